@@ -16,6 +16,7 @@ BuildRequires:  pkgconfig(dbus-1) >= 1.8.0
 BuildRequires:  pkgconfig(libpulse)
 BuildRequires:  pkgconfig(gstreamer-1.0)
 BuildRequires:  pkgconfig(gstreamer-controller-1.0)
+BuildRequires:  pkgconfig(gstreamer-app-1.0)
 BuildRequires:  pkgconfig(gio-2.0)
 BuildRequires:  pkgconfig(gobject-2.0)
 BuildRequires:  pkgconfig(gthread-2.0)
@@ -111,6 +112,7 @@ ln -s ../ngfd.service %{buildroot}%{_userunitdir}/actdead-session.target.wants/
 %{_libdir}/ngf/libngfd_devicelock.so
 %{_libdir}/ngf/libngfd_route.so
 %{_libdir}/ngf/libngfd_null.so
+%{_libdir}/ngf/libngfd_socket.so
 %{_userunitdir}/ngfd.service
 %{_userunitdir}/user-session.target.wants/ngfd.service
 %{_userunitdir}/actdead-session.target.wants/ngfd.service
@@ -26,6 +26,10 @@
 typedef struct _NContext NContext;
 
 #include <ngf/value.h>
+#include <ngf/proplist.h>
+
+/** Immutable view of the context values at one point in time. */
+typedef struct _NContextSnapshot NContextSnapshot;
 
 /** Context value change callback function */
 typedef void (*NContextValueChangeFunc) (NContext *context,
@@ -34,9 +38,28 @@ typedef void (*NContextValueChangeFunc) (NContext *context,
                                          const NValue *new_value,
                                          void *userdata);
 
+/** Single value change delivered to NContextChangesFunc. */
+typedef struct _NContextChange
+{
+    const char   *key;          /**< Changed key. */
+    const NValue *old_value;    /**< Value before the change, or NULL. */
+    const NValue *new_value;    /**< Current value. */
+} NContextChange;
+
+/** Context changes callback function. Called once for all the values
+ *  changed by a single n_context_set_value or transaction commit. */
+typedef void (*NContextChangesFunc) (NContext *context,
+                                     const NContextChange *changes,
+                                     unsigned int num_changes,
+                                     void *userdata);
+
 /**
  * Change or add key/value pair to context.
  *
+ * If a transaction is open the change is only applied by
+ * n_context_commit, until then the previous value is returned
+ * by n_context_get_value.
+ *
  * @param context NContext structure.
  * @param key Key.
  * @param value Values as NValue type.
@@ -44,6 +67,44 @@ typedef void (*NContextValueChangeFunc) (NContext *context,
 void          n_context_set_value                (NContext *context, const char *key,
                                                   NValue *value);
 
+/**
+ * Set string value for key, unless the key already has an equal string
+ * value. An unchanged value is neither allocated nor broadcast. Inside a
+ * transaction the value is compared to the one pending for the key.
+ *
+ * @param context NContext structure.
+ * @param key Key.
+ * @param value String value, copied.
+ * @return TRUE if the value changed.
+ */
+int           n_context_set_string_if_changed    (NContext *context, const char *key,
+                                                  const char *value);
+
+/**
+ * Set unsigned integer value for key, unless the key already has an equal
+ * unsigned integer value. See n_context_set_string_if_changed.
+ *
+ * @param context NContext structure.
+ * @param key Key.
+ * @param value Unsigned integer value.
+ * @return TRUE if the value changed.
+ */
+int           n_context_set_uint_if_changed      (NContext *context, const char *key,
+                                                  guint value);
+
+/**
+ * Restore the value of key cached by an earlier run and keep caching
+ * its changes. Sources whose initial state arrives asynchronously call
+ * this at load, so that the context has a best guess until the real
+ * state is known. Nothing is restored if the key already has a value
+ * or no cache is configured.
+ *
+ * @param context NContext structure.
+ * @param key Key.
+ * @return TRUE if a cached value was restored.
+ */
+int           n_context_restore_value            (NContext *context, const char *key);
+
 /**
  * Get value by key from context.
  *
@@ -53,11 +114,47 @@ void          n_context_set_value                (NContext *context, const char
  */
 const NValue* n_context_get_value                (NContext *context, const char *key);
 
+/**
+ * Get value by interned key from context.
+ *
+ * @param context NContext structure.
+ * @param atom Key atom, @see n_atom_intern
+ * @return Value as NValue or NULL if no value associated with key is found.
+ */
+const NValue* n_context_get_value_by_atom        (NContext *context, NAtom atom);
+
+/**
+ * Subscribe callback function to a key, to a family of keys or to all
+ * keys. A key ending with ".*" subscribes to every key starting with
+ * the part before the "*", for example "profile.*" to all the profile
+ * keys, but not to "profile" itself. Only the subscribers of the changed
+ * key are notified, the subscribers of the single key first.
+ *
+ * @param context NContext structure.
+ * @param key Key, prefix ending with ".*", or NULL or "*" for all keys.
+ * @param callback Callback function.
+ * @param userdata Userdata.
+ * @return Subscription id for n_context_unsubscribe, or 0 on failure.
+ * @see NContextValueChangeFunc
+ */
+unsigned int  n_context_subscribe                (NContext *context, const char *key,
+                                                  NContextValueChangeFunc callback,
+                                                  void *userdata);
+
+/**
+ * Remove a subscription made with n_context_subscribe, in constant time.
+ * The callback may remove its own subscription while it is notified.
+ *
+ * @param context NContext structure.
+ * @param id Subscription id.
+ */
+void          n_context_unsubscribe              (NContext *context, unsigned int id);
+
 /**
  * Subscribe callback function to key in context structure
  *
  * @param context NContext structure.
- * @param key Key.
+ * @param key Key, see n_context_subscribe.
  * @param callback Callback function.
  * @param userdata Userdata.
  * @return TRUE is successful.
@@ -77,4 +174,116 @@ int           n_context_subscribe_value_change   (NContext *context, const char
 void          n_context_unsubscribe_value_change (NContext *context, const char *key,
                                                   NContextValueChangeFunc callback);
 
+/**
+ * Begin a context transaction. Values set until the matching
+ * n_context_commit are applied together, and subscribers are notified
+ * only once per changed key. Transactions may be nested, changes are
+ * applied when the outermost transaction is committed.
+ *
+ * @param context NContext structure.
+ */
+void          n_context_begin                    (NContext *context);
+
+/**
+ * Commit a context transaction started with n_context_begin. All the
+ * values are applied before any subscriber is notified, with the old
+ * value being the one before the transaction and the new value the
+ * last one set.
+ *
+ * @param context NContext structure.
+ */
+void          n_context_commit                   (NContext *context);
+
+/**
+ * Subscribe callback function to all context changes. The callback
+ * receives all the changes of a transaction in one call.
+ *
+ * @param context NContext structure.
+ * @param callback Callback function.
+ * @param userdata Userdata.
+ * @return TRUE is successful.
+ * @see NContextChangesFunc
+ */
+int           n_context_subscribe_changes        (NContext *context,
+                                                  NContextChangesFunc callback,
+                                                  void *userdata);
+
+/**
+ * Unsubscribe changes callback
+ *
+ * @param context NContext structure.
+ * @param callback Callback function, @see NContextChangesFunc
+ */
+void          n_context_unsubscribe_changes      (NContext *context,
+                                                  NContextChangesFunc callback);
+
+/**
+ * Start reading snapshots of the context. Snapshots are only published
+ * while there are readers, the first one publishes a snapshot of the
+ * current values. Must be called from the main thread, e.g. when the
+ * plugin reading snapshots from its threads is initialized.
+ * @param context NContext structure.
+ */
+void          n_context_add_snapshot_reader      (NContext *context);
+
+/**
+ * Stop reading snapshots, the last reader releases the published one.
+ * Must be called from the main thread.
+ * @param context NContext structure.
+ */
+void          n_context_remove_snapshot_reader   (NContext *context);
+
+/**
+ * Get the latest snapshot of the context. While there are readers, a new
+ * snapshot is published after each change, or each transaction, before
+ * the subscribers are notified. The snapshot never changes, so it can be
+ * read from any thread without locking, for example by worker jobs. This
+ * function and the snapshot reference functions may be called from any
+ * thread.
+ * @param context NContext structure.
+ * @return Snapshot, release with n_context_snapshot_unref, or NULL if
+ * there are no readers.
+ * @see n_context_add_snapshot_reader
+ */
+NContextSnapshot* n_context_get_snapshot         (NContext *context);
+
+/**
+ * Add a reference to snapshot.
+ * @param snapshot Snapshot.
+ * @return The snapshot.
+ */
+NContextSnapshot* n_context_snapshot_ref         (NContextSnapshot *snapshot);
+
+/**
+ * Release a reference to snapshot, the last one frees it.
+ * @param snapshot Snapshot.
+ */
+void          n_context_snapshot_unref           (NContextSnapshot *snapshot);
+
+/**
+ * Get value by key from a snapshot.
+ * @param snapshot Snapshot.
+ * @param key Key.
+ * @return Value as NValue, valid as long as the snapshot, or NULL.
+ */
+const NValue* n_context_snapshot_get_value       (const NContextSnapshot *snapshot,
+                                                  const char *key);
+
+/**
+ * Get value by interned key from a snapshot.
+ * @param snapshot Snapshot.
+ * @param atom Key atom, @see n_atom_intern
+ * @return Value as NValue, valid as long as the snapshot, or NULL.
+ */
+const NValue* n_context_snapshot_get_value_by_atom (const NContextSnapshot *snapshot,
+                                                    NAtom atom);
+
+/**
+ * Get the context generation the snapshot was taken at. Snapshots with
+ * equal generations have equal values.
+ * @param snapshot Snapshot.
+ * @return Generation.
+ */
+unsigned int  n_context_snapshot_get_generation  (const NContextSnapshot *snapshot);
+
 #endif /* N_CONTEXT_H */
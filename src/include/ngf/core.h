@@ -48,6 +48,28 @@ NContext*        n_core_get_context  (NCore *core);
  */
 GList*           n_core_get_requests (NCore *core);
 
+/**
+ * Look up an active request by its identifier
+ *
+ * @param core Core.
+ * @param id Request identifier, see n_request_get_id.
+ * @return Active request with the identifier or NULL if there is none.
+ */
+NRequest*        n_core_lookup_request (NCore *core, guint id);
+
+/**
+ * Hint that a request for an event is likely to follow shortly. The
+ * event is resolved against the current context like a played request
+ * and the capable sinks with a prewarm function get a chance to set up
+ * their resources in advance. Nothing is played.
+ *
+ * @param core Core.
+ * @param event Event name of the expected request.
+ * @param properties Expected request properties or NULL.
+ */
+void             n_core_prewarm_event (NCore *core, const char *event,
+                                       const NProplist *properties);
+
 /**
  * Get list of registered sinks
  *
@@ -64,6 +86,84 @@ NSinkInterface** n_core_get_sinks    (NCore *core);
  */
 GList*           n_core_get_events   (NCore *core);
 
+/**
+ * Get generation of the event list. The generation changes whenever
+ * events are added or removed, e.g. when the events are reloaded, so
+ * data derived from the events is valid as long as it stays the same.
+ *
+ * @param core Core.
+ * @return Event list generation.
+ */
+guint            n_core_get_events_generation (NCore *core);
+
+/**
+ * Get statistics of the request to event resolution cache.
+ *
+ * @param core Core.
+ * @param hits Number of requests resolved from the cache, or NULL.
+ * @param misses Number of requests that needed full evaluation, or NULL.
+ * @param size Number of entries currently in the cache, or NULL.
+ */
+void             n_core_get_event_cache_stats (NCore *core, guint *hits,
+                                               guint *misses, guint *size);
+
+/**
+ * Declare a key a filter_sinks hook callback depends on
+ *
+ * Capable sinks are resolved once per event and reused for following
+ * requests as long as the declared keys stay the same. The filter_sinks
+ * hook is only fired when the sinks are resolved, so its callbacks need
+ * to declare every key they look at. While any callback connected to the
+ * hook has not declared its keys, sinks are resolved for every request.
+ *
+ * @param core Core.
+ * @param callback Callback connected, or to be connected, to the hook.
+ * @param userdata Userdata the callback is connected with.
+ * @param key Request property key, or context key prefixed with "context@".
+ *            NULL declares that the callback depends on no (other) keys.
+ * @param value_matters TRUE if the value matters, FALSE if only presence of the key matters.
+ * @see n_sink_interface_add_plan_key
+ */
+void             n_core_add_sink_plan_key (NCore *core, NHookCallback callback,
+                                           void *userdata, const char *key,
+                                           int value_matters);
+
+/**
+ * Get statistics of the per event sink plan cache.
+ *
+ * @param core Core.
+ * @param hits Number of requests that used a cached sink plan, or NULL.
+ * @param misses Number of requests that resolved the sinks, or NULL.
+ */
+void             n_core_get_sink_plan_stats (NCore *core, guint *hits, guint *misses);
+
+/**
+ * Restrict the properties kept from incoming requests
+ *
+ * Input interfaces drop other keys while decoding a request, saving the
+ * work for properties that would be dropped later anyway. The last call
+ * replaces the previous keys.
+ *
+ * @param core Core.
+ * @param keys NULL terminated array of keys, or NULL to keep all keys.
+ */
+void             n_core_set_request_keys  (NCore *core, const char **keys);
+
+/**
+ * Intern a property key of an incoming request
+ *
+ * Keys declared by an event definition, key type or plugin are looked
+ * up. While all keys are kept, other keys are interned too, up to a
+ * limit after which they are dropped; keys under "sound.stream." have a
+ * limit of their own.
+ *
+ * @param core Core.
+ * @param key Property key.
+ * @return Atom for the key, or 0 if the key is not kept.
+ * @see n_core_set_request_keys
+ */
+NAtom            n_core_intern_request_key (NCore *core, const char *key);
+
 /**
  * Connect callback function to hook
  *
@@ -91,4 +191,36 @@ int              n_core_connect      (NCore *core, NCoreHook hook, int priority,
  */
 void             n_core_disconnect   (NCore *core, NCoreHook hook, NHookCallback callback, void *userdata);
 
+/**
+ * Enable or disable timing of hook callbacks
+ *
+ * While enabled, the number of calls and the cumulative and maximum
+ * duration of every hook callback are collected. Timing can also be
+ * enabled with the "hook-timing" key in the general section of the
+ * configuration.
+ *
+ * @param core Core.
+ * @param enabled TRUE to enable timing.
+ */
+void             n_core_set_hook_timing (NCore *core, int enabled);
+
+/**
+ * Log the collected hook callback statistics
+ *
+ * @param core Core.
+ */
+void             n_core_dump_hook_stats (NCore *core);
+
+/**
+ * Log the latency timelines of active and recently finished requests
+ *
+ * Every timeline lists the time each request stage was reached relative
+ * to the moment the request was received, and how long every sink took
+ * to prepare, synchronize and play. Finished requests are only listed
+ * when timeline-history is set in the configuration.
+ *
+ * @param core Core.
+ */
+void             n_core_dump_request_timelines (NCore *core);
+
 #endif /* N_CORE_H */
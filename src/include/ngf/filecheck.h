@@ -0,0 +1,56 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+#ifndef N_FILECHECK_H
+#define N_FILECHECK_H
+
+#include <glib.h>
+#include <ngf/core.h>
+
+/* Sound files referenced by the events and the profile are checked in
+ * a worker thread and the result is cached, so that a request is not
+ * sent to the sinks with a file that can not be played. The directories
+ * of the checked files are watched and a changed file is checked again.
+ * The keys holding file paths are listed in file-check-keys of the
+ * general section of the configuration. */
+
+/** State of a checked file. */
+typedef enum _NFileState
+{
+    N_FILE_STATE_UNKNOWN = 0,   /**< Not checked yet. */
+    N_FILE_STATE_VALID,         /**< Regular, readable and not empty. */
+    N_FILE_STATE_INVALID        /**< Missing, unreadable or empty. */
+} NFileState;
+
+/**
+ * Get the state of a file
+ *
+ * A file not checked before is checked in the background and
+ * N_FILE_STATE_UNKNOWN is returned until the check is done. Only
+ * absolute paths are checked.
+ *
+ * @param core Core.
+ * @param path Absolute path of the file.
+ * @return State of the file.
+ */
+NFileState n_core_check_file (NCore *core, const char *path);
+
+#endif /* N_FILECHECK_H */
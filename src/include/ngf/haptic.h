@@ -53,6 +53,11 @@
 
 #define N_HAPTIC_EFFECT_DEFAULT   "default"
 
+/* Context key of the touch vibration level of the current profile. Level
+ * 0 disables touch feedback, plugins may scale the intensity of touch
+ * effects by the other levels. */
+#define N_HAPTIC_VIBRA_LEVEL_KEY  "profile.current.touchscreen.vibration.level"
+
 /* System-defined haptic effects. Preferably all plugins implementing
  * haptic functionality should be able to handle all the effects
  * listed here. Strictly speaking only mandatory one is "default".
@@ -104,6 +109,32 @@
  */
 int n_haptic_can_handle (NSinkInterface *iface, NRequest *request);
 
+/**
+ * Filter haptic like n_haptic_can_handle, with the settings and call
+ * state taken from a context snapshot
+ *
+ * As the snapshot doesn't change, this can be used outside of the main
+ * loop, for example in a worker job deciding on a request prepared on
+ * the main loop.
+ *
+ * @param request Pointer to a NRequest
+ * @param snapshot Context snapshot, @see n_context_get_snapshot and
+ * n_context_add_snapshot_reader
+ * @return FALSE if the plugin should not handle this event, TRUE otherwise
+ */
+int n_haptic_can_handle_snapshot (NRequest *request, const NContextSnapshot *snapshot);
+
+/**
+ * Declare the keys n_haptic_can_handle depends on
+ *
+ * Plugins using n_haptic_can_handle should call this from their
+ * initialize function, in addition to declaring their own keys
+ * with n_sink_interface_add_plan_key.
+ *
+ * @param iface Pointer to a NSinkInterface
+ */
+void n_haptic_add_plan_keys (NSinkInterface *iface);
+
 /* Each haptic type belongs to a haptic class.
  *
  * Based on the haptic class the haptic event may be filtered away
@@ -36,21 +36,46 @@ typedef enum _NHookPriority
     N_HOOK_PRIORITY_FIRST   = 100
 } NHookPriority;
 
-/** Internal hook structure. */
-typedef struct _NHook
-{
-    gchar *name;
-    GList *slots;
-} NHook;
+typedef struct _NHook NHook;
 
 /** Hook callback function */
 typedef void (*NHookCallback) (NHook *hook, void *data, void *userdata);
 
+/** Callback connected to a hook. */
+typedef struct _NHookSlot
+{
+    int            priority;
+    NHookCallback  callback;
+    void          *userdata;
+    gboolean       removed;     /**< disconnected while the hook was firing */
+
+    /* statistics, collected while timing is enabled */
+    guint          calls;       /**< number of calls */
+    gint64         total_us;    /**< cumulative duration in microseconds */
+    gint64         max_us;      /**< longest call in microseconds */
+} NHookSlot;
+
+/** Internal hook structure. */
+struct _NHook
+{
+    gchar      *name;
+    NHookSlot **slots;          /* slots sorted by priority */
+    guint       num_slots;
+    guint       firing;         /* nested n_hook_fire calls */
+    GSList     *retired;        /* slots and arrays released after firing */
+    gboolean    timing;         /* collect slot statistics */
+};
+
 /** Initializes hook structure
  * @param hook Hook.
  */
 void n_hook_init       (NHook *hook);
 
+/** Releases all slots of the hook
+ * @param hook Hook.
+ */
+void n_hook_clear      (NHook *hook);
+
 /** Connect callback function to hook
  * @param hook Hook.
  * @param priority Priority of the callback function.
@@ -76,4 +101,11 @@ void n_hook_disconnect (NHook *hook, NHookCallback callback, void *userdata);
  */
 int  n_hook_fire       (NHook *hook, void *data);
 
+/** Enables or disables collecting call counts and durations of the slots.
+ * Enabling resets the collected statistics.
+ * @param hook Hook.
+ * @param enabled TRUE to enable timing.
+ */
+void n_hook_set_timing (NHook *hook, int enabled);
+
 #endif /* N_HOOK_H */
@@ -33,7 +33,12 @@ typedef enum _NLogTarget
     N_LOG_TARGET_STDOUT,
     
     /** Direct logging to syslog */
-    N_LOG_TARGET_SYSLOG
+    N_LOG_TARGET_SYSLOG,
+
+    /** Store messages unformatted to an in-memory ring buffer. Buffered
+     *  messages are formatted and written to the previous target by
+     *  n_log_dump. */
+    N_LOG_TARGET_BUFFER
 } NLogTarget;
 
 /** Logging levels. Selected level also includes all messages from higher levels */
@@ -77,6 +82,23 @@ void n_log_set_target (NLogTarget target);
  */
 NLogTarget n_log_get_target ();
 
+/** Format and write buffered messages, oldest first, to the target that
+ * was in use before N_LOG_TARGET_BUFFER. Messages overwritten before
+ * they were dumped are reported as lost.
+ * @param max_messages Maximum number of messages to write, 0 for all
+ * @return Number of messages written
+ */
+unsigned int n_log_dump (unsigned int max_messages);
+
+/** Dump all the buffered messages in batches from the main loop when it
+ * is idle, so that dumping does not hold up other work.
+ */
+void n_log_schedule_dump ();
+
+/** Get number of buffered messages not dumped yet
+ */
+unsigned int n_log_get_buffered ();
+
 /** Log message. Use convenience functions to send actual messages.
  * @param level Logging level
  * @param function Function to which the message is related to
@@ -86,24 +108,33 @@ NLogTarget n_log_get_target ();
  */
 void n_log_message    (NLogLevel level, const char *function, int line, const char *fmt, ...);
 
+/** Lowest logging level compiled in, as a NLogLevel value. Messages
+ *  below it are dropped by the compiler, see --with-log-level. */
+#ifndef N_LOG_LEVEL_MIN
+#define N_LOG_LEVEL_MIN 0
+#endif
+
+/** TRUE if messages of the level are logged. Use to skip work done only
+ *  for log messages, like converting values to strings. */
+#define N_LOG_ENABLED(level) \
+    ((level) >= N_LOG_LEVEL_MIN && (level) >= n_log_get_level ())
+
+#define N_LOG_AT_LEVEL(level, ...) \
+    do { if ((level) >= N_LOG_LEVEL_MIN) n_log_message ((level), (const char*) __FUNCTION__, __LINE__, __VA_ARGS__); } while(0)
+
 /** Log function enter message */
-#define N_ENTER(...) \
-    do {  n_log_message (N_LOG_LEVEL_ENTER, (const char*) __FUNCTION__, __LINE__, __VA_ARGS__); } while(0)
-    
+#define N_ENTER(...)   N_LOG_AT_LEVEL (N_LOG_LEVEL_ENTER, __VA_ARGS__)
+
 /** Log debug message */
-#define N_DEBUG(...) \
-    do { n_log_message (N_LOG_LEVEL_DEBUG, (const char*) __FUNCTION__, __LINE__, __VA_ARGS__); } while(0)
+#define N_DEBUG(...)   N_LOG_AT_LEVEL (N_LOG_LEVEL_DEBUG, __VA_ARGS__)
 
 /** Log info message */
-#define N_INFO(...) \
-    do { n_log_message (N_LOG_LEVEL_INFO, (const char*) __FUNCTION__, __LINE__, __VA_ARGS__); } while(0)
+#define N_INFO(...)    N_LOG_AT_LEVEL (N_LOG_LEVEL_INFO, __VA_ARGS__)
 
 /** Log warning message */
-#define N_WARNING(...) \
-    do { n_log_message (N_LOG_LEVEL_WARNING, (const char*) __FUNCTION__, __LINE__, __VA_ARGS__); } while(0)
+#define N_WARNING(...) N_LOG_AT_LEVEL (N_LOG_LEVEL_WARNING, __VA_ARGS__)
 
 /** Log error message */
-#define N_ERROR(...) \
-    do { n_log_message (N_LOG_LEVEL_ERROR, (const char*) __FUNCTION__, __LINE__, __VA_ARGS__); } while(0)
+#define N_ERROR(...)   N_LOG_AT_LEVEL (N_LOG_LEVEL_ERROR, __VA_ARGS__)
 
 #endif /* N_LOG_H */
@@ -0,0 +1,97 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_MEMORY_H
+#define N_MEMORY_H
+
+#include <glib.h>
+#include <ngf/core.h>
+
+/* Memory controller of the core. Caches that keep data between requests
+ * register here and report their size after every change. The sizes are
+ * tracked against a global budget and reported as the gauges
+ * memory.<name> (peak in memory.<name>.max) and memory.total. When the
+ * budget is exceeded and on system memory pressure, the caches are asked
+ * to trim themselves, the lowest priority first, and the freed heap is
+ * returned to the system. After the daemon has been idle for a while, the
+ * caches below N_MEMORY_PRIORITY_HIGH are emptied.
+ * All functions are called from the main loop. */
+
+/** Memory controller. */
+typedef struct _NMemory NMemory;
+
+/** Cache registered to the memory controller. */
+typedef struct _NMemoryCache NMemoryCache;
+
+/** Cache priorities, caches of lower priority are trimmed first. */
+typedef enum _NMemoryPriority
+{
+    N_MEMORY_PRIORITY_LOW     = -10,
+    N_MEMORY_PRIORITY_DEFAULT = 0,
+    N_MEMORY_PRIORITY_HIGH    = 10
+} NMemoryPriority;
+
+/**
+ * Trim callback
+ * The cache drops entries until it uses at most target bytes, or as
+ * close to it as the entries in use allow, and reports the new size
+ * with n_memory_cache_set_size.
+ * @param target Size the cache should shrink to in bytes.
+ * @param userdata Userdata given when the cache was added.
+ */
+typedef void (*NMemoryTrimFunc) (gsize target, gpointer userdata);
+
+/**
+ * Get memory controller of the core
+ * @param core Core.
+ * @return Memory controller.
+ */
+NMemory*      n_core_get_memory       (NCore *core);
+
+/**
+ * Register a cache
+ * @param memory Memory controller.
+ * @param name Name of the cache, reported as memory.name.
+ * @param priority Priority of the cache, see NMemoryPriority.
+ * @param trim Trim callback.
+ * @param userdata Userdata passed to the callback.
+ * @return Cache, removed with n_memory_remove_cache.
+ */
+NMemoryCache* n_memory_add_cache      (NMemory *memory, const char *name, int priority,
+                                       NMemoryTrimFunc trim, gpointer userdata);
+
+/**
+ * Unregister a cache
+ * The size of the cache is no longer counted, the gauge keeps the peak.
+ * @param memory Memory controller.
+ * @param cache Cache.
+ */
+void          n_memory_remove_cache   (NMemory *memory, NMemoryCache *cache);
+
+/**
+ * Report size of a cache
+ * When the total size exceeds the budget, caches are trimmed from the
+ * main loop afterwards, never from within the call.
+ * @param cache Cache, may be NULL.
+ * @param size Bytes used by the cache.
+ */
+void          n_memory_cache_set_size (NMemoryCache *cache, gsize size);
+
+#endif /* N_MEMORY_H */
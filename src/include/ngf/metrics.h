@@ -0,0 +1,226 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_METRICS_H
+#define N_METRICS_H
+
+#include <glib.h>
+#include <ngf/core.h>
+
+/* Runtime metrics. Metrics are registered once, typically when the core
+ * or a plugin initializes, and updated from the main loop afterwards.
+ * Updating a metric never allocates memory or formats strings, so the
+ * metrics can stay enabled in production builds. All update functions
+ * accept NULL metrics, in which case the update is ignored. */
+
+/** Number of buckets in a histogram. Bucket 0 counts values <= 0, bucket
+    n counts values in range [2^(n-1), 2^n) and the last bucket counts
+    values that do not fit in the other buckets. */
+#define N_METRIC_HISTOGRAM_BUCKETS (26)
+
+/** Maximum number of distinct labels in a counter family. Further labels
+    are counted under N_METRIC_FAMILY_OTHER. */
+#define N_METRIC_FAMILY_MAX_LABELS (128)
+#define N_METRIC_FAMILY_OTHER      "other"
+
+/** Number of labels kept by a ranking. */
+#define N_METRIC_RANKING_SIZE      (8)
+
+/** Maximum length of a ranking label including the terminating zero.
+    Longer labels are shortened from the beginning. */
+#define N_METRIC_RANKING_LABEL_MAX (96)
+
+/** Internal metrics registry. */
+typedef struct _NMetrics NMetrics;
+
+/** Monotonically increasing counter. */
+typedef struct _NMetricCounter NMetricCounter;
+
+/** Value which can go up and down. Also records the high-water mark. */
+typedef struct _NMetricGauge NMetricGauge;
+
+/** Distribution of values, e.g. latencies in microseconds. */
+typedef struct _NMetricHistogram NMetricHistogram;
+
+/** Set of counters with the same name, distinguished by a label. */
+typedef struct _NMetricFamily NMetricFamily;
+
+/** Labels with the largest values seen, e.g. the slowest sound files. */
+typedef struct _NMetricRanking NMetricRanking;
+
+/**
+ * Callback for n_metrics_foreach
+ *
+ * @param name Name of the value.
+ * @param value Current value.
+ * @param userdata Userdata.
+ */
+typedef void (*NMetricsFunc) (const char *name, guint64 value, void *userdata);
+
+/**
+ * Get metrics registry of the core
+ *
+ * @param core Core.
+ * @return Metrics registry.
+ */
+NMetrics*         n_core_get_metrics       (NCore *core);
+
+/**
+ * Register a counter
+ *
+ * If a counter with the same name already exists, it is returned.
+ *
+ * @param metrics Metrics registry.
+ * @param name Name of the counter.
+ * @return Counter or NULL if the name is used by a metric of another type.
+ */
+NMetricCounter*   n_metrics_add_counter    (NMetrics *metrics, const char *name);
+
+/**
+ * Register a gauge
+ *
+ * @param metrics Metrics registry.
+ * @param name Name of the gauge. The high-water mark is reported as name.max.
+ * @return Gauge or NULL if the name is used by a metric of another type.
+ */
+NMetricGauge*     n_metrics_add_gauge      (NMetrics *metrics, const char *name);
+
+/**
+ * Register a histogram
+ *
+ * @param metrics Metrics registry.
+ * @param name Name of the histogram. Count, sum, maximum and the non-empty
+ *             buckets are reported as name.count, name.sum, name.max and
+ *             name.le_0, name.lt_N (N being the exclusive upper limit of the
+ *             bucket) and name.inf.
+ * @return Histogram or NULL if the name is used by a metric of another type.
+ */
+NMetricHistogram* n_metrics_add_histogram  (NMetrics *metrics, const char *name);
+
+/**
+ * Register a rolling histogram
+ *
+ * A rolling histogram only reports recent values. Values are collected
+ * in generations of window values and the current and the previous
+ * generation are reported, so between window and 2 * window of the most
+ * recent values are included. Values are added with n_metric_histogram_add().
+ *
+ * @param metrics Metrics registry.
+ * @param name Name of the histogram, reported as with n_metrics_add_histogram().
+ * @param window Number of values in a generation. 0 makes the histogram
+ *               cumulative.
+ * @return Histogram or NULL if the name is used by a metric of another type.
+ */
+NMetricHistogram* n_metrics_add_rolling_histogram (NMetrics *metrics, const char *name,
+                                                   guint window);
+
+/**
+ * Register a counter family
+ *
+ * @param metrics Metrics registry.
+ * @param name Name of the family. Counters are reported as name.label.
+ * @return Counter family or NULL if the name is used by a metric of another type.
+ */
+NMetricFamily*    n_metrics_add_family     (NMetrics *metrics, const char *name);
+
+/**
+ * Register a ranking
+ *
+ * @param metrics Metrics registry.
+ * @param name Name of the ranking. The labels are reported as name.label,
+ *             the label with the largest value first.
+ * @return Ranking or NULL if the name is used by a metric of another type.
+ */
+NMetricRanking*   n_metrics_add_ranking    (NMetrics *metrics, const char *name);
+
+/**
+ * Increment counter by one
+ *
+ * @param counter Counter.
+ */
+void              n_metric_counter_inc     (NMetricCounter *counter);
+
+/**
+ * Increment counter
+ *
+ * @param counter Counter.
+ * @param value Amount to add.
+ */
+void              n_metric_counter_add     (NMetricCounter *counter, guint64 value);
+
+/**
+ * Set gauge value
+ *
+ * @param gauge Gauge.
+ * @param value New value.
+ */
+void              n_metric_gauge_set       (NMetricGauge *gauge, guint64 value);
+
+/**
+ * Add value to histogram
+ *
+ * @param histogram Histogram.
+ * @param value Value to add.
+ */
+void              n_metric_histogram_add   (NMetricHistogram *histogram, gint64 value);
+
+/**
+ * Increment counter of a label by one
+ *
+ * The counter of the label is created when the label is seen for the
+ * first time, following increments of the same label do not allocate.
+ *
+ * @param family Counter family.
+ * @param label Label.
+ */
+void              n_metric_family_inc      (NMetricFamily *family, const char *label);
+
+/**
+ * Record value of a label in a ranking
+ * Every label keeps the largest value recorded for it. A label not in
+ * the ranking replaces the label with the smallest value if its value
+ * is larger, once the ranking holds N_METRIC_RANKING_SIZE labels.
+ * @param ranking Ranking.
+ * @param label Label.
+ * @param value Value.
+ */
+void              n_metric_ranking_record  (NMetricRanking *ranking, const char *label,
+                                            guint64 value);
+
+/**
+ * Call function for every reported value
+ *
+ * Values are reported in the order the metrics were registered.
+ *
+ * @param metrics Metrics registry.
+ * @param func Callback.
+ * @param userdata Userdata passed to the callback.
+ */
+void              n_metrics_foreach        (NMetrics *metrics, NMetricsFunc func,
+                                            void *userdata);
+
+/**
+ * Log all reported values
+ *
+ * @param metrics Metrics registry.
+ */
+void              n_metrics_dump           (NMetrics *metrics);
+
+#endif /* N_METRICS_H */
@@ -67,30 +67,50 @@ void             n_plugin_register_sink  (NPlugin *plugin, const NSinkInterfaceD
  */
 void             n_plugin_register_input (NPlugin *plugin, const NInputInterfaceDecl *decl);
 
+/** Name of a plugin entry point. A plugin compiled with N_PLUGIN_BUILTIN
+ * defined to its name, e.g. -DN_PLUGIN_BUILTIN=dbus, gets entry points of
+ * its own, n_plugin_dbus__load and so on, so that it can be linked into
+ * ngfd together with other built-in plugins. */
+#ifdef N_PLUGIN_BUILTIN
+#define N_PLUGIN_SYMBOL(p_sym)                  N_PLUGIN_SYMBOL_ID (N_PLUGIN_BUILTIN, p_sym)
+#define N_PLUGIN_SYMBOL_ID(p_id, p_sym)         N_PLUGIN_SYMBOL_PASTE (p_id, p_sym)
+#define N_PLUGIN_SYMBOL_PASTE(p_id, p_sym)      n_plugin_##p_id##__##p_sym
+#else
+#define N_PLUGIN_SYMBOL(p_sym)                  n_plugin__##p_sym
+#endif
+
 /** Macro to define plugin name */
 #define N_PLUGIN_NAME(p_name)                   \
-    const char* n_plugin__get_name () {         \
+    const char* N_PLUGIN_SYMBOL (get_name) () { \
         return p_name;                          \
     }
 
 /** Macro to define plugin description */
 #define N_PLUGIN_DESCRIPTION(p_desc)            \
-    const char* n_plugin__get_desc () {         \
+    const char* N_PLUGIN_SYMBOL (get_desc) () { \
         return p_desc;                          \
     }
 
 /** Macro to define plugin version */
 #define N_PLUGIN_VERSION(p_version)             \
-    const char* n_plugin__get_version () {      \
+    const char* N_PLUGIN_SYMBOL (get_version) () { \
         return p_version;                       \
     }
 
 /** Plugin loading function. Plugin declaration structure should be initialized here. */
 #define N_PLUGIN_LOAD(p_plugin)                 \
-    int n_plugin__load (NPlugin* p_plugin)
+    int N_PLUGIN_SYMBOL (load) (NPlugin* p_plugin)
 
 /** Plugin unload function. Plugin memory releasing should be done here. */
 #define N_PLUGIN_UNLOAD(p_plugin)               \
-    void n_plugin__unload (NPlugin* p_plugin)
+    void N_PLUGIN_SYMBOL (unload) (NPlugin* p_plugin)
+
+/** Optional plugin reload function. Called with the new parameters when
+ * the plugin settings have changed on a reload. The parameters returned
+ * by n_plugin_get_params are replaced with the new ones after the
+ * function returns TRUE, so pointers to the previous values must not be
+ * kept. Return FALSE to keep the previous parameters. */
+#define N_PLUGIN_RELOAD(p_plugin, p_params)     \
+    int N_PLUGIN_SYMBOL (reload) (NPlugin* p_plugin, const NProplist* p_params)
 
 #endif /* N_PLUGIN_H */
@@ -27,6 +27,9 @@ typedef struct _NProplist NProplist;
 
 #include <ngf/value.h>
 
+/** Interned proplist key. Zero is never a valid atom. */
+typedef guint32 NAtom;
+
 /** Proplist manipulation function definition. Used in n_proplist_foreach
  * @param key Proplist key
  * @param value Value associated with key
@@ -39,12 +42,23 @@ typedef void (*NProplistFunc) (const char *key, const NValue *value, gpointer us
  */
 NProplist*  n_proplist_new         ();
 
-/** Create copy of existing proplist
+/** Create copy of existing proplist. Entries are shared copy-on-write,
+ * so copying is cheap until either of the proplists is modified.
  * @param source Source proplist
  * @return Copy of source proplist
  */
 NProplist*  n_proplist_copy        (const NProplist *source);
 
+/** Create proplist with keys of overlay on top of keys of base. Result
+ * is same as copying base and merging overlay to it, but neither of the
+ * proplists is copied until the result is modified, and then only the
+ * overlay keys are.
+ * @param base Base proplist
+ * @param overlay Proplist whose keys override the keys of base
+ * @return New proplist
+ */
+NProplist*  n_proplist_new_layered (const NProplist *base, const NProplist *overlay);
+
 /** Create copy of existing proplist, copying only selected keys.
  * @param source Source proplist
  * @param keys Keys to be copied as GList
@@ -103,20 +117,58 @@ gboolean    n_proplist_has_key     (const NProplist *proplist, const char *key);
  */
 gboolean    n_proplist_match_exact (const NProplist *a, const NProplist *b);
 
-/** Insert or update key/value pair in proplist
+/** Insert or update key/value pair in proplist. The key is interned,
+ * so keys received from clients should be resolved with
+ * n_core_intern_request_key and set by atom instead.
  * @param proplist Proplist
  * @param key Key
  * @param value Value
  */
 void        n_proplist_set         (NProplist *proplist, const char *key, const NValue *value);
 
-/** Get value from proplist
+/** Get value from proplist. Value may be shared with copies of the
+ * proplist and must not be modified.
  * @param proplist Proplist
  * @param key Key
  * @return Value of the key as NValue or NULL if empty
  */
 NValue*     n_proplist_get         (const NProplist *proplist, const char *key);
 
+/** Intern key string. The same key always maps to the same atom, so
+ * keys used on hot paths can be resolved once at load time and looked
+ * up with a plain integer compare afterwards. Interned strings are never
+ * freed.
+ * @param key Proplist key
+ * @return Atom for key, or 0 if key is NULL
+ */
+NAtom       n_atom_intern          (const char *key);
+
+/** Look up the atom of a key without interning it
+ * @param key Proplist key
+ * @return Atom for key, or 0 if the key has never been interned
+ */
+NAtom       n_atom_lookup          (const char *key);
+
+/** Get key string of an atom
+ * @param atom Atom
+ * @return Interned key string, or NULL if atom is not valid
+ */
+const char* n_atom_to_string       (NAtom atom);
+
+/** Insert or update key/value pair in proplist using interned key
+ * @param proplist Proplist
+ * @param atom Key atom, @see n_atom_intern
+ * @param value Value, proplist takes ownership
+ */
+void        n_proplist_set_by_atom (NProplist *proplist, NAtom atom, const NValue *value);
+
+/** Get value from proplist using interned key
+ * @param proplist Proplist
+ * @param atom Key atom, @see n_atom_intern
+ * @return Value or NULL if key is not found
+ */
+NValue*     n_proplist_get_by_atom (const NProplist *proplist, NAtom atom);
+
 /* helpers */
 
 /** Remove key from proplist
@@ -28,6 +28,21 @@ typedef struct _NRequest NRequest;
 #include <ngf/proplist.h>
 #include <ngf/event.h>
 
+/** Stages of the request timeline. The monotonic time (as returned by
+ * g_get_monotonic_time) is recorded when the request first reaches a stage. */
+typedef enum _NRequestStage
+{
+    N_REQUEST_STAGE_RECEIVED = 0,   /**< Received by the input interface */
+    N_REQUEST_STAGE_RESOLVED,       /**< Event resolved */
+    N_REQUEST_STAGE_HOOKS_DONE,     /**< Hooks fired and sinks resolved */
+    N_REQUEST_STAGE_SYNCHRONIZED,   /**< All sinks synchronized */
+    N_REQUEST_STAGE_MASTER_PLAY,    /**< Master sink started playing */
+    N_REQUEST_STAGE_PLAYING,        /**< First sink started playing */
+    N_REQUEST_STAGE_STOP,           /**< Stop requested */
+    N_REQUEST_STAGE_DONE,           /**< Completed, failed or stopped */
+    N_REQUEST_STAGE_LAST
+} NRequestStage;
+
 /** Create empty request
  * @return Allocated request structure
  */
@@ -67,6 +82,12 @@ const char*      n_request_get_name       (NRequest *request);
  */
 void             n_request_set_properties (NRequest *request, NProplist *properties);
 
+/** Set properties to request without copying them
+ * @param request Request
+ * @param properties Properties as NProplist, request takes ownership
+ */
+void             n_request_take_properties (NRequest *request, NProplist *properties);
+
 /** Get properties from request
  * @param request Request
  * @return Properties as NProplist
@@ -107,6 +128,15 @@ void             n_request_store_data     (NRequest *request, const char *key, v
  */
 void*            n_request_get_data       (NRequest *request, const char *key);
 
+/** Allocate memory that lives as long as the request. Memory is zero
+ * filled and can't be freed separately, all of it is released when the
+ * request is freed. Intended for data stored with n_request_store_data.
+ * @param request Request
+ * @param size Number of bytes to allocate
+ * @return Pointer to allocated memory or NULL if size is 0
+ */
+void*            n_request_alloc          (NRequest *request, gsize size);
+
 /** Check if the request is paused
  * @param request Request
  * @return TRUE if request is currently paused
@@ -126,4 +156,38 @@ NRequest*        n_request_new_with_event_and_properties (const char *event, con
  */
 int              n_request_is_fallback    (NRequest *request);
 
+/** Set the time the request reached a stage. Input interfaces can use
+ * this to record when the request was received, before it was created.
+ * @param request Request
+ * @param stage Stage
+ * @param time Monotonic time in microseconds
+ */
+void             n_request_set_timestamp  (NRequest *request, NRequestStage stage, gint64 time);
+
+/** Get the time the request reached a stage
+ * @param request Request
+ * @param stage Stage
+ * @return Monotonic time in microseconds or 0 if the stage was not reached
+ */
+gint64           n_request_get_timestamp  (NRequest *request, NRequestStage stage);
+
+/** Get the common start time of the request. When the event sets
+ * core.sync_start, the core picks a start time in the near future once
+ * all sinks are synchronized, and the sinks schedule the start of their
+ * output against it instead of starting when play is called.
+ * @param request Request
+ * @return Monotonic time in microseconds or 0 if the sinks start at once
+ */
+gint64           n_request_get_start_time (NRequest *request);
+
+/** Get the main loop priority for sources dispatched on behalf of the
+ * request. Requests of events with core.critical are latency critical
+ * and get G_PRIORITY_HIGH, so that their callbacks run before other
+ * pending work. Sinks use this for the idles and watches of a request.
+ * @param request Request
+ * @param default_priority Priority to use for other requests, e.g. G_PRIORITY_DEFAULT_IDLE
+ * @return Priority for the source
+ */
+int              n_request_get_source_priority (NRequest *request, int default_priority);
+
 #endif /* N_REQUEST_H */
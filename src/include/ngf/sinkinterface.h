@@ -32,6 +32,28 @@ typedef struct _NSinkInterface NSinkInterface;
 #define N_SINK_INTERFACE_TYPE_VIBRATOR  "vibra"
 #define N_SINK_INTERFACE_TYPE_LEDS      "leds"
 
+/** Return value of the initialization function of an interface that
+ * completes its initialization asynchronously. The interface reports the
+ * result later with n_sink_interface_initialized. */
+#define N_SINK_INTERFACE_INIT_PENDING   (2)
+
+/** Cost hint of a sink for a request, see the cost function of the
+ * interface declaration. */
+typedef struct _NSinkCost
+{
+    /** Estimated time from prepare to audible output in microseconds. */
+    unsigned int setup_us;
+
+    /** TRUE if the sink can fade the volume of the request. */
+    int can_fade;
+
+    /** TRUE if the sink can repeat the sound of the request. */
+    int can_loop;
+
+    /** TRUE if the sound of the request is already cached by the sink. */
+    int cached;
+} NSinkCost;
+
 /** Interface declaration structure. */
 typedef struct _NSinkInterfaceDecl
 {
@@ -44,11 +66,13 @@ typedef struct _NSinkInterfaceDecl
 
     /** Initialization function. Called when interface is loaded.
      * @param iface NSinkInterface structure
-     * @return TRUE if success
+     * @return TRUE if success, N_SINK_INTERFACE_INIT_PENDING if the result
+     *         is reported later with n_sink_interface_initialized
      */
     int  (*initialize) (NSinkInterface *iface);
     
-    /** Shutdown function. Called when interface is removed.
+    /** Shutdown function. Called when interface is removed, also when
+     * the initialization is still pending.
      * @param iface NSinkInterface structure
      */
     void (*shutdown)   (NSinkInterface *iface);
@@ -66,7 +90,7 @@ typedef struct _NSinkInterfaceDecl
      * @return TRUE if prepare succeeds
      */
     int  (*prepare)    (NSinkInterface *iface, NRequest *request);
-    
+
     /** Play function. This function is when interface is requested to start playback of the request.
      * @param iface NSinkInterface structure
      * @param request Request
@@ -80,13 +104,55 @@ typedef struct _NSinkInterfaceDecl
      * @return TRUE if playback is paused successfully
      */
     int  (*pause)      (NSinkInterface *iface, NRequest *request);
-    
+
     /** Stop function. This function is when interface is requested to stop playback of the request.
      * @param iface NSinkInterface structure
      * @param request Request
      * @return TRUE if playback is stopped
      */
     void (*stop)       (NSinkInterface *iface, NRequest *request);
+
+    /** Prewarm function, optional. This function is called when a request is likely to be played soon, see n_core_prewarm_event.
+     * The request is freed after the call, interface copies what it needs and drops unclaimed resources after a timeout.
+     * @param iface NSinkInterface structure
+     * @param request Resolved speculative request
+     */
+    void (*prewarm)    (NSinkInterface *iface, NRequest *request);
+
+    /** Cost function, optional. Called for the audio sinks that can handle the request when
+     * more than one of them has a cost function. The request is played only by the cheapest
+     * of them that can fade and repeat the sound if the request needs it: the one with the
+     * lowest setup latency, a cached sound and a higher priority winning ties. Setting
+     * "core.route" to false in the event plays the request with all of them.
+     * @param iface NSinkInterface structure
+     * @param request Request
+     * @param cost Cost hint to fill, zeroed by the caller
+     * @return TRUE if the hint is filled, FALSE to keep the sink out of the routing
+     */
+    int  (*cost)       (NSinkInterface *iface, NRequest *request, NSinkCost *cost);
+
+    /** Threaded prepare function, optional. Blocking setup, like loading a file, is done here
+     * instead of in prepare. The function is called in a worker thread after the prepare of
+     * every sink of the request, so that the sinks are prepared concurrently. The sink is
+     * synchronized when the function returns TRUE and failed otherwise, prepare must not
+     * synchronize it. The function may only read the request properties and the data stored
+     * in prepare and change the sink's own request data, it must not call the sink interface
+     * functions. Pending work is cancelled before the sink is stopped.
+     * @param iface NSinkInterface structure
+     * @param request Request
+     * @return TRUE if prepare succeeds
+     */
+    int  (*prepare_work) (NSinkInterface *iface, NRequest *request);
+
+    /** Resume function, optional. A sink with resume keeps its prepared device state while
+     * the request is paused, e.g. the pipeline in PAUSED or the effect uploaded, so that
+     * playback continues here with a single state change. Sinks without resume are played
+     * again instead.
+     * @param iface NSinkInterface structure
+     * @param request Request
+     * @return TRUE if playback is resumed
+     */
+    int  (*resume)     (NSinkInterface *iface, NRequest *request);
 } NSinkInterfaceDecl;
 
 /** Stores userdata for the sink interface
@@ -119,6 +185,17 @@ const char* n_sink_interface_get_name (NSinkInterface *iface);
  */
 const char* n_sink_interface_get_type (NSinkInterface *iface);
 
+/** Declare a key the can_handle function of the interface depends on.
+ * Once every sink with a can_handle function has declared its keys,
+ * the result is cached per event and can_handle is called again only
+ * when one of the declared keys changes.
+ * @param iface NSinkInterface structure
+ * @param key Request property key, or context key prefixed with "context@".
+ *            NULL declares that can_handle depends on no (other) keys.
+ * @param value_matters TRUE if the value matters, FALSE if only presence of the key matters
+ */
+void n_sink_interface_add_plan_key (NSinkInterface *iface, const char *key, int value_matters);
+
 /** Report that sink will resync to other sinks resynchronize requests.
  * @param iface NSinkInterface structure
  * @param request Request
@@ -151,4 +228,37 @@ void n_sink_interface_complete             (NSinkInterface *iface, NRequest *req
  */
 void n_sink_interface_fail                 (NSinkInterface *iface, NRequest *request);
 
+/**
+ * Record a sink specific stage on the request timeline, e.g. a state
+ * change of the sink pipeline. The stage is listed after the prepare,
+ * sync and play stages of the sink in n_core_dump_request_timelines.
+ * At most 8 stages are recorded per request.
+ * @param iface NSinkInterface structure
+ * @param request Request
+ * @param stage Name of the stage, must outlive the request (e.g. a literal)
+ * @param time Monotonic time in microseconds
+ */
+void n_sink_interface_mark                 (NSinkInterface *iface, NRequest *request,
+                                            const char *stage, gint64 time);
+
+/**
+ * Report the time the output of the sink actually started. With a
+ * common start time (see n_request_get_start_time) the largest
+ * difference to it is reported as the skew of the request timeline.
+ * @param iface NSinkInterface structure
+ * @param request Request
+ * @param time Monotonic time in microseconds
+ */
+void n_sink_interface_started              (NSinkInterface *iface, NRequest *request,
+                                            gint64 time);
+
+/**
+ * Report the result of an initialization that returned
+ * N_SINK_INTERFACE_INIT_PENDING. The interface is not used for requests
+ * before it has been initialized successfully.
+ * @param iface NSinkInterface structure
+ * @param success TRUE if the interface is ready for use
+ */
+void n_sink_interface_initialized          (NSinkInterface *iface, int success);
+
 #endif /* N_SINK_INTERFACE_H */
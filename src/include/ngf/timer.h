@@ -0,0 +1,87 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_TIMER_H
+#define N_TIMER_H
+
+#include <glib.h>
+#include <ngf/core.h>
+
+/* Timers shared by the core and the plugins. All timers run from a single
+ * main loop source, so deadlines that fall within the same resolution
+ * period are dispatched in one wakeup. Use them instead of g_timeout_add
+ * for request and sink timeouts. Timer callbacks have the GSourceFunc
+ * signature: returning TRUE restarts the timer with the same interval,
+ * FALSE removes it. */
+
+/** Resolution of the timers in milliseconds. Deadlines are rounded up to
+    the next multiple of it, a timer never fires early. */
+#define N_TIMER_RESOLUTION_MS (4)
+
+/** Internal timer wheel. */
+typedef struct _NTimers NTimers;
+
+/**
+ * Get timers of the core
+ *
+ * @param core Core.
+ * @return Timers.
+ */
+NTimers* n_core_get_timers (NCore *core);
+
+/**
+ * Add a timer
+ *
+ * @param timers Timers.
+ * @param interval Time until the timer fires in milliseconds.
+ * @param func Callback, returns TRUE to fire again after interval.
+ * @param userdata Userdata passed to the callback.
+ * @return Identifier of the timer, never 0.
+ */
+guint    n_timers_add      (NTimers *timers, guint interval, GSourceFunc func,
+                            gpointer userdata);
+
+/**
+ * Remove a timer
+ *
+ * The timer may be removed from its own callback.
+ *
+ * @param timers Timers.
+ * @param id Identifier returned by n_timers_add.
+ * @return TRUE if the timer was found.
+ */
+gboolean n_timers_remove   (NTimers *timers, guint id);
+
+/**
+ * Run a callback once at a monotonic time
+ *
+ * Unlike the timers above the deadline is not rounded to the timer
+ * resolution. Use it when the callback starts output that has to line
+ * up with other sinks, e.g. at the start time of a request.
+ *
+ * @param time Monotonic time in microseconds. A time in the past runs
+ *             the callback on the next main loop iteration.
+ * @param func Callback, the return value is ignored.
+ * @param userdata Userdata passed to the callback.
+ * @return Main loop source id, remove with g_source_remove.
+ */
+guint    n_timer_run_at    (gint64 time, GSourceFunc func, gpointer userdata);
+
+#endif /* N_TIMER_H */
@@ -0,0 +1,50 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+#ifndef N_WAKEUP_H
+#define N_WAKEUP_H
+
+#include <glib.h>
+
+/* Accounting of main loop wakeups, enabled with wakeup-stats in the
+ * general configuration. Every return from a main loop poll that was
+ * allowed to sleep counts as a wakeup, as idle when no request was
+ * active and as active otherwise. Sources tell their wakeups apart by
+ * noting their origin from the callback; the first origin noted after
+ * a wakeup gets it. Wakeups are reported as the counter families
+ * wakeups.idle.<origin> and wakeups.active.<origin>, the rates as the
+ * gauges wakeups.idle_rate and wakeups.active_rate in wakeups per 1000
+ * seconds spent in the state. When disabled, noting an origin costs a
+ * single test. */
+
+/**
+ * Note the origin of the current main loop wakeup
+ *
+ * Called from the main loop at the start of a callback of a source,
+ * e.g. a timer or an IO watch.
+ *
+ * @param origin Name of the source, e.g. "gst.fade". The string must
+ *               stay valid until the next main loop iteration, so
+ *               usually a literal.
+ */
+void n_wakeup_note (const char *origin);
+
+#endif /* N_WAKEUP_H */
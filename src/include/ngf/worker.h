@@ -0,0 +1,81 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_WORKER_H
+#define N_WORKER_H
+
+#include <glib.h>
+#include <ngf/core.h>
+
+/* Worker threads of the core for blocking work, like file system access
+ * and synchronous IPC, that would otherwise stall the main loop. A job
+ * runs its function in a worker thread and its done callback on the
+ * main loop once the function has returned. The job function must not
+ * touch state owned by the main loop, the job data should carry
+ * everything it needs and the results. Plugins cancel their pending
+ * jobs when they are unloaded. */
+
+/** Worker thread pool. */
+typedef struct _NWorkers NWorkers;
+
+/** Job function, runs in a worker thread. */
+typedef void (*NWorkerFunc) (gpointer userdata);
+
+/** Job done callback, runs on the main loop after the job function. */
+typedef void (*NWorkerDoneFunc) (gpointer userdata);
+
+/**
+ * Get worker threads of the core
+ *
+ * @param core Core.
+ * @return Workers.
+ */
+NWorkers* n_core_get_workers (NCore *core);
+
+/**
+ * Submit a job
+ *
+ * @param workers Workers.
+ * @param func Job function, run in a worker thread.
+ * @param done Callback run on the main loop when the job is done, may be NULL.
+ * @param userdata Job data passed to the function and the callback.
+ * @param free_func Frees the job data on the main loop after the done
+ *                  callback or when the job is cancelled, may be NULL.
+ * @return Identifier of the job, never 0.
+ */
+guint    n_workers_submit (NWorkers *workers, NWorkerFunc func,
+                           NWorkerDoneFunc done, gpointer userdata,
+                           GDestroyNotify free_func);
+
+/**
+ * Cancel a job
+ *
+ * A job that has not started is dropped. If the job function is running
+ * the call waits for it to return. Either way the done callback is not
+ * called and the job data is freed before returning, so whatever the
+ * job uses may be released right after.
+ *
+ * @param workers Workers.
+ * @param id Identifier returned by n_workers_submit.
+ * @return TRUE if the job was pending.
+ */
+gboolean n_workers_cancel (NWorkers *workers, guint id);
+
+#endif /* N_WORKER_H */
@@ -0,0 +1,72 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <glib.h>
+#include "allocstats.h"
+
+#ifdef ENABLE_ALLOC_STATS
+
+static const char *alloc_type_names[N_ALLOC_TYPES] = {
+    "proplist", "value", "request", "event", "hook_slot", "list"
+};
+
+/* updated from the worker threads too, hence atomically */
+static volatile gsize alloc_count[N_ALLOC_TYPES];
+static volatile gsize alloc_bytes[N_ALLOC_TYPES];
+static volatile gsize alloc_live[N_ALLOC_TYPES];
+
+void
+n_alloc_stats_add (NAllocType type, gsize count, gsize size)
+{
+    g_assert (type < N_ALLOC_TYPES);
+
+    (void) g_atomic_pointer_add (&alloc_count[type], count);
+    (void) g_atomic_pointer_add (&alloc_bytes[type], size);
+    (void) g_atomic_pointer_add (&alloc_live[type], count);
+}
+
+void
+n_alloc_stats_remove (NAllocType type)
+{
+    g_assert (type < N_ALLOC_TYPES);
+
+    (void) g_atomic_pointer_add (&alloc_live[type], -1);
+}
+
+void
+n_alloc_stats_get (NAllocType type, NAllocStats *stats)
+{
+    g_assert (type < N_ALLOC_TYPES);
+    g_assert (stats);
+
+    stats->count = (gsize) g_atomic_pointer_get (&alloc_count[type]);
+    stats->bytes = (gsize) g_atomic_pointer_get (&alloc_bytes[type]);
+    stats->live  = (gsize) g_atomic_pointer_get (&alloc_live[type]);
+}
+
+const char*
+n_alloc_stats_type_name (NAllocType type)
+{
+    g_assert (type < N_ALLOC_TYPES);
+
+    return alloc_type_names[type];
+}
+
+#endif /* ENABLE_ALLOC_STATS */
@@ -0,0 +1,70 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_ALLOC_STATS_H
+#define N_ALLOC_STATS_H
+
+/* allocation accounting of the core types, built only with
+   --enable-alloc-stats. every allocation of a tracked type is counted
+   with its size, and every free of it, so that the objects still alive
+   show up as alloc.<type>.live in the statistics of the core. GList
+   nodes are counted where core-player creates them but not when
+   freed. memory owned by an object, such as the shared data, entry
+   arrays and hash tables of a proplist, only adds to the bytes of its
+   type. */
+
+#include <glib.h>
+
+typedef enum _NAllocType
+{
+    N_ALLOC_PROPLIST = 0,
+    N_ALLOC_VALUE,
+    N_ALLOC_REQUEST,
+    N_ALLOC_EVENT,
+    N_ALLOC_HOOK_SLOT,
+    N_ALLOC_LIST,
+    N_ALLOC_TYPES
+} NAllocType;
+
+typedef struct _NAllocStats
+{
+    gsize count;                /* allocations */
+    gsize bytes;                /* bytes allocated */
+    gsize live;                 /* objects not freed yet */
+} NAllocStats;
+
+#ifdef ENABLE_ALLOC_STATS
+void        n_alloc_stats_add        (NAllocType type, gsize count, gsize size);
+void        n_alloc_stats_remove     (NAllocType type);
+void        n_alloc_stats_get        (NAllocType type, NAllocStats *stats);
+const char* n_alloc_stats_type_name  (NAllocType type);
+
+#define N_ALLOC_COUNT(type, size)         n_alloc_stats_add ((type), 1, (size))
+#define N_ALLOC_COUNT_N(type, n, size)    n_alloc_stats_add ((type), (n), (n) * (size))
+#define N_ALLOC_BYTES(type, size)         n_alloc_stats_add ((type), 0, (size))
+#define N_FREE_COUNT(type)                n_alloc_stats_remove ((type))
+#else
+#define N_ALLOC_COUNT(type, size)       do { } while (0)
+#define N_ALLOC_COUNT_N(type, n, size)  do { } while (0)
+#define N_ALLOC_BYTES(type, size)       do { } while (0)
+#define N_FREE_COUNT(type)              do { } while (0)
+#endif
+
+#endif /* N_ALLOC_STATS_H */
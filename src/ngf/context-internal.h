@@ -24,7 +24,16 @@
 
 #include <ngf/context.h>
 
-NContext* n_context_new  ();
-void      n_context_free (NContext *context);
+NContext* n_context_new                  ();
+void      n_context_free                 (NContext *context);
+
+/* generation is increased on every value change. generation of a key
+   is the context generation when the key was last changed, or 0 if
+   the key has never been set. */
+guint     n_context_get_generation       (NContext *context);
+guint     n_context_get_key_generation   (NContext *context, NAtom atom);
+
+/* file where the values of restored keys are cached between runs. */
+void      n_context_set_cache_file       (NContext *context, const char *filename);
 
 #endif /* N_CONTEXT_H */
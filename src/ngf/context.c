@@ -19,6 +19,9 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <ngf/log.h>
 #include <ngf/proplist.h>
 
@@ -26,37 +29,190 @@
 
 #define LOG_CAT "context: "
 
+#define CACHE_GROUP      "context"
+#define CACHE_SAVE_DELAY (1)
+
+typedef struct _NContextKey NContextKey;
+
 typedef struct _NContextSubscriber
 {
     gpointer  userdata;
     NContextValueChangeFunc callback;
+    guint        id;
+    GList      **list;          /* list the subscriber is in    */
+    GList       *link;          /* link of the subscriber in it */
+    NContextKey *key;           /* key of a single key subscription */
 } NContextSubscriber;
 
-typedef struct _NContextKey
+typedef struct _NContextChangesSubscriber
+{
+    gpointer  userdata;
+    NContextChangesFunc callback;
+} NContextChangesSubscriber;
+
+struct _NContextKey
 {
+    const gchar *name;          /* key of the keys table        */
     GList      *subscribers;    /* value:NContextSubscriber     */
-} NContextKey;
+};
+
+/* Node of the prefix subscription trie, one per key segment. Nodes are
+   only freed with the context, so that unsubscribing while a change is
+   broadcast is safe. */
+typedef struct _NContextNode
+{
+    gchar      *segment;
+    GSList     *children;       /* value:NContextNode           */
+    GList      *subscribers;    /* value:NContextSubscriber, keys below the node */
+} NContextNode;
+
+typedef struct _NContextPending
+{
+    NAtom       atom;
+    NValue     *value;
+} NContextPending;
 
 struct _NContext
 {
     NProplist  *values;
     GHashTable *keys;           /* key:gchar value:NContextKey  */
     GList      *all_keys;       /* value:NContextSubscriber     */
+    NContextNode *prefixes;     /* root of the prefix subscriptions */
+    GHashTable *subscriptions;  /* key:id value:NContextSubscriber, owned */
+    guint       next_id;
+    GList      *all_changes;    /* value:NContextChangesSubscriber */
+    GHashTable *generations;    /* key:NAtom value:guint        */
+    guint       generation;
+
+    guint       transaction;    /* open transaction depth       */
+    GArray     *pending;        /* value:NContextPending, in set order */
+
+    GMutex      snapshot_lock;  /* only for swapping the snapshot */
+    NContextSnapshot *snapshot; /* values as of the last change */
+    guint       snapshot_readers; /* snapshots are published only for readers */
+
+    gchar      *cache_file;
+    GKeyFile   *cache;
+    GHashTable *cached_keys;    /* key:NAtom, keys restored from cache */
+    guint       cache_save_id;
+};
+
+/* the values are copied, not shared with the context, as the shared
+   proplist storage and its reference count belong to the main thread.
+   values themselves are safe to copy and free from any thread. */
+struct _NContextSnapshot
+{
+    gint        ref;
+    guint       generation;
+    NProplist  *values;
 };
 
+static void n_context_cache_store (NContext *context, NAtom atom, const NValue *value);
+static void n_context_publish     (NContext *context);
+
 static void
 broadcast_list (NContext *context, GList *list, const char *key,
                 const NValue *old_value, const NValue *new_value)
 {
     NContextSubscriber *subscriber = NULL;
     GList              *iter       = NULL;
+    GList              *next       = NULL;
 
-    for (iter = g_list_first (list); iter; iter = g_list_next (iter)) {
+    /* the subscriber may unsubscribe itself from the callback */
+    for (iter = g_list_first (list); iter; iter = next) {
+        next = g_list_next (iter);
         subscriber = (NContextSubscriber*) iter->data;
         subscriber->callback (context, key, old_value, new_value, subscriber->userdata);
     }
 }
 
+static NContextNode*
+n_context_node_child (NContextNode *node, const char *segment, gsize len,
+                      gboolean create)
+{
+    NContextNode *child = NULL;
+    GSList       *iter  = NULL;
+
+    for (iter = node->children; iter; iter = g_slist_next (iter)) {
+        child = (NContextNode*) iter->data;
+        if (strncmp (child->segment, segment, len) == 0 && child->segment[len] == '\0')
+            return child;
+    }
+
+    if (!create)
+        return NULL;
+
+    child = g_new0 (NContextNode, 1);
+    child->segment = g_strndup (segment, len);
+    node->children = g_slist_prepend (node->children, child);
+
+    return child;
+}
+
+/* node of prefix, which is the subscribed key without the trailing ".*" */
+static NContextNode*
+n_context_node_lookup (NContext *context, const char *prefix, gsize len,
+                       gboolean create)
+{
+    NContextNode *node    = NULL;
+    const char   *segment = prefix;
+    const char   *end     = NULL;
+    const char   *stop    = prefix + len;
+
+    if (!context->prefixes) {
+        if (!create)
+            return NULL;
+        context->prefixes = g_new0 (NContextNode, 1);
+    }
+
+    node = context->prefixes;
+
+    while (node && segment <= stop) {
+        if (!(end = memchr (segment, '.', stop - segment)))
+            end = stop;
+
+        node = n_context_node_child (node, segment, end - segment, create);
+        segment = end + 1;
+    }
+
+    return node;
+}
+
+static void
+n_context_node_free (NContextNode *node)
+{
+    g_slist_free_full (node->children, (GDestroyNotify) n_context_node_free);
+    g_list_free (node->subscribers);
+    g_free (node->segment);
+    g_free (node);
+}
+
+static void
+n_context_key_free (gpointer data)
+{
+    NContextKey *context_key = data;
+
+    g_list_free (context_key->subscribers);
+    g_free (context_key);
+}
+
+/* walk the key segments in the trie, the subscribers of a node get the
+   keys having more segments after it. */
+static void
+broadcast_prefixes (NContext *context, const char *key,
+                    const NValue *old_value, const NValue *new_value)
+{
+    NContextNode *node    = context->prefixes;
+    const char   *segment = key;
+    const char   *end     = NULL;
+
+    while (node && (end = strchr (segment, '.'))) {
+        if ((node = n_context_node_child (node, segment, end - segment, FALSE)))
+            broadcast_list (context, node->subscribers, key, old_value, new_value);
+        segment = end + 1;
+    }
+}
+
 static void
 n_context_broadcast_change (NContext *context, const char *key,
                             const NValue *old_value, const NValue *new_value)
@@ -77,22 +233,306 @@ n_context_broadcast_change (NContext *context, const char *key,
     if ((context_key = g_hash_table_lookup (context->keys, key)))
         broadcast_list (context, context_key->subscribers, key, old_value, new_value);
 
+    broadcast_prefixes (context, key, old_value, new_value);
     broadcast_list (context, context->all_keys, key, old_value, new_value);
 }
 
+/* values are owned by the context after this, changes are filled
+   with the old and the new values. */
+static void
+n_context_apply (NContext *context, const NContextPending *pending,
+                 NContextChange *changes, guint num_changes)
+{
+    guint i;
+
+    context->generation++;
+
+    for (i = 0; i < num_changes; i++) {
+        changes[i].key = n_atom_to_string (pending[i].atom);
+        changes[i].old_value = n_value_copy (n_proplist_get_by_atom (context->values,
+                                                                     pending[i].atom));
+        changes[i].new_value = pending[i].value;
+
+        n_proplist_set_by_atom (context->values, pending[i].atom, pending[i].value);
+        g_hash_table_replace (context->generations, GUINT_TO_POINTER (pending[i].atom),
+                              GUINT_TO_POINTER (context->generation));
+
+        if (context->cached_keys &&
+            g_hash_table_contains (context->cached_keys, GUINT_TO_POINTER (pending[i].atom)))
+            n_context_cache_store (context, pending[i].atom, pending[i].value);
+    }
+
+    if (context->snapshot_readers > 0)
+        n_context_publish (context);
+}
+
+static void
+n_context_snapshot_copy_cb (const char *key, const NValue *value, gpointer userdata)
+{
+    /* context keys are all interned already */
+    n_proplist_set_by_atom ((NProplist*) userdata, n_atom_lookup (key), n_value_copy (value));
+}
+
+/* replace the snapshot with one of the current values, readers holding
+   the previous snapshot keep it until they release it. */
+static void
+n_context_publish (NContext *context)
+{
+    NContextSnapshot *snapshot = NULL;
+    NContextSnapshot *previous = NULL;
+
+    snapshot = g_new0 (NContextSnapshot, 1);
+    snapshot->ref        = 1;
+    snapshot->generation = context->generation;
+    snapshot->values     = n_proplist_new ();
+    n_proplist_foreach (context->values, n_context_snapshot_copy_cb, snapshot->values);
+
+    g_mutex_lock (&context->snapshot_lock);
+    previous = context->snapshot;
+    context->snapshot = snapshot;
+    g_mutex_unlock (&context->snapshot_lock);
+
+    if (previous)
+        n_context_snapshot_unref (previous);
+}
+
+void
+n_context_add_snapshot_reader (NContext *context)
+{
+    if (!context)
+        return;
+
+    if (context->snapshot_readers++ == 0)
+        n_context_publish (context);
+}
+
+void
+n_context_remove_snapshot_reader (NContext *context)
+{
+    NContextSnapshot *previous = NULL;
+
+    if (!context || context->snapshot_readers == 0)
+        return;
+
+    if (--context->snapshot_readers > 0)
+        return;
+
+    g_mutex_lock (&context->snapshot_lock);
+    previous = context->snapshot;
+    context->snapshot = NULL;
+    g_mutex_unlock (&context->snapshot_lock);
+
+    n_context_snapshot_unref (previous);
+}
+
+NContextSnapshot*
+n_context_get_snapshot (NContext *context)
+{
+    NContextSnapshot *snapshot = NULL;
+
+    if (!context)
+        return NULL;
+
+    g_mutex_lock (&context->snapshot_lock);
+    snapshot = n_context_snapshot_ref (context->snapshot);
+    g_mutex_unlock (&context->snapshot_lock);
+
+    return snapshot;
+}
+
+NContextSnapshot*
+n_context_snapshot_ref (NContextSnapshot *snapshot)
+{
+    if (snapshot)
+        g_atomic_int_inc (&snapshot->ref);
+
+    return snapshot;
+}
+
+void
+n_context_snapshot_unref (NContextSnapshot *snapshot)
+{
+    if (!snapshot || !g_atomic_int_dec_and_test (&snapshot->ref))
+        return;
+
+    n_proplist_free (snapshot->values);
+    g_free (snapshot);
+}
+
+const NValue*
+n_context_snapshot_get_value (const NContextSnapshot *snapshot, const char *key)
+{
+    if (!snapshot || !key)
+        return NULL;
+
+    return n_proplist_get (snapshot->values, key);
+}
+
+const NValue*
+n_context_snapshot_get_value_by_atom (const NContextSnapshot *snapshot, NAtom atom)
+{
+    if (!snapshot)
+        return NULL;
+
+    return n_proplist_get_by_atom (snapshot->values, atom);
+}
+
+unsigned int
+n_context_snapshot_get_generation (const NContextSnapshot *snapshot)
+{
+    return snapshot ? snapshot->generation : 0;
+}
+
+static void
+n_context_notify (NContext *context, NContextChange *changes, guint num_changes)
+{
+    NContextChangesSubscriber *subscriber = NULL;
+    GList                     *iter       = NULL;
+    guint                      i;
+
+    for (i = 0; i < num_changes; i++)
+        n_context_broadcast_change (context, changes[i].key,
+                                    changes[i].old_value, changes[i].new_value);
+
+    for (iter = g_list_first (context->all_changes); iter; iter = g_list_next (iter)) {
+        subscriber = (NContextChangesSubscriber*) iter->data;
+        subscriber->callback (context, changes, num_changes, subscriber->userdata);
+    }
+
+    for (i = 0; i < num_changes; i++)
+        n_value_free ((NValue*) changes[i].old_value);
+}
+
 void
 n_context_set_value (NContext *context, const char *key,
                      NValue *value)
 {
-    NValue *old_value = NULL;
+    NContextPending  pending;
+    NContextPending *p      = NULL;
+    NContextChange   change;
+    guint            i;
 
     if (!context || !key)
         return;
 
-    old_value = n_value_copy (n_proplist_get (context->values, key));
-    n_proplist_set (context->values, key, value);
-    n_context_broadcast_change (context, key, old_value, value);
-    n_value_free (old_value);
+    pending.atom  = n_atom_intern (key);
+    pending.value = value;
+
+    if (context->transaction > 0) {
+        /* coalesce repeated changes to the same key. */
+        for (i = 0; i < context->pending->len; i++) {
+            p = &g_array_index (context->pending, NContextPending, i);
+            if (p->atom == pending.atom) {
+                if (p->value != value)
+                    n_value_free (p->value);
+                p->value = value;
+                return;
+            }
+        }
+
+        g_array_append_val (context->pending, pending);
+        return;
+    }
+
+    n_context_apply  (context, &pending, &change, 1);
+    n_context_notify (context, &change, 1);
+}
+
+static const NValue*
+n_context_current_value (NContext *context, NAtom atom)
+{
+    NContextPending *p = NULL;
+    guint            i;
+
+    /* the latest pending value wins, it is only ever set once per key. */
+    if (context->transaction > 0) {
+        for (i = 0; i < context->pending->len; i++) {
+            p = &g_array_index (context->pending, NContextPending, i);
+            if (p->atom == atom)
+                return p->value;
+        }
+    }
+
+    return n_proplist_get_by_atom (context->values, atom);
+}
+
+int
+n_context_set_string_if_changed (NContext *context, const char *key,
+                                 const char *value)
+{
+    const NValue *current = NULL;
+    NValue       *v       = NULL;
+
+    if (!context || !key || !value)
+        return FALSE;
+
+    current = n_context_current_value (context, n_atom_intern (key));
+    if (current && n_value_type (current) == N_VALUE_TYPE_STRING &&
+        g_strcmp0 (n_value_get_string (current), value) == 0)
+        return FALSE;
+
+    v = n_value_new ();
+    n_value_set_string (v, value);
+    n_context_set_value (context, key, v);
+
+    return TRUE;
+}
+
+int
+n_context_set_uint_if_changed (NContext *context, const char *key,
+                               guint value)
+{
+    const NValue *current = NULL;
+    NValue       *v       = NULL;
+
+    if (!context || !key)
+        return FALSE;
+
+    current = n_context_current_value (context, n_atom_intern (key));
+    if (current && n_value_type (current) == N_VALUE_TYPE_UINT &&
+        n_value_get_uint (current) == value)
+        return FALSE;
+
+    v = n_value_new ();
+    n_value_set_uint (v, value);
+    n_context_set_value (context, key, v);
+
+    return TRUE;
+}
+
+void
+n_context_begin (NContext *context)
+{
+    if (!context)
+        return;
+
+    context->transaction++;
+}
+
+void
+n_context_commit (NContext *context)
+{
+    NContextChange *changes = NULL;
+    GArray         *pending = NULL;
+
+    if (!context || context->transaction == 0)
+        return;
+
+    if (--context->transaction > 0 || context->pending->len == 0)
+        return;
+
+    /* subscribers may start new transactions while being notified. */
+    pending = context->pending;
+    context->pending = g_array_new (FALSE, FALSE, sizeof (NContextPending));
+
+    N_DEBUG (LOG_CAT "committing %u changes", pending->len);
+
+    changes = g_new0 (NContextChange, pending->len);
+    n_context_apply  (context, (NContextPending*) pending->data, changes, pending->len);
+    n_context_notify (context, changes, pending->len);
+
+    g_free (changes);
+    g_array_free (pending, TRUE);
 }
 
 const NValue*
@@ -104,46 +544,153 @@ n_context_get_value (NContext *context, const char *key)
     return (const NValue*) n_proplist_get (context->values, key);
 }
 
+const NValue*
+n_context_get_value_by_atom (NContext *context, NAtom atom)
+{
+    if (!context || !atom)
+        return NULL;
+
+    return (const NValue*) n_proplist_get_by_atom (context->values, atom);
+}
+
+guint
+n_context_get_generation (NContext *context)
+{
+    return context ? context->generation : 0;
+}
+
+guint
+n_context_get_key_generation (NContext *context, NAtom atom)
+{
+    if (!context || !atom)
+        return 0;
+
+    return GPOINTER_TO_UINT (g_hash_table_lookup (context->generations,
+                                                  GUINT_TO_POINTER (atom)));
+}
+
+/* list for the subscriptions of key, NULL if there is none and create
+   is not set. */
+static GList**
+n_context_subscriber_list (NContext *context, const char *key, gboolean create,
+                           NContextKey **context_key)
+{
+    NContextNode *node = NULL;
+    gsize         len  = 0;
+
+    *context_key = NULL;
+
+    if (!key || g_str_equal (key, "*"))
+        return &context->all_keys;
+
+    len = strlen (key);
+    if (len >= 2 && key[len - 2] == '.' && key[len - 1] == '*') {
+        if (!(node = n_context_node_lookup (context, key, len - 2, create)))
+            return NULL;
+        return &node->subscribers;
+    }
+
+    if (!(*context_key = g_hash_table_lookup (context->keys, key))) {
+        if (!create)
+            return NULL;
+        *context_key = g_new0 (NContextKey, 1);
+        (*context_key)->name = g_strdup (key);
+        g_hash_table_insert (context->keys, (gpointer) (*context_key)->name, *context_key);
+    }
+
+    return &(*context_key)->subscribers;
+}
+
+unsigned int
+n_context_subscribe (NContext *context, const char *key,
+                     NContextValueChangeFunc callback, void *userdata)
+{
+    NContextSubscriber *subscriber  = NULL;
+    NContextKey        *context_key = NULL;
+    GList             **list        = NULL;
+
+    if (!context || !callback)
+        return 0;
+
+    list = n_context_subscriber_list (context, key, TRUE, &context_key);
+
+    subscriber = g_new0 (NContextSubscriber, 1);
+    subscriber->callback = callback;
+    subscriber->userdata = userdata;
+    subscriber->id       = ++context->next_id;
+    subscriber->list     = list;
+    subscriber->key      = context_key;
+
+    *list = g_list_append (*list, subscriber);
+    subscriber->link = g_list_last (*list);
+
+    g_hash_table_insert (context->subscriptions, GUINT_TO_POINTER (subscriber->id), subscriber);
+
+    N_DEBUG (LOG_CAT "subscriber added for key '%s'", key ? key : "<all keys>");
+
+    return subscriber->id;
+}
+
+void
+n_context_unsubscribe (NContext *context, unsigned int id)
+{
+    NContextSubscriber *subscriber = NULL;
+
+    if (!context || id == 0)
+        return;
+
+    if (!(subscriber = g_hash_table_lookup (context->subscriptions, GUINT_TO_POINTER (id))))
+        return;
+
+    *subscriber->list = g_list_delete_link (*subscriber->list, subscriber->link);
+    if (subscriber->key && !subscriber->key->subscribers)
+        g_hash_table_remove (context->keys, subscriber->key->name);
+
+    g_hash_table_remove (context->subscriptions, GUINT_TO_POINTER (id));
+}
+
 int
 n_context_subscribe_value_change (NContext *context, const char *key,
                                   NContextValueChangeFunc callback,
                                   void *userdata)
 {
-    NContextKey        *context_key = NULL;
-    NContextSubscriber *subscriber  = NULL;
+    return n_context_subscribe (context, key, callback, userdata) != 0;
+}
+
+int
+n_context_subscribe_changes (NContext *context, NContextChangesFunc callback,
+                             void *userdata)
+{
+    NContextChangesSubscriber *subscriber = NULL;
 
     if (!context || !callback)
         return FALSE;
 
-    subscriber = g_new0 (NContextSubscriber, 1);
+    subscriber = g_new0 (NContextChangesSubscriber, 1);
     subscriber->callback = callback;
     subscriber->userdata = userdata;
 
-    if (key) {
-        if (!(context_key = g_hash_table_lookup (context->keys, key))) {
-            context_key = g_new0 (NContextKey, 1);
-            g_hash_table_insert (context->keys, g_strdup (key), context_key);
-        }
-        context_key->subscribers = g_list_append (context_key->subscribers, subscriber);
-    } else
-        context->all_keys = g_list_append (context->all_keys, subscriber);
+    context->all_changes = g_list_append (context->all_changes, subscriber);
 
-    N_DEBUG (LOG_CAT "subscriber added for key '%s'", key ? key : "<all keys>");
+    N_DEBUG (LOG_CAT "changes subscriber added");
 
     return TRUE;
 }
 
-static void
-remove_from_list (GList **list, NContextValueChangeFunc callback)
+void
+n_context_unsubscribe_changes (NContext *context, NContextChangesFunc callback)
 {
-    NContextSubscriber  *subscriber  = NULL;
-    GList               *iter        = NULL;
+    NContextChangesSubscriber *subscriber = NULL;
+    GList                     *iter       = NULL;
 
-    for (iter = g_list_first (*list); iter; iter = g_list_next (iter)) {
-        subscriber = (NContextSubscriber*) iter->data;
+    if (!context || !callback)
+        return;
+
+    for (iter = g_list_first (context->all_changes); iter; iter = g_list_next (iter)) {
+        subscriber = (NContextChangesSubscriber*) iter->data;
 
         if (subscriber->callback == callback) {
-            *list = g_list_remove (*list, subscriber);
+            context->all_changes = g_list_remove (context->all_changes, subscriber);
             g_free (subscriber);
             break;
         }
@@ -154,19 +701,179 @@ void
 n_context_unsubscribe_value_change (NContext *context, const char *key,
                                     NContextValueChangeFunc callback)
 {
-    NContextKey *context_key  = NULL;
+    NContextSubscriber *subscriber  = NULL;
+    NContextKey        *context_key = NULL;
+    GList             **list        = NULL;
+    GList              *iter        = NULL;
 
     if (!context || !callback)
         return;
 
-    if (key) {
-        if ((context_key = g_hash_table_lookup (context->keys, key))) {
-            remove_from_list (&context_key->subscribers, callback);
-            if (!context_key->subscribers)
-                g_hash_table_remove (context->keys, key);
+    if (!(list = n_context_subscriber_list (context, key, FALSE, &context_key)))
+        return;
+
+    for (iter = g_list_first (*list); iter; iter = g_list_next (iter)) {
+        subscriber = (NContextSubscriber*) iter->data;
+
+        if (subscriber->callback == callback) {
+            n_context_unsubscribe (context, subscriber->id);
+            break;
         }
-    } else
-        remove_from_list (&context->all_keys, callback);
+    }
+}
+
+static void
+n_context_cache_save (NContext *context)
+{
+    GError *error = NULL;
+    gchar  *data  = NULL;
+    gchar  *dir   = NULL;
+    gsize   size  = 0;
+
+    if (context->cache_save_id > 0) {
+        g_source_remove (context->cache_save_id);
+        context->cache_save_id = 0;
+    }
+
+    data = g_key_file_to_data (context->cache, &size, NULL);
+    dir  = g_path_get_dirname (context->cache_file);
+    (void) g_mkdir_with_parents (dir, 0755);
+
+    if (!g_file_set_contents (context->cache_file, data, size, &error)) {
+        N_WARNING (LOG_CAT "failed to save context cache '%s': %s",
+            context->cache_file, error->message);
+        g_error_free (error);
+    }
+
+    g_free (dir);
+    g_free (data);
+}
+
+static gboolean
+n_context_cache_save_cb (gpointer userdata)
+{
+    NContext *context = userdata;
+
+    context->cache_save_id = 0;
+    n_context_cache_save (context);
+
+    return FALSE;
+}
+
+/* values are stored as "type:value", pointers are not cached. */
+static void
+n_context_cache_store (NContext *context, NAtom atom, const NValue *value)
+{
+    const char *key    = n_atom_to_string (atom);
+    gchar      *stored = NULL;
+
+    switch (n_value_type (value)) {
+        case N_VALUE_TYPE_STRING:
+            stored = g_strdup_printf ("string:%s", n_value_get_string (value));
+            break;
+        case N_VALUE_TYPE_INT:
+            stored = g_strdup_printf ("int:%d", n_value_get_int (value));
+            break;
+        case N_VALUE_TYPE_UINT:
+            stored = g_strdup_printf ("uint:%u", n_value_get_uint (value));
+            break;
+        case N_VALUE_TYPE_BOOL:
+            stored = g_strdup (n_value_get_bool (value) ? "bool:true" : "bool:false");
+            break;
+        default:
+            break;
+    }
+
+    if (stored)
+        g_key_file_set_string (context->cache, CACHE_GROUP, key, stored);
+    else
+        g_key_file_remove_key (context->cache, CACHE_GROUP, key, NULL);
+
+    g_free (stored);
+
+    if (context->cache_save_id == 0)
+        context->cache_save_id = g_timeout_add_seconds (CACHE_SAVE_DELAY,
+                                                        n_context_cache_save_cb, context);
+}
+
+static NValue*
+n_context_cache_parse (const char *stored)
+{
+    NValue     *value = NULL;
+    const char *data  = NULL;
+
+    if (!stored || !(data = strchr (stored, ':')))
+        return NULL;
+
+    data++;
+    value = n_value_new ();
+
+    if (g_str_has_prefix (stored, "string:"))
+        n_value_set_string (value, data);
+    else if (g_str_has_prefix (stored, "int:"))
+        n_value_set_int (value, (gint) strtol (data, NULL, 10));
+    else if (g_str_has_prefix (stored, "uint:"))
+        n_value_set_uint (value, (guint) strtoul (data, NULL, 10));
+    else if (g_str_has_prefix (stored, "bool:"))
+        n_value_set_bool (value, g_strcmp0 (data, "true") == 0);
+    else {
+        n_value_free (value);
+        value = NULL;
+    }
+
+    return value;
+}
+
+void
+n_context_set_cache_file (NContext *context, const char *filename)
+{
+    GError *error = NULL;
+
+    g_assert (context != NULL);
+    g_assert (context->cache == NULL);
+
+    if (!filename)
+        return;
+
+    context->cache_file  = g_strdup (filename);
+    context->cache       = g_key_file_new ();
+    context->cached_keys = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    if (!g_key_file_load_from_file (context->cache, filename, G_KEY_FILE_NONE, &error)) {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            N_WARNING (LOG_CAT "failed to load context cache '%s': %s",
+                filename, error->message);
+        g_error_free (error);
+    }
+}
+
+int
+n_context_restore_value (NContext *context, const char *key)
+{
+    NAtom   atom   = 0;
+    gchar  *stored = NULL;
+    NValue *value  = NULL;
+
+    if (!context || !key || !context->cache)
+        return FALSE;
+
+    atom = n_atom_intern (key);
+    g_hash_table_add (context->cached_keys, GUINT_TO_POINTER (atom));
+
+    if (n_context_current_value (context, atom))
+        return FALSE;
+
+    stored = g_key_file_get_string (context->cache, CACHE_GROUP, key, NULL);
+    value  = n_context_cache_parse (stored);
+    g_free (stored);
+
+    if (!value)
+        return FALSE;
+
+    N_DEBUG (LOG_CAT "restored cached value for '%s'", key);
+    n_context_set_value (context, key, value);
+
+    return TRUE;
 }
 
 NContext*
@@ -177,15 +884,42 @@ n_context_new ()
     context = g_new0 (NContext, 1);
     context->values = n_proplist_new ();
     context->keys = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                           g_free, g_free);
+                                           g_free, n_context_key_free);
+    context->subscriptions = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                    NULL, g_free);
+    context->generations = g_hash_table_new (g_direct_hash, g_direct_equal);
+    context->pending = g_array_new (FALSE, FALSE, sizeof (NContextPending));
+    g_mutex_init (&context->snapshot_lock);
     return context;
 }
 
 void
 n_context_free (NContext *context)
 {
-    g_list_free_full (context->all_keys, g_free);
+    guint i;
+
+    for (i = 0; i < context->pending->len; i++)
+        n_value_free (g_array_index (context->pending, NContextPending, i).value);
+    g_array_free (context->pending, TRUE);
+
+    g_list_free (context->all_keys);
+    g_list_free_full (context->all_changes, g_free);
     g_hash_table_destroy (context->keys);
+    if (context->prefixes)
+        n_context_node_free (context->prefixes);
+    g_hash_table_destroy (context->subscriptions);
+    n_context_snapshot_unref (context->snapshot);
+    g_mutex_clear (&context->snapshot_lock);
+    g_hash_table_destroy (context->generations);
     n_proplist_free (context->values);
+
+    if (context->cache) {
+        if (context->cache_save_id > 0)
+            n_context_cache_save (context);
+        g_key_file_free (context->cache);
+        g_hash_table_destroy (context->cached_keys);
+        g_free (context->cache_file);
+    }
+
     g_free (context);
 }
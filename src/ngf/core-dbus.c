@@ -28,6 +28,7 @@
 #include <ngf/core-dbus.h>
 #include "core-internal.h"
 #include "core-dbus-internal.h"
+#include "wakeup-internal.h"
 
 #define LOG_CAT "core-dbus: "
 
@@ -41,9 +42,20 @@ struct NDBusHelper {
     NCore          *core;
     guint           id_counter;
     n_dbus_bus      bus[2];
-    GHashTable     *matches;
+    GHashTable     *matches;        /* key:n_dbus_match_key value:n_dbus_match */
+    GHashTable     *interfaces;     /* key:interface value:number of matches */
+    guint           no_iface_matches;
 };
 
+/* Signals are matched on the exact interface, path and member triple,
+ * any of which may be NULL. Lookups use a key pointing to the strings
+ * of the message, so no match string needs to be built per signal. */
+typedef struct n_dbus_match_key {
+    char           *iface;
+    char           *path;
+    char           *member;
+} n_dbus_match_key;
+
 typedef struct n_dbus_cb {
     guint           id;
     NDBusFilterFunc cb;
@@ -51,6 +63,7 @@ typedef struct n_dbus_cb {
 } n_dbus_cb;
 
 typedef struct n_dbus_match {
+    n_dbus_match_key key;           /* first, the match is its own key */
     NDBusHelper    *dbus;
     DBusBusType     type;
     char           *match_str;
@@ -79,6 +92,30 @@ build_match_string (const char *iface, const char *path, const char *member)
                             member ? "'" : "");
 }
 
+static guint
+match_key_hash (gconstpointer data)
+{
+    const n_dbus_match_key *key = data;
+    guint                   hash;
+
+    hash = key->iface ? g_str_hash (key->iface) : 0;
+    hash = hash * 31 + (key->path ? g_str_hash (key->path) : 0);
+    hash = hash * 31 + (key->member ? g_str_hash (key->member) : 0);
+
+    return hash;
+}
+
+static gboolean
+match_key_equal (gconstpointer a, gconstpointer b)
+{
+    const n_dbus_match_key *ka = a;
+    const n_dbus_match_key *kb = b;
+
+    return g_strcmp0 (ka->member, kb->member) == 0 &&
+           g_strcmp0 (ka->path, kb->path) == 0 &&
+           g_strcmp0 (ka->iface, kb->iface) == 0;
+}
+
 static const char*
 bus_str (DBusBusType type)
 {
@@ -91,27 +128,35 @@ bus_str (DBusBusType type)
 static DBusHandlerResult
 filter_cb (DBusConnection *connection, DBusMessage *msg, void *userdata)
 {
-    NDBusHelper    *dbus = userdata;
-    n_dbus_match   *match;
-    char           *match_str = NULL;
-    const char     *iface;
-    const char     *path;
-    const char     *member;
-    GSList         *i;
-    int             ret = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    NDBusHelper      *dbus = userdata;
+    n_dbus_match     *match;
+    n_dbus_match_key  key;
+    GSList           *i;
+    int               ret = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-    iface  = dbus_message_get_interface (msg);
-    path   = dbus_message_get_path (msg);
-    member = dbus_message_get_member (msg);
+    n_wakeups_note_default ("dbus");
 
-    if ((!iface && !path && !member) || dbus_message_get_type (msg) != DBUS_MESSAGE_TYPE_SIGNAL)
+    if (dbus_message_get_type (msg) != DBUS_MESSAGE_TYPE_SIGNAL)
         goto done;
 
-    match_str = build_match_string (iface, path, member);
+    /* most signals on the bus are for interfaces nobody listens to. */
+    key.iface = (char*) dbus_message_get_interface (msg);
 
-    if (!(match = g_hash_table_lookup (dbus->matches, match_str)))
+    if (key.iface ? !g_hash_table_lookup (dbus->interfaces, key.iface)
+                  : dbus->no_iface_matches == 0)
         goto done;
 
+    key.path   = (char*) dbus_message_get_path (msg);
+    key.member = (char*) dbus_message_get_member (msg);
+
+    if (!key.iface && !key.path && !key.member)
+        goto done;
+
+    if (!(match = g_hash_table_lookup (dbus->matches, &key)))
+        goto done;
+
+    n_wakeup_note ("dbus.signal");
+
     for (i = match->callbacks; i; i = i->next) {
         n_dbus_cb *cb = i->data;
         int r;
@@ -120,7 +165,6 @@ filter_cb (DBusConnection *connection, DBusMessage *msg, void *userdata)
     }
 
 done:
-    g_free (match_str);
     return ret;
 }
 
@@ -226,6 +270,7 @@ match_remove_full (gpointer userdata)
     n_dbus_match    *match = userdata;
     n_dbus_cb       *cb;
     GSList          *i;
+    guint            count;
 
     while (match->callbacks) {
         i = match->callbacks;
@@ -239,8 +284,22 @@ match_remove_full (gpointer userdata)
                            match->match_str, NULL);
     connection_unref (match->dbus, match->type);
 
+    if (match->key.iface) {
+        count = GPOINTER_TO_UINT (g_hash_table_lookup (match->dbus->interfaces,
+                                                       match->key.iface));
+        if (count > 1)
+            g_hash_table_insert (match->dbus->interfaces, g_strdup (match->key.iface),
+                                 GUINT_TO_POINTER (count - 1));
+        else
+            g_hash_table_remove (match->dbus->interfaces, match->key.iface);
+    } else
+        match->dbus->no_iface_matches--;
+
     N_DEBUG (LOG_CAT "remove match '%s'", match->match_str);
     g_free (match->match_str);
+    g_free (match->key.iface);
+    g_free (match->key.path);
+    g_free (match->key.member);
     g_free (match);
 }
 
@@ -251,8 +310,10 @@ n_dbus_helper_new (NCore *core)
 
     dbus            = g_new0 (NDBusHelper, 1);
     dbus->core      = core;
-    dbus->matches   = g_hash_table_new_full (g_str_hash, g_str_equal,
+    dbus->matches   = g_hash_table_new_full (match_key_hash, match_key_equal,
                                              NULL, match_remove_full);
+    dbus->interfaces = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, NULL);
 
     return dbus;
 }
@@ -263,6 +324,7 @@ n_dbus_helper_free (NDBusHelper *dbus)
     g_assert (dbus);
 
     g_hash_table_destroy (dbus->matches);
+    g_hash_table_destroy (dbus->interfaces);
     g_assert (dbus->bus[DBUS_BUS_SYSTEM].ref == 0);
     g_assert (!dbus->bus[DBUS_BUS_SYSTEM].connection);
     g_assert (dbus->bus[DBUS_BUS_SESSION].ref == 0);
@@ -279,10 +341,11 @@ n_dbus_add_match (NCore            *core,
                   const char       *path,
                   const char       *member)
 {
-    n_dbus_match   *match;
-    DBusConnection *connection;
-    char           *match_str;
-    int             id;
+    n_dbus_match     *match;
+    n_dbus_match_key  key;
+    DBusConnection   *connection;
+    guint             count;
+    int               id;
 
     g_assert (core);
     g_assert (core->dbus);
@@ -292,18 +355,30 @@ n_dbus_add_match (NCore            *core,
         return 0;
     }
 
-    match_str = build_match_string (iface, path, member);
-
-    if (!(match = g_hash_table_lookup (core->dbus->matches, match_str))) {
-        N_DEBUG (LOG_CAT "new match '%s'", match_str);
-        match           = g_new0 (n_dbus_match, 1);
-        match->type     = type;
-        match->dbus     = core->dbus;
-        match->match_str= match_str;
+    key.iface  = (char*) iface;
+    key.path   = (char*) path;
+    key.member = (char*) member;
+
+    if (!(match = g_hash_table_lookup (core->dbus->matches, &key))) {
+        match             = g_new0 (n_dbus_match, 1);
+        match->key.iface  = g_strdup (iface);
+        match->key.path   = g_strdup (path);
+        match->key.member = g_strdup (member);
+        match->type       = type;
+        match->dbus       = core->dbus;
+        match->match_str  = build_match_string (iface, path, member);
+        N_DEBUG (LOG_CAT "new match '%s'", match->match_str);
         dbus_bus_add_match (connection, match->match_str, NULL);
-        g_hash_table_insert (core->dbus->matches, match->match_str, match);
-    } else
-        g_free (match_str);
+        g_hash_table_insert (core->dbus->matches, &match->key, match);
+
+        if (match->key.iface) {
+            count = GPOINTER_TO_UINT (g_hash_table_lookup (core->dbus->interfaces,
+                                                           match->key.iface));
+            g_hash_table_insert (core->dbus->interfaces, g_strdup (match->key.iface),
+                                 GUINT_TO_POINTER (count + 1));
+        } else
+            core->dbus->no_iface_matches++;
+    }
 
     id = ++core->dbus->id_counter;
     match_add_callback (match, id, cb, userdata);
@@ -343,7 +418,7 @@ dbus_remove_match (NCore *core, guint match_id, NDBusFilterFunc match_cb)
     }
 
     if (match && !match->callbacks)
-        g_hash_table_remove (core->dbus->matches, match->match_str);
+        g_hash_table_remove (core->dbus->matches, &match->key);
 
     return removed;
 }
@@ -36,18 +36,43 @@
 #include "context-internal.h"
 #include "core-dbus-internal.h"
 #include "haptic-internal.h"
+#include "metrics-internal.h"
+#include "timer-internal.h"
+#include "worker-internal.h"
+#include "memory-internal.h"
+#include "filecheck-internal.h"
+#include "allocstats.h"
+
+typedef struct _NCoreLazyPlugin NCoreLazyPlugin;
 
 struct _NCore
 {
     gchar            *conf_path;            /* configuration path */
     gchar            *user_conf_path;       /* configuration path for user defined settings */
     gchar            *plugin_path;          /* plugin path */
+    gchar            *event_db_path;        /* precompiled event database, optional */
 
     GList            *required_plugins;     /* plugins to load (required) */
     GList            *optional_plugins;     /* plugins to load (loading may fail, and won't disturb operation) */
     GList            *plugins;              /* NPlugin* */
+    NPlugin          *init_plugin;          /* plugin being initialized */
+    GList            *lazy_plugins;         /* NCoreLazyPlugin*, plugins loaded on demand */
+    NCoreLazyPlugin  *lazy_loading;         /* lazy plugin being loaded */
+
+    gboolean          async_init;           /* sinks may finish initialization after startup */
+    guint             pending_init;         /* required sinks still initializing */
+    gboolean          init_waiting;         /* init done is fired when pending_init drops to 0 */
+    gint64            init_started;         /* monotonic time the initialization started */
+    gboolean          early_start;          /* inputs are initialized before the sinks */
+    GList            *startup_queue;        /* requests waiting for their sinks to initialize */
+    guint             startup_source;       /* idle dispatch of the startup queue */
+
+    guint             watchdog_prepare;     /* deadlines of stalled sinks, ms, 0 disables */
+    guint             watchdog_synchronize;
+    guint             watchdog_play;
 
     NSinkInterface  **sinks;                /* sink interfaces registered */
+    NSinkInterface  **sinks_by_priority;    /* same, highest priority first */
     unsigned int      num_sinks;
     GList            *sink_order;           /* order of sinks */
 
@@ -61,7 +86,65 @@ struct _NCore
     NDBusHelper      *dbus;                 /* dbus helper */
 
     GHashTable       *key_types;
+    GHashTable       *request_keys;         /* NAtom set of incoming keys kept, NULL keeps all */
+    guint             request_key_atoms;    /* undeclared request keys interned */
+    guint             request_prefix_atoms; /* of them, under the stream prefixes */
     GList            *requests;             /* active requests */
+    GList            *scheduled;            /* requests holding or waiting for slots */
+    GHashTable       *request_table;        /* key:request id value:NRequest */
+
+    GHashTable       *event_cache;          /* request key:gchar value:NEvent */
+    guint             event_cache_context_generation;
+    guint             event_cache_list_generation;
+    guint             event_cache_hits;
+    guint             event_cache_misses;
+
+    GArray           *sink_plan_keys;       /* NSinkPlanKey, keys sink plans depend on */
+    GHashTable       *sink_plans;           /* key:NEvent value:GList of NSinkPlan */
+    guint             sink_plan_list_generation;
+    GArray           *sink_plan_filters;    /* NSinkPlanFilter, filter_sinks callbacks that declared their keys */
+    guint             sink_plan_hits;
+    guint             sink_plan_misses;
+
+    GQueue           *timelines;            /* formatted timelines of recently finished requests */
+    guint             timeline_history;     /* number of finished timelines kept */
+
+    NMetrics         *metrics;              /* runtime metrics */
+    NMetricFamily    *metric_requests;      /* requests per resolved event */
+    NMetricCounter   *metric_failed;        /* failed requests, including fallbacks */
+    NMetricCounter   *metric_fallbacks;     /* fallback requests played */
+    NMetricFamily    *metric_routes;        /* requests routed per chosen audio sink */
+    NMetricCounter   *metric_route_unmet;   /* routings no sink could serve fully */
+    NMetricCounter   *metric_no_event;      /* requests without matching event */
+    NMetricCounter   *metric_invalid_file;  /* requests sent to the fallback for an invalid file */
+    NMetricFamily    *metric_watchdog;      /* stalls found by the watchdog, per sink and stage */
+    NMetricCounter   *metric_coalesced;     /* requests merged into or restarting another */
+    NMetricCounter   *metric_prewarmed;     /* speculative requests resolved for the sinks */
+    NMetricCounter   *metric_preempted;     /* requests stopped, paused or queued for a higher priority */
+    NMetricGauge     *metric_active;        /* active requests */
+    NMetricHistogram *metric_start_skew;    /* sink start skew of synchronized starts, us */
+    NMetricHistogram *metric_dispatch_lag;  /* request idle dispatch delay, us */
+    NMetricHistogram *metric_critical_lag;  /* same for critical requests, us */
+    NMetricHistogram *metric_resume;        /* resume of paused requests, us */
+    NMetricHistogram *metric_startup_wait;  /* requests waiting for sinks at startup, us */
+    NMetricGauge     *metric_event_bytes;   /* event property memory */
+    NMetricGauge     *metric_event_unshared; /* same if no strings were shared */
+#ifdef ENABLE_ALLOC_STATS
+    NMetricGauge     *metric_alloc_count[N_ALLOC_TYPES];  /* allocations of the core types */
+    NMetricGauge     *metric_alloc_bytes[N_ALLOC_TYPES];  /* bytes allocated for them */
+    NMetricGauge     *metric_alloc_live[N_ALLOC_TYPES];   /* objects not freed yet */
+    NMetricCounter   *metric_alloc_requests; /* requests done, for allocations per request */
+#endif
+
+    NTimers          *timers;               /* request and sink timeouts */
+    NWorkers         *workers;              /* threads for blocking plugin work */
+    NMemory          *memory;               /* cache sizes and trimming */
+    NFileCheck       *filecheck;            /* checked sound files, NULL if no keys are checked */
+    NAtom            *file_check_keys;      /* keys holding the paths of the files checked */
+    guint             num_file_check_keys;
+
+    GList            *event_files;          /* event configuration files parsed */
+    GList            *retired_events;       /* replaced events, freed when no longer in use */
 
     NHook             hooks[N_CORE_HOOK_LAST];
 
@@ -71,7 +154,13 @@ struct _NCore
 NCore*    n_core_new              (int *argc, char **argv);
 void      n_core_free             (NCore *core);
 int       n_core_initialize       (NCore *core);
+int       n_core_initialize_sinks (NCore *core);
+NPlugin*  n_core_open_plugin      (NCore *core, const char *plugin_name, NProplist *params);
+void      n_core_finish_initialize (NCore *core);
+void      n_core_sink_initialized (NCore *core, NSinkInterface *sink, int success);
 int       n_core_reload_events    (NCore *core);
+int       n_core_reload_plugins   (NCore *core);
+void      n_core_free_retired_events (NCore *core);
 void      n_core_shutdown         (NCore *core);
 
 void      n_core_register_sink    (NCore *core, const NSinkInterfaceDecl *iface);
@@ -81,5 +170,13 @@ NEvent*   n_core_evaluate_request (NCore *core, NRequest *request);
 
 void      n_core_fire_hook        (NCore *core, NCoreHook hook, void *data);
 
+#ifdef ENABLE_ALLOC_STATS
+void      n_core_sync_alloc_stats (NCore *core);
+void      n_core_report_alloc_stats (NCore *core, NRequest *request);
+#else
+#define   n_core_sync_alloc_stats(core) do { } while (0)
+#define   n_core_report_alloc_stats(core, request) do { } while (0)
+#endif
+
 #endif /* N_CORE_INTERNAL_H */
 
@@ -0,0 +1,384 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ngf/log.h>
+#include "core-lazy.h"
+#include "core-player.h"
+#include "plugin-internal.h"
+
+#define LOG_CAT "core: "
+
+#define LAZY_KEY                "lazy"
+#define LAZY_SINK_KEY           "lazy.sink"
+#define LAZY_TYPE_KEY           "lazy.type"
+#define LAZY_KEYS_KEY           "lazy.keys"
+#define LAZY_UNLOAD_TIMEOUT_KEY "lazy.unload-timeout"
+
+/* seconds without requests before a lazily loaded plugin is unloaded. */
+#define LAZY_DEFAULT_UNLOAD_TIMEOUT (60)
+
+struct _NCoreLazyPlugin
+{
+    NCore              *core;
+    gchar              *name;           /* plugin name */
+    NProplist          *params;         /* plugin parameters, copied for every load */
+    gchar              *sink_name;
+    gchar              *sink_type;
+    gchar             **keys;           /* request keys the sink handles */
+    guint               unload_timeout; /* in seconds, 0 never unloads */
+
+    NSinkInterface     *sink;           /* registered sink, stub when not loaded */
+    NSinkInterfaceDecl  stub;
+    NSinkInterfaceDecl  real;           /* sink registered by the plugin */
+    gboolean            registered;     /* real has been registered */
+    NPlugin            *plugin;         /* loaded plugin or NULL */
+    gboolean            failed;         /* loading failed, not retried */
+
+    guint               unload_source;
+    guint64             plays;          /* sink plays at the last idle check */
+};
+
+static NCoreLazyPlugin* n_core_lazy_lookup      (NCore *core, NSinkInterface *sink);
+static int              n_core_lazy_stub_play   (NSinkInterface *iface, NRequest *request);
+static void             n_core_lazy_stub_stop   (NSinkInterface *iface, NRequest *request);
+static int              n_core_lazy_can_handle  (NSinkInterface *iface, NRequest *request);
+static int              n_core_lazy_load        (NCoreLazyPlugin *lazy);
+static void             n_core_lazy_unload      (NCoreLazyPlugin *lazy, gboolean shutdown_sink);
+static gboolean         n_core_lazy_in_use      (NCoreLazyPlugin *lazy);
+static gboolean         n_core_lazy_idle_cb     (gpointer userdata);
+static void             n_core_lazy_free        (NCoreLazyPlugin *lazy);
+
+static NCoreLazyPlugin*
+n_core_lazy_lookup (NCore *core, NSinkInterface *sink)
+{
+    GList *iter = NULL;
+
+    for (iter = g_list_first (core->lazy_plugins); iter; iter = g_list_next (iter)) {
+        if (((NCoreLazyPlugin*) iter->data)->sink == sink)
+            return (NCoreLazyPlugin*) iter->data;
+    }
+
+    return NULL;
+}
+
+static int
+n_core_lazy_stub_play (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+    (void) request;
+
+    return FALSE;
+}
+
+static void
+n_core_lazy_stub_stop (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+    (void) request;
+}
+
+static int
+n_core_lazy_can_handle (NSinkInterface *iface, NRequest *request)
+{
+    NCoreLazyPlugin  *lazy  = NULL;
+    const NProplist  *props = NULL;
+    gchar           **key   = NULL;
+
+    if (!(lazy = n_core_lazy_lookup (iface->core, iface)) || lazy->failed)
+        return FALSE;
+
+    if (!(props = n_request_get_properties (request)))
+        return FALSE;
+
+    for (key = lazy->keys; *key; ++key) {
+        if (n_proplist_has_key (props, *key))
+            break;
+    }
+
+    if (!*key)
+        return FALSE;
+
+    if (!lazy->plugin && !n_core_lazy_load (lazy))
+        return FALSE;
+
+    /* initialization still pending, the request is played without
+       the sink. */
+    if (iface->init_state != N_SINK_INIT_READY)
+        return FALSE;
+
+    return lazy->real.can_handle ? lazy->real.can_handle (iface, request) : TRUE;
+}
+
+int
+n_core_lazy_add_plugin (NCore *core, const char *plugin_name, NProplist *params)
+{
+    g_assert (core != NULL);
+    g_assert (plugin_name != NULL);
+
+    NCoreLazyPlugin *lazy    = NULL;
+    const char      *keys    = NULL;
+    const char      *value   = NULL;
+    gchar          **key     = NULL;
+
+    if (!params || !n_proplist_has_key (params, LAZY_KEY))
+        return FALSE;
+
+    value = n_proplist_get_string (params, LAZY_KEY);
+    if (!value || (g_ascii_strcasecmp (value, "true") != 0 && strcmp (value, "1") != 0))
+        return FALSE;
+
+    if (!(keys = n_proplist_get_string (params, LAZY_KEYS_KEY))) {
+        N_WARNING (LOG_CAT "lazy plugin '%s' declares no %s, loading normally",
+            plugin_name, LAZY_KEYS_KEY);
+        return FALSE;
+    }
+
+    lazy = g_new0 (NCoreLazyPlugin, 1);
+    lazy->core           = core;
+    lazy->name           = g_strdup (plugin_name);
+    lazy->params         = params;
+    lazy->keys           = g_strsplit (keys, ";", -1);
+    lazy->unload_timeout = LAZY_DEFAULT_UNLOAD_TIMEOUT;
+
+    value = n_proplist_get_string (params, LAZY_SINK_KEY);
+    lazy->sink_name = g_strdup (value ? value : plugin_name);
+    lazy->sink_type = g_strdup (n_proplist_get_string (params, LAZY_TYPE_KEY));
+
+    if ((value = n_proplist_get_string (params, LAZY_UNLOAD_TIMEOUT_KEY)))
+        lazy->unload_timeout = (guint) atoi (value);
+
+    lazy->stub.name       = lazy->sink_name;
+    lazy->stub.type       = lazy->sink_type;
+    lazy->stub.can_handle = n_core_lazy_can_handle;
+    lazy->stub.play       = n_core_lazy_stub_play;
+    lazy->stub.stop       = n_core_lazy_stub_stop;
+
+    n_core_register_sink (core, &lazy->stub);
+
+    if (!core->num_sinks || core->sinks[core->num_sinks - 1]->funcs.play != n_core_lazy_stub_play) {
+        n_core_lazy_free (lazy);
+        return TRUE;
+    }
+
+    lazy->sink = core->sinks[core->num_sinks - 1];
+    core->lazy_plugins = g_list_append (core->lazy_plugins, lazy);
+
+    /* the stub decision depends only on the presence of the keys. */
+    for (key = lazy->keys; *key; ++key) {
+        g_strstrip (*key);
+        if (**key)
+            n_core_add_plan_key (core, lazy->sink, *key, FALSE);
+    }
+
+    N_INFO (LOG_CAT "plugin '%s' is loaded on demand for sink '%s'",
+        lazy->name, lazy->sink_name);
+
+    return TRUE;
+}
+
+void
+n_core_lazy_register_sink (NCore *core, const NSinkInterfaceDecl *decl)
+{
+    g_assert (core != NULL);
+    g_assert (core->lazy_loading != NULL);
+
+    NCoreLazyPlugin *lazy = core->lazy_loading;
+
+    if (lazy->registered || !g_str_equal (decl->name, lazy->sink_name)) {
+        N_WARNING (LOG_CAT "lazy plugin '%s' may only register sink '%s', "
+            "sink interface '%s' not registered", lazy->name, lazy->sink_name,
+            decl->name);
+        return;
+    }
+
+    lazy->real       = *decl;
+    lazy->registered = TRUE;
+}
+
+static int
+n_core_lazy_load (NCoreLazyPlugin *lazy)
+{
+    NCore          *core    = lazy->core;
+    NSinkInterface *sink    = lazy->sink;
+    NPlugin        *plugin  = NULL;
+    gint64          started = g_get_monotonic_time ();
+    int             ret     = FALSE;
+
+    if (!(plugin = n_core_open_plugin (core, lazy->name, n_proplist_copy (lazy->params))))
+        goto failed;
+
+    core->lazy_loading = lazy;
+    core->init_plugin  = plugin;
+    ret = n_plugin_init (plugin);
+    core->lazy_loading = NULL;
+    core->init_plugin  = NULL;
+
+    if (!ret || !lazy->registered) {
+        N_WARNING (LOG_CAT "lazy plugin '%s' did not register sink '%s'",
+            lazy->name, lazy->sink_name);
+        if (ret)
+            plugin->unload (plugin);
+        n_plugin_unload (plugin);
+        lazy->registered = FALSE;
+        goto failed;
+    }
+
+    lazy->plugin = plugin;
+
+    sink->funcs            = lazy->real;
+    sink->funcs.can_handle = n_core_lazy_can_handle;
+    sink->plugin           = plugin;
+
+    /* a can_handle of the plugin has to declare its own keys. */
+    sink->plan_declared = lazy->real.can_handle ? FALSE : TRUE;
+
+    sink->init_state   = N_SINK_INIT_PENDING;
+    sink->init_started = g_get_monotonic_time ();
+
+    ret = sink->funcs.initialize ? sink->funcs.initialize (sink) : TRUE;
+    if (ret != N_SINK_INTERFACE_INIT_PENDING)
+        n_core_sink_initialized (core, sink, ret);
+
+    if (sink->init_state == N_SINK_INIT_FAILED) {
+        n_core_lazy_unload (lazy, FALSE);
+        goto failed;
+    }
+
+    n_core_clear_sink_plans (core);
+
+    N_INFO (LOG_CAT "loaded plugin '%s' on demand (%" G_GINT64_FORMAT " us)",
+        lazy->name, g_get_monotonic_time () - started);
+
+    if (lazy->unload_timeout > 0) {
+        lazy->plays = sink->plays;
+        lazy->unload_source = g_timeout_add_seconds (lazy->unload_timeout,
+            n_core_lazy_idle_cb, lazy);
+    }
+
+    return TRUE;
+
+failed:
+    N_ERROR (LOG_CAT "unable to load plugin '%s' on demand, sink '%s' disabled",
+        lazy->name, lazy->sink_name);
+    lazy->failed = TRUE;
+
+    return FALSE;
+}
+
+static void
+n_core_lazy_unload (NCoreLazyPlugin *lazy, gboolean shutdown_sink)
+{
+    NSinkInterface *sink = lazy->sink;
+
+    if (lazy->unload_source) {
+        g_source_remove (lazy->unload_source);
+        lazy->unload_source = 0;
+    }
+
+    if (!lazy->plugin)
+        return;
+
+    if (sink && shutdown_sink && sink->funcs.shutdown)
+        sink->funcs.shutdown (sink);
+
+    lazy->plugin->unload (lazy->plugin);
+    n_plugin_unload (lazy->plugin);
+    lazy->plugin     = NULL;
+    lazy->registered = FALSE;
+
+    if (!sink)
+        return;
+
+    sink->funcs         = lazy->stub;
+    sink->userdata      = NULL;
+    sink->plugin        = NULL;
+    sink->init_state    = N_SINK_INIT_READY;
+    sink->plan_declared = TRUE;
+
+    n_core_clear_sink_plans (lazy->core);
+}
+
+static gboolean
+n_core_lazy_in_use (NCoreLazyPlugin *lazy)
+{
+    GList           *iter = NULL;
+    NSinkInterface **sink = NULL;
+
+    for (iter = g_list_first (lazy->core->requests); iter; iter = g_list_next (iter)) {
+        for (sink = ((NRequest*) iter->data)->all_sinks; sink && *sink; ++sink) {
+            if (*sink == lazy->sink)
+                return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static gboolean
+n_core_lazy_idle_cb (gpointer userdata)
+{
+    NCoreLazyPlugin *lazy = (NCoreLazyPlugin*) userdata;
+
+    /* played since the last check, wait for another quiet period. */
+    if (lazy->plays != lazy->sink->plays || n_core_lazy_in_use (lazy)) {
+        lazy->plays = lazy->sink->plays;
+        return TRUE;
+    }
+
+    N_INFO (LOG_CAT "unloading idle plugin '%s'", lazy->name);
+
+    lazy->unload_source = 0;
+    n_core_lazy_unload (lazy, TRUE);
+
+    return FALSE;
+}
+
+static void
+n_core_lazy_free (NCoreLazyPlugin *lazy)
+{
+    n_proplist_free (lazy->params);
+    g_strfreev (lazy->keys);
+    g_free (lazy->sink_type);
+    g_free (lazy->sink_name);
+    g_free (lazy->name);
+    g_free (lazy);
+}
+
+void
+n_core_lazy_shutdown (NCore *core)
+{
+    g_assert (core != NULL);
+
+    NCoreLazyPlugin *lazy = NULL;
+    GList           *iter = NULL;
+
+    /* the sinks have been shut down and freed with the other sinks. */
+    for (iter = g_list_first (core->lazy_plugins); iter; iter = g_list_next (iter)) {
+        lazy = (NCoreLazyPlugin*) iter->data;
+        lazy->sink = NULL;
+        n_core_lazy_unload (lazy, FALSE);
+        n_core_lazy_free (lazy);
+    }
+
+    g_list_free (core->lazy_plugins);
+    core->lazy_plugins = NULL;
+}
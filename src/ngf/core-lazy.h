@@ -0,0 +1,38 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_CORE_LAZY_H
+#define N_CORE_LAZY_H
+
+#include <ngf/proplist.h>
+#include "core-internal.h"
+#include "sinkinterface-internal.h"
+
+/* Lazy plugins are declared in the plugin configuration with
+ * "lazy = true". The core registers a stub sink for them that handles
+ * requests with any of the "lazy.keys" properties, and loads the real
+ * plugin on the first such request. */
+
+int  n_core_lazy_add_plugin    (NCore *core, const char *plugin_name,
+                                NProplist *params);
+void n_core_lazy_register_sink (NCore *core, const NSinkInterfaceDecl *decl);
+void n_core_lazy_shutdown      (NCore *core);
+
+#endif /* N_CORE_LAZY_H */
@@ -20,30 +20,146 @@
  */
 
 #include "core-player.h"
+#include "plugin-internal.h"
+#include "probes.h"
+#include "allocstats.h"
+#include "wakeup-internal.h"
 #include <string.h>
 
 #define LOG_CAT         "core: "
-#define FALLBACK_SUFFIX ".fallback"
 #define MAX_TIMEOUT_KEY "core.max_timeout"
-#define POLICY_TIMEOUT_KEY "play.timeout"
+#define COALESCE_WINDOW_KEY "core.coalesce_window"
+#define COALESCE_MODE_KEY   "core.coalesce"
+#define SYNC_START_KEY      "core.sync_start"
+#define PRIORITY_KEY        "core.priority"
+#define SLOTS_KEY           "core.slots"
+#define PREEMPT_KEY         "core.preempt"
+#define CRITICAL_KEY        "core.critical"
+#define ROUTE_KEY           "core.route"
+#define WATCHDOG_PLAY_KEY   "core.watchdog_play"
+#define ROUTE_LOOP_KEY      "sound.repeat"
+
+/* request keys of the volume fades, a request with any of them needs
+   a sink that can fade. */
+static const char *route_fade_keys[] = {
+    "sound.fade-in",
+    "sound.fade-out",
+    "sound.fade-pause",
+    "sound.fade-resume",
+    "sound.fade-stop",
+    NULL
+};
+
+/* number of sink plans kept for each event */
+#define SINK_PLAN_MAX_PER_EVENT (8)
+
+/* output resources prioritized requests compete for. */
+#define N_CORE_SLOT_AUDIO   (1 << 0)
+#define N_CORE_SLOT_VIBRA   (1 << 1)
+#define N_CORE_SLOT_LEDS    (1 << 2)
+#define N_CORE_SLOT_ALL     (N_CORE_SLOT_AUDIO | N_CORE_SLOT_VIBRA | N_CORE_SLOT_LEDS)
+
+/* what a request does when a higher priority one needs its slots. */
+typedef enum _NCoreYield
+{
+    N_CORE_YIELD_MIX = 0,       /* keep playing alongside */
+    N_CORE_YIELD_STOP,          /* stop, or don't start at all */
+    N_CORE_YIELD_PAUSE          /* pause, or wait to start, until the slots free */
+} NCoreYield;
+
+typedef enum _NCoreSchedule
+{
+    N_CORE_SCHEDULE_PLAY = 0,
+    N_CORE_SCHEDULE_QUEUE,
+    N_CORE_SCHEDULE_DROP
+} NCoreSchedule;
+
+typedef struct _NSinkPlanKey
+{
+    NAtom       atom;
+    gboolean    context;        /* context value instead of request property */
+    gboolean    value;          /* value matters, not only presence */
+} NSinkPlanKey;
+
+typedef struct _NSinkPlanFilter
+{
+    NHookCallback  callback;
+    void          *userdata;
+} NSinkPlanFilter;
+
+typedef struct _NSinkPlan
+{
+    NValue    **values;         /* plan key values, NULL when unset */
+    guint       num_values;
+    NSinkSet    sinks;          /* capable and filtered sinks */
+} NSinkPlan;
+
+/* threaded prepare of a sink, see prepare_work in NSinkInterfaceDecl */
+typedef struct _NCorePrepareJob
+{
+    NRequest       *request;
+    NSinkInterface *sink;
+    guint           id;
+    int             result;
+} NCorePrepareJob;
 
 static gboolean n_core_max_timeout_reached_cb         (gpointer userdata);
 static void     n_core_setup_max_timeout              (NRequest *request);
 static void     n_core_clear_max_timeout              (NRequest *request);
+static guint    n_core_watchdog_play_deadline         (NRequest *request);
+static gboolean n_core_watchdog_cb                    (gpointer userdata);
+static void     n_core_setup_watchdog                 (NRequest *request);
+static void     n_core_clear_watchdog                 (NRequest *request);
 static void     n_core_fire_new_request_hook          (NRequest *request);
 static void     n_core_fire_transform_properties_hook (NRequest *request);
-static GList*   n_core_fire_filter_sinks_hook         (NRequest *request, GList *sinks);
-static GList*   n_core_query_capable_sinks            (NRequest *request);
+static NSinkSet n_core_fire_filter_sinks_hook         (NRequest *request, NSinkSet sinks);
+static NSinkSet n_core_query_capable_sinks            (NRequest *request);
+static gboolean n_core_sink_plan_enabled              (NCore *core);
+static const NValue* n_core_sink_plan_value           (NRequest *request, const NSinkPlanKey *key);
+static NSinkPlan* n_core_sink_plan_lookup             (NRequest *request);
+static void     n_core_sink_plan_store                (NRequest *request, NSinkSet sinks);
+static void     n_core_sink_plan_free                 (NSinkPlan *plan);
+static void     n_core_sink_plan_list_free            (gpointer data);
+static NSinkSet n_core_resolve_sinks                  (NRequest *request);
+static gboolean n_core_route_cheaper                  (const NSinkCost *cost, const NSinkCost *best);
+static NSinkSet n_core_route_sinks                    (NRequest *request, NSinkSet sinks,
+                                                       gboolean count);
+static guint    n_core_sink_set_count                 (NSinkSet sinks);
+static NSinkInterface** n_core_sink_set_to_array      (NRequest *request, NSinkSet sinks);
 static void     n_core_merge_request_properties       (NRequest *request, NEvent *event);
+static NRequest* n_core_find_coalesce_target          (NCore *core, NRequest *request,
+                                                       gint64 window_us);
+static gboolean n_core_coalesce_request               (NCore *core, NRequest *request);
+static void     n_core_add_request                    (NCore *core, NRequest *request);
+static void     n_core_add_timeline                   (NCore *core, gchar *timeline);
+static void     n_core_remove_request                 (NCore *core, NRequest *request);
+static int      n_core_start_request                  (NCore *core, NRequest *request);
+static const char* n_core_request_invalid_file        (NCore *core, NRequest *request);
+static guint    n_core_parse_slots                    (const char *str);
+static gboolean n_core_request_blocked                (NCore *core, NRequest *request);
+static void     n_core_preempt_requests               (NCore *core, NRequest *request);
+static NCoreSchedule n_core_schedule_request          (NCore *core, NRequest *request);
+static void     n_core_unschedule_request             (NCore *core, NRequest *request);
+static void     n_core_reschedule                     (NCore *core);
+static int      n_core_process_request                (NCore *core, NRequest *request);
+static gboolean n_core_request_waits_startup          (NCore *core, NRequest *request);
+static gboolean n_core_startup_dispatch_cb            (gpointer userdata);
 
 static void     n_core_send_reply               (NRequest *request, NCorePlayerState status);
 static void     n_core_send_error               (NRequest *request, const char *err_msg);
-static int      n_core_sink_in_list             (GList *sinks, NSinkInterface *sink);
-static int      n_core_sink_priority_cmp        (gconstpointer in_a, gconstpointer in_b);
+static int      n_core_sink_in_set              (NSinkSet set, NSinkInterface *sink);
 static gboolean n_core_sink_synchronize_done_cb (gpointer userdata);
 static gboolean n_core_request_done_cb          (gpointer userdata);
-static void     n_core_stop_sinks               (GList *sinks, NRequest *request);
-static int      n_core_prepare_sinks            (GList *sinks, NRequest *request);
+static guint    n_core_request_idle             (NRequest *request, GSourceFunc callback);
+static void     n_core_record_dispatch_lag      (NRequest *request);
+static void     n_core_stop_sinks               (NSinkSet sinks, NRequest *request);
+static void     n_core_prepare_work_cb          (gpointer userdata);
+static void     n_core_prepare_done_cb          (gpointer userdata);
+static void     n_core_prepare_job_free         (gpointer userdata);
+static void     n_core_submit_prepare           (NRequest *request, GList *sinks);
+static void     n_core_cancel_prepare           (NRequest *request, NSinkInterface *sink);
+static NCorePrepareJob* n_core_find_prepare     (NRequest *request, NSinkInterface *sink);
+static int      n_core_prepare_sinks            (NSinkSet sinks, NRequest *request);
 
 
 
@@ -69,8 +185,8 @@ n_core_setup_max_timeout (NRequest *request)
 
     if (request->timeout_ms > 0) {
         N_DEBUG (LOG_CAT "maximum timeout set to %d", request->timeout_ms);
-        request->max_timeout_id = g_timeout_add (request->timeout_ms,
-            n_core_max_timeout_reached_cb, request);
+        request->max_timeout_id = n_timers_add (request->core->timers,
+            request->timeout_ms, n_core_max_timeout_reached_cb, request);
     }
 }
 
@@ -81,11 +197,146 @@ n_core_clear_max_timeout (NRequest *request)
 
     if (request->max_timeout_id > 0) {
         N_DEBUG (LOG_CAT "maximum timeout callback removed.");
-        g_source_remove (request->max_timeout_id);
+        n_timers_remove (request->core->timers, request->max_timeout_id);
         request->max_timeout_id = 0;
     }
 }
 
+/* The watchdog fails the sinks that stay too long in a stage of the
+ * request: a threaded prepare that has not returned, a prepared sink
+ * that has not synchronized and, only if a play deadline is set, a
+ * playing sink that has not completed. Failing the sink stops all the
+ * sinks of the request, so their resources are released, and plays the
+ * fallback. The timer is kept for the nearest deadline only. */
+
+static guint
+n_core_watchdog_play_deadline (NRequest *request)
+{
+    const NValue *value = NULL;
+
+    /* most events have no natural length, e.g. repeated ringtones, the
+       event may set its own play deadline. */
+
+    if (request->event &&
+        (value = n_proplist_get (request->event->properties, WATCHDOG_PLAY_KEY)) != NULL)
+        return (guint) MAX (n_value_get_int (value), 0);
+
+    return request->core->watchdog_play;
+}
+
+static gboolean
+n_core_watchdog_cb (gpointer userdata)
+{
+    NRequest          *request  = (NRequest*) userdata;
+    NCore             *core     = request->core;
+    NSinkInterface   **iter     = NULL;
+    NSinkInterface    *sink     = NULL;
+    NRequestSinkTimes *times    = NULL;
+    NCorePrepareJob   *job      = NULL;
+    const char        *stage    = NULL;
+    gchar             *label    = NULL;
+    guint              play     = n_core_watchdog_play_deadline (request);
+    gint64             now      = g_get_monotonic_time ();
+    gint64             next     = G_MAXINT64;
+    gint64             since    = 0;
+    gint64             deadline = 0;
+
+    request->watchdog_id = 0;
+
+    if (request->stop_source_id > 0)
+        return FALSE;
+
+    for (iter = request->all_sinks; iter && *iter; ++iter) {
+        sink = *iter;
+        job  = NULL;
+
+        if (n_core_sink_in_set (request->watchdog_stalled, sink) ||
+            !(times = n_request_get_sink_times (request, sink)))
+            continue;
+
+        if (n_core_sink_in_set (request->sinks_preparing, sink)) {
+            job      = n_core_find_prepare (request, sink);
+            stage    = job ? "prepare" : "synchronize";
+            deadline = job ? core->watchdog_prepare : core->watchdog_synchronize;
+            since    = times->stage;
+        }
+        else if (n_core_sink_in_set (request->sinks_playing, sink) && !request->is_paused) {
+            stage    = "play";
+            deadline = play;
+            since    = times->stage;
+        }
+        else
+            continue;
+
+        if (deadline == 0 || since == 0)
+            continue;
+
+        deadline = since + deadline * 1000;
+        if (now < deadline) {
+            next = MIN (next, deadline);
+            continue;
+        }
+
+        request->watchdog_stalled |= N_SINK_SET_BIT (sink);
+        label = g_strdup_printf ("%s.%s", sink->name, stage);
+        n_metric_family_inc (core->metric_watchdog, label);
+        g_free (label);
+
+        /* cancelling a job still running in its thread would block the
+           main loop until it returns, it is only recorded. */
+
+        if (job && n_workers_running (core->workers, job->id)) {
+            N_WARNING (LOG_CAT "prepare of sink '%s' for request '%s' is stuck in its thread",
+                sink->name, request->name);
+            continue;
+        }
+
+        N_WARNING (LOG_CAT "sink '%s' stalled in %s of request '%s', failing it",
+            sink->name, stage, request->name);
+        n_core_fail_sink (core, sink, request);
+        return FALSE;
+    }
+
+    if (next != G_MAXINT64)
+        request->watchdog_id = n_timers_add (core->timers,
+            (guint) ((next - now + 999) / 1000), n_core_watchdog_cb, request);
+
+    return FALSE;
+}
+
+static void
+n_core_setup_watchdog (NRequest *request)
+{
+    NCore *core     = request->core;
+    guint  deadline = 0;
+    guint  play     = 0;
+
+    if (request->watchdog_id > 0)
+        return;
+
+    /* the first check is at the earliest deadline any stage can have,
+       the callback moves on to the next one. */
+
+    deadline = core->watchdog_prepare;
+    if (core->watchdog_synchronize > 0 && (deadline == 0 || core->watchdog_synchronize < deadline))
+        deadline = core->watchdog_synchronize;
+    if ((play = n_core_watchdog_play_deadline (request)) > 0 && (deadline == 0 || play < deadline))
+        deadline = play;
+
+    if (deadline > 0)
+        request->watchdog_id = n_timers_add (core->timers, deadline,
+            n_core_watchdog_cb, request);
+}
+
+static void
+n_core_clear_watchdog (NRequest *request)
+{
+    if (request->watchdog_id > 0) {
+        n_timers_remove (request->core->timers, request->watchdog_id);
+        request->watchdog_id = 0;
+    }
+}
+
 static void
 n_core_fire_new_request_hook (NRequest *request)
 {
@@ -110,54 +361,699 @@ n_core_fire_transform_properties_hook (NRequest *request)
     n_core_fire_hook (request->core, N_CORE_HOOK_TRANSFORM_PROPERTIES, &transform_data);
 }
 
-static GList*
-n_core_fire_filter_sinks_hook (NRequest *request, GList *sinks)
+static NSinkSet
+n_core_fire_filter_sinks_hook (NRequest *request, NSinkSet sinks)
 {
     g_assert (request != NULL);
     g_assert (request->core != NULL);
 
-    NCoreHookFilterSinksData filter_sinks_data;
+    NCore                    *core  = request->core;
+    NSinkInterface          **sink  = NULL;
+    GList                    *iter  = NULL;
+    NCoreHookFilterSinksData  filter_sinks_data;
+
+    /* the hook edits a list of the sinks, it is built only when there
+       is someone to edit it. */
+    if (core->hooks[N_CORE_HOOK_FILTER_SINKS].num_slots == 0)
+        return sinks;
 
     filter_sinks_data.request = request;
-    filter_sinks_data.sinks   = sinks;
-    n_core_fire_hook (request->core, N_CORE_HOOK_FILTER_SINKS, &filter_sinks_data);
+    filter_sinks_data.sinks   = NULL;
 
-    return filter_sinks_data.sinks;
+    for (sink = core->sinks_by_priority; sink && *sink; ++sink) {
+        if (n_core_sink_in_set (sinks, *sink)) {
+            filter_sinks_data.sinks = g_list_prepend (filter_sinks_data.sinks, *sink);
+            N_ALLOC_COUNT (N_ALLOC_LIST, sizeof (GList));
+        }
+    }
+    filter_sinks_data.sinks = g_list_reverse (filter_sinks_data.sinks);
+
+    n_core_fire_hook (core, N_CORE_HOOK_FILTER_SINKS, &filter_sinks_data);
+
+    sinks = 0;
+    for (iter = g_list_first (filter_sinks_data.sinks); iter; iter = g_list_next (iter))
+        sinks |= N_SINK_SET_BIT ((NSinkInterface*) iter->data);
+    g_list_free (filter_sinks_data.sinks);
+
+    return sinks;
 }
 
-static GList*
+static NSinkSet
 n_core_query_capable_sinks (NRequest *request)
 {
     g_assert (request != NULL);
     g_assert (request->core != NULL);
 
     NCore           *core  = request->core;
-    GList           *sinks = NULL;
+    NSinkSet         sinks = 0;
     NSinkInterface **iter  = NULL;
 
     for (iter = core->sinks; *iter; ++iter) {
+        /* skip sinks still initializing or failed to initialize. on an
+           early start the sinks not yet initialized are skipped too. */
+        if ((*iter)->init_state == N_SINK_INIT_PENDING ||
+            (*iter)->init_state == N_SINK_INIT_FAILED)
+            continue;
+
+        if ((*iter)->init_state == N_SINK_INIT_NONE && core->early_start)
+            continue;
+
         if ((*iter)->funcs.can_handle && !(*iter)->funcs.can_handle (*iter, request))
             continue;
 
-        sinks = g_list_append (sinks, *iter);
+        sinks |= N_SINK_SET_BIT (*iter);
     }
 
     return sinks;
 }
 
+/* Sink plans cache the capable, filtered and sorted sinks per event. A
+ * plan is reused when all values of the declared plan keys are the same
+ * as when the plan was resolved. Caching is only possible when every
+ * sink with a can_handle function and every filter hook callback have
+ * declared what their decision depends on. */
+
+static gboolean
+n_core_sink_plan_filter_declared (NCore *core, NHookSlot *slot)
+{
+    NSinkPlanFilter *filter = NULL;
+    guint            i;
+
+    for (i = 0; core->sink_plan_filters && i < core->sink_plan_filters->len; i++) {
+        filter = &g_array_index (core->sink_plan_filters, NSinkPlanFilter, i);
+        if (filter->callback == slot->callback && filter->userdata == slot->userdata)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gboolean
+n_core_sink_plan_enabled (NCore *core)
+{
+    NSinkInterface **iter = NULL;
+    NHook           *hook = &core->hooks[N_CORE_HOOK_FILTER_SINKS];
+    guint            i;
+
+    if (!core->sinks)
+        return FALSE;
+
+    for (iter = core->sinks; *iter; ++iter) {
+        if ((*iter)->funcs.can_handle && !(*iter)->plan_declared)
+            return FALSE;
+    }
+
+    for (i = 0; i < hook->num_slots; i++) {
+        if (!n_core_sink_plan_filter_declared (core, hook->slots[i]))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static const NValue*
+n_core_sink_plan_value (NRequest *request, const NSinkPlanKey *key)
+{
+    if (key->context)
+        return n_context_get_value_by_atom (request->core->context, key->atom);
+
+    return n_proplist_get_by_atom (request->properties, key->atom);
+}
+
+static NSinkPlan*
+n_core_sink_plan_lookup (NRequest *request)
+{
+    NCore              *core  = request->core;
+    GList              *iter  = NULL;
+    NSinkPlan          *plan  = NULL;
+    const NSinkPlanKey *key   = NULL;
+    const NValue       *value = NULL;
+    guint               i;
+
+    iter = g_hash_table_lookup (core->sink_plans, request->event);
+    for (; iter; iter = g_list_next (iter)) {
+        plan = (NSinkPlan*) iter->data;
+
+        for (i = 0; i < plan->num_values; i++) {
+            key   = &g_array_index (core->sink_plan_keys, NSinkPlanKey, i);
+            value = n_core_sink_plan_value (request, key);
+
+            if (!value != !plan->values[i])
+                break;
+            if (key->value && value && !n_value_equals (value, plan->values[i]))
+                break;
+        }
+
+        if (i == plan->num_values)
+            return plan;
+    }
+
+    return NULL;
+}
+
+static void
+n_core_sink_plan_store (NRequest *request, NSinkSet sinks)
+{
+    NCore              *core  = request->core;
+    GList              *plans = NULL;
+    GList              *last  = NULL;
+    NSinkPlan          *plan  = NULL;
+    const NSinkPlanKey *key   = NULL;
+    const NValue       *value = NULL;
+    guint               i;
+
+    plan             = g_new0 (NSinkPlan, 1);
+    plan->num_values = core->sink_plan_keys ? core->sink_plan_keys->len : 0;
+    plan->values     = g_new0 (NValue*, plan->num_values);
+    plan->sinks      = sinks;
+
+    for (i = 0; i < plan->num_values; i++) {
+        key = &g_array_index (core->sink_plan_keys, NSinkPlanKey, i);
+        if ((value = n_core_sink_plan_value (request, key)))
+            plan->values[i] = n_value_copy (value);
+    }
+
+    /* steal the list so that replacing it doesn't free the plans. */
+    plans = g_hash_table_lookup (core->sink_plans, request->event);
+    g_hash_table_steal (core->sink_plans, request->event);
+
+    plans = g_list_prepend (plans, plan);
+    N_ALLOC_COUNT (N_ALLOC_LIST, sizeof (GList));
+    if (g_list_length (plans) > SINK_PLAN_MAX_PER_EVENT) {
+        last = g_list_last (plans);
+        n_core_sink_plan_free (last->data);
+        plans = g_list_delete_link (plans, last);
+    }
+
+    g_hash_table_insert (core->sink_plans, request->event, plans);
+}
+
+static void
+n_core_sink_plan_free (NSinkPlan *plan)
+{
+    guint i;
+
+    for (i = 0; i < plan->num_values; i++) {
+        if (plan->values[i])
+            n_value_free (plan->values[i]);
+    }
+
+    g_free (plan->values);
+    g_free (plan);
+}
+
+static void
+n_core_sink_plan_list_free (gpointer data)
+{
+    g_list_free_full ((GList*) data, (GDestroyNotify) n_core_sink_plan_free);
+}
+
+static NSinkSet
+n_core_resolve_sinks (NRequest *request)
+{
+    NCore     *core      = request->core;
+    NSinkPlan *plan      = NULL;
+    NSinkSet   sinks     = 0;
+    gboolean   cacheable = FALSE;
+
+    if ((cacheable = n_core_sink_plan_enabled (core))) {
+        if (!core->sink_plans) {
+            core->sink_plans = g_hash_table_new_full (g_direct_hash,
+                g_direct_equal, NULL, n_core_sink_plan_list_free);
+        }
+
+        /* plans refer to events, drop them when the event list changes. */
+        if (core->sink_plan_list_generation != core->eventlist->generation) {
+            g_hash_table_remove_all (core->sink_plans);
+            core->sink_plan_list_generation = core->eventlist->generation;
+        }
+
+        if ((plan = n_core_sink_plan_lookup (request))) {
+            N_DEBUG (LOG_CAT "using cached sink plan for request '%s'",
+                request->name);
+            core->sink_plan_hits++;
+            return plan->sinks;
+        }
+
+        core->sink_plan_misses++;
+    }
+
+    sinks = n_core_query_capable_sinks (request);
+    sinks = n_core_fire_filter_sinks_hook (request, sinks);
+
+    if (cacheable)
+        n_core_sink_plan_store (request, sinks);
+
+    return sinks;
+}
+
+static gboolean
+n_core_route_cheaper (const NSinkCost *cost, const NSinkCost *best)
+{
+    if (cost->setup_us != best->setup_us)
+        return cost->setup_us < best->setup_us;
+
+    return cost->cached && !best->cached;
+}
+
+/* Route the request to the cheapest of the audio sinks with a cost
+ * function. The cost depends on the sink state, e.g. what is cached,
+ * so routing is done for every request after the sink plan. Sinks
+ * that can not fade or repeat the sound are only chosen for requests
+ * that do not need it, if none of them can the request is played by
+ * all of them as before. */
+static NSinkSet
+n_core_route_sinks (NRequest *request, NSinkSet sinks, gboolean count)
+{
+    NCore           *core       = request->core;
+    NSinkInterface **sink       = NULL;
+    NSinkInterface  *best       = NULL;
+    NSinkSet         candidates = 0;
+    NSinkCost        best_cost;
+    NSinkCost        cost;
+    const char     **key        = NULL;
+    gboolean         need_fade  = FALSE;
+    gboolean         need_loop  = FALSE;
+
+    if (n_proplist_has_key (request->properties, ROUTE_KEY) &&
+        !n_proplist_get_bool (request->properties, ROUTE_KEY))
+        return sinks;
+
+    need_loop = n_proplist_get_bool (request->properties, ROUTE_LOOP_KEY);
+    for (key = route_fade_keys; *key && !need_fade; ++key)
+        need_fade = n_proplist_has_key (request->properties, *key);
+
+    memset (&best_cost, 0, sizeof (best_cost));
+
+    for (sink = core->sinks_by_priority; sink && *sink; ++sink) {
+        if (!n_core_sink_in_set (sinks, *sink) || !(*sink)->funcs.cost ||
+            g_strcmp0 ((*sink)->type, N_SINK_INTERFACE_TYPE_AUDIO) != 0)
+            continue;
+
+        memset (&cost, 0, sizeof (cost));
+        if (!(*sink)->funcs.cost (*sink, request, &cost))
+            continue;
+
+        candidates |= N_SINK_SET_BIT (*sink);
+
+        if ((need_fade && !cost.can_fade) || (need_loop && !cost.can_loop))
+            continue;
+
+        if (!best || n_core_route_cheaper (&cost, &best_cost)) {
+            best      = *sink;
+            best_cost = cost;
+        }
+    }
+
+    if (n_core_sink_set_count (candidates) < 2)
+        return sinks;
+
+    if (!best) {
+        N_DEBUG (LOG_CAT "no audio sink can serve request '%s' fully, not routed",
+            request->name);
+        if (count)
+            n_metric_counter_inc (core->metric_route_unmet);
+        return sinks;
+    }
+
+    N_DEBUG (LOG_CAT "request '%s' routed to sink '%s' (setup %u us%s)",
+        request->name, best->name, best_cost.setup_us,
+        best_cost.cached ? ", cached" : "");
+    if (count)
+        n_metric_family_inc (core->metric_routes, best->name);
+
+    return (sinks & ~candidates) | N_SINK_SET_BIT (best);
+}
+
+static guint
+n_core_sink_set_count (NSinkSet sinks)
+{
+    guint count = 0;
+
+    for (; sinks; sinks &= sinks - 1)
+        count++;
+
+    return count;
+}
+
+/* the sinks of the set in priority order, NULL terminated. the array
+   lives in the request arena. priority is set automatically for each
+   sink if "core.sink_order" key is set. */
+static NSinkInterface**
+n_core_sink_set_to_array (NRequest *request, NSinkSet sinks)
+{
+    NSinkInterface **array = NULL;
+    NSinkInterface **sink  = NULL;
+    guint            i     = 0;
+
+    array = n_request_alloc (request,
+        (n_core_sink_set_count (sinks) + 1) * sizeof (NSinkInterface*));
+
+    for (sink = request->core->sinks_by_priority; sink && *sink; ++sink) {
+        if (n_core_sink_in_set (sinks, *sink))
+            array[i++] = *sink;
+    }
+
+    return array;
+}
+
 static void
 n_core_merge_request_properties (NRequest *request, NEvent *event)
 {
     g_assert (request != NULL);
     g_assert (event != NULL);
 
-    NProplist *copy = NULL;
+    NProplist *merged = NULL;
 
-    copy = n_proplist_copy (event->properties);
-    n_proplist_merge (copy, request->properties);
+    /* event properties are shared, request only allocates for the
+       keys it changes afterwards. */
+    merged = n_proplist_new_layered (event->properties, request->properties);
 
     n_proplist_free (request->properties);
-    request->properties = copy;
+    request->properties = merged;
+}
+
+static NRequest*
+n_core_find_coalesce_target (NCore *core, NRequest *request, gint64 window_us)
+{
+    NRequest *active = NULL;
+    GList    *iter   = NULL;
+    gint64    now    = g_get_monotonic_time ();
+    int       size   = 0;
+
+    for (iter = g_list_first (core->requests); iter; iter = g_list_next (iter)) {
+        active = (NRequest*) iter->data;
+
+        if (active->event != request->event ||
+            active->input_iface != request->input_iface ||
+            active->stop_source_id > 0 || active->is_paused || active->is_fallback)
+            continue;
+
+        if (now - active->timeline[N_REQUEST_STAGE_RESOLVED] > window_us)
+            continue;
+
+        /* the client is identified by the properties set by the input
+           interface, so matching properties means the same client. */
+        size = n_proplist_size (request->original_properties);
+        if (n_proplist_size (active->original_properties) != size)
+            continue;
+
+        if (size == 0 || n_proplist_match_exact (active->original_properties,
+                                                 request->original_properties))
+            return active;
+    }
+
+    return NULL;
+}
+
+static gboolean
+n_core_coalesce_request (NCore *core, NRequest *request)
+{
+    g_assert (core != NULL);
+    g_assert (request != NULL);
+
+    const NValue *value  = NULL;
+    const char   *mode   = NULL;
+    NRequest     *active = NULL;
+    gint          window = 0;
+
+    value = n_proplist_get (request->event->properties, COALESCE_WINDOW_KEY);
+    if (!value || (window = n_value_get_int (value)) <= 0)
+        return FALSE;
+
+    if (!(active = n_core_find_coalesce_target (core, request, (gint64) window * 1000)))
+        return FALSE;
+
+    n_metric_counter_inc (core->metric_coalesced);
+    mode = n_proplist_get_string (request->event->properties, COALESCE_MODE_KEY);
+
+    if (mode && g_str_equal (mode, "restart")) {
+        /* the new request replaces the one playing. */
+        N_DEBUG (LOG_CAT "request '%s' (%u) restarts request %u", request->name,
+            request->id, active->id);
+        n_core_stop_request (core, active, 0);
+        return FALSE;
+    }
+
+    /* merge into the request playing, the new one completes right
+       away without any sink work. */
+    N_DEBUG (LOG_CAT "request '%s' (%u) merged into request %u", request->name,
+        request->id, active->id);
+    request->stop_source_id = n_core_request_idle (request, n_core_request_done_cb);
+
+    return TRUE;
+}
+
+static void
+n_core_add_request (NCore *core, NRequest *request)
+{
+    g_assert (core != NULL);
+    g_assert (request != NULL);
+    g_assert (request->link == NULL);
+
+    core->requests = g_list_prepend (core->requests, request);
+    N_ALLOC_COUNT (N_ALLOC_LIST, sizeof (GList));
+    request->link  = core->requests;
+    g_hash_table_insert (core->request_table, GUINT_TO_POINTER (request->id),
+        request);
+    n_metric_gauge_set (core->metric_active, g_hash_table_size (core->request_table));
+    n_memory_set_busy (core->memory, TRUE);
+    n_wakeups_set_active (TRUE);
+}
+
+static void
+n_core_remove_request (NCore *core, NRequest *request)
+{
+    g_assert (core != NULL);
+    g_assert (request != NULL);
+
+    if (!request->link)
+        return;
+
+    core->requests = g_list_delete_link (core->requests, request->link);
+    request->link  = NULL;
+    g_hash_table_remove (core->request_table, GUINT_TO_POINTER (request->id));
+    n_metric_gauge_set (core->metric_active, g_hash_table_size (core->request_table));
+#ifdef ENABLE_ALLOC_STATS
+    n_metric_counter_inc (core->metric_alloc_requests);
+#endif
+    n_core_sync_alloc_stats (core);
+    n_core_report_alloc_stats (core, request);
+
+    /* caches are trimmed once the daemon has been idle for a while */
+    if (g_hash_table_size (core->request_table) == 0) {
+        n_memory_set_busy (core->memory, FALSE);
+        n_wakeups_set_active (FALSE);
+    }
+}
+
+static guint
+n_core_parse_slots (const char *str)
+{
+    gchar **split = NULL;
+    gchar **item  = NULL;
+    guint   slots = 0;
+
+    if (!str)
+        return N_CORE_SLOT_ALL;
+
+    split = g_strsplit (str, ",", -1);
+    for (item = split; *item; ++item) {
+        g_strstrip (*item);
+
+        if (g_str_equal (*item, "audio"))
+            slots |= N_CORE_SLOT_AUDIO;
+        else if (g_str_equal (*item, "vibra"))
+            slots |= N_CORE_SLOT_VIBRA;
+        else if (g_str_equal (*item, "leds"))
+            slots |= N_CORE_SLOT_LEDS;
+        else if (**item)
+            N_WARNING (LOG_CAT "unknown slot '%s' in '%s'", *item, str);
+    }
+    g_strfreev (split);
+
+    return slots;
+}
+
+/* a request is blocked by the requests of the same or higher priority
+   holding any of its slots. */
+static gboolean
+n_core_request_blocked (NCore *core, NRequest *request)
+{
+    GList    *iter   = NULL;
+    NRequest *active = NULL;
+
+    for (iter = g_list_first (core->scheduled); iter; iter = g_list_next (iter)) {
+        active = (NRequest*) iter->data;
+
+        if (active == request || active->sched_queued || active->sched_paused)
+            continue;
+
+        if ((active->sched_slots & request->sched_slots) &&
+            active->sched_priority >= request->sched_priority)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+n_core_preempt_requests (NCore *core, NRequest *request)
+{
+    GList    *iter   = NULL;
+    NRequest *active = NULL;
+
+    for (iter = g_list_first (core->scheduled); iter; iter = g_list_next (iter)) {
+        active = (NRequest*) iter->data;
+
+        if (active == request || active->sched_queued || active->sched_paused)
+            continue;
+
+        if (!(active->sched_slots & request->sched_slots) ||
+            active->sched_priority >= request->sched_priority)
+            continue;
+
+        switch (active->sched_yield) {
+            case N_CORE_YIELD_STOP:
+                N_DEBUG (LOG_CAT "request %u preempts request %u", request->id, active->id);
+                n_metric_counter_inc (core->metric_preempted);
+                n_core_stop_request (core, active, 0);
+                break;
+
+            case N_CORE_YIELD_PAUSE:
+                if (active->is_paused)
+                    break;
+                N_DEBUG (LOG_CAT "request %u pauses request %u", request->id, active->id);
+                n_metric_counter_inc (core->metric_preempted);
+                n_core_pause_request (core, active);
+                active->sched_paused = TRUE;
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+/* requests of events with a core.priority hold the slots given in
+   core.slots (all by default). a lower priority request yields according
+   to its core.preempt: "stop", "pause" or "mix" (default). */
+static NCoreSchedule
+n_core_schedule_request (NCore *core, NRequest *request)
+{
+    const NValue *value = NULL;
+    const char   *yield = NULL;
+
+    if (!(value = n_proplist_get (request->event->properties, PRIORITY_KEY)))
+        return N_CORE_SCHEDULE_PLAY;
+
+    request->sched_priority = n_value_get_int (value);
+    request->sched_slots    = n_core_parse_slots (
+        n_proplist_get_string (request->event->properties, SLOTS_KEY));
+    request->sched_yield    = N_CORE_YIELD_MIX;
+
+    if ((yield = n_proplist_get_string (request->event->properties, PREEMPT_KEY))) {
+        if (g_str_equal (yield, "stop"))
+            request->sched_yield = N_CORE_YIELD_STOP;
+        else if (g_str_equal (yield, "pause"))
+            request->sched_yield = N_CORE_YIELD_PAUSE;
+    }
+
+    if (!request->sched_slots)
+        return N_CORE_SCHEDULE_PLAY;
+
+    if (n_core_request_blocked (core, request)) {
+        switch (request->sched_yield) {
+            case N_CORE_YIELD_STOP:
+                N_DEBUG (LOG_CAT "request '%s' (%u) dropped for a higher priority request",
+                    request->name, request->id);
+                request->sched_slots = 0;
+                n_metric_counter_inc (core->metric_preempted);
+                return N_CORE_SCHEDULE_DROP;
+
+            case N_CORE_YIELD_PAUSE:
+                N_DEBUG (LOG_CAT "request '%s' (%u) queued for a higher priority request",
+                    request->name, request->id);
+                request->sched_queued = TRUE;
+                core->scheduled = g_list_append (core->scheduled, request);
+                N_ALLOC_COUNT (N_ALLOC_LIST, sizeof (GList));
+                n_metric_counter_inc (core->metric_preempted);
+                return N_CORE_SCHEDULE_QUEUE;
+
+            default:
+                break;
+        }
+    }
+
+    n_core_preempt_requests (core, request);
+    core->scheduled = g_list_append (core->scheduled, request);
+    N_ALLOC_COUNT (N_ALLOC_LIST, sizeof (GList));
+
+    return N_CORE_SCHEDULE_PLAY;
+}
+
+static void
+n_core_unschedule_request (NCore *core, NRequest *request)
+{
+    if (!request->sched_slots)
+        return;
+
+    core->scheduled      = g_list_remove (core->scheduled, request);
+    request->sched_slots  = 0;
+    request->sched_queued = FALSE;
+    request->sched_paused = FALSE;
+}
+
+static gint
+n_core_schedule_priority_cmp (gconstpointer in_a, gconstpointer in_b)
+{
+    const NRequest *a = in_a;
+    const NRequest *b = in_b;
+
+    return (a->sched_priority > b->sched_priority) ? -1 :
+           (a->sched_priority < b->sched_priority) ? 1 : 0;
+}
+
+/* resume and start the requests no longer blocked, higher priorities
+   first. */
+static void
+n_core_reschedule (NCore *core)
+{
+    GList    *waiting = NULL;
+    GList    *iter    = NULL;
+    NRequest *request = NULL;
+
+    for (iter = g_list_first (core->scheduled); iter; iter = g_list_next (iter)) {
+        request = (NRequest*) iter->data;
+        if (request->sched_queued || request->sched_paused) {
+            waiting = g_list_prepend (waiting, request);
+            N_ALLOC_COUNT (N_ALLOC_LIST, sizeof (GList));
+        }
+    }
+
+    waiting = g_list_sort (g_list_reverse (waiting), n_core_schedule_priority_cmp);
+
+    for (iter = g_list_first (waiting); iter; iter = g_list_next (iter)) {
+        request = (NRequest*) iter->data;
+
+        if (request->stop_source_id > 0 || n_core_request_blocked (core, request))
+            continue;
+
+        n_core_preempt_requests (core, request);
+
+        if (request->sched_paused) {
+            N_DEBUG (LOG_CAT "resuming preempted request %u", request->id);
+            request->sched_paused = FALSE;
+            n_core_resume_request (core, request);
+        }
+        else {
+            N_DEBUG (LOG_CAT "starting queued request %u", request->id);
+            request->sched_queued = FALSE;
+            n_core_start_request (core, request);
+        }
+    }
+
+    g_list_free (waiting);
 }
 
 static void
@@ -185,93 +1081,236 @@ n_core_send_error (NRequest *request, const char *err_msg)
 }
 
 static int
-n_core_sink_in_list (GList *sinks, NSinkInterface *sink)
+n_core_sink_in_set (NSinkSet set, NSinkInterface *sink)
 {
-    if (!sinks || !sink)
+    if (!set || !sink)
         return FALSE;
 
-    return g_list_find (sinks, sink) != NULL ? TRUE : FALSE;
+    return (set & N_SINK_SET_BIT (sink)) ? TRUE : FALSE;
 }
 
-static int
-n_core_sink_priority_cmp (gconstpointer in_a, gconstpointer in_b)
+/* idles of critical requests are dispatched before other pending work,
+   the delay to the dispatch is recorded to see that they are. */
+static guint
+n_core_request_idle (NRequest *request, GSourceFunc callback)
 {
-    NSinkInterface *a = (NSinkInterface*) in_a;
-    NSinkInterface *b = (NSinkInterface*) in_b;
+    request->source_queued = g_get_monotonic_time ();
 
-    if (a->priority > b->priority)
-        return -1;
-    else if (b->priority > a->priority)
-        return 1;
+    return g_idle_add_full (n_request_get_source_priority (request, G_PRIORITY_DEFAULT_IDLE),
+                            callback, request, NULL);
+}
+
+static void
+n_core_record_dispatch_lag (NRequest *request)
+{
+    NCore *core = request->core;
+
+    if (request->source_queued == 0 || !core)
+        return;
 
-    return 0;
+    n_metric_histogram_add (request->is_critical ? core->metric_critical_lag
+                                                 : core->metric_dispatch_lag,
+                            g_get_monotonic_time () - request->source_queued);
+    request->source_queued = 0;
 }
 
 static gboolean
 n_core_sink_synchronize_done_cb (gpointer userdata)
 {
-    NRequest       *request   = (NRequest*) userdata;
-    NCore          *core      = request->core;
-    GList          *iter      = NULL;
-    NSinkInterface *sink      = NULL;
+    NRequest          *request   = (NRequest*) userdata;
+    NCore             *core      = request->core;
+    NSinkInterface   **iter      = NULL;
+    NSinkInterface    *sink      = NULL;
+    NRequestSinkTimes *times     = NULL;
+    gint               lead      = 0;
+
+    n_core_record_dispatch_lag (request);
 
     /* setup the maximum timeout callback. */
     n_core_setup_max_timeout (request);
 
-    /* all sinks have been synchronized for the request. call play for every
-       prepared sink. */
+    /* all sinks have been synchronized for the request. call play for every
+       prepared sink. */
+
+    request->play_source_id = 0;
+    n_request_mark (request, N_REQUEST_STAGE_SYNCHRONIZED);
+    N_PROBE2 (request_synchronized, request->id, request->name);
+
+    /* with a synchronized start the sinks are given a common start time
+       far enough in the future to cover the play calls, and start their
+       output against it. */
+
+    if (request->event &&
+        (lead = n_proplist_get_int (request->event->properties, SYNC_START_KEY)) > 0) {
+        request->start_time = g_get_monotonic_time () + (gint64) lead * 1000;
+        N_DEBUG (LOG_CAT "request '%s' starts in %d ms", request->name, lead);
+    }
+
+    for (iter = request->all_sinks; iter && *iter; ++iter) {
+        sink = *iter;
+
+        if (!n_core_sink_in_set (request->sinks_prepared, sink))
+            continue;
+
+        N_PROBE2 (sink_play, request->id, sink->name);
+
+        if (!sink->funcs.play (sink, request)) {
+            N_WARNING (LOG_CAT "sink '%s' failed play request '%s'",
+                sink->name, request->name);
+
+            n_core_fail_sink (core, sink, request);
+            return FALSE;
+        }
+
+        if ((times = n_request_get_sink_times (request, sink)) && !times->play) {
+            times->play = g_get_monotonic_time ();
+            n_metric_histogram_add (sink->play_metric,
+                times->play - n_request_get_timestamp (request, N_REQUEST_STAGE_RECEIVED));
+        }
+        if (times)
+            times->stage = g_get_monotonic_time ();
+        if (sink == request->master_sink)
+            n_request_mark (request, N_REQUEST_STAGE_MASTER_PLAY);
+        n_request_mark (request, N_REQUEST_STAGE_PLAYING);
+
+        /* sinks without prepare are stopped once they have played. */
+        if (!sink->funcs.prepare)
+            request->sinks_stop |= N_SINK_SET_BIT (sink);
+
+        request->sinks_playing |= N_SINK_SET_BIT (sink);
+        sink->plays++;
+    }
+
+    request->sinks_prepared = 0;
+
+    return FALSE;
+}
+
+static void
+n_core_stop_sinks (NSinkSet sinks, NRequest *request)
+{
+    NSinkInterface **iter = NULL;
+    NSinkInterface *sink = NULL;
+
+    for (iter = request->all_sinks; iter && *iter && sinks; ++iter) {
+        sink = *iter;
+
+        if (!n_core_sink_in_set (sinks, sink))
+            continue;
+
+        sinks &= ~N_SINK_SET_BIT (sink);
+        n_core_cancel_prepare (request, sink);
+        if (sink->funcs.stop)
+            sink->funcs.stop (sink, request);
+    }
+}
+
+static void
+n_core_prepare_work_cb (gpointer userdata)
+{
+    NCorePrepareJob *job = (NCorePrepareJob*) userdata;
+
+    job->result = job->sink->funcs.prepare_work (job->sink, job->request);
+}
+
+static void
+n_core_prepare_done_cb (gpointer userdata)
+{
+    NCorePrepareJob *job     = (NCorePrepareJob*) userdata;
+    NRequest        *request = job->request;
+
+    request->prepare_jobs = g_list_remove (request->prepare_jobs, job);
 
-    request->play_source_id = 0;
-    for (iter = g_list_first (request->sinks_prepared); iter; iter = g_list_next (iter)) {
-        sink = (NSinkInterface*) iter->data;
+    if (!job->result) {
+        N_WARNING (LOG_CAT "sink '%s' failed to prepare request '%s'",
+            job->sink->name, request->name);
 
-        if (!sink->funcs.play (sink, request)) {
-            N_WARNING (LOG_CAT "sink '%s' failed play request '%s'",
-                sink->name, request->name);
+        n_core_fail_sink (request->core, job->sink, request);
+        return;
+    }
 
-            n_core_fail_sink (core, sink, request);
-            return FALSE;
-        }
+    n_core_synchronize_sink (request->core, job->sink, request);
+}
 
-        if (!sink->funcs.prepare) {
-            if (n_core_sink_in_list (request->stop_list, sink))
-                request->stop_list = g_list_append (request->stop_list, sink);
-        }
+static void
+n_core_prepare_job_free (gpointer userdata)
+{
+    g_slice_free (NCorePrepareJob, userdata);
+}
+
+static void
+n_core_submit_prepare (NRequest *request, GList *sinks)
+{
+    NWorkers        *workers = request->core->workers;
+    GList           *iter    = NULL;
+    NCorePrepareJob *job     = NULL;
 
-        request->sinks_playing = g_list_append (request->sinks_playing,
-            sink);
+    for (iter = g_list_first (sinks); iter; iter = g_list_next (iter)) {
+        job = g_slice_new0 (NCorePrepareJob);
+        job->request = request;
+        job->sink    = (NSinkInterface*) iter->data;
+
+        request->prepare_jobs = g_list_prepend (request->prepare_jobs, job);
+        N_ALLOC_COUNT (N_ALLOC_LIST, sizeof (GList));
+        job->id = n_workers_submit (workers, n_core_prepare_work_cb,
+            n_core_prepare_done_cb, job, n_core_prepare_job_free);
     }
+}
 
-    g_list_free (request->sinks_prepared);
-    request->sinks_prepared = NULL;
+static NCorePrepareJob*
+n_core_find_prepare (NRequest *request, NSinkInterface *sink)
+{
+    GList *iter = NULL;
 
-    return FALSE;
+    for (iter = g_list_first (request->prepare_jobs); iter; iter = g_list_next (iter)) {
+        if (((NCorePrepareJob*) iter->data)->sink == sink)
+            return (NCorePrepareJob*) iter->data;
+    }
+
+    return NULL;
 }
 
 static void
-n_core_stop_sinks (GList *sinks, NRequest *request)
+n_core_cancel_prepare (NRequest *request, NSinkInterface *sink)
 {
-    GList          *iter = NULL;
-    NSinkInterface *sink = NULL;
+    GList           *iter = NULL;
+    NCorePrepareJob *job  = NULL;
 
-    for (iter = g_list_first (sinks); iter; iter = g_list_next (iter)) {
-        sink = (NSinkInterface*) iter->data;
-	 if (sink && sink->funcs.stop)
-	     sink->funcs.stop (sink, request);
+    for (iter = g_list_first (request->prepare_jobs); iter; iter = g_list_next (iter)) {
+        job = (NCorePrepareJob*) iter->data;
+
+        if (job->sink != sink)
+            continue;
+
+        N_DEBUG (LOG_CAT "cancelling prepare of sink '%s'", sink->name);
+        request->prepare_jobs = g_list_delete_link (request->prepare_jobs, iter);
+        (void) n_workers_cancel (request->core->workers, job->id);
+        return;
     }
 }
 
 static int
-n_core_prepare_sinks (GList *sinks, NRequest *request)
+n_core_prepare_sinks (NSinkSet sinks, NRequest *request)
 {
     g_assert (request != NULL);
 
-    NCore          *core = request->core;
-    GList          *iter = NULL;
-    NSinkInterface *sink = NULL;
+    NCore             *core  = request->core;
+    NSinkInterface   **iter  = NULL;
+    GList             *work  = NULL;
+    NSinkInterface    *sink  = NULL;
+    NRequestSinkTimes *times = NULL;
 
-    for (iter = g_list_first (sinks); iter; iter = g_list_next (iter)) {
-        sink = (NSinkInterface*) iter->data;
+    for (iter = request->all_sinks; iter && *iter; ++iter) {
+        sink = *iter;
+
+        if (!n_core_sink_in_set (sinks, sink))
+            continue;
+
+        if ((times = n_request_get_sink_times (request, sink))) {
+            times->stage = g_get_monotonic_time ();
+            if (!times->prepare)
+                times->prepare = times->stage;
+        }
 
         if (!sink->funcs.prepare) {
             N_DEBUG (LOG_CAT "sink has no prepare, synchronizing immediately");
@@ -284,13 +1323,24 @@ n_core_prepare_sinks (GList *sinks, NRequest *request)
                 sink->name, request->name);
 
             n_core_fail_sink (core, sink, request);
+            g_list_free (work);
             return FALSE;
         }
 
-        if (!n_core_sink_in_list (request->stop_list, sink))
-            request->stop_list = g_list_append (request->stop_list, sink);
+        request->sinks_stop |= N_SINK_SET_BIT (sink);
+
+        if (sink->funcs.prepare_work) {
+            work = g_list_append (work, sink);
+            N_ALLOC_COUNT (N_ALLOC_LIST, sizeof (GList));
+        }
     }
 
+    /* blocking parts of the prepares run concurrently once every sink has
+       stored its data, the request is synchronized with the slowest one. */
+
+    n_core_submit_prepare (request, work);
+    g_list_free (work);
+
     return TRUE;
 }
 
@@ -300,9 +1350,9 @@ n_translate_fallback (const char *key, const NValue *value, gpointer userdata)
     NProplist *props = (NProplist*) userdata;
     gchar *new_key = NULL;
 
-    if (g_str_has_suffix (key, FALLBACK_SUFFIX)) {
+    if (g_str_has_suffix (key, N_EVENT_FALLBACK_SUFFIX)) {
         new_key = g_strdup (key);
-        new_key[strlen (key) - strlen (FALLBACK_SUFFIX)] = 0;
+        new_key[strlen (key) - strlen (N_EVENT_FALLBACK_SUFFIX)] = 0;
         n_proplist_set (props, new_key, n_value_copy (value));
         g_free (new_key);
     }
@@ -314,36 +1364,99 @@ n_find_fallback_cb (const char *key, const NValue *value, gpointer userdata)
     (void) value;
 
     gboolean *has_fallbacks = (gboolean*) userdata;
-    if (g_str_has_suffix (key, FALLBACK_SUFFIX))
+    if (g_str_has_suffix (key, N_EVENT_FALLBACK_SUFFIX))
         *has_fallbacks = TRUE;
 }
 
+static gboolean
+n_core_request_has_fallbacks (NRequest *request)
+{
+    gboolean has_fallbacks = FALSE;
+
+    /* fallback keys of the event are known already, only the keys of
+       the request itself need to be looked at. */
+
+    if (request->event && request->event->num_fallbacks > 0)
+        return TRUE;
+
+    n_proplist_foreach (request->original_properties, n_find_fallback_cb, &has_fallbacks);
+
+    return has_fallbacks;
+}
+
+static void
+n_core_apply_fallbacks (NRequest *request)
+{
+    const NEvent *event = request->event;
+    NValue       *value = NULL;
+    guint         i;
+
+    /* the translated keys are written on top of the merged properties,
+       so the event properties below stay shared. */
+
+    for (i = 0; i < event->num_fallbacks; i++) {
+        value = n_proplist_get_by_atom (request->properties, event->fallbacks[2 * i]);
+        if (value)
+            n_proplist_set_by_atom (request->properties, event->fallbacks[2 * i + 1],
+                                    n_value_copy (value));
+    }
+
+    n_proplist_foreach (request->original_properties, n_translate_fallback,
+                        request->properties);
+}
+
 static gboolean
 n_core_request_done_cb (gpointer userdata)
 {
     NRequest  *request       = (NRequest*) userdata;
     NRequest  *fallback      = NULL;
     NCore     *core          = request->core;
-    gboolean   has_fallbacks = FALSE;
+    gchar     *timeline      = NULL;
+    gint64     skew          = 0;
+
+    n_core_record_dispatch_lag (request);
 
     /* ensure that maximum timeout is removed. */
     n_core_clear_max_timeout (request);
+    n_core_clear_watchdog (request);
 
     /* all sinks have been either completed or the request failed. we will run
        a stop on each sink and then clear out the request. */
 
     request->stop_source_id = 0;
-    core->requests = g_list_remove (core->requests, request);
+    n_core_remove_request (core, request);
+
+    if (request->startup_queued) {
+        core->startup_queue     = g_list_remove (core->startup_queue, request);
+        request->startup_queued = FALSE;
+    }
+    N_PROBE3 (request_done, request->id, request->name, request->has_failed);
 
     N_DEBUG (LOG_CAT "stopping all sinks for request '%s'", request->name);
-    n_core_stop_sinks (request->stop_list, request);
+    n_core_stop_sinks (request->sinks_stop, request);
+
+    /* the slots are free for the requests waiting for them. */
+    if (request->sched_slots) {
+        n_core_unschedule_request (core, request);
+        n_core_reschedule (core);
+    }
+
+    n_request_mark (request, N_REQUEST_STAGE_DONE);
+    if ((skew = n_request_get_start_skew (request)) >= 0)
+        n_metric_histogram_add (core->metric_start_skew, skew);
+    /* formatting the timeline costs more than the rest of the
+       bookkeeping, only do it for the log or the kept history. */
+    if (N_LOG_ENABLED (N_LOG_LEVEL_INFO) || core->timeline_history > 0) {
+        timeline = n_request_timeline_to_string (request);
+        N_INFO (LOG_CAT "timeline %s", timeline);
+        n_core_add_timeline (core, timeline);
+    }
 
-    g_list_free (request->stop_list);
-    g_list_free (request->sinks_resync);
-    g_list_free (request->sinks_playing);
-    g_list_free (request->sinks_prepared);
-    g_list_free (request->sinks_preparing);
-    g_list_free (request->all_sinks);
+    /* the array itself lives in the request arena */
+    request->all_sinks = NULL;
+
+    if (request->has_failed)
+        n_metric_counter_inc (core->metric_failed);
 
     if (request->has_failed && request->is_fallback) {
         /* if the fallback failed, bail out. */
@@ -364,8 +1477,7 @@ n_core_request_done_cb (gpointer userdata)
 
     /* try fallbacks */
 
-    n_proplist_foreach (request->properties, n_find_fallback_cb, &has_fallbacks);
-    if (!has_fallbacks) {
+    if (!n_core_request_has_fallbacks (request)) {
         /* no fallbacks for the request, error out */
         n_core_send_error (request, "no fallbacks!");
         goto done;
@@ -378,8 +1490,10 @@ n_core_request_done_cb (gpointer userdata)
 
     fallback              = n_request_copy (request);
     fallback->is_fallback = TRUE;
+    n_metric_counter_inc (core->metric_fallbacks);
 
     n_request_free (request);
+    n_core_free_retired_events (core);
 
     n_core_play_request (core, fallback);
 
@@ -389,6 +1503,7 @@ done:
     /* free the actual request */
     N_DEBUG (LOG_CAT "request '%s' done", request->name);
     n_request_free (request);
+    n_core_free_retired_events (core);
 
     return FALSE;
 }
@@ -396,18 +1511,15 @@ done:
 int
 n_core_play_request (NCore *core, NRequest *request)
 {
-    NProplist *new_props     = NULL;
-
     g_assert (core != NULL);
     g_assert (request != NULL);
 
-    GList  *all_sinks = NULL;
-
     /* store the original request properties and default timeout */
 
     request->original_properties = n_proplist_copy (request->properties);
     request->timeout_ms = n_proplist_get_uint (request->properties, POLICY_TIMEOUT_KEY);
     request->core = core;
+    N_PROBE3 (request_play, request->id, request->name, request->is_fallback);
 
     /* evaluate the request and context to resolve the correct event for
        this specific request. if no event, then there is no default event
@@ -418,12 +1530,188 @@ n_core_play_request (NCore *core, NRequest *request)
         N_WARNING (LOG_CAT "unable to resolve event for request '%s'",
             request->name);
         request->no_event = TRUE;
+        n_metric_counter_inc (core->metric_no_event);
         goto fail_request;
     }
 
+    n_request_mark (request, N_REQUEST_STAGE_RESOLVED);
+    n_metric_family_inc (core->metric_requests, request->event->name);
+    request->is_critical = n_proplist_get_bool (request->event->properties, CRITICAL_KEY);
+    N_PROBE3 (request_resolved, request->id, request->name, request->event->name);
+
     N_DEBUG (LOG_CAT "request '%s' resolved to event '%s'", request->name,
         request->event->name);
 
+    /* during an early start the request waits until the sinks it may
+       need have initialized. */
+
+    if (core->early_start && n_core_request_waits_startup (core, request)) {
+        N_DEBUG (LOG_CAT "request '%s' (%u) waits for sinks to initialize",
+            request->name, request->id);
+        request->startup_queued = TRUE;
+        core->startup_queue = g_list_append (core->startup_queue, request);
+        N_ALLOC_COUNT (N_ALLOC_LIST, sizeof (GList));
+        return TRUE;
+    }
+
+    return n_core_process_request (core, request);
+
+fail_request:
+    request->has_failed     = TRUE;
+    request->stop_source_id = n_core_request_idle (request, n_core_request_done_cb);
+
+    return TRUE;
+}
+
+static int
+n_core_process_request (NCore *core, NRequest *request)
+{
+    /* identical requests in quick succession share the sink work. */
+
+    if (!request->is_fallback && n_core_coalesce_request (core, request))
+        return TRUE;
+
+    /* prioritized requests may have to wait for or give way to others
+       using the same slots, before any sink work is done. */
+
+    switch (n_core_schedule_request (core, request)) {
+        case N_CORE_SCHEDULE_QUEUE:
+            return TRUE;
+
+        case N_CORE_SCHEDULE_DROP:
+            request->stop_source_id = n_core_request_idle (request, n_core_request_done_cb);
+            return TRUE;
+
+        default:
+            break;
+    }
+
+    return n_core_start_request (core, request);
+}
+
+/* a request waits for the sinks of required plugins that have not
+   finished their initialization. a plugin listing the request keys its
+   sink handles in startup.keys is only waited for by the requests with
+   any of the keys. */
+static gboolean
+n_core_request_waits_startup (NCore *core, NRequest *request)
+{
+    NSinkInterface **iter = NULL;
+    gchar          **key  = NULL;
+
+    for (iter = core->sinks; iter && *iter; ++iter) {
+        if ((*iter)->init_state == N_SINK_INIT_READY ||
+            (*iter)->init_state == N_SINK_INIT_FAILED)
+            continue;
+
+        if ((*iter)->plugin && !(*iter)->plugin->required)
+            continue;
+
+        if (!(*iter)->startup_keys)
+            return TRUE;
+
+        for (key = (*iter)->startup_keys; *key; ++key) {
+            if (n_proplist_has_key (request->properties, *key) ||
+                n_proplist_has_key (request->event->properties, *key))
+                return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static gboolean
+n_core_startup_dispatch_cb (gpointer userdata)
+{
+    NCore    *core    = (NCore*) userdata;
+    GList    *iter    = NULL;
+    GList    *next    = NULL;
+    NRequest *request = NULL;
+
+    core->startup_source = 0;
+
+    for (iter = g_list_first (core->startup_queue); iter; iter = next) {
+        next    = g_list_next (iter);
+        request = (NRequest*) iter->data;
+
+        /* stopped while waiting, removed when done. paused while
+           waiting, dispatched again when resumed. */
+        if (request->stop_source_id > 0 || request->is_paused ||
+            n_core_request_waits_startup (core, request))
+            continue;
+
+        core->startup_queue     = g_list_delete_link (core->startup_queue, iter);
+        request->startup_queued = FALSE;
+        n_metric_histogram_add (core->metric_startup_wait,
+            g_get_monotonic_time () - request->timeline[N_REQUEST_STAGE_RESOLVED]);
+
+        N_DEBUG (LOG_CAT "starting request '%s' (%u) waiting for sinks",
+            request->name, request->id);
+        n_core_process_request (core, request);
+    }
+
+    return FALSE;
+}
+
+void
+n_core_dispatch_startup_queue (NCore *core)
+{
+    g_assert (core != NULL);
+
+    if (!core->startup_queue || core->startup_source > 0)
+        return;
+
+    core->startup_source = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+        n_core_startup_dispatch_cb, core, NULL);
+}
+
+void
+n_core_free_startup_queue (NCore *core)
+{
+    g_assert (core != NULL);
+
+    if (core->startup_source > 0) {
+        g_source_remove (core->startup_source);
+        core->startup_source = 0;
+    }
+
+    g_list_free (core->startup_queue);
+    core->startup_queue = NULL;
+}
+
+/* Returns the path of a file of the request known to be invalid, if
+ * the request can fall back to another event. Files not checked yet
+ * are left for the sinks to find out. */
+
+static const char*
+n_core_request_invalid_file (NCore *core, NRequest *request)
+{
+    const NValue *value = NULL;
+    const char   *path  = NULL;
+    guint         i;
+
+    if (!core->filecheck || request->is_fallback)
+        return NULL;
+
+    for (i = 0; i < core->num_file_check_keys; i++) {
+        value = n_proplist_get_by_atom (request->properties, core->file_check_keys[i]);
+        if (!value || n_value_type (value) != N_VALUE_TYPE_STRING)
+            continue;
+
+        path = n_value_get_string (value);
+        if (n_file_check_lookup (core->filecheck, path) == N_FILE_STATE_INVALID)
+            return n_core_request_has_fallbacks (request) ? path : NULL;
+    }
+
+    return NULL;
+}
+
+static int
+n_core_start_request (NCore *core, NRequest *request)
+{
+    NSinkSet    sinks    = 0;
+    const char *invalid  = NULL;
+
     /* fire the hook before merge */
 
     n_core_fire_new_request_hook (request);
@@ -433,45 +1721,52 @@ n_core_play_request (NCore *core, NRequest *request)
     n_core_merge_request_properties (request, request->event);
 
     /* check if fallbacks need to be used */
-    if (request->is_fallback) {
-        new_props = n_proplist_copy (request->properties);
-        n_proplist_foreach (request->properties,
-            n_translate_fallback, new_props);
-        n_proplist_free (request->properties);
-        request->properties  = new_props;
-    }
+    if (request->is_fallback)
+        n_core_apply_fallbacks (request);
 
     n_core_fire_transform_properties_hook (request);
 
-    /* query and filter capable sinks */
+    /* a file already known to be missing or broken would only fail in
+       the sinks, go to the fallback right away. */
+
+    if ((invalid = n_core_request_invalid_file (core, request)) != NULL) {
+        N_INFO (LOG_CAT "file '%s' of request '%s' is invalid, using the fallback",
+            invalid, request->name);
+        n_metric_counter_inc (core->metric_invalid_file);
+        goto fail_request;
+    }
+
+    /* query, filter and sort capable sinks, or use the cached plan, and
+       route the request to the cheapest audio sink */
 
-    all_sinks = n_core_query_capable_sinks (request);
-    all_sinks = n_core_fire_filter_sinks_hook (request, all_sinks);
+    sinks = n_core_resolve_sinks (request);
+    sinks = n_core_route_sinks (request, sinks, TRUE);
+    n_request_mark (request, N_REQUEST_STAGE_HOOKS_DONE);
 
     /* if no sinks left, then nothing to do. */
 
-    if (!all_sinks) {
+    if (!sinks) {
         N_WARNING (LOG_CAT "no sinks that can handle the request '%s'",
             request->name);
         goto fail_request;
     }
 
-    /* sort the sinks based on their priority. priority is set automatically for
-       each sink if "core.sink_order" key is set. */
-
-    all_sinks = g_list_sort (all_sinks, n_core_sink_priority_cmp);
-
     /* setup the sinks for the play data */
 
-    request->all_sinks       = all_sinks;
-    request->sinks_preparing = g_list_copy (all_sinks);
-    request->master_sink     = (NSinkInterface*) ((g_list_first (all_sinks))->data);
+    request->sink_times      = n_request_alloc (request,
+        core->num_sinks * sizeof (NRequestSinkTimes));
+    request->num_sink_times  = core->num_sinks;
+    request->all_sinks       = n_core_sink_set_to_array (request, sinks);
+    request->sinks_preparing = sinks;
+    request->master_sink     = request->all_sinks[0];
 
     /* prepare all sinks that can handle the event. if there is no preparation
        function defined within the sink, then it is synchronized immediately. */
 
-    core->requests = g_list_append (core->requests, request);
-    n_core_prepare_sinks (all_sinks, request);
+    n_core_add_request (core, request);
+    N_PROBE3 (request_prepare, request->id, request->name, n_core_sink_set_count (sinks));
+    n_core_prepare_sinks (sinks, request);
+    n_core_setup_watchdog (request);
 
     n_core_send_reply (request, N_CORE_EVENT_PLAYING);
 
@@ -479,18 +1774,60 @@ n_core_play_request (NCore *core, NRequest *request)
 
 fail_request:
     request->has_failed     = TRUE;
-    request->stop_source_id = g_idle_add (n_core_request_done_cb, request);
+    request->stop_source_id = n_core_request_idle (request, n_core_request_done_cb);
 
     return TRUE;
 }
 
+void
+n_core_prewarm_request (NCore *core, NRequest *request)
+{
+    g_assert (core != NULL);
+    g_assert (request != NULL);
+
+    NSinkInterface **sink  = NULL;
+    NSinkSet         sinks = 0;
+
+    /* resolve the request exactly like it would be played, but only let
+       the sinks prepare their resources. the request is never added to
+       the active requests and no replies are sent for it. */
+
+    request->core = core;
+
+    if (!(request->event = n_core_evaluate_request (core, request))) {
+        N_DEBUG (LOG_CAT "no event to prewarm for request '%s'", request->name);
+        goto done;
+    }
+
+    n_core_fire_new_request_hook (request);
+    n_core_merge_request_properties (request, request->event);
+    n_core_fire_transform_properties_hook (request);
+
+    sinks = n_core_resolve_sinks (request);
+    sinks = n_core_route_sinks (request, sinks, FALSE);
+
+    for (sink = core->sinks_by_priority; sink && *sink; ++sink) {
+        if (!(sinks & N_SINK_SET_BIT (*sink)) || !(*sink)->funcs.prewarm)
+            continue;
+
+        N_DEBUG (LOG_CAT "prewarming sink '%s' for event '%s'", (*sink)->name,
+            request->event->name);
+        (*sink)->funcs.prewarm (*sink, request);
+    }
+
+    n_metric_counter_inc (core->metric_prewarmed);
+
+done:
+    n_request_free (request);
+}
+
 int
 n_core_pause_request (NCore *core, NRequest *request)
 {
     g_assert (core != NULL);
     g_assert (request != NULL);
 
-    GList          *iter = NULL;
+    NSinkInterface **iter = NULL;
     NSinkInterface *sink = NULL;
     int all_paused = 1;
 
@@ -500,8 +1837,8 @@ n_core_pause_request (NCore *core, NRequest *request)
         return TRUE;
     }
 
-    for (iter = g_list_first (request->all_sinks); iter; iter = g_list_next (iter)) {
-        sink = (NSinkInterface*) iter->data;
+    for (iter = request->all_sinks; iter && *iter; ++iter) {
+        sink = *iter;
 
         if (sink->funcs.pause && !sink->funcs.pause (sink, request)) {
             N_WARNING (LOG_CAT "sink '%s' failed to pause request '%s'",
@@ -513,6 +1850,9 @@ n_core_pause_request (NCore *core, NRequest *request)
     if (all_paused)
         n_core_send_reply (request, N_CORE_EVENT_PAUSED);
 
+    /* the time paused does not count against any deadline. */
+    n_core_clear_watchdog (request);
+
     request->is_paused = TRUE;
     return TRUE;
 }
@@ -523,9 +1863,13 @@ n_core_resume_request (NCore *core, NRequest *request)
     g_assert (core != NULL);
     g_assert (request != NULL);
 
-    GList          *iter = NULL;
-    NSinkInterface *sink = NULL;
+    NSinkInterface **iter    = NULL;
+    NSinkInterface *sink    = NULL;
+    NRequestSinkTimes *times = NULL;
+    gint64          started = 0;
+    gint64          elapsed = 0;
     int all_resumed = 1;
+    int resumed     = 1;
 
     if (!request->is_paused) {
         N_DEBUG (LOG_CAT "request '%s' is not paused, no action.",
@@ -533,20 +1877,51 @@ n_core_resume_request (NCore *core, NRequest *request)
         return TRUE;
     }
 
-    for (iter = g_list_first (request->all_sinks); iter; iter = g_list_next (iter)) {
-        sink = (NSinkInterface*) iter->data;
+    /* a request that has not started yet has no sinks to resume, it is
+       started from the startup queue and replies then. */
+    if (request->startup_queued) {
+        request->is_paused = FALSE;
+        n_core_dispatch_startup_queue (core);
+        return TRUE;
+    }
+
+    started = g_get_monotonic_time ();
+
+    for (iter = request->all_sinks; iter && *iter; ++iter) {
+        sink = *iter;
 
-        if (sink->funcs.play && !sink->funcs.play (sink, request)) {
-            N_WARNING (LOG_CAT "sink '%s' failed to resume (play) request '%s'",
+        /* sinks that kept their state just continue, others play again */
+        if (sink->funcs.resume)
+            resumed = sink->funcs.resume (sink, request);
+        else if (sink->funcs.play)
+            resumed = sink->funcs.play (sink, request);
+        else
+            resumed = 1;
+
+        if (!resumed) {
+            N_WARNING (LOG_CAT "sink '%s' failed to resume request '%s'",
                 sink->name, request->name);
             all_resumed = 0;
         }
     }
 
+    elapsed = g_get_monotonic_time () - started;
+
+    /* the stages start over from the resume. */
+    for (iter = request->all_sinks; iter && *iter; ++iter) {
+        if ((times = n_request_get_sink_times (request, *iter)))
+            times->stage = started + elapsed;
+    }
+
+    request->num_resumes++;
+    request->resume_max = MAX (request->resume_max, elapsed);
+    n_metric_histogram_add (core->metric_resume, elapsed);
+
     if (all_resumed)
         n_core_send_reply (request, N_CORE_EVENT_PLAYING);
 
     request->is_paused = FALSE;
+    n_core_setup_watchdog (request);
     return TRUE;
 }
 
@@ -566,14 +1941,131 @@ n_core_stop_request (NCore *core, NRequest *request, guint timeout)
         request->play_source_id = 0;
     }
 
-    if (timeout > 0)
-        request->stop_source_id = g_timeout_add (timeout, n_core_request_done_cb, request);
+    n_request_mark (request, N_REQUEST_STAGE_STOP);
+    N_PROBE3 (request_stop, request->id, request->name, timeout);
+
+    if (timeout > 0) {
+        request->source_queued  = 0;
+        request->stop_source_id = g_timeout_add_full (
+            n_request_get_source_priority (request, G_PRIORITY_DEFAULT), timeout,
+            n_core_request_done_cb, request, NULL);
+    }
     else
-        request->stop_source_id = g_idle_add (n_core_request_done_cb, request);
+        request->stop_source_id = n_core_request_idle (request, n_core_request_done_cb);
 
     n_core_clear_max_timeout (request);
 }
 
+void
+n_core_add_plan_key (NCore *core, NSinkInterface *sink, const char *key,
+                     int value_matters)
+{
+    g_assert (core != NULL);
+
+    NSinkPlanKey  new_key;
+    NSinkPlanKey *k = NULL;
+    guint         i;
+
+    if (sink)
+        sink->plan_declared = TRUE;
+
+    /* no key, only declare that the decision doesn't depend on anything
+       else than the keys that have been declared. */
+    if (!key) {
+        n_core_clear_sink_plans (core);
+        return;
+    }
+
+    memset (&new_key, 0, sizeof (new_key));
+
+    if (g_str_has_prefix (key, N_EVENT_RULE_CONTEXT_PREFIX)) {
+        key = key + strlen (N_EVENT_RULE_CONTEXT_PREFIX);
+        new_key.context = TRUE;
+    }
+
+    new_key.atom  = n_atom_intern (key);
+    new_key.value = value_matters ? TRUE : FALSE;
+
+    if (!core->sink_plan_keys)
+        core->sink_plan_keys = g_array_new (FALSE, TRUE, sizeof (NSinkPlanKey));
+
+    for (i = 0; i < core->sink_plan_keys->len; i++) {
+        k = &g_array_index (core->sink_plan_keys, NSinkPlanKey, i);
+        if (k->atom == new_key.atom && k->context == new_key.context) {
+            k->value = k->value || new_key.value;
+            goto done;
+        }
+    }
+
+    g_array_append_val (core->sink_plan_keys, new_key);
+
+done:
+    N_DEBUG (LOG_CAT "sink plan depends on %s'%s'%s",
+        new_key.context ? N_EVENT_RULE_CONTEXT_PREFIX : "", key,
+        new_key.value ? "" : " (presence)");
+
+    n_core_clear_sink_plans (core);
+}
+
+void
+n_core_add_filter_plan_key (NCore *core, NHookCallback callback, void *userdata,
+                            const char *key, int value_matters)
+{
+    g_assert (core != NULL);
+    g_assert (callback != NULL);
+
+    NSinkPlanFilter  new_filter;
+    NSinkPlanFilter *filter = NULL;
+    guint            i;
+
+    if (!core->sink_plan_filters)
+        core->sink_plan_filters = g_array_new (FALSE, TRUE, sizeof (NSinkPlanFilter));
+
+    for (i = 0; i < core->sink_plan_filters->len; i++) {
+        filter = &g_array_index (core->sink_plan_filters, NSinkPlanFilter, i);
+        if (filter->callback == callback && filter->userdata == userdata)
+            break;
+    }
+
+    if (i == core->sink_plan_filters->len) {
+        new_filter.callback = callback;
+        new_filter.userdata = userdata;
+        g_array_append_val (core->sink_plan_filters, new_filter);
+    }
+
+    n_core_add_plan_key (core, NULL, key, value_matters);
+}
+
+void
+n_core_clear_sink_plans (NCore *core)
+{
+    g_assert (core != NULL);
+
+    if (core->sink_plans)
+        g_hash_table_remove_all (core->sink_plans);
+}
+
+void
+n_core_free_sink_plans (NCore *core)
+{
+    g_assert (core != NULL);
+
+    if (core->sink_plans) {
+        g_hash_table_destroy (core->sink_plans);
+        core->sink_plans = NULL;
+    }
+
+    if (core->sink_plan_keys) {
+        g_array_free (core->sink_plan_keys, TRUE);
+        core->sink_plan_keys = NULL;
+    }
+
+    if (core->sink_plan_filters) {
+        g_array_free (core->sink_plan_filters, TRUE);
+        core->sink_plan_filters = NULL;
+    }
+}
+
 void
 n_core_set_resync_on_master (NCore *core, NSinkInterface *sink,
                              NRequest *request)
@@ -588,11 +2080,10 @@ n_core_set_resync_on_master (NCore *core, NSinkInterface *sink,
         return;
     }
 
-    if (n_core_sink_in_list (request->sinks_resync, sink))
+    if (n_core_sink_in_set (request->sinks_resync, sink))
         return;
 
-    request->sinks_resync = g_list_append (request->sinks_resync,
-        sink);
+    request->sinks_resync |= N_SINK_SET_BIT (sink);
 
     N_DEBUG (LOG_CAT "sink '%s' set to resynchronize on master sink '%s'",
         sink->name, request->master_sink->name);
@@ -606,7 +2097,7 @@ n_core_resynchronize_sinks (NCore *core, NSinkInterface *sink,
     g_assert (sink != NULL);
     g_assert (request != NULL);
 
-    GList *resync_list = NULL;
+    NSinkSet resync = 0;
 
     if (request->master_sink != sink) {
         N_WARNING (LOG_CAT "sink '%s' not master sink, not resyncing.",
@@ -622,10 +2113,8 @@ n_core_resynchronize_sinks (NCore *core, NSinkInterface *sink,
     /* add the master sink to prepared list, since it only needs play
        to continue. */
 
-    request->sinks_playing  = g_list_remove (request->sinks_playing,
-        request->master_sink);
-    request->sinks_prepared = g_list_append (request->sinks_prepared,
-        request->master_sink);
+    request->sinks_playing  &= ~N_SINK_SET_BIT (request->master_sink);
+    request->sinks_prepared |= N_SINK_SET_BIT (request->master_sink);
 
     /* if resync list is empty, we'll just trigger play on the master
        sink again. */
@@ -633,36 +2122,52 @@ n_core_resynchronize_sinks (NCore *core, NSinkInterface *sink,
     if (!request->sinks_resync) {
         N_DEBUG (LOG_CAT "no sinks in resync list, triggering play for sink '%s'",
             sink->name);
-        request->play_source_id = g_idle_add (n_core_sink_synchronize_done_cb,
-            request);
+        request->play_source_id = n_core_request_idle (request, n_core_sink_synchronize_done_cb);
         return;
     }
 
-    /* first, we need to copy and clear the resync list. otherwise when the
-       list is prepared, duplicates are added. */
+    /* first, we need to take and clear the resync set, sinks may ask
+       for resync again while being prepared. */
 
-    resync_list = g_list_copy (request->sinks_resync);
-    g_list_free (request->sinks_resync);
-    request->sinks_resync = NULL;
+    resync = request->sinks_resync;
+    request->sinks_resync = 0;
 
-    /* stop all sinks in the resync list. */
+    /* stop all sinks in the resync set. */
 
-    n_core_stop_sinks (resync_list, request);
+    n_core_stop_sinks (resync, request);
 
-    /* prepare all sinks in the resync list and re-trigger the playback
+    /* prepare all sinks in the resync set and re-trigger the playback
        for them. */
 
-    request->sinks_preparing = g_list_copy (resync_list);
-    (void) n_core_prepare_sinks (resync_list, request);
+    request->sinks_preparing = resync;
+    (void) n_core_prepare_sinks (resync, request);
+    n_core_setup_watchdog (request);
+}
+
+static void
+n_core_add_timeline (NCore *core, gchar *timeline)
+{
+    g_queue_push_tail (core->timelines, timeline);
+
+    while (g_queue_get_length (core->timelines) > core->timeline_history)
+        g_free (g_queue_pop_head (core->timelines));
+}
 
-    /* clear the list copy. */
+void
+n_core_free_timelines (NCore *core)
+{
+    if (!core->timelines)
+        return;
 
-    g_list_free (resync_list);
+    g_queue_free_full (core->timelines, g_free);
+    core->timelines = NULL;
 }
 
 void
 n_core_synchronize_sink (NCore *core, NSinkInterface *sink, NRequest *request)
 {
+    NRequestSinkTimes *times = NULL;
+
     g_assert (core != NULL);
     g_assert (sink != NULL);
     g_assert (request != NULL);
@@ -685,7 +2190,7 @@ n_core_synchronize_sink (NCore *core, NSinkInterface *sink, NRequest *request)
         return;
     }
 
-    if (!n_core_sink_in_list (request->sinks_preparing, sink)) {
+    if (!n_core_sink_in_set (request->sinks_preparing, sink)) {
         N_WARNING (LOG_CAT "sink '%s' not in preparing list.",
             sink->name);
         return;
@@ -693,14 +2198,20 @@ n_core_synchronize_sink (NCore *core, NSinkInterface *sink, NRequest *request)
 
     N_DEBUG (LOG_CAT "sink '%s' synchronized for request '%s'",
         sink->name, request->name);
+    N_PROBE2 (sink_synchronized, request->id, sink->name);
+
+    if ((times = n_request_get_sink_times (request, sink)) && !times->synchronized) {
+        times->synchronized = g_get_monotonic_time ();
+        n_metric_histogram_add (sink->prepare_metric,
+            times->synchronized - times->prepare);
+    }
 
-    request->sinks_preparing = g_list_remove (request->sinks_preparing, sink);
-    request->sinks_prepared  = g_list_append (request->sinks_prepared, sink);
+    request->sinks_preparing &= ~N_SINK_SET_BIT (sink);
+    request->sinks_prepared  |= N_SINK_SET_BIT (sink);
 
     if (!request->sinks_preparing) {
         N_DEBUG (LOG_CAT "all sinks have been synchronized");
-        request->play_source_id = g_idle_add (n_core_sink_synchronize_done_cb,
-            request);
+        request->play_source_id = n_core_request_idle (request, n_core_sink_synchronize_done_cb);
     }
 }
 
@@ -721,12 +2232,12 @@ n_core_complete_sink (NCore *core, NSinkInterface *sink, NRequest *request)
 
     N_DEBUG (LOG_CAT "sink '%s' completed request '%s'",
         sink->name, request->name);
+    N_PROBE2 (sink_complete, request->id, sink->name);
 
-    request->sinks_playing = g_list_remove (request->sinks_playing, sink);
+    request->sinks_playing &= ~N_SINK_SET_BIT (sink);
     if (!request->sinks_playing) {
         N_DEBUG (LOG_CAT "all sinks have been completed");
-        request->stop_source_id = g_idle_add (n_core_request_done_cb,
-            request);
+        request->stop_source_id = n_core_request_idle (request, n_core_request_done_cb);
     }
 }
 
@@ -739,6 +2250,7 @@ n_core_fail_sink (NCore *core, NSinkInterface *sink, NRequest *request)
 
     N_WARNING (LOG_CAT "sink '%s' failed request '%s'",
         sink->name, request->name);
+    N_PROBE2 (sink_fail, request->id, sink->name);
 
     if (request->stop_source_id > 0)
         return;
@@ -746,5 +2258,5 @@ n_core_fail_sink (NCore *core, NSinkInterface *sink, NRequest *request)
     /* sink failed, so request failed */
 
     request->has_failed     = TRUE;
-    request->stop_source_id = g_idle_add (n_core_request_done_cb, request);
+    request->stop_source_id = n_core_request_idle (request, n_core_request_done_cb);
 }
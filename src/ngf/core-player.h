@@ -26,6 +26,9 @@
 #include "core-internal.h"
 #include "sinkinterface-internal.h"
 
+/* request key read by the core on every request */
+#define POLICY_TIMEOUT_KEY "play.timeout"
+
 typedef enum _NCorePlayerState
 {
     N_CORE_EVENT_FAILED         = 0,
@@ -38,6 +41,18 @@ int  n_core_play_request     (NCore *core, NRequest *request);
 int  n_core_pause_request    (NCore *core, NRequest *request);
 int  n_core_resume_request   (NCore *core, NRequest *request);
 void n_core_stop_request     (NCore *core, NRequest *request, guint timeout);
+void n_core_prewarm_request  (NCore *core, NRequest *request);
+
+void n_core_dispatch_startup_queue (NCore *core);
+void n_core_free_startup_queue     (NCore *core);
+
+void n_core_add_plan_key        (NCore *core, NSinkInterface *sink, const char *key,
+                                  int value_matters);
+void n_core_add_filter_plan_key (NCore *core, NHookCallback callback, void *userdata,
+                                 const char *key, int value_matters);
+void n_core_clear_sink_plans     (NCore *core);
+void n_core_free_sink_plans      (NCore *core);
+void n_core_free_timelines       (NCore *core);
 
 void n_core_set_resync_on_master (NCore *core, NSinkInterface *sink, NRequest *request);
 void n_core_resynchronize_sinks  (NCore *core, NSinkInterface *sink, NRequest *request);
@@ -23,6 +23,7 @@
 #include <string.h>
 #include <glib.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
 
 #include <ngf/log.h>
@@ -30,11 +31,15 @@
 #include "core-internal.h"
 #include "event-internal.h"
 #include "eventlist-internal.h"
+#include "eventdb-internal.h"
 #include "request-internal.h"
 #include "context-internal.h"
 #include "core-dbus-internal.h"
 #include "haptic-internal.h"
 #include "core-player.h"
+#include "core-lazy.h"
+#include "allocstats.h"
+#include "wakeup-internal.h"
 
 #define LOG_CAT  "core: "
 
@@ -44,20 +49,81 @@
 #define PLUGIN_CONF_PATH        "plugins.d"
 #define EVENT_CONF_PATH         "events.d"
 
+/* maximum number of resolved requests to remember. cache is flushed
+   when full. */
+#define EVENT_CACHE_MAX_SIZE    (128)
+
 #define CORE_CONF_KEYTYPES      "keytypes"
 
+/* request keys a sink is needed for, see early-start. */
+#define STARTUP_KEYS_KEY        "startup.keys"
+
+/* undeclared keys of incoming requests interned at most, separately for
+   the keys under request_key_prefixes and the others. */
+#define REQUEST_KEY_ATOMS_MAX   (256)
+
+/* keys the sinks pass on as they are, like the PulseAudio stream
+   properties of the gst and canberra sinks. */
+static const char *request_key_prefixes[] = { "sound.stream.", NULL };
+
 static gchar*     n_core_get_path               (const char *key, const char *default_path);
-static NProplist* n_core_load_params            (NCore *core, const char *plugin_name);
-static NPlugin*   n_core_open_plugin            (NCore *core, const char *plugin_name);
+static void       n_core_run_parallel           (GPtrArray *items, GFunc func);
+static GHashTable* n_core_load_plugin_conf      (NCore *core);
+static NProplist* n_core_load_params            (NCore *core, GHashTable *plugin_conf,
+                                                 const char *plugin_name);
 static int        n_core_init_plugin            (NPlugin *plugin, gboolean required);
 static void       n_core_unload_plugin          (NCore *core, NPlugin *plugin);
-static void       n_core_parse_events_from_file (NEventList *eventlist, const char *filename);
-static int        n_core_parse_events           (NEventList *eventlist, const char *conf_path);
+static int        n_core_initialize_sink        (NCore *core, NSinkInterface *sink);
+static void       n_core_set_sink_init_result   (NCore *core, NSinkInterface *sink,
+                                                 int success);
+static void       n_core_add_startup_gauge      (NCore *core, const char *kind,
+                                                 const char *name, const char *what,
+                                                 gint64 value);
+static int        n_core_initialize_inputs      (NCore *core);
+static void       n_core_report_startup         (NCore *core);
+static gboolean   n_core_request_key_has_prefix (const char *key);
+static void       n_core_init_done              (NCore *core);
+static void       n_core_event_file_free        (gpointer data);
+static int        n_core_update_events          (NCore *core);
+static int        n_core_load_events            (NCore *core);
+static void       n_core_report_events          (NCore *core);
+static void       n_core_save_events            (NCore *core);
+static void       n_core_check_event_files      (NCore *core);
 static void       n_core_parse_keytypes         (NCore *core, GKeyFile *keyfile);
 static void       n_core_parse_sink_order       (NCore *core, GKeyFile *keyfile);
 static int        n_core_parse_configuration    (NCore *core);
+#ifdef ENABLE_ALLOC_STATS
+static void       n_core_add_alloc_metrics      (NCore *core);
+#endif
+
+/* Parameters of one plugin, collected from all of its configuration files. */
+typedef struct _NCorePluginConf
+{
+    NProplist  *params;
+    GKeyFile   *keytypes;           /* keytypes from the same files */
+} NCorePluginConf;
 
-static GSList*    tmp_plugin_conf_files;
+/* Event configuration file the current events were parsed from. */
+typedef struct _NCoreEventFile
+{
+    gchar      *filename;
+    guint64     size;
+    gint64      mtime;
+    guint64     inode;
+    gchar      *checksum;           /* of the file content */
+    GHashTable *names;              /* event names defined in the file */
+    GKeyFile   *keyfile;            /* changed content, only set during update */
+    gboolean    changed;            /* only set during update */
+} NCoreEventFile;
+
+/* Configuration file read in a thread of n_core_run_parallel. */
+typedef struct _NCoreConfFile
+{
+    const gchar *filename;
+    GList       *plugins;           /* names of the plugins configured */
+    GKeyFile    *keyfile;
+    GError      *error;
+} NCoreConfFile;
 
 
 static gchar*
@@ -75,6 +141,29 @@ n_core_get_path (const char *key, const char *default_path)
     return g_strdup (source);
 }
 
+/* Runs func for each of the items, spread over a thread per processor,
+ * and returns once all of them are done. The function gets the item and
+ * NULL, and must not touch anything but the item. */
+static void
+n_core_run_parallel (GPtrArray *items, GFunc func)
+{
+    GThreadPool *pool    = NULL;
+    guint        threads = 0;
+    guint        i;
+
+    threads = MIN (g_get_num_processors (), items->len);
+    if (threads > 1)
+        pool = g_thread_pool_new (func, NULL, (gint) threads, TRUE, NULL);
+
+    for (i = 0; i < items->len; i++) {
+        if (!pool || !g_thread_pool_push (pool, g_ptr_array_index (items, i), NULL))
+            func (g_ptr_array_index (items, i), NULL);
+    }
+
+    if (pool)
+        g_thread_pool_free (pool, FALSE, TRUE);
+}
+
 static GSList*
 n_core_conf_files_from_path (const char *base_path, const char *path)
 {
@@ -124,114 +213,179 @@ done:
     return conf_files;
 }
 
-static GSList*
-n_core_plugin_conf_files (NCore *core)
+static void
+n_core_plugin_conf_free (gpointer data)
 {
-    if (tmp_plugin_conf_files)
-        return tmp_plugin_conf_files;
-
-    tmp_plugin_conf_files = n_core_conf_files_from_path (core->conf_path, PLUGIN_CONF_PATH);
+    NCorePluginConf *conf = data;
 
-    return tmp_plugin_conf_files;
+    n_proplist_free (conf->params);
+    g_key_file_free (conf->keytypes);
+    g_slice_free (NCorePluginConf, conf);
 }
 
 static void
-n_core_plugin_conf_files_done ()
+n_core_plugin_conf_parse (GHashTable *plugin_conf, GKeyFile *keyfile,
+                          const char *filename, const char *plugin_name)
 {
-    if (tmp_plugin_conf_files) {
-        g_slist_free_full (tmp_plugin_conf_files, g_free);
-        tmp_plugin_conf_files = NULL;
+    NCorePluginConf *conf  = NULL;
+    gchar          **keys  = NULL;
+    gchar          **iter  = NULL;
+    gchar           *value = NULL;
+
+    keys = g_key_file_get_keys (keyfile, plugin_name, NULL, NULL);
+    if (!keys) {
+        N_WARNING (LOG_CAT "no group '%s' within configuration file '%s'",
+            plugin_name, filename);
+        return;
     }
-}
 
-/* Returns new GSList with filenames for plugin_name. The list should be freed
- * after use, but the list element data not. */
-static GSList*
-n_core_plugin_conf_files_for_plugin (NCore *core, const char *plugin_name)
-{
-    GSList *plugin = NULL;
-    GSList *i      = NULL;
-    gchar  *suffix = NULL;
+    if (!(conf = g_hash_table_lookup (plugin_conf, plugin_name))) {
+        conf = g_slice_new0 (NCorePluginConf);
+        conf->params   = n_proplist_new ();
+        conf->keytypes = g_key_file_new ();
+        g_hash_table_insert (plugin_conf, g_strdup (plugin_name), conf);
+    }
 
-    if (n_core_plugin_conf_files (core)) {
-        suffix = g_strdup_printf ("%s.ini", plugin_name);
+    for (iter = keys; *iter; ++iter) {
+        if ((value = g_key_file_get_string (keyfile, plugin_name, *iter, NULL)) == NULL)
+            continue;
 
-        for (i = n_core_plugin_conf_files (core); i; i = g_slist_next (i)) {
-            if (g_str_has_suffix (i->data, suffix))
-                plugin = g_slist_append (plugin, i->data);
-        }
+        N_DEBUG (LOG_CAT "+ plugin parameter (%s): %s = %s%s",
+            plugin_name, *iter, value,
+            n_proplist_has_key (conf->params, *iter) ? " (override previous)" : "");
+        n_proplist_set_string (conf->params, *iter, value);
+        g_free (value);
+    }
+
+    g_strfreev (keys);
+
+    /* keytypes of the file extend the known keytypes once the plugin
+       is loaded. */
+
+    keys = g_key_file_get_keys (keyfile, CORE_CONF_KEYTYPES, NULL, NULL);
+    for (iter = keys; iter && *iter; ++iter) {
+        if ((value = g_key_file_get_string (keyfile, CORE_CONF_KEYTYPES, *iter, NULL)) == NULL)
+            continue;
 
-        g_free (suffix);
+        g_key_file_set_string (conf->keytypes, CORE_CONF_KEYTYPES, *iter, value);
+        g_free (value);
     }
 
-    return plugin;
+    g_strfreev (keys);
 }
 
-static NProplist*
-n_core_load_params (NCore *core, const char *plugin_name)
+static void
+n_core_conf_file_load_cb (gpointer data, gpointer userdata)
 {
-    g_assert (core != NULL);
-    g_assert (plugin_name != NULL);
+    NCoreConfFile *file = data;
 
-    NProplist      *proplist    = NULL;
-    GKeyFile       *keyfile     = NULL;
-    gchar         **keys        = NULL;
-    gchar         **iter        = NULL;
-    GError         *error       = NULL;
-    gchar          *value       = NULL;
-    GSList         *plugin_conf = NULL;
+    (void) userdata;
+
+    file->keyfile = g_key_file_new ();
+    if (!g_key_file_load_from_file (file->keyfile, file->filename, G_KEY_FILE_NONE, &file->error)) {
+        g_key_file_free (file->keyfile);
+        file->keyfile = NULL;
+    }
+}
+
+static void
+n_core_conf_file_free (gpointer data)
+{
+    NCoreConfFile *file = data;
+
+    if (file->keyfile)
+        g_key_file_free (file->keyfile);
+    if (file->error)
+        g_error_free (file->error);
+    g_list_free (file->plugins);
+    g_slice_free (NCoreConfFile, file);
+}
+
+/* Reads the configuration files of all plugins to load. Each file is
+ * read once, all of them in parallel, and then its groups are collected
+ * for the plugins named by the file in file order. Returns a table of
+ * plugin name to NCorePluginConf. */
+static GHashTable*
+n_core_load_plugin_conf (NCore *core)
+{
+    GHashTable     *plugin_conf = NULL;
+    GPtrArray      *conf_files  = NULL;
+    NCoreConfFile  *file        = NULL;
+    GList          *plugins     = NULL;
+    GList          *p           = NULL;
+    GSList         *files       = NULL;
     GSList         *i           = NULL;
-    const gchar    *filename    = NULL;
+    gchar          *suffix      = NULL;
+    guint           n;
+
+    plugin_conf = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                         n_core_plugin_conf_free);
+    conf_files = g_ptr_array_new_with_free_func (n_core_conf_file_free);
+    files = n_core_conf_files_from_path (core->conf_path, PLUGIN_CONF_PATH);
+    plugins = g_list_concat (g_list_copy (core->required_plugins),
+                             g_list_copy (core->optional_plugins));
+
+    for (i = files; i; i = g_slist_next (i)) {
+        file = NULL;
+
+        for (p = g_list_first (plugins); p; p = g_list_next (p)) {
+            suffix = g_strdup_printf ("%s.ini", (const char*) p->data);
+            if (g_str_has_suffix ((const gchar*) i->data, suffix)) {
+                if (!file) {
+                    file = g_slice_new0 (NCoreConfFile);
+                    file->filename = i->data;
+                    g_ptr_array_add (conf_files, file);
+                }
+                file->plugins = g_list_append (file->plugins, p->data);
+            }
+            g_free (suffix);
+        }
+    }
 
-    proplist = n_proplist_new ();
-    keyfile = g_key_file_new ();
-    plugin_conf = n_core_plugin_conf_files_for_plugin (core, plugin_name);
+    n_core_run_parallel (conf_files, n_core_conf_file_load_cb);
 
-    for (i = plugin_conf; i; i = g_slist_next (i)) {
-        filename = (const gchar*) i->data;
+    for (n = 0; n < conf_files->len; n++) {
+        file = g_ptr_array_index (conf_files, n);
 
-        if (!g_key_file_load_from_file (keyfile, filename, G_KEY_FILE_NONE, &error)) {
+        if (!file->keyfile) {
             N_WARNING (LOG_CAT "problem with configuration file '%s': %s",
-                filename, error->message);
-            g_error_free (error);
+                file->filename, file->error->message);
             continue;
         }
 
-        keys = g_key_file_get_keys (keyfile, plugin_name, NULL, NULL);
-        if (!keys) {
-            N_WARNING (LOG_CAT "no group '%s' within configuration file '%s'",
-                plugin_name, filename);
-            continue;
-        }
+        for (p = g_list_first (file->plugins); p; p = g_list_next (p))
+            n_core_plugin_conf_parse (plugin_conf, file->keyfile, file->filename, p->data);
+    }
 
-        /* Extend known keytypes from plugin configuration. */
-        n_core_parse_keytypes (core, keyfile);
+    g_ptr_array_free (conf_files, TRUE);
+    g_list_free (plugins);
+    g_slist_free_full (files, g_free);
 
-        for (iter = keys; *iter; ++iter) {
-            if ((value = g_key_file_get_string (keyfile, plugin_name, *iter, NULL)) == NULL)
-                continue;
+    return plugin_conf;
+}
 
-            N_DEBUG (LOG_CAT "+ plugin parameter (%s): %s = %s%s",
-                plugin_name, *iter, value,
-                n_proplist_has_key (proplist, *iter) ? " (override previous)" : "");
-            n_proplist_set_string (proplist, *iter, value);
-            g_free (value);
-        }
+static NProplist*
+n_core_load_params (NCore *core, GHashTable *plugin_conf, const char *plugin_name)
+{
+    g_assert (core != NULL);
+    g_assert (plugin_conf != NULL);
+    g_assert (plugin_name != NULL);
 
-        g_strfreev (keys);
-        g_key_file_remove_group (keyfile, plugin_name, NULL);
-        g_key_file_remove_group (keyfile, CORE_CONF_KEYTYPES, NULL);
-    }
+    NCorePluginConf *conf = NULL;
 
-    g_key_file_free (keyfile);
-    /* Only remove the list, not the element data. */
-    g_slist_free (plugin_conf);
+    if (!(conf = g_hash_table_lookup (plugin_conf, plugin_name)))
+        return n_proplist_new ();
 
-    return proplist;
+    /* Extend known keytypes from plugin configuration. */
+    n_core_parse_keytypes (core, conf->keytypes);
+
+    return n_proplist_copy (conf->params);
 }
 
-static NPlugin*
-n_core_open_plugin (NCore *core, const char *plugin_name)
+/* Opens the plugin module, the plugin takes ownership of the params. */
+
+NPlugin*
+n_core_open_plugin (NCore *core, const char *plugin_name, NProplist *params)
 {
     g_assert (core != NULL);
     g_assert (plugin_name != NULL);
@@ -239,6 +393,17 @@ n_core_open_plugin (NCore *core, const char *plugin_name)
     NPlugin *plugin    = NULL;
     gchar   *filename  = NULL;
     gchar   *full_path = NULL;
+    gint64   started   = g_get_monotonic_time ();
+
+    if ((plugin = n_plugin_open_builtin (plugin_name))) {
+        plugin->core    = core;
+        plugin->params  = params;
+        plugin->open_us = g_get_monotonic_time () - started;
+
+        N_DEBUG (LOG_CAT "opened built-in plugin '%s'", plugin->get_name ());
+
+        return plugin;
+    }
 
     filename  = g_strdup_printf ("libngfd_%s.so", plugin_name);
     full_path = g_build_filename (core->plugin_path, filename, NULL);
@@ -246,8 +411,9 @@ n_core_open_plugin (NCore *core, const char *plugin_name)
     if (!(plugin = n_plugin_open (full_path)))
         goto done;
 
-    plugin->core   = core;
-    plugin->params = n_core_load_params (core, plugin_name);
+    plugin->core    = core;
+    plugin->params  = params;
+    plugin->open_us = g_get_monotonic_time () - started;
 
     N_DEBUG (LOG_CAT "opened plugin '%s' (%s)", plugin->get_name (), filename);
 
@@ -261,6 +427,8 @@ done:
 
     if (plugin)
         n_plugin_unload (plugin);
+    else if (params)
+        n_proplist_free (params);
 
     g_free (full_path);
     g_free (filename);
@@ -271,16 +439,33 @@ done:
 static int
 n_core_init_plugin (NPlugin *plugin, gboolean required)
 {
-    int ret = FALSE;
+    NSinkInterface **sink    = NULL;
+    int              ret     = FALSE;
+    gint64           started = 0;
 
     g_assert (plugin != NULL);
 
-    if (!(ret = n_plugin_init (plugin))) {
+    /* sinks registered by the load function inherit the required flag. */
+    plugin->required          = required;
+    plugin->core->init_plugin = plugin;
+
+    started         = g_get_monotonic_time ();
+    ret             = n_plugin_init (plugin);
+    plugin->init_us = g_get_monotonic_time () - started;
+
+    plugin->core->init_plugin = NULL;
+
+    if (!ret) {
         if (required)
             N_ERROR (LOG_CAT "unable to init required plugin '%s'", plugin->get_name());
         else
             N_INFO (LOG_CAT "unable to init optional plugin '%s'", plugin->get_name());
 
+        for (sink = plugin->core->sinks; sink && *sink; ++sink) {
+            if ((*sink)->plugin == plugin)
+                (*sink)->plugin = NULL;
+        }
+
         n_plugin_unload (plugin);
     }
 
@@ -323,6 +508,39 @@ n_core_new (int *argc, char **argv)
 
     core->key_types = g_hash_table_new_full (g_str_hash, g_str_equal,
         g_free, NULL);
+    (void) n_atom_intern (POLICY_TIMEOUT_KEY);
+    core->event_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, NULL);
+    core->request_table = g_hash_table_new (g_direct_hash, g_direct_equal);
+    core->timelines     = g_queue_new ();
+
+    core->metrics           = n_metrics_new ();
+    core->metric_requests   = n_metrics_add_family (core->metrics, "requests.event");
+    core->metric_failed     = n_metrics_add_counter (core->metrics, "requests.failed");
+    core->metric_fallbacks  = n_metrics_add_counter (core->metrics, "requests.fallback");
+    core->metric_routes     = n_metrics_add_family (core->metrics, "requests.route");
+    core->metric_route_unmet = n_metrics_add_counter (core->metrics, "requests.route_unmet");
+    core->metric_no_event   = n_metrics_add_counter (core->metrics, "requests.no_event");
+    core->metric_invalid_file = n_metrics_add_counter (core->metrics, "requests.invalid_file");
+    core->metric_watchdog   = n_metrics_add_family (core->metrics, "watchdog.stalled");
+    core->metric_coalesced  = n_metrics_add_counter (core->metrics, "requests.coalesced");
+    core->metric_prewarmed  = n_metrics_add_counter (core->metrics, "requests.prewarmed");
+    core->metric_preempted  = n_metrics_add_counter (core->metrics, "requests.preempted");
+    core->metric_active     = n_metrics_add_gauge (core->metrics, "requests.active");
+    core->metric_start_skew = n_metrics_add_histogram (core->metrics, "requests.start_skew_us");
+    core->metric_dispatch_lag = n_metrics_add_histogram (core->metrics, "mainloop.dispatch_lag_us");
+    core->metric_critical_lag = n_metrics_add_histogram (core->metrics, "mainloop.critical_lag_us");
+    core->metric_resume       = n_metrics_add_histogram (core->metrics, "requests.resume_us");
+    core->metric_startup_wait = n_metrics_add_histogram (core->metrics, "requests.startup_wait_us");
+    core->metric_event_bytes  = n_metrics_add_gauge (core->metrics, "events.bytes");
+    core->metric_event_unshared = n_metrics_add_gauge (core->metrics, "events.bytes_unshared");
+
+    core->timers            = n_timers_new ();
+    core->workers           = n_workers_new (N_WORKERS_DEFAULT_THREADS);
+    core->memory            = n_memory_new (core->metrics, core->timers);
+#ifdef ENABLE_ALLOC_STATS
+    n_core_add_alloc_metrics (core);
+#endif
 
     return core;
 }
@@ -330,25 +548,73 @@ n_core_new (int *argc, char **argv)
 void
 n_core_free (NCore *core)
 {
+    int i;
+
     g_assert (core != NULL);
 
     if (!core->shutdown_done)
         n_core_shutdown (core);
 
     g_list_free_full (core->sink_order, g_free);
+    g_list_free (core->scheduled);
 
     g_hash_table_destroy (core->key_types);
+    if (core->request_keys)
+        g_hash_table_destroy (core->request_keys);
+    g_hash_table_destroy (core->event_cache);
+    g_hash_table_destroy (core->request_table);
+    n_core_free_sink_plans (core);
+    n_core_free_timelines (core);
+
+    for (i = 0; i < N_CORE_HOOK_LAST; i++)
+        n_hook_clear (&core->hooks[i]);
+
+    g_list_free_full (core->event_files, n_core_event_file_free);
+    g_list_free_full (core->retired_events, (GDestroyNotify) n_event_free);
 
     n_event_list_free (core->eventlist);
     n_haptic_free (core->haptic);
+    n_memory_free (core->memory);
+    n_file_check_free (core->filecheck);
+    g_free (core->file_check_keys);
+    n_wakeups_disable ();
+    n_metrics_free (core->metrics);
+    n_timers_free (core->timers);
+    n_workers_free (core->workers);
     n_dbus_helper_free (core->dbus);
     n_context_free (core->context);
     g_free (core->plugin_path);
     g_free (core->conf_path);
     g_free (core->user_conf_path);
+    g_free (core->event_db_path);
     g_free (core);
 }
 
+static void
+n_core_sort_sinks (NCore *core)
+{
+    NSinkInterface *sink = NULL;
+    unsigned int    i, j;
+
+    /* keep the registration order in core->sinks, the sink indexes and
+       the lazy sinks depend on it. the sorted copy is walked when resolving
+       the sinks of a request, so that no list is built or sorted then. */
+
+    core->sinks_by_priority = (NSinkInterface**) g_realloc (core->sinks_by_priority,
+        sizeof (NSinkInterface*) * (core->num_sinks + 1));
+
+    for (i = 0; i < core->num_sinks; i++) {
+        sink = core->sinks[i];
+
+        for (j = i; j > 0 && core->sinks_by_priority[j-1]->priority < sink->priority; j--)
+            core->sinks_by_priority[j] = core->sinks_by_priority[j-1];
+
+        core->sinks_by_priority[j] = sink;
+    }
+
+    core->sinks_by_priority[core->num_sinks] = NULL;
+}
+
 static void
 n_core_set_sink_priorities (NSinkInterface **sink_list, GList *sink_order)
 {
@@ -379,6 +645,289 @@ n_core_set_sink_priorities (NSinkInterface **sink_list, GList *sink_order)
     g_list_free (list);
 }
 
+static int
+n_core_initialize_sink (NCore *core, NSinkInterface *sink)
+{
+    int ret = TRUE;
+
+    sink->init_state   = N_SINK_INIT_PENDING;
+    sink->init_started = g_get_monotonic_time ();
+
+    if (!sink->plugin || sink->plugin->required)
+        core->pending_init++;
+
+    if (sink->funcs.initialize)
+        ret = sink->funcs.initialize (sink);
+
+    if (ret != N_SINK_INTERFACE_INIT_PENDING) {
+        n_core_set_sink_init_result (core, sink, ret);
+        return ret;
+    }
+
+    if (core->async_init) {
+        N_DEBUG (LOG_CAT "sink '%s' initializing asynchronously", sink->name);
+        return TRUE;
+    }
+
+    /* run the main loop until the sink reports its initialization
+       done, the sinks are initialized one by one. */
+
+    while (sink->init_state == N_SINK_INIT_PENDING)
+        g_main_context_iteration (NULL, TRUE);
+
+    return sink->init_state == N_SINK_INIT_READY;
+}
+
+int
+n_core_initialize_sinks (NCore *core)
+{
+    g_assert (core != NULL);
+
+    NSinkInterface **sink = NULL;
+
+    if (!core->sinks)
+        return TRUE;
+
+    /* setup the sink priorities based on the sink-order */
+
+    n_core_set_sink_priorities (core->sinks, core->sink_order);
+    n_core_sort_sinks (core);
+
+    for (sink = core->sinks; *sink; ++sink) {
+        if (!n_core_initialize_sink (core, *sink)) {
+            N_ERROR (LOG_CAT "sink '%s' failed to initialize", (*sink)->name);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static void
+n_core_set_sink_init_result (NCore *core, NSinkInterface *sink, int success)
+{
+    sink->init_state = success ? N_SINK_INIT_READY : N_SINK_INIT_FAILED;
+    sink->init_us    = g_get_monotonic_time () - sink->init_started;
+
+    if (!sink->plugin || sink->plugin->required)
+        core->pending_init--;
+
+    n_core_add_startup_gauge (core, "sink", sink->name, "init", sink->init_us);
+
+    /* requests received during an early start may now be served. */
+    n_core_dispatch_startup_queue (core);
+}
+
+void
+n_core_sink_initialized (NCore *core, NSinkInterface *sink, int success)
+{
+    g_assert (core != NULL);
+    g_assert (sink != NULL);
+
+    if (sink->init_state != N_SINK_INIT_PENDING) {
+        N_WARNING (LOG_CAT "sink '%s' reported initialization twice", sink->name);
+        return;
+    }
+
+    n_core_set_sink_init_result (core, sink, success);
+
+    /* asynchronously initialized sinks become usable or fail while
+       requests may already be played, resolve the sinks again. */
+    n_core_clear_sink_plans (core);
+
+    if (!core->async_init)
+        return;
+
+    if (success)
+        N_DEBUG (LOG_CAT "sink '%s' initialized (%" G_GINT64_FORMAT " us)",
+            sink->name, sink->init_us);
+    else
+        N_ERROR (LOG_CAT "sink '%s' failed to initialize, disabled", sink->name);
+
+    if (core->init_waiting && core->pending_init == 0) {
+        core->init_waiting = FALSE;
+        n_core_init_done (core);
+    }
+}
+
+void
+n_core_finish_initialize (NCore *core)
+{
+    g_assert (core != NULL);
+
+    if (core->pending_init > 0) {
+        N_INFO (LOG_CAT "waiting for %u sink(s) to initialize", core->pending_init);
+        core->init_waiting = TRUE;
+        return;
+    }
+
+    n_core_init_done (core);
+}
+
+static void
+n_core_add_startup_gauge (NCore *core, const char *kind, const char *name,
+                          const char *what, gint64 value)
+{
+    NMetricGauge *gauge  = NULL;
+    gchar        *metric = NULL;
+
+    metric = g_strdup_printf ("startup.%s.%s.%s_us", kind, name, what);
+    if ((gauge = n_metrics_add_gauge (core->metrics, metric)))
+        n_metric_gauge_set (gauge, (guint64) value);
+    g_free (metric);
+}
+
+#ifdef ENABLE_ALLOC_STATS
+static void
+n_core_add_alloc_metrics (NCore *core)
+{
+    const char *type = NULL;
+    gchar      *name = NULL;
+    guint       i;
+
+    for (i = 0; i < N_ALLOC_TYPES; i++) {
+        type = n_alloc_stats_type_name ((NAllocType) i);
+
+        name = g_strdup_printf ("alloc.%s.count", type);
+        core->metric_alloc_count[i] = n_metrics_add_gauge (core->metrics, name);
+        g_free (name);
+
+        name = g_strdup_printf ("alloc.%s.bytes", type);
+        core->metric_alloc_bytes[i] = n_metrics_add_gauge (core->metrics, name);
+        g_free (name);
+
+        /* list nodes are not followed to their free */
+        if (i == N_ALLOC_LIST)
+            continue;
+
+        name = g_strdup_printf ("alloc.%s.live", type);
+        core->metric_alloc_live[i] = n_metrics_add_gauge (core->metrics, name);
+        g_free (name);
+    }
+
+    core->metric_alloc_requests = n_metrics_add_counter (core->metrics, "alloc.requests");
+}
+
+/* the counts are shared by all cores of the process and updated from
+   worker threads too, the metrics are synchronized on the main
+   thread. */
+void
+n_core_sync_alloc_stats (NCore *core)
+{
+    NAllocStats stats;
+    guint       i;
+
+    g_assert (core != NULL);
+
+    for (i = 0; i < N_ALLOC_TYPES; i++) {
+        n_alloc_stats_get ((NAllocType) i, &stats);
+        n_metric_gauge_set (core->metric_alloc_count[i], stats.count);
+        n_metric_gauge_set (core->metric_alloc_bytes[i], stats.bytes);
+        n_metric_gauge_set (core->metric_alloc_live[i], stats.live);
+    }
+}
+
+/* allocations from the creation of the request until it is done. the
+   counts are process wide, so concurrent requests and the daemon itself
+   show up in the report too. */
+void
+n_core_report_alloc_stats (NCore *core, NRequest *request)
+{
+    NAllocStats stats;
+    GString    *report = NULL;
+    guint       i;
+
+    g_assert (core != NULL);
+    g_assert (request != NULL);
+
+    if (!N_LOG_ENABLED (N_LOG_LEVEL_DEBUG))
+        return;
+
+    report = g_string_new (NULL);
+
+    for (i = 0; i < N_ALLOC_TYPES; i++) {
+        n_alloc_stats_get ((NAllocType) i, &stats);
+        g_string_append_printf (report, "%s%s %" G_GSIZE_FORMAT "/%" G_GSIZE_FORMAT " B",
+            i > 0 ? ", " : "", n_alloc_stats_type_name ((NAllocType) i),
+            stats.count - request->alloc_start[i].count,
+            stats.bytes - request->alloc_start[i].bytes);
+    }
+
+    N_DEBUG (LOG_CAT "request %u (%s) allocated %s", request->id,
+        request->name ? request->name : "", report->str);
+    g_string_free (report, TRUE);
+}
+#endif
+
+static void
+n_core_report_startup (NCore *core)
+{
+    NSinkInterface **sink   = NULL;
+    NPlugin         *plugin = NULL;
+    NMetricGauge    *gauge  = NULL;
+    GList           *iter   = NULL;
+    gint64           total  = 0;
+
+    total = g_get_monotonic_time () - core->init_started;
+
+    for (iter = g_list_first (core->plugins); iter; iter = g_list_next (iter)) {
+        plugin = (NPlugin*) iter->data;
+
+        N_INFO (LOG_CAT "startup: plugin '%s' opened in %" G_GINT64_FORMAT
+            " us, loaded in %" G_GINT64_FORMAT " us", plugin->get_name (),
+            plugin->open_us, plugin->init_us);
+
+        n_core_add_startup_gauge (core, "plugin", plugin->get_name (), "open", plugin->open_us);
+        n_core_add_startup_gauge (core, "plugin", plugin->get_name (), "load", plugin->init_us);
+    }
+
+    for (sink = core->sinks; sink && *sink; ++sink) {
+        if ((*sink)->init_state == N_SINK_INIT_PENDING) {
+            N_INFO (LOG_CAT "startup: sink '%s' still initializing", (*sink)->name);
+            continue;
+        }
+
+        N_INFO (LOG_CAT "startup: sink '%s' initialized in %" G_GINT64_FORMAT " us%s",
+            (*sink)->name, (*sink)->init_us,
+            (*sink)->init_state == N_SINK_INIT_FAILED ? " (failed)" : "");
+    }
+
+    N_INFO (LOG_CAT "startup: initialized in %" G_GINT64_FORMAT " us", total);
+
+    if ((gauge = n_metrics_add_gauge (core->metrics, "startup.total_us")))
+        n_metric_gauge_set (gauge, (guint64) total);
+}
+
+static void
+n_core_init_done (NCore *core)
+{
+    n_core_report_startup (core);
+
+    /* fire the init done hook. */
+
+    n_core_fire_hook (core, N_CORE_HOOK_INIT_DONE, NULL);
+}
+
+static int
+n_core_initialize_inputs (NCore *core)
+{
+    NInputInterface **input = NULL;
+
+    if (!core->inputs) {
+        N_ERROR (LOG_CAT "no plugin has registered input interface");
+        return FALSE;
+    }
+
+    for (input = core->inputs; *input; ++input) {
+        if ((*input)->funcs.initialize && !(*input)->funcs.initialize (*input)) {
+            N_ERROR (LOG_CAT "input '%s' failed to initialize", (*input)->name);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
 int
 n_core_initialize (NCore *core)
 {
@@ -389,12 +938,12 @@ n_core_initialize (NCore *core)
 
     GList            *required_plugins = NULL;
     GList            *optional_plugins = NULL;
-    NSinkInterface  **sink   = NULL;
-    NInputInterface **input  = NULL;
     NPlugin          *plugin = NULL;
+    NProplist        *params = NULL;
     GList            *p      = NULL;
+    GHashTable       *plugin_conf = NULL;
 
-    tmp_plugin_conf_files    = NULL;
+    core->init_started       = g_get_monotonic_time ();
 
     /* setup hooks */
 
@@ -414,11 +963,18 @@ n_core_initialize (NCore *core)
         goto failed_init;
     }
 
-    /* load all plugins */
+    /* load all plugins, with the configuration of every plugin
+       read up front. */
+
+    plugin_conf = n_core_load_plugin_conf (core);
 
     /* first mandatory plugins */
     for (p = g_list_first (core->required_plugins); p; p = g_list_next (p)) {
-        if (!(plugin = n_core_open_plugin (core, (const char*) p->data)))
+        params = n_core_load_params (core, plugin_conf, (const char*) p->data);
+        if (n_core_lazy_add_plugin (core, (const char*) p->data, params))
+            continue;
+
+        if (!(plugin = n_core_open_plugin (core, (const char*) p->data, params)))
             goto failed_init;
 
         required_plugins = g_list_append (required_plugins, plugin);
@@ -426,27 +982,27 @@ n_core_initialize (NCore *core)
 
     /* then optional plugins */
     for (p = g_list_first (core->optional_plugins); p; p = g_list_next (p)) {
-        if ((plugin = n_core_open_plugin (core, (const char*) p->data)))
+        params = n_core_load_params (core, plugin_conf, (const char*) p->data);
+        if (n_core_lazy_add_plugin (core, (const char*) p->data, params))
+            continue;
+
+        if ((plugin = n_core_open_plugin (core, (const char*) p->data, params)))
             optional_plugins = g_list_append (optional_plugins, plugin);
 
         if (!plugin)
             N_INFO (LOG_CAT "optional plugin %s not opened.", p->data);
     }
 
-    /* Clear temporary conf file list. */
-    n_core_plugin_conf_files_done ();
+    g_hash_table_destroy (plugin_conf);
+    plugin_conf = NULL;
 
-    /* load events from the given event path. */
+    /* load events from the event database or the given event paths. */
 
-    if (!n_core_parse_events (core->eventlist, core->conf_path)) {
+    if (!n_core_load_events (core)) {
         N_ERROR (LOG_CAT "no events defined.");
         goto failed_init;
     }
 
-    /* load user defined events, failure to load doesn't
-     * prevent startup. */
-    n_core_parse_events (core->eventlist, core->user_conf_path);
-
     /* initialize required plugins */
     for (p = required_plugins; p; p = g_list_next (p)) {
         if (!n_core_init_plugin ((NPlugin *) p->data, TRUE))
@@ -474,38 +1030,25 @@ n_core_initialize (NCore *core)
         goto failed_init;
     }
 
-    /* setup the sink priorities based on the sink-order */
+    /* on an early start the inputs accept requests while the sinks
+       are initialized, the requests wait for the sinks they need. */
 
-    n_core_set_sink_priorities (core->sinks, core->sink_order);
+    if (core->early_start && !n_core_initialize_inputs (core))
+        goto failed_init;
 
-    for (sink = core->sinks; *sink; ++sink) {
-        if ((*sink)->funcs.initialize && !(*sink)->funcs.initialize (*sink)) {
-            N_ERROR (LOG_CAT "sink '%s' failed to initialize", (*sink)->name);
-            goto failed_init;
-        }
-    }
+    if (!n_core_initialize_sinks (core))
+        goto failed_init;
 
-    /* initialize all inputs. */
+    if (!core->early_start && !n_core_initialize_inputs (core))
+        goto failed_init;
 
-    if (!core->inputs) {
-        N_ERROR (LOG_CAT "no plugin has registered input interface");
-        goto failed_init;
-    }
-
-    for (input = core->inputs; *input; ++input) {
-        if ((*input)->funcs.initialize && !(*input)->funcs.initialize (*input)) {
-            N_ERROR (LOG_CAT "input '%s' failed to initialize", (*input)->name);
-            goto failed_init;
-        }
-    }
-
-    /* fire the init done hook. */
-
-    n_core_fire_hook (core, N_CORE_HOOK_INIT_DONE, NULL);
+    n_core_finish_initialize (core);
 
     return TRUE;
 
 failed_init:
+    if (plugin_conf)
+        g_hash_table_destroy (plugin_conf);
     g_list_free (required_plugins);
     g_list_free (optional_plugins);
 
@@ -515,27 +1058,76 @@ failed_init:
 int
 n_core_reload_events (NCore *core)
 {
-    GList       *iter           = NULL;
-    NEventList  *new_eventlist  = n_event_list_new (core);
+    guint generation = core->eventlist->generation;
 
-    if (!n_core_parse_events (new_eventlist, core->conf_path))
-        goto fail;
+    if (!n_core_update_events (core)) {
+        N_INFO (LOG_CAT "failed to reload events.");
+        return FALSE;
+    }
 
-    n_core_parse_events (new_eventlist, core->user_conf_path);
+    if (generation != core->eventlist->generation) {
+        n_core_save_events (core);
+        n_core_report_events (core);
+    }
 
-    /* stop all possibly active requests */
-    for (iter = g_list_first (n_core_get_requests (core)); iter; iter = g_list_next (iter))
-        n_core_stop_request (core, iter->data, 0);
+    /* the missing files may have been installed with the events. */
+    if (core->filecheck) {
+        n_file_check_forget_invalid (core->filecheck);
+        n_core_check_event_files (core);
+    }
 
-    n_event_list_free (core->eventlist);
-    core->eventlist = new_eventlist;
     N_INFO (LOG_CAT "reloaded events (%d).", n_event_list_size (core->eventlist));
     return TRUE;
+}
 
-fail:
-    n_event_list_free (new_eventlist);
-    N_INFO (LOG_CAT "failed to reload events.");
-    return FALSE;
+/* Reads the plugin configuration files again and passes the changed
+ * parameters to the plugins implementing reload. Returns the number of
+ * plugins that applied new parameters. */
+int
+n_core_reload_plugins (NCore *core)
+{
+    g_assert (core != NULL);
+
+    GHashTable *plugin_conf = NULL;
+    GList      *iter        = NULL;
+    NPlugin    *plugin      = NULL;
+    NProplist  *params      = NULL;
+    const char *name        = NULL;
+    int         reloaded    = 0;
+
+    plugin_conf = n_core_load_plugin_conf (core);
+
+    for (iter = g_list_first (core->plugins); iter; iter = g_list_next (iter)) {
+        plugin = (NPlugin*) iter->data;
+        name   = plugin->get_name ();
+        params = n_core_load_params (core, plugin_conf, name);
+
+        if (n_proplist_match_exact (plugin->params, params)) {
+            n_proplist_free (params);
+            continue;
+        }
+
+        if (!plugin->reload) {
+            N_INFO (LOG_CAT "parameters of plugin '%s' changed, applied on restart", name);
+            n_proplist_free (params);
+            continue;
+        }
+
+        if (!plugin->reload (plugin, params)) {
+            N_WARNING (LOG_CAT "plugin '%s' failed to apply new parameters", name);
+            n_proplist_free (params);
+            continue;
+        }
+
+        N_INFO (LOG_CAT "reloaded parameters of plugin '%s'", name);
+        n_proplist_free (plugin->params);
+        plugin->params = params;
+        reloaded++;
+    }
+
+    g_hash_table_destroy (plugin_conf);
+
+    return reloaded;
 }
 
 static void
@@ -555,6 +1147,8 @@ n_core_shutdown (NCore *core)
     NSinkInterface  **sink  = NULL;
     GList            *iter  = NULL;
 
+    n_core_free_startup_queue (core);
+
     /* shutdown all inputs */
 
     if (core->inputs) {
@@ -573,12 +1167,17 @@ n_core_shutdown (NCore *core)
         for (sink = core->sinks; *sink; ++sink) {
             if ((*sink)->funcs.shutdown)
                 (*sink)->funcs.shutdown (*sink);
+            g_strfreev ((*sink)->startup_keys);
             g_free (*sink);
         }
         g_free (core->sinks);
         core->sinks = NULL;
+        g_free (core->sinks_by_priority);
+        core->sinks_by_priority = NULL;
     }
 
+    n_core_lazy_shutdown (core);
+
     if (core->plugins) {
         g_list_foreach (core->plugins, unload_plugin_cb, core);
         g_list_free (core->plugins);
@@ -611,11 +1210,43 @@ n_core_register_sink (NCore *core, const NSinkInterfaceDecl *iface)
     g_assert (iface->stop != NULL);
 
     NSinkInterface *sink = NULL;
+    gchar          *name = NULL;
+    const char     *keys = NULL;
+    gchar         **key  = NULL;
+
+    /* a lazily loaded plugin takes over its stub sink. */
+    if (core->lazy_loading) {
+        n_core_lazy_register_sink (core, iface);
+        return;
+    }
+
+    if (core->num_sinks >= N_SINK_SET_MAX) {
+        N_WARNING (LOG_CAT "too many sinks, sink interface '%s' not registered",
+            iface->name);
+        return;
+    }
+
     sink = g_new0 (NSinkInterface, 1);
     sink->name  = iface->name;
     sink->type  = iface->type;
     sink->core  = core;
     sink->funcs = *iface;
+    sink->index = core->num_sinks;
+    sink->plugin = core->init_plugin;
+
+    if (sink->plugin && sink->plugin->params &&
+        (keys = n_proplist_get_string (sink->plugin->params, STARTUP_KEYS_KEY))) {
+        sink->startup_keys = g_strsplit (keys, ";", -1);
+        for (key = sink->startup_keys; *key; ++key)
+            g_strstrip (*key);
+    }
+
+    name = g_strdup_printf ("sink.%s.prepare_us", sink->name);
+    sink->prepare_metric = n_metrics_add_histogram (core->metrics, name);
+    g_free (name);
+    name = g_strdup_printf ("sink.%s.play_us", sink->name);
+    sink->play_metric = n_metrics_add_histogram (core->metrics, name);
+    g_free (name);
 
     core->num_sinks++;
     core->sinks = (NSinkInterface**) g_realloc (core->sinks,
@@ -623,6 +1254,7 @@ n_core_register_sink (NCore *core, const NSinkInterfaceDecl *iface)
 
     core->sinks[core->num_sinks-1] = sink;
     core->sinks[core->num_sinks]   = NULL;
+    n_core_sort_sinks (core);
 
     N_DEBUG (LOG_CAT "sink interface '%s' registered", sink->name);
 }
@@ -635,6 +1267,12 @@ n_core_register_input (NCore *core, const NInputInterfaceDecl *iface)
     g_assert (core != NULL);
     g_assert (iface->name != NULL);
 
+    if (core->lazy_loading) {
+        N_WARNING (LOG_CAT "input interface '%s' not registered by plugin loaded "
+            "on demand", iface->name);
+        return;
+    }
+
     input = g_new0 (NInputInterface, 1);
     input->name  = iface->name;
     input->core  = core;
@@ -651,57 +1289,416 @@ n_core_register_input (NCore *core, const NInputInterfaceDecl *iface)
 }
 
 static void
-n_core_parse_events_from_file (NEventList *eventlist, const char *filename)
+n_core_event_file_free (gpointer data)
 {
-    g_assert (eventlist != NULL);
-    g_assert (filename != NULL);
+    NCoreEventFile *file = data;
+
+    if (file->keyfile)
+        g_key_file_free (file->keyfile);
+    g_hash_table_destroy (file->names);
+    g_free (file->checksum);
+    g_free (file->filename);
+    g_free (file);
+}
 
-    GKeyFile  *keyfile    = NULL;
-    GError    *error      = NULL;
+static NCoreEventFile*
+n_core_event_file_new (const char *filename)
+{
+    NCoreEventFile *file = NULL;
 
-    keyfile = g_key_file_new ();
-    if (!g_key_file_load_from_file (keyfile, filename, G_KEY_FILE_NONE, &error)) {
+    file           = g_new0 (NCoreEventFile, 1);
+    file->filename = g_strdup (filename);
+    file->names    = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    return file;
+}
+
+static gint
+n_core_event_file_compare (gconstpointer a, gconstpointer b)
+{
+    const NCoreEventFile *file = a;
+
+    return g_strcmp0 (file->filename, (const char*) b);
+}
+
+/* Returns TRUE if the file content changed since the last update, in
+ * which case the new content is left in file->keyfile. Unchanged size,
+ * mtime and inode are trusted without reading the file. */
+static gboolean
+n_core_event_file_update (NCoreEventFile *file)
+{
+    struct stat  st;
+    GError      *error    = NULL;
+    gchar       *data     = NULL;
+    gchar       *checksum = NULL;
+    gsize        length   = 0;
+
+    memset (&st, 0, sizeof (st));
+    if (stat (file->filename, &st) == 0 && file->checksum &&
+        file->size  == (guint64) st.st_size  &&
+        file->mtime == (gint64)  st.st_mtime &&
+        file->inode == (guint64) st.st_ino)
+        return FALSE;
+
+    file->size  = (guint64) st.st_size;
+    file->mtime = (gint64)  st.st_mtime;
+    file->inode = (guint64) st.st_ino;
+
+    if (!g_file_get_contents (file->filename, &data, &length, &error)) {
         N_WARNING (LOG_CAT "failed to load event file: %s", error->message);
-        g_error_free    (error);
-        g_key_file_free (keyfile);
+        g_error_free (error);
+        error = NULL;
+        data = g_strdup ("");
+        length = 0;
+    }
+
+    checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA1, (const guchar*) data, length);
+    if (g_strcmp0 (checksum, file->checksum) == 0) {
+        g_free (checksum);
+        g_free (data);
+        return FALSE;
+    }
+
+    g_free (file->checksum);
+    file->checksum = checksum;
+
+    N_DEBUG (LOG_CAT "processing event file '%s'", file->filename);
+
+    file->keyfile = g_key_file_new ();
+    if (!g_key_file_load_from_data (file->keyfile, data, length, G_KEY_FILE_NONE, &error)) {
+        N_WARNING (LOG_CAT "failed to load event file: %s", error->message);
+        g_error_free (error);
+        g_key_file_free (file->keyfile);
+        file->keyfile = NULL;
+    }
+    g_free (data);
+
+    return TRUE;
+}
+
+static void
+n_core_event_file_update_cb (gpointer data, gpointer userdata)
+{
+    NCoreEventFile *file = data;
+
+    (void) userdata;
+
+    file->changed = n_core_event_file_update (file);
+}
+
+/* Loads the content of an unchanged file that defines affected events. */
+static void
+n_core_event_file_load_cb (gpointer data, gpointer userdata)
+{
+    NCoreEventFile *file  = data;
+    GError         *error = NULL;
+
+    (void) userdata;
+
+    file->keyfile = g_key_file_new ();
+    if (!g_key_file_load_from_file (file->keyfile, file->filename, G_KEY_FILE_NONE, &error)) {
+        N_WARNING (LOG_CAT "failed to load event file: %s", error->message);
+        g_error_free (error);
+        g_key_file_free (file->keyfile);
+        file->keyfile = NULL;
+    }
+}
+
+static void
+n_core_event_file_read_names (NCoreEventFile *file)
+{
+    gchar **groups = NULL;
+    gchar **group  = NULL;
+    gchar  *name   = NULL;
+
+    g_hash_table_remove_all (file->names);
+
+    if (!file->keyfile)
         return;
+
+    groups = g_key_file_get_groups (file->keyfile, NULL);
+    for (group = groups; *group; ++group) {
+        if ((name = n_event_parse_group_name (*group)))
+            g_hash_table_add (file->names, name);
     }
+    g_strfreev (groups);
+}
+
+static void
+n_core_add_names (GHashTable *to, GHashTable *from)
+{
+    GHashTableIter  iter;
+    gpointer        name;
+
+    g_hash_table_iter_init (&iter, from);
+    while (g_hash_table_iter_next (&iter, &name, NULL))
+        g_hash_table_add (to, g_strdup (name));
+}
 
-    N_DEBUG (LOG_CAT "processing event file '%s'", filename);
+static gboolean
+n_core_names_intersect (GHashTable *a, GHashTable *b)
+{
+    GHashTableIter  iter;
+    gpointer        name;
 
-    n_event_list_parse_keyfile (eventlist, keyfile);
+    g_hash_table_iter_init (&iter, a);
+    while (g_hash_table_iter_next (&iter, &name, NULL)) {
+        if (g_hash_table_contains (b, name))
+            return TRUE;
+    }
 
-    g_key_file_free (keyfile);
+    return FALSE;
 }
 
-static int
-n_core_parse_events (NEventList *eventlist, const char *conf_path)
+static GSList*
+n_core_event_files (NCore *core)
+{
+    GSList *files = NULL;
+
+    files = n_core_conf_files_from_path (core->conf_path, EVENT_CONF_PATH);
+    if (!files)
+        return NULL;
+
+    return g_slist_concat (files,
+        n_core_conf_files_from_path (core->user_conf_path, EVENT_CONF_PATH));
+}
+
+void
+n_core_free_retired_events (NCore *core)
 {
-    GSList        *conf_files = NULL;
-    GSList        *i          = NULL;
-    gchar         *filename   = NULL;
+    GList  *iter = NULL;
+    GList  *next = NULL;
+    GList  *r    = NULL;
 
-    /* find all the events within the given path */
-    conf_files = n_core_conf_files_from_path (conf_path, EVENT_CONF_PATH);
+    for (iter = core->retired_events; iter; iter = next) {
+        next = g_list_next (iter);
 
-    if (!conf_files)
+        for (r = core->requests; r; r = g_list_next (r)) {
+            if (((NRequest*) r->data)->event == iter->data)
+                break;
+        }
+
+        if (!r) {
+            n_event_free (iter->data);
+            core->retired_events = g_list_delete_link (core->retired_events, iter);
+        }
+    }
+}
+
+/* Bring the event list up to date with the event configuration files.
+ * Only the events with a name found in a changed, added or removed file
+ * are parsed again, from all the files defining that name and in the
+ * same file order as a full parse, so merging and %unset_event work the
+ * same way. Replaced events are kept around while active requests still
+ * refer to them. The files are read and parsed in parallel, the events
+ * are merged into the event list in file order on the calling thread. */
+static int
+n_core_update_events (NCore *core)
+{
+    GHashTableIter  names_iter;
+    GSList         *filenames = NULL;
+    GSList         *s         = NULL;
+    GList          *files     = NULL;
+    GList          *iter      = NULL;
+    GList          *found     = NULL;
+    GHashTable     *affected  = NULL;
+    GPtrArray      *work      = NULL;
+    NCoreEventFile *file      = NULL;
+    gpointer        name      = NULL;
+    guint           changed   = 0;
+
+    /* system events are required, user events are optional. */
+    if (!(filenames = n_core_event_files (core)))
         return FALSE;
 
-    for (i = conf_files; i; i = g_slist_next (i)) {
-        filename = i->data;
-        n_core_parse_events_from_file (eventlist, filename);
+    affected = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    /* events not parsed here (loaded from the event database) have no
+       file information, replace all of them. */
+    if (!core->event_files) {
+        for (iter = n_event_list_get_events (core->eventlist); iter; iter = g_list_next (iter))
+            g_hash_table_add (affected, g_strdup (((NEvent*) iter->data)->name));
     }
 
-    g_slist_free_full (conf_files, g_free);
+    work = g_ptr_array_new ();
+
+    for (s = filenames; s; s = g_slist_next (s)) {
+        if ((found = g_list_find_custom (core->event_files, s->data, n_core_event_file_compare))) {
+            file = found->data;
+            core->event_files = g_list_delete_link (core->event_files, found);
+        } else
+            file = n_core_event_file_new (s->data);
+
+        files = g_list_append (files, file);
+        g_ptr_array_add (work, file);
+    }
+    g_slist_free_full (filenames, g_free);
 
-    if (n_event_list_size (eventlist) == 0) {
+    n_core_run_parallel (work, n_core_event_file_update_cb);
+
+    for (iter = files; iter; iter = g_list_next (iter)) {
+        file = iter->data;
+
+        if (file->changed) {
+            n_core_add_names (affected, file->names);
+            n_core_event_file_read_names (file);
+            n_core_add_names (affected, file->names);
+            file->changed = FALSE;
+            changed++;
+        }
+    }
+
+    /* files removed since the last update. */
+    for (iter = core->event_files; iter; iter = g_list_next (iter)) {
+        n_core_add_names (affected, ((NCoreEventFile*) iter->data)->names);
+        changed++;
+    }
+    g_list_free_full (core->event_files, n_core_event_file_free);
+    core->event_files = files;
+
+    if (changed == 0) {
+        N_DEBUG (LOG_CAT "event files unchanged.");
+        goto done;
+    }
+
+    g_hash_table_iter_init (&names_iter, affected);
+    while (g_hash_table_iter_next (&names_iter, &name, NULL)) {
+        core->retired_events = g_list_concat (core->retired_events,
+            n_event_list_remove_events (core->eventlist, name));
+    }
+
+    /* unchanged files defining affected events are read again. */
+    g_ptr_array_set_size (work, 0);
+    for (iter = files; iter; iter = g_list_next (iter)) {
+        file = iter->data;
+        if (!file->keyfile && n_core_names_intersect (file->names, affected))
+            g_ptr_array_add (work, file);
+    }
+    n_core_run_parallel (work, n_core_event_file_load_cb);
+
+    for (iter = files; iter; iter = g_list_next (iter)) {
+        file = iter->data;
+
+        if (file->keyfile) {
+            n_event_list_parse_keyfile_filtered (core->eventlist, file->keyfile, affected);
+            g_key_file_free (file->keyfile);
+            file->keyfile = NULL;
+        }
+    }
+
+    n_event_list_prune_rules (core->eventlist);
+    g_hash_table_remove_all (core->event_cache);
+    n_core_free_retired_events (core);
+    n_event_list_prune_values (core->eventlist);
+
+    N_INFO (LOG_CAT "%u event files changed, %u events updated.",
+        changed, g_hash_table_size (affected));
+
+done:
+    g_ptr_array_free (work, TRUE);
+    g_hash_table_destroy (affected);
+
+    return TRUE;
+}
+
+static GSList*
+n_core_event_sources (NCore *core)
+{
+    GSList *sources = NULL;
+
+    /* keytypes in the main configuration affect how event
+     * properties are parsed. */
+    sources = g_slist_append (sources,
+        g_build_filename (core->conf_path, DEFAULT_CONF_FILENAME, NULL));
+
+    return g_slist_concat (sources, n_core_event_files (core));
+}
+
+static int
+n_core_load_events (NCore *core)
+{
+    GSList   *sources = NULL;
+    gboolean  loaded  = FALSE;
+
+    if (core->event_db_path) {
+        sources = n_core_event_sources (core);
+        loaded = n_event_db_load (core->eventlist, core->event_db_path, sources);
+        g_slist_free_full (sources, g_free);
+
+        if (loaded) {
+            n_core_report_events (core);
+            n_core_check_event_files (core);
+            return TRUE;
+        }
+    }
+
+    /* failure to load user defined events doesn't prevent startup. */
+    if (!n_core_update_events (core) || n_event_list_size (core->eventlist) == 0) {
         N_ERROR (LOG_CAT "no valid events defined.");
         return FALSE;
     }
 
+    n_core_save_events (core);
+    n_core_report_events (core);
+    n_core_check_event_files (core);
+
     return TRUE;
 }
 
+static void
+n_core_report_events (NCore *core)
+{
+    NEventListFootprint footprint;
+
+    n_event_list_get_footprint (core->eventlist, &footprint);
+
+    n_metric_gauge_set (core->metric_event_bytes, footprint.bytes);
+    n_metric_gauge_set (core->metric_event_unshared, footprint.unshared_bytes);
+
+    N_INFO (LOG_CAT "%u events with %u property values take %" G_GSIZE_FORMAT
+        " bytes, %" G_GSIZE_FORMAT " bytes unshared (%u distinct strings).",
+        footprint.num_events, footprint.num_values, footprint.bytes,
+        footprint.unshared_bytes, footprint.num_strings);
+}
+
+/* Starts checking the files the events refer to, so that the first
+ * request of an event with a missing file goes to its fallback. */
+
+static void
+n_core_check_event_files (NCore *core)
+{
+    const NEvent *event = NULL;
+    const NValue *value = NULL;
+    GList        *iter  = NULL;
+    guint         i;
+
+    if (!core->filecheck)
+        return;
+
+    for (iter = g_list_first (core->eventlist->event_list); iter; iter = g_list_next (iter)) {
+        event = (const NEvent*) iter->data;
+
+        for (i = 0; i < core->num_file_check_keys; i++) {
+            value = n_proplist_get_by_atom (event->properties, core->file_check_keys[i]);
+            if (value && n_value_type (value) == N_VALUE_TYPE_STRING)
+                (void) n_file_check_lookup (core->filecheck, n_value_get_string (value));
+        }
+    }
+}
+
+static void
+n_core_save_events (NCore *core)
+{
+    GSList *sources = NULL;
+
+    if (!core->event_db_path)
+        return;
+
+    sources = n_core_event_sources (core);
+    n_event_db_save (core->eventlist, core->event_db_path, sources);
+    g_slist_free_full (sources, g_free);
+}
+
 static void
 n_core_parse_keytypes (NCore *core, GKeyFile *keyfile)
 {
@@ -741,6 +1738,8 @@ n_core_parse_keytypes (NCore *core, GKeyFile *keyfile)
         }
 
         N_DEBUG (LOG_CAT "new key type '%s' = %s", *key, value);
+        /* a key with a type is declared for incoming requests. */
+        (void) n_atom_intern (*key);
         g_hash_table_replace (core->key_types, g_strdup (*key), GINT_TO_POINTER(key_type));
         g_free (value);
     }
@@ -793,6 +1792,15 @@ n_core_parse_configuration (NCore *core)
     GError    *error      = NULL;
     gchar     *filename   = NULL;
     gchar    **plugins    = NULL;
+    gchar     *cache      = NULL;
+    gchar     *cache_path = NULL;
+    gint       threads    = 0;
+    gint       value      = 0;
+    gchar     *pressure   = NULL;
+    gchar     *trigger    = NULL;
+    gchar    **keys       = NULL;
+    gsize      num_keys   = 0;
+    gsize      i          = 0;
 
     filename = g_build_filename (core->conf_path, DEFAULT_CONF_FILENAME, NULL);
     keyfile  = g_key_file_new ();
@@ -819,6 +1827,80 @@ n_core_parse_configuration (NCore *core)
         g_strfreev (plugins);
     }
 
+    /* precompiled event database, optional. */
+    core->event_db_path = g_key_file_get_string (keyfile, "general", "event-cache", NULL);
+
+    /* context values cached over restarts, relative to the user cache dir. */
+    if ((cache = g_key_file_get_string (keyfile, "general", "context-cache", NULL)) != NULL) {
+        if (g_path_is_absolute (cache))
+            cache_path = g_strdup (cache);
+        else
+            cache_path = g_build_filename (g_get_user_cache_dir (), cache, NULL);
+
+        n_context_set_cache_file (core->context, cache_path);
+        g_free (cache_path);
+        g_free (cache);
+    }
+
+    /* threads for the blocking work of the plugins. */
+    if ((threads = g_key_file_get_integer (keyfile, "general", "worker-threads", NULL)) > 0)
+        n_workers_set_max_threads (core->workers, threads);
+
+    /* memory budget of the caches in KiB, trimmed after idle seconds. */
+    if ((value = g_key_file_get_integer (keyfile, "general", "memory-budget", NULL)) > 0)
+        n_memory_set_budget (core->memory, (gsize) value * 1024);
+
+    if (g_key_file_has_key (keyfile, "general", "memory-idle-timeout", NULL)) {
+        value = g_key_file_get_integer (keyfile, "general", "memory-idle-timeout", NULL);
+        n_memory_set_idle_timeout (core->memory, value > 0 ? (guint) value * 1000 : 0);
+    }
+
+    /* trim the caches on system memory pressure, PSI file and trigger. */
+    if ((pressure = g_key_file_get_string (keyfile, "general", "memory-pressure", NULL)) != NULL) {
+        trigger = g_key_file_get_string (keyfile, "general", "memory-pressure-trigger", NULL);
+        (void) n_memory_watch_pressure (core->memory, pressure, trigger);
+        g_free (trigger);
+        g_free (pressure);
+    }
+
+    /* keys of the sound files checked in the background. */
+    if ((keys = g_key_file_get_string_list (keyfile, "general", "file-check-keys", &num_keys, NULL)) != NULL) {
+        if (num_keys > 0 && !core->filecheck) {
+            core->file_check_keys     = g_new0 (NAtom, num_keys);
+            core->num_file_check_keys = num_keys;
+            for (i = 0; i < num_keys; i++)
+                core->file_check_keys[i] = n_atom_intern (g_strstrip (keys[i]));
+            core->filecheck = n_file_check_new (core->workers, core->metrics);
+        }
+        g_strfreev (keys);
+    }
+
+    /* let sinks finish their initialization after the startup. */
+    core->async_init = g_key_file_get_boolean (keyfile, "general", "async-init", NULL);
+
+    /* accept requests before the sinks have been initialized. */
+    core->early_start = g_key_file_get_boolean (keyfile, "general", "early-start", NULL);
+
+    /* keep the timelines of the last finished requests for the dumps. */
+    if ((value = g_key_file_get_integer (keyfile, "general", "timeline-history", NULL)) > 0)
+        core->timeline_history = (guint) value;
+
+    /* collect call counts and durations of hook callbacks. */
+    if (g_key_file_get_boolean (keyfile, "general", "hook-timing", NULL))
+        n_core_set_hook_timing (core, TRUE);
+
+    /* fail sinks that stall in a stage of a request for too long. */
+    if ((value = g_key_file_get_integer (keyfile, "general", "watchdog-prepare", NULL)) > 0)
+        core->watchdog_prepare = (guint) value;
+    if ((value = g_key_file_get_integer (keyfile, "general", "watchdog-synchronize", NULL)) > 0)
+        core->watchdog_synchronize = (guint) value;
+    if ((value = g_key_file_get_integer (keyfile, "general", "watchdog-play", NULL)) > 0)
+        core->watchdog_play = (guint) value;
+
+    /* count main loop wakeups by their origin. */
+    if (g_key_file_get_boolean (keyfile, "general", "wakeup-stats", NULL))
+        n_wakeups_enable (core->metrics);
+
     /* load all the event configuration key entries. */
 
     n_core_parse_keytypes (core, keyfile);
@@ -834,10 +1916,82 @@ n_core_parse_configuration (NCore *core)
 }
 
 
+static void
+n_core_event_cache_append_value (GString *key, const NValue *value)
+{
+    const char *str = NULL;
+
+    if (!value) {
+        g_string_append_c (key, 'n');
+        return;
+    }
+
+    switch (n_value_type (value)) {
+        case N_VALUE_TYPE_STRING:
+            str = n_value_get_string (value);
+            g_string_append_printf (key, "s%u:%s", (guint) strlen (str), str);
+            break;
+        case N_VALUE_TYPE_INT:
+            g_string_append_printf (key, "i%d;", n_value_get_int (value));
+            break;
+        case N_VALUE_TYPE_UINT:
+            g_string_append_printf (key, "u%u;", n_value_get_uint (value));
+            break;
+        case N_VALUE_TYPE_BOOL:
+            g_string_append_printf (key, "b%d;", n_value_get_bool (value) ? 1 : 0);
+            break;
+        case N_VALUE_TYPE_POINTER:
+            g_string_append_printf (key, "p%p;", n_value_get_pointer (value));
+            break;
+        default:
+            g_string_append_c (key, '?');
+            break;
+    }
+}
+
+static gchar*
+n_core_event_cache_key (NCore *core, NRequest *request)
+{
+    const NAtom *keys     = NULL;
+    guint        num_keys = 0;
+    guint        i;
+    GString     *key      = NULL;
+
+    keys = n_event_list_get_request_keys (core->eventlist, request->name, &num_keys);
+    if (!keys)
+        return NULL;
+
+    /* the result only depends on the request keys the rules of this
+       event name look at, everything else can be ignored. */
+
+    key = g_string_new (request->name);
+    g_string_append_c (key, '\n');
+    for (i = 0; i < num_keys; i++)
+        n_core_event_cache_append_value (key,
+            n_proplist_get_by_atom (request->properties, keys[i]));
+
+    return g_string_free (key, FALSE);
+}
+
+static void
+n_core_event_cache_validate (NCore *core)
+{
+    guint context_generation = n_context_get_generation (core->context);
+
+    if (core->event_cache_context_generation == context_generation &&
+        core->event_cache_list_generation == core->eventlist->generation)
+        return;
+
+    g_hash_table_remove_all (core->event_cache);
+    core->event_cache_context_generation = context_generation;
+    core->event_cache_list_generation    = core->eventlist->generation;
+}
+
 NEvent*
 n_core_evaluate_request (NCore *core, NRequest *request)
 {
     NEvent *event;
+    gchar  *key;
 
     g_assert (core != NULL);
     g_assert (request != NULL);
@@ -845,20 +1999,110 @@ n_core_evaluate_request (NCore *core, NRequest *request)
     N_DEBUG (LOG_CAT "evaluating events for request '%s'",
         request->name);
 
+    n_core_event_cache_validate (core);
+
+    if (!(key = n_core_event_cache_key (core, request)))
+        return NULL;
+
+    if ((event = g_hash_table_lookup (core->event_cache, key))) {
+        core->event_cache_hits++;
+        N_DEBUG (LOG_CAT "evaluated to '%s' (cached)", event->name);
+        g_free (key);
+        return event;
+    }
+
+    core->event_cache_misses++;
+
     if ((event = n_event_list_match_request (core->eventlist, request))) {
         N_DEBUG (LOG_CAT "evaluated to '%s'", event->name);
         n_event_rules_dump (event, LOG_CAT);
+
+        if (g_hash_table_size (core->event_cache) >= EVENT_CACHE_MAX_SIZE)
+            g_hash_table_remove_all (core->event_cache);
+
+        g_hash_table_insert (core->event_cache, key, event);
+        key = NULL;
     }
 
+    g_free (key);
+
     return event;
 }
 
+void
+n_core_get_event_cache_stats (NCore *core, guint *hits, guint *misses, guint *size)
+{
+    if (hits)
+        *hits = core ? core->event_cache_hits : 0;
+    if (misses)
+        *misses = core ? core->event_cache_misses : 0;
+    if (size)
+        *size = core ? g_hash_table_size (core->event_cache) : 0;
+}
+
+void
+n_core_add_sink_plan_key (NCore *core, NHookCallback callback, void *userdata,
+                          const char *key, int value_matters)
+{
+    if (!core || !callback)
+        return;
+
+    n_core_add_filter_plan_key (core, callback, userdata, key, value_matters);
+}
+
+void
+n_core_get_sink_plan_stats (NCore *core, guint *hits, guint *misses)
+{
+    if (hits)
+        *hits = core ? core->sink_plan_hits : 0;
+    if (misses)
+        *misses = core ? core->sink_plan_misses : 0;
+}
+
 NContext*
 n_core_get_context (NCore *core)
 {
     return (core != NULL) ? core->context : NULL;
 }
 
+NMetrics*
+n_core_get_metrics (NCore *core)
+{
+    if (!core)
+        return NULL;
+
+    /* brought up to date for whoever reads them */
+    n_core_sync_alloc_stats (core);
+    return core->metrics;
+}
+
+NTimers*
+n_core_get_timers (NCore *core)
+{
+    return (core != NULL) ? core->timers : NULL;
+}
+
+NWorkers*
+n_core_get_workers (NCore *core)
+{
+    return (core != NULL) ? core->workers : NULL;
+}
+
+NFileState
+n_core_check_file (NCore *core, const char *path)
+{
+    if (!core || !core->filecheck || !path)
+        return N_FILE_STATE_UNKNOWN;
+
+    return n_file_check_lookup (core->filecheck, path);
+}
+
+NMemory*
+n_core_get_memory (NCore *core)
+{
+    return (core != NULL) ? core->memory : NULL;
+}
+
 GList*
 n_core_get_requests (NCore *core)
 {
@@ -868,6 +2112,108 @@ n_core_get_requests (NCore *core)
     return core->requests;
 }
 
+NRequest*
+n_core_lookup_request (NCore *core, guint id)
+{
+    if (!core || id == 0)
+        return NULL;
+
+    return (NRequest*) g_hash_table_lookup (core->request_table,
+        GUINT_TO_POINTER (id));
+}
+
+void
+n_core_prewarm_event (NCore *core, const char *event, const NProplist *properties)
+{
+    g_assert (core != NULL);
+    g_assert (event != NULL);
+
+    NRequest *request = NULL;
+
+    request = n_request_new_with_event_and_properties (event, properties);
+    if (!request->properties)
+        request->properties = n_proplist_new ();
+
+    n_core_prewarm_request (core, request);
+}
+
+void
+n_core_set_request_keys (NCore *core, const char **keys)
+{
+    const char **key = NULL;
+
+    if (!core)
+        return;
+
+    if (core->request_keys) {
+        g_hash_table_destroy (core->request_keys);
+        core->request_keys = NULL;
+    }
+
+    if (!keys)
+        return;
+
+    core->request_keys = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    for (key = keys; *key; ++key)
+        g_hash_table_add (core->request_keys, GUINT_TO_POINTER (n_atom_intern (*key)));
+}
+
+static gboolean
+n_core_request_key_has_prefix (const char *key)
+{
+    const char **prefix = NULL;
+
+    for (prefix = request_key_prefixes; *prefix; ++prefix) {
+        if (g_str_has_prefix (key, *prefix))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+NAtom
+n_core_intern_request_key (NCore *core, const char *key)
+{
+    NAtom  atom  = 0;
+    guint *count = NULL;
+
+    if (!core || !key)
+        return 0;
+
+    /* keys declared at load time, by event definitions, key types and
+       plugins, are interned already. */
+    if ((atom = n_atom_lookup (key))) {
+        if (core->request_keys &&
+            !g_hash_table_contains (core->request_keys, GUINT_TO_POINTER (atom)))
+            return 0;
+        return atom;
+    }
+
+    /* the kept keys have been interned when they were set. */
+    if (core->request_keys)
+        return 0;
+
+    /* other keys are passed on for the sinks forwarding them, like the
+       stream properties, but only so many are interned so that clients
+       can't grow the atom table without limit. the stream properties
+       have a budget of their own. */
+    count = n_core_request_key_has_prefix (key) ?
+        &core->request_prefix_atoms : &core->request_key_atoms;
+
+    if (*count >= REQUEST_KEY_ATOMS_MAX) {
+        if (*count == REQUEST_KEY_ATOMS_MAX) {
+            N_WARNING (LOG_CAT "%u undeclared request keys interned, dropping "
+                "new ones like '%s'", REQUEST_KEY_ATOMS_MAX, key);
+            ++*count;
+        }
+        return 0;
+    }
+
+    ++*count;
+    return n_atom_intern (key);
+}
+
 NSinkInterface**
 n_core_get_sinks (NCore *core)
 {
@@ -886,6 +2232,15 @@ n_core_get_events (NCore *core)
     return n_event_list_get_events (core->eventlist);
 }
 
+guint
+n_core_get_events_generation (NCore *core)
+{
+    if (!core)
+        return 0;
+
+    return core->eventlist->generation;
+}
+
 int
 n_core_connect (NCore *core, NCoreHook hook, int priority,
                 NHookCallback callback, void *userdata)
@@ -901,6 +2256,10 @@ n_core_connect (NCore *core, NCoreHook hook, int priority,
 
     n_hook_connect (&core->hooks[hook], priority, callback, userdata);
 
+    /* the cached plans were not filtered by the new callback */
+    if (hook == N_CORE_HOOK_FILTER_SINKS)
+        n_core_clear_sink_plans (core);
+
     return TRUE;
 }
 
@@ -915,6 +2274,72 @@ n_core_disconnect (NCore *core, NCoreHook hook, NHookCallback callback,
         return;
 
     n_hook_disconnect (&core->hooks[hook], callback, userdata);
+
+    if (hook == N_CORE_HOOK_FILTER_SINKS)
+        n_core_clear_sink_plans (core);
+}
+
+void
+n_core_set_hook_timing (NCore *core, int enabled)
+{
+    int i;
+
+    if (!core)
+        return;
+
+    for (i = 0; i < N_CORE_HOOK_LAST; i++)
+        n_hook_set_timing (&core->hooks[i], enabled);
+}
+
+void
+n_core_dump_hook_stats (NCore *core)
+{
+    NHook     *hook = NULL;
+    NHookSlot *slot = NULL;
+    int        i;
+    guint      j;
+
+    if (!core)
+        return;
+
+    for (i = 0; i < N_CORE_HOOK_LAST; i++) {
+        hook = &core->hooks[i];
+
+        if (!hook->timing) {
+            N_INFO (LOG_CAT "hook '%s' timing disabled", n_core_hook_to_string (i));
+            continue;
+        }
+
+        for (j = 0; j < hook->num_slots; j++) {
+            slot = hook->slots[j];
+            N_INFO (LOG_CAT "hook '%s' callback 0x%p priority %d: calls %u, "
+                            "total %" G_GINT64_FORMAT " us, avg %" G_GINT64_FORMAT " us, "
+                            "max %" G_GINT64_FORMAT " us",
+                            n_core_hook_to_string (i), (void*) slot->callback,
+                            slot->priority, slot->calls, slot->total_us,
+                            slot->calls ? slot->total_us / slot->calls : 0,
+                            slot->max_us);
+        }
+    }
+}
+
+void
+n_core_dump_request_timelines (NCore *core)
+{
+    GList *iter     = NULL;
+    gchar *timeline = NULL;
+
+    if (!core)
+        return;
+
+    for (iter = g_list_first (core->requests); iter; iter = g_list_next (iter)) {
+        timeline = n_request_timeline_to_string ((NRequest*) iter->data);
+        N_INFO (LOG_CAT "timeline %s", timeline);
+        g_free (timeline);
+    }
+
+    for (iter = g_queue_peek_head_link (core->timelines); iter; iter = g_list_next (iter))
+        N_INFO (LOG_CAT "timeline %s", (const gchar*) iter->data);
 }
 
 void
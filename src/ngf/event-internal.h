@@ -33,19 +33,30 @@
 #define N_EVENT_GROUP_ENTRY_DEFINE  "%define "
 #define N_EVENT_GROUP_ENTRY_INCLUDE "%include"
 
+/* Value of key with this suffix replaces the key without it when the
+ * request is played again as a fallback. */
+#define N_EVENT_FALLBACK_SUFFIX     ".fallback"
+
 struct _NEvent
 {
     gchar      *name;               /* event name */
     NProplist  *properties;         /* properties */
     GSList     *rules;
     int         priority;           /* higher value higher priority */
+    int         haptic_class;       /* class of haptic.type, N_HAPTIC_CLASS_* */
+    guint       num_fallbacks;
+    NAtom      *fallbacks;          /* fallback key, target key pairs */
 };
 
 NEvent*     n_event_new              ();
 void        n_event_free             (NEvent *event);
+/* Resolve the haptic class and the fallback keys of the event
+ * properties, called whenever the properties change. */
+void        n_event_index_properties (NEvent *event);
 
 NEvent*     n_event_new_from_group   (GSList **rule_list, GKeyFile *keyfile,
                                       const char *group, GHashTable *keytypes, GHashTable *defines);
+gchar*      n_event_parse_group_name (const char *group);
 NProplist*  n_event_parse_properties (GKeyFile *keyfile, const char *group,
                                       GHashTable *key_types, GHashTable *defines);
 
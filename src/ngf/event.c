@@ -24,8 +24,10 @@
 #include <string.h>
 #include <glib.h>
 #include <ngf/log.h>
+#include <ngf/haptic.h>
 #include "eventrule-internal.h"
 #include "event-internal.h"
+#include "allocstats.h"
 
 #define LOG_CAT "event: "
 
@@ -41,6 +43,7 @@ static void     merge_rules             (GSList **to, GSList *from);
 NEvent*
 n_event_new ()
 {
+    N_ALLOC_COUNT (N_ALLOC_EVENT, sizeof (NEvent));
     return g_new0 (NEvent, 1);
 }
 
@@ -59,8 +62,49 @@ n_event_free (NEvent *event)
     }
 
     g_free (event->name);
+    g_free (event->fallbacks);
     g_slist_free_full (event->rules, event_unref_rule_cb);
     g_free (event);
+    N_FREE_COUNT (N_ALLOC_EVENT);
+}
+
+static void
+event_find_fallback_cb (const char *key, const NValue *value, gpointer userdata)
+{
+    (void) value;
+
+    GArray *fallbacks = userdata;
+    gchar  *target    = NULL;
+    NAtom   atoms[2];
+
+    if (!g_str_has_suffix (key, N_EVENT_FALLBACK_SUFFIX))
+        return;
+
+    target   = g_strndup (key, strlen (key) - strlen (N_EVENT_FALLBACK_SUFFIX));
+    atoms[0] = n_atom_intern (key);
+    atoms[1] = n_atom_intern (target);
+    g_array_append_vals (fallbacks, atoms, 2);
+    g_free (target);
+}
+
+void
+n_event_index_properties (NEvent *event)
+{
+    GArray *fallbacks = NULL;
+
+    g_assert (event);
+
+    /* the haptic class only depends on the type, resolve it once. */
+    event->haptic_class = n_haptic_class_for_type (
+        n_proplist_get_string (event->properties, N_HAPTIC_TYPE_KEY));
+
+    g_free (event->fallbacks);
+
+    fallbacks = g_array_new (FALSE, FALSE, sizeof (NAtom));
+    n_proplist_foreach (event->properties, event_find_fallback_cb, fallbacks);
+
+    event->num_fallbacks = fallbacks->len / 2;
+    event->fallbacks     = (NAtom*) g_array_free (fallbacks, fallbacks->len == 0);
 }
 
 guint
@@ -132,7 +176,7 @@ dump_event_rules_cb (gpointer data, gpointer userdata)
 void
 n_event_rules_dump (NEvent *event, const char *debug_prefix)
 {
-    if (event && n_log_get_level() <= N_LOG_LEVEL_DEBUG)
+    if (event && N_LOG_ENABLED (N_LOG_LEVEL_DEBUG))
         g_slist_foreach (event->rules, dump_event_rules_cb, (gpointer) debug_prefix);
 }
 
@@ -246,6 +290,28 @@ done:
     return TRUE;
 }
 
+gchar*
+n_event_parse_group_name (const char *group)
+{
+    gchar **split = NULL;
+    gchar  *name  = NULL;
+    gchar  *priority = NULL;
+
+    g_assert (group);
+
+    if (g_str_has_prefix (group, N_EVENT_GROUP_ENTRY_DEFINE))
+        return NULL;
+
+    split = g_strsplit (group, "=>", 2);
+    if ((priority = strstr (split[0], "@priority")))
+        *priority = '\0';
+
+    name = g_strdup (g_strstrip (split[0]));
+    g_strfreev (split);
+
+    return name;
+}
+
 NProplist*
 n_event_parse_properties (GKeyFile *keyfile, const char *group,
                           GHashTable *keytypes, GHashTable *defines)
@@ -364,6 +430,8 @@ n_event_new_from_group (GSList **rule_list, GKeyFile *keyfile, const char *group
     event->properties = props;
     event->priority   = priority;
 
+    n_event_index_properties (event);
+
     return event;
 }
 
@@ -0,0 +1,36 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_EVENT_DB_INTERNAL_H
+#define N_EVENT_DB_INTERNAL_H
+
+#include <glib.h>
+#include "eventlist-internal.h"
+
+/* Precompiled event database. Stores the fully parsed and merged
+ * event list together with the identity (path, size, mtime, inode) of
+ * every configuration file it was built from. Loading fails if any of
+ * the source files changed, in which case the events need to be parsed
+ * from the ini files again. */
+
+gboolean n_event_db_load (NEventList *eventlist, const char *filename, GSList *sources);
+gboolean n_event_db_save (NEventList *eventlist, const char *filename, GSList *sources);
+
+#endif /* N_EVENT_DB_INTERNAL_H */
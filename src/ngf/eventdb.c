@@ -0,0 +1,564 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <ngf/log.h>
+#include <ngf/value.h>
+#include <ngf/proplist.h>
+#include "event-internal.h"
+#include "eventrule-internal.h"
+#include "eventlist-internal.h"
+#include "eventdb-internal.h"
+
+#define LOG_CAT "event-db: "
+
+/* file layout, all integers little endian:
+ *
+ *   magic, version
+ *   u32 num_sources, { string path, u64 size, i64 mtime, u64 inode }
+ *   u32 num_events,  { string name, i32 priority,
+ *                      u32 num_rules, { u8 target, u8 op, string key, value },
+ *                      u32 num_properties, { string key, value } }
+ *
+ * strings are u32 length followed by the bytes and a terminating zero,
+ * so that they can be used directly from the mapped file. values are
+ * u8 type followed by string, i32, u32 or u8 by type. */
+
+#define EVENT_DB_MAGIC      "NGFEVDB"
+#define EVENT_DB_VERSION    (1)
+
+typedef struct _NEventDBReader
+{
+    const guint8 *data;
+    gsize         size;
+    gsize         pos;
+    gboolean      failed;
+} NEventDBReader;
+
+typedef struct _NEventDBSource
+{
+    guint64 size;
+    gint64  mtime;
+    guint64 inode;
+} NEventDBSource;
+
+static gboolean     db_source_stat      (const char *filename, NEventDBSource *source);
+static void         db_put_data         (GByteArray *buf, const void *data, guint len);
+static void         db_put_u8           (GByteArray *buf, guint8 value);
+static void         db_put_u32          (GByteArray *buf, guint32 value);
+static void         db_put_u64          (GByteArray *buf, guint64 value);
+static void         db_put_string       (GByteArray *buf, const char *str);
+static gboolean     db_put_value        (GByteArray *buf, const NValue *value);
+static gboolean     db_reader_check     (NEventDBReader *reader, gsize len);
+static guint8       db_get_u8           (NEventDBReader *reader);
+static guint32      db_get_u32          (NEventDBReader *reader);
+static guint64      db_get_u64          (NEventDBReader *reader);
+static const char*  db_get_string       (NEventDBReader *reader);
+static NValue*      db_get_value        (NEventDBReader *reader);
+static NEventRule*  db_get_rule         (NEventDBReader *reader, GSList **rule_list);
+static NEvent*      db_get_event        (NEventDBReader *reader, GSList **rule_list);
+static gboolean     db_check_sources    (NEventDBReader *reader, GSList *sources);
+
+
+
+static gboolean
+db_source_stat (const char *filename, NEventDBSource *source)
+{
+    struct stat st;
+
+    if (stat (filename, &st) < 0)
+        return FALSE;
+
+    source->size  = (guint64) st.st_size;
+    source->mtime = (gint64) st.st_mtime;
+    source->inode = (guint64) st.st_ino;
+
+    return TRUE;
+}
+
+static void
+db_put_data (GByteArray *buf, const void *data, guint len)
+{
+    g_byte_array_append (buf, (const guint8*) data, len);
+}
+
+static void
+db_put_u8 (GByteArray *buf, guint8 value)
+{
+    db_put_data (buf, &value, sizeof (value));
+}
+
+static void
+db_put_u32 (GByteArray *buf, guint32 value)
+{
+    value = GUINT32_TO_LE (value);
+    db_put_data (buf, &value, sizeof (value));
+}
+
+static void
+db_put_u64 (GByteArray *buf, guint64 value)
+{
+    value = GUINT64_TO_LE (value);
+    db_put_data (buf, &value, sizeof (value));
+}
+
+static void
+db_put_string (GByteArray *buf, const char *str)
+{
+    guint32 len = str ? strlen (str) : 0;
+
+    db_put_u32 (buf, len);
+    db_put_data (buf, str ? str : "", len + 1);
+}
+
+static gboolean
+db_put_value (GByteArray *buf, const NValue *value)
+{
+    int type = n_value_type (value);
+
+    db_put_u8 (buf, type);
+
+    switch (type) {
+        case N_VALUE_TYPE_STRING:
+            db_put_string (buf, n_value_get_string (value));
+            break;
+        case N_VALUE_TYPE_INT:
+            db_put_u32 (buf, (guint32) n_value_get_int (value));
+            break;
+        case N_VALUE_TYPE_UINT:
+            db_put_u32 (buf, n_value_get_uint (value));
+            break;
+        case N_VALUE_TYPE_BOOL:
+            db_put_u8 (buf, n_value_get_bool (value) ? 1 : 0);
+            break;
+        default:
+            /* pointers can't be stored */
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+typedef struct _NEventDBWriteData
+{
+    GByteArray *buf;
+    gboolean    failed;
+} NEventDBWriteData;
+
+static void
+db_put_property_cb (const char *key, const NValue *value, gpointer userdata)
+{
+    NEventDBWriteData *data = userdata;
+
+    db_put_string (data->buf, key);
+    if (!db_put_value (data->buf, value))
+        data->failed = TRUE;
+}
+
+gboolean
+n_event_db_save (NEventList *eventlist, const char *filename, GSList *sources)
+{
+    NEventDBWriteData  data;
+    NEventDBSource     source;
+    GByteArray        *buf     = NULL;
+    GList             *iter    = NULL;
+    GSList            *s       = NULL;
+    GSList            *r       = NULL;
+    NEvent            *event   = NULL;
+    NEventRule        *rule    = NULL;
+    GError            *error   = NULL;
+    gchar             *dirname = NULL;
+    gboolean           success = FALSE;
+
+    g_assert (eventlist);
+    g_assert (filename);
+
+    buf = g_byte_array_new ();
+    data.buf    = buf;
+    data.failed = FALSE;
+
+    db_put_data (buf, EVENT_DB_MAGIC, sizeof (EVENT_DB_MAGIC));
+    db_put_u32  (buf, EVENT_DB_VERSION);
+
+    db_put_u32 (buf, g_slist_length (sources));
+    for (s = sources; s; s = g_slist_next (s)) {
+        if (!db_source_stat (s->data, &source)) {
+            N_WARNING (LOG_CAT "cannot stat '%s', not writing event database.",
+                (const char*) s->data);
+            goto done;
+        }
+
+        db_put_string (buf, s->data);
+        db_put_u64    (buf, source.size);
+        db_put_u64    (buf, (guint64) source.mtime);
+        db_put_u64    (buf, source.inode);
+    }
+
+    db_put_u32 (buf, n_event_list_size (eventlist));
+    for (iter = g_list_first (n_event_list_get_events (eventlist)); iter; iter = g_list_next (iter)) {
+        event = iter->data;
+
+        db_put_string (buf, event->name);
+        db_put_u32    (buf, (guint32) event->priority);
+
+        db_put_u32 (buf, g_slist_length (event->rules));
+        for (r = event->rules; r; r = g_slist_next (r)) {
+            rule = r->data;
+            db_put_u8     (buf, rule->target);
+            db_put_u8     (buf, rule->op);
+            db_put_string (buf, rule->key);
+            if (!db_put_value (buf, rule->value))
+                data.failed = TRUE;
+        }
+
+        db_put_u32 (buf, n_proplist_size (event->properties));
+        n_proplist_foreach (event->properties, db_put_property_cb, &data);
+
+        if (data.failed) {
+            N_WARNING (LOG_CAT "event '%s' cannot be stored, not writing event database.",
+                event->name);
+            goto done;
+        }
+    }
+
+    dirname = g_path_get_dirname (filename);
+    g_mkdir_with_parents (dirname, 0755);
+    g_free (dirname);
+
+    if (!g_file_set_contents (filename, (const gchar*) buf->data, buf->len, &error)) {
+        N_WARNING (LOG_CAT "failed to write event database: %s", error->message);
+        g_error_free (error);
+        goto done;
+    }
+
+    N_INFO (LOG_CAT "wrote %d events to '%s' (%u bytes)",
+        n_event_list_size (eventlist), filename, buf->len);
+    success = TRUE;
+
+done:
+    g_byte_array_free (buf, TRUE);
+
+    return success;
+}
+
+static gboolean
+db_reader_check (NEventDBReader *reader, gsize len)
+{
+    if (reader->failed || reader->size - reader->pos < len)
+        reader->failed = TRUE;
+
+    return !reader->failed;
+}
+
+static guint8
+db_get_u8 (NEventDBReader *reader)
+{
+    if (!db_reader_check (reader, 1))
+        return 0;
+
+    return reader->data[reader->pos++];
+}
+
+static guint32
+db_get_u32 (NEventDBReader *reader)
+{
+    guint32 value;
+
+    if (!db_reader_check (reader, sizeof (value)))
+        return 0;
+
+    memcpy (&value, reader->data + reader->pos, sizeof (value));
+    reader->pos += sizeof (value);
+
+    return GUINT32_FROM_LE (value);
+}
+
+static guint64
+db_get_u64 (NEventDBReader *reader)
+{
+    guint64 value;
+
+    if (!db_reader_check (reader, sizeof (value)))
+        return 0;
+
+    memcpy (&value, reader->data + reader->pos, sizeof (value));
+    reader->pos += sizeof (value);
+
+    return GUINT64_FROM_LE (value);
+}
+
+static const char*
+db_get_string (NEventDBReader *reader)
+{
+    const char *str;
+    guint32     len;
+
+    len = db_get_u32 (reader);
+    if (!db_reader_check (reader, (gsize) len + 1))
+        return NULL;
+
+    str = (const char*) reader->data + reader->pos;
+    if (str[len] != '\0' || strlen (str) != len) {
+        reader->failed = TRUE;
+        return NULL;
+    }
+
+    reader->pos += len + 1;
+
+    return str;
+}
+
+static NValue*
+db_get_value (NEventDBReader *reader)
+{
+    NValue     *value = NULL;
+    const char *str   = NULL;
+
+    value = n_value_new ();
+
+    switch (db_get_u8 (reader)) {
+        case N_VALUE_TYPE_STRING:
+            if ((str = db_get_string (reader)))
+                n_value_set_string (value, str);
+            break;
+        case N_VALUE_TYPE_INT:
+            n_value_set_int (value, (gint) db_get_u32 (reader));
+            break;
+        case N_VALUE_TYPE_UINT:
+            n_value_set_uint (value, db_get_u32 (reader));
+            break;
+        case N_VALUE_TYPE_BOOL:
+            n_value_set_bool (value, db_get_u8 (reader) ? TRUE : FALSE);
+            break;
+        default:
+            reader->failed = TRUE;
+            break;
+    }
+
+    if (reader->failed) {
+        n_value_free (value);
+        return NULL;
+    }
+
+    return value;
+}
+
+static NEventRule*
+db_get_rule (NEventDBReader *reader, GSList **rule_list)
+{
+    NEventRule *rule   = NULL;
+    NValue     *value  = NULL;
+    const char *key    = NULL;
+    GSList     *iter   = NULL;
+    guint8      target = 0;
+    guint8      op     = 0;
+
+    target = db_get_u8 (reader);
+    op     = db_get_u8 (reader);
+    key    = db_get_string (reader);
+
+    if (!key || !(value = db_get_value (reader)))
+        return NULL;
+
+    if (target > N_EVENT_RULE_CONTEXT || op > N_EVENT_RULE_LESS_OR_EQUAL) {
+        reader->failed = TRUE;
+        n_value_free (value);
+        return NULL;
+    }
+
+    rule = n_event_rule_new (target, key, op, value);
+
+    /* share identical rules between events, same as when parsing. */
+    for (iter = *rule_list; iter; iter = g_slist_next (iter)) {
+        if (n_event_rule_equal (rule, iter->data)) {
+            n_event_rule_unref (rule);
+            return n_event_rule_ref (iter->data);
+        }
+    }
+
+    *rule_list = g_slist_append (*rule_list, n_event_rule_ref (rule));
+
+    return rule;
+}
+
+static NEvent*
+db_get_event (NEventDBReader *reader, GSList **rule_list)
+{
+    NEvent     *event = NULL;
+    NEventRule *rule  = NULL;
+    NValue     *value = NULL;
+    const char *str   = NULL;
+    guint32     count = 0;
+    guint32     i;
+
+    if (!(str = db_get_string (reader)))
+        return NULL;
+
+    event             = n_event_new ();
+    event->name       = g_strdup (str);
+    event->priority   = (int) db_get_u32 (reader);
+    event->properties = n_proplist_new ();
+
+    count = db_get_u32 (reader);
+    for (i = 0; i < count && !reader->failed; i++) {
+        if ((rule = db_get_rule (reader, rule_list)))
+            event->rules = g_slist_append (event->rules, rule);
+    }
+
+    count = db_get_u32 (reader);
+    for (i = 0; i < count && !reader->failed; i++) {
+        str = db_get_string (reader);
+        if (str && (value = db_get_value (reader)))
+            n_proplist_set (event->properties, str, value);
+    }
+
+    if (reader->failed) {
+        n_event_free (event);
+        return NULL;
+    }
+
+    n_event_index_properties (event);
+
+    return event;
+}
+
+static gboolean
+db_check_sources (NEventDBReader *reader, GSList *sources)
+{
+    NEventDBSource  source;
+    GSList         *s     = NULL;
+    const char     *path  = NULL;
+    guint32         count = 0;
+    guint64         size  = 0;
+    gint64          mtime = 0;
+    guint64         inode = 0;
+
+    count = db_get_u32 (reader);
+    if (count != g_slist_length (sources))
+        return FALSE;
+
+    for (s = sources; s && !reader->failed; s = g_slist_next (s)) {
+        path  = db_get_string (reader);
+        size  = db_get_u64 (reader);
+        mtime = (gint64) db_get_u64 (reader);
+        inode = db_get_u64 (reader);
+
+        if (reader->failed || g_strcmp0 (path, s->data) != 0)
+            return FALSE;
+
+        if (!db_source_stat (path, &source) || source.size != size ||
+            source.mtime != mtime || source.inode != inode) {
+            N_DEBUG (LOG_CAT "source '%s' changed", path);
+            return FALSE;
+        }
+    }
+
+    return !reader->failed;
+}
+
+static void
+db_free_event_cb (gpointer data)
+{
+    n_event_free ((NEvent*) data);
+}
+
+static void
+db_free_rule_cb (gpointer data)
+{
+    n_event_rule_unref ((NEventRule*) data);
+}
+
+gboolean
+n_event_db_load (NEventList *eventlist, const char *filename, GSList *sources)
+{
+    NEventDBReader  reader;
+    GMappedFile    *file      = NULL;
+    GError         *error     = NULL;
+    GList          *events    = NULL;
+    GSList         *rule_list = NULL;
+    NEvent         *event     = NULL;
+    guint32         count     = 0;
+    guint32         i;
+
+    g_assert (eventlist);
+    g_assert (filename);
+
+    if (n_event_list_size (eventlist) > 0)
+        return FALSE;
+
+    if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR))
+        return FALSE;
+
+    if (!(file = g_mapped_file_new (filename, FALSE, &error))) {
+        N_WARNING (LOG_CAT "failed to map '%s': %s", filename, error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+
+    memset (&reader, 0, sizeof (reader));
+    reader.data = (const guint8*) g_mapped_file_get_contents (file);
+    reader.size = g_mapped_file_get_length (file);
+
+    if (!db_reader_check (&reader, sizeof (EVENT_DB_MAGIC)) ||
+        memcmp (reader.data, EVENT_DB_MAGIC, sizeof (EVENT_DB_MAGIC)) != 0) {
+        N_WARNING (LOG_CAT "'%s' is not an event database", filename);
+        goto fail;
+    }
+    reader.pos += sizeof (EVENT_DB_MAGIC);
+
+    if (db_get_u32 (&reader) != EVENT_DB_VERSION) {
+        N_INFO (LOG_CAT "event database version changed");
+        goto fail;
+    }
+
+    if (!db_check_sources (&reader, sources)) {
+        N_INFO (LOG_CAT "event configuration changed, event database is out of date");
+        goto fail;
+    }
+
+    count = db_get_u32 (&reader);
+    for (i = 0; i < count; i++) {
+        if (!(event = db_get_event (&reader, &rule_list)))
+            break;
+        events = g_list_prepend (events, event);
+    }
+
+    if (reader.failed || count == 0) {
+        N_WARNING (LOG_CAT "event database '%s' is corrupted", filename);
+        goto fail;
+    }
+
+    n_event_list_add_events (eventlist, g_list_reverse (events), rule_list);
+    g_mapped_file_unref (file);
+
+    N_INFO (LOG_CAT "loaded %u events from '%s'", count, filename);
+
+    return TRUE;
+
+fail:
+    g_list_free_full (events, db_free_event_cb);
+    g_slist_free_full (rule_list, db_free_rule_cb);
+    g_mapped_file_unref (file);
+
+    return FALSE;
+}
@@ -26,19 +26,78 @@
 
 #include <ngf/proplist.h>
 #include "core-internal.h"
+#include "eventrule-internal.h"
+#include "context-internal.h"
+#include "value-internal.h"
+
+/* Compiled match index for all events sharing one name. Rules are
+ * shared between events (see merge_rules in event.c), so each distinct
+ * rule and each distinct key is evaluated at most once per match. */
+typedef struct _NEventIndex
+{
+    guint        num_keys;
+    NAtom       *keys;              /* distinct rule keys */
+    guint8      *key_targets;       /* NEventRuleTarget for each key */
+    guint        num_request_keys;
+    NAtom       *request_keys;      /* distinct request target keys */
+    guint        num_rules;
+    NEventRule **rules;             /* distinct rules */
+    guint       *rule_keys;         /* rule index -> key index */
+    guint        num_events;
+    NEvent     **events;            /* events in match order */
+    guint       *event_offsets;     /* num_events + 1 offsets to event_rules */
+    guint       *event_rules;       /* rule indices for each event */
+
+    /* last result, reused while none of the context keys change.
+       only used when there are no request rules. */
+    gboolean     has_request_rules;
+    gboolean     result_valid;
+    guint        result_generation;
+    NEvent      *result;
+
+    /* scratch space reused on every match */
+    guint8      *rule_state;
+    guint8      *key_state;
+    const NValue **key_values;
+} NEventIndex;
 
 typedef struct _NEventList
 {
     NCore      *core;
     GHashTable *event_table;
+    GHashTable *index_table;        /* key:event name value:NEventIndex */
     GList      *event_list;
     GSList     *rule_list;
+    gboolean    linear_match;       /* walk the rules without index */
+    guint       generation;         /* increased whenever events change */
+    NValuePool *values;             /* strings shared by all event properties */
 } NEventList;
 
+typedef struct _NEventListFootprint
+{
+    guint       num_events;
+    guint       num_values;
+    guint       num_strings;        /* distinct string buffers */
+    gsize       bytes;              /* property values as stored */
+    gsize       unshared_bytes;     /* same without any shared strings */
+} NEventListFootprint;
+
 NEventList* n_event_list_new            (NCore *core);
 void        n_event_list_free           (NEventList *eventlist);
 gboolean    n_event_list_parse_keyfile  (NEventList *eventlist, GKeyFile *keyfile);
+/* Parse only events whose name is found in names set. */
+int         n_event_list_parse_keyfile_filtered (NEventList *eventlist, GKeyFile *keyfile,
+                                                 GHashTable *names);
+void        n_event_list_add_events     (NEventList *eventlist, GList *events, GSList *rules);
+const NAtom* n_event_list_get_request_keys (NEventList *eventlist, const char *name,
+                                            guint *num_keys);
 GList*      n_event_list_get_events     (NEventList *eventlist);
+/* Detach all events with given name, returned list is owned by caller. */
+GList*      n_event_list_remove_events  (NEventList *eventlist, const char *name);
+void        n_event_list_prune_rules    (NEventList *eventlist);
+/* Drop pooled strings no event uses anymore. */
+void        n_event_list_prune_values   (NEventList *eventlist);
+void        n_event_list_get_footprint  (NEventList *eventlist, NEventListFootprint *footprint);
 guint       n_event_list_size           (const NEventList *eventlist);
 
 NEvent*     n_event_list_match_request  (NEventList *eventlist, NRequest *request);
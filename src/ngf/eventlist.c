@@ -19,6 +19,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <glib.h>
 #include <ngf/log.h>
@@ -32,22 +33,36 @@
 #define UNSET_KEY_PREFIX "%unset."
 #define UNSET_EVENT_STR  "%unset_event"
 
+/* Set to disable the compiled event index and match by walking
+ * the event rules one by one. */
+#define LINEAR_MATCH_ENV "NGF_EVENT_LINEAR_MATCH"
+
+#define STATE_UNKNOWN   (0)
+#define STATE_TRUE      (1)
+#define STATE_FALSE     (2)
+
 static NEvent*      event_list_add_event        (NEventList *eventlist, NEvent *event);
 static void         parse_defines               (NCore *core, GKeyFile *keyfile,
                                                  const char *group, GHashTable **defines);
 static void         event_list_free_cb          (gpointer in_key, gpointer in_data,
                                                  gpointer userdata);
 static void         event_rule_free_cb          (gpointer data);
-static void         cache_rule_context_cb       (NContext *context, const char *key,
-                                                 const NValue *old_value, const NValue *new_value,
-                                                 void *userdata);
 static void         match_event_rule_cb         (gpointer data, gpointer userdata);
 static void         event_dump_value_cb         (const char *key, const NValue *value,
                                                  gpointer userdata);
 static gint         sort_event_cb               (gconstpointer a, gconstpointer b);
+static void         event_list_intern_values    (NEventList *eventlist, NEvent *event);
+static void         event_intern_value_cb       (const char *key, const NValue *value,
+                                                 gpointer userdata);
+static void         footprint_value_cb          (const char *key, const NValue *value,
+                                                 gpointer userdata);
 static const char*  strip_prefix                (const char *group, const char *prefix);
-static void         subscribe_event_rules_cb    (gpointer data, gpointer userdata);
-static void         unsubscribe_event_rules_cb  (gpointer data, gpointer userdata);
+static NEventIndex* event_index_new             (GList *event_list);
+static NEventIndex* event_list_get_index        (NEventList *eventlist, const char *name,
+                                                 GList *event_list);
+static void         event_index_free            (gpointer data);
+static NEvent*      event_index_match           (NEventIndex *index, NRequest *request,
+                                                 NContext *context);
 
 typedef struct _NEventMatchResult
 {
@@ -56,6 +71,12 @@ typedef struct _NEventMatchResult
     gboolean  has_match;
 } NEventMatchResult;
 
+typedef struct _NFootprintData
+{
+    NEventListFootprint *footprint;
+    GHashTable          *buffers;
+} NFootprintData;
+
 NEventList*
 n_event_list_new (NCore *core)
 {
@@ -64,6 +85,12 @@ n_event_list_new (NCore *core)
     el              = g_new0 (NEventList, 1);
     el->core        = core;
     el->event_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    el->index_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, event_index_free);
+    el->linear_match = getenv (LINEAR_MATCH_ENV) != NULL;
+    el->values      = n_value_pool_new ();
+
+    if (el->linear_match)
+        N_INFO (LOG_CAT "event index disabled, using linear rule matching.");
 
     return el;
 }
@@ -135,6 +162,22 @@ find_unset_key_cb (const char *key, const NValue *value, gpointer userdata)
     match_key (key, UNSET_KEY_PREFIX, userdata);
 }
 
+static void
+event_intern_value_cb (const char *key, const NValue *value, gpointer userdata)
+{
+    (void) key;
+
+    /* the buffer is only swapped for an equal one, so the value itself
+       does not change. */
+    n_value_pool_intern ((NValuePool*) userdata, (NValue*) value);
+}
+
+static void
+event_list_intern_values (NEventList *eventlist, NEvent *event)
+{
+    n_proplist_foreach (event->properties, event_intern_value_cb, eventlist->values);
+}
+
 /* Event may change when calling this function, so returned event
  * pointer should be used if it needs to be manipulated after adding
  * to eventlist. */
@@ -148,9 +191,14 @@ event_list_add_event (NEventList *eventlist, NEvent *event)
     GList  *iter       = NULL;
     NEvent *found      = NULL;
 
-    /* get the event list for the specific event name. */
+    event_list_intern_values (eventlist, event);
+
+    /* get the event list for the specific event name. any change to it
+       invalidates the compiled index, which is rebuilt on next match. */
 
     event_list = g_hash_table_lookup (eventlist->event_table, event->name);
+    g_hash_table_remove (eventlist->index_table, event->name);
+    eventlist->generation++;
 
     /* iterate through the event list and try to find an event that has the
        same rules. */
@@ -195,10 +243,13 @@ event_list_add_event (NEventList *eventlist, NEvent *event)
                 n_proplist_unset (event->properties, key);
             }
             n_proplist_merge (found->properties, event->properties);
+            n_event_index_properties (found);
             n_event_free (event);
 
-            N_DEBUG (LOG_CAT "merged properties:", found->name);
-            n_proplist_foreach (found->properties, event_dump_value_cb, NULL);
+            if (N_LOG_ENABLED (N_LOG_LEVEL_DEBUG)) {
+                N_DEBUG (LOG_CAT "merged properties:", found->name);
+                n_proplist_foreach (found->properties, event_dump_value_cb, NULL);
+            }
 
             return found;
         }
@@ -206,14 +257,16 @@ event_list_add_event (NEventList *eventlist, NEvent *event)
 
     /* completely new event, add it to the list and sort it. */
 
-    N_DEBUG (LOG_CAT "new event '%s'", event->name);
-    if (n_event_rules_size (event) > 0)
-        n_event_rules_dump (event, LOG_CAT);
-    else
-        N_DEBUG (LOG_CAT "+ default");
+    if (N_LOG_ENABLED (N_LOG_LEVEL_DEBUG)) {
+        N_DEBUG (LOG_CAT "new event '%s'", event->name);
+        if (n_event_rules_size (event) > 0)
+            n_event_rules_dump (event, LOG_CAT);
+        else
+            N_DEBUG (LOG_CAT "+ default");
 
-    N_DEBUG (LOG_CAT "properties");
-    n_proplist_foreach (event->properties, event_dump_value_cb, NULL);
+        N_DEBUG (LOG_CAT "properties");
+        n_proplist_foreach (event->properties, event_dump_value_cb, NULL);
+    }
 
     event_list = g_list_append (event_list, event);
     event_list = g_list_sort (event_list, sort_event_cb);
@@ -277,10 +330,18 @@ done:
 
 int
 n_event_list_parse_keyfile (NEventList *eventlist, GKeyFile *keyfile)
+{
+    return n_event_list_parse_keyfile_filtered (eventlist, keyfile, NULL);
+}
+
+int
+n_event_list_parse_keyfile_filtered (NEventList *eventlist, GKeyFile *keyfile,
+                                     GHashTable *names)
 {
     GHashTable *defines   = NULL;
     gchar    **group_list = NULL;
     gchar    **group      = NULL;
+    gchar     *name       = NULL;
     NEvent    *event      = NULL;
     int        parsed     = 0;
 
@@ -293,13 +354,19 @@ n_event_list_parse_keyfile (NEventList *eventlist, GKeyFile *keyfile)
         parse_defines (eventlist->core, keyfile, *group, &defines);
 
     for (group = group_list; *group; ++group) {
+        if (names) {
+            name = n_event_parse_group_name (*group);
+            if (!name || !g_hash_table_contains (names, name)) {
+                g_free (name);
+                continue;
+            }
+            g_free (name);
+        }
+
         event = n_event_new_from_group (&eventlist->rule_list, keyfile, *group,
                                         eventlist->core->key_types, defines);
         if (event) {
-            event = event_list_add_event (eventlist, event);
-            if (event)
-                g_slist_foreach (event->rules, subscribe_event_rules_cb,
-                                 n_core_get_context (eventlist->core));
+            event_list_add_event (eventlist, event);
             parsed++;
         }
     }
@@ -319,6 +386,140 @@ n_event_list_get_events (NEventList *eventlist)
     return eventlist->event_list;
 }
 
+void
+n_event_list_add_events (NEventList *eventlist, GList *events, GSList *rules)
+{
+    GHashTableIter  iter;
+    gpointer        key        = NULL;
+    gpointer        value      = NULL;
+    GList          *event_list = NULL;
+    GList          *e          = NULL;
+    NEvent         *event      = NULL;
+
+    g_assert (eventlist);
+
+    /* events come fully merged, in the order they were originally added,
+       so they only need to be appended and each name sorted once. */
+
+    eventlist->rule_list = g_slist_concat (eventlist->rule_list, rules);
+
+    for (e = g_list_first (events); e; e = g_list_next (e)) {
+        event = e->data;
+        event_list_intern_values (eventlist, event);
+        event_list = g_hash_table_lookup (eventlist->event_table, event->name);
+        event_list = g_list_prepend (event_list, event);
+        g_hash_table_replace (eventlist->event_table, g_strdup (event->name), event_list);
+    }
+
+    g_hash_table_iter_init (&iter, eventlist->event_table);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        event_list = g_list_reverse ((GList*) value);
+        g_hash_table_iter_replace (&iter, g_list_sort (event_list, sort_event_cb));
+    }
+
+    eventlist->event_list = g_list_concat (eventlist->event_list, events);
+    g_hash_table_remove_all (eventlist->index_table);
+    eventlist->generation++;
+}
+
+GList*
+n_event_list_remove_events (NEventList *eventlist, const char *name)
+{
+    gpointer key        = NULL;
+    gpointer value      = NULL;
+    GList   *event_list = NULL;
+    GList   *iter       = NULL;
+
+    g_assert (eventlist);
+    g_assert (name);
+
+    if (!g_hash_table_lookup_extended (eventlist->event_table, name, &key, &value))
+        return NULL;
+
+    event_list = value;
+    g_hash_table_remove (eventlist->index_table, name);
+    g_hash_table_steal (eventlist->event_table, name);
+    g_free (key);
+    eventlist->generation++;
+
+    for (iter = g_list_first (event_list); iter; iter = g_list_next (iter))
+        eventlist->event_list = g_list_remove (eventlist->event_list, iter->data);
+
+    return event_list;
+}
+
+void
+n_event_list_prune_rules (NEventList *eventlist)
+{
+    GSList *iter = NULL;
+    GSList *next = NULL;
+
+    g_assert (eventlist);
+
+    /* rules only referenced by the rule list are not used by any
+       event anymore. */
+
+    for (iter = eventlist->rule_list; iter; iter = next) {
+        next = g_slist_next (iter);
+        if (((NEventRule*) iter->data)->ref == 1) {
+            n_event_rule_unref (iter->data);
+            eventlist->rule_list = g_slist_delete_link (eventlist->rule_list, iter);
+        }
+    }
+}
+
+void
+n_event_list_prune_values (NEventList *eventlist)
+{
+    g_assert (eventlist);
+
+    n_value_pool_prune (eventlist->values);
+}
+
+static void
+footprint_value_cb (const char *key, const NValue *value, gpointer userdata)
+{
+    (void) key;
+
+    NFootprintData *data   = userdata;
+    gconstpointer   buffer = NULL;
+    gsize           size   = 0;
+    gsize           bytes  = 0;
+
+    bytes = n_value_heap_size (value, &size, &buffer);
+
+    data->footprint->num_values++;
+    data->footprint->bytes          += bytes;
+    data->footprint->unshared_bytes += bytes + size;
+
+    if (buffer && !g_hash_table_contains (data->buffers, buffer)) {
+        g_hash_table_add (data->buffers, (gpointer) buffer);
+        data->footprint->bytes += size;
+    }
+}
+
+void
+n_event_list_get_footprint (NEventList *eventlist, NEventListFootprint *footprint)
+{
+    NFootprintData  data;
+    GList          *iter = NULL;
+
+    g_assert (eventlist);
+    g_assert (footprint);
+
+    memset (footprint, 0, sizeof (NEventListFootprint));
+    data.footprint = footprint;
+    data.buffers   = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    for (iter = g_list_first (eventlist->event_list); iter; iter = g_list_next (iter)) {
+        footprint->num_events++;
+        n_proplist_foreach (((NEvent*) iter->data)->properties, footprint_value_cb, &data);
+    }
+
+    footprint->num_strings = g_hash_table_size (data.buffers);
+    g_hash_table_destroy (data.buffers);
+}
+
 guint
 n_event_list_size (const NEventList *eventlist)
 {
@@ -357,51 +558,15 @@ n_event_list_free (NEventList *eventlist)
 {
     g_assert (eventlist);
 
-    g_slist_foreach (eventlist->rule_list, unsubscribe_event_rules_cb,
-                     n_core_get_context (eventlist->core));
-
     g_slist_free_full    (eventlist->rule_list, event_rule_free_cb);
     g_list_free          (eventlist->event_list);
+    g_hash_table_destroy (eventlist->index_table);
     g_hash_table_foreach (eventlist->event_table, event_list_free_cb, NULL);
     g_hash_table_destroy (eventlist->event_table);
+    n_value_pool_free    (eventlist->values);
     g_free (eventlist);
 }
 
-static void
-cache_rule_context_cb (NContext *context,
-                       const char *key,
-                       const NValue *old_value,
-                       const NValue *new_value,
-                       void *userdata)
-{
-    NEventRule *rule = userdata;
-
-    (void) context;
-
-    g_assert (rule->target == N_EVENT_RULE_CONTEXT);
-
-    if (n_event_rule_cached_value_set (rule, n_event_rule_match (rule, new_value)) &&
-
-        n_log_get_level() <= N_LOG_LEVEL_DEBUG) {
-
-        char *old_value_str;
-        char *new_value_str;
-        char *rule_value_str;
-
-        rule_value_str = n_value_to_string (rule->value);
-        old_value_str = n_value_to_string (old_value);
-        new_value_str = n_value_to_string (new_value);
-
-        N_DEBUG (LOG_CAT "cache " N_EVENT_RULE_CONTEXT_PREFIX "%s(%s): %s -> %s: %s",
-                         key, rule_value_str,
-                         old_value_str, new_value_str,
-                         n_event_rule_cached_value (rule) ? "true" : "false");
-        g_free (rule_value_str);
-        g_free (old_value_str);
-        g_free (new_value_str);
-    }
-}
-
 static void
 match_event_rule_cb (gpointer data, gpointer userdata)
 {
@@ -409,11 +574,15 @@ match_event_rule_cb (gpointer data, gpointer userdata)
     NEventMatchResult *result      = userdata;
     NRequest          *request     = result->request;
     const NValue      *match_value = NULL;
+    guint              generation  = 0;
 
     if (!result->has_match)
         return;
 
-    if (n_event_rule_cached (rule)) {
+    if (rule->target == N_EVENT_RULE_CONTEXT)
+        generation = n_context_get_key_generation (result->context, rule->atom);
+
+    if (n_event_rule_cached (rule, generation)) {
         if (!n_event_rule_cached_value (rule))
             result->has_match = FALSE;
         N_DEBUG (LOG_CAT "-> (cached) " N_EVENT_RULE_CONTEXT_PREFIX "'%s'-> %s",
@@ -423,15 +592,15 @@ match_event_rule_cb (gpointer data, gpointer userdata)
     }
 
     switch (rule->target) {
-        case N_EVENT_RULE_CONTEXT:  match_value = n_context_get_value (result->context, rule->key); break;
-        case N_EVENT_RULE_REQUEST:  match_value = n_proplist_get (request->properties, rule->key);  break;
+        case N_EVENT_RULE_CONTEXT:  match_value = n_context_get_value_by_atom (result->context, rule->atom); break;
+        case N_EVENT_RULE_REQUEST:  match_value = n_proplist_get_by_atom (request->properties, rule->atom);  break;
     };
 
     result->has_match = n_event_rule_match (rule, match_value);
 
-    n_event_rule_cached_value_set (rule, result->has_match);
+    n_event_rule_cached_value_set (rule, result->has_match, generation);
 
-    if (n_log_get_level() <= N_LOG_LEVEL_DEBUG) {
+    if (N_LOG_ENABLED (N_LOG_LEVEL_DEBUG)) {
         gchar      *value_str       = NULL;
         gchar      *match_value_str = NULL;
         const char *op_str          = "";
@@ -451,25 +620,15 @@ match_event_rule_cb (gpointer data, gpointer userdata)
     }
 }
 
-NEvent*
-n_event_list_match_request (NEventList *eventlist, NRequest *request)
+static NEvent*
+event_list_match_linear (NEventList *eventlist, GList *event_list, NRequest *request)
 {
     NEvent *event      = NULL;
     NEvent *found      = NULL;
-    GList  *event_list = NULL;
     GList  *iter       = NULL;
 
     NEventMatchResult result;
 
-    g_assert (eventlist);
-    g_assert (request);
-
-    /* find the list of events that have the same name. */
-
-    event_list = g_hash_table_lookup (eventlist->event_table, request->name);
-    if (!event_list)
-        return NULL;
-
     /* for each event, match the properties. */
 
     for (iter = g_list_first (event_list); iter; iter = g_list_next (iter)) {
@@ -498,28 +657,273 @@ n_event_list_match_request (NEventList *eventlist, NRequest *request)
     return found;
 }
 
-static void
-subscribe_event_rules_cb (gpointer data, gpointer userdata)
+static guint
+index_add_key (GArray *keys, GArray *targets, const NEventRule *rule)
+{
+    guint8 target = rule->target;
+    guint  i;
+
+    for (i = 0; i < keys->len; i++) {
+        if (g_array_index (targets, guint8, i) == target &&
+            g_array_index (keys, NAtom, i) == rule->atom)
+            return i;
+    }
+
+    g_array_append_val (keys, rule->atom);
+    g_array_append_val (targets, target);
+
+    return keys->len - 1;
+}
+
+static NEventIndex*
+event_index_new (GList *event_list)
 {
-    NEventRule *rule    = data;
-    NContext   *context = userdata;
+    NEventIndex *index;
+    GPtrArray   *rules;
+    GArray      *keys;
+    GArray      *targets;
+    GArray      *rule_keys;
+    GArray      *event_rules;
+    GList       *iter;
+    GSList      *r;
+    NEvent      *event;
+    guint        rule_index;
+    guint        key_index;
+    guint        i;
+
+    index             = g_new0 (NEventIndex, 1);
+    index->num_events = g_list_length (event_list);
+    index->events     = g_new0 (NEvent*, index->num_events);
+    index->event_offsets = g_new0 (guint, index->num_events + 1);
+
+    rules       = g_ptr_array_new ();
+    keys        = g_array_new (FALSE, FALSE, sizeof (NAtom));
+    targets     = g_array_new (FALSE, FALSE, sizeof (guint8));
+    rule_keys   = g_array_new (FALSE, FALSE, sizeof (guint));
+    event_rules = g_array_new (FALSE, FALSE, sizeof (guint));
+
+    for (iter = g_list_first (event_list), i = 0; iter; iter = g_list_next (iter), i++) {
+        event = iter->data;
+        index->events[i] = event;
+        index->event_offsets[i] = event_rules->len;
+
+        for (r = event->rules; r; r = g_slist_next (r)) {
+            /* identical rules are the same object across events, so
+               the pointer identifies a distinct key/op/value triplet. */
+            for (rule_index = 0; rule_index < rules->len; rule_index++) {
+                if (g_ptr_array_index (rules, rule_index) == r->data)
+                    break;
+            }
 
-    if (rule->target == N_EVENT_RULE_CONTEXT &&
-        rule->cache == N_EVENT_RULE_CACHE_INACTIVE) {
-        n_context_subscribe_value_change (context, rule->key, cache_rule_context_cb, rule);
-        rule->cache = N_EVENT_RULE_CACHE_UNSET;
+            if (rule_index == rules->len) {
+                g_ptr_array_add (rules, r->data);
+                key_index = index_add_key (keys, targets, r->data);
+                g_array_append_val (rule_keys, key_index);
+                if (((NEventRule*) r->data)->target == N_EVENT_RULE_REQUEST)
+                    index->has_request_rules = TRUE;
+            }
+
+            g_array_append_val (event_rules, rule_index);
+        }
     }
+    index->event_offsets[index->num_events] = event_rules->len;
+
+    index->num_rules   = rules->len;
+    index->rules       = (NEventRule**) g_ptr_array_free (rules, FALSE);
+    index->num_keys    = keys->len;
+    index->keys        = (NAtom*) g_array_free (keys, FALSE);
+    index->key_targets = (guint8*) g_array_free (targets, FALSE);
+
+    index->request_keys = g_new0 (NAtom, index->num_keys + 1);
+    for (i = 0; i < index->num_keys; i++) {
+        if (index->key_targets[i] == N_EVENT_RULE_REQUEST)
+            index->request_keys[index->num_request_keys++] = index->keys[i];
+    }
+
+    index->rule_keys   = (guint*) g_array_free (rule_keys, FALSE);
+    index->event_rules = (guint*) g_array_free (event_rules, FALSE);
+
+    index->rule_state  = g_new0 (guint8, index->num_rules + 1);
+    index->key_state   = g_new0 (guint8, index->num_keys + 1);
+    index->key_values  = g_new0 (const NValue*, index->num_keys + 1);
+
+    N_DEBUG (LOG_CAT "indexed %u events with %u distinct rules over %u keys",
+                     index->num_events, index->num_rules, index->num_keys);
+
+    return index;
 }
 
 static void
-unsubscribe_event_rules_cb (gpointer data, gpointer userdata)
+event_index_free (gpointer data)
+{
+    NEventIndex *index = data;
+
+    g_free (index->events);
+    g_free (index->event_offsets);
+    g_free (index->event_rules);
+    g_free (index->rules);
+    g_free (index->rule_keys);
+    g_free (index->keys);
+    g_free (index->key_targets);
+    g_free (index->request_keys);
+    g_free (index->rule_state);
+    g_free (index->key_state);
+    g_free (index->key_values);
+    g_free (index);
+}
+
+static gboolean
+event_index_match_rule (NEventIndex *index, guint rule_index,
+                        NRequest *request, NContext *context)
+{
+    NEventRule *rule       = index->rules[rule_index];
+    guint       key        = index->rule_keys[rule_index];
+    guint       generation = 0;
+    gboolean    match;
+
+    if (index->rule_state[rule_index] != STATE_UNKNOWN)
+        return index->rule_state[rule_index] == STATE_TRUE;
+
+    /* context rule results stay valid until the key changes. */
+    if (rule->target == N_EVENT_RULE_CONTEXT)
+        generation = n_context_get_key_generation (context, index->keys[key]);
+
+    if (n_event_rule_cached (rule, generation)) {
+        match = n_event_rule_cached_value (rule);
+    } else {
+        /* fetch each distinct key only once per match. */
+        if (!index->key_state[key]) {
+            if (index->key_targets[key] == N_EVENT_RULE_CONTEXT)
+                index->key_values[key] = n_context_get_value_by_atom (context, index->keys[key]);
+            else
+                index->key_values[key] = n_proplist_get_by_atom (request->properties, index->keys[key]);
+            index->key_state[key] = TRUE;
+        }
+
+        match = n_event_rule_match (rule, index->key_values[key]);
+        n_event_rule_cached_value_set (rule, match, generation);
+    }
+
+    N_DEBUG (LOG_CAT "-> %s'%s' rule %u -> %s",
+             rule->target == N_EVENT_RULE_CONTEXT ? N_EVENT_RULE_CONTEXT_PREFIX : "",
+             rule->key, rule_index, match ? "true" : "false");
+
+    index->rule_state[rule_index] = match ? STATE_TRUE : STATE_FALSE;
+
+    return match;
+}
+
+static gboolean
+event_index_result_valid (NEventIndex *index, NContext *context)
+{
+    guint generation = n_context_get_generation (context);
+    guint i;
+
+    if (!index->result_valid)
+        return FALSE;
+
+    if (index->result_generation == generation)
+        return TRUE;
+
+    /* something changed in context, check if it was any of ours. */
+    for (i = 0; i < index->num_keys; i++) {
+        if (n_context_get_key_generation (context, index->keys[i]) > index->result_generation)
+            return FALSE;
+    }
+
+    index->result_generation = generation;
+    return TRUE;
+}
+
+static NEvent*
+event_index_match (NEventIndex *index, NRequest *request, NContext *context)
+{
+    NEvent *found = NULL;
+    guint   i;
+    guint   r;
+
+    /* with context rules only the result depends on nothing but the
+       context, so it can be reused until one of the keys changes. */
+    if (!index->has_request_rules && event_index_result_valid (index, context)) {
+        N_DEBUG (LOG_CAT "-> (cached) event '%s'",
+                 index->result ? index->result->name : "<none>");
+        return index->result;
+    }
+
+    memset (index->rule_state, STATE_UNKNOWN, index->num_rules);
+    memset (index->key_state, 0, index->num_keys);
+
+    for (i = 0; i < index->num_events && !found; i++) {
+        for (r = index->event_offsets[i]; r < index->event_offsets[i + 1]; r++) {
+            if (!event_index_match_rule (index, index->event_rules[r], request, context))
+                break;
+        }
+
+        /* all rules matched, or default event with no rules. */
+        if (r == index->event_offsets[i + 1])
+            found = index->events[i];
+    }
+
+    if (!index->has_request_rules) {
+        index->result            = found;
+        index->result_generation = n_context_get_generation (context);
+        index->result_valid      = TRUE;
+    }
+
+    return found;
+}
+
+NEvent*
+n_event_list_match_request (NEventList *eventlist, NRequest *request)
+{
+    GList       *event_list = NULL;
+    NEventIndex *index      = NULL;
+
+    g_assert (eventlist);
+    g_assert (request);
+
+    /* find the list of events that have the same name. */
+
+    event_list = g_hash_table_lookup (eventlist->event_table, request->name);
+    if (!event_list)
+        return NULL;
+
+    if (eventlist->linear_match)
+        return event_list_match_linear (eventlist, event_list, request);
+
+    index = event_list_get_index (eventlist, request->name, event_list);
+    return event_index_match (index, request, n_core_get_context (eventlist->core));
+}
+
+static NEventIndex*
+event_list_get_index (NEventList *eventlist, const char *name, GList *event_list)
 {
-    NEventRule *rule    = data;
-    NContext   *context = userdata;
+    NEventIndex *index = NULL;
 
-    if (rule->target == N_EVENT_RULE_CONTEXT &&
-        rule->cache != N_EVENT_RULE_CACHE_INACTIVE) {
-        n_context_unsubscribe_value_change (context, rule->key, cache_rule_context_cb);
-        rule->cache = N_EVENT_RULE_CACHE_INACTIVE;
+    if (!(index = g_hash_table_lookup (eventlist->index_table, name))) {
+        index = event_index_new (event_list);
+        g_hash_table_insert (eventlist->index_table, g_strdup (name), index);
     }
+
+    return index;
+}
+
+const NAtom*
+n_event_list_get_request_keys (NEventList *eventlist, const char *name, guint *num_keys)
+{
+    GList       *event_list = NULL;
+    NEventIndex *index      = NULL;
+
+    g_assert (eventlist);
+    g_assert (num_keys);
+
+    *num_keys = 0;
+
+    if (!name || !(event_list = g_hash_table_lookup (eventlist->event_table, name)))
+        return NULL;
+
+    index = event_list_get_index (eventlist, name, event_list);
+    *num_keys = index->num_request_keys;
+
+    return index->request_keys;
 }
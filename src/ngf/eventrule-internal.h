@@ -23,6 +23,7 @@
 #define N_EVENT_RULE_INTERNAL_H
 
 #include <ngf/value.h>
+#include <ngf/proplist.h>
 
 #define N_EVENT_RULE_CONTEXT_PREFIX "context@"
 
@@ -45,31 +46,47 @@ typedef enum _NEventRuleOp
 
 typedef enum _NEventRuleCache
 {
-    N_EVENT_RULE_CACHE_INACTIVE,
     N_EVENT_RULE_CACHE_UNSET,
     N_EVENT_RULE_CACHE_TRUE,
     N_EVENT_RULE_CACHE_FALSE
 } NEventRuleCache;
 
-typedef struct _NEventRule
+typedef struct _NEventRule NEventRule;
+
+/* matcher chosen from the op and value type when the rule is created,
+   match_value is never NULL. */
+typedef gboolean (*NEventRuleMatchFunc) (const NEventRule *rule, const NValue *match_value);
+
+struct _NEventRule
 {
     int                 ref;
     NEventRuleTarget    target;
     char               *key;
+    NAtom               atom;           /* interned key */
     NValue             *value;
     NEventRuleOp        op;
     NEventRuleCache     cache;
-} NEventRule;
+    guint               cache_generation;   /* context key generation of cached value */
+    NEventRuleMatchFunc match;
+    union {
+        const char     *s;              /* points to value's string */
+        gint            i;
+        guint           u;
+        gboolean        b;
+    } match_data;                       /* value unpacked for the matcher */
+};
 
+NEventRule* n_event_rule_new              (NEventRuleTarget target, const char *key,
+                                           NEventRuleOp op, NValue *value);
 NEventRule* n_event_rule_parse            (const char *rule_str);
 NEventRule* n_event_rule_ref              (NEventRule *rule);
 void        n_event_rule_unref            (NEventRule *rule);
 gboolean    n_event_rule_equal            (const NEventRule *a, const NEventRule *b);
 void        n_event_rule_dump             (const NEventRule *rule, const char *debug_prefix);
 gboolean    n_event_rule_match            (const NEventRule *rule, const NValue *match_value);
-gboolean    n_event_rule_cached           (const NEventRule *rule);
+gboolean    n_event_rule_cached           (const NEventRule *rule, guint generation);
 gboolean    n_event_rule_cached_value     (const NEventRule *rule);
-gboolean    n_event_rule_cached_value_set (NEventRule *rule, gboolean value);
+gboolean    n_event_rule_cached_value_set (NEventRule *rule, gboolean value, guint generation);
 const char* n_event_rule_op_string        (const NEventRule *rule);
 
 gboolean    n_parse_number                (const char *str, gint64 *value);
@@ -27,6 +27,9 @@
 
 #define LOG_CAT "event-rule: "
 
+static gboolean event_rule_match_generic (const NEventRule *rule, const NValue *match_value);
+static void     event_rule_set_matcher   (NEventRule *rule);
+
 gboolean
 n_parse_number (const char *str, gint64 *value)
 {
@@ -69,6 +72,29 @@ parse_boolean (const char *str, gboolean *value)
     return FALSE;
 }
 
+NEventRule*
+n_event_rule_new (NEventRuleTarget target, const char *key, NEventRuleOp op,
+                  NValue *value)
+{
+    NEventRule *rule;
+
+    g_assert (key);
+    g_assert (value);
+
+    rule            = g_new0 (NEventRule, 1);
+    rule->ref       = 1;
+    rule->key       = g_strdup (key);
+    rule->atom      = n_atom_intern (key);
+    rule->value     = value;
+    rule->op        = op;
+    rule->target    = target;
+    rule->cache     = N_EVENT_RULE_CACHE_UNSET;
+
+    event_rule_set_matcher (rule);
+
+    return rule;
+}
+
 NEventRule*
 n_event_rule_parse (const char *rule_str)
 {
@@ -163,13 +189,7 @@ n_event_rule_parse (const char *rule_str)
     }
 
 
-    rule            = g_new0 (NEventRule, 1);
-    rule->ref       = 1;
-    rule->key       = g_strdup (key);
-    rule->value     = value;
-    rule->op        = op;
-    rule->target    = target;
-    rule->cache     = N_EVENT_RULE_CACHE_INACTIVE;
+    rule = n_event_rule_new (target, key, op, value);
 
     g_strfreev (items);
 
@@ -221,7 +241,7 @@ n_event_rule_equal (const NEventRule *a, const NEventRule *b)
     g_assert (a);
     g_assert (b);
 
-    return (g_strcmp0 (a->key, b->key) == 0 &&
+    return (a->atom == b->atom              &&
             a->op == b->op                  &&
             n_value_equals (a->value, b->value));
 }
@@ -233,7 +253,7 @@ n_event_rule_dump (const NEventRule *rule, const char *debug_prefix)
 
     g_assert (rule);
 
-    if (n_log_get_level() <= N_LOG_LEVEL_DEBUG) {
+    if (N_LOG_ENABLED (N_LOG_LEVEL_DEBUG)) {
         if (rule->op != N_EVENT_RULE_ALWAYS)
             value_str = n_value_to_string (rule->value);
         N_DEBUG ("%s+ %s'%s' %s '%s'", debug_prefix ? debug_prefix : LOG_CAT,
@@ -251,20 +271,172 @@ n_event_rule_dump (const NEventRule *rule, const char *debug_prefix)
         default:                match = FALSE;                                                          \
     };
 
+/* a request value of "*" matches any rule */
+static inline gboolean
+event_rule_wildcard (const NValue *match_value)
+{
+    const char *str = n_value_get_string (match_value);
+
+    return str && str[0] == '*' && str[1] == '\0';
+}
+
+static gboolean
+event_rule_match_always (const NEventRule *rule, const NValue *match_value)
+{
+    (void) rule;
+    (void) match_value;
+
+    return TRUE;
+}
+
+static inline gboolean
+event_rule_string_equal (const NEventRule *rule, const char *str)
+{
+    const char *rule_str = rule->match_data.s;
+
+    /* most values differ already by their first character */
+    if (str[0] != rule_str[0])
+        return FALSE;
+
+    return str[0] == '\0' || strcmp (str + 1, rule_str + 1) == 0;
+}
+
+static gboolean
+event_rule_match_string_equals (const NEventRule *rule, const NValue *match_value)
+{
+    const char *str = n_value_get_string (match_value);
+
+    if (!str)
+        return FALSE;
+
+    return event_rule_string_equal (rule, str) ||
+           (str[0] == '*' && str[1] == '\0');
+}
+
+static gboolean
+event_rule_match_string_nequals (const NEventRule *rule, const NValue *match_value)
+{
+    const char *str = n_value_get_string (match_value);
+
+    if (!str)
+        return FALSE;
+
+    return !event_rule_string_equal (rule, str) ||
+           (str[0] == '*' && str[1] == '\0');
+}
+
+#define MATCHER(name, value_type, get, field, op)                                       \
+    static gboolean                                                                     \
+    name (const NEventRule *rule, const NValue *match_value)                            \
+    {                                                                                   \
+        if (n_value_type (match_value) != value_type)                                   \
+            return event_rule_wildcard (match_value);                                   \
+        return get (match_value) op rule->match_data.field;                             \
+    }
+
+MATCHER (event_rule_match_int_equals,     N_VALUE_TYPE_INT,  n_value_get_int,  i, ==)
+MATCHER (event_rule_match_int_nequals,    N_VALUE_TYPE_INT,  n_value_get_int,  i, !=)
+MATCHER (event_rule_match_int_greater,    N_VALUE_TYPE_INT,  n_value_get_int,  i, >)
+MATCHER (event_rule_match_int_less,       N_VALUE_TYPE_INT,  n_value_get_int,  i, <)
+MATCHER (event_rule_match_int_greater_eq, N_VALUE_TYPE_INT,  n_value_get_int,  i, >=)
+MATCHER (event_rule_match_int_less_eq,    N_VALUE_TYPE_INT,  n_value_get_int,  i, <=)
+MATCHER (event_rule_match_uint_equals,    N_VALUE_TYPE_UINT, n_value_get_uint, u, ==)
+MATCHER (event_rule_match_uint_nequals,   N_VALUE_TYPE_UINT, n_value_get_uint, u, !=)
+MATCHER (event_rule_match_uint_greater,   N_VALUE_TYPE_UINT, n_value_get_uint, u, >)
+MATCHER (event_rule_match_uint_less,      N_VALUE_TYPE_UINT, n_value_get_uint, u, <)
+MATCHER (event_rule_match_uint_greater_eq, N_VALUE_TYPE_UINT, n_value_get_uint, u, >=)
+MATCHER (event_rule_match_uint_less_eq,   N_VALUE_TYPE_UINT, n_value_get_uint, u, <=)
+MATCHER (event_rule_match_bool_equals,    N_VALUE_TYPE_BOOL, n_value_get_bool, b, ==)
+MATCHER (event_rule_match_bool_nequals,   N_VALUE_TYPE_BOOL, n_value_get_bool, b, !=)
+#undef MATCHER
+
+static const NEventRuleMatchFunc int_matchers[] = {
+    [N_EVENT_RULE_EQUALS]           = event_rule_match_int_equals,
+    [N_EVENT_RULE_NEQUALS]          = event_rule_match_int_nequals,
+    [N_EVENT_RULE_GREATER]          = event_rule_match_int_greater,
+    [N_EVENT_RULE_LESS]             = event_rule_match_int_less,
+    [N_EVENT_RULE_GREATER_OR_EQUAL] = event_rule_match_int_greater_eq,
+    [N_EVENT_RULE_LESS_OR_EQUAL]    = event_rule_match_int_less_eq
+};
+
+static const NEventRuleMatchFunc uint_matchers[] = {
+    [N_EVENT_RULE_EQUALS]           = event_rule_match_uint_equals,
+    [N_EVENT_RULE_NEQUALS]          = event_rule_match_uint_nequals,
+    [N_EVENT_RULE_GREATER]          = event_rule_match_uint_greater,
+    [N_EVENT_RULE_LESS]             = event_rule_match_uint_less,
+    [N_EVENT_RULE_GREATER_OR_EQUAL] = event_rule_match_uint_greater_eq,
+    [N_EVENT_RULE_LESS_OR_EQUAL]    = event_rule_match_uint_less_eq
+};
+
+static void
+event_rule_set_matcher (NEventRule *rule)
+{
+    /* everything about the rule is known here, pick the matcher so that
+       matching against a request is a single call. combinations without
+       a specialized matcher use the generic one. */
+
+    rule->match = event_rule_match_generic;
+
+    if (rule->op == N_EVENT_RULE_ALWAYS) {
+        rule->match = event_rule_match_always;
+        return;
+    }
+
+    switch (n_value_type (rule->value)) {
+        case N_VALUE_TYPE_STRING:
+            rule->match_data.s = n_value_get_string (rule->value);
+            if (rule->op == N_EVENT_RULE_EQUALS)
+                rule->match = event_rule_match_string_equals;
+            else if (rule->op == N_EVENT_RULE_NEQUALS)
+                rule->match = event_rule_match_string_nequals;
+            break;
+
+        case N_VALUE_TYPE_INT:
+            rule->match_data.i = n_value_get_int (rule->value);
+            if ((guint) rule->op < G_N_ELEMENTS (int_matchers))
+                rule->match = int_matchers[rule->op];
+            break;
+
+        case N_VALUE_TYPE_UINT:
+            rule->match_data.u = n_value_get_uint (rule->value);
+            if ((guint) rule->op < G_N_ELEMENTS (uint_matchers))
+                rule->match = uint_matchers[rule->op];
+            break;
+
+        case N_VALUE_TYPE_BOOL:
+            rule->match_data.b = n_value_get_bool (rule->value);
+            if (rule->op == N_EVENT_RULE_EQUALS)
+                rule->match = event_rule_match_bool_equals;
+            else if (rule->op == N_EVENT_RULE_NEQUALS)
+                rule->match = event_rule_match_bool_nequals;
+            break;
+
+        default:
+            break;
+    }
+
+    if (!rule->match)
+        rule->match = event_rule_match_generic;
+}
+
 gboolean
 n_event_rule_match (const NEventRule *rule, const NValue *match_value)
 {
     g_assert (rule);
 
-    gboolean match  = TRUE;
+    if (!match_value)
+        return FALSE;
 
-    if (match_value && rule->op == N_EVENT_RULE_ALWAYS)
-        goto done;
+    return rule->match (rule, match_value);
+}
 
-    if (!match_value) {
-        match = FALSE;
+static gboolean
+event_rule_match_generic (const NEventRule *rule, const NValue *match_value)
+{
+    gboolean match  = TRUE;
+
+    if (rule->op == N_EVENT_RULE_ALWAYS)
         goto done;
-    }
 
     if (g_strcmp0 (n_value_get_string (match_value), "*") == 0)
         goto done;
@@ -307,12 +479,13 @@ done:
 #undef MATCH_VALUES
 
 gboolean
-n_event_rule_cached (const NEventRule *rule)
+n_event_rule_cached (const NEventRule *rule, guint generation)
 {
     g_assert (rule);
 
     return rule->target == N_EVENT_RULE_CONTEXT &&
-           rule->cache > N_EVENT_RULE_CACHE_UNSET;
+           rule->cache != N_EVENT_RULE_CACHE_UNSET &&
+           rule->cache_generation == generation;
 }
 
 gboolean
@@ -324,7 +497,7 @@ n_event_rule_cached_value (const NEventRule *rule)
 }
 
 gboolean
-n_event_rule_cached_value_set (NEventRule *rule, gboolean value)
+n_event_rule_cached_value_set (NEventRule *rule, gboolean value, guint generation)
 {
     gboolean changed = FALSE;
 
@@ -333,6 +506,7 @@ n_event_rule_cached_value_set (NEventRule *rule, gboolean value)
     if (rule->target == N_EVENT_RULE_CONTEXT) {
         changed = (rule->cache == N_EVENT_RULE_CACHE_TRUE) != value;
         rule->cache = value ? N_EVENT_RULE_CACHE_TRUE : N_EVENT_RULE_CACHE_FALSE;
+        rule->cache_generation = generation;
     }
 
     return changed;
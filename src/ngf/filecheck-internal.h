@@ -0,0 +1,39 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+#ifndef N_FILECHECK_INTERNAL_H
+#define N_FILECHECK_INTERNAL_H
+
+#include <ngf/filecheck.h>
+#include <ngf/worker.h>
+#include <ngf/metrics.h>
+
+/* files remembered at most, checks of further files are not cached */
+#define N_FILE_CHECK_MAX_ENTRIES (512)
+
+typedef struct _NFileCheck NFileCheck;
+
+NFileCheck* n_file_check_new    (NWorkers *workers, NMetrics *metrics);
+void        n_file_check_free   (NFileCheck *check);
+NFileState  n_file_check_lookup (NFileCheck *check, const char *path);
+void        n_file_check_forget_invalid (NFileCheck *check);
+
+#endif /* N_FILECHECK_INTERNAL_H */
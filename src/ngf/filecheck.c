@@ -0,0 +1,337 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <glib.h>
+#include <ngf/log.h>
+#include "filecheck-internal.h"
+
+#define LOG_CAT "filecheck: "
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                    IN_CLOSE_WRITE | IN_ATTRIB)
+
+/* The files are opened and the directories watched in the worker
+ * threads, as both may block on the storage. The results and the
+ * watches are kept on the main loop. */
+
+typedef struct _NFileEntry
+{
+    NFileState  state;
+    guint       job_id;             /* check in progress, 0 if none */
+    gboolean    recheck;            /* changed while being checked */
+} NFileEntry;
+
+typedef struct _NFileJob
+{
+    NFileCheck *check;
+    gchar      *path;
+    int         fd;                 /* inotify instance, only read by the job */
+    int         wd;                 /* watch of the directory, -1 if none */
+    NFileState  state;
+} NFileJob;
+
+struct _NFileCheck
+{
+    NWorkers     *workers;
+    GHashTable   *entries;          /* key:path value:NFileEntry */
+    GHashTable   *watches;          /* key:watch descriptor value:directory */
+    int           fd;               /* inotify instance, -1 without */
+    guint         io_id;
+    guint         num_invalid;
+    NMetricGauge *metric_invalid;   /* files known to be invalid */
+};
+
+static void     n_file_check_submit  (NFileCheck *check, const char *path,
+                                      NFileEntry *entry);
+static void     n_file_check_run_cb  (gpointer userdata);
+static void     n_file_check_done_cb (gpointer userdata);
+static void     n_file_check_job_free (gpointer userdata);
+static void     n_file_check_set_state (NFileCheck *check, NFileEntry *entry,
+                                        NFileState state);
+static void     n_file_check_changed (NFileCheck *check, const char *path);
+static gboolean n_file_check_io_cb   (GIOChannel *source, GIOCondition condition,
+                                      gpointer userdata);
+static void     n_file_check_entry_free (gpointer userdata);
+
+static void
+n_file_check_entry_free (gpointer userdata)
+{
+    g_slice_free (NFileEntry, userdata);
+}
+
+static void
+n_file_check_submit (NFileCheck *check, const char *path, NFileEntry *entry)
+{
+    NFileJob *job = NULL;
+
+    job        = g_slice_new0 (NFileJob);
+    job->check = check;
+    job->path  = g_strdup (path);
+    job->fd    = check->fd;
+    job->wd    = -1;
+
+    entry->recheck = FALSE;
+    entry->job_id  = n_workers_submit (check->workers, n_file_check_run_cb,
+        n_file_check_done_cb, job, n_file_check_job_free);
+}
+
+static void
+n_file_check_run_cb (gpointer userdata)
+{
+    NFileJob    *job  = userdata;
+    struct stat  st;
+    gchar       *dir  = NULL;
+    int          fd   = -1;
+
+    /* a sink can only play a regular file it can read, checking the
+       format would take decoding it. the path comes from clients, so
+       only regular files are opened, and without blocking: opening a
+       fifo would hold the worker, and the shutdown waiting for it. */
+
+    job->state = N_FILE_STATE_INVALID;
+
+    if (stat (job->path, &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0 &&
+        (fd = open (job->path, O_RDONLY | O_CLOEXEC | O_NONBLOCK | O_NOCTTY)) >= 0) {
+        /* the path may have been replaced in between */
+        if (fstat (fd, &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0)
+            job->state = N_FILE_STATE_VALID;
+        close (fd);
+    }
+
+    if (job->fd >= 0) {
+        dir = g_path_get_dirname (job->path);
+        job->wd = inotify_add_watch (job->fd, dir, WATCH_MASK);
+        g_free (dir);
+    }
+}
+
+static void
+n_file_check_done_cb (gpointer userdata)
+{
+    NFileJob   *job   = userdata;
+    NFileCheck *check = job->check;
+    NFileEntry *entry = NULL;
+
+    if (job->wd >= 0 && !g_hash_table_contains (check->watches, GINT_TO_POINTER (job->wd)))
+        g_hash_table_insert (check->watches, GINT_TO_POINTER (job->wd),
+            g_path_get_dirname (job->path));
+
+    if (!(entry = g_hash_table_lookup (check->entries, job->path)))
+        return;
+
+    entry->job_id = 0;
+
+    if (entry->recheck) {
+        n_file_check_submit (check, job->path, entry);
+        return;
+    }
+
+    if (job->state == N_FILE_STATE_INVALID && entry->state != N_FILE_STATE_INVALID)
+        N_WARNING (LOG_CAT "file '%s' is missing, unreadable or empty", job->path);
+
+    n_file_check_set_state (check, entry, job->state);
+}
+
+static void
+n_file_check_job_free (gpointer userdata)
+{
+    NFileJob *job = userdata;
+
+    g_free (job->path);
+    g_slice_free (NFileJob, job);
+}
+
+static void
+n_file_check_set_state (NFileCheck *check, NFileEntry *entry, NFileState state)
+{
+    if (entry->state == N_FILE_STATE_INVALID)
+        check->num_invalid--;
+    if (state == N_FILE_STATE_INVALID)
+        check->num_invalid++;
+
+    entry->state = state;
+    n_metric_gauge_set (check->metric_invalid, check->num_invalid);
+}
+
+static void
+n_file_check_changed (NFileCheck *check, const char *path)
+{
+    NFileEntry *entry = NULL;
+
+    if (!(entry = g_hash_table_lookup (check->entries, path)))
+        return;
+
+    N_DEBUG (LOG_CAT "file '%s' changed, checking again", path);
+
+    /* the result of a check in progress may be from before the change. */
+    if (entry->job_id > 0)
+        entry->recheck = TRUE;
+    else
+        n_file_check_submit (check, path, entry);
+}
+
+static gboolean
+n_file_check_io_cb (GIOChannel *source, GIOCondition condition, gpointer userdata)
+{
+    NFileCheck *check = userdata;
+    const struct inotify_event *event = NULL;
+    const char *dir  = NULL;
+    gchar      *path = NULL;
+    ssize_t     len  = 0;
+    char        buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    char       *ptr  = NULL;
+
+    (void) source;
+
+    if (condition & (G_IO_HUP | G_IO_ERR)) {
+        N_WARNING (LOG_CAT "file watch failed, changed files are not checked again");
+        check->io_id = 0;
+        return FALSE;
+    }
+
+    while ((len = read (check->fd, buf, sizeof (buf))) > 0) {
+        for (ptr = buf; ptr < buf + len; ptr += sizeof (struct inotify_event) + event->len) {
+            event = (const struct inotify_event*) ptr;
+
+            if (event->len == 0)
+                continue;
+
+            if (!(dir = g_hash_table_lookup (check->watches, GINT_TO_POINTER (event->wd))))
+                continue;
+
+            path = g_build_filename (dir, event->name, NULL);
+            n_file_check_changed (check, path);
+            g_free (path);
+        }
+    }
+
+    return TRUE;
+}
+
+NFileCheck*
+n_file_check_new (NWorkers *workers, NMetrics *metrics)
+{
+    NFileCheck *check   = NULL;
+    GIOChannel *channel = NULL;
+
+    g_assert (workers != NULL);
+    g_assert (metrics != NULL);
+
+    check = g_new0 (NFileCheck, 1);
+    check->workers = workers;
+    check->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, n_file_check_entry_free);
+    check->watches = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, g_free);
+    check->metric_invalid = n_metrics_add_gauge (metrics, "files.invalid");
+
+    /* without the watches a file is checked once until it is forgotten. */
+    if ((check->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        N_WARNING (LOG_CAT "unable to watch files: %s", g_strerror (errno));
+        return check;
+    }
+
+    channel = g_io_channel_unix_new (check->fd);
+    check->io_id = g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+        n_file_check_io_cb, check);
+    g_io_channel_unref (channel);
+
+    return check;
+}
+
+void
+n_file_check_free (NFileCheck *check)
+{
+    GHashTableIter  iter;
+    NFileEntry     *entry = NULL;
+
+    if (!check)
+        return;
+
+    /* the jobs use the inotify instance, they are done before it is
+       closed. */
+
+    g_hash_table_iter_init (&iter, check->entries);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &entry)) {
+        if (entry->job_id > 0)
+            n_workers_cancel (check->workers, entry->job_id);
+    }
+
+    if (check->io_id > 0)
+        g_source_remove (check->io_id);
+    if (check->fd >= 0)
+        close (check->fd);
+
+    g_hash_table_destroy (check->entries);
+    g_hash_table_destroy (check->watches);
+    g_free (check);
+}
+
+NFileState
+n_file_check_lookup (NFileCheck *check, const char *path)
+{
+    NFileEntry *entry = NULL;
+
+    g_assert (check != NULL);
+
+    if (!path || !g_path_is_absolute (path))
+        return N_FILE_STATE_UNKNOWN;
+
+    if ((entry = g_hash_table_lookup (check->entries, path)))
+        return entry->state;
+
+    if (g_hash_table_size (check->entries) >= N_FILE_CHECK_MAX_ENTRIES)
+        return N_FILE_STATE_UNKNOWN;
+
+    entry = g_slice_new0 (NFileEntry);
+    g_hash_table_insert (check->entries, g_strdup (path), entry);
+    n_file_check_submit (check, path, entry);
+
+    return N_FILE_STATE_UNKNOWN;
+}
+
+/* Drops the files known to be invalid, they are checked again when
+ * looked up. The directory of a missing file may not have existed to
+ * be watched. */
+
+void
+n_file_check_forget_invalid (NFileCheck *check)
+{
+    GHashTableIter  iter;
+    NFileEntry     *entry = NULL;
+
+    g_assert (check != NULL);
+
+    g_hash_table_iter_init (&iter, check->entries);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &entry)) {
+        if (entry->state == N_FILE_STATE_INVALID && entry->job_id == 0) {
+            n_file_check_set_state (check, entry, N_FILE_STATE_UNKNOWN);
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+}
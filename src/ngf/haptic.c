@@ -29,20 +29,55 @@
 #include <ngf/haptic.h>
 #include "core-internal.h"
 #include "haptic-internal.h"
+#include "event-internal.h"
 
 #define LOG_CAT "haptic: "
 
 #define CONTEXT_ALERT_ENABLED   "profile.current.vibrating.alert.enabled"
-#define CONTEXT_VIBRA_LEVEL     "profile.current.touchscreen.vibration.level"
+#define CONTEXT_VIBRA_LEVEL     N_HAPTIC_VIBRA_LEVEL_KEY
 #define CONTEXT_CALL_STATE      "call_state.mode"
 
-struct NHaptic {
-    NCore      *core;
+#define HAPTIC_CLASS_COUNT      (N_HAPTIC_CLASS_EVENT + 1)
+
+/* context values the policy is decided from */
+typedef struct _NHapticState {
     gboolean    call_active;
     int         vibra_level;
     gboolean    alert_enabled;
+    gboolean    class_allowed[HAPTIC_CLASS_COUNT];  /* policy by haptic class */
+} NHapticState;
+
+struct NHaptic {
+    NCore        *core;
+    NHapticState  state;
 };
 
+static NAtom type_atom          = 0;
+static NAtom effect_atom        = 0;
+static NAtom alert_enabled_atom = 0;
+static NAtom vibra_level_atom   = 0;
+static NAtom call_state_atom    = 0;
+
+static void
+state_set_call_state (NHapticState *state, const NValue *value)
+{
+    const char *call_state = n_value_get_string (value);
+
+    state->call_active = call_state && !strcmp (call_state, "active");
+}
+
+/* the policy only changes with the context values, so it is decided
+   here instead of for each request. */
+static void
+update_policy (NHapticState *state)
+{
+    state->class_allowed[N_HAPTIC_CLASS_UNDEFINED] = FALSE;
+    state->class_allowed[N_HAPTIC_CLASS_TOUCH] =
+        !state->call_active && state->vibra_level != 0;
+    state->class_allowed[N_HAPTIC_CLASS_EVENT] =
+        !state->call_active && state->alert_enabled;
+}
+
 static void
 call_state_changed_cb (NContext *context,
                        const char *key,
@@ -50,18 +85,14 @@ call_state_changed_cb (NContext *context,
                        const NValue *new_value,
                        void *userdata)
 {
-    NHaptic    *haptic = userdata;
-    const char *state;
+    NHaptic *haptic = userdata;
 
     (void) context;
     (void) key;
     (void) old_value;
 
-    if ((state = n_value_get_string (new_value)) &&
-        !strcmp (state, "active"))
-        haptic->call_active = TRUE;
-    else
-        haptic->call_active = FALSE;
+    state_set_call_state (&haptic->state, new_value);
+    update_policy (&haptic->state);
 }
 
 static void
@@ -77,7 +108,8 @@ vibra_level_changed_cb (NContext *context,
     (void) key;
     (void) old_value;
 
-    haptic->vibra_level = n_value_get_int (new_value);
+    haptic->state.vibra_level = n_value_get_int (new_value);
+    update_policy (&haptic->state);
 }
 
 static void
@@ -93,7 +125,8 @@ alert_enabled_changed_cb (NContext *context,
     (void) key;
     (void) old_value;
 
-    haptic->alert_enabled = n_value_get_bool (new_value);
+    haptic->state.alert_enabled = n_value_get_bool (new_value);
+    update_policy (&haptic->state);
 }
 
 NHaptic*
@@ -101,30 +134,25 @@ n_haptic_new (NCore *core)
 {
     NHaptic      *haptic;
     NContext     *context;
-    const NValue *alert_enabled;
-    const NValue *vibra_level;
-    const NValue *call_state;
-    const char   *call_state_str;
 
     haptic = g_new0 (NHaptic, 1);
     haptic->core = core;
     context = n_core_get_context (core);
 
+    type_atom          = n_atom_intern (N_HAPTIC_TYPE_KEY);
+    effect_atom        = n_atom_intern (N_HAPTIC_EFFECT_KEY);
+    alert_enabled_atom = n_atom_intern (CONTEXT_ALERT_ENABLED);
+    vibra_level_atom   = n_atom_intern (CONTEXT_VIBRA_LEVEL);
+    call_state_atom    = n_atom_intern (CONTEXT_CALL_STATE);
+
     n_context_subscribe_value_change (context, CONTEXT_CALL_STATE, call_state_changed_cb, haptic);
     n_context_subscribe_value_change (context, CONTEXT_VIBRA_LEVEL, vibra_level_changed_cb, haptic);
     n_context_subscribe_value_change (context, CONTEXT_ALERT_ENABLED, alert_enabled_changed_cb, haptic);
 
-    if ((call_state = n_context_get_value (context, CONTEXT_CALL_STATE))) {
-        if ((call_state_str = n_value_get_string (call_state)) &&
-            !strcmp (call_state_str, "active"))
-            haptic->call_active = TRUE;
-    }
-
-    if ((vibra_level = n_context_get_value (context, CONTEXT_VIBRA_LEVEL)))
-        haptic->vibra_level = n_value_get_int (vibra_level);
-
-    if ((alert_enabled = n_context_get_value (context, CONTEXT_ALERT_ENABLED)))
-        haptic->alert_enabled = n_value_get_bool (alert_enabled);
+    state_set_call_state (&haptic->state, n_context_get_value (context, CONTEXT_CALL_STATE));
+    haptic->state.vibra_level   = n_value_get_int (n_context_get_value (context, CONTEXT_VIBRA_LEVEL));
+    haptic->state.alert_enabled = n_value_get_bool (n_context_get_value (context, CONTEXT_ALERT_ENABLED));
+    update_policy (&haptic->state);
 
     return haptic;
 }
@@ -143,14 +171,12 @@ n_haptic_free (NHaptic *haptic)
     g_free (haptic);
 }
 
-int
-n_haptic_can_handle (NSinkInterface *iface, NRequest *request)
+static int
+haptic_can_handle (const NHapticState *state, NRequest *request)
 {
-    NCore           *core = n_sink_interface_get_core (iface);
-    NHaptic         *haptic = core->haptic;
     const NEvent    *event = n_request_get_event (request);
     const NProplist *props = n_request_get_properties (request);
-    const char      *haptic_type = NULL;
+    const NValue    *haptic_type = NULL;
     const char      *event_name = n_request_get_name (request);
     int              haptic_class;
 
@@ -161,43 +187,71 @@ n_haptic_can_handle (NSinkInterface *iface, NRequest *request)
         return FALSE;
     }
 
-    haptic_type = n_proplist_get_string (props, N_HAPTIC_TYPE_KEY);
+    haptic_type = n_proplist_get_by_atom (props, type_atom);
 
-    if (haptic_type == NULL) {
+    if (haptic_type == NULL || n_value_type ((NValue*) haptic_type) != N_VALUE_TYPE_STRING) {
         N_DEBUG (LOG_CAT "No, haptic type not defined.");
         return FALSE;
     }
 
-    if (haptic->call_active) {
+    /* the class of the event type is resolved already, unless the
+       request has a type of its own. */
+
+    if (haptic_type == n_proplist_get_by_atom (event->properties, type_atom))
+        haptic_class = event->haptic_class;
+    else
+        haptic_class = n_haptic_class_for_type (n_value_get_string ((NValue*) haptic_type));
+
+    if (haptic_class < 0 || haptic_class >= HAPTIC_CLASS_COUNT)
+        haptic_class = N_HAPTIC_CLASS_UNDEFINED;
+
+    if (state->class_allowed[haptic_class])
+        return TRUE;
+
+    if (haptic_class == N_HAPTIC_CLASS_UNDEFINED)
+        N_DEBUG (LOG_CAT "No, unknown haptic type.");
+    else if (state->call_active)
         N_DEBUG (LOG_CAT "No, should not vibrate during call.");
-        return FALSE;
-    }
+    else if (haptic_class == N_HAPTIC_CLASS_TOUCH)
+        N_DEBUG (LOG_CAT "No, touch vibra level at 0.");
+    else
+        N_DEBUG (LOG_CAT "No, vibration disabled in profile.");
 
-    haptic_class = n_haptic_class_for_type (haptic_type);
-
-    switch (haptic_class) {
-        case N_HAPTIC_CLASS_TOUCH:
-            if (haptic->vibra_level == 0) {
-                N_DEBUG (LOG_CAT "No, touch vibra level at 0.");
-                return FALSE;
-            }
-            break;
-
-        case N_HAPTIC_CLASS_EVENT:
-            if (!haptic->alert_enabled) {
-                N_DEBUG (LOG_CAT "No, vibration disabled in profile.");
-                return FALSE;
-            }
-            break;
-
-        case N_HAPTIC_CLASS_UNDEFINED:
-            /* fall through */
-        default:
-            N_DEBUG (LOG_CAT "No, unknown haptic type.");
-            return FALSE;
-    }
+    return FALSE;
+}
+
+int
+n_haptic_can_handle (NSinkInterface *iface, NRequest *request)
+{
+    NCore *core = n_sink_interface_get_core (iface);
+
+    return haptic_can_handle (&core->haptic->state, request);
+}
+
+int
+n_haptic_can_handle_snapshot (NRequest *request, const NContextSnapshot *snapshot)
+{
+    NHapticState state;
+
+    /* the atoms are set up when the core creates the haptic policy */
+    g_assert (call_state_atom != 0);
+
+    memset (&state, 0, sizeof (state));
+    state_set_call_state (&state, n_context_snapshot_get_value_by_atom (snapshot, call_state_atom));
+    state.vibra_level   = n_value_get_int (n_context_snapshot_get_value_by_atom (snapshot, vibra_level_atom));
+    state.alert_enabled = n_value_get_bool (n_context_snapshot_get_value_by_atom (snapshot, alert_enabled_atom));
+    update_policy (&state);
 
-    return TRUE;
+    return haptic_can_handle (&state, request);
+}
+
+void
+n_haptic_add_plan_keys (NSinkInterface *iface)
+{
+    n_sink_interface_add_plan_key (iface, N_HAPTIC_TYPE_KEY, TRUE);
+    n_sink_interface_add_plan_key (iface, N_EVENT_RULE_CONTEXT_PREFIX CONTEXT_CALL_STATE, TRUE);
+    n_sink_interface_add_plan_key (iface, N_EVENT_RULE_CONTEXT_PREFIX CONTEXT_VIBRA_LEVEL, TRUE);
+    n_sink_interface_add_plan_key (iface, N_EVENT_RULE_CONTEXT_PREFIX CONTEXT_ALERT_ENABLED, TRUE);
 }
 
 /* Hard-coded here for now, if more flexible setup is needed
@@ -219,9 +273,16 @@ const char*
 n_haptic_effect_for_request (NRequest *request)
 {
     const NProplist *props;
+    NValue          *value;
 
     g_assert (request);
     props = n_request_get_properties (request);
 
-    return n_proplist_get_string (props, N_HAPTIC_EFFECT_KEY);
+    if (!effect_atom)
+        effect_atom = n_atom_intern (N_HAPTIC_EFFECT_KEY);
+
+    value = n_proplist_get_by_atom (props, effect_atom);
+
+    return (value && n_value_type (value) == N_VALUE_TYPE_STRING) ?
+        n_value_get_string (value) : NULL;
 }
@@ -22,14 +22,11 @@
 #include <ngf/hook.h>
 #include <glib.h>
 #include <string.h>
+#include "allocstats.h"
 
-typedef struct _NHookSlot
-{
-    NHook         *hook;
-    int            priority;
-    NHookCallback  callback;
-    void          *userdata;
-} NHookSlot;
+static void n_hook_slot_free     (NHookSlot *slot);
+static void n_hook_release       (NHook *hook, gpointer data);
+static void n_hook_set_slots     (NHook *hook, NHookSlot **slots, guint num_slots);
 
 static void
 n_hook_slot_free (NHookSlot *slot)
@@ -37,7 +34,30 @@ n_hook_slot_free (NHookSlot *slot)
     if (!slot)
         return;
 
-    g_slice_free (NHookSlot, slot);
+    g_free (slot);
+    N_FREE_COUNT (N_ALLOC_HOOK_SLOT);
+}
+
+/* slots and slot arrays may still be in use by n_hook_fire further up
+   in the stack, release them only after the outermost fire returns.
+   both are allocated with g_new. */
+static void
+n_hook_release (NHook *hook, gpointer data)
+{
+    if (hook->firing > 0)
+        hook->retired = g_slist_prepend (hook->retired, data);
+    else
+        g_free (data);
+}
+
+static void
+n_hook_set_slots (NHook *hook, NHookSlot **slots, guint num_slots)
+{
+    if (hook->slots)
+        n_hook_release (hook, hook->slots);
+
+    hook->slots     = slots;
+    hook->num_slots = num_slots;
 }
 
 void
@@ -46,36 +66,55 @@ n_hook_init (NHook *hook)
     memset (hook, 0, sizeof (NHook));
 }
 
-static int
-n_hook_sort_slot_cb (gconstpointer in_a, gconstpointer in_b)
+void
+n_hook_clear (NHook *hook)
 {
-    NHookSlot *a = (NHookSlot*) in_a;
-    NHookSlot *b = (NHookSlot*) in_b;
-
-    if (a->priority > b->priority)
-        return -1;
-    else if (b->priority > a->priority)
-        return 1;
-    return 0;
+    guint i;
+
+    if (!hook)
+        return;
+
+    g_assert (hook->firing == 0);
+
+    for (i = 0; i < hook->num_slots; i++)
+        n_hook_slot_free (hook->slots[i]);
+
+    g_free (hook->slots);
+    hook->slots     = NULL;
+    hook->num_slots = 0;
 }
 
 int
 n_hook_connect (NHook *hook, int priority, NHookCallback callback,
                 void *userdata)
 {
-    NHookSlot *slot = NULL;
+    NHookSlot  *slot  = NULL;
+    NHookSlot **slots = NULL;
+    guint       pos   = 0;
 
     if (!hook || !callback)
         return FALSE;
 
-    slot = g_slice_new0 (NHookSlot);
-    slot->hook     = hook;
+    slot = g_new0 (NHookSlot, 1);
+    N_ALLOC_COUNT (N_ALLOC_HOOK_SLOT, sizeof (NHookSlot));
     slot->callback = callback;
     slot->userdata = userdata;
     slot->priority = priority;
 
-    hook->slots = g_list_append (hook->slots, slot);
-    hook->slots = g_list_sort (hook->slots, n_hook_sort_slot_cb);
+    /* higher priority first, slots with the same priority are called in
+       the order they were connected. */
+    while (pos < hook->num_slots && hook->slots[pos]->priority >= priority)
+        pos++;
+
+    slots = g_new (NHookSlot*, hook->num_slots + 1);
+    if (pos > 0)
+        memcpy (slots, hook->slots, pos * sizeof (NHookSlot*));
+    slots[pos] = slot;
+    if (pos < hook->num_slots)
+        memcpy (slots + pos + 1, hook->slots + pos,
+                (hook->num_slots - pos) * sizeof (NHookSlot*));
+
+    n_hook_set_slots (hook, slots, hook->num_slots + 1);
 
     return TRUE;
 }
@@ -83,34 +122,99 @@ n_hook_connect (NHook *hook, int priority, NHookCallback callback,
 void
 n_hook_disconnect (NHook *hook, NHookCallback callback, void *userdata)
 {
-    GList *iter = NULL;
+    NHookSlot  *slot  = NULL;
+    NHookSlot **slots = NULL;
+    guint       pos   = 0;
 
     if (!hook || !callback)
         return;
 
-    for (iter = g_list_first (hook->slots); iter; iter = g_list_next (iter)) {
-        NHookSlot *slot = (NHookSlot*) iter->data;
-        if (slot->callback == callback && slot->userdata == userdata) {
-            hook->slots = g_list_remove (hook->slots, slot);
-            n_hook_slot_free (slot);
-            return;
-        }
+    for (pos = 0; pos < hook->num_slots; pos++) {
+        slot = hook->slots[pos];
+        if (slot->callback == callback && slot->userdata == userdata)
+            break;
+    }
+
+    if (pos == hook->num_slots)
+        return;
+
+    if (hook->num_slots > 1) {
+        slots = g_new (NHookSlot*, hook->num_slots - 1);
+        memcpy (slots, hook->slots, pos * sizeof (NHookSlot*));
+        memcpy (slots + pos, hook->slots + pos + 1,
+                (hook->num_slots - pos - 1) * sizeof (NHookSlot*));
     }
+
+    n_hook_set_slots (hook, slots, hook->num_slots - 1);
+
+    slot->removed = TRUE;
+    n_hook_release (hook, slot);
 }
 
 int
 n_hook_fire (NHook *hook, void *data)
 {
-    GList *iter = NULL;
+    NHookSlot **slots     = NULL;
+    NHookSlot  *slot      = NULL;
+    guint       num_slots = 0;
+    guint       i;
+    gint64      start;
+    gint64      elapsed;
 
     if (!hook)
         return FALSE;
 
-    for (iter = g_list_first (hook->slots); iter; iter = g_list_next (iter)) {
-        NHookSlot *slot = (NHookSlot*) iter->data;
+    slots     = hook->slots;
+    num_slots = hook->num_slots;
+
+    hook->firing++;
+
+    for (i = 0; i < num_slots; i++) {
+        slot = slots[i];
+
+        if (slot->removed)
+            continue;
+
+        if (!hook->timing) {
+            slot->callback (hook, data, slot->userdata);
+            continue;
+        }
+
+        start = g_get_monotonic_time ();
         slot->callback (hook, data, slot->userdata);
+        elapsed = g_get_monotonic_time () - start;
+
+        slot->calls++;
+        slot->total_us += elapsed;
+        if (elapsed > slot->max_us)
+            slot->max_us = elapsed;
+    }
+
+    hook->firing--;
+
+    if (hook->firing == 0 && hook->retired) {
+        g_slist_free_full (hook->retired, g_free);
+        hook->retired = NULL;
     }
 
     return TRUE;
 }
 
+void
+n_hook_set_timing (NHook *hook, int enabled)
+{
+    guint i;
+
+    if (!hook)
+        return;
+
+    if (enabled && !hook->timing) {
+        for (i = 0; i < hook->num_slots; i++) {
+            hook->slots[i]->calls    = 0;
+            hook->slots[i]->total_us = 0;
+            hook->slots[i]->max_us   = 0;
+        }
+    }
+
+    hook->timing = enabled ? TRUE : FALSE;
+}
@@ -23,15 +23,70 @@
 #include <stdlib.h>
 #include <syslog.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 
+#include <glib.h>
+
 #include <ngf/log.h>
 
 #define LOG_CAT "log: "
 
-static NLogLevel       _log_level       = N_LOG_LEVEL_ENTER;
-static NLogTarget      _log_target      = N_LOG_TARGET_STDOUT;
-static struct timespec _log_clock_start = { 0, 0 };
+#define LOG_MESSAGE_SIZE (256)
+
+/* messages kept in the ring buffer, and the room for the raw arguments of
+   one message. arguments not fitting are dropped from the dump. */
+#define LOG_BUFFER_RECORDS   (1024)
+#define LOG_BUFFER_ARGS_SIZE (200)
+
+/* messages written per main loop iteration by a scheduled dump. */
+#define LOG_DUMP_BATCH       (64)
+
+typedef enum _NLogArgLength
+{
+    N_LOG_ARG_INT = 0,
+    N_LOG_ARG_CHAR,
+    N_LOG_ARG_SHORT,
+    N_LOG_ARG_LONG,
+    N_LOG_ARG_LLONG,
+    N_LOG_ARG_SIZE,
+    N_LOG_ARG_INTMAX,
+    N_LOG_ARG_PTRDIFF,
+    N_LOG_ARG_LDOUBLE
+} NLogArgLength;
+
+/* one conversion of a format string. */
+typedef struct _NLogSpec
+{
+    const char    *start;       /* the '%' */
+    size_t         len;
+    int            stars;       /* width and precision given as arguments */
+    int            precision;   /* -1 if none, -2 if given as argument */
+    NLogArgLength  length;
+    char           conv;
+} NLogSpec;
+
+typedef struct _NLogRecord
+{
+    volatile gint   seq;        /* index + 1 once complete, 0 while written */
+    NLogLevel       level;
+    const char     *fmt;        /* interned copy of the format */
+    struct timespec stamp;
+    guint16         args_len;
+    guint8          truncated;
+    char            args[LOG_BUFFER_ARGS_SIZE];
+} NLogRecord;
+
+static NLogLevel       _log_level        = N_LOG_LEVEL_ENTER;
+static NLogTarget      _log_target       = N_LOG_TARGET_STDOUT;
+static NLogTarget      _log_dump_target  = N_LOG_TARGET_STDOUT;
+static struct timespec _log_clock_start  = { 0, 0 };
+
+static NLogRecord     *_log_buffer       = NULL;
+static volatile gint   _log_buffer_head  = 0;   /* next record to write */
+static guint           _log_buffer_tail  = 0;   /* next record to dump  */
+static guint           _log_dump_id      = 0;
 
 static int
 n_log_syslog_priority_from_level (NLogLevel category)
@@ -77,6 +132,21 @@ n_log_set_target (NLogTarget target)
     if (target == _log_target)
         return;
 
+    /* the buffer is dumped to the target it replaces. */
+    if (target == N_LOG_TARGET_BUFFER) {
+        if (!_log_buffer)
+            _log_buffer = calloc (LOG_BUFFER_RECORDS, sizeof (NLogRecord));
+        if (!_log_buffer)
+            return;
+        if (_log_target != N_LOG_TARGET_NONE)
+            _log_dump_target = _log_target;
+        _log_target = target;
+        return;
+    }
+
+    if (_log_target == N_LOG_TARGET_BUFFER)
+        (void) n_log_dump (0);
+
     _log_target = target;
     if (target == N_LOG_TARGET_SYSLOG) {
         openlog ("ngfd", 0, LOG_DAEMON);
@@ -121,22 +191,498 @@ n_log_level_to_string (NLogLevel category)
 }
 
 static void
-n_log_get_clock_stamp (char *buffer, size_t len)
+n_log_format_clock_stamp (char *buffer, size_t len, const struct timespec *ts)
 {
     struct timespec res;
-    struct timespec ts;
     long ms = 0;
 
+    res.tv_sec  = ts->tv_sec - _log_clock_start.tv_sec;
+    res.tv_nsec = ts->tv_nsec - _log_clock_start.tv_nsec;
+    if (res.tv_nsec < 0) {
+        res.tv_sec--;
+        res.tv_nsec += 1000000000;
+    }
+    ms = res.tv_nsec / 1000000;
+
+    snprintf (buffer, len, "%lu.%.3lu",  (long) res.tv_sec, ms);
+}
+
+static void
+n_log_get_clock_stamp (char *buffer, size_t len)
+{
+    struct timespec ts;
+
     if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0) {
         snprintf (buffer, len, "no_time");
         return;
     }
 
-    res.tv_sec  = ts.tv_sec - _log_clock_start.tv_sec;
-    res.tv_nsec = ts.tv_nsec - _log_clock_start.tv_nsec;
-    ms = res.tv_nsec / 1000000;
+    n_log_format_clock_stamp (buffer, len, &ts);
+}
 
-    snprintf (buffer, len, "%lu.%.3lu",  (long) res.tv_sec, ms);
+static void
+n_log_write (NLogTarget target, NLogLevel category, const char *clock_stamp,
+             const char *buf)
+{
+    char stamp[256];
+
+    if (target == N_LOG_TARGET_SYSLOG) {
+        syslog (n_log_syslog_priority_from_level (category), "%s", buf);
+    }
+    else if (target == N_LOG_TARGET_STDOUT) {
+        if (!clock_stamp) {
+            n_log_get_clock_stamp (stamp, sizeof (stamp));
+            clock_stamp = stamp;
+        }
+        fprintf (stdout, "[%s] %s: %s\n", clock_stamp, n_log_level_to_string (category), buf);
+    }
+}
+
+/* find the next conversion from fmt, "%%" included. returns FALSE at the
+   end of the format or on a conversion that can't be buffered. */
+static int
+n_log_next_spec (const char *fmt, NLogSpec *spec)
+{
+    const char *p = NULL;
+
+    if (!(p = strchr (fmt, '%')))
+        return FALSE;
+
+    memset (spec, 0, sizeof (*spec));
+    spec->start = p++;
+
+    while (*p && strchr ("#0- +'", *p))
+        p++;
+
+    spec->precision = -1;
+
+    if (*p == '*') {
+        spec->stars++;
+        p++;
+    }
+    else {
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->stars++;
+            spec->precision = -2;
+            p++;
+        }
+        else {
+            spec->precision = 0;
+            for (; *p >= '0' && *p <= '9'; p++)
+                spec->precision = MIN (spec->precision * 10 + (*p - '0'), G_MAXINT / 10);
+        }
+    }
+
+    switch (*p) {
+        case 'h':
+            spec->length = (p[1] == 'h') ? (p++, N_LOG_ARG_CHAR) : N_LOG_ARG_SHORT;
+            p++;
+            break;
+        case 'l':
+            spec->length = (p[1] == 'l') ? (p++, N_LOG_ARG_LLONG) : N_LOG_ARG_LONG;
+            p++;
+            break;
+        case 'q': spec->length = N_LOG_ARG_LLONG;   p++; break;
+        case 'z': spec->length = N_LOG_ARG_SIZE;    p++; break;
+        case 'j': spec->length = N_LOG_ARG_INTMAX;  p++; break;
+        case 't': spec->length = N_LOG_ARG_PTRDIFF; p++; break;
+        case 'L': spec->length = N_LOG_ARG_LDOUBLE; p++; break;
+        default:
+            break;
+    }
+
+    spec->conv = *p;
+    if (!spec->conv || !strchr ("%diouxXcsfFeEgGaAp", spec->conv))
+        return FALSE;
+
+    /* wide characters are not supported. */
+    if ((spec->conv == 'c' || spec->conv == 's') && spec->length != N_LOG_ARG_INT)
+        return FALSE;
+
+    spec->len = (size_t) (p - spec->start) + 1;
+
+    return TRUE;
+}
+
+static int
+n_log_args_put (NLogRecord *record, const void *data, size_t len)
+{
+    if (record->args_len + len > LOG_BUFFER_ARGS_SIZE) {
+        record->truncated = TRUE;
+        return FALSE;
+    }
+
+    memcpy (record->args + record->args_len, data, len);
+    record->args_len += len;
+
+    return TRUE;
+}
+
+/* copy the arguments as they are, only strings are copied by value. */
+static void
+n_log_capture_args (NLogRecord *record, const char *fmt, va_list args)
+{
+    NLogSpec            spec;
+    const char         *s       = NULL;
+    long long           ll      = 0;
+    unsigned long long  ull     = 0;
+    double              d       = 0;
+    long double         ld      = 0;
+    void               *ptr     = NULL;
+    size_t              len     = 0;
+    int                 star    = 0;
+    int                 precision;
+    int                 i;
+
+    while (n_log_next_spec (fmt, &spec)) {
+        fmt = spec.start + spec.len;
+
+        if (spec.conv == '%')
+            continue;
+
+        precision = spec.precision;
+        for (i = 0; i < spec.stars; i++) {
+            star = va_arg (args, int);
+            if (!n_log_args_put (record, &star, sizeof (star)))
+                return;
+            /* the precision is the last one given as argument. */
+            if (spec.precision == -2 && i == spec.stars - 1)
+                precision = star < 0 ? -1 : star;
+        }
+
+        switch (spec.conv) {
+            case 'd': case 'i': case 'c':
+                switch (spec.length) {
+                    case N_LOG_ARG_LONG:    ll = va_arg (args, long);      break;
+                    case N_LOG_ARG_LLONG:   ll = va_arg (args, long long); break;
+                    case N_LOG_ARG_SIZE:    ll = va_arg (args, ssize_t);   break;
+                    case N_LOG_ARG_INTMAX:  ll = va_arg (args, intmax_t);  break;
+                    case N_LOG_ARG_PTRDIFF: ll = va_arg (args, ptrdiff_t); break;
+                    default:                ll = va_arg (args, int);       break;
+                }
+                if (!n_log_args_put (record, &ll, sizeof (ll)))
+                    return;
+                break;
+
+            case 'o': case 'u': case 'x': case 'X':
+                switch (spec.length) {
+                    case N_LOG_ARG_LONG:    ull = va_arg (args, unsigned long);      break;
+                    case N_LOG_ARG_LLONG:   ull = va_arg (args, unsigned long long); break;
+                    case N_LOG_ARG_SIZE:    ull = va_arg (args, size_t);             break;
+                    case N_LOG_ARG_INTMAX:  ull = va_arg (args, uintmax_t);          break;
+                    case N_LOG_ARG_PTRDIFF: ull = va_arg (args, ptrdiff_t);          break;
+                    default:                ull = va_arg (args, unsigned int);       break;
+                }
+                if (!n_log_args_put (record, &ull, sizeof (ull)))
+                    return;
+                break;
+
+            case 's':
+                s   = va_arg (args, const char*);
+                s   = s ? s : "(null)";
+                /* with a precision the string need not be terminated,
+                   only the part printed is copied. */
+                len = (precision >= 0 ? strnlen (s, precision) : strlen (s)) + 1;
+                if (record->args_len + len > LOG_BUFFER_ARGS_SIZE) {
+                    /* keep what fits of the string, but nothing after it. */
+                    len = LOG_BUFFER_ARGS_SIZE - record->args_len;
+                    if (len > 0) {
+                        memcpy (record->args + record->args_len, s, len - 1);
+                        record->args[LOG_BUFFER_ARGS_SIZE - 1] = '\0';
+                        record->args_len = LOG_BUFFER_ARGS_SIZE;
+                    }
+                    record->truncated = TRUE;
+                    return;
+                }
+                (void) n_log_args_put (record, s, len - 1);
+                (void) n_log_args_put (record, "", 1);
+                break;
+
+            case 'p':
+                ptr = va_arg (args, void*);
+                if (!n_log_args_put (record, &ptr, sizeof (ptr)))
+                    return;
+                break;
+
+            default:
+                if (spec.length == N_LOG_ARG_LDOUBLE) {
+                    ld = va_arg (args, long double);
+                    if (!n_log_args_put (record, &ld, sizeof (ld)))
+                        return;
+                }
+                else {
+                    d = va_arg (args, double);
+                    if (!n_log_args_put (record, &d, sizeof (d)))
+                        return;
+                }
+                break;
+        }
+    }
+}
+
+static int
+n_log_args_get (const NLogRecord *record, size_t *offset, void *data, size_t len)
+{
+    if (*offset + len > record->args_len)
+        return FALSE;
+
+    memcpy (data, record->args + *offset, len);
+    *offset += len;
+
+    return TRUE;
+}
+
+/* format a buffered message, the same way n_log_message would have. */
+static void
+n_log_format_record (const NLogRecord *record, char *buf, size_t size)
+{
+    NLogSpec            spec;
+    const char         *fmt     = record->fmt;
+    char                conv[64];
+    size_t              pos     = 0;
+    size_t              offset  = 0;
+    size_t              len     = 0;
+    long long           ll      = 0;
+    unsigned long long  ull     = 0;
+    double              d       = 0;
+    long double         ld      = 0;
+    void               *ptr     = NULL;
+    int                 stars[2] = { 0, 0 };
+    int                 complete = FALSE;
+    int                 i, c;
+
+#define APPEND(...) \
+    do { \
+        c = snprintf (buf + pos, size - pos, __VA_ARGS__); \
+        pos = (c < 0) ? pos : MIN (size - 1, pos + (size_t) c); \
+    } while (0)
+
+    buf[0] = '\0';
+
+    while (pos < size - 1) {
+        if (!n_log_next_spec (fmt, &spec)) {
+            /* the rest is text, or ends with a conversion that was not
+               captured. */
+            if ((complete = !strchr (fmt, '%')))
+                APPEND ("%s", fmt);
+            else
+                APPEND ("%.*s", (int) (strchr (fmt, '%') - fmt), fmt);
+            break;
+        }
+
+        APPEND ("%.*s", (int) (spec.start - fmt), fmt);
+        fmt = spec.start + spec.len;
+
+        if (spec.conv == '%') {
+            APPEND ("%%");
+            continue;
+        }
+
+        for (i = 0; i < spec.stars && i < 2; i++) {
+            if (!n_log_args_get (record, &offset, &stars[i], sizeof (int)))
+                goto out;
+        }
+
+        if (spec.len >= sizeof (conv) || spec.stars > 2)
+            goto out;
+
+        memcpy (conv, spec.start, spec.len);
+        conv[spec.len] = '\0';
+
+#define APPEND_VALUE(value) \
+        do { \
+            if (spec.stars == 2)      APPEND (conv, stars[0], stars[1], value); \
+            else if (spec.stars == 1) APPEND (conv, stars[0], value); \
+            else                      APPEND (conv, value); \
+        } while (0)
+
+        switch (spec.conv) {
+            case 'd': case 'i': case 'c':
+                if (!n_log_args_get (record, &offset, &ll, sizeof (ll)))
+                    goto out;
+                switch (spec.length) {
+                    case N_LOG_ARG_LONG:    APPEND_VALUE ((long) ll);      break;
+                    case N_LOG_ARG_LLONG:   APPEND_VALUE (ll);             break;
+                    case N_LOG_ARG_SIZE:    APPEND_VALUE ((ssize_t) ll);   break;
+                    case N_LOG_ARG_INTMAX:  APPEND_VALUE ((intmax_t) ll);  break;
+                    case N_LOG_ARG_PTRDIFF: APPEND_VALUE ((ptrdiff_t) ll); break;
+                    default:                APPEND_VALUE ((int) ll);       break;
+                }
+                break;
+
+            case 'o': case 'u': case 'x': case 'X':
+                if (!n_log_args_get (record, &offset, &ull, sizeof (ull)))
+                    goto out;
+                switch (spec.length) {
+                    case N_LOG_ARG_LONG:    APPEND_VALUE ((unsigned long) ull); break;
+                    case N_LOG_ARG_LLONG:   APPEND_VALUE (ull);                 break;
+                    case N_LOG_ARG_SIZE:    APPEND_VALUE ((size_t) ull);        break;
+                    case N_LOG_ARG_INTMAX:  APPEND_VALUE ((uintmax_t) ull);     break;
+                    case N_LOG_ARG_PTRDIFF: APPEND_VALUE ((ptrdiff_t) ull);     break;
+                    default:                APPEND_VALUE ((unsigned int) ull);  break;
+                }
+                break;
+
+            case 's':
+                if (offset >= record->args_len)
+                    goto out;
+                len = strnlen (record->args + offset, record->args_len - offset);
+                if (offset + len >= record->args_len) {
+                    /* a truncated string ends the record. */
+                    APPEND ("%.*s", (int) len, record->args + offset);
+                    goto out;
+                }
+                APPEND_VALUE (record->args + offset);
+                offset += len + 1;
+                break;
+
+            case 'p':
+                if (!n_log_args_get (record, &offset, &ptr, sizeof (ptr)))
+                    goto out;
+                APPEND_VALUE (ptr);
+                break;
+
+            default:
+                if (spec.length == N_LOG_ARG_LDOUBLE) {
+                    if (!n_log_args_get (record, &offset, &ld, sizeof (ld)))
+                        goto out;
+                    APPEND_VALUE (ld);
+                }
+                else {
+                    if (!n_log_args_get (record, &offset, &d, sizeof (d)))
+                        goto out;
+                    APPEND_VALUE (d);
+                }
+                break;
+        }
+
+#undef APPEND_VALUE
+    }
+
+out:
+    if (!complete && pos < size - 1)
+        APPEND (" [truncated]");
+
+#undef APPEND
+}
+
+/* store the message without formatting. writers reserve a record with an
+   atomic increment, so messages from other threads are safe to store.
+   the format is interned: it may live in a plugin that is unloaded
+   before the buffer is dumped. */
+static void
+n_log_buffer_message (NLogLevel category, const char *fmt, va_list args)
+{
+    NLogRecord *record = NULL;
+    guint       index;
+
+    index  = (guint) g_atomic_int_add (&_log_buffer_head, 1);
+    record = &_log_buffer[index % LOG_BUFFER_RECORDS];
+
+    g_atomic_int_set (&record->seq, 0);
+
+    record->level     = category;
+    record->fmt       = g_intern_string (fmt);
+    record->args_len  = 0;
+    record->truncated = FALSE;
+    if (clock_gettime (CLOCK_MONOTONIC, &record->stamp) < 0)
+        memset (&record->stamp, 0, sizeof (record->stamp));
+
+    n_log_capture_args (record, fmt, args);
+
+    g_atomic_int_set (&record->seq, (gint) (index + 1));
+}
+
+unsigned int
+n_log_dump (unsigned int max_messages)
+{
+    NLogRecord   record;
+    NLogRecord  *slot        = NULL;
+    char         clock_stamp[256];
+    char         buf[LOG_MESSAGE_SIZE];
+    guint        head;
+    guint        dropped     = 0;
+    unsigned int num_written = 0;
+
+    if (!_log_buffer)
+        return 0;
+
+    head = (guint) g_atomic_int_get (&_log_buffer_head);
+
+    if (head - _log_buffer_tail > LOG_BUFFER_RECORDS) {
+        dropped = head - _log_buffer_tail - LOG_BUFFER_RECORDS;
+        _log_buffer_tail = head - LOG_BUFFER_RECORDS;
+    }
+
+    for (; _log_buffer_tail != head; _log_buffer_tail++) {
+        if (max_messages > 0 && num_written >= max_messages)
+            break;
+
+        slot = &_log_buffer[_log_buffer_tail % LOG_BUFFER_RECORDS];
+
+        /* skip records being written or already overwritten. */
+        if ((guint) g_atomic_int_get (&slot->seq) != _log_buffer_tail + 1) {
+            dropped++;
+            continue;
+        }
+
+        memcpy (&record, slot, sizeof (record));
+
+        if ((guint) g_atomic_int_get (&slot->seq) != _log_buffer_tail + 1) {
+            dropped++;
+            continue;
+        }
+
+        n_log_format_record (&record, buf, sizeof (buf));
+        n_log_format_clock_stamp (clock_stamp, sizeof (clock_stamp), &record.stamp);
+        n_log_write (_log_dump_target, record.level, clock_stamp, buf);
+        num_written++;
+    }
+
+    if (dropped > 0) {
+        snprintf (buf, sizeof (buf), LOG_CAT "%u buffered messages lost", dropped);
+        n_log_write (_log_dump_target, N_LOG_LEVEL_WARNING, NULL, buf);
+    }
+
+    return num_written;
+}
+
+static gboolean
+n_log_dump_cb (gpointer userdata)
+{
+    (void) userdata;
+
+    if (n_log_dump (LOG_DUMP_BATCH) == LOG_DUMP_BATCH && n_log_get_buffered () > 0)
+        return TRUE;
+
+    _log_dump_id = 0;
+
+    return FALSE;
+}
+
+void
+n_log_schedule_dump ()
+{
+    if (!_log_buffer || _log_dump_id > 0)
+        return;
+
+    _log_dump_id = g_idle_add_full (G_PRIORITY_LOW, n_log_dump_cb, NULL, NULL);
+}
+
+unsigned int
+n_log_get_buffered ()
+{
+    if (!_log_buffer)
+        return 0;
+
+    return MIN ((guint) g_atomic_int_get (&_log_buffer_head) - _log_buffer_tail,
+                LOG_BUFFER_RECORDS);
 }
 
 void
@@ -157,8 +703,7 @@ void
 n_log_message (NLogLevel category, const char *function, int line,
                const char *fmt, ...)
 {
-    char clock_stamp[256];
-    char buf[256];
+    char buf[LOG_MESSAGE_SIZE];
 
     (void) function;
     (void) line;
@@ -168,14 +713,15 @@ n_log_message (NLogLevel category, const char *function, int line,
 
     va_list fmt_args;
     va_start (fmt_args, fmt);
-    vsnprintf (buf, 256, fmt, fmt_args);
-    va_end (fmt_args);
 
-    if (_log_target == N_LOG_TARGET_SYSLOG) {
-        syslog (n_log_syslog_priority_from_level (category), "%s", buf);
-    }
-    else if (_log_target == N_LOG_TARGET_STDOUT) {
-        n_log_get_clock_stamp (clock_stamp, 256);
-        fprintf (stdout, "[%s] %s: %s\n", clock_stamp, n_log_level_to_string (category), buf);
+    if (_log_target == N_LOG_TARGET_BUFFER) {
+        n_log_buffer_message (category, fmt, fmt_args);
+        va_end (fmt_args);
+        return;
     }
+
+    vsnprintf (buf, sizeof (buf), fmt, fmt_args);
+    va_end (fmt_args);
+
+    n_log_write (_log_target, category, NULL, buf);
 }
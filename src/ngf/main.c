@@ -33,10 +33,17 @@
 
 #include <ngf/log.h>
 #include "core-internal.h"
+#include "plugin-internal.h"
 
 #define LOG_CAT "core: "
 
-#define EVENT_RELOAD_TIME_LIMIT_US (2 * G_USEC_PER_SEC)
+/* NGFD_BUILTIN_PLUGINS lists the plugins configured with
+ * --with-builtin-plugins as N_BUILTIN_PLUGIN(name) entries. */
+#ifdef NGFD_BUILTIN_PLUGINS
+#define N_BUILTIN_PLUGIN(p_id) N_PLUGIN_BUILTIN_DECLARE (p_id)
+NGFD_BUILTIN_PLUGINS
+#undef N_BUILTIN_PLUGIN
+#endif
 
 typedef struct _AppData
 {
@@ -45,9 +52,9 @@ typedef struct _AppData
     gint       default_loglevel;
     guint      sigusr1_source;
     guint      sigusr2_source;
+    guint      sighup_source;
     guint      sigint_source;
     guint      sigterm_source;
-    gint64     last_event_reload;
     gboolean   use_default_loglevel;
 } AppData;
 
@@ -60,10 +67,11 @@ parse_cmdline (int argc, char **argv, AppData *app)
     static struct option long_opts[] = {
         { "verbose",        no_argument,        0, 'v' },
         { "quiet",          no_argument,        0, 'q' },
+        { "log-buffer",     no_argument,        0, 'b' },
         { 0, 0, 0, 0 }
     };
 
-    while ((opt = getopt_long (argc, argv, "vq", long_opts, &opt_index)) != -1) {
+    while ((opt = getopt_long (argc, argv, "vqb", long_opts, &opt_index)) != -1) {
         switch (opt) {
             case 'v':
                 if (level)
@@ -74,6 +82,11 @@ parse_cmdline (int argc, char **argv, AppData *app)
                 level = N_LOG_LEVEL_NONE;
                 break;
 
+            /* messages are formatted only when dumped with SIGUSR2. */
+            case 'b':
+                n_log_set_target (N_LOG_TARGET_BUFFER);
+                break;
+
             default:
                 break;
         }
@@ -125,17 +138,29 @@ handle_sigusr1 (gpointer userdata)
     return TRUE;
 }
 
-/* Reload all event definitions */
+/* Dump runtime metrics and buffered log messages */
 static gboolean
 handle_sigusr2 (gpointer userdata)
 {
     AppData *app = userdata;
 
-    if (app->last_event_reload + EVENT_RELOAD_TIME_LIMIT_US < g_get_real_time ()) {
-        N_INFO ("daemon: event reload requested.");
-        n_core_reload_events (app->core);
-        app->last_event_reload = g_get_real_time ();
-    }
+    n_metrics_dump (n_core_get_metrics (app->core));
+    n_log_schedule_dump ();
+
+    return TRUE;
+}
+
+/* Reload changed event definitions and plugin parameters */
+static gboolean
+handle_sighup (gpointer userdata)
+{
+    AppData *app = userdata;
+
+    /* only changed event files are parsed again, so reloading is
+       cheap enough to do on every request. */
+    N_INFO ("daemon: reload requested.");
+    n_core_reload_events (app->core);
+    n_core_reload_plugins (app->core);
 
     return TRUE;
 }
@@ -149,6 +174,9 @@ install_signal_handlers (AppData *app)
     app->sigusr2_source = g_unix_signal_add (SIGUSR2,
                                              handle_sigusr2,
                                              app);
+    app->sighup_source  = g_unix_signal_add (SIGHUP,
+                                             handle_sighup,
+                                             app);
     app->sigterm_source = g_unix_signal_add (SIGTERM,
                                              handle_sigterm,
                                              app);
@@ -166,6 +194,9 @@ remove_signal_handlers (AppData *app)
     if (app->sigusr2_source)
         g_source_remove (app->sigusr2_source), app->sigusr2_source = 0;
 
+    if (app->sighup_source)
+        g_source_remove (app->sighup_source), app->sighup_source = 0;
+
     if (app->sigterm_source)
         g_source_remove (app->sigterm_source), app->sigterm_source = 0;
 
@@ -187,6 +218,13 @@ main (int argc, char *argv[])
         return 1;
 
     N_DEBUG ("daemon: Starting.");
+
+#ifdef NGFD_BUILTIN_PLUGINS
+#define N_BUILTIN_PLUGIN(p_id) n_plugin_register_builtin (&n_plugin_builtin_##p_id);
+    NGFD_BUILTIN_PLUGINS
+#undef N_BUILTIN_PLUGIN
+#endif
+
     app.loop = g_main_loop_new (NULL, 0);
     app.core = n_core_new (&argc, argv);
 
@@ -0,0 +1,46 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_MEMORY_INTERNAL_H
+#define N_MEMORY_INTERNAL_H
+
+#include <ngf/memory.h>
+#include <ngf/metrics.h>
+#include <ngf/timer.h>
+
+/* caches are trimmed after this long without requests, ms */
+#define N_MEMORY_DEFAULT_IDLE_TIMEOUT (30000)
+
+/* PSI trigger: 150 ms of stalls for some tasks within one second */
+#define N_MEMORY_DEFAULT_PRESSURE_TRIGGER "some 150000 1000000"
+
+/* PSI windows of unprivileged users are multiples of this, us */
+#define N_MEMORY_UNPRIVILEGED_WINDOW (2000000)
+
+NMemory* n_memory_new              (NMetrics *metrics, NTimers *timers);
+void     n_memory_free             (NMemory *memory);
+void     n_memory_set_budget       (NMemory *memory, gsize budget);
+void     n_memory_set_idle_timeout (NMemory *memory, guint timeout);
+gboolean n_memory_watch_pressure   (NMemory *memory, const char *path, const char *trigger);
+void     n_memory_set_busy         (NMemory *memory, gboolean busy);
+void     n_memory_trim             (NMemory *memory, gsize target);
+gsize    n_memory_get_total        (NMemory *memory);
+
+#endif /* N_MEMORY_INTERNAL_H */
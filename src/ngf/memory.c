@@ -0,0 +1,449 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <ngf/log.h>
+#include "memory-internal.h"
+
+#define LOG_CAT "memory: "
+
+struct _NMemoryCache
+{
+    NMemory         *memory;
+    gchar           *name;
+    gint             priority;
+    NMemoryTrimFunc  trim;
+    gpointer         userdata;
+    gsize            size;
+    NMetricGauge    *gauge;
+};
+
+struct _NMemory
+{
+    NMetrics        *metrics;
+    NTimers         *timers;
+    GList           *caches;            /* NMemoryCache, lowest priority first */
+    gsize            total;
+    gsize            budget;            /* bytes, 0 if unlimited */
+    gboolean         trimming;
+    guint            budget_id;         /* deferred trim to the budget */
+    guint            idle_timeout;      /* ms, 0 if disabled */
+    guint            idle_id;
+    gint             pressure_fd;
+    guint            pressure_id;
+    NMetricGauge    *metric_total;
+    NMetricCounter  *metric_trims;
+    NMetricCounter  *metric_pressure;
+};
+
+static gint     n_memory_cache_cmp      (gconstpointer a, gconstpointer b);
+static void     n_memory_trim_caches    (NMemory *memory, gsize target);
+static void     n_memory_evict_caches   (NMemory *memory, gint priority);
+static gchar*   n_memory_coarse_trigger (const char *trigger);
+static void     n_memory_release        (void);
+static gboolean n_memory_budget_cb      (gpointer userdata);
+static gboolean n_memory_idle_cb        (gpointer userdata);
+static gboolean n_memory_pressure_cb    (gint fd, GIOCondition condition, gpointer userdata);
+static void     n_memory_unwatch        (NMemory *memory);
+
+static gint
+n_memory_cache_cmp (gconstpointer a, gconstpointer b)
+{
+    const NMemoryCache *cache_a = a;
+    const NMemoryCache *cache_b = b;
+
+    return cache_a->priority - cache_b->priority;
+}
+
+static void
+n_memory_trim_caches (NMemory *memory, gsize target)
+{
+    NMemoryCache *cache  = NULL;
+    GList        *iter   = NULL;
+    gsize         excess = 0;
+
+    if (memory->trimming)
+        return;
+
+    memory->trimming = TRUE;
+
+    for (iter = g_list_first (memory->caches); iter && memory->total > target; iter = g_list_next (iter)) {
+        cache = (NMemoryCache*) iter->data;
+
+        if (cache->size == 0 || !cache->trim)
+            continue;
+
+        excess = memory->total - target;
+        N_DEBUG (LOG_CAT "trimming cache '%s' of %" G_GSIZE_FORMAT " bytes",
+            cache->name, cache->size);
+        cache->trim (cache->size > excess ? cache->size - excess : 0, cache->userdata);
+    }
+
+    memory->trimming = FALSE;
+    n_metric_counter_inc (memory->metric_trims);
+}
+
+/* the freed heap stays in the malloc arenas until it is trimmed */
+/* empty the caches below the priority, the lowest first */
+static void
+n_memory_evict_caches (NMemory *memory, gint priority)
+{
+    NMemoryCache *cache = NULL;
+    GList        *iter  = NULL;
+
+    if (memory->trimming)
+        return;
+
+    memory->trimming = TRUE;
+
+    for (iter = g_list_first (memory->caches); iter; iter = g_list_next (iter)) {
+        cache = (NMemoryCache*) iter->data;
+
+        if (cache->priority >= priority)
+            break;
+
+        if (cache->size == 0 || !cache->trim)
+            continue;
+
+        N_DEBUG (LOG_CAT "evicting cache '%s' of %" G_GSIZE_FORMAT " bytes",
+            cache->name, cache->size);
+        cache->trim (0, cache->userdata);
+    }
+
+    memory->trimming = FALSE;
+    n_metric_counter_inc (memory->metric_trims);
+}
+
+static void
+n_memory_release (void)
+{
+#ifdef __GLIBC__
+    (void) malloc_trim (0);
+#endif
+}
+
+static gboolean
+n_memory_budget_cb (gpointer userdata)
+{
+    NMemory *memory = (NMemory*) userdata;
+
+    memory->budget_id = 0;
+
+    if (memory->budget > 0 && memory->total > memory->budget) {
+        N_DEBUG (LOG_CAT "%" G_GSIZE_FORMAT " bytes used, budget is %" G_GSIZE_FORMAT,
+            memory->total, memory->budget);
+        n_memory_trim_caches (memory, memory->budget);
+    }
+
+    return FALSE;
+}
+
+static gboolean
+n_memory_idle_cb (gpointer userdata)
+{
+    NMemory *memory = (NMemory*) userdata;
+
+    memory->idle_id = 0;
+
+    /* only the high priority caches are kept while idle, within the
+       budget if there is one */
+    N_DEBUG (LOG_CAT "idle, releasing memory");
+    n_memory_evict_caches (memory, N_MEMORY_PRIORITY_HIGH);
+    if (memory->budget > 0)
+        n_memory_trim_caches (memory, memory->budget);
+    n_memory_release ();
+
+    return FALSE;
+}
+
+static gboolean
+n_memory_pressure_cb (gint fd, GIOCondition condition, gpointer userdata)
+{
+    NMemory *memory = (NMemory*) userdata;
+
+    (void) fd;
+
+    if (condition & G_IO_ERR) {
+        N_WARNING (LOG_CAT "memory pressure trigger failed, not watching");
+        memory->pressure_id = 0;
+        n_memory_unwatch (memory);
+        return FALSE;
+    }
+
+    N_INFO (LOG_CAT "memory pressure, %" G_GSIZE_FORMAT " bytes cached", memory->total);
+    n_metric_counter_inc (memory->metric_pressure);
+
+    /* keep what fits in half of the budget, the highest priorities first */
+    n_memory_trim (memory, memory->budget / 2);
+
+    return TRUE;
+}
+
+/* Unprivileged users are allowed only windows that are multiples of two
+ * seconds, returns the trigger with the window rounded up and the stall
+ * time scaled along, or NULL if it already is one. */
+static gchar*
+n_memory_coarse_trigger (const char *trigger)
+{
+    gchar   kind[5];
+    guint64 stall  = 0;
+    guint64 window = 0;
+    guint64 coarse = 0;
+
+    if (sscanf (trigger, "%4s %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+                kind, &stall, &window) != 3 || window == 0)
+        return NULL;
+
+    coarse = (window + N_MEMORY_UNPRIVILEGED_WINDOW - 1) /
+        N_MEMORY_UNPRIVILEGED_WINDOW * N_MEMORY_UNPRIVILEGED_WINDOW;
+    if (coarse == window)
+        return NULL;
+
+    return g_strdup_printf ("%s %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+        kind, stall * coarse / window, coarse);
+}
+
+static void
+n_memory_unwatch (NMemory *memory)
+{
+    if (memory->pressure_id > 0) {
+        g_source_remove (memory->pressure_id);
+        memory->pressure_id = 0;
+    }
+
+    if (memory->pressure_fd >= 0) {
+        close (memory->pressure_fd);
+        memory->pressure_fd = -1;
+    }
+}
+
+NMemory*
+n_memory_new (NMetrics *metrics, NTimers *timers)
+{
+    NMemory *memory = NULL;
+
+    memory = g_new0 (NMemory, 1);
+    memory->metrics         = metrics;
+    memory->timers          = timers;
+    memory->idle_timeout    = N_MEMORY_DEFAULT_IDLE_TIMEOUT;
+    memory->pressure_fd     = -1;
+    memory->metric_total    = n_metrics_add_gauge (metrics, "memory.total");
+    memory->metric_trims    = n_metrics_add_counter (metrics, "memory.trims");
+    memory->metric_pressure = n_metrics_add_counter (metrics, "memory.pressure");
+
+    return memory;
+}
+
+void
+n_memory_free (NMemory *memory)
+{
+    NMemoryCache *cache = NULL;
+    GList        *iter  = NULL;
+
+    if (!memory)
+        return;
+
+    n_memory_unwatch (memory);
+
+    if (memory->budget_id > 0)
+        n_timers_remove (memory->timers, memory->budget_id);
+
+    if (memory->idle_id > 0)
+        n_timers_remove (memory->timers, memory->idle_id);
+
+    for (iter = g_list_first (memory->caches); iter; iter = g_list_next (iter)) {
+        cache = (NMemoryCache*) iter->data;
+        N_WARNING (LOG_CAT "cache '%s' was not removed", cache->name);
+        g_free (cache->name);
+        g_slice_free (NMemoryCache, cache);
+    }
+
+    g_list_free (memory->caches);
+    g_free (memory);
+}
+
+void
+n_memory_set_budget (NMemory *memory, gsize budget)
+{
+    g_assert (memory != NULL);
+
+    memory->budget = budget;
+}
+
+void
+n_memory_set_idle_timeout (NMemory *memory, guint timeout)
+{
+    g_assert (memory != NULL);
+
+    memory->idle_timeout = timeout;
+}
+
+gboolean
+n_memory_watch_pressure (NMemory *memory, const char *path, const char *trigger)
+{
+    gchar *coarse = NULL;
+
+    g_assert (memory != NULL);
+    g_assert (path != NULL);
+
+    if (!trigger)
+        trigger = N_MEMORY_DEFAULT_PRESSURE_TRIGGER;
+
+    n_memory_unwatch (memory);
+
+    if ((memory->pressure_fd = open (path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0) {
+        N_WARNING (LOG_CAT "unable to open '%s': %s", path, strerror (errno));
+        goto failed;
+    }
+
+    /* the trigger is registered with the terminating zero */
+    if (write (memory->pressure_fd, trigger, strlen (trigger) + 1) < 0) {
+        if ((errno != EPERM && errno != EINVAL) || !(coarse = n_memory_coarse_trigger (trigger))) {
+            N_WARNING (LOG_CAT "unable to set trigger '%s' to '%s': %s", trigger, path,
+                strerror (errno));
+            goto failed;
+        }
+
+        N_DEBUG (LOG_CAT "trigger '%s' refused, trying '%s'", trigger, coarse);
+        if (write (memory->pressure_fd, coarse, strlen (coarse) + 1) < 0) {
+            N_WARNING (LOG_CAT "unable to set trigger '%s' to '%s': %s", coarse, path,
+                strerror (errno));
+            g_free (coarse);
+            goto failed;
+        }
+
+        trigger = coarse;
+    }
+
+    memory->pressure_id = g_unix_fd_add (memory->pressure_fd, G_IO_PRI | G_IO_ERR,
+        n_memory_pressure_cb, memory);
+
+    N_DEBUG (LOG_CAT "watching memory pressure of '%s' (%s)", path, trigger);
+    g_free (coarse);
+
+    return TRUE;
+
+failed:
+    n_memory_unwatch (memory);
+    return FALSE;
+}
+
+void
+n_memory_set_busy (NMemory *memory, gboolean busy)
+{
+    g_assert (memory != NULL);
+
+    if (busy) {
+        if (memory->idle_id > 0) {
+            n_timers_remove (memory->timers, memory->idle_id);
+            memory->idle_id = 0;
+        }
+        return;
+    }
+
+    if (memory->idle_timeout > 0 && memory->idle_id == 0)
+        memory->idle_id = n_timers_add (memory->timers, memory->idle_timeout,
+            n_memory_idle_cb, memory);
+}
+
+void
+n_memory_trim (NMemory *memory, gsize target)
+{
+    g_assert (memory != NULL);
+
+    n_memory_trim_caches (memory, target);
+    n_memory_release ();
+}
+
+gsize
+n_memory_get_total (NMemory *memory)
+{
+    return memory ? memory->total : 0;
+}
+
+NMemoryCache*
+n_memory_add_cache (NMemory *memory, const char *name, int priority,
+                    NMemoryTrimFunc trim, gpointer userdata)
+{
+    NMemoryCache *cache  = NULL;
+    gchar        *metric = NULL;
+
+    g_assert (memory != NULL);
+    g_assert (name != NULL);
+
+    cache = g_slice_new0 (NMemoryCache);
+    cache->memory   = memory;
+    cache->name     = g_strdup (name);
+    cache->priority = priority;
+    cache->trim     = trim;
+    cache->userdata = userdata;
+
+    metric = g_strdup_printf ("memory.%s", name);
+    cache->gauge = n_metrics_add_gauge (memory->metrics, metric);
+    g_free (metric);
+
+    memory->caches = g_list_insert_sorted (memory->caches, cache, n_memory_cache_cmp);
+
+    return cache;
+}
+
+void
+n_memory_remove_cache (NMemory *memory, NMemoryCache *cache)
+{
+    g_assert (memory != NULL);
+
+    if (!cache)
+        return;
+
+    n_memory_cache_set_size (cache, 0);
+    memory->caches = g_list_remove (memory->caches, cache);
+    g_free (cache->name);
+    g_slice_free (NMemoryCache, cache);
+}
+
+void
+n_memory_cache_set_size (NMemoryCache *cache, gsize size)
+{
+    NMemory *memory = NULL;
+
+    if (!cache)
+        return;
+
+    memory = cache->memory;
+    memory->total = memory->total - cache->size + size;
+    cache->size   = size;
+
+    n_metric_gauge_set (cache->gauge, size);
+    n_metric_gauge_set (memory->metric_total, memory->total);
+
+    if (memory->budget > 0 && memory->total > memory->budget &&
+        !memory->trimming && memory->budget_id == 0)
+        memory->budget_id = n_timers_add (memory->timers, 0, n_memory_budget_cb, memory);
+}
@@ -0,0 +1,501 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <ngf/log.h>
+#include "metrics-internal.h"
+
+#define LOG_CAT "metrics: "
+
+typedef enum _NMetricType
+{
+    N_METRIC_COUNTER,
+    N_METRIC_GAUGE,
+    N_METRIC_HISTOGRAM,
+    N_METRIC_FAMILY,
+    N_METRIC_RANKING
+} NMetricType;
+
+struct _NMetricCounter
+{
+    guint64 value;
+};
+
+struct _NMetricGauge
+{
+    guint64 value;
+    guint64 max;
+};
+
+struct _NMetricHistogram
+{
+    guint64 count;
+    guint64 sum;
+    guint64 max;
+    guint64 buckets[N_METRIC_HISTOGRAM_BUCKETS];
+    guint64 window;             /* values per generation, 0 if not rolling */
+    struct _NMetricHistogram *previous;   /* previous generation */
+};
+
+typedef struct _NMetricLabel
+{
+    gchar          *label;
+    NMetricCounter  counter;
+} NMetricLabel;
+
+struct _NMetricFamily
+{
+    GHashTable     *labels;     /* key:label value:NMetricLabel */
+    GPtrArray      *order;      /* NMetricLabel, in order of appearance */
+    NMetricCounter  other;      /* labels beyond N_METRIC_FAMILY_MAX_LABELS */
+};
+
+typedef struct _NMetricRankingEntry
+{
+    gchar           label[N_METRIC_RANKING_LABEL_MAX];
+    guint64         value;
+} NMetricRankingEntry;
+
+struct _NMetricRanking
+{
+    NMetricRankingEntry entries[N_METRIC_RANKING_SIZE];  /* largest value first */
+    guint               num_entries;
+};
+
+typedef struct _NMetric
+{
+    NMetricType  type;
+    gchar       *name;
+    union {
+        NMetricCounter   counter;
+        NMetricGauge     gauge;
+        NMetricHistogram histogram;
+        NMetricFamily    family;
+        NMetricRanking   ranking;
+    } u;
+} NMetric;
+
+struct _NMetrics
+{
+    GPtrArray  *metrics;        /* NMetric, in order of registration */
+    GHashTable *names;          /* key:name value:NMetric */
+};
+
+static void     n_metric_free       (NMetric *metric);
+static void     n_metric_label_free (gpointer data);
+static NMetric* n_metrics_add       (NMetrics *metrics, const char *name,
+                                     NMetricType type);
+static void     n_metrics_report    (GString *name, gsize prefix_len,
+                                     const char *suffix, guint64 value,
+                                     NMetricsFunc func, void *userdata);
+static void     n_metrics_dump_cb   (const char *name, guint64 value,
+                                     void *userdata);
+
+static void
+n_metric_free (NMetric *metric)
+{
+    if (metric->type == N_METRIC_HISTOGRAM)
+        g_free (metric->u.histogram.previous);
+
+    if (metric->type == N_METRIC_FAMILY) {
+        g_hash_table_destroy (metric->u.family.labels);
+        g_ptr_array_free (metric->u.family.order, TRUE);
+    }
+
+    g_free (metric->name);
+    g_free (metric);
+}
+
+static void
+n_metric_label_free (gpointer data)
+{
+    NMetricLabel *label = (NMetricLabel*) data;
+
+    g_free (label->label);
+    g_free (label);
+}
+
+NMetrics*
+n_metrics_new ()
+{
+    NMetrics *metrics = NULL;
+
+    metrics = g_new0 (NMetrics, 1);
+    metrics->metrics = g_ptr_array_new_with_free_func ((GDestroyNotify) n_metric_free);
+    metrics->names = g_hash_table_new (g_str_hash, g_str_equal);
+
+    return metrics;
+}
+
+void
+n_metrics_free (NMetrics *metrics)
+{
+    if (!metrics)
+        return;
+
+    g_hash_table_destroy (metrics->names);
+    g_ptr_array_free (metrics->metrics, TRUE);
+    g_free (metrics);
+}
+
+static NMetric*
+n_metrics_add (NMetrics *metrics, const char *name, NMetricType type)
+{
+    NMetric *metric = NULL;
+
+    if (!metrics || !name)
+        return NULL;
+
+    if ((metric = g_hash_table_lookup (metrics->names, name))) {
+        if (metric->type != type) {
+            N_WARNING (LOG_CAT "metric '%s' already registered with another type",
+                name);
+            return NULL;
+        }
+        return metric;
+    }
+
+    metric = g_new0 (NMetric, 1);
+    metric->type = type;
+    metric->name = g_strdup (name);
+
+    if (type == N_METRIC_FAMILY) {
+        metric->u.family.labels = g_hash_table_new (g_str_hash, g_str_equal);
+        metric->u.family.order = g_ptr_array_new_with_free_func (n_metric_label_free);
+    }
+
+    g_ptr_array_add (metrics->metrics, metric);
+    g_hash_table_insert (metrics->names, metric->name, metric);
+
+    return metric;
+}
+
+NMetricCounter*
+n_metrics_add_counter (NMetrics *metrics, const char *name)
+{
+    NMetric *metric = n_metrics_add (metrics, name, N_METRIC_COUNTER);
+    return metric ? &metric->u.counter : NULL;
+}
+
+NMetricGauge*
+n_metrics_add_gauge (NMetrics *metrics, const char *name)
+{
+    NMetric *metric = n_metrics_add (metrics, name, N_METRIC_GAUGE);
+    return metric ? &metric->u.gauge : NULL;
+}
+
+NMetricHistogram*
+n_metrics_add_histogram (NMetrics *metrics, const char *name)
+{
+    NMetric *metric = n_metrics_add (metrics, name, N_METRIC_HISTOGRAM);
+    return metric ? &metric->u.histogram : NULL;
+}
+
+NMetricHistogram*
+n_metrics_add_rolling_histogram (NMetrics *metrics, const char *name,
+                                 guint window)
+{
+    NMetric *metric = n_metrics_add (metrics, name, N_METRIC_HISTOGRAM);
+
+    if (!metric)
+        return NULL;
+
+    if (window > 0 && !metric->u.histogram.previous) {
+        metric->u.histogram.window = window;
+        metric->u.histogram.previous = g_new0 (NMetricHistogram, 1);
+    }
+
+    return &metric->u.histogram;
+}
+
+NMetricFamily*
+n_metrics_add_family (NMetrics *metrics, const char *name)
+{
+    NMetric *metric = n_metrics_add (metrics, name, N_METRIC_FAMILY);
+    return metric ? &metric->u.family : NULL;
+}
+
+NMetricRanking*
+n_metrics_add_ranking (NMetrics *metrics, const char *name)
+{
+    NMetric *metric = n_metrics_add (metrics, name, N_METRIC_RANKING);
+    return metric ? &metric->u.ranking : NULL;
+}
+
+void
+n_metric_counter_inc (NMetricCounter *counter)
+{
+    if (counter)
+        counter->value++;
+}
+
+void
+n_metric_counter_add (NMetricCounter *counter, guint64 value)
+{
+    if (counter)
+        counter->value += value;
+}
+
+void
+n_metric_gauge_set (NMetricGauge *gauge, guint64 value)
+{
+    if (!gauge)
+        return;
+
+    gauge->value = value;
+    if (value > gauge->max)
+        gauge->max = value;
+}
+
+void
+n_metric_histogram_add (NMetricHistogram *histogram, gint64 value)
+{
+    guint bucket;
+
+    if (!histogram)
+        return;
+
+    if (histogram->window > 0 && histogram->count >= histogram->window) {
+        /* start a new generation, the previous one is still reported */
+        histogram->previous->count = histogram->count;
+        histogram->previous->sum = histogram->sum;
+        histogram->previous->max = histogram->max;
+        memcpy (histogram->previous->buckets, histogram->buckets,
+                sizeof (histogram->buckets));
+
+        histogram->count = 0;
+        histogram->sum = 0;
+        histogram->max = 0;
+        memset (histogram->buckets, 0, sizeof (histogram->buckets));
+    }
+
+    if (value <= 0)
+        bucket = 0;
+    else if (value >= (G_GINT64_CONSTANT (1) << (N_METRIC_HISTOGRAM_BUCKETS - 2)))
+        bucket = N_METRIC_HISTOGRAM_BUCKETS - 1;
+    else
+        bucket = g_bit_storage ((gulong) value);
+
+    histogram->buckets[bucket]++;
+    histogram->count++;
+
+    if (value > 0) {
+        histogram->sum += value;
+        if ((guint64) value > histogram->max)
+            histogram->max = value;
+    }
+}
+
+void
+n_metric_family_inc (NMetricFamily *family, const char *label)
+{
+    NMetricLabel *entry = NULL;
+
+    if (!family)
+        return;
+
+    if (!label) {
+        family->other.value++;
+        return;
+    }
+
+    if (!(entry = g_hash_table_lookup (family->labels, label))) {
+        if (family->order->len >= N_METRIC_FAMILY_MAX_LABELS) {
+            family->other.value++;
+            return;
+        }
+
+        entry = g_new0 (NMetricLabel, 1);
+        entry->label = g_strdup (label);
+        g_ptr_array_add (family->order, entry);
+        g_hash_table_insert (family->labels, entry->label, entry);
+    }
+
+    entry->counter.value++;
+}
+
+void
+n_metric_ranking_record (NMetricRanking *ranking, const char *label,
+                         guint64 value)
+{
+    NMetricRankingEntry  entry;
+    gsize                len;
+    guint                i;
+
+    if (!ranking || !label)
+        return;
+
+    len = strlen (label);
+    if (len >= N_METRIC_RANKING_LABEL_MAX)
+        label += len - (N_METRIC_RANKING_LABEL_MAX - 1);
+
+    for (i = 0; i < ranking->num_entries; i++) {
+        if (strcmp (ranking->entries[i].label, label) == 0)
+            break;
+    }
+
+    if (i < ranking->num_entries) {
+        if (value <= ranking->entries[i].value)
+            return;
+    }
+    else if (ranking->num_entries < N_METRIC_RANKING_SIZE) {
+        i = ranking->num_entries++;
+        g_strlcpy (ranking->entries[i].label, label, N_METRIC_RANKING_LABEL_MAX);
+    }
+    else {
+        i = ranking->num_entries - 1;
+        if (value <= ranking->entries[i].value)
+            return;
+        g_strlcpy (ranking->entries[i].label, label, N_METRIC_RANKING_LABEL_MAX);
+    }
+
+    ranking->entries[i].value = value;
+
+    /* keep the entries ordered, the updated entry can only move up */
+    while (i > 0 && ranking->entries[i - 1].value < ranking->entries[i].value) {
+        entry = ranking->entries[i - 1];
+        ranking->entries[i - 1] = ranking->entries[i];
+        ranking->entries[i] = entry;
+        i--;
+    }
+}
+
+static void
+n_metrics_report (GString *name, gsize prefix_len, const char *suffix,
+                  guint64 value, NMetricsFunc func, void *userdata)
+{
+    g_string_truncate (name, prefix_len);
+    if (suffix) {
+        g_string_append_c (name, '.');
+        g_string_append (name, suffix);
+    }
+
+    func (name->str, value, userdata);
+}
+
+void
+n_metrics_foreach (NMetrics *metrics, NMetricsFunc func, void *userdata)
+{
+    NMetric          *metric    = NULL;
+    NMetricHistogram *histogram = NULL;
+    NMetricHistogram  total;
+    NMetricLabel     *label     = NULL;
+    GString          *name      = NULL;
+    gchar             suffix[32];
+    gsize             len;
+    guint             i, j;
+
+    if (!metrics || !func)
+        return;
+
+    name = g_string_new (NULL);
+
+    for (i = 0; i < metrics->metrics->len; i++) {
+        metric = g_ptr_array_index (metrics->metrics, i);
+        g_string_assign (name, metric->name);
+        len = name->len;
+
+        switch (metric->type) {
+            case N_METRIC_COUNTER:
+                n_metrics_report (name, len, NULL, metric->u.counter.value,
+                                  func, userdata);
+                break;
+
+            case N_METRIC_GAUGE:
+                n_metrics_report (name, len, NULL, metric->u.gauge.value,
+                                  func, userdata);
+                n_metrics_report (name, len, "max", metric->u.gauge.max,
+                                  func, userdata);
+                break;
+
+            case N_METRIC_HISTOGRAM:
+                histogram = &metric->u.histogram;
+                if (histogram->previous) {
+                    total = *histogram;
+                    total.count += histogram->previous->count;
+                    total.sum += histogram->previous->sum;
+                    total.max = MAX (total.max, histogram->previous->max);
+                    for (j = 0; j < N_METRIC_HISTOGRAM_BUCKETS; j++)
+                        total.buckets[j] += histogram->previous->buckets[j];
+                    histogram = &total;
+                }
+
+                n_metrics_report (name, len, "count", histogram->count, func, userdata);
+                n_metrics_report (name, len, "sum", histogram->sum, func, userdata);
+                n_metrics_report (name, len, "max", histogram->max, func, userdata);
+
+                for (j = 0; j < N_METRIC_HISTOGRAM_BUCKETS; j++) {
+                    if (histogram->buckets[j] == 0)
+                        continue;
+
+                    if (j == 0)
+                        g_strlcpy (suffix, "le_0", sizeof (suffix));
+                    else if (j == N_METRIC_HISTOGRAM_BUCKETS - 1)
+                        g_strlcpy (suffix, "inf", sizeof (suffix));
+                    else
+                        g_snprintf (suffix, sizeof (suffix), "lt_%" G_GUINT64_FORMAT,
+                                    G_GUINT64_CONSTANT (1) << j);
+
+                    n_metrics_report (name, len, suffix, histogram->buckets[j],
+                                      func, userdata);
+                }
+                break;
+
+            case N_METRIC_FAMILY:
+                for (j = 0; j < metric->u.family.order->len; j++) {
+                    label = g_ptr_array_index (metric->u.family.order, j);
+                    n_metrics_report (name, len, label->label, label->counter.value,
+                                      func, userdata);
+                }
+                if (metric->u.family.other.value > 0)
+                    n_metrics_report (name, len, N_METRIC_FAMILY_OTHER,
+                                      metric->u.family.other.value, func, userdata);
+                break;
+
+            case N_METRIC_RANKING:
+                for (j = 0; j < metric->u.ranking.num_entries; j++)
+                    n_metrics_report (name, len, metric->u.ranking.entries[j].label,
+                                      metric->u.ranking.entries[j].value, func, userdata);
+                break;
+        }
+    }
+
+    g_string_free (name, TRUE);
+}
+
+static void
+n_metrics_dump_cb (const char *name, guint64 value, void *userdata)
+{
+    (void) userdata;
+
+    N_INFO (LOG_CAT "%s = %" G_GUINT64_FORMAT, name, value);
+}
+
+void
+n_metrics_dump (NMetrics *metrics)
+{
+    if (!metrics)
+        return;
+
+    N_INFO (LOG_CAT "==== METRICS ====");
+    n_metrics_foreach (metrics, n_metrics_dump_cb, NULL);
+    N_INFO (LOG_CAT "=================");
+}
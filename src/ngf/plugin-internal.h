@@ -37,16 +37,56 @@ struct _NPlugin
     GModule     *module;            /* plugin module handle */
     gpointer     userdata;          /* plugin implementor internal data */
     NProplist   *params;            /* plugin parameters */
+    gboolean     required;          /* failing to initialize fails the startup */
+    gint64       open_us;           /* time spent opening the module, in us */
+    gint64       init_us;           /* time spent in the load function, in us */
 
     const char* (*get_name)    ();
     const char* (*get_desc)    ();
     const char* (*get_version) ();
     int         (*load)        (NPlugin *plugin);
     void        (*unload)      (NPlugin *plugin);
+    int         (*reload)      (NPlugin *plugin, const NProplist *params); /* optional */
 };
 
-NPlugin* n_plugin_open   (const char *plugin_name);
-int      n_plugin_init   (NPlugin *plugin);
-void     n_plugin_unload (NPlugin *plugin);
+/* entry points of a plugin linked into ngfd, see N_PLUGIN_BUILTIN */
+typedef struct _NPluginBuiltin
+{
+    const char  *name;              /* name the plugin is configured with */
+    const char* (*get_name)    ();
+    const char* (*get_desc)    ();
+    const char* (*get_version) ();
+    int         (*load)        (NPlugin *plugin);
+    void        (*unload)      (NPlugin *plugin);
+    int         (*reload)      (NPlugin *plugin, const NProplist *params); /* optional */
+} NPluginBuiltin;
+
+/* Declares the NPluginBuiltin n_plugin_builtin_<p_id> of a plugin
+ * compiled with -DN_PLUGIN_BUILTIN=<p_id>. The reload function is
+ * referenced weakly, as the plugin may not define it. */
+#define N_PLUGIN_BUILTIN_DECLARE(p_id)                                              \
+    extern const char* n_plugin_##p_id##__get_name ();                             \
+    extern const char* n_plugin_##p_id##__get_desc ();                             \
+    extern const char* n_plugin_##p_id##__get_version ();                          \
+    extern int  n_plugin_##p_id##__load (NPlugin *plugin);                         \
+    extern void n_plugin_##p_id##__unload (NPlugin *plugin);                       \
+    extern int  n_plugin_##p_id##__reload (NPlugin *plugin,                        \
+                                          const NProplist *params)                 \
+                                          __attribute__ ((weak));                  \
+    static const NPluginBuiltin n_plugin_builtin_##p_id = {                        \
+        #p_id,                                                                      \
+        n_plugin_##p_id##__get_name,                                               \
+        n_plugin_##p_id##__get_desc,                                               \
+        n_plugin_##p_id##__get_version,                                            \
+        n_plugin_##p_id##__load,                                                   \
+        n_plugin_##p_id##__unload,                                                 \
+        n_plugin_##p_id##__reload                                                  \
+    };
+
+NPlugin* n_plugin_open             (const char *plugin_name);
+NPlugin* n_plugin_open_builtin     (const char *name);
+void     n_plugin_register_builtin (const NPluginBuiltin *builtin);
+int      n_plugin_init             (NPlugin *plugin);
+void     n_plugin_unload           (NPlugin *plugin);
 
 #endif /* N_PLUGIN_INTERNAL_H */
@@ -25,6 +25,9 @@
 
 #define LOG_CAT "plugin: "
 
+/* plugins linked into the binary, looked up before the plugin path */
+static GSList *builtin_plugins = NULL;
+
 NPlugin*
 n_plugin_open (const char *filename)
 {
@@ -55,6 +58,10 @@ n_plugin_open (const char *filename)
 
 #undef LOAD_SYMBOL
 
+    /* applying changed parameters at runtime is optional. */
+    if (!g_module_symbol (plugin->module, "n_plugin__reload", (gpointer*) &plugin->reload))
+        plugin->reload = NULL;
+
     return plugin;
 
 fail_load:
@@ -62,6 +69,47 @@ fail_load:
     return NULL;
 }
 
+void
+n_plugin_register_builtin (const NPluginBuiltin *builtin)
+{
+    g_assert (builtin != NULL);
+    g_assert (builtin->name != NULL);
+
+    builtin_plugins = g_slist_prepend (builtin_plugins, (gpointer) builtin);
+}
+
+/* Same as n_plugin_open for a built-in plugin, without a module. Returns
+ * NULL if no plugin of the name has been registered. */
+
+NPlugin*
+n_plugin_open_builtin (const char *name)
+{
+    const NPluginBuiltin *builtin = NULL;
+    NPlugin              *plugin  = NULL;
+    GSList               *iter    = NULL;
+
+    g_assert (name != NULL);
+
+    for (iter = builtin_plugins; iter; iter = g_slist_next (iter)) {
+        builtin = (const NPluginBuiltin*) iter->data;
+        if (g_str_equal (builtin->name, name))
+            break;
+    }
+
+    if (!iter)
+        return NULL;
+
+    plugin = g_new0 (NPlugin, 1);
+    plugin->get_name    = builtin->get_name;
+    plugin->get_desc    = builtin->get_desc;
+    plugin->get_version = builtin->get_version;
+    plugin->load        = builtin->load;
+    plugin->unload      = builtin->unload;
+    plugin->reload      = builtin->reload;
+
+    return plugin;
+}
+
 int
 n_plugin_init (NPlugin *plugin)
 {
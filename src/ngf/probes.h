@@ -0,0 +1,40 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_PROBES_H
+#define N_PROBES_H
+
+/* static tracepoints in the request lifecycle, for perf, bpftrace or
+   systemtap. they are built only with --enable-probes, and cost a nop
+   when not traced. list them with e.g. "perf list sdt_ngfd:*". */
+
+#ifdef ENABLE_PROBES
+#include <sys/sdt.h>
+
+#define N_PROBE1(name, a)          DTRACE_PROBE1 (ngfd, name, a)
+#define N_PROBE2(name, a, b)       DTRACE_PROBE2 (ngfd, name, a, b)
+#define N_PROBE3(name, a, b, c)    DTRACE_PROBE3 (ngfd, name, a, b, c)
+#else
+#define N_PROBE1(name, a)          do { } while (0)
+#define N_PROBE2(name, a, b)       do { } while (0)
+#define N_PROBE3(name, a, b, c)    do { } while (0)
+#endif
+
+#endif /* N_PROBES_H */
@@ -19,17 +19,75 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+#include <string.h>
 #include <ngf/log.h>
 #include <ngf/proplist.h>
+#include "allocstats.h"
 
 #define LOG_CAT "proplist: "
 
+/* keys are stored as atoms, see n_atom_intern () */
+#define ATOM_TO_KEY(atom) GUINT_TO_POINTER (atom)
+#define KEY_TO_ATOM(key)  ((NAtom) GPOINTER_TO_UINT (key))
+
+/* proplists up to this many entries are kept in a flat array and
+   searched linearly, larger ones are converted to a hash table. */
+#define PROPLIST_FLAT_MAX   (32)
+#define PROPLIST_FLAT_MIN   (8)
+
+/* allocations of a hash table are not visible, so they are counted as
+   the table with its first 8 buckets, and the key, value and hash of
+   every entry added. */
+#define PROPLIST_TABLE_ENTRY_SIZE (2 * sizeof (gpointer) + sizeof (guint))
+#define PROPLIST_TABLE_SIZE       (96 + 8 * PROPLIST_TABLE_ENTRY_SIZE)
+
+typedef struct _NProplistEntry
+{
+    NAtom   atom;
+    NValue *value;
+} NProplistEntry;
+
+/* entry storage, shared between proplists and copied on write. */
+typedef struct _NProplistData
+{
+    int             ref;
+    guint           num_entries;
+    guint           max_entries;
+    NProplistEntry *entries;    /* flat storage, NULL when hashed */
+    GHashTable     *values;     /* key:NAtom value:NValue, NULL when flat */
+} NProplistData;
+
+typedef void (*NProplistAtomFunc) (NAtom atom, NValue *value, gpointer userdata);
+
+/* a proplist is its own entries layered on top of an optional read-only
+   base, e.g. request properties on top of the event properties. keys
+   in data shadow the same keys in base. */
 struct _NProplist {
-    GHashTable *values;
+    NProplistData *data;
+    NProplistData *base;
 };
 
-static void    n_proplist_free_value    (gpointer data);
-static void    n_proplist_replace_value (gpointer key, gpointer value, gpointer userdata);
+static void           n_proplist_free_value    (gpointer data);
+static void           n_proplist_replace_value (NAtom atom, NValue *value, gpointer userdata);
+static NAtom          n_proplist_lookup_atom   (const char *key);
+static void           n_proplist_foreach_atom  (const NProplist *proplist, NProplistAtomFunc func,
+                                                gpointer userdata);
+static NProplistData* n_proplist_writable      (NProplist *proplist);
+static void           n_proplist_flatten       (NProplist *proplist);
+
+static NProplistData* data_new                 ();
+static NProplistData* data_ref                 (NProplistData *data);
+static void           data_unref               (NProplistData *data);
+static NProplistData* data_copy                (const NProplistData *source);
+static int            data_find_entry          (const NProplistData *data, NAtom atom);
+static void           data_reserve             (NProplistData *data, guint num_entries);
+static void           data_to_table            (NProplistData *data);
+static guint          data_size                (const NProplistData *data);
+static NValue*        data_get                 (const NProplistData *data, NAtom atom);
+static void           data_set                 (NProplistData *data, NAtom atom, NValue *value);
+static gboolean       data_remove              (NProplistData *data, NAtom atom);
+static void           data_foreach             (const NProplistData *data, NProplistAtomFunc func,
+                                                gpointer userdata);
 
 
 
@@ -40,12 +98,320 @@ n_proplist_free_value (gpointer data)
 }
 
 static void
-n_proplist_replace_value (gpointer key, gpointer value, gpointer userdata)
+n_proplist_replace_value (NAtom atom, NValue *value, gpointer userdata)
+{
+    NProplist *target = (NProplist*) userdata;
+
+    n_proplist_set_by_atom (target, atom, n_value_copy (value));
+}
+
+static NAtom
+n_proplist_lookup_atom (const char *key)
+{
+    /* key that has never been interned cannot be in any proplist,
+       so don't intern it just for a lookup. */
+    return (NAtom) g_quark_try_string (key);
+}
+
+static NProplistData*
+data_new ()
+{
+    NProplistData *data = NULL;
+
+    data      = g_slice_new0 (NProplistData);
+    data->ref = 1;
+    N_ALLOC_BYTES (N_ALLOC_PROPLIST, sizeof (NProplistData));
+
+    return data;
+}
+
+static NProplistData*
+data_ref (NProplistData *data)
+{
+    if (data)
+        data->ref++;
+
+    return data;
+}
+
+static void
+data_unref (NProplistData *data)
+{
+    guint i;
+
+    if (!data || --data->ref > 0)
+        return;
+
+    if (data->values)
+        g_hash_table_destroy (data->values);
+
+    for (i = 0; i < data->num_entries; i++)
+        n_value_free (data->entries[i].value);
+
+    g_free (data->entries);
+    g_slice_free (NProplistData, data);
+}
+
+static void
+data_copy_value_cb (NAtom atom, NValue *value, gpointer userdata)
+{
+    data_set ((NProplistData*) userdata, atom, n_value_copy (value));
+}
+
+static NProplistData*
+data_copy (const NProplistData *source)
+{
+    NProplistData *data = NULL;
+    guint          i;
+
+    data = data_new ();
+
+    if (source->values) {
+        data_foreach (source, data_copy_value_cb, data);
+        return data;
+    }
+
+    /* flat copy is a single allocation of exactly the needed size. */
+    if (source->num_entries > 0) {
+        data->entries     = g_new (NProplistEntry, source->num_entries);
+        data->max_entries = source->num_entries;
+        data->num_entries = source->num_entries;
+        N_ALLOC_BYTES (N_ALLOC_PROPLIST, source->num_entries * sizeof (NProplistEntry));
+
+        for (i = 0; i < source->num_entries; i++) {
+            data->entries[i].atom  = source->entries[i].atom;
+            data->entries[i].value = n_value_copy (source->entries[i].value);
+        }
+    }
+
+    return data;
+}
+
+static int
+data_find_entry (const NProplistData *data, NAtom atom)
+{
+    guint i;
+
+    for (i = 0; i < data->num_entries; i++) {
+        if (data->entries[i].atom == atom)
+            return (int) i;
+    }
+
+    return -1;
+}
+
+static void
+data_reserve (NProplistData *data, guint num_entries)
+{
+    guint max_entries = 0;
+
+    if (data->values || num_entries <= data->max_entries)
+        return;
+
+    max_entries = MAX (num_entries, MAX (PROPLIST_FLAT_MIN,
+                                         data->max_entries * 2));
+    max_entries = MIN (max_entries, PROPLIST_FLAT_MAX);
+    data->entries = g_renew (NProplistEntry, data->entries, max_entries);
+    N_ALLOC_BYTES (N_ALLOC_PROPLIST, (max_entries - data->max_entries) * sizeof (NProplistEntry));
+    data->max_entries = max_entries;
+}
+
+static void
+data_to_table (NProplistData *data)
 {
-    GHashTable *values = (GHashTable*) userdata;
-    NValue    *v       = (NValue*) value;
+    guint i;
+
+    data->values = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+        n_proplist_free_value);
+    N_ALLOC_BYTES (N_ALLOC_PROPLIST, PROPLIST_TABLE_SIZE);
+
+    for (i = 0; i < data->num_entries; i++) {
+        g_hash_table_insert (data->values,
+            ATOM_TO_KEY (data->entries[i].atom), data->entries[i].value);
+    }
+
+    g_free (data->entries);
+    data->entries     = NULL;
+    data->num_entries = 0;
+    data->max_entries = 0;
+}
+
+static guint
+data_size (const NProplistData *data)
+{
+    return data->values ? g_hash_table_size (data->values) : data->num_entries;
+}
+
+static NValue*
+data_get (const NProplistData *data, NAtom atom)
+{
+    int index = -1;
+
+    if (data->values)
+        return (NValue*) g_hash_table_lookup (data->values, ATOM_TO_KEY (atom));
 
-    g_hash_table_replace (values, g_strdup (key), n_value_copy (v));
+    index = data_find_entry (data, atom);
+    return index >= 0 ? data->entries[index].value : NULL;
+}
+
+static void
+data_set (NProplistData *data, NAtom atom, NValue *value)
+{
+    int index = -1;
+
+    if (!data->values) {
+        if ((index = data_find_entry (data, atom)) >= 0) {
+            if (data->entries[index].value != value)
+                n_value_free (data->entries[index].value);
+            data->entries[index].value = value;
+            return;
+        }
+
+        if (data->num_entries < PROPLIST_FLAT_MAX) {
+            data_reserve (data, data->num_entries + 1);
+            data->entries[data->num_entries].atom  = atom;
+            data->entries[data->num_entries].value = value;
+            data->num_entries++;
+            return;
+        }
+
+        data_to_table (data);
+    }
+
+#ifdef ENABLE_ALLOC_STATS
+    if (!g_hash_table_lookup_extended (data->values, ATOM_TO_KEY (atom), NULL, NULL))
+        N_ALLOC_BYTES (N_ALLOC_PROPLIST, PROPLIST_TABLE_ENTRY_SIZE);
+#endif
+
+    g_hash_table_replace (data->values, ATOM_TO_KEY (atom), value);
+}
+
+static gboolean
+data_remove (NProplistData *data, NAtom atom)
+{
+    int index = -1;
+
+    if (data->values)
+        return g_hash_table_remove (data->values, ATOM_TO_KEY (atom));
+
+    if ((index = data_find_entry (data, atom)) < 0)
+        return FALSE;
+
+    /* keep insertion order of the remaining entries. */
+    n_value_free (data->entries[index].value);
+    data->num_entries--;
+    memmove (&data->entries[index], &data->entries[index + 1],
+             (data->num_entries - index) * sizeof (NProplistEntry));
+
+    return TRUE;
+}
+
+static void
+data_foreach (const NProplistData *data, NProplistAtomFunc func, gpointer userdata)
+{
+    GHashTableIter  iter;
+    gpointer        key   = NULL;
+    NValue         *value = NULL;
+    guint           i;
+
+    if (data->values) {
+        g_hash_table_iter_init (&iter, data->values);
+        while (g_hash_table_iter_next (&iter, &key, (gpointer) &value))
+            func (KEY_TO_ATOM (key), value, userdata);
+        return;
+    }
+
+    for (i = 0; i < data->num_entries; i++)
+        func (data->entries[i].atom, data->entries[i].value, userdata);
+}
+
+static NProplistData*
+n_proplist_writable (NProplist *proplist)
+{
+    NProplistData *data = NULL;
+
+    if (proplist->data->ref > 1) {
+        data = data_copy (proplist->data);
+        data_unref (proplist->data);
+        proplist->data = data;
+    }
+
+    return proplist->data;
+}
+
+static void
+n_proplist_flatten (NProplist *proplist)
+{
+    NProplistData *data = NULL;
+
+    if (!proplist->base)
+        return;
+
+    /* fold the base layer into own entries, keeping the shadowing keys. */
+    data = data_copy (proplist->base);
+    data_reserve (data, data->num_entries + data_size (proplist->data));
+    data_foreach (proplist->data, data_copy_value_cb, data);
+
+    data_unref (proplist->base);
+    data_unref (proplist->data);
+    proplist->base = NULL;
+    proplist->data = data;
+}
+
+typedef struct _NProplistLayerData
+{
+    const NProplistData *shadow;
+    NProplistAtomFunc    func;
+    gpointer             userdata;
+} NProplistLayerData;
+
+static void
+n_proplist_foreach_base_cb (NAtom atom, NValue *value, gpointer userdata)
+{
+    NProplistLayerData *layer = userdata;
+
+    if (!data_get (layer->shadow, atom))
+        layer->func (atom, value, layer->userdata);
+}
+
+static void
+n_proplist_foreach_atom (const NProplist *proplist, NProplistAtomFunc func,
+                         gpointer userdata)
+{
+    NProplistLayerData layer;
+
+    data_foreach (proplist->data, func, userdata);
+
+    if (proplist->base) {
+        layer.shadow   = proplist->data;
+        layer.func     = func;
+        layer.userdata = userdata;
+        data_foreach (proplist->base, n_proplist_foreach_base_cb, &layer);
+    }
+}
+
+NAtom
+n_atom_intern (const char *key)
+{
+    if (!key)
+        return 0;
+
+    return (NAtom) g_quark_from_string (key);
+}
+
+NAtom
+n_atom_lookup (const char *key)
+{
+    if (!key)
+        return 0;
+
+    return n_proplist_lookup_atom (key);
+}
+
+const char*
+n_atom_to_string (NAtom atom)
+{
+    return g_quark_to_string ((GQuark) atom);
 }
 
 NProplist*
@@ -54,8 +420,8 @@ n_proplist_new ()
     NProplist *proplist = NULL;
 
     proplist = g_slice_new0 (NProplist);
-    proplist->values = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
-        n_proplist_free_value);
+    proplist->data = data_new ();
+    N_ALLOC_COUNT (N_ALLOC_PROPLIST, sizeof (NProplist));
 
     return proplist;
 }
@@ -68,8 +434,39 @@ n_proplist_copy (const NProplist *source)
     if (!source)
         return NULL;
 
-    proplist = n_proplist_new ();
-    g_hash_table_foreach (source->values, n_proplist_replace_value, proplist->values);
+    /* entries are shared until either of the proplists is modified. */
+    proplist = g_slice_new0 (NProplist);
+    proplist->data = data_ref (source->data);
+    proplist->base = data_ref (source->base);
+    N_ALLOC_COUNT (N_ALLOC_PROPLIST, sizeof (NProplist));
+
+    return proplist;
+}
+
+NProplist*
+n_proplist_new_layered (const NProplist *base, const NProplist *overlay)
+{
+    NProplist *proplist = NULL;
+
+    if (!base)
+        return n_proplist_copy (overlay);
+
+    if (!overlay)
+        return n_proplist_copy (base);
+
+    /* only a single base layer is supported, anything deeper is
+       merged the regular way. */
+    if (base->base || overlay->base) {
+        proplist = n_proplist_copy (base);
+        n_proplist_merge (proplist, overlay);
+        return proplist;
+    }
+
+    proplist = g_slice_new0 (NProplist);
+    proplist->base = data_ref (base->data);
+    proplist->data = data_ref (overlay->data);
+    N_ALLOC_COUNT (N_ALLOC_PROPLIST, sizeof (NProplist));
+
     return proplist;
 }
 
@@ -77,16 +474,9 @@ NProplist*
 n_proplist_copy_keys (const NProplist *source, GList *keys)
 {
     NProplist  *proplist = NULL;
-    NValue     *value    = NULL;
-    GList      *iter     = NULL;
 
     proplist = n_proplist_new ();
-    for (iter = g_list_first (keys); iter; iter = g_list_next (iter)) {
-        if ((value = n_proplist_get (source, (const char*) iter->data))) {
-            g_hash_table_insert (proplist->values,
-                g_strdup ((const char*) iter->data), n_value_copy (value));
-        }
-    }
+    n_proplist_merge_keys (proplist, source, keys);
 
     return proplist;
 }
@@ -94,11 +484,22 @@ n_proplist_copy_keys (const NProplist *source, GList *keys)
 void
 n_proplist_merge (NProplist *target, const NProplist *source)
 {
+    NProplistData *data = NULL;
+
     if (!target || !source)
         return;
 
-    g_hash_table_foreach (source->values, n_proplist_replace_value,
-        target->values);
+    /* merging to an empty proplist is same as copying. */
+    if (!target->base && data_size (target->data) == 0) {
+        data_unref (target->data);
+        target->data = data_ref (source->data);
+        target->base = data_ref (source->base);
+        return;
+    }
+
+    data = n_proplist_writable (target);
+    data_reserve (data, data->num_entries + n_proplist_size (source));
+    n_proplist_foreach_atom (source, n_proplist_replace_value, target);
 }
 
 void
@@ -114,10 +515,8 @@ n_proplist_merge_keys (NProplist *target, const NProplist *source, GList *keys)
         n_proplist_merge (target, source);
 
     for (iter = g_list_first (keys); iter; iter = g_list_next (iter)) {
-        if ((value = n_proplist_get (source, (const char*) iter->data))) {
-            g_hash_table_replace (target->values,
-                g_strdup ((const char*) iter->data), n_value_copy (value));
-        }
+        if ((value = n_proplist_get (source, (const char*) iter->data)))
+            n_proplist_set_by_atom (target, n_atom_intern (iter->data), n_value_copy (value));
     }
 }
 
@@ -127,80 +526,130 @@ n_proplist_free (NProplist *proplist)
     if (!proplist)
         return;
 
-    g_hash_table_destroy (proplist->values);
+    data_unref (proplist->data);
+    data_unref (proplist->base);
     g_slice_free (NProplist, proplist);
+    N_FREE_COUNT (N_ALLOC_PROPLIST);
+}
+
+static void
+n_proplist_count_cb (NAtom atom, NValue *value, gpointer userdata)
+{
+    (void) atom;
+    (void) value;
+
+    (*(int*) userdata)++;
 }
 
 int
 n_proplist_size (const NProplist *proplist)
 {
+    int size = 0;
+
     if (!proplist)
         return 0;
 
-    return g_hash_table_size (proplist->values);
+    if (!proplist->base)
+        return data_size (proplist->data);
+
+    n_proplist_foreach_atom (proplist, n_proplist_count_cb, &size);
+    return size;
+}
+
+typedef struct _NProplistForeachData
+{
+    NProplistFunc func;
+    gpointer      userdata;
+} NProplistForeachData;
+
+static void
+n_proplist_foreach_cb (NAtom atom, NValue *value, gpointer userdata)
+{
+    NProplistForeachData *data = userdata;
+
+    data->func (n_atom_to_string (atom), value, data->userdata);
 }
 
 void
 n_proplist_foreach (const NProplist *proplist, NProplistFunc func, gpointer userdata)
 {
-    const char     *key   = NULL;
-    NValue         *value = NULL;
-    GHashTableIter  iter;
+    NProplistForeachData data;
 
     if (!proplist || !func)
         return;
 
-    g_hash_table_iter_init (&iter, proplist->values);
-    while (g_hash_table_iter_next (&iter, (gpointer) &key, (gpointer) &value)) {
-        func (key, value, userdata);
-    }
+    data.func     = func;
+    data.userdata = userdata;
+    n_proplist_foreach_atom (proplist, n_proplist_foreach_cb, &data);
 }
 
 gboolean
 n_proplist_is_empty (const NProplist *proplist)
 {
-    return (proplist && g_hash_table_size (proplist->values) == 0) ? TRUE : FALSE;
+    return (proplist && n_proplist_size (proplist) == 0) ? TRUE : FALSE;
 }
 
 gboolean
 n_proplist_has_key (const NProplist *proplist, const char *key)
 {
-    return (proplist && g_hash_table_lookup (proplist->values, key) != NULL) ? TRUE : FALSE;
+    return n_proplist_get (proplist, key) != NULL ? TRUE : FALSE;
+}
+
+typedef struct _NProplistMatchData
+{
+    const NProplist *other;
+    gboolean         match;
+} NProplistMatchData;
+
+static void
+n_proplist_match_cb (NAtom atom, NValue *value, gpointer userdata)
+{
+    NProplistMatchData *data = userdata;
+
+    if (data->match && !n_value_equals (value, n_proplist_get_by_atom (data->other, atom)))
+        data->match = FALSE;
 }
 
 gboolean
 n_proplist_match_exact (const NProplist *a, const NProplist *b)
 {
-    const char *key   = NULL;
-    NValue     *value = NULL;
-    NValue     *match = NULL;
-    GHashTableIter iter;
+    NProplistMatchData data;
 
     if (!a || !b)
         return FALSE;
 
+    if (a->data == b->data && a->base == b->base)
+        return TRUE;
+
     if (n_proplist_size (a) != n_proplist_size (b))
         return FALSE;
 
     /* check if the keys and values match. */
 
-    g_hash_table_iter_init (&iter, a->values);
-    while (g_hash_table_iter_next (&iter, (gpointer) &key, (gpointer) &value)) {
-        match = (NValue*) g_hash_table_lookup (b->values, key);
-        if (!n_value_equals (value, match))
-            return FALSE;
-    }
+    data.other = b;
+    data.match = TRUE;
+    n_proplist_foreach_atom (a, n_proplist_match_cb, &data);
 
-    return TRUE;
+    return data.match;
 }
 
 void
 n_proplist_unset (NProplist *proplist, const char *key)
 {
+    NAtom atom = 0;
+
     if (!proplist || !key)
         return;
 
-    g_hash_table_remove (proplist->values, key);
+    if (!(atom = n_proplist_lookup_atom (key)) || !n_proplist_get_by_atom (proplist, atom))
+        return;
+
+    /* base layer is read-only, so a key coming from there can only
+       be removed by folding the layers together. */
+    if (proplist->base && data_get (proplist->base, atom))
+        n_proplist_flatten (proplist);
+
+    data_remove (n_proplist_writable (proplist), atom);
 }
 
 void
@@ -209,7 +658,7 @@ n_proplist_set (NProplist *proplist, const char *key, const NValue *value)
     if (!proplist || !key || !value)
         return;
 
-    g_hash_table_replace (proplist->values, g_strdup (key), (gpointer) value);
+    n_proplist_set_by_atom (proplist, n_atom_intern (key), value);
 }
 
 NValue*
@@ -218,7 +667,30 @@ n_proplist_get (const NProplist *proplist, const char *key)
     if (!proplist || !key)
         return NULL;
 
-    return (NValue*) g_hash_table_lookup (proplist->values, key);
+    return n_proplist_get_by_atom (proplist, n_proplist_lookup_atom (key));
+}
+
+void
+n_proplist_set_by_atom (NProplist *proplist, NAtom atom, const NValue *value)
+{
+    if (!proplist || !atom || !value)
+        return;
+
+    data_set (n_proplist_writable (proplist), atom, (NValue*) value);
+}
+
+NValue*
+n_proplist_get_by_atom (const NProplist *proplist, NAtom atom)
+{
+    NValue *value = NULL;
+
+    if (!proplist || !atom)
+        return NULL;
+
+    if (!(value = data_get (proplist->data, atom)) && proplist->base)
+        value = data_get (proplist->base, atom);
+
+    return value;
 }
 
 void
@@ -358,22 +830,21 @@ n_proplist_get_pointer (const NProplist *proplist, const char *key)
         n_value_get_pointer (value) : NULL;
 }
 
-void
-n_proplist_dump (const NProplist *proplist)
+static void
+n_proplist_dump_cb (NAtom atom, NValue *value, gpointer userdata)
 {
-    GHashTableIter iter;
-    gchar *key = NULL;
-    NValue *value = NULL;
     gchar *str_value = NULL;
 
-    if (n_log_get_level() <= N_LOG_LEVEL_DEBUG) {
-        g_hash_table_iter_init (&iter, proplist->values);
-        while (g_hash_table_iter_next (&iter, (gpointer) &key, (gpointer) &value)) {
-            str_value = n_value_to_string (value);
-            N_DEBUG (LOG_CAT "%s = %s", key, str_value);
-            g_free (str_value);
-        }
-    }
-}
+    (void) userdata;
 
+    str_value = n_value_to_string (value);
+    N_DEBUG (LOG_CAT "%s = %s", n_atom_to_string (atom), str_value);
+    g_free (str_value);
+}
 
+void
+n_proplist_dump (const NProplist *proplist)
+{
+    if (proplist && N_LOG_ENABLED (N_LOG_LEVEL_DEBUG))
+        n_proplist_foreach_atom (proplist, n_proplist_dump_cb, NULL);
+}
@@ -25,12 +25,42 @@
 #include <ngf/request.h>
 #include <ngf/proplist.h>
 
+#include "allocstats.h"
 #include "core-internal.h"
 #include "event-internal.h"
 #include "inputinterface-internal.h"
+#include "sinkinterface-internal.h"
 
 /* typedef struct _NRequest NRequest; */
 
+/* size of the arena space allocated together with the request,
+   enough for the sink data of typical requests. */
+#define N_REQUEST_ARENA_INLINE  (256)
+
+typedef struct _NRequestChunk NRequestChunk;
+
+/* timeline of a single sink, monotonic time or 0 if not reached */
+typedef struct _NRequestSinkTimes
+{
+    gint64           prepare;
+    gint64           synchronized;
+    gint64           play;
+    gint64           started;       /* output started, see n_sink_interface_started */
+    gint64           stage;         /* start of the current stage for the watchdog,
+                                       reset on every prepare, play and resume */
+} NRequestSinkTimes;
+
+/* maximum number of sink specific stages recorded per request */
+#define N_REQUEST_SINK_MARKS_MAX (8)
+
+/* sink specific stage, see n_sink_interface_mark */
+typedef struct _NRequestSinkMark
+{
+    guint            sink_index;
+    const char      *name;
+    gint64           time;
+} NRequestSinkMark;
+
 struct _NRequest
 {
     gchar           *name;          /* request name */
@@ -46,24 +76,68 @@ struct _NRequest
     gboolean         is_fallback;
     gboolean         has_failed;
     gboolean         no_event;
+    gboolean         is_critical;           /* callbacks dispatched at high priority */
 
     guint            play_source_id;        /* source id for play */
     guint            stop_source_id;        /* source id for stop */
+    gint64           source_queued;         /* time the pending idle was added */
 
-    GList           *all_sinks;             /* all sinks available for the request */
-    GList           *sinks_preparing;       /* sinks not yet synchronized and still preparing */
-    GList           *sinks_prepared;
-    GList           *sinks_playing;         /* sinks currently playing */
-    GList           *sinks_resync;
-    GList           *stop_list;
+    NSinkInterface **all_sinks;             /* all sinks available for the request, NULL terminated
+                                               in priority order, in the arena */
+    NSinkSet         sinks_preparing;       /* sinks not yet synchronized and still preparing */
+    NSinkSet         sinks_prepared;
+    NSinkSet         sinks_playing;         /* sinks currently playing */
+    NSinkSet         sinks_resync;
+    NSinkSet         sinks_stop;            /* sinks to stop when request is done */
     NSinkInterface  *master_sink;
+    GList           *prepare_jobs;          /* pending threaded prepares */
+    GList           *link;                  /* entry in core active requests */
 
     guint            max_timeout_id;
     guint            timeout_ms;
+    guint            watchdog_id;           /* timer of the next watchdog deadline */
+    NSinkSet         watchdog_stalled;      /* sinks the watchdog has found stalled */
+
+    guint            sched_slots;           /* slots held, 0 if not scheduled */
+    gint             sched_priority;
+    guint            sched_yield;           /* NCoreYield to higher priorities */
+    gboolean         sched_queued;          /* waiting for the slots to free */
+    gboolean         sched_paused;          /* paused by a higher priority request */
+    gboolean         startup_queued;        /* waiting for its sinks to initialize */
+
+    gint64           timeline[N_REQUEST_STAGE_LAST];
+    gint64           start_time;            /* common start time of the sinks, 0 if not set */
+    guint            num_resumes;
+    gint64           resume_max;            /* slowest resume of the sinks, us */
+    NRequestSinkTimes *sink_times;          /* indexed by sink index */
+    guint            num_sink_times;
+    NRequestSinkMark *sink_marks;           /* allocated on the first mark */
+    guint            num_sink_marks;
+#ifdef ENABLE_ALLOC_STATS
+    NAllocStats      alloc_start[N_ALLOC_TYPES]; /* process counts when created */
+#endif
+
+    /* arena for n_request_alloc, freed with the request */
+    guint8          *arena;                 /* current chunk */
+    gsize            arena_used;
+    gsize            arena_size;
+    NRequestChunk   *chunks;                /* additionally allocated chunks */
+    union {
+        guint8       data[N_REQUEST_ARENA_INLINE];
+        gdouble      align_d;
+        gpointer     align_p;
+    } arena_inline;
 };
 
 NRequest* n_request_new          ();
 void      n_request_free         (NRequest *request);
 int       n_request_has_fallback (NRequest *request);
 
+void      n_request_mark         (NRequest *request, NRequestStage stage);
+NRequestSinkTimes* n_request_get_sink_times (NRequest *request, NSinkInterface *sink);
+void      n_request_add_sink_mark (NRequest *request, NSinkInterface *sink,
+                                   const char *name, gint64 time);
+gint64    n_request_get_start_skew (NRequest *request);
+gchar*    n_request_timeline_to_string (NRequest *request);
+
 #endif /* N_REQUEST_INTERNAL_H */
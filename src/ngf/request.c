@@ -19,18 +19,57 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+#include <string.h>
 #include "request-internal.h"
+#include "allocstats.h"
+
+/* arena chunks allocated when the inline space runs out. allocations
+   larger than half a chunk get a chunk of their own. */
+#define ARENA_CHUNK_SIZE    (1024)
+#define ARENA_ALIGN         (2 * sizeof (gpointer))
+
+struct _NRequestChunk
+{
+    NRequestChunk *next;
+    gpointer       pad;         /* keep data aligned to ARENA_ALIGN */
+    guint8         data[];
+};
 
 static guint id_counter = 0;
 
+static NRequest*
+request_alloc ()
+{
+    NRequest *request = NULL;
+#ifdef ENABLE_ALLOC_STATS
+    NAllocStats start[N_ALLOC_TYPES];
+    guint       i;
+
+    /* taken first so the request itself is part of its report */
+    for (i = 0; i < N_ALLOC_TYPES; i++)
+        n_alloc_stats_get ((NAllocType) i, &start[i]);
+#endif
+
+    request             = g_slice_new0 (NRequest);
+    request->arena      = request->arena_inline.data;
+    request->arena_size = sizeof (request->arena_inline.data);
+    N_ALLOC_COUNT (N_ALLOC_REQUEST, sizeof (NRequest));
+#ifdef ENABLE_ALLOC_STATS
+    memcpy (request->alloc_start, start, sizeof (start));
+#endif
+
+    return request;
+}
+
 NRequest*
 n_request_new ()
 {
     NRequest *request = NULL;
 
-    request = g_slice_new0 (NRequest);
+    request = request_alloc ();
     /* skip 0 */
     request->id = ++id_counter ? id_counter : ++id_counter;
+    request->timeline[N_REQUEST_STAGE_RECEIVED] = g_get_monotonic_time ();
     return request;
 }
 
@@ -39,10 +78,11 @@ n_request_copy (const NRequest *request)
 {
     NRequest *copy;
 
-    copy                = g_slice_new0 (NRequest);
+    copy                = request_alloc ();
     copy->id            = request->id;
     copy->name          = request->name ? g_strdup (request->name) : NULL;
     copy->input_iface   = request->input_iface;
+    copy->timeline[N_REQUEST_STAGE_RECEIVED] = request->timeline[N_REQUEST_STAGE_RECEIVED];
     if (request->original_properties)
         copy->properties = n_proplist_copy (request->original_properties);
     else if (request->properties)
@@ -78,6 +118,8 @@ n_request_new_with_event_and_properties (const char *event, const NProplist *pro
 void
 n_request_free (NRequest *request)
 {
+    NRequestChunk *chunk = NULL;
+
     if (request->properties) {
         n_proplist_free (request->properties);
         request->properties = NULL;
@@ -91,7 +133,51 @@ n_request_free (NRequest *request)
     g_free (request->name);
     request->name = NULL;
 
+    while ((chunk = request->chunks)) {
+        request->chunks = chunk->next;
+        g_free (chunk);
+        N_FREE_COUNT (N_ALLOC_REQUEST);
+    }
+
     g_slice_free (NRequest, request);
+    N_FREE_COUNT (N_ALLOC_REQUEST);
+}
+
+void*
+n_request_alloc (NRequest *request, gsize size)
+{
+    NRequestChunk *chunk = NULL;
+    gpointer       ptr   = NULL;
+
+    if (!request || size == 0)
+        return NULL;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (request->arena_used + size <= request->arena_size) {
+        ptr = request->arena + request->arena_used;
+        request->arena_used += size;
+        return memset (ptr, 0, size);
+    }
+
+    if (size > ARENA_CHUNK_SIZE / 2) {
+        chunk = g_malloc0 (sizeof (NRequestChunk) + size);
+        N_ALLOC_COUNT (N_ALLOC_REQUEST, sizeof (NRequestChunk) + size);
+        chunk->next = request->chunks;
+        request->chunks = chunk;
+        return chunk->data;
+    }
+
+    chunk = g_malloc0 (sizeof (NRequestChunk) + ARENA_CHUNK_SIZE);
+    N_ALLOC_COUNT (N_ALLOC_REQUEST, sizeof (NRequestChunk) + ARENA_CHUNK_SIZE);
+    chunk->next = request->chunks;
+    request->chunks = chunk;
+
+    request->arena      = chunk->data;
+    request->arena_size = ARENA_CHUNK_SIZE;
+    request->arena_used = size;
+
+    return chunk->data;
 }
 
 unsigned int
@@ -116,6 +202,16 @@ n_request_set_properties (NRequest *request, NProplist *properties)
     request->properties = n_proplist_copy (properties);
 }
 
+void
+n_request_take_properties (NRequest *request, NProplist *properties)
+{
+    if (!request || !properties)
+        return;
+
+    n_proplist_free (request->properties);
+    request->properties = properties;
+}
+
 const NProplist*
 n_request_get_properties (NRequest *request)
 {
@@ -179,4 +275,189 @@ n_request_get_timeout (NRequest *request)
     return (request != NULL) ? request->timeout_ms : 0;
 }
 
+void
+n_request_set_timestamp (NRequest *request, NRequestStage stage, gint64 time)
+{
+    if (!request || stage >= N_REQUEST_STAGE_LAST)
+        return;
+
+    request->timeline[stage] = time;
+}
+
+gint64
+n_request_get_timestamp (NRequest *request, NRequestStage stage)
+{
+    if (!request || stage >= N_REQUEST_STAGE_LAST)
+        return 0;
+
+    return request->timeline[stage];
+}
+
+gint64
+n_request_get_start_time (NRequest *request)
+{
+    return (request != NULL) ? request->start_time : 0;
+}
 
+int
+n_request_get_source_priority (NRequest *request, int default_priority)
+{
+    if (request && request->is_critical)
+        return G_PRIORITY_HIGH;
+
+    return default_priority;
+}
+
+void
+n_request_mark (NRequest *request, NRequestStage stage)
+{
+    g_assert (request != NULL);
+    g_assert (stage < N_REQUEST_STAGE_LAST);
+
+    if (request->timeline[stage] == 0)
+        request->timeline[stage] = g_get_monotonic_time ();
+}
+
+NRequestSinkTimes*
+n_request_get_sink_times (NRequest *request, NSinkInterface *sink)
+{
+    g_assert (request != NULL);
+    g_assert (sink != NULL);
+
+    if (sink->index >= request->num_sink_times)
+        return NULL;
+
+    return &request->sink_times[sink->index];
+}
+
+void
+n_request_add_sink_mark (NRequest *request, NSinkInterface *sink,
+                         const char *name, gint64 time)
+{
+    NRequestSinkMark *mark = NULL;
+
+    g_assert (request != NULL);
+    g_assert (sink != NULL);
+    g_assert (name != NULL);
+
+    if (request->num_sink_marks >= N_REQUEST_SINK_MARKS_MAX)
+        return;
+
+    if (!request->sink_marks)
+        request->sink_marks = n_request_alloc (request,
+            N_REQUEST_SINK_MARKS_MAX * sizeof (NRequestSinkMark));
+
+    mark = &request->sink_marks[request->num_sink_marks++];
+    mark->sink_index = sink->index;
+    mark->name       = name;
+    mark->time       = time;
+}
+
+gint64
+n_request_get_start_skew (NRequest *request)
+{
+    gint64 skew = -1;
+    gint64 diff;
+    guint  i;
+
+    g_assert (request != NULL);
+
+    if (!request->start_time)
+        return -1;
+
+    for (i = 0; i < request->num_sink_times; i++) {
+        if (!request->sink_times[i].started)
+            continue;
+
+        diff = request->sink_times[i].started - request->start_time;
+        if (diff < 0)
+            diff = -diff;
+        if (diff > skew)
+            skew = diff;
+    }
+
+    return skew;
+}
+
+static void
+timeline_append (GString *str, const char *name, char sep, gint64 time,
+                 gint64 base)
+{
+    if (time > 0)
+        g_string_append_printf (str, "%s%c+%" G_GINT64_FORMAT, name, sep, time - base);
+    else
+        g_string_append_printf (str, "%s%c-", name, sep);
+}
+
+gchar*
+n_request_timeline_to_string (NRequest *request)
+{
+    static const char *stage_names[N_REQUEST_STAGE_LAST] = {
+        "received", "resolved", "hooks", "synchronized",
+        "master_play", "playing", "stop", "done"
+    };
+
+    GString            *str   = NULL;
+    NSinkInterface    **sinks = NULL;
+    NRequestSinkTimes  *times = NULL;
+    gint64              base;
+    gint64              skew;
+    guint               i, j;
+
+    g_assert (request != NULL);
+
+    base = request->timeline[N_REQUEST_STAGE_RECEIVED];
+    str  = g_string_new (NULL);
+
+    g_string_append_printf (str, "request '%s' id=%u event=%s status=%s",
+        request->name, request->id,
+        request->event ? request->event->name : "-",
+        request->has_failed ? "failed" :
+        request->timeline[N_REQUEST_STAGE_STOP] ? "stopped" :
+        request->timeline[N_REQUEST_STAGE_DONE] ? "completed" : "active");
+
+    for (i = 0; i < N_REQUEST_STAGE_LAST; i++) {
+        g_string_append_c (str, ' ');
+        timeline_append (str, stage_names[i], '=', request->timeline[i], base);
+    }
+
+    if (request->start_time) {
+        g_string_append_c (str, ' ');
+        timeline_append (str, "start", '=', request->start_time, base);
+        if ((skew = n_request_get_start_skew (request)) >= 0)
+            g_string_append_printf (str, " skew=%" G_GINT64_FORMAT, skew);
+    }
+
+    if (request->num_resumes > 0)
+        g_string_append_printf (str, " resumes=%u resume_max=%" G_GINT64_FORMAT,
+            request->num_resumes, request->resume_max);
+
+    sinks = request->core ? request->core->sinks : NULL;
+    for (i = 0; sinks && sinks[i] && i < request->num_sink_times; i++) {
+        times = &request->sink_times[i];
+        if (!times->prepare && !times->synchronized && !times->play)
+            continue;
+
+        g_string_append_printf (str, " sink.%s=", sinks[i]->name);
+        timeline_append (str, "prepare", ':', times->prepare, base);
+        g_string_append_c (str, ',');
+        timeline_append (str, "sync", ':', times->synchronized, base);
+        g_string_append_c (str, ',');
+        timeline_append (str, "play", ':', times->play, base);
+
+        if (times->started) {
+            g_string_append_c (str, ',');
+            timeline_append (str, "started", ':', times->started, base);
+        }
+
+        for (j = 0; j < request->num_sink_marks; j++) {
+            if (request->sink_marks[j].sink_index != i)
+                continue;
+            g_string_append_c (str, ',');
+            timeline_append (str, request->sink_marks[j].name, ':',
+                             request->sink_marks[j].time, base);
+        }
+    }
+
+    return g_string_free (str, FALSE);
+}
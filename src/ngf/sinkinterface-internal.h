@@ -22,10 +22,28 @@
 #ifndef N_SINK_INTERFACE_INTERNAL_H
 #define N_SINK_INTERFACE_INTERNAL_H
 
+#include <glib.h>
 #include <ngf/sinkinterface.h>
+#include <ngf/plugin.h>
+#include <ngf/metrics.h>
+
+/* per-request sink states are kept as bitmasks indexed by the
+   registration index of the sink. */
+typedef guint64 NSinkSet;
+
+#define N_SINK_SET_MAX          (64)
+#define N_SINK_SET_BIT(sink)    (G_GUINT64_CONSTANT (1) << (sink)->index)
 
 #include "core-internal.h"
 
+typedef enum _NSinkInitState
+{
+    N_SINK_INIT_NONE = 0,
+    N_SINK_INIT_PENDING,
+    N_SINK_INIT_READY,
+    N_SINK_INIT_FAILED
+} NSinkInitState;
+
 /* typedef struct _NSinkInterface NSinkInterface; */
 
 struct _NSinkInterface
@@ -36,6 +54,16 @@ struct _NSinkInterface
     NCore              *core;
     void               *userdata;
     int                 priority;       /* priority */
+    guint               index;          /* bit in request sink sets */
+    gboolean            plan_declared;  /* can_handle keys have been declared */
+    NMetricHistogram   *prepare_metric; /* prepare to synchronized, in us */
+    NMetricHistogram   *play_metric;    /* request received to play, in us */
+    NPlugin            *plugin;         /* plugin that registered the sink, or NULL */
+    NSinkInitState      init_state;
+    gint64              init_started;   /* monotonic time, in us */
+    gint64              init_us;        /* duration of the initialization */
+    guint64             plays;          /* requests played, for idle detection */
+    gchar             **startup_keys;   /* request keys the sink is waited for, NULL waits always */
 };
 
 #endif /* N_SINK_INTERFACE_INTERNAL_H */
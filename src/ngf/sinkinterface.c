@@ -40,6 +40,16 @@ n_sink_interface_get_type (NSinkInterface *iface)
     return iface->type;
 }
 
+void
+n_sink_interface_add_plan_key (NSinkInterface *iface, const char *key,
+                               int value_matters)
+{
+    if (!iface)
+        return;
+
+    n_core_add_plan_key (iface->core, iface, key, value_matters);
+}
+
 void
 n_sink_interface_set_resync_on_master (NSinkInterface *iface, NRequest *request)
 {
@@ -85,6 +95,37 @@ n_sink_interface_fail (NSinkInterface *iface, NRequest *request)
     n_core_fail_sink (iface->core, iface, request);
 }
 
+void
+n_sink_interface_mark (NSinkInterface *iface, NRequest *request,
+                       const char *stage, gint64 time)
+{
+    if (!iface || !request || !stage)
+        return;
+
+    n_request_add_sink_mark (request, iface, stage, time);
+}
+
+void
+n_sink_interface_started (NSinkInterface *iface, NRequest *request, gint64 time)
+{
+    NRequestSinkTimes *times = NULL;
+
+    if (!iface || !request)
+        return;
+
+    if ((times = n_request_get_sink_times (request, iface)) && !times->started)
+        times->started = time;
+}
+
+void
+n_sink_interface_initialized (NSinkInterface *iface, int success)
+{
+    if (!iface)
+        return;
+
+    n_core_sink_initialized (iface->core, iface, success);
+}
+
 void
 n_sink_interface_set_userdata (NSinkInterface *iface, void *userdata)
 {
@@ -0,0 +1,446 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <glib.h>
+#include <ngf/log.h>
+#include "timer-internal.h"
+#include "wakeup-internal.h"
+
+#define LOG_CAT "timer: "
+
+/* Hierarchical timer wheel. Time is counted in ticks of the timer
+ * resolution. Level 0 holds the timers expiring within WHEEL_SIZE ticks,
+ * one slot per tick. Every following level covers WHEEL_SIZE times the
+ * range of the previous one, and its timers are moved to the lower levels
+ * when the wheel reaches the start of their slot. Timers beyond the range
+ * of the top level are put in its farthest slot and inserted again when
+ * that comes up. A single GSource is kept ready for the start of the
+ * first occupied slot. */
+
+#define WHEEL_BITS      (6)
+#define WHEEL_SIZE      (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS    (4)
+#define WHEEL_RANGE(l)  ((guint64) 1 << (WHEEL_BITS * ((l) + 1)))
+#define MAX_DELTA       (WHEEL_RANGE (WHEEL_LEVELS - 1) - 1)
+#define TICK_US         (N_TIMER_RESOLUTION_MS * 1000)
+#define NO_EXPIRY       G_MAXUINT64
+
+/* the main loop polls with millisecond timeouts, precise timers wake up
+   this much early and sleep the rest of the way. */
+#define PRECISE_MARGIN_US (1000)
+
+typedef struct _NTimer
+{
+    guint        id;
+    guint64      expires;       /* tick */
+    guint64      interval;      /* ticks */
+    GSourceFunc  func;
+    gpointer     userdata;
+    GList        link;          /* in the slot queue */
+    GQueue      *slot;
+} NTimer;
+
+struct _NTimers
+{
+    GSource     *source;
+    GHashTable  *timers;        /* key:id value:NTimer */
+    guint        next_id;
+    guint64      now;           /* last tick processed */
+    guint64      occupied[WHEEL_LEVELS];
+    GQueue       slots[WHEEL_LEVELS][WHEEL_SIZE];
+    NTimer      *current;       /* timer being dispatched */
+    gboolean     current_removed;
+};
+
+typedef struct _NPreciseTimer
+{
+    GSource      source;
+    gint64       time;
+} NPreciseTimer;
+
+static guint64  n_timers_current_tick (gboolean round_up);
+static guint64  n_timers_next_expiry  (NTimers *timers);
+static void     n_timers_insert       (NTimers *timers, NTimer *timer);
+static void     n_timers_unlink       (NTimers *timers, NTimer *timer);
+static void     n_timers_schedule     (NTimers *timers);
+static gboolean n_timers_dispatch_cb  (GSource *source, GSourceFunc callback,
+                                       gpointer userdata);
+static gboolean n_timer_precise_dispatch_cb (GSource *source, GSourceFunc callback,
+                                             gpointer userdata);
+
+static GSourceFuncs timers_source_funcs = {
+    .dispatch = n_timers_dispatch_cb
+};
+
+static GSourceFuncs precise_source_funcs = {
+    .dispatch = n_timer_precise_dispatch_cb
+};
+
+static guint64
+n_timers_current_tick (gboolean round_up)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    return round_up ? (now + TICK_US - 1) / TICK_US : now / TICK_US;
+}
+
+static guint64
+n_timers_slot_start (NTimers *timers, int level, guint slot)
+{
+    guint64 start;
+
+    start = (timers->now & ~(WHEEL_RANGE (level) - 1)) +
+            ((guint64) slot << (WHEEL_BITS * level));
+
+    /* slots behind the current one belong to the next round */
+    if (start <= timers->now)
+        start += WHEEL_RANGE (level);
+
+    return start;
+}
+
+static guint64
+n_timers_next_expiry (NTimers *timers)
+{
+    guint64 next = NO_EXPIRY;
+    guint64 start;
+    guint64 bits;
+    guint   current;
+    guint   slot;
+    int     level;
+
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        if (!(bits = timers->occupied[level]))
+            continue;
+
+        /* first occupied slot after the current one */
+        current = ((timers->now >> (WHEEL_BITS * level)) + 1) & WHEEL_MASK;
+        bits = (bits >> current) | (current ? bits << (WHEEL_SIZE - current) : 0);
+        slot = (current + __builtin_ctzll (bits)) & WHEEL_MASK;
+
+        start = n_timers_slot_start (timers, level, slot);
+        if (start < next)
+            next = start;
+    }
+
+    return next;
+}
+
+static void
+n_timers_insert (NTimers *timers, NTimer *timer)
+{
+    guint64 delta;
+    guint64 expires;
+    guint   slot;
+    int     level;
+
+    delta = timer->expires > timers->now ? timer->expires - timers->now : 0;
+    if (delta > MAX_DELTA)
+        delta = MAX_DELTA;
+    expires = timers->now + delta;
+
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < WHEEL_RANGE (level))
+            break;
+    }
+
+    slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    timer->slot = &timers->slots[level][slot];
+    g_queue_push_tail_link (timer->slot, &timer->link);
+    timers->occupied[level] |= (guint64) 1 << slot;
+}
+
+static void
+n_timers_unlink (NTimers *timers, NTimer *timer)
+{
+    int level;
+    int slot;
+
+    if (!timer->slot)
+        return;
+
+    g_queue_unlink (timer->slot, &timer->link);
+
+    if (g_queue_is_empty (timer->slot)) {
+        level = (timer->slot - &timers->slots[0][0]) / WHEEL_SIZE;
+        slot  = (timer->slot - &timers->slots[0][0]) % WHEEL_SIZE;
+        timers->occupied[level] &= ~((guint64) 1 << slot);
+    }
+
+    timer->slot = NULL;
+}
+
+static void
+n_timers_schedule (NTimers *timers)
+{
+    guint64 next = n_timers_next_expiry (timers);
+
+    /* attached when first needed */
+    if (!timers->source) {
+        timers->source = g_source_new (&timers_source_funcs, sizeof (GSource));
+        g_source_set_callback (timers->source, NULL, timers, NULL);
+        g_source_attach (timers->source, NULL);
+    }
+
+    g_source_set_ready_time (timers->source,
+                             next == NO_EXPIRY ? -1 : (gint64) (next * TICK_US));
+}
+
+static void
+n_timers_cascade (NTimers *timers, int level)
+{
+    GQueue *slot  = NULL;
+    GList  *link  = NULL;
+
+    slot = &timers->slots[level][(timers->now >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    while ((link = g_queue_pop_head_link (slot))) {
+        ((NTimer*) link->data)->slot = NULL;
+        n_timers_insert (timers, link->data);
+    }
+
+    timers->occupied[level] &= ~((guint64) 1 << ((timers->now >> (WHEEL_BITS * level)) & WHEEL_MASK));
+}
+
+static void
+n_timers_fire (NTimers *timers)
+{
+    NTimer   *timer  = NULL;
+    GQueue   *slot   = NULL;
+    GList    *link   = NULL;
+    gboolean  repeat = FALSE;
+
+    slot = &timers->slots[0][timers->now & WHEEL_MASK];
+
+    /* timers added by the callbacks always expire after the current tick,
+       so they never end up in this slot. */
+    while ((link = g_queue_pop_head_link (slot))) {
+        timer = link->data;
+        timer->slot = NULL;
+
+        /* was beyond the range of the wheel, wait for the rest */
+        if (timer->expires > timers->now) {
+            n_timers_insert (timers, timer);
+            continue;
+        }
+
+        timers->current = timer;
+        timers->current_removed = FALSE;
+        repeat = timer->func (timer->userdata);
+        timers->current = NULL;
+
+        if (repeat && !timers->current_removed) {
+            timer->expires = timers->now + timer->interval;
+            n_timers_insert (timers, timer);
+        } else {
+            if (!timers->current_removed)
+                g_hash_table_remove (timers->timers, GUINT_TO_POINTER (timer->id));
+            g_slice_free (NTimer, timer);
+        }
+    }
+
+    timers->occupied[0] &= ~((guint64) 1 << (timers->now & WHEEL_MASK));
+}
+
+static gboolean
+n_timers_dispatch_cb (GSource *source, GSourceFunc callback, gpointer userdata)
+{
+    NTimers *timers = userdata;
+    guint64  target;
+    guint64  next;
+    int      level;
+
+    (void) source;
+    (void) callback;
+
+    n_wakeups_note_default ("timers");
+
+    target = n_timers_current_tick (FALSE);
+
+    while (timers->now < target) {
+        if ((next = n_timers_next_expiry (timers)) > target) {
+            timers->now = target;
+            break;
+        }
+
+        timers->now = next;
+        for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((next & (WHEEL_RANGE (level - 1) - 1)) == 0)
+                n_timers_cascade (timers, level);
+        }
+        n_timers_fire (timers);
+    }
+
+    n_timers_schedule (timers);
+
+    return TRUE;
+}
+
+NTimers*
+n_timers_new ()
+{
+    NTimers *timers = NULL;
+    int      level;
+    int      slot;
+
+    timers = g_new0 (NTimers, 1);
+    timers->timers = g_hash_table_new (g_direct_hash, g_direct_equal);
+    timers->now = n_timers_current_tick (FALSE);
+
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        for (slot = 0; slot < WHEEL_SIZE; slot++)
+            g_queue_init (&timers->slots[level][slot]);
+    }
+
+    return timers;
+}
+
+static void
+n_timers_free_timer (gpointer key, gpointer value, gpointer userdata)
+{
+    (void) key;
+    (void) userdata;
+
+    g_slice_free (NTimer, value);
+}
+
+void
+n_timers_free (NTimers *timers)
+{
+    if (!timers)
+        return;
+
+    if (g_hash_table_size (timers->timers) > 0)
+        N_DEBUG (LOG_CAT "%u timers still pending", g_hash_table_size (timers->timers));
+
+    g_hash_table_foreach (timers->timers, n_timers_free_timer, NULL);
+    g_hash_table_destroy (timers->timers);
+    if (timers->source) {
+        g_source_destroy (timers->source);
+        g_source_unref (timers->source);
+    }
+    g_free (timers);
+}
+
+guint
+n_timers_size (NTimers *timers)
+{
+    return timers ? g_hash_table_size (timers->timers) : 0;
+}
+
+guint
+n_timers_add (NTimers *timers, guint interval, GSourceFunc func, gpointer userdata)
+{
+    NTimer  *timer = NULL;
+    guint64  ticks;
+    guint64  current;
+
+    g_assert (timers != NULL);
+    g_assert (func != NULL);
+
+    ticks = ((guint64) interval + N_TIMER_RESOLUTION_MS - 1) / N_TIMER_RESOLUTION_MS;
+    current = n_timers_current_tick (TRUE);
+
+    /* catch up with the time passed while nothing was due */
+    if (!timers->current && current > timers->now &&
+        n_timers_next_expiry (timers) > current)
+        timers->now = current;
+
+    timer = g_slice_new0 (NTimer);
+    timer->link.data = timer;
+    timer->interval = MAX (ticks, 1);
+    timer->expires = MAX (current + ticks, timers->now + 1);
+    timer->func = func;
+    timer->userdata = userdata;
+
+    do {
+        timer->id = ++timers->next_id;
+    } while (timer->id == 0 ||
+             g_hash_table_lookup (timers->timers, GUINT_TO_POINTER (timer->id)));
+
+    g_hash_table_insert (timers->timers, GUINT_TO_POINTER (timer->id), timer);
+    n_timers_insert (timers, timer);
+    if (!timers->current)
+        n_timers_schedule (timers);
+
+    return timer->id;
+}
+
+gboolean
+n_timers_remove (NTimers *timers, guint id)
+{
+    NTimer *timer = NULL;
+
+    g_assert (timers != NULL);
+
+    if (!(timer = g_hash_table_lookup (timers->timers, GUINT_TO_POINTER (id))))
+        return FALSE;
+
+    g_hash_table_remove (timers->timers, GUINT_TO_POINTER (id));
+
+    if (timer == timers->current) {
+        timers->current_removed = TRUE;
+        return TRUE;
+    }
+
+    n_timers_unlink (timers, timer);
+    g_slice_free (NTimer, timer);
+    if (!timers->current)
+        n_timers_schedule (timers);
+
+    return TRUE;
+}
+
+static gboolean
+n_timer_precise_dispatch_cb (GSource *source, GSourceFunc callback,
+                             gpointer userdata)
+{
+    NPreciseTimer *timer = (NPreciseTimer*) source;
+    gint64         now;
+
+    n_wakeups_note_default ("timers");
+
+    while ((now = g_get_monotonic_time ()) < timer->time)
+        g_usleep (timer->time - now);
+
+    if (callback)
+        (void) callback (userdata);
+
+    return G_SOURCE_REMOVE;
+}
+
+guint
+n_timer_run_at (gint64 time, GSourceFunc func, gpointer userdata)
+{
+    GSource *source = NULL;
+    guint    id;
+
+    g_assert (func != NULL);
+
+    source = g_source_new (&precise_source_funcs, sizeof (NPreciseTimer));
+    ((NPreciseTimer*) source)->time = time;
+    g_source_set_priority (source, G_PRIORITY_HIGH);
+    g_source_set_callback (source, func, userdata, NULL);
+    g_source_set_ready_time (source, MAX (time - PRECISE_MARGIN_US, 0));
+    id = g_source_attach (source, NULL);
+    g_source_unref (source);
+
+    return id;
+}
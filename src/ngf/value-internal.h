@@ -0,0 +1,47 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_VALUE_INTERNAL_H
+#define N_VALUE_INTERNAL_H
+
+#include <glib.h>
+#include <ngf/value.h>
+
+/* Pool of interned string buffers. Values interned to the same pool
+ * share one buffer for equal strings, no matter where they were
+ * parsed from. Only strings too long to be stored inline are pooled. */
+typedef struct _NValuePool NValuePool;
+
+NValuePool* n_value_pool_new    ();
+void        n_value_pool_free   (NValuePool *pool);
+/* Replace the string buffer of value with the pooled one. Returns the
+ * number of bytes freed by doing so. */
+gsize       n_value_pool_intern (NValuePool *pool, NValue *value);
+/* Drop strings no longer referenced outside of the pool. */
+void        n_value_pool_prune  (NValuePool *pool);
+guint       n_value_pool_size   (const NValuePool *pool);
+
+/* Heap bytes used by value itself. The string buffer, if any, is
+ * reported separately in buffer_size and identified by buffer, so that
+ * shared buffers can be counted once. */
+gsize       n_value_heap_size   (const NValue *value, gsize *buffer_size,
+                                 gconstpointer *buffer);
+
+#endif /* N_VALUE_INTERNAL_H */
@@ -22,22 +22,53 @@
 #include <string.h>
 #include <ngf/log.h>
 #include <ngf/value.h>
+#include "value-internal.h"
+#include "allocstats.h"
+
+/* strings up to N_VALUE_INLINE_MAX characters are stored within the
+   value itself, longer strings are kept in a refcounted immutable buffer
+   shared between all copies of the value. */
+#define N_VALUE_INLINE_MAX      (15)
+
+#define N_VALUE_STRING_INLINE   (0)
+#define N_VALUE_STRING_SHARED   (1)
+
+typedef struct _NValueString
+{
+    gint  ref;
+    gchar str[];
+} NValueString;
 
 struct _NValue
 {
-    guint type;
+    guint16 type;
+    guint16 storage;            /* N_VALUE_STRING_* for strings */
     union {
-        gchar   *s;
-        gint     i;
-        guint    u;
-        gboolean b;
-        gpointer p;
+        gchar         inline_s[N_VALUE_INLINE_MAX + 1];
+        NValueString *shared;
+        gint          i;
+        guint         u;
+        gboolean      b;
+        gpointer      p;
     } value;
 };
 
+struct _NValuePool
+{
+    GHashTable *strings;        /* key:string value:NValueString, one ref held */
+};
+
+static const gchar*
+value_string (const NValue *value)
+{
+    return value->storage == N_VALUE_STRING_INLINE ? value->value.inline_s
+                                                   : value->value.shared->str;
+}
+
 NValue*
 n_value_new ()
 {
+    N_ALLOC_COUNT (N_ALLOC_VALUE, sizeof (NValue));
     return (NValue*) g_slice_new0 (NValue);
 }
 
@@ -49,6 +80,7 @@ n_value_free (NValue *value)
 
     n_value_clean (value);
     g_slice_free (NValue, value);
+    N_FREE_COUNT (N_ALLOC_VALUE);
 }
 
 void
@@ -66,10 +98,14 @@ n_value_clean (NValue *value)
     if (!value)
         return;
 
-    if (value->type == N_VALUE_TYPE_STRING) {
-        g_free (value->value.s);
-        value->value.s = NULL;
+    if (value->type == N_VALUE_TYPE_STRING && value->storage == N_VALUE_STRING_SHARED) {
+        if (g_atomic_int_dec_and_test (&value->value.shared->ref)) {
+            g_free (value->value.shared);
+            N_FREE_COUNT (N_ALLOC_VALUE);
+        }
     }
+
+    memset (value, 0, sizeof (NValue));
 }
 
 NValue*
@@ -80,32 +116,16 @@ n_value_copy (const NValue *value)
     if (!value)
         return NULL;
 
-    if (value->type == 0)
+    if (value->type == 0 || value->type > N_VALUE_TYPE_POINTER)
         return NULL;
 
+    /* plain copy for everything but shared strings, which just need
+       another reference. */
     new_value = n_value_new ();
-    new_value->type = value->type;
+    *new_value = *value;
 
-    switch (value->type) {
-        case N_VALUE_TYPE_STRING:
-            new_value->value.s = g_strdup (value->value.s);
-            break;
-        case N_VALUE_TYPE_INT:
-            new_value->value.i = value->value.i;
-            break;
-        case N_VALUE_TYPE_UINT:
-            new_value->value.u = value->value.u;
-            break;
-        case N_VALUE_TYPE_BOOL:
-            new_value->value.b = value->value.b;
-            break;
-        case N_VALUE_TYPE_POINTER:
-            new_value->value.p = value->value.p;
-            break;
-        default:
-            n_value_free (new_value);
-            return NULL;
-    }
+    if (value->type == N_VALUE_TYPE_STRING && value->storage == N_VALUE_STRING_SHARED)
+        g_atomic_int_inc (&value->value.shared->ref);
 
     return new_value;
 }
@@ -135,7 +155,10 @@ n_value_equals (const NValue *a, const NValue *b)
 
     switch (a->type) {
         case N_VALUE_TYPE_STRING:
-            if (g_str_equal (a->value.s, b->value.s))
+            if (a->storage == N_VALUE_STRING_SHARED && b->storage == N_VALUE_STRING_SHARED &&
+                a->value.shared == b->value.shared)
+                return TRUE;
+            if (g_str_equal (value_string (a), value_string (b)))
                 return TRUE;
             break;
         case N_VALUE_TYPE_INT:
@@ -164,23 +187,45 @@ n_value_equals (const NValue *a, const NValue *b)
 void
 n_value_set_string (NValue *value, const char *in_value)
 {
+    NValueString *shared = NULL;
+    gsize         len    = 0;
+
     if (!value || !in_value)
         return;
 
-    value->type    = N_VALUE_TYPE_STRING;
-    value->value.s = g_strdup (in_value);
+    len = strlen (in_value);
+
+    if (len <= N_VALUE_INLINE_MAX) {
+        gchar buf[N_VALUE_INLINE_MAX + 1];
+
+        /* in_value may point to the current contents. */
+        memcpy (buf, in_value, len + 1);
+        n_value_clean (value);
+        memcpy (value->value.inline_s, buf, len + 1);
+        value->storage = N_VALUE_STRING_INLINE;
+    } else {
+        shared = g_malloc (sizeof (NValueString) + len + 1);
+        shared->ref = 1;
+        N_ALLOC_COUNT (N_ALLOC_VALUE, sizeof (NValueString) + len + 1);
+        memcpy (shared->str, in_value, len + 1);
+        n_value_clean (value);
+        value->value.shared = shared;
+        value->storage = N_VALUE_STRING_SHARED;
+    }
+
+    value->type = N_VALUE_TYPE_STRING;
 }
 
 const gchar*
 n_value_get_string (const NValue *value)
 {
-    return (value && value->type == N_VALUE_TYPE_STRING) ? (const char*) value->value.s : NULL;
+    return (value && value->type == N_VALUE_TYPE_STRING) ? value_string (value) : NULL;
 }
 
 gchar*
 n_value_dup_string (const NValue *value)
 {
-    return (value && value->type == N_VALUE_TYPE_STRING) ? g_strdup (value->value.s) : NULL;
+    return (value && value->type == N_VALUE_TYPE_STRING) ? g_strdup (value_string (value)) : NULL;
 }
 
 void
@@ -189,6 +234,7 @@ n_value_set_int (NValue *value, const gint in_value)
     if (!value)
         return;
 
+    n_value_clean (value);
     value->type    = N_VALUE_TYPE_INT;
     value->value.i = in_value;
 }
@@ -205,6 +251,7 @@ n_value_set_uint (NValue *value, const guint in_value)
     if (!value)
         return;
 
+    n_value_clean (value);
     value->type    = N_VALUE_TYPE_UINT;
     value->value.u = in_value;
 }
@@ -221,6 +268,7 @@ n_value_set_bool (NValue *value, const gboolean in_value)
     if (!value)
         return;
 
+    n_value_clean (value);
     value->type    = N_VALUE_TYPE_BOOL;
     value->value.b = in_value;
 }
@@ -237,6 +285,7 @@ n_value_set_pointer (NValue *value, const gpointer in_value)
     if (!value)
         return;
 
+    n_value_clean (value);
     value->type    = N_VALUE_TYPE_POINTER;
     value->value.p = in_value;
 }
@@ -257,7 +306,7 @@ n_value_to_string (const NValue *value)
 
     switch (value->type) {
         case N_VALUE_TYPE_STRING:
-            result = g_strdup_printf ("%s " N_VALUE_STR_STRING, value->value.s);
+            result = g_strdup_printf ("%s " N_VALUE_STR_STRING, value_string (value));
             break;
 
         case N_VALUE_TYPE_INT:
@@ -285,3 +334,112 @@ n_value_to_string (const NValue *value)
     return result;
 }
 
+
+static void
+value_string_unref (gpointer data)
+{
+    NValueString *shared = data;
+
+    if (g_atomic_int_dec_and_test (&shared->ref)) {
+        g_free (shared);
+        N_FREE_COUNT (N_ALLOC_VALUE);
+    }
+}
+
+NValuePool*
+n_value_pool_new ()
+{
+    NValuePool *pool = NULL;
+
+    pool = g_new0 (NValuePool, 1);
+    pool->strings = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                           value_string_unref);
+
+    return pool;
+}
+
+void
+n_value_pool_free (NValuePool *pool)
+{
+    if (!pool)
+        return;
+
+    g_hash_table_destroy (pool->strings);
+    g_free (pool);
+}
+
+gsize
+n_value_pool_intern (NValuePool *pool, NValue *value)
+{
+    NValueString *shared = NULL;
+    gsize         saved  = 0;
+
+    g_assert (pool);
+
+    if (!value || value->type != N_VALUE_TYPE_STRING || value->storage != N_VALUE_STRING_SHARED)
+        return 0;
+
+    shared = g_hash_table_lookup (pool->strings, value->value.shared->str);
+
+    if (!shared) {
+        /* first of its kind, the pool takes a reference of its own. */
+        shared = value->value.shared;
+        g_atomic_int_inc (&shared->ref);
+        g_hash_table_insert (pool->strings, shared->str, shared);
+        return 0;
+    }
+
+    if (shared == value->value.shared)
+        return 0;
+
+    if (g_atomic_int_get (&value->value.shared->ref) == 1)
+        n_value_heap_size (value, &saved, NULL);
+
+    g_atomic_int_inc (&shared->ref);
+    value_string_unref (value->value.shared);
+    value->value.shared = shared;
+
+    return saved;
+}
+
+static gboolean
+value_pool_unused_cb (gpointer key, gpointer value, gpointer userdata)
+{
+    (void) key;
+    (void) userdata;
+
+    return g_atomic_int_get (&((NValueString*) value)->ref) == 1;
+}
+
+void
+n_value_pool_prune (NValuePool *pool)
+{
+    g_assert (pool);
+
+    g_hash_table_foreach_remove (pool->strings, value_pool_unused_cb, NULL);
+}
+
+guint
+n_value_pool_size (const NValuePool *pool)
+{
+    g_assert (pool);
+
+    return g_hash_table_size (pool->strings);
+}
+
+gsize
+n_value_heap_size (const NValue *value, gsize *buffer_size, gconstpointer *buffer)
+{
+    gboolean shared = FALSE;
+
+    shared = value && value->type == N_VALUE_TYPE_STRING &&
+             value->storage == N_VALUE_STRING_SHARED;
+
+    if (buffer_size)
+        *buffer_size = shared ? sizeof (NValueString) + strlen (value->value.shared->str) + 1 : 0;
+
+    if (buffer)
+        *buffer = shared ? value->value.shared : NULL;
+
+    return value ? sizeof (NValue) : 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+#ifndef N_WAKEUP_INTERNAL_H
+#define N_WAKEUP_INTERNAL_H
+
+#include <ngf/wakeup.h>
+#include <ngf/metrics.h>
+
+/* origin of wakeups nothing was noted for */
+#define N_WAKEUP_ORIGIN_OTHER "other"
+
+void n_wakeups_enable       (NMetrics *metrics);
+void n_wakeups_disable      (void);
+void n_wakeups_set_active   (gboolean active);
+void n_wakeups_note_default (const char *origin);
+
+#endif /* N_WAKEUP_INTERNAL_H */
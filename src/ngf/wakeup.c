@@ -0,0 +1,175 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+#include <glib.h>
+#include <ngf/log.h>
+#include "wakeup-internal.h"
+
+#define LOG_CAT "wakeup: "
+
+/* The poll function of the default main context is wrapped. A wakeup
+ * is left pending when the poll returns and attributed on the next
+ * poll, once the callbacks of the iteration have had the chance to
+ * note their origin. The core sources only note a default origin, so
+ * that a plugin callback run from them still gets the wakeup. */
+
+enum
+{
+    N_WAKEUP_IDLE,
+    N_WAKEUP_ACTIVE,
+    N_WAKEUP_STATES
+};
+
+typedef struct _NWakeups
+{
+    GPollFunc      poll;                        /* wrapped poll function */
+    NMetricFamily *origins[N_WAKEUP_STATES];
+    NMetricGauge  *rates[N_WAKEUP_STATES];
+    guint64        count[N_WAKEUP_STATES];
+    gint64         time[N_WAKEUP_STATES];       /* usec spent in the state */
+    gint64         since;                       /* start of the current state */
+    int            state;
+    gboolean       pending;                     /* wakeup not attributed yet */
+    int            pending_state;
+    const char    *origin;
+    const char    *default_origin;
+} NWakeups;
+
+static void n_wakeups_update_rates (NWakeups *wakeups);
+static void n_wakeups_flush        (NWakeups *wakeups);
+static gint n_wakeups_poll         (GPollFD *fds, guint nfds, gint timeout);
+
+static NWakeups *_wakeups = NULL;
+
+static void
+n_wakeups_update_rates (NWakeups *wakeups)
+{
+    gint64 now = g_get_monotonic_time ();
+    int    i;
+
+    wakeups->time[wakeups->state] += now - wakeups->since;
+    wakeups->since = now;
+
+    for (i = 0; i < N_WAKEUP_STATES; i++) {
+        if (wakeups->time[i] > 0)
+            n_metric_gauge_set (wakeups->rates[i],
+                wakeups->count[i] * 1000 * G_USEC_PER_SEC / wakeups->time[i]);
+    }
+}
+
+static void
+n_wakeups_flush (NWakeups *wakeups)
+{
+    const char *origin = wakeups->origin;
+
+    if (!wakeups->pending)
+        return;
+
+    if (!origin)
+        origin = wakeups->default_origin ? wakeups->default_origin : N_WAKEUP_ORIGIN_OTHER;
+
+    n_metric_family_inc (wakeups->origins[wakeups->pending_state], origin);
+    wakeups->count[wakeups->pending_state]++;
+    n_wakeups_update_rates (wakeups);
+
+    wakeups->pending        = FALSE;
+    wakeups->origin         = NULL;
+    wakeups->default_origin = NULL;
+}
+
+static gint
+n_wakeups_poll (GPollFD *fds, guint nfds, gint timeout)
+{
+    NWakeups *wakeups = _wakeups;
+    gint      result;
+
+    n_wakeups_flush (wakeups);
+
+    result = wakeups->poll (fds, nfds, timeout);
+
+    /* a poll that was not allowed to sleep did not wake anything up */
+    if (timeout != 0 && result >= 0) {
+        wakeups->pending       = TRUE;
+        wakeups->pending_state = wakeups->state;
+    }
+
+    return result;
+}
+
+void
+n_wakeups_enable (NMetrics *metrics)
+{
+    NWakeups *wakeups = NULL;
+
+    if (_wakeups)
+        return;
+
+    wakeups = g_new0 (NWakeups, 1);
+    wakeups->origins[N_WAKEUP_IDLE]   = n_metrics_add_family (metrics, "wakeups.idle");
+    wakeups->origins[N_WAKEUP_ACTIVE] = n_metrics_add_family (metrics, "wakeups.active");
+    wakeups->rates[N_WAKEUP_IDLE]     = n_metrics_add_gauge (metrics, "wakeups.idle_rate");
+    wakeups->rates[N_WAKEUP_ACTIVE]   = n_metrics_add_gauge (metrics, "wakeups.active_rate");
+    wakeups->state = N_WAKEUP_IDLE;
+    wakeups->since = g_get_monotonic_time ();
+    wakeups->poll  = g_main_context_get_poll_func (NULL);
+
+    _wakeups = wakeups;
+    g_main_context_set_poll_func (NULL, n_wakeups_poll);
+
+    N_INFO (LOG_CAT "main loop wakeups are counted");
+}
+
+void
+n_wakeups_disable (void)
+{
+    if (!_wakeups)
+        return;
+
+    g_main_context_set_poll_func (NULL, _wakeups->poll);
+    g_free (_wakeups);
+    _wakeups = NULL;
+}
+
+void
+n_wakeups_set_active (gboolean active)
+{
+    int state = active ? N_WAKEUP_ACTIVE : N_WAKEUP_IDLE;
+
+    if (!_wakeups || _wakeups->state == state)
+        return;
+
+    n_wakeups_update_rates (_wakeups);
+    _wakeups->state = state;
+}
+
+void
+n_wakeups_note_default (const char *origin)
+{
+    if (_wakeups && _wakeups->pending && !_wakeups->default_origin)
+        _wakeups->default_origin = origin;
+}
+
+void
+n_wakeup_note (const char *origin)
+{
+    if (_wakeups && _wakeups->pending && !_wakeups->origin)
+        _wakeups->origin = origin;
+}
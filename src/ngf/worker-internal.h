@@ -0,0 +1,35 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_WORKER_INTERNAL_H
+#define N_WORKER_INTERNAL_H
+
+#include <ngf/worker.h>
+
+/* threads started for the jobs, more jobs wait for a free thread */
+#define N_WORKERS_DEFAULT_THREADS (2)
+
+NWorkers* n_workers_new             (guint max_threads);
+void      n_workers_free            (NWorkers *workers);
+void      n_workers_set_max_threads (NWorkers *workers, guint max_threads);
+guint     n_workers_size            (NWorkers *workers);
+gboolean  n_workers_running         (NWorkers *workers, guint id);
+
+#endif /* N_WORKER_INTERNAL_H */
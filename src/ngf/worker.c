@@ -0,0 +1,296 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <glib.h>
+#include <ngf/log.h>
+#include "worker-internal.h"
+#include "wakeup-internal.h"
+
+#define LOG_CAT "worker: "
+
+/* The jobs run in a GThreadPool. A finished job is queued back to the
+ * main loop, where a single source dispatches the done callbacks. The
+ * job state is shared with the threads under the lock, the table of
+ * jobs is only used on the main loop. */
+
+typedef enum _NWorkerState
+{
+    N_WORKER_STATE_QUEUED = 0,
+    N_WORKER_STATE_RUNNING,
+    N_WORKER_STATE_FINISHED
+} NWorkerState;
+
+typedef struct _NWorkerJob
+{
+    guint            id;
+    NWorkerFunc      func;
+    NWorkerDoneFunc  done;
+    gpointer         userdata;
+    GDestroyNotify   free_func;
+    NWorkerState     state;
+    gboolean         cancelled;     /* data freed, job struct left to its holder */
+} NWorkerJob;
+
+struct _NWorkers
+{
+    GThreadPool *pool;
+    GSource     *source;            /* dispatches finished jobs */
+    GMutex       lock;
+    GCond        cond;              /* signaled when a cancelled job returns */
+    GQueue       finished;          /* NWorkerJob, under the lock */
+    GHashTable  *jobs;               /* key:id value:NWorkerJob */
+    guint        next_id;
+};
+
+static void     n_workers_run_cb      (gpointer data, gpointer userdata);
+static gboolean n_workers_dispatch_cb (GSource *source, GSourceFunc callback,
+                                       gpointer userdata);
+
+static GSourceFuncs workers_source_funcs = {
+    .dispatch = n_workers_dispatch_cb
+};
+
+static void
+n_workers_run_cb (gpointer data, gpointer userdata)
+{
+    NWorkers   *workers = userdata;
+    NWorkerJob *job     = data;
+
+    g_mutex_lock (&workers->lock);
+    if (job->cancelled) {
+        g_mutex_unlock (&workers->lock);
+        g_slice_free (NWorkerJob, job);
+        return;
+    }
+    job->state = N_WORKER_STATE_RUNNING;
+    g_mutex_unlock (&workers->lock);
+
+    job->func (job->userdata);
+
+    g_mutex_lock (&workers->lock);
+    job->state = N_WORKER_STATE_FINISHED;
+    if (job->cancelled)
+        g_cond_broadcast (&workers->cond);
+    else {
+        g_queue_push_tail (&workers->finished, job);
+        g_source_set_ready_time (workers->source, 0);
+    }
+    g_mutex_unlock (&workers->lock);
+}
+
+static gboolean
+n_workers_dispatch_cb (GSource *source, GSourceFunc callback, gpointer userdata)
+{
+    NWorkers   *workers = userdata;
+    NWorkerJob *job     = NULL;
+
+    (void) callback;
+
+    n_wakeups_note_default ("workers");
+    g_source_set_ready_time (source, -1);
+
+    /* one at a time, the callbacks may cancel the jobs still queued */
+    for (;;) {
+        g_mutex_lock (&workers->lock);
+        job = g_queue_pop_head (&workers->finished);
+        g_mutex_unlock (&workers->lock);
+
+        if (!job)
+            break;
+
+        if (!job->cancelled) {
+            g_hash_table_remove (workers->jobs, GUINT_TO_POINTER (job->id));
+            if (job->done)
+                job->done (job->userdata);
+            if (job->free_func)
+                job->free_func (job->userdata);
+        }
+
+        g_slice_free (NWorkerJob, job);
+    }
+
+    return TRUE;
+}
+
+NWorkers*
+n_workers_new (guint max_threads)
+{
+    NWorkers *workers = NULL;
+    GError   *error   = NULL;
+
+    workers = g_new0 (NWorkers, 1);
+    g_mutex_init (&workers->lock);
+    g_cond_init (&workers->cond);
+    g_queue_init (&workers->finished);
+    workers->jobs = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    workers->pool = g_thread_pool_new (n_workers_run_cb, workers,
+        max_threads > 0 ? (gint) max_threads : N_WORKERS_DEFAULT_THREADS, FALSE, &error);
+    if (!workers->pool) {
+        N_ERROR (LOG_CAT "unable to create the worker threads: %s", error->message);
+        g_error_free (error);
+    }
+
+    return workers;
+}
+
+static void
+n_workers_cancel_job (NWorkers *workers, NWorkerJob *job)
+{
+    gboolean running = FALSE;
+
+    g_mutex_lock (&workers->lock);
+    job->cancelled = TRUE;
+    while (job->state == N_WORKER_STATE_RUNNING) {
+        running = TRUE;
+        g_cond_wait (&workers->cond, &workers->lock);
+    }
+    g_mutex_unlock (&workers->lock);
+
+    if (job->free_func)
+        job->free_func (job->userdata);
+
+    /* a queued job is freed by its thread, a finished one by the
+       dispatch. */
+    if (running)
+        g_slice_free (NWorkerJob, job);
+}
+
+void
+n_workers_free (NWorkers *workers)
+{
+    GHashTableIter  iter;
+    gpointer        value;
+    NWorkerJob     *job = NULL;
+
+    if (!workers)
+        return;
+
+    if (g_hash_table_size (workers->jobs) > 0)
+        N_DEBUG (LOG_CAT "cancelling %u pending jobs", g_hash_table_size (workers->jobs));
+
+    g_hash_table_iter_init (&iter, workers->jobs);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        g_hash_table_iter_remove (&iter);
+        n_workers_cancel_job (workers, value);
+    }
+
+    /* the threads drop the cancelled jobs left in the pool */
+    if (workers->pool)
+        g_thread_pool_free (workers->pool, FALSE, TRUE);
+
+    while ((job = g_queue_pop_head (&workers->finished)))
+        g_slice_free (NWorkerJob, job);
+
+    if (workers->source) {
+        g_source_destroy (workers->source);
+        g_source_unref (workers->source);
+    }
+    g_hash_table_destroy (workers->jobs);
+    g_mutex_clear (&workers->lock);
+    g_cond_clear (&workers->cond);
+    g_free (workers);
+}
+
+void
+n_workers_set_max_threads (NWorkers *workers, guint max_threads)
+{
+    g_assert (workers != NULL);
+
+    if (workers->pool && max_threads > 0)
+        g_thread_pool_set_max_threads (workers->pool, max_threads, NULL);
+}
+
+guint
+n_workers_size (NWorkers *workers)
+{
+    return workers ? g_hash_table_size (workers->jobs) : 0;
+}
+
+gboolean
+n_workers_running (NWorkers *workers, guint id)
+{
+    NWorkerJob *job     = NULL;
+    gboolean    running = FALSE;
+
+    g_assert (workers != NULL);
+
+    if (!(job = g_hash_table_lookup (workers->jobs, GUINT_TO_POINTER (id))))
+        return FALSE;
+
+    g_mutex_lock (&workers->lock);
+    running = job->state == N_WORKER_STATE_RUNNING;
+    g_mutex_unlock (&workers->lock);
+
+    return running;
+}
+
+guint
+n_workers_submit (NWorkers *workers, NWorkerFunc func, NWorkerDoneFunc done,
+                  gpointer userdata, GDestroyNotify free_func)
+{
+    NWorkerJob *job = NULL;
+
+    g_assert (workers != NULL);
+    g_assert (func != NULL);
+
+    /* attached when first needed */
+    if (!workers->source) {
+        workers->source = g_source_new (&workers_source_funcs, sizeof (GSource));
+        g_source_set_callback (workers->source, NULL, workers, NULL);
+        g_source_set_ready_time (workers->source, -1);
+        g_source_attach (workers->source, NULL);
+    }
+
+    job = g_slice_new0 (NWorkerJob);
+    job->func      = func;
+    job->done      = done;
+    job->userdata  = userdata;
+    job->free_func = free_func;
+
+    do {
+        job->id = ++workers->next_id;
+    } while (job->id == 0 || g_hash_table_contains (workers->jobs, GUINT_TO_POINTER (job->id)));
+
+    g_hash_table_insert (workers->jobs, GUINT_TO_POINTER (job->id), job);
+
+    /* without threads the job runs right away, the result is still
+       delivered from the main loop. */
+    if (!workers->pool || !g_thread_pool_push (workers->pool, job, NULL))
+        n_workers_run_cb (job, workers);
+
+    return job->id;
+}
+
+gboolean
+n_workers_cancel (NWorkers *workers, guint id)
+{
+    NWorkerJob *job = NULL;
+
+    g_assert (workers != NULL);
+
+    if (!(job = g_hash_table_lookup (workers->jobs, GUINT_TO_POINTER (id))))
+        return FALSE;
+
+    g_hash_table_remove (workers->jobs, GUINT_TO_POINTER (id));
+    n_workers_cancel_job (workers, job);
+
+    return TRUE;
+}
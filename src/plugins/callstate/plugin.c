@@ -27,6 +27,8 @@
 
 #define LOG_CAT "callstate: "
 #define CALL_STATE_KEY "call_state.mode"
+#define PREWARM_EVENT_KEY "prewarm_event"
+#define DEFAULT_PREWARM_EVENT "ringtone"
 
 N_PLUGIN_NAME        ("callstate")
 N_PLUGIN_VERSION     ("0.2")
@@ -34,14 +36,15 @@ N_PLUGIN_DESCRIPTION ("Call state tracking plugin")
 
 typedef struct NCallState {
     bool        active;
+    bool        ringing;
+    NCore      *core;
     NContext   *context;
+    gchar      *prewarm_event;  /* event hinted to the sinks on incoming call */
 } NCallState;
 
 static void
 update_context_call_state (NCallState *callstate, const char *value)
 {
-    NValue *v;
-
     if (callstate->active && (!g_strcmp0 (value, "ringing") || !g_strcmp0 (value, "active"))) {
         /* When new call is incoming while there is an active call,
          * MCE call state changes to ringing. For our purposes this
@@ -51,9 +54,19 @@ update_context_call_state (NCallState *callstate, const char *value)
     }
 
     callstate->active = !g_strcmp0 (value, "active");
-    v = n_value_new ();
-    n_value_set_string (v, value);
-    n_context_set_value (callstate->context, CALL_STATE_KEY, v);
+    (void) n_context_set_string_if_changed (callstate->context, CALL_STATE_KEY, value);
+
+    /* the ringtone request follows an incoming call right away, let the
+       sinks get ready for it with the new call state in the context. */
+    if (!g_strcmp0 (value, "ringing")) {
+        if (!callstate->ringing && callstate->prewarm_event) {
+            N_DEBUG (LOG_CAT "incoming call, prewarming '%s'", callstate->prewarm_event);
+            n_core_prewarm_event (callstate->core, callstate->prewarm_event, NULL);
+        }
+        callstate->ringing = true;
+    }
+    else
+        callstate->ringing = false;
 }
 
 static void
@@ -105,6 +118,7 @@ N_PLUGIN_LOAD (plugin)
     NCore      *core;
     NContext   *context;
     NCallState *callstate;
+    const char *value;
 
     core = n_plugin_get_core (plugin);
     g_assert (core);
@@ -113,8 +127,21 @@ N_PLUGIN_LOAD (plugin)
     g_assert (context);
 
     callstate = g_new0 (NCallState, 1);
+    callstate->core = core;
     callstate->context = context;
 
+    /* an empty prewarm_event disables the hint */
+    value = n_proplist_get_string (n_plugin_get_params (plugin), PREWARM_EVENT_KEY);
+    if (!value)
+        value = DEFAULT_PREWARM_EVENT;
+    if (*value)
+        callstate->prewarm_event = g_strdup (value);
+
+    /* last known state until the call state query is answered. */
+    if (n_context_restore_value (context, CALL_STATE_KEY))
+        callstate->active = !g_strcmp0 (n_value_get_string (
+            n_context_get_value (context, CALL_STATE_KEY)), "active");
+
     if (n_dbus_add_match (core, filter_cb, callstate, DBUS_BUS_SYSTEM,
                           MCE_SIGNAL_IF,
                           MCE_SIGNAL_PATH,
@@ -137,10 +164,13 @@ N_PLUGIN_LOAD (plugin)
 
 N_PLUGIN_UNLOAD (plugin)
 {
-    NCore    *core;
+    NCore      *core;
+    NCallState *callstate;
 
     core = n_plugin_get_core (plugin);
     n_dbus_remove_match_by_cb (core, filter_cb);
 
-    g_free (n_plugin_get_userdata (plugin));
+    callstate = n_plugin_get_userdata (plugin);
+    g_free (callstate->prewarm_event);
+    g_free (callstate);
 }
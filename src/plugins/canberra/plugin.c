@@ -19,8 +19,12 @@
  */
 
 #include <ngf/plugin.h>
+#include <ngf/timer.h>
+#include <ngf/worker.h>
+#include <ngf/wakeup.h>
 #include <canberra.h>
 
+#include <stdlib.h>
 #include <string.h>
 
 #define STREAM_PREFIX_KEY "sound.stream."
@@ -29,6 +33,19 @@
 #define SOUND_FILENAME_KEY "canberra.filename"
 #define SOUND_VOLUME_KEY "sound.volume"
 
+#define THEME_KEY "theme"
+#define PRELOAD_KEY "preload"
+#define CACHE_SIZE_KEY "cache_size"
+#define COMPLETE_TIMEOUT_KEY "complete_timeout"
+#define DEFAULT_THEME "jolla-ambient"
+#define DEFAULT_CACHE_SIZE (32)             /* samples */
+#define DEFAULT_COMPLETE_TIMEOUT (30000)    /* ms */
+
+/* setup latency hints for routing against the other audio sinks, us */
+#define COST_CACHED_US      (5000)      /* sample played by the server */
+#define COST_FILE_US        (30000)     /* sample read from the file */
+#define COST_CONNECT_US     (60000)     /* same after connecting */
+
 typedef struct _CanberraData
 {
     NRequest       *request;
@@ -36,21 +53,71 @@ typedef struct _CanberraData
     const gchar    *filename;
     gboolean        sound_enabled;
     guint           complete_cb_id;
+    guint32         play_id;        /* canberra id of the playing sample, 0 if none */
 } CanberraData;
 
+/* Finished playback, passed from the canberra thread to the main loop. */
+typedef struct _CanberraFinish
+{
+    guint32 play_id;
+    int     error;
+} CanberraFinish;
+
 N_PLUGIN_NAME        ("canberra")
 N_PLUGIN_VERSION     ("0.1")
 N_PLUGIN_DESCRIPTION ("libcanberra plugin")
 
 typedef struct sink_userdata {
     ca_context *c_context;
-    GHashTable *cached_samples;
+    GHashTable *cached_samples;         /* sample -> GList link in cache_lru */
+    GQueue      cache_lru;              /* lazily cached samples, most recent first */
     gboolean    support_cached_samples;
+    GHashTable *caching;                /* sample -> worker job caching it */
+    NWorkers   *workers;
+    GMutex      cache_lock;             /* serializes the jobs using cache_context */
+    ca_context *cache_context;          /* used only by the cache jobs */
+    GHashTable *playing;                /* play id -> CanberraData */
+    guint32     next_play_id;
 } sink_userdata;
 
+/* Uploading a sample to the server blocks until it is loaded, so it is
+ * done in a worker thread. libcanberra contexts are not thread safe,
+ * the jobs have a context of their own for the uploads. */
+typedef struct _CanberraCacheJob
+{
+    sink_userdata *u;
+    gchar         *sample;
+    const char    *cache_control;
+    int            error;
+} CanberraCacheJob;
+
+static gchar  *canberra_theme = NULL;
+static gchar **canberra_preload = NULL;
+static guint   canberra_cache_size = DEFAULT_CACHE_SIZE;
+static guint   canberra_complete_timeout = DEFAULT_COMPLETE_TIMEOUT;
+
+/* sink data for the finish callbacks, NULL once the sink is shut down */
+static sink_userdata *canberra_sink = NULL;
+
+static void canberra_preload_samples (sink_userdata *u);
 
 static void canberra_disconnect (sink_userdata *u)
 {
+    GHashTableIter iter;
+    gpointer       job_id;
+
+    /* the jobs use the context, wait for the one running */
+    g_hash_table_iter_init (&iter, u->caching);
+    while (g_hash_table_iter_next (&iter, NULL, &job_id))
+        n_workers_cancel (u->workers, GPOINTER_TO_UINT (job_id));
+    g_hash_table_remove_all (u->caching);
+
+    /* no job is running anymore */
+    if (u->cache_context) {
+        ca_context_destroy (u->cache_context);
+        u->cache_context = NULL;
+    }
+
     if (u->c_context) {
         ca_context_destroy (u->c_context);
         u->c_context = NULL;
@@ -64,7 +131,9 @@ static int canberra_connect (sink_userdata *u)
     if (u->c_context)
         return TRUE;
 
+    /* the samples are cached to the server of the previous context */
     g_hash_table_remove_all (u->cached_samples);
+    g_queue_clear (&u->cache_lru);
     ca_context_create (&u->c_context);
     error = ca_context_open (u->c_context);
     if (error) {
@@ -74,9 +143,147 @@ static int canberra_connect (sink_userdata *u)
         return FALSE;
     }
 
+    canberra_preload_samples (u);
+
     return TRUE;
 }
 
+static void
+canberra_cache_job_free (CanberraCacheJob *job)
+{
+    g_free (job->sample);
+    g_slice_free (CanberraCacheJob, job);
+}
+
+static void
+canberra_cache_job_cb (gpointer userdata)
+{
+    CanberraCacheJob *job      = userdata;
+    sink_userdata    *u        = job->u;
+    ca_proplist      *ca_props = NULL;
+
+    g_mutex_lock (&u->cache_lock);
+
+    if (!u->cache_context) {
+        ca_context_create (&u->cache_context);
+        job->error = ca_context_open (u->cache_context);
+        if (job->error != CA_SUCCESS) {
+            ca_context_destroy (u->cache_context);
+            u->cache_context = NULL;
+            goto done;
+        }
+    }
+
+    ca_proplist_create (&ca_props);
+    ca_proplist_sets (ca_props, CA_PROP_CANBERRA_XDG_THEME_NAME, canberra_theme);
+    ca_proplist_sets (ca_props, CA_PROP_EVENT_ID, job->sample);
+    ca_proplist_sets (ca_props, CA_PROP_CANBERRA_CACHE_CONTROL, job->cache_control);
+
+    job->error = ca_context_cache_full (u->cache_context, ca_props);
+    ca_proplist_destroy (ca_props);
+
+done:
+    g_mutex_unlock (&u->cache_lock);
+}
+
+static void
+canberra_cache_done_cb (gpointer userdata)
+{
+    CanberraCacheJob *job   = userdata;
+    sink_userdata    *u     = job->u;
+    gchar            *key   = NULL;
+
+    g_hash_table_remove (u->caching, job->sample);
+
+    if (job->error == CA_ERROR_NOTSUPPORTED) {
+        N_WARNING (LOG_CAT "sample caching not supported by backend. disabling for the duration of plugin.");
+        u->support_cached_samples = FALSE;
+        return;
+    } else if (job->error != CA_SUCCESS) {
+        N_WARNING (LOG_CAT "canberra couldn't cache sample %s (%d: %s)", job->sample,
+            -job->error, ca_strerror (job->error));
+        return;
+    }
+
+    N_DEBUG (LOG_CAT "cached sample %s (%s)", job->sample, job->cache_control);
+
+    /* preloaded samples stay in the server, they are not part of the LRU */
+    if (g_str_equal (job->cache_control, "permanent")) {
+        g_hash_table_replace (u->cached_samples, g_strdup (job->sample), NULL);
+        return;
+    }
+
+    while (canberra_cache_size > 0 &&
+           g_queue_get_length (&u->cache_lru) >= canberra_cache_size) {
+        key = g_queue_pop_tail (&u->cache_lru);
+        N_DEBUG (LOG_CAT "evicting sample %s", key);
+        g_hash_table_remove (u->cached_samples, key);
+    }
+
+    key = g_strdup (job->sample);
+    g_queue_push_head (&u->cache_lru, key);
+    g_hash_table_insert (u->cached_samples, key, g_queue_peek_head_link (&u->cache_lru));
+}
+
+static void
+canberra_cache_sample (sink_userdata *u, const char *sample, const char *cache_control)
+{
+    CanberraCacheJob *job = NULL;
+
+    if (g_hash_table_contains (u->caching, sample))
+        return;
+
+    job = g_slice_new0 (CanberraCacheJob);
+    job->u             = u;
+    job->sample        = g_strdup (sample);
+    job->cache_control = cache_control;
+
+    N_DEBUG (LOG_CAT "caching sample %s (%s)", sample, cache_control);
+    g_hash_table_insert (u->caching, g_strdup (sample), GUINT_TO_POINTER (
+        n_workers_submit (u->workers, canberra_cache_job_cb, canberra_cache_done_cb,
+                          job, (GDestroyNotify) canberra_cache_job_free)));
+}
+
+static void
+canberra_preload_samples (sink_userdata *u)
+{
+    gchar **sample = NULL;
+
+    if (!canberra_preload)
+        return;
+
+    for (sample = canberra_preload; *sample && u->support_cached_samples; ++sample) {
+        if (**sample == '\0' || g_hash_table_contains (u->cached_samples, *sample))
+            continue;
+
+        canberra_cache_sample (u, *sample, "permanent");
+    }
+}
+
+/* Have the sample cached for the following plays. The first play of a
+ * sample not cached yet is not held up by the upload, it is played from
+ * the file while the sample is cached. */
+static void
+canberra_ensure_cached (sink_userdata *u, const char *sample)
+{
+    GList *link = NULL;
+
+    if (g_hash_table_lookup_extended (u->cached_samples, sample, NULL, (gpointer*) &link)) {
+        /* move lazily cached samples to the front, preloaded have no link */
+        if (link) {
+            g_queue_unlink (&u->cache_lru, link);
+            g_queue_push_head_link (&u->cache_lru, link);
+        }
+        return;
+    }
+
+    /* The server keeps the samples it was asked to cache, libcanberra has
+     * no call to drop a single one. Lazily cached samples are therefore
+     * volatile, which lets the server drop them. Only cache_size of them
+     * are tracked, an evicted sample is cached again on its next play. */
+    canberra_cache_sample (u, sample, "volatile");
+}
+
 static int
 canberra_sink_initialize (NSinkInterface *iface)
 {
@@ -86,12 +293,19 @@ canberra_sink_initialize (NSinkInterface *iface)
 
     u = g_new0 (sink_userdata, 1);
 
-    /* Only provide free function for key, since both key and value are same
-     * string. */
+    /* The value is the link of the key in cache_lru, the key is freed by
+     * the table. */
     u->cached_samples = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_queue_init (&u->cache_lru);
     u->support_cached_samples = TRUE;
+    u->caching = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    u->workers = n_core_get_workers (n_sink_interface_get_core (iface));
+    g_mutex_init (&u->cache_lock);
+    u->playing = g_hash_table_new (g_direct_hash, g_direct_equal);
+    canberra_sink = u;
     canberra_connect (u);
     n_sink_interface_set_userdata (iface, u);
+    n_sink_interface_add_plan_key (iface, SOUND_FILENAME_KEY, FALSE);
     return TRUE;
 }
 
@@ -103,9 +317,14 @@ canberra_sink_shutdown (NSinkInterface *iface)
     N_DEBUG (LOG_CAT "sink shutdown");
 
     if (u) {
+        canberra_sink = NULL;
         canberra_disconnect (u);
+        g_queue_clear (&u->cache_lru);
         if (u->cached_samples)
             g_hash_table_destroy (u->cached_samples);
+        g_hash_table_destroy (u->caching);
+        g_hash_table_destroy (u->playing);
+        g_mutex_clear (&u->cache_lock);
         g_free (u);
     }
 }
@@ -126,12 +345,36 @@ canberra_sink_can_handle (NSinkInterface *iface, NRequest *request)
     return FALSE;
 }
 
+static int
+canberra_sink_cost (NSinkInterface *iface, NRequest *request, NSinkCost *cost)
+{
+    sink_userdata   *u     = n_sink_interface_get_userdata (iface);
+    const NProplist *props = n_request_get_properties (request);
+    const char      *sample;
+
+    if (!u || !(sample = n_proplist_get_string (props, SOUND_FILENAME_KEY)))
+        return FALSE;
+
+    /* samples are neither faded nor repeated */
+    cost->can_fade = FALSE;
+    cost->can_loop = FALSE;
+    cost->cached   = u->c_context && u->support_cached_samples &&
+                     g_hash_table_contains (u->cached_samples, sample);
+
+    if (cost->cached)
+        cost->setup_us = COST_CACHED_US;
+    else
+        cost->setup_us = u->c_context ? COST_FILE_US : COST_CONNECT_US;
+
+    return TRUE;
+}
+
 static int
 canberra_sink_prepare (NSinkInterface *iface, NRequest *request)
 {
     N_DEBUG (LOG_CAT "sink prepare");
 
-    CanberraData *data = g_slice_new0 (CanberraData);
+    CanberraData *data = n_request_alloc (request, sizeof (CanberraData));
     NProplist *props = props = (NProplist*) n_request_get_properties (request);
 
     data->request    = request;
@@ -167,16 +410,80 @@ proplist_to_structure_cb (const char *key, const NValue *value, gpointer userdat
     ca_proplist_sets (target, prop_key, prop_value);
 }
 
+static void
+canberra_forget_play (CanberraData *data)
+{
+    sink_userdata *u = n_sink_interface_get_userdata (data->iface);
+
+    if (data->complete_cb_id > 0) {
+        n_timers_remove (n_core_get_timers (n_sink_interface_get_core (data->iface)),
+                         data->complete_cb_id);
+        data->complete_cb_id = 0;
+    }
+
+    if (data->play_id > 0) {
+        g_hash_table_remove (u->playing, GUINT_TO_POINTER (data->play_id));
+        data->play_id = 0;
+    }
+}
+
 static gboolean
 canberra_complete_cb (gpointer userdata) {
     CanberraData *data = userdata;
 
+    n_wakeup_note ("canberra.complete");
     data->complete_cb_id = 0;
+
+    if (data->play_id > 0)
+        N_WARNING (LOG_CAT "no completion for %s, assuming it is done", data->filename);
+
+    canberra_forget_play (data);
     n_sink_interface_complete (data->iface, data->request);
 
     return FALSE;
 }
 
+static gboolean
+canberra_finished_cb (gpointer userdata)
+{
+    CanberraFinish *finish = userdata;
+    CanberraData   *data   = NULL;
+
+    n_wakeup_note ("canberra.complete");
+
+    /* the request may have been stopped while the notification was queued */
+    if (canberra_sink &&
+        (data = g_hash_table_lookup (canberra_sink->playing, GUINT_TO_POINTER (finish->play_id)))) {
+        canberra_forget_play (data);
+
+        if (finish->error == CA_SUCCESS || finish->error == CA_ERROR_CANCELED)
+            n_sink_interface_complete (data->iface, data->request);
+        else {
+            N_WARNING (LOG_CAT "playing %s failed: %s", data->filename, ca_strerror (finish->error));
+            n_sink_interface_fail (data->iface, data->request);
+        }
+    }
+
+    g_slice_free (CanberraFinish, finish);
+
+    return FALSE;
+}
+
+static void
+canberra_finish_cb (ca_context *c, uint32_t id, int error_code, void *userdata)
+{
+    CanberraFinish *finish = NULL;
+
+    (void) c;
+    (void) userdata;
+
+    /* called from the canberra backend thread */
+    finish = g_slice_new (CanberraFinish);
+    finish->play_id = id;
+    finish->error = error_code;
+    g_idle_add (canberra_finished_cb, finish);
+}
+
 static int
 canberra_sink_play (NSinkInterface *iface, NRequest *request)
 {
@@ -200,47 +507,46 @@ canberra_sink_play (NSinkInterface *iface, NRequest *request)
     if (canberra_connect (u) == FALSE)
         return FALSE;
 
+    if (u->support_cached_samples)
+        canberra_ensure_cached (u, data->filename);
+
     props = n_request_get_properties (request);
     ca_proplist_create (&ca_props);
 
-    /* TODO: don't hardcode */
-    ca_proplist_sets (ca_props, CA_PROP_CANBERRA_XDG_THEME_NAME, "jolla-ambient");
+    ca_proplist_sets (ca_props, CA_PROP_CANBERRA_XDG_THEME_NAME, canberra_theme);
     ca_proplist_sets (ca_props, CA_PROP_EVENT_ID, data->filename);
-    if (u->support_cached_samples)
-        ca_proplist_sets (ca_props, CA_PROP_CANBERRA_CACHE_CONTROL, "permanent");
-
-    if (u->support_cached_samples && !g_hash_table_contains(u->cached_samples, data->filename)) {
-        N_DEBUG (LOG_CAT "caching sample %s", data->filename);
-        error = ca_context_cache_full (u->c_context, ca_props);
-        if (error == CA_ERROR_NOTSUPPORTED) {
-            N_WARNING (LOG_CAT "sample caching not supported by backend. disabling for the duration of plugin.");
-            u->support_cached_samples = FALSE;
-        } else if (error != CA_SUCCESS) {
-            N_WARNING (LOG_CAT "canberra couldn't cache sample %s (%d: %s)", data->filename, -error, ca_strerror(error));
-            ca_proplist_destroy (ca_props);
-            canberra_disconnect (u);
-            return FALSE;
-        } else
-            g_hash_table_add (u->cached_samples, g_strdup(data->filename));
-    }
 
     /* convert all properties within the request that begin with
        "sound.stream." prefix. */
     n_proplist_foreach (props, proplist_to_structure_cb, ca_props);
 
-    error = ca_context_play_full (u->c_context, 0, ca_props, NULL, NULL);
+    /* play ids are never 0, 0 marks a request without playback */
+    if (++u->next_play_id == 0)
+        ++u->next_play_id;
+    data->play_id = u->next_play_id;
+    g_hash_table_insert (u->playing, GUINT_TO_POINTER (data->play_id), data);
+
+    error = ca_context_play_full (u->c_context, data->play_id, ca_props,
+                                  canberra_finish_cb, NULL);
     ca_proplist_destroy (ca_props);
 
     if (error != CA_SUCCESS) {
         N_WARNING (LOG_CAT "sink play had a warning: %s", ca_strerror (error));
+        canberra_forget_play (data);
         canberra_disconnect (u);
         return FALSE;
     }
 
+    /* completed by the finish callback, the timeout only guards against
+       a backend that never reports it. */
+    data->complete_cb_id = n_timers_add (n_core_get_timers (n_sink_interface_get_core (iface)),
+                                         canberra_complete_timeout, canberra_complete_cb, data);
+
+    return TRUE;
+
 complete:
-    /* We do not know how long our samples play, but let's guess we
-     * are done in 200ms. */
-    data->complete_cb_id = g_timeout_add (200, canberra_complete_cb, data);
+    data->complete_cb_id = n_timers_add (n_core_get_timers (n_sink_interface_get_core (iface)),
+                                         0, canberra_complete_cb, data);
 
     return TRUE;
 }
@@ -250,15 +556,14 @@ canberra_sink_stop (NSinkInterface *iface, NRequest *request)
 {
     N_DEBUG (LOG_CAT "sink stop");
 
-    (void) iface;
-
-    CanberraData *data = (CanberraData*) n_request_get_data (request, CANBERRA_KEY);
+    sink_userdata *u    = n_sink_interface_get_userdata (iface);
+    CanberraData  *data = (CanberraData*) n_request_get_data (request, CANBERRA_KEY);
     g_assert (data != NULL);
 
-    if (data->complete_cb_id > 0)
-        g_source_remove (data->complete_cb_id);
+    if (data->play_id > 0 && u->c_context)
+        (void) ca_context_cancel (u->c_context, data->play_id);
 
-    g_slice_free (CanberraData, data);
+    canberra_forget_play (data);
 }
 
 N_PLUGIN_LOAD (plugin)
@@ -274,11 +579,25 @@ N_PLUGIN_LOAD (plugin)
         .prepare    = canberra_sink_prepare,
         .play       = canberra_sink_play,
         .pause      = NULL,
-        .stop       = canberra_sink_stop
+        .stop       = canberra_sink_stop,
+        .cost       = canberra_sink_cost
     };
 
+    const NProplist *params = NULL;
+    const char      *value  = NULL;
+
     n_plugin_register_sink (plugin, &decl);
 
+    params = n_plugin_get_params (plugin);
+    canberra_theme = g_strdup ((value = n_proplist_get_string (params, THEME_KEY)) ?
+                               value : DEFAULT_THEME);
+    if ((value = n_proplist_get_string (params, PRELOAD_KEY)))
+        canberra_preload = g_strsplit (value, ";", -1);
+    if ((value = n_proplist_get_string (params, CACHE_SIZE_KEY)))
+        canberra_cache_size = atoi (value);
+    if ((value = n_proplist_get_string (params, COMPLETE_TIMEOUT_KEY)))
+        canberra_complete_timeout = atoi (value);
+
     return TRUE;
 }
 
@@ -287,4 +606,9 @@ N_PLUGIN_UNLOAD (plugin)
     (void) plugin;
 
     N_DEBUG (LOG_CAT "plugin unload");
+
+    g_free (canberra_theme);
+    canberra_theme = NULL;
+    g_strfreev (canberra_preload);
+    canberra_preload = NULL;
 }
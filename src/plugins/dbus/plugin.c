@@ -23,7 +23,10 @@
 #include <dbus/dbus.h>
 #include <dbus-gmain/dbus-gmain.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <ngf/log.h>
 #include <ngf/value.h>
@@ -31,6 +34,8 @@
 #include <ngf/plugin.h>
 #include <ngf/request.h>
 #include <ngf/inputinterface.h>
+#include <ngf/metrics.h>
+#include <ngf/wakeup.h>
 
 N_PLUGIN_NAME        ("dbus")
 N_PLUGIN_VERSION     ("0.1")
@@ -48,11 +53,24 @@ N_PLUGIN_DESCRIPTION ("D-Bus interface")
 #define NGF_DBUS_STATUS       "Status"
 #define NGF_DBUS_METHOD_PLAY  "Play"
 #define NGF_DBUS_METHOD_STOP  "Stop"
+#define NGF_DBUS_METHOD_PLAY_MANY "PlayMany"
+#define NGF_DBUS_METHOD_STOP_MANY "StopMany"
 #define NGF_DBUS_METHOD_PAUSE "Pause"
 #define NGF_DBUS_METHOD_DEBUG "internal_debug"
+#define NGF_DBUS_METHOD_STATISTICS "GetStatistics"
+#define NGF_DBUS_METHOD_PEER_ADDRESS "GetPeerAddress"
 
 #define NGF_DBUS_PROPERTY_NAME "dbus.event.client"
 
+/* Request property selecting the Status signals sent for the request:
+   "all" (default), "completion" for completed and failed only, or
+   "none" for fire-and-forget clients. */
+#define NGF_DBUS_STATUS_KEY    "dbus.status"
+
+/* Boolean request property, a client setting it gets its Status signals
+   addressed to it from then on instead of broadcast. */
+#define NGF_DBUS_UNICAST_KEY   "dbus.unicast"
+
 #define DBUS_CLIENT_MATCH "type='signal',sender='org.freedesktop.DBus',member='NameOwnerChanged'"
 
 #define DBUS_MCE_NAME         "com.nokia.mce"
@@ -62,20 +80,50 @@ N_PLUGIN_DESCRIPTION ("D-Bus interface")
 #define DEFAULT_REQUEST_LIMIT   (16)
 #define DEFAULT_CLIENT_LIMIT    (64)
 
+#define DBUSIF_RATE             "rate"
+#define DBUSIF_BURST            "burst"
+#define DBUSIF_LOW_PRIORITY     "low_priority_events"
+#define DEFAULT_RATE            (0)     /* no rate limiting */
+#define DEFAULT_BURST           (10)
+#define DEFAULT_LOW_PRIORITY    "*_tacticon"
+
+#define DBUSIF_PEER_SERVER      "peer_server"
+#define DBUSIF_PEER_ADDRESS     "peer_address"
+#define DEFAULT_PEER_SERVER     FALSE
+
+#define DBUSIF_RECORD_FILE      "record_file"
+#define RECORD_HEADER           "# ngfd request record 1\n"
+
 /* from ngf/core-player.h */
 #define N_DBUS_EVENT_FAILED     (0)
 #define N_DBUS_EVENT_COMPLETED  (1)
 
+#define STATUS_MASK_NONE        (0)
+#define STATUS_MASK_COMPLETION  (1 << 0)
+#define STATUS_MASK_STATE       (1 << 1)    /* playing and paused */
+#define STATUS_MASK_ALL         (STATUS_MASK_COMPLETION | STATUS_MASK_STATE)
+
 static uint32_t          dbusif_max_requests;
 static uint32_t          dbusif_max_clients;
+static gdouble           dbusif_rate;           /* tokens per second */
+static gdouble           dbusif_burst;          /* bucket size */
+static GSList           *dbusif_low_priority;   /* GPatternSpec* */
+static gboolean          dbusif_peer_server;
+static gchar            *dbusif_peer_address;
+static dbus_int32_t      dbusif_peer_slot = -1;
+static gchar            *dbusif_record_file;
+
+typedef struct _DBusInterfaceData DBusInterfaceData;
 
 static gboolean          msg_parse_variant       (DBusMessageIter *iter,
                                                   NProplist *proplist,
-                                                  const char *key);
+                                                  NAtom atom);
 static gboolean          msg_parse_dict          (DBusMessageIter *iter,
+                                                  NCore *core,
                                                   NProplist *proplist);
 static gboolean          msg_get_properties      (DBusMessageIter *iter,
-                                                  NProplist **properties);
+                                                  NCore *core,
+                                                  NProplist *properties);
 static DBusHandlerResult dbusif_message_function (DBusConnection *connection,
                                                   DBusMessage *msg,
                                                   void *userdata);
@@ -90,35 +138,78 @@ static void              dbusif_send_error       (NInputInterface *iface,
 static void              dbusif_send_reply       (NInputInterface *iface,
                                                   NRequest *request,
                                                   int code);
+static DBusHandlerResult dbusif_peer_filter      (DBusConnection *connection,
+                                                  DBusMessage *msg,
+                                                  void *userdata);
+static gboolean          dbusif_status_flush_cb  (gpointer userdata);
+static void              dbusif_parse_limits     (const NProplist *props);
+static void              dbusif_record           (DBusInterfaceData *idata,
+                                                  const char *op,
+                                                  const char *client,
+                                                  uint32_t event_id);
+static void              dbusif_record_play      (NInputInterface *iface,
+                                                  const char *sender,
+                                                  DBusMessageIter *iter,
+                                                  uint32_t event_id);
 
-typedef struct _DBusInterfaceData
+struct _DBusInterfaceData
 {
     DBusConnection  *connection;
     NInputInterface *iface;
-    GSList *clients; // Internal cache of all clients currently connected
-    uint32_t client_count;
-} DBusInterfaceData;
+    GHashTable *clients; // Clients currently connected, by bus name
+    NMetricCounter *client_limit_metric;  /* plays rejected by the client limit */
+    NMetricCounter *request_limit_metric; /* plays rejected by the request limit */
+    NMetricCounter *shed_metric;          /* low priority plays dropped by the rate limit */
+    NMetricCounter *coalesced_metric;     /* low priority plays merged by the rate limit */
+    NMetricCounter *preempted_metric;     /* low priority requests stopped for others */
+    NMetricGauge   *clients_metric;       /* clients currently connected */
+    DBusServer *server;   /* private server for peer-to-peer clients */
+    GSList     *peers;    /* DBusInterfacePeer* */
+    guint       peer_serial;
+    GSList     *status_clients; /* clients with queued status, ref'd */
+    guint       status_flush_id;
+    FILE       *record;         /* request stream recording, NULL when off */
+    gint64      record_start;
+};
+
+typedef struct _DBusInterfaceStatus
+{
+    uint32_t    event_id;
+    uint32_t    status;
+} DBusInterfaceStatus;
+
+typedef struct _DBusInterfacePeer
+{
+    NInputInterface *iface;
+    DBusConnection  *connection;
+    char             name[32];  /* client name, never a valid bus name */
+} DBusInterfacePeer;
 
 typedef struct _DBusInterfaceClient
 {
     uint32_t    ref;
     uint32_t    active_requests;
+    uint32_t    low_requests;   /* active low priority requests */
+    GList      *requests;       /* ids of the active requests, newest first */
+    gdouble     tokens;         /* rate limit bucket */
+    gint64      refilled;       /* when tokens was last refilled */
+    DBusConnection *connection; /* peer connection, NULL for bus clients */
+    GArray     *status;         /* DBusInterfaceStatus queued for the flush */
+    gboolean    unicast;        /* Status signals addressed to the client */
     char        name[1];
 } DBusInterfaceClient;
 
 static gboolean
-msg_parse_variant (DBusMessageIter *iter, NProplist *proplist, const char *key)
+msg_parse_variant (DBusMessageIter *iter, NProplist *proplist, NAtom atom)
 {
     DBusMessageIter variant;
+    NValue *value = NULL;
 
     const char *str_value = NULL;
     dbus_uint32_t uint_value;
     dbus_int32_t int_value;
     dbus_bool_t boolean_value;
 
-    if (!key)
-        return FALSE;
-
     if (dbus_message_iter_get_arg_type (iter) != DBUS_TYPE_VARIANT)
         return FALSE;
 
@@ -127,35 +218,42 @@ msg_parse_variant (DBusMessageIter *iter, NProplist *proplist, const char *key)
     switch (dbus_message_iter_get_arg_type (&variant)) {
         case DBUS_TYPE_STRING:
             dbus_message_iter_get_basic (&variant, &str_value);
-            n_proplist_set_string (proplist, key, str_value);
-            return TRUE;
+            value = n_value_new ();
+            n_value_set_string (value, str_value);
+            break;
 
         case DBUS_TYPE_UINT32:
             dbus_message_iter_get_basic (&variant, &uint_value);
-            n_proplist_set_uint (proplist, key, uint_value);
-            return TRUE;
+            value = n_value_new ();
+            n_value_set_uint (value, uint_value);
+            break;
 
         case DBUS_TYPE_INT32:
             dbus_message_iter_get_basic (&variant, &int_value);
-            n_proplist_set_int (proplist, key, int_value);
-            return TRUE;
+            value = n_value_new ();
+            n_value_set_int (value, int_value);
+            break;
 
         case DBUS_TYPE_BOOLEAN:
             dbus_message_iter_get_basic (&variant, &boolean_value);
-            n_proplist_set_bool (proplist, key, boolean_value ? TRUE : FALSE);
-            return TRUE;
+            value = n_value_new ();
+            n_value_set_bool (value, boolean_value ? TRUE : FALSE);
+            break;
 
         default:
-            break;
+            return FALSE;
     }
 
-    return FALSE;
+    n_proplist_set_by_atom (proplist, atom, value);
+
+    return TRUE;
 }
 
 static gboolean
-msg_parse_dict (DBusMessageIter *iter, NProplist *proplist)
+msg_parse_dict (DBusMessageIter *iter, NCore *core, NProplist *proplist)
 {
-    const char      *key = NULL;
+    const char      *key  = NULL;
+    NAtom            atom = 0;
     DBusMessageIter  dict;
 
     /* Recurse to the dict entry */
@@ -173,35 +271,48 @@ msg_parse_dict (DBusMessageIter *iter, NProplist *proplist)
     dbus_message_iter_get_basic (&dict, &key);
     dbus_message_iter_next (&dict);
 
+    /* Skip keys that would be dropped later anyway */
+    if (!(atom = n_core_intern_request_key (core, key)))
+        return TRUE;
+
     /* Parse the variant contents */
-    if (!msg_parse_variant (&dict, proplist, key))
+    if (!msg_parse_variant (&dict, proplist, atom))
         return FALSE;
 
     return TRUE;
 }
 
 static gboolean
-msg_get_properties (DBusMessageIter *iter, NProplist **properties)
+msg_get_properties (DBusMessageIter *iter, NCore *core, NProplist *properties)
 {
-    NProplist       *p = NULL;
     DBusMessageIter  array;
 
     if (dbus_message_iter_get_arg_type (iter) != DBUS_TYPE_ARRAY)
         return FALSE;
 
-    p = n_proplist_new ();
-
     dbus_message_iter_recurse (iter, &array);
     while (dbus_message_iter_get_arg_type (&array) != DBUS_TYPE_INVALID) {
-        (void) msg_parse_dict (&array, p);
+        (void) msg_parse_dict (&array, core, properties);
         dbus_message_iter_next (&array);
     }
 
-    *properties = p;
-
     return TRUE;
 }
 
+static const char*
+dbusif_get_sender (DBusConnection *connection, DBusMessage *msg)
+{
+    DBusInterfacePeer *peer = NULL;
+
+    /* messages on a peer connection have no sender, the peer is
+       identified by its connection. */
+    if (dbusif_peer_slot != -1 &&
+        (peer = dbus_connection_get_data (connection, dbusif_peer_slot)))
+        return peer->name;
+
+    return dbus_message_get_sender (msg);
+}
+
 static void
 dbusif_ack (DBusConnection *connection, DBusMessage *msg, uint32_t event_id)
 {
@@ -215,6 +326,21 @@ dbusif_ack (DBusConnection *connection, DBusMessage *msg, uint32_t event_id)
     }
 }
 
+static void
+dbusif_ack_many (DBusConnection *connection, DBusMessage *msg, GArray *ids)
+{
+    DBusMessage   *reply = NULL;
+    const uint32_t *data = (const uint32_t*) ids->data;
+
+    reply = dbus_message_new_method_return (msg);
+    if (reply) {
+        dbus_message_append_args (reply, DBUS_TYPE_ARRAY, DBUS_TYPE_UINT32,
+            &data, ids->len, DBUS_TYPE_INVALID);
+        dbus_connection_send (connection, reply, NULL);
+        dbus_message_unref (reply);
+    }
+}
+
 static void
 dbusif_reply_error (DBusConnection *connection, DBusMessage *msg,
                     const char *error_name, const char *error_message)
@@ -234,13 +360,19 @@ dbusif_reply_error (DBusConnection *connection, DBusMessage *msg,
 }
 
 static DBusInterfaceClient*
-client_new (const char *client_name)
+client_new (const char *client_name, DBusConnection *connection)
 {
     DBusInterfaceClient *c;
 
     c = g_malloc (sizeof (*c) + strlen (client_name));
     c->ref = 1;
     c->active_requests = 0;
+    c->low_requests = 0;
+    c->requests = NULL;
+    c->tokens = dbusif_burst;
+    c->refilled = g_get_monotonic_time ();
+    c->connection = connection ? dbus_connection_ref (connection) : NULL;
+    c->status = g_array_new (FALSE, FALSE, sizeof (DBusInterfaceStatus));
     strcpy(c->name, client_name);
     N_DEBUG (LOG_CAT ">> new client (%s)", c->name);
 
@@ -257,6 +389,10 @@ client_ref (DBusInterfaceClient *client)
 static void
 client_free (DBusInterfaceClient *client)
 {
+    g_list_free (client->requests);
+    g_array_free (client->status, TRUE);
+    if (client->connection)
+        dbus_connection_unref (client->connection);
     g_free (client);
 }
 
@@ -269,115 +405,326 @@ client_unref (DBusInterfaceClient *client)
         client_free (client);
 }
 
+static gboolean
+event_is_low_priority (const char *event)
+{
+    GSList *iter = NULL;
+
+    for (iter = dbusif_low_priority; iter; iter = g_slist_next (iter)) {
+        if (g_pattern_match_string (iter->data, event))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gboolean
+client_take_token (DBusInterfaceClient *client, gint64 now)
+{
+    if (dbusif_rate <= 0.0)
+        return TRUE;
+
+    client->tokens += (now - client->refilled) * dbusif_rate / G_USEC_PER_SEC;
+    if (client->tokens > dbusif_burst)
+        client->tokens = dbusif_burst;
+    client->refilled = now;
+
+    if (client->tokens < 1.0)
+        return FALSE;
+
+    client->tokens -= 1.0;
+    return TRUE;
+}
+
 static inline void
-client_request_new (DBusInterfaceClient *client)
+client_request_new (DBusInterfaceClient *client, uint32_t event_id,
+                    gboolean low_priority)
 {
     client->active_requests++;
+    if (low_priority)
+        client->low_requests++;
+    client->requests = g_list_prepend (client->requests,
+        GUINT_TO_POINTER (event_id));
 }
 
 static inline void
-client_request_done (DBusInterfaceClient *client)
+client_request_done (DBusInterfaceClient *client, uint32_t event_id,
+                     gboolean low_priority)
 {
     if (client->active_requests == 0)
         N_ERROR (LOG_CAT "client '%s' active requests 0", client->name);
     else
         client->active_requests--;
+
+    if (low_priority && client->low_requests > 0)
+        client->low_requests--;
+
+    client->requests = g_list_remove (client->requests,
+        GUINT_TO_POINTER (event_id));
 }
 
 static DBusInterfaceClient*
 client_list_find (DBusInterfaceData *idata, const char *client_name)
 {
-    GSList              *search;
-    DBusInterfaceClient *c;
-
-    for (search = idata->clients; search; search = g_slist_next(search)) {
-        c = search->data;
-        if (g_str_equal (client_name, c->name))
-            return c;
-    }
-
-    return NULL;
+    return g_hash_table_lookup (idata->clients, client_name);
 }
 
 static void
 client_list_remove (DBusInterfaceData *idata, DBusInterfaceClient *client)
 {
-    GSList *search;
-
-    if ((search = g_slist_find (idata->clients, client))) {
-        idata->clients = g_slist_delete_link (idata->clients, search);
-        idata->client_count--;
-    } else
+    if (!g_hash_table_remove (idata->clients, client->name))
         N_ERROR (LOG_CAT "cannot find client %s from client list.", client->name);
+    n_metric_gauge_set (idata->clients_metric, g_hash_table_size (idata->clients));
 }
 
 static void
 client_list_add (DBusInterfaceData *idata, DBusInterfaceClient *client)
 {
-    idata->clients = g_slist_append (idata->clients, client);
-    idata->client_count++;
+    g_hash_table_insert (idata->clients, client->name, client);
+    n_metric_gauge_set (idata->clients_metric, g_hash_table_size (idata->clients));
 }
 
-static DBusHandlerResult
-dbusif_play_handler (DBusConnection *connection, DBusMessage *msg,
-                     NInputInterface *iface)
+static NRequest*
+client_find_event (DBusInterfaceData *idata, DBusInterfaceClient *client,
+                   const char *event)
+{
+    NRequest *request = NULL;
+    GList    *iter    = NULL;
+
+    for (iter = client->requests; iter; iter = g_list_next (iter)) {
+        request = dbusif_lookup_request (idata->iface, GPOINTER_TO_UINT (iter->data));
+        if (request && g_str_equal (n_request_get_name (request), event))
+            return request;
+    }
+
+    return NULL;
+}
+
+static gboolean
+client_preempt_low (DBusInterfaceData *idata, DBusInterfaceClient *client)
+{
+    NRequest *request = NULL;
+    GList    *iter    = NULL;
+
+    /* stop the oldest low priority request, the slot is returned
+       once the stop completes. */
+    for (iter = g_list_last (client->requests); iter; iter = g_list_previous (iter)) {
+        request = dbusif_lookup_request (idata->iface, GPOINTER_TO_UINT (iter->data));
+        if (request && event_is_low_priority (n_request_get_name (request))) {
+            N_DEBUG (LOG_CAT "client %s: stopping '%s' (%u) to make room",
+                client->name, n_request_get_name (request), n_request_get_id (request));
+            n_input_interface_stop_request (idata->iface, request, 0);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static gboolean
+dbusif_parse_request (NInputInterface *iface, DBusConnection *connection,
+                      const char *sender, DBusMessageIter *iter, gint64 received,
+                      NRequest **request, uint32_t *event_id,
+                      const char **error_name, const char **error)
 {
     DBusInterfaceData   *idata      = NULL;
     const char          *event      = NULL;
     NProplist           *properties = NULL;
-    NRequest            *request    = NULL;
-    DBusMessageIter      iter;
-    const char          *sender     = NULL;
+    NRequest            *active     = NULL;
     DBusInterfaceClient *client     = NULL;
-    const char          *error      = NULL;
+    gboolean             low        = FALSE;
 
     idata = n_input_interface_get_userdata (iface);
+    *request = NULL;
+    *event_id = 0;
 
-    // We won't launch events without proper sender
-    if ((sender = dbus_message_get_sender (msg)) == NULL)
+    if (dbus_message_iter_get_arg_type (iter) != DBUS_TYPE_STRING)
         goto fail;
 
+    dbus_message_iter_get_basic (iter, &event);
+    dbus_message_iter_next (iter);
+
+    low = event_is_low_priority (event);
+
     if (!(client = client_list_find(idata, sender))) {
-        if (idata->client_count >= dbusif_max_clients) {
-            error = "Too many simultaneous clients.";
+        if (g_hash_table_size (idata->clients) >= dbusif_max_clients) {
+            *error = "Too many simultaneous clients.";
+            n_metric_counter_inc (idata->client_limit_metric);
             goto limits;
         }
-        client = client_new (sender);
+        client = client_new (sender, connection == idata->connection ?
+                                     NULL : connection);
         client_list_add (idata, client);
-    } else if (client->active_requests >= dbusif_max_requests) {
-        error = "Too many simultaneous requests.";
-        goto limits;
     }
 
-    dbus_message_iter_init (msg, &iter);
-    if (dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_STRING)
-        goto fail;
+    if (low && !client_take_token (client, received)) {
+        /* over the rate, join an identical request that is still
+           active or drop the play without failing the client. */
+        if ((active = client_find_event (idata, client, event))) {
+            N_DEBUG (LOG_CAT "client %s over rate, '%s' coalesced to %u",
+                client->name, event, n_request_get_id (active));
+            n_metric_counter_inc (idata->coalesced_metric);
+            *event_id = n_request_get_id (active);
+        } else {
+            N_DEBUG (LOG_CAT "client %s over rate, '%s' shed", client->name, event);
+            n_metric_counter_inc (idata->shed_metric);
+        }
+        return TRUE;
+    }
 
-    dbus_message_iter_get_basic (&iter, &event);
-    dbus_message_iter_next (&iter);
+    if (client->active_requests >= dbusif_max_requests) {
+        /* low priority requests may not keep others out. */
+        if (low || client->active_requests - client->low_requests >= dbusif_max_requests ||
+            !client_preempt_low (idata, client)) {
+            *error = "Too many simultaneous requests.";
+            n_metric_counter_inc (idata->request_limit_metric);
+            goto limits;
+        }
+        n_metric_counter_inc (idata->preempted_metric);
+    }
 
-    if (!msg_get_properties (&iter, &properties))
+    /* decode the properties straight into the request. */
+    properties = n_proplist_new ();
+    if (!msg_get_properties (iter, n_input_interface_get_core (iface), properties)) {
+        n_proplist_free (properties);
         goto fail;
+    }
 
-    client_ref (client);
-    client_request_new (client);
+    if (n_proplist_get_bool (properties, NGF_DBUS_UNICAST_KEY))
+        client->unicast = TRUE;
 
     n_proplist_set_pointer (properties, NGF_DBUS_PROPERTY_NAME, client);
-    request = n_request_new_with_event_and_properties (event, properties);
-    n_proplist_free (properties);
+    *request = n_request_new_with_event (event);
+    n_request_take_properties (*request, properties);
+    n_request_set_timestamp (*request, N_REQUEST_STAGE_RECEIVED, received);
+
+    client_ref (client);
+    client_request_new (client, n_request_get_id (*request), low);
+    *event_id = n_request_get_id (*request);
 
     N_INFO (LOG_CAT ">> play received for event '%s' with id '%u' (client %s : %u active request(s))",
-                    event, n_request_get_id (request), client->name, client->active_requests);
+                    event, *event_id, client->name, client->active_requests);
+
+    return TRUE;
+
+limits:
+    *error_name = DBUS_ERROR_LIMITS_EXCEEDED;
+    return FALSE;
+
+fail:
+    *error_name = DBUS_ERROR_INVALID_ARGS;
+    *error = "Malformed method call.";
+    return FALSE;
+}
+
+/* plays are recorded as the client sent them, also the ones that were
+   rejected or shed. Their recorded id is 0. */
+static gboolean
+dbusif_new_request (NInputInterface *iface, DBusConnection *connection,
+                    const char *sender, DBusMessageIter *iter, gint64 received,
+                    NRequest **request, uint32_t *event_id,
+                    const char **error_name, const char **error)
+{
+    DBusInterfaceData *idata = NULL;
+    DBusMessageIter    args  = *iter;
+    gboolean           ret;
+
+    idata = n_input_interface_get_userdata (iface);
+
+    ret = dbusif_parse_request (iface, connection, sender, iter, received,
+                                request, event_id, error_name, error);
+
+    if (idata->record)
+        dbusif_record_play (iface, sender, &args, *event_id);
+
+    return ret;
+}
+
+static DBusHandlerResult
+dbusif_play_handler (DBusConnection *connection, DBusMessage *msg,
+                     NInputInterface *iface)
+{
+    NRequest            *request    = NULL;
+    DBusMessageIter      iter;
+    const char          *sender     = NULL;
+    const char          *error_name = NULL;
+    const char          *error      = NULL;
+    uint32_t             event_id   = 0;
+    gint64               received   = g_get_monotonic_time ();
+
+    // We won't launch events without proper sender
+    if ((sender = dbusif_get_sender (connection, msg)) == NULL)
+        goto fail;
+
+    dbus_message_iter_init (msg, &iter);
+    if (!dbusif_new_request (iface, connection, sender, &iter, received,
+                             &request, &event_id, &error_name, &error)) {
+        dbusif_reply_error (connection, msg, error_name, error);
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
 
     // Reply internal event_id immediately
-    dbusif_ack (connection, msg, n_request_get_id (request));
+    dbusif_ack (connection, msg, event_id);
 
-    n_input_interface_play_request (iface, request);
+    if (request)
+        n_input_interface_play_request (iface, request);
 
     return DBUS_HANDLER_RESULT_HANDLED;
 
-limits:
-    dbusif_reply_error (connection, msg, DBUS_ERROR_LIMITS_EXCEEDED, error);
+fail:
+    dbusif_reply_error (connection, msg, DBUS_ERROR_INVALID_ARGS, "Malformed method call.");
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static DBusHandlerResult
+dbusif_play_many_handler (DBusConnection *connection, DBusMessage *msg,
+                          NInputInterface *iface)
+{
+    GArray              *ids        = NULL;
+    GSList              *requests   = NULL;
+    GSList              *iter       = NULL;
+    NRequest            *request    = NULL;
+    DBusMessageIter      array;
+    DBusMessageIter      entry;
+    const char          *sender     = NULL;
+    const char          *error_name = NULL;
+    const char          *error      = NULL;
+    uint32_t             event_id   = 0;
+    gint64               received   = g_get_monotonic_time ();
+
+    if ((sender = dbusif_get_sender (connection, msg)) == NULL ||
+        !dbus_message_has_signature (msg, "a(sa{sv})"))
+        goto fail;
+
+    dbus_message_iter_init (msg, &array);
+    dbus_message_iter_recurse (&array, &entry);
+
+    /* an entry that cannot be played gets id 0, the others are still
+       played. */
+    ids = g_array_new (FALSE, FALSE, sizeof (uint32_t));
+    while (dbus_message_iter_get_arg_type (&entry) == DBUS_TYPE_STRUCT) {
+        DBusMessageIter fields;
+
+        dbus_message_iter_recurse (&entry, &fields);
+        if (!dbusif_new_request (iface, connection, sender, &fields, received,
+                                 &request, &event_id, &error_name, &error))
+            N_DEBUG (LOG_CAT "play %u of batch from %s failed: %s", ids->len,
+                sender, error);
+        else if (request)
+            requests = g_slist_prepend (requests, request);
+
+        g_array_append_val (ids, event_id);
+        dbus_message_iter_next (&entry);
+    }
+
+    dbusif_ack_many (connection, msg, ids);
+    g_array_free (ids, TRUE);
+
+    requests = g_slist_reverse (requests);
+    for (iter = requests; iter; iter = g_slist_next (iter))
+        n_input_interface_play_request (iface, (NRequest*) iter->data);
+    g_slist_free (requests);
+
     return DBUS_HANDLER_RESULT_HANDLED;
 
 fail:
@@ -390,25 +737,10 @@ dbusif_lookup_request (NInputInterface *iface, uint32_t event_id)
 {
     g_assert (iface != NULL);
 
-    NCore     *core            = NULL;
-    NRequest  *request         = NULL;
-    GList     *active_requests = NULL;
-    GList     *iter            = NULL;
-
     if (event_id == 0)
         return NULL;
 
-    core = n_input_interface_get_core (iface);
-    active_requests = n_core_get_requests (core);
-
-    for (iter = g_list_first (active_requests); iter; iter = g_list_next (iter)) {
-        request = (NRequest*) iter->data;
-
-        if (n_request_get_id (request) == event_id)
-            return request;
-    }
-
-    return NULL;
+    return n_core_lookup_request (n_input_interface_get_core (iface), event_id);
 }
 
 static void
@@ -436,25 +768,12 @@ dbusif_stop_by_client (DBusInterfaceData *idata, DBusInterfaceClient *by_client)
     g_assert (idata != NULL);
     g_assert (by_client);
 
-    NCore               *core               = NULL;
     NRequest            *request            = NULL;
-    GList               *active_requests    = NULL;
     GList               *iter               = NULL;
-    NProplist           *properties         = NULL;
-    DBusInterfaceClient *client             = NULL;
 
-    core = n_input_interface_get_core (idata->iface);
-    active_requests = n_core_get_requests (core);
-
-    for (iter = g_list_first (active_requests); iter; iter = g_list_next (iter)) {
-        request = (NRequest*) iter->data;
-
-        properties = (NProplist*) n_request_get_properties (request);
-        if (!properties)
-            continue;
-
-        client = n_proplist_get_pointer (properties, NGF_DBUS_PROPERTY_NAME);
-        if (client == by_client)
+    for (iter = g_list_first (by_client->requests); iter; iter = g_list_next (iter)) {
+        request = dbusif_lookup_request (idata->iface, GPOINTER_TO_UINT (iter->data));
+        if (request)
             n_input_interface_stop_request (idata->iface, request, 0);
     }
 }
@@ -471,7 +790,7 @@ dbusif_stop_handler (DBusConnection *connection, DBusMessage *msg,
 
     idata = n_input_interface_get_userdata (iface);
 
-    if ((sender = dbus_message_get_sender (msg)) == NULL) {
+    if ((sender = dbusif_get_sender (connection, msg)) == NULL) {
         error = "Unknown sender.";
         goto access;
     }
@@ -490,6 +809,7 @@ dbusif_stop_handler (DBusConnection *connection, DBusMessage *msg,
     }
 
     N_INFO (LOG_CAT ">> stop received for id '%u'", event_id);
+    dbusif_record (idata, "stop", sender, event_id);
 
     request = dbusif_lookup_request (iface, event_id);
 
@@ -512,6 +832,125 @@ args:
     return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+static DBusHandlerResult
+dbusif_stop_many_handler (DBusConnection *connection, DBusMessage *msg,
+                          NInputInterface *iface)
+{
+    DBusInterfaceData   *idata      = NULL;
+    dbus_uint32_t       *event_ids  = NULL;
+    int                  num_ids    = 0;
+    GArray              *ids        = NULL;
+    NRequest            *request    = NULL;
+    const char          *sender     = NULL;
+    uint32_t             event_id   = 0;
+    int                  i;
+
+    idata = n_input_interface_get_userdata (iface);
+
+    if ((sender = dbusif_get_sender (connection, msg)) == NULL ||
+        !client_list_find (idata, sender)) {
+        dbusif_reply_error (connection, msg, DBUS_ERROR_ACCESS_DENIED, "Unknown client.");
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    if (!dbus_message_get_args (msg, NULL,
+                                DBUS_TYPE_ARRAY, DBUS_TYPE_UINT32, &event_ids, &num_ids,
+                                DBUS_TYPE_INVALID))
+    {
+        dbusif_reply_error (connection, msg, DBUS_ERROR_INVALID_ARGS, "Malformed method call.");
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    N_INFO (LOG_CAT ">> stop received for %d id(s)", num_ids);
+
+    /* ids that are not found are replied as 0. */
+    ids = g_array_sized_new (FALSE, FALSE, sizeof (uint32_t), num_ids);
+    for (i = 0; i < num_ids; i++) {
+        dbusif_record (idata, "stop", sender, event_ids[i]);
+        event_id = 0;
+        if ((request = dbusif_lookup_request (iface, event_ids[i]))) {
+            n_input_interface_stop_request (iface, request, 0);
+            event_id = event_ids[i];
+        }
+        g_array_append_val (ids, event_id);
+    }
+
+    dbusif_ack_many (connection, msg, ids);
+    g_array_free (ids, TRUE);
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+
+static void
+dbusif_append_statistic (const char *name, guint64 value, void *userdata)
+{
+    DBusMessageIter *array = (DBusMessageIter*) userdata;
+    DBusMessageIter  entry;
+    dbus_uint64_t    dbus_value = value;
+
+    dbus_message_iter_open_container (array, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &name);
+    dbus_message_iter_append_basic (&entry, DBUS_TYPE_UINT64, &dbus_value);
+    dbus_message_iter_close_container (array, &entry);
+}
+
+static DBusHandlerResult
+dbusif_statistics_handler (DBusConnection *connection, DBusMessage *msg,
+                           NInputInterface *iface)
+{
+    DBusMessage     *reply = NULL;
+    DBusMessageIter  iter;
+    DBusMessageIter  array;
+
+    reply = dbus_message_new_method_return (msg);
+    if (!reply)
+        return DBUS_HANDLER_RESULT_NEED_MEMORY;
+
+    dbus_message_iter_init_append (reply, &iter);
+    dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+        DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+        DBUS_TYPE_STRING_AS_STRING
+        DBUS_TYPE_UINT64_AS_STRING
+        DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &array);
+    n_metrics_foreach (n_core_get_metrics (n_input_interface_get_core (iface)),
+                       dbusif_append_statistic, &array);
+    dbus_message_iter_close_container (&iter, &array);
+
+    dbus_connection_send (connection, reply, NULL);
+    dbus_message_unref (reply);
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static DBusHandlerResult
+dbusif_peer_address_handler (DBusConnection *connection, DBusMessage *msg,
+                             NInputInterface *iface)
+{
+    DBusInterfaceData *idata   = NULL;
+    DBusMessage       *reply   = NULL;
+    char              *address = NULL;
+
+    idata = n_input_interface_get_userdata (iface);
+
+    if (!idata->server) {
+        dbusif_reply_error (connection, msg, DBUS_ERROR_NOT_SUPPORTED,
+                            "Peer-to-peer server is not enabled.");
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    address = dbus_server_get_address (idata->server);
+    reply = dbus_message_new_method_return (msg);
+    if (reply) {
+        dbus_message_append_args (reply, DBUS_TYPE_STRING, &address,
+                                  DBUS_TYPE_INVALID);
+        dbus_connection_send (connection, reply, NULL);
+        dbus_message_unref (reply);
+    }
+    dbus_free (address);
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
 
 static DBusHandlerResult
 dbusif_debug_handler (DBusConnection *connection, DBusMessage *msg,
@@ -519,20 +958,24 @@ dbusif_debug_handler (DBusConnection *connection, DBusMessage *msg,
 {
     DBusMessage         *reply          = NULL;
     DBusInterfaceData   *idata          = NULL;
-    GSList              *search         = NULL;
     DBusInterfaceClient *client         = NULL;
+    GHashTableIter       search;
     uint32_t             total_clients  = 0;
     uint32_t             total_requests = 0;
+    guint                cache_hits     = 0;
+    guint                cache_misses   = 0;
+    guint                cache_size     = 0;
 
     idata = n_input_interface_get_userdata (iface);
 
     N_INFO (LOG_CAT "==== DUMP STATS ====");
 
-    for (search = idata->clients; search; search = g_slist_next(search)) {
-        client = (DBusInterfaceClient *) search->data;
-        N_INFO (LOG_CAT "client %s  ref %d, active_requests %u/%u",
+    g_hash_table_iter_init (&search, idata->clients);
+    while (g_hash_table_iter_next (&search, NULL, (gpointer*) &client)) {
+        N_INFO (LOG_CAT "client %s  ref %d, active_requests %u/%u (%u low priority), tokens %.1f/%.0f",
                         client->name, client->ref,
-                        client->active_requests, dbusif_max_requests);
+                        client->active_requests, dbusif_max_requests,
+                        client->low_requests, client->tokens, dbusif_burst);
         total_requests += client->active_requests;
         total_clients++;
     }
@@ -540,6 +983,20 @@ dbusif_debug_handler (DBusConnection *connection, DBusMessage *msg,
     N_INFO (LOG_CAT "total clients %u/%u, per-client max requests %u , active requests %u",
                     total_clients, dbusif_max_clients,
                     dbusif_max_requests, total_requests);
+
+    n_core_get_event_cache_stats (n_input_interface_get_core (iface),
+                                  &cache_hits, &cache_misses, &cache_size);
+    N_INFO (LOG_CAT "event cache hits %u, misses %u, entries %u",
+                    cache_hits, cache_misses, cache_size);
+
+    n_core_get_sink_plan_stats (n_input_interface_get_core (iface),
+                                &cache_hits, &cache_misses);
+    N_INFO (LOG_CAT "sink plan hits %u, misses %u", cache_hits, cache_misses);
+
+    n_core_dump_hook_stats (n_input_interface_get_core (iface));
+    n_core_dump_request_timelines (n_input_interface_get_core (iface));
+    n_metrics_dump (n_core_get_metrics (n_input_interface_get_core (iface)));
+    n_log_schedule_dump ();
     N_INFO (LOG_CAT "====================");
 
     if (!dbus_message_get_no_reply (msg)) {
@@ -566,7 +1023,7 @@ dbusif_pause_handler (DBusConnection *connection, DBusMessage *msg,
 
     idata = n_input_interface_get_userdata (iface);
 
-    if ((sender = dbus_message_get_sender (msg)) == NULL) {
+    if ((sender = dbusif_get_sender (connection, msg)) == NULL) {
         error = "Unknown sender.";
         goto access;
     }
@@ -587,6 +1044,7 @@ dbusif_pause_handler (DBusConnection *connection, DBusMessage *msg,
 
     N_INFO (LOG_CAT ">> %s received for id '%u'", pause ? "pause" : "resume",
         event_id);
+    dbusif_record (idata, pause ? "pause" : "resume", sender, event_id);
 
     request = dbusif_lookup_request (iface, event_id);
 
@@ -626,6 +1084,7 @@ dbusif_disconnect_handler (NInputInterface *iface, const gchar *client_name)
 
     if ((client = client_list_find (idata, client_name))) {
         N_INFO (LOG_CAT ">> client disconnect (%s)", client->name);
+        dbusif_record (idata, "gone", client->name, 0);
         dbusif_stop_by_client (idata, client);
         client_list_remove (idata, client);
         client_unref (client);
@@ -661,6 +1120,9 @@ dbusif_message_function (DBusConnection *connection, DBusMessage *msg,
     gchar *s1 = NULL;
     gchar *s2 = NULL;
 
+    n_wakeup_note (dbus_message_get_type (msg) == DBUS_MESSAGE_TYPE_METHOD_CALL ?
+                   "dbus.request" : "dbus.signal");
+
     if (dbus_message_is_signal (msg, "org.freedesktop.DBus", "NameOwnerChanged")) {
         if (!dbus_message_get_args
             (msg, &error,
@@ -701,23 +1163,306 @@ dbusif_message_function (DBusConnection *connection, DBusMessage *msg,
     else if (g_str_equal (member, NGF_DBUS_METHOD_STOP))
         return dbusif_stop_handler (connection, msg, iface);
 
+    else if (g_str_equal (member, NGF_DBUS_METHOD_PLAY_MANY))
+        return dbusif_play_many_handler (connection, msg, iface);
+
+    else if (g_str_equal (member, NGF_DBUS_METHOD_STOP_MANY))
+        return dbusif_stop_many_handler (connection, msg, iface);
+
     else if (g_str_equal (member, NGF_DBUS_METHOD_PAUSE))
         return dbusif_pause_handler (connection, msg, iface);
 
     else if (g_str_equal (member, NGF_DBUS_METHOD_DEBUG))
         return dbusif_debug_handler (connection, msg, iface);
 
+    else if (g_str_equal (member, NGF_DBUS_METHOD_STATISTICS))
+        return dbusif_statistics_handler (connection, msg, iface);
+
+    else if (g_str_equal (member, NGF_DBUS_METHOD_PEER_ADDRESS))
+        return dbusif_peer_address_handler (connection, msg, iface);
+
     return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
+static const struct DBusObjectPathVTable dbusif_vtable = {
+    .message_function = dbusif_message_function
+};
+
+static void
+dbusif_peer_free (DBusInterfacePeer *peer)
+{
+    DBusInterfaceData *idata = n_input_interface_get_userdata (peer->iface);
+
+    idata->peers = g_slist_remove (idata->peers, peer);
+    dbusif_disconnect_handler (peer->iface, peer->name);
+
+    dbus_connection_remove_filter (peer->connection, dbusif_peer_filter, peer);
+    dbus_connection_unregister_object_path (peer->connection, NGF_DBUS_PATH);
+    dbus_connection_set_data (peer->connection, dbusif_peer_slot, NULL, NULL);
+    dbus_connection_close (peer->connection);
+    dbus_connection_unref (peer->connection);
+    g_free (peer);
+}
+
+static DBusHandlerResult
+dbusif_peer_filter (DBusConnection *connection, DBusMessage *msg,
+                    void *userdata)
+{
+    DBusInterfacePeer *peer = userdata;
+
+    (void) connection;
+
+    if (!dbus_message_is_signal (msg, DBUS_INTERFACE_LOCAL, "Disconnected"))
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    N_DEBUG (LOG_CAT "peer %s disconnected", peer->name);
+    dbusif_peer_free (peer);
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static dbus_bool_t
+dbusif_peer_allow_user (DBusConnection *connection, unsigned long uid,
+                        void *userdata)
+{
+    (void) connection;
+    (void) userdata;
+
+    return uid == 0 || uid == (unsigned long) getuid ();
+}
+
+static void
+dbusif_peer_new_connection (DBusServer *server, DBusConnection *connection,
+                            void *userdata)
+{
+    NInputInterface   *iface = userdata;
+    DBusInterfaceData *idata = NULL;
+    DBusInterfacePeer *peer  = NULL;
+
+    (void) server;
+
+    idata = n_input_interface_get_userdata (iface);
+
+    peer = g_new0 (DBusInterfacePeer, 1);
+    peer->iface = iface;
+    peer->connection = dbus_connection_ref (connection);
+    g_snprintf (peer->name, sizeof (peer->name), ":peer.%u", ++idata->peer_serial);
+
+    if (!dbus_connection_set_data (connection, dbusif_peer_slot, peer, NULL) ||
+        !dbus_connection_register_object_path (connection, NGF_DBUS_PATH,
+                                               &dbusif_vtable, iface) ||
+        !dbus_connection_add_filter (connection, dbusif_peer_filter, peer, NULL)) {
+        N_WARNING (LOG_CAT "failed to set up peer connection");
+        dbus_connection_set_data (connection, dbusif_peer_slot, NULL, NULL);
+        dbus_connection_close (connection);
+        dbus_connection_unref (connection);
+        g_free (peer);
+        return;
+    }
+
+    dbus_connection_set_unix_user_function (connection, dbusif_peer_allow_user,
+                                            NULL, NULL);
+    dbus_gmain_set_up_connection (connection, NULL);
+    idata->peers = g_slist_prepend (idata->peers, peer);
+
+    N_DEBUG (LOG_CAT "new peer %s", peer->name);
+}
+
+static gboolean
+dbusif_peer_server_start (NInputInterface *iface)
+{
+    DBusInterfaceData *idata   = NULL;
+    DBusError          error   = DBUS_ERROR_INIT;
+    gchar             *address = NULL;
+    char              *listen  = NULL;
+
+    idata = n_input_interface_get_userdata (iface);
+
+    if (!dbus_connection_allocate_data_slot (&dbusif_peer_slot))
+        return FALSE;
+
+    address = dbusif_peer_address ? g_strdup (dbusif_peer_address)
+                                  : g_strdup_printf ("unix:tmpdir=%s",
+                                                     g_get_user_runtime_dir ());
+
+    if (!(idata->server = dbus_server_listen (address, &error))) {
+        N_WARNING (LOG_CAT "failed to listen on %s: %s", address, error.message);
+        dbus_error_free (&error);
+        g_free (address);
+        dbus_connection_free_data_slot (&dbusif_peer_slot);
+        return FALSE;
+    }
+    g_free (address);
+
+    dbus_server_set_new_connection_function (idata->server,
+                                             dbusif_peer_new_connection,
+                                             iface, NULL);
+    dbus_gmain_set_up_server (idata->server, NULL);
+
+    listen = dbus_server_get_address (idata->server);
+    N_INFO (LOG_CAT "peer-to-peer server listening on %s", listen);
+    dbus_free (listen);
+
+    return TRUE;
+}
+
+static void
+dbusif_peer_server_stop (NInputInterface *iface)
+{
+    DBusInterfaceData *idata = n_input_interface_get_userdata (iface);
+
+    if (!idata->server)
+        return;
+
+    while (idata->peers)
+        dbusif_peer_free (idata->peers->data);
+
+    dbus_server_disconnect (idata->server);
+    dbus_server_unref (idata->server);
+    idata->server = NULL;
+    dbus_connection_free_data_slot (&dbusif_peer_slot);
+}
+
+/* The request stream is written one call per line, the fields are
+   separated by tabs:
+
+     <us since start> play <client> <id> <event> [<key>=<type>:<value>]...
+     <us since start> stop|pause|resume <client> <id>
+     <us since start> gone <client> 0
+
+   The id is the one the client got in the reply, the type of a
+   property is one of s, i, u or b. Event names, keys and strings are
+   escaped like C strings. */
+static void
+dbusif_record_open (DBusInterfaceData *idata)
+{
+    if (!(idata->record = fopen (dbusif_record_file, "w"))) {
+        N_WARNING (LOG_CAT "failed to open record file %s: %s",
+            dbusif_record_file, g_strerror (errno));
+        return;
+    }
+
+    fputs (RECORD_HEADER, idata->record);
+    idata->record_start = g_get_monotonic_time ();
+
+    N_INFO (LOG_CAT "recording the request stream to %s", dbusif_record_file);
+}
+
+static void
+dbusif_record_close (DBusInterfaceData *idata)
+{
+    if (idata->record) {
+        fclose (idata->record);
+        idata->record = NULL;
+    }
+}
+
+static GString*
+dbusif_record_line (DBusInterfaceData *idata, const char *op,
+                    const char *client, uint32_t event_id)
+{
+    GString *line = g_string_sized_new (128);
+
+    g_string_printf (line, "%" G_GINT64_FORMAT "\t%s\t%s\t%u",
+                     g_get_monotonic_time () - idata->record_start,
+                     op, client, event_id);
+
+    return line;
+}
+
+static void
+dbusif_record_write (DBusInterfaceData *idata, GString *line)
+{
+    g_string_append_c (line, '\n');
+
+    if (fwrite (line->str, 1, line->len, idata->record) != line->len) {
+        N_WARNING (LOG_CAT "failed to write record, recording stopped");
+        dbusif_record_close (idata);
+    }
+
+    g_string_free (line, TRUE);
+}
+
+static void
+dbusif_record (DBusInterfaceData *idata, const char *op, const char *client,
+               uint32_t event_id)
+{
+    if (idata->record)
+        dbusif_record_write (idata, dbusif_record_line (idata, op, client, event_id));
+}
+
+static void
+dbusif_record_property (const char *key, const NValue *value, gpointer userdata)
+{
+    GString *line    = userdata;
+    gchar   *escaped = NULL;
+    gchar   *data    = NULL;
+    char     type;
+
+    switch (n_value_type (value)) {
+        case N_VALUE_TYPE_STRING:
+            type = 's';
+            data = g_strescape (n_value_get_string (value), NULL);
+            break;
+        case N_VALUE_TYPE_INT:
+            type = 'i';
+            data = g_strdup_printf ("%d", n_value_get_int (value));
+            break;
+        case N_VALUE_TYPE_UINT:
+            type = 'u';
+            data = g_strdup_printf ("%u", n_value_get_uint (value));
+            break;
+        case N_VALUE_TYPE_BOOL:
+            type = 'b';
+            data = g_strdup (n_value_get_bool (value) ? "1" : "0");
+            break;
+        default:
+            /* the client pointer set by us */
+            return;
+    }
+
+    escaped = g_strescape (key, NULL);
+    g_string_append_printf (line, "\t%s=%c:%s", escaped, type, data);
+    g_free (escaped);
+    g_free (data);
+}
+
+static void
+dbusif_record_play (NInputInterface *iface, const char *sender,
+                    DBusMessageIter *iter, uint32_t event_id)
+{
+    DBusInterfaceData *idata      = NULL;
+    NProplist         *properties = NULL;
+    GString           *line       = NULL;
+    const char        *event      = NULL;
+    gchar             *escaped    = NULL;
+
+    idata = n_input_interface_get_userdata (iface);
+
+    if (dbus_message_iter_get_arg_type (iter) != DBUS_TYPE_STRING)
+        return;
+
+    dbus_message_iter_get_basic (iter, &event);
+    dbus_message_iter_next (iter);
+
+    properties = n_proplist_new ();
+    if (msg_get_properties (iter, n_input_interface_get_core (iface), properties)) {
+        line = dbusif_record_line (idata, "play", sender, event_id);
+        escaped = g_strescape (event, NULL);
+        g_string_append_c (line, '\t');
+        g_string_append (line, escaped);
+        g_free (escaped);
+        n_proplist_foreach (properties, dbusif_record_property, line);
+        dbusif_record_write (idata, line);
+    }
+    n_proplist_free (properties);
+}
+
 static int
 dbusif_initialize (NInputInterface *iface)
 {
-    static struct DBusObjectPathVTable method = {
-        .message_function = dbusif_message_function
-    };
-
     DBusInterfaceData *idata;
+    NMetrics  *metrics;
     DBusError error;
     int       ret;
 
@@ -725,6 +1470,15 @@ dbusif_initialize (NInputInterface *iface)
     idata->iface = iface;
     n_input_interface_set_userdata (iface, idata);
 
+    metrics = n_core_get_metrics (n_input_interface_get_core (iface));
+    idata->client_limit_metric = n_metrics_add_counter (metrics, "dbus.rejected.client_limit");
+    idata->request_limit_metric = n_metrics_add_counter (metrics, "dbus.rejected.request_limit");
+    idata->shed_metric = n_metrics_add_counter (metrics, "dbus.shed.rate_limit");
+    idata->coalesced_metric = n_metrics_add_counter (metrics, "dbus.coalesced.rate_limit");
+    idata->preempted_metric = n_metrics_add_counter (metrics, "dbus.preempted.request_limit");
+    idata->clients_metric = n_metrics_add_gauge (metrics, "dbus.clients");
+    idata->clients = g_hash_table_new (g_str_hash, g_str_equal);
+
     dbus_error_init (&error);
     idata->connection = dbus_bus_get (DBUS_BUS_SYSTEM, &error);
     if (!idata->connection) {
@@ -744,13 +1498,20 @@ dbusif_initialize (NInputInterface *iface)
     }
 
     if (!dbus_connection_register_object_path (idata->connection,
-        NGF_DBUS_PATH, &method, iface))
+        NGF_DBUS_PATH, &dbusif_vtable, iface))
         goto error;
 
     /* Monitor for ohmd restarts and disconnecting clients*/
     dbus_bus_add_match (idata->connection, DBUS_CLIENT_MATCH, NULL);
     dbus_connection_add_filter (idata->connection, dbusif_message_function, iface, NULL);
 
+    /* a failing peer server leaves the bus interface running */
+    if (dbusif_peer_server)
+        (void) dbusif_peer_server_start (iface);
+
+    if (dbusif_record_file)
+        dbusif_record_open (idata);
+
     return TRUE;
 
 error:
@@ -767,9 +1528,23 @@ dbusif_shutdown (NInputInterface *iface)
 
     idata = n_input_interface_get_userdata (iface);
 
+    if (idata && idata->status_flush_id) {
+        g_source_remove (idata->status_flush_id);
+        dbusif_status_flush_cb (idata);
+    }
+
+    if (idata)
+        dbusif_peer_server_stop (iface);
+
+    if (idata)
+        dbusif_record_close (idata);
+
     if (idata && idata->connection)
         dbus_connection_unref (idata->connection);
 
+    if (idata && idata->clients)
+        g_hash_table_destroy (idata->clients);
+
     g_free (idata);
 }
 
@@ -783,53 +1558,144 @@ dbusif_send_error (NInputInterface *iface, NRequest *request,
     dbusif_send_reply (iface, request, N_DBUS_EVENT_FAILED);
 }
 
-static void
-dbusif_send_reply (NInputInterface *iface, NRequest *request, int code)
+static guint
+dbusif_status_mask (const NProplist *props)
 {
-    DBusInterfaceData   *idata   = NULL;
-    DBusMessage         *msg     = NULL;
-    const NProplist     *props   = NULL;
-    guint               event_id = 0;
-    DBusInterfaceClient *client  = NULL;
-    guint               status   = N_DBUS_EVENT_FAILED;
+    const char *value = NULL;
 
-    idata = n_input_interface_get_userdata (iface);
+    if (!(value = n_proplist_get_string (props, NGF_DBUS_STATUS_KEY)))
+        return STATUS_MASK_ALL;
 
-    props  = n_request_get_properties (request);
-    event_id = n_request_get_id (request);
-    status = code;
+    if (g_str_equal (value, "none"))
+        return STATUS_MASK_NONE;
+    else if (g_str_equal (value, "completion"))
+        return STATUS_MASK_COMPLETION;
 
-    if (event_id == 0)
-        return;
+    return STATUS_MASK_ALL;
+}
 
-    N_DEBUG (LOG_CAT "sending reply for request '%s' (event.id=%d) with code %d",
-        n_request_get_name (request), event_id, code);
+static void
+dbusif_status_send (DBusInterfaceData *idata, DBusInterfaceClient *client,
+                    const DBusInterfaceStatus *entry)
+{
+    DBusMessage *msg = NULL;
 
     if ((msg = dbus_message_new_signal (NGF_DBUS_PATH,
                                         NGF_DBUS_IFACE,
                                         NGF_DBUS_STATUS)) == NULL) {
         N_WARNING (LOG_CAT "failed to construct signal.");
-        goto end;
+        return;
     }
 
     dbus_message_append_args (msg,
-        DBUS_TYPE_UINT32, &event_id,
-        DBUS_TYPE_UINT32, &status,
+        DBUS_TYPE_UINT32, &entry->event_id,
+        DBUS_TYPE_UINT32, &entry->status,
         DBUS_TYPE_INVALID);
 
-    dbus_connection_send (idata->connection, msg, NULL);
+    /* peers see the status on their own connection. on the bus the
+       signal is broadcast, other listeners may follow it, unless the
+       client asked to be the only one woken up. */
+    if (client->connection) {
+        dbus_connection_send (client->connection, msg, NULL);
+    } else {
+        if (client->unicast)
+            dbus_message_set_destination (msg, client->name);
+        dbus_connection_send (idata->connection, msg, NULL);
+    }
+
     dbus_message_unref (msg);
+}
+
+static gboolean
+dbusif_status_flush_cb (gpointer userdata)
+{
+    DBusInterfaceData   *idata  = userdata;
+    DBusInterfaceClient *client = NULL;
+    GSList              *iter   = NULL;
+    guint                i;
+
+    idata->status_flush_id = 0;
+
+    for (iter = idata->status_clients; iter; iter = g_slist_next (iter)) {
+        client = iter->data;
+        for (i = 0; i < client->status->len; i++)
+            dbusif_status_send (idata, client,
+                                &g_array_index (client->status, DBusInterfaceStatus, i));
+        g_array_set_size (client->status, 0);
+        client_unref (client);
+    }
+
+    g_slist_free (idata->status_clients);
+    idata->status_clients = NULL;
+
+    return FALSE;
+}
+
+static void
+dbusif_status_queue (DBusInterfaceData *idata, DBusInterfaceClient *client,
+                     uint32_t event_id, uint32_t status)
+{
+    DBusInterfaceStatus *entry = NULL;
+    DBusInterfaceStatus  queued;
+    guint                i;
+
+    if (client->status->len == 0) {
+        idata->status_clients = g_slist_prepend (idata->status_clients,
+                                                 client_ref (client));
+        if (!idata->status_flush_id)
+            idata->status_flush_id = g_idle_add (dbusif_status_flush_cb, idata);
+    }
+
+    /* a newer state of the same request replaces one that was not
+       sent yet, completion is always the last state of a request. */
+    for (i = 0; i < client->status->len; i++) {
+        entry = &g_array_index (client->status, DBusInterfaceStatus, i);
+        if (entry->event_id == event_id) {
+            entry->status = status;
+            return;
+        }
+    }
+
+    queued.event_id = event_id;
+    queued.status = status;
+    g_array_append_val (client->status, queued);
+}
+
+static void
+dbusif_send_reply (NInputInterface *iface, NRequest *request, int code)
+{
+    DBusInterfaceData   *idata    = NULL;
+    const NProplist     *props    = NULL;
+    guint               event_id  = 0;
+    DBusInterfaceClient *client   = NULL;
+    gboolean            completed = FALSE;
+    guint               mask      = STATUS_MASK_ALL;
+
+    idata = n_input_interface_get_userdata (iface);
+
+    props  = n_request_get_properties (request);
+    event_id = n_request_get_id (request);
+    client = n_proplist_get_pointer (props, NGF_DBUS_PROPERTY_NAME);
+    completed = (code == N_DBUS_EVENT_FAILED || code == N_DBUS_EVENT_COMPLETED);
 
-end:
-    if (code == N_DBUS_EVENT_FAILED || code == N_DBUS_EVENT_COMPLETED) {
-        client = n_proplist_get_pointer (props, NGF_DBUS_PROPERTY_NAME);
-        client_request_done (client);
+    if (event_id == 0 || !client)
+        return;
+
+    mask = dbusif_status_mask (props);
+    if (mask & (completed ? STATUS_MASK_COMPLETION : STATUS_MASK_STATE)) {
+        N_DEBUG (LOG_CAT "queueing reply for request '%s' (event.id=%d) with code %d",
+            n_request_get_name (request), event_id, code);
+        dbusif_status_queue (idata, client, event_id, code);
+    }
+
+    if (completed) {
+        client_request_done (client, event_id,
+                             event_is_low_priority (n_request_get_name (request)));
         client_unref (client);
     }
 }
 
-int
-n_plugin__load (NPlugin *plugin)
+N_PLUGIN_LOAD (plugin)
 {
     static const NInputInterfaceDecl iface = {
         .name       = "dbus",
@@ -842,10 +1708,48 @@ n_plugin__load (NPlugin *plugin)
     const NProplist *props;
     const char *value;
 
+    props = n_plugin_get_params (plugin);
+    dbusif_parse_limits (props);
+
+    /* declare the request keys read here */
+    (void) n_atom_intern (NGF_DBUS_STATUS_KEY);
+    (void) n_atom_intern (NGF_DBUS_UNICAST_KEY);
+
+    dbusif_peer_server = DEFAULT_PEER_SERVER;
+    if (n_proplist_has_key (props, DBUSIF_PEER_SERVER) &&
+        (value = n_proplist_get_string (props, DBUSIF_PEER_SERVER))) {
+        dbusif_peer_server = g_ascii_strcasecmp (value, "true") == 0;
+    }
+
+    if (n_proplist_has_key (props, DBUSIF_PEER_ADDRESS) &&
+        (value = n_proplist_get_string (props, DBUSIF_PEER_ADDRESS))) {
+        dbusif_peer_address = g_strdup (value);
+    }
+
+    if (n_proplist_has_key (props, DBUSIF_RECORD_FILE) &&
+        (value = n_proplist_get_string (props, DBUSIF_RECORD_FILE))) {
+        dbusif_record_file = g_strdup (value);
+    }
+
+    /* register the DBus interface as the NInputInterface */
+    n_plugin_register_input (plugin, &iface);
+
+    return 1;
+}
+
+/* The request and client limits, the rate limit and the low priority
+   events can be changed at runtime. The peer server is set up once. */
+static void
+dbusif_parse_limits (const NProplist *props)
+{
+    const char *value;
+    gchar **patterns;
+    gchar **p;
+
     dbusif_max_requests = DEFAULT_REQUEST_LIMIT;
     dbusif_max_clients = DEFAULT_CLIENT_LIMIT;
-
-    props = n_plugin_get_params (plugin);
+    dbusif_rate = DEFAULT_RATE;
+    dbusif_burst = DEFAULT_BURST;
 
     if (n_proplist_has_key (props, DBUSIF_REQUEST_LIMIT) &&
         (value = n_proplist_get_string (props, DBUSIF_REQUEST_LIMIT))) {
@@ -857,14 +1761,56 @@ n_plugin__load (NPlugin *plugin)
         dbusif_max_clients = atoi (value);
     }
 
-    /* register the DBus interface as the NInputInterface */
-    n_plugin_register_input (plugin, &iface);
+    if (n_proplist_has_key (props, DBUSIF_RATE) &&
+        (value = n_proplist_get_string (props, DBUSIF_RATE))) {
+        dbusif_rate = g_ascii_strtod (value, NULL);
+    }
+
+    if (n_proplist_has_key (props, DBUSIF_BURST) &&
+        (value = n_proplist_get_string (props, DBUSIF_BURST))) {
+        dbusif_burst = g_ascii_strtod (value, NULL);
+    }
+
+    if (dbusif_burst < 1.0)
+        dbusif_burst = 1.0;
+
+    g_slist_free_full (dbusif_low_priority, (GDestroyNotify) g_pattern_spec_free);
+    dbusif_low_priority = NULL;
+
+    if (!n_proplist_has_key (props, DBUSIF_LOW_PRIORITY) ||
+        !(value = n_proplist_get_string (props, DBUSIF_LOW_PRIORITY)))
+        value = DEFAULT_LOW_PRIORITY;
+
+    patterns = g_strsplit (value, ";", -1);
+    for (p = patterns; *p; ++p) {
+        g_strstrip (*p);
+        if (**p)
+            dbusif_low_priority = g_slist_append (dbusif_low_priority,
+                                                  g_pattern_spec_new (*p));
+    }
+    g_strfreev (patterns);
+}
+
+N_PLUGIN_RELOAD (plugin, params)
+{
+    (void) plugin;
+
+    dbusif_parse_limits (params);
+
+    N_INFO (LOG_CAT "limits: %u requests per client, %u clients, rate %.1f/s burst %.1f",
+            dbusif_max_requests, dbusif_max_clients, dbusif_rate, dbusif_burst);
 
     return 1;
 }
 
-void
-n_plugin__unload (NPlugin *plugin)
+N_PLUGIN_UNLOAD (plugin)
 {
     (void) plugin;
+
+    g_slist_free_full (dbusif_low_priority, (GDestroyNotify) g_pattern_spec_free);
+    dbusif_low_priority = NULL;
+    g_free (dbusif_peer_address);
+    dbusif_peer_address = NULL;
+    g_free (dbusif_record_file);
+    dbusif_record_file = NULL;
 }
@@ -56,9 +56,8 @@ device_lock_state_to_string (int state)
 static void
 update_context_devicelock_state (NContext *context, int value)
 {
-    NValue *v = n_value_new ();
-    n_value_set_string (v, device_lock_state_to_string (value));
-    n_context_set_value (context, DEVICE_LOCK_KEY, v);
+    (void) n_context_set_string_if_changed (context, DEVICE_LOCK_KEY,
+                                            device_lock_state_to_string (value));
 }
 
 static void
@@ -112,6 +111,9 @@ N_PLUGIN_LOAD (plugin)
     context = n_core_get_context (core);
     g_assert (context);
 
+    /* last known state until the state query is answered. */
+    (void) n_context_restore_value (context, DEVICE_LOCK_KEY);
+
     if (n_dbus_add_match (core,
                           filter_cb,
                           context,
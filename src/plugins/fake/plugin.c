@@ -38,8 +38,8 @@ N_PLUGIN_DESCRIPTION ("Fake plugin")
 static int
 fake_sink_initialize (NSinkInterface *iface)
 {
-    (void) iface;
     N_DEBUG (LOG_CAT "sink initialize");
+    n_sink_interface_add_plan_key (iface, NULL, FALSE);
     return TRUE;
 }
 
@@ -65,7 +65,7 @@ fake_sink_prepare (NSinkInterface *iface, NRequest *request)
 {
     N_DEBUG (LOG_CAT "sink prepare");
 
-    FakeData *data = g_slice_new0 (FakeData);
+    FakeData *data = n_request_alloc (request, sizeof (FakeData));
 
     data->request    = request;
     data->iface      = iface;
@@ -131,8 +131,6 @@ fake_sink_stop (NSinkInterface *iface, NRequest *request)
         g_source_remove (data->timeout_id);
         data->timeout_id = 0;
     }
-
-    g_slice_free (FakeData, data);
 }
 
 N_PLUGIN_LOAD (plugin)
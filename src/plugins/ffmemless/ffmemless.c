@@ -67,6 +67,18 @@ int ffmemless_erase_effect(int effect_id, int device_file)
 	}
 }
 
+int ffmemless_effect_slots(int device_file)
+{
+	int count;
+
+	if (ioctl(device_file, EVIOCGEFFECTS, &count) == -1) {
+		perror("Vibra query effect count");
+		return -1;
+	} else {
+		return count;
+	}
+}
+
 int ffmemless_evdev_file_open(const char *file_name, unsigned long features[4])
 {
 	int result, fp;
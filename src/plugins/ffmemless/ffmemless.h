@@ -28,6 +28,15 @@ int ffmemless_play(int effect_id, int device_file, int play);
 int ffmemless_upload_effect(struct ff_effect *effect, int device_file);
 int ffmemless_erase_effect(int effect_id, int device_file);
 
+/**
+ * ffmemless_effect_slots - Query the number of effects a device can hold.
+ *
+ * @param device_file An open file descriptor of the event device
+ * @returns Number of effects that can be uploaded at the same time,
+ *          -1 on error.
+ */
+int ffmemless_effect_slots(int device_file);
+
 /**
  * ffmemless_evdev_file_open - Open given device file.
  *
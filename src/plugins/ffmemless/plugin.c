@@ -24,8 +24,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
 #include <ngf/plugin.h>
 #include <ngf/haptic.h>
+#include <ngf/timer.h>
+#include <ngf/context.h>
 #include <linux/input.h>
 
 #include "ffmemless.h"
@@ -40,6 +44,11 @@
 #define FFM_CACHE_EFFECTS_KEY	"cache_effects"
 #define FFM_SOUND_REPEAT_KEY	"sound.repeat"
 #define FFM_HAPTIC_DURATION_KEY	"haptic.duration"
+#define FFM_PREWARM_TIMEOUT_KEY	"prewarm_timeout"
+#define FFM_EFFECT_SLOTS_KEY	"effect_slots"
+#define FFM_IO_THREAD_KEY	"io_thread"
+#define FFM_EFFECT_TABLE_KEY	"effect_table"
+#define FFM_LEVEL_SCALE_KEY	"level_scale"
 #define FFM_MAX_PARAM_LEN	80
 
 #define NGF_DEFAULT_DURATION	240
@@ -52,6 +61,11 @@
 
 #define CUSTOM_DATA_LEN 3
 
+#define FFM_DEFAULT_PREWARM_TIMEOUT 5000
+
+#define FFM_TABLE_MAGIC		"NGFFFMT"
+#define FFM_TABLE_VERSION	1
+
 N_PLUGIN_NAME(FFM_PLUGIN_NAME)
 N_PLUGIN_DESCRIPTION("Vibra plugin using ff-memless kernel backend")
 N_PLUGIN_VERSION("0.10")
@@ -62,18 +76,109 @@ struct ffm_effect_data {
 	int id;
 	int repeat;
 	guint playback_time;
-	int poll_id;
+	guint poll_id;
+	/* source of a start deferred to the common start time */
+	guint start_id;
 	int16_t customEffectId;
 	struct ff_effect cached_effect;
+	gboolean preloaded;
+	/* effect in the effects table this request plays */
+	const struct ffm_effect_data *origin;
+	struct ffm_slot *slot;
+	/* the request is gone, data waits for the worker to let go of it */
+	gboolean stopped;
+	/* effect was started, and stopped by a pause but kept on the device */
+	gboolean playing;
+	gboolean suspended;
+	/* parameters were set up from the ini files or the effect table */
+	gboolean configured;
+	/* copies scaled to the vibra levels, NULL unless level_scale is set */
+	struct ffm_effect_data **variants;
+};
+
+/* device effect slot, kept with the least recently played one evicted */
+struct ffm_slot {
+	const struct ffm_effect_data *effect;
+	int id;
+	int busy;
+	guint64 stamp;
+	/* holds parameters from before a reload, never found again */
+	gboolean stale;
+};
+
+/*
+ * Effect table file: a header followed by one entry per configured effect.
+ * The table is only used if it was compiled from the same plugin
+ * parameters and system settings file.
+ */
+struct ffm_table_header {
+	char magic[8];
+	guint32 version;
+	guint32 entry_size;
+	guint32 count;
+	guint32 props_hash;
+	gint64 sys_mtime;
+	gint64 sys_size;
+};
+
+struct ffm_table_entry {
+	char name[FFM_MAX_PARAM_LEN];
+	gint32 repeat;
+	gint16 custom_id;
+	struct ff_effect effect;
+};
+
+enum ffm_command_type {
+	FFM_CMD_PREPARE,
+	FFM_CMD_PLAY,
+	FFM_CMD_SUSPEND,
+	FFM_CMD_ERASE,
+	FFM_CMD_PREWARM,
+	FFM_CMD_FREE,
+	FFM_CMD_RELOAD,
+	FFM_CMD_QUIT
+};
+
+struct ffm_command {
+	enum ffm_command_type type;
+	struct ffm_effect_data *data;
+	const struct ffm_effect_data *effect;
+	int play;
+	/* of the result callbacks, the worker never touches the request */
+	gint priority;
+	/* of a reload, handed back to the main loop waiting for it */
+	int result;
 };
 
 static struct ffm_data {
 	int 		dev_file;
 	const NProplist *ngfd_props;
 	NProplist *sys_props;
+	gchar *sys_file;
 	GHashTable	*effects;
 	gboolean cache_effects;
 	unsigned long features[4];
+	/* effect uploaded ahead of an expected request */
+	const struct ffm_effect_data *prewarm_effect;
+	int prewarm_id;
+	guint prewarm_expire_id;
+	guint prewarm_timeout;
+	NTimers *prewarm_timers;
+	/* resident effects, NULL unless effect_slots is set */
+	struct ffm_slot *slots;
+	int slot_count;
+	guint64 slot_clock;
+	const struct ffm_effect_data *default_effect;
+	/* haptics I/O worker, NULL unless io_thread is set */
+	GThread *worker;
+	GAsyncQueue *commands;
+	GAsyncQueue *replies;
+	/* magnitude percent of the touch effects for vibra levels from 1 on */
+	int *level_scale;
+	int level_count;
+	/* scale of the current vibra level, -1 if touch effects play as is */
+	int level_index;
+	NContext *context;
 } ffm;
 
 static int ffm_setup_device(const NProplist *props, int *dev_fd)
@@ -199,6 +304,19 @@ done:
 	return proplist;
 }
 
+static void ffm_effect_free(gpointer userdata)
+{
+	struct ffm_effect_data *data = (struct ffm_effect_data *) userdata;
+	int i;
+
+	if (data->variants) {
+		for (i = 0; i < ffm.level_count; i++)
+			g_free(data->variants[i]);
+		g_free(data->variants);
+	}
+	g_free(data);
+}
+
 /*
  * Create a Hash table of effects from a string of semicolon separated keys.
  * Values of keys will be initialized to -1.
@@ -224,7 +342,7 @@ static GHashTable *ffm_new_effect_list(const char *effect_data)
 	}
 
 	list = g_hash_table_new_full(g_str_hash,  g_str_equal,
-					g_free, g_free);
+					g_free, ffm_effect_free);
 
 	for (i = 0; effect_names[i] != NULL; i++) {
 		/* Add effect key to effect list with initial data */
@@ -240,6 +358,80 @@ ffm_effect_list_done:
 	return list;
 }
 
+static int ffm_setup_slots(const char *value, int dev_fd)
+{
+	int capacity = ffmemless_effect_slots(dev_fd);
+	int count;
+
+	/* the default effect stays uploaded outside of the slots */
+	if (capacity < 2) {
+		N_WARNING (LOG_CAT "device holds %d effects, not managing slots",
+				capacity);
+		return -1;
+	}
+
+	count = capacity - 1;
+	if (g_strcmp0(value, "auto") && atoi(value) > 0 && atoi(value) < count)
+		count = atoi(value);
+
+	ffm.slots = g_new0(struct ffm_slot, count);
+	ffm.slot_count = count;
+	ffm.slot_clock = 0;
+
+	N_DEBUG (LOG_CAT "managing %d of %d effect slots", count, capacity);
+	return 0;
+}
+
+static struct ffm_slot *ffm_slot_find(const struct ffm_effect_data *effect)
+{
+	int i;
+
+	for (i = 0; i < ffm.slot_count; i++) {
+		if (ffm.slots[i].effect == effect && !ffm.slots[i].stale)
+			return &ffm.slots[i];
+	}
+	return NULL;
+}
+
+/* Free slot, or the least recently used idle one after erasing its effect */
+static struct ffm_slot *ffm_slot_claim(void)
+{
+	struct ffm_slot *lru = NULL;
+	int i;
+
+	for (i = 0; i < ffm.slot_count; i++) {
+		if (!ffm.slots[i].effect)
+			return &ffm.slots[i];
+		if (!ffm.slots[i].busy && (!lru || ffm.slots[i].stamp < lru->stamp))
+			lru = &ffm.slots[i];
+	}
+
+	if (!lru) {
+		N_WARNING (LOG_CAT "all %d effect slots are playing", ffm.slot_count);
+		return NULL;
+	}
+
+	N_DEBUG (LOG_CAT "evicting effect %d from its slot", lru->id);
+	ffmemless_erase_effect(lru->id, ffm.dev_file);
+	lru->effect = NULL;
+	lru->id = -1;
+	lru->stale = FALSE;
+
+	return lru;
+}
+
+static void ffm_slot_drop(const struct ffm_effect_data *effect)
+{
+	struct ffm_slot *slot = ffm_slot_find(effect);
+
+	if (!slot)
+		return;
+
+	ffmemless_erase_effect(slot->id, ffm.dev_file);
+	slot->effect = NULL;
+	slot->id = -1;
+}
+
 /* Load the default fall-back effect and insert it to effects table */
 static int ffm_setup_default_effect(GHashTable *effects, int dev_fd)
 {
@@ -278,9 +470,10 @@ static int ffm_setup_default_effect(GHashTable *effects, int dev_fd)
 		ff.u.rumble.strong_magnitude = NGF_DEFAULT_RMAGNITUDE;
 		ff.u.rumble.weak_magnitude = NGF_DEFAULT_RMAGNITUDE;
 	}
-	if (ffm.cache_effects) {
+	if (ffm.cache_effects || ffm.slots) {
 		memcpy(&data->cached_effect, &ff, sizeof(ff));
 	}
+	ffm.default_effect = data;
 	if (ffmemless_upload_effect(&ff, dev_fd)) {
 		N_DEBUG (LOG_CAT "%s effect load failed", N_HAPTIC_EFFECT_DEFAULT);
 		return -1;
@@ -291,6 +484,108 @@ static int ffm_setup_default_effect(GHashTable *effects, int dev_fd)
 	return 0;
 }
 
+/*
+ * Replace the effect of data in the kernel with ff, which has all of its
+ * parameters filled in. Returns 1 if the effect was skipped and -1 if it
+ * could not be loaded.
+ */
+static int ffm_load_effect(const char *key, struct ffm_effect_data *data,
+				struct ff_effect *ff)
+{
+	int16_t custom_data[CUSTOM_DATA_LEN] = {0, 0, 0};
+	struct ffm_slot *slot = NULL;
+	gboolean slotted;
+
+	slotted = ffm.slots && data != ffm.default_effect;
+
+	if (slotted) {
+		ffm_slot_drop(data);
+		data->id = -1;
+		if ((slot = ffm_slot_claim()) == NULL)
+			return 1;
+	} else if (data->id != -1) {
+		if(ffmemless_erase_effect(data->id, ffm.dev_file)) {
+			N_WARNING (LOG_CAT "Failed to remove id %d",
+							data->id);
+			return 1;
+		}
+		data->id = -1;
+	}
+	ff->id = data->id;
+
+	N_DEBUG (LOG_CAT "Creating / updating effect %s", key);
+
+	if (ff->type == FF_PERIODIC && ff->u.periodic.waveform == FF_CUSTOM) {
+		custom_data[0] = data->customEffectId;
+		ff->u.periodic.custom_data = custom_data;
+		ff->u.periodic.custom_len = CUSTOM_DATA_LEN;
+	}
+
+	/* Finally load the effect */
+	if (ffmemless_upload_effect(ff, ffm.dev_file)) {
+		N_DEBUG (LOG_CAT "%s effect loading failed",
+						key);
+		return -1;
+	}
+	/* If the id was -1, kernel has updated it with valid value */
+	data->id = ff->id;
+	if (slotted) {
+		slot->effect = data;
+		slot->id = ff->id;
+		slot->stamp = ++ffm.slot_clock;
+	}
+	/* Calculate the playback time */
+	if (ff->type == FF_PERIODIC && ff->u.periodic.waveform == FF_CUSTOM) {
+		data->playback_time = ff->u.periodic.custom_data[1] * 1000
+			+ ff->u.periodic.custom_data[2];
+		N_DEBUG(LOG_CAT "Custom effect %d reports back %hd ms playback time",
+			ff->id, data->playback_time);
+	} else {
+		data->playback_time = data->repeat *
+			(ff->replay.delay + ff->replay.length);
+	}
+
+	/* kept for re-uploads and for the effect table */
+	memcpy(&data->cached_effect, ff, sizeof(*ff));
+
+	N_DEBUG (LOG_CAT "Created effect %s with id %d", key, data->id);
+	N_DEBUG (LOG_CAT "Parameters:\n"
+		"type = 0x%x\n"
+		"length = %dms\n"
+		"delay = %dms\n"
+		"strong rumble magn = 0x%x\n"
+		"weak rumble magn = 0x%x\n"
+		"const level = 0x%d\n"
+		"per_waveform = 0x%x\n"
+		"period = %dms\n"
+		"periodic magnitude = 0x%x\n"
+		"offset = 0x%x\n"
+		"phase = %d\n"
+		"att = %ums\n"
+		"att_lev = 0x%x\n"
+		"fade = %ums\n"
+		"fade_lev = 0x%x\n",
+		"custom_len = %d\n",
+		ff->type,
+		ff->replay.length,
+		ff->replay.delay,
+		ff->u.rumble.strong_magnitude,
+		ff->u.rumble.weak_magnitude,
+		ff->u.constant.level,
+		ff->u.periodic.waveform,
+		ff->u.periodic.period,
+		ff->u.periodic.magnitude,
+		ff->u.periodic.offset,
+		ff->u.periodic.phase,
+		ff->u.periodic.envelope.attack_length,
+		ff->u.periodic.envelope.attack_level,
+		ff->u.periodic.envelope.fade_length,
+		ff->u.periodic.envelope.fade_level,
+		ff->u.periodic.custom_len);
+
+	return 0;
+}
+
 /*
  * Setup parameters for given effects (if any parameters exist in props), and
  * load new or update existing effects to kernel.
@@ -319,7 +614,6 @@ static int ffm_setup_effects(const NProplist *props, GHashTable *effects)
 	while (g_hash_table_iter_next(&iter, (gpointer) &key,
 							(gpointer) &data)) {
 		memset(&ff, 0, sizeof(struct ff_effect));
-		int16_t custom_data[CUSTOM_DATA_LEN] = {0, 0, 0};
 		N_DEBUG (LOG_CAT "got key %s, id %d", key, data->id);
 
 		value = ffm_get_str_value(props, key, "_TYPE");
@@ -343,17 +637,6 @@ static int ffm_setup_effects(const NProplist *props, GHashTable *effects)
 			continue;
 		}
 
-		if (data->id != -1) {
-			if(ffmemless_erase_effect(data->id, ffm.dev_file)) {
-				N_WARNING (LOG_CAT "Failed to remove id %d",
-								data->id);
-				continue;
-			}
-			data->id = -1;
-		}
-		ff.id = data->id;
-
-		N_DEBUG (LOG_CAT "Creating / updating effect %s", key);
 
 		ff.replay.length = ffm_get_int_value(props, key,
 						"_DURATION", 0, UINT16_MAX);
@@ -434,9 +717,6 @@ static int ffm_setup_effects(const NProplist *props, GHashTable *effects)
 			if (ff.u.periodic.waveform == FF_CUSTOM) {
 				data->customEffectId = ffm_get_int_value(props,
 					key, "_CUSTOM", 0, UINT16_MAX);
-				custom_data[0] = data->customEffectId;
-				ff.u.periodic.custom_data = custom_data;
-				ff.u.periodic.custom_len = CUSTOM_DATA_LEN;
 			}
 
 			ff.u.periodic.period = ffm_get_int_value(props,
@@ -479,68 +759,308 @@ static int ffm_setup_effects(const NProplist *props, GHashTable *effects)
 		}
 
 		/* Finally load the effect */
-		if (ffmemless_upload_effect(&ff, ffm.dev_file)) {
-			N_DEBUG (LOG_CAT "%s effect loading failed",
-							key);
-			goto ffm_eff_error1;
+		switch (ffm_load_effect(key, data, &ff)) {
+		case 0:
+			data->configured = TRUE;
+			break;
+		case 1:
+			continue;
+		default:
+			return -1;
 		}
-		/* If the id was -1, kernel has updated it with valid value */
-		data->id = ff.id;
-		/* Calculate the playback time */
-		if (ff.type == FF_PERIODIC && ff.u.periodic.waveform == FF_CUSTOM) {
-			data->playback_time = ff.u.periodic.custom_data[1] * 1000
-				+ ff.u.periodic.custom_data[2];
-			N_DEBUG(LOG_CAT "Custom effect %d reports back %hd ms playback time",
-				ff.id, data->playback_time);
-		} else {
-			data->playback_time = data->repeat *
-				(ff.replay.delay + ff.replay.length);
+	}
+
+	return 0;
+}
+
+static void ffm_hash_prop(const char *key, const NValue *value, gpointer userdata)
+{
+	guint32 *hash = (guint32 *) userdata;
+	gchar *str = n_value_to_string(value);
+
+	/* summed up, the order of the proplist is not defined */
+	*hash += g_str_hash(key) * 31 + g_str_hash(str ? str : "");
+	g_free(str);
+}
+
+/* Fill in what a valid table header has to match */
+static void ffm_table_stamp(struct ffm_table_header *header)
+{
+	struct stat st;
+
+	memset(header, 0, sizeof(struct ffm_table_header));
+	memcpy(header->magic, FFM_TABLE_MAGIC, sizeof(header->magic));
+	header->version = FFM_TABLE_VERSION;
+	header->entry_size = sizeof(struct ffm_table_entry);
+	n_proplist_foreach(ffm.ngfd_props, ffm_hash_prop, &header->props_hash);
+
+	if (ffm.sys_file && g_stat(ffm.sys_file, &st) == 0) {
+		header->sys_mtime = st.st_mtime;
+		header->sys_size = st.st_size;
+	}
+}
+
+/* Load the effects from a compiled table, fails if the table is stale */
+static int ffm_table_load(const char *path, GHashTable *effects)
+{
+	const struct ffm_table_header *header;
+	const struct ffm_table_entry *entry;
+	struct ffm_table_header expect;
+	struct ffm_effect_data *data;
+	struct ff_effect ff;
+	GMappedFile *file;
+	gsize len;
+	guint32 i;
+	int ret = -1;
+
+	if ((file = g_mapped_file_new(path, FALSE, NULL)) == NULL) {
+		N_DEBUG (LOG_CAT "no effect table %s", path);
+		return -1;
+	}
+
+	len = g_mapped_file_get_length(file);
+	header = (const struct ffm_table_header *) g_mapped_file_get_contents(file);
+	ffm_table_stamp(&expect);
+
+	if (len < sizeof(expect) ||
+			memcmp(header->magic, expect.magic, sizeof(expect.magic)) ||
+			header->version != expect.version ||
+			header->entry_size != expect.entry_size ||
+			header->props_hash != expect.props_hash ||
+			header->sys_mtime != expect.sys_mtime ||
+			header->sys_size != expect.sys_size ||
+			len != sizeof(expect) + (gsize) header->count * expect.entry_size) {
+		N_DEBUG (LOG_CAT "effect table %s is out of date", path);
+		goto ffm_table_done;
+	}
+
+	entry = (const struct ffm_table_entry *) (header + 1);
+	for (i = 0; i < header->count; i++, entry++) {
+		data = g_hash_table_lookup(effects, entry->name);
+		if (!data) {
+			N_WARNING (LOG_CAT "effect %.*s of the table is not supported",
+					FFM_MAX_PARAM_LEN, entry->name);
+			goto ffm_table_done;
 		}
 
-		if (ffm.cache_effects) {
-			memcpy(&data->cached_effect, &ff, sizeof(ff));
+		memcpy(&ff, &entry->effect, sizeof(ff));
+		data->repeat = entry->repeat;
+		data->customEffectId = entry->custom_id;
+
+		if (ffm_load_effect(entry->name, data, &ff))
+			goto ffm_table_done;
+		data->configured = TRUE;
+	}
+
+	N_DEBUG (LOG_CAT "loaded %u effects from %s", header->count, path);
+	ret = 0;
+
+ffm_table_done:
+	g_mapped_file_unref(file);
+	return ret;
+}
+
+/* Compile the configured effects into a table for the next start */
+static void ffm_table_save(const char *path, GHashTable *effects)
+{
+	struct ffm_table_header header;
+	struct ffm_table_entry entry;
+	struct ffm_effect_data *data;
+	GHashTableIter iter;
+	GByteArray *table;
+	GError *error = NULL;
+	gchar *dir;
+	char *key;
+
+	ffm_table_stamp(&header);
+	table = g_byte_array_new();
+	g_byte_array_append(table, (const guint8 *) &header, sizeof(header));
+
+	g_hash_table_iter_init(&iter, effects);
+	while (g_hash_table_iter_next(&iter, (gpointer) &key,
+							(gpointer) &data)) {
+		if (!data->configured)
+			continue;
+
+		memset(&entry, 0, sizeof(entry));
+		if (g_strlcpy(entry.name, key, sizeof(entry.name)) >= sizeof(entry.name)) {
+			N_WARNING (LOG_CAT "effect name %s is too long for the table", key);
+			goto ffm_save_done;
 		}
+		entry.repeat = data->repeat;
+		entry.custom_id = data->customEffectId;
+		memcpy(&entry.effect, &data->cached_effect, sizeof(entry.effect));
+		entry.effect.id = -1;
+		if (entry.effect.type == FF_PERIODIC)
+			entry.effect.u.periodic.custom_data = NULL;
+
+		g_byte_array_append(table, (const guint8 *) &entry, sizeof(entry));
+		header.count++;
+	}
+	memcpy(table->data, &header, sizeof(header));
+
+	dir = g_path_get_dirname(path);
+	g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
 
-		N_DEBUG (LOG_CAT "Created effect %s with id %d", key, data->id);
-		N_DEBUG (LOG_CAT "Parameters:\n"
-			"type = 0x%x\n"
-			"length = %dms\n"
-			"delay = %dms\n"
-			"strong rumble magn = 0x%x\n"
-			"weak rumble magn = 0x%x\n"
-			"const level = 0x%d\n"
-			"per_waveform = 0x%x\n"
-			"period = %dms\n"
-			"periodic magnitude = 0x%x\n"
-			"offset = 0x%x\n"
-			"phase = %d\n"
-			"att = %ums\n"
-			"att_lev = 0x%x\n"
-			"fade = %ums\n"
-			"fade_lev = 0x%x\n",
-			"custom_len = %d\n",
-			ff.type,
-			ff.replay.length,
-			ff.replay.delay,
-			ff.u.rumble.strong_magnitude,
-			ff.u.rumble.weak_magnitude,
-			ff.u.constant.level,
-			ff.u.periodic.waveform,
-			ff.u.periodic.period,
-			ff.u.periodic.magnitude,
-			ff.u.periodic.offset,
-			ff.u.periodic.phase,
-			ff.u.periodic.envelope.attack_length,
-			ff.u.periodic.envelope.attack_level,
-			ff.u.periodic.envelope.fade_length,
-			ff.u.periodic.envelope.fade_level,
-			ff.u.periodic.custom_len);
+	if (!g_file_set_contents(path, (const gchar *) table->data, table->len,
+								&error)) {
+		N_WARNING (LOG_CAT "can't write effect table: %s", error->message);
+		g_error_free(error);
+	} else {
+		N_DEBUG (LOG_CAT "compiled %u effects into %s", header.count, path);
 	}
 
-	return 0;
-ffm_eff_error1:
-	g_hash_table_destroy(ffm.effects);
-	return -1;
+ffm_save_done:
+	g_byte_array_free(table, TRUE);
+}
+
+static NTimers *ffm_timers(struct ffm_effect_data *data)
+{
+	return n_core_get_timers(n_sink_interface_get_core(data->iface));
+}
+
+static struct ffm_slot *ffm_slot_get(const struct ffm_effect_data *effect);
+static int ffm_play_effect(struct ffm_effect_data *data, int play);
+static int ffm_suspend_effect(struct ffm_effect_data *data);
+static void ffm_play_failed(struct ffm_effect_data *data);
+static int ffm_reload_effects(void);
+
+static void ffm_worker_push(enum ffm_command_type type,
+				struct ffm_effect_data *data,
+				const struct ffm_effect_data *effect, int play)
+{
+	struct ffm_command *cmd = g_new0(struct ffm_command, 1);
+
+	cmd->type = type;
+	cmd->data = data;
+	cmd->effect = effect;
+	cmd->play = play;
+	cmd->priority = G_PRIORITY_DEFAULT_IDLE;
+	/* the request may be freed before the worker gets to the command */
+	if ((type == FFM_CMD_PREPARE || type == FFM_CMD_PLAY) && data->request)
+		cmd->priority = n_request_get_source_priority(data->request,
+						G_PRIORITY_DEFAULT_IDLE);
+	g_async_queue_push(ffm.commands, cmd);
+}
+
+static gboolean ffm_prepared_cb(gpointer userdata)
+{
+	struct ffm_effect_data *data = (struct ffm_effect_data *) userdata;
+
+	if (!data->stopped)
+		n_sink_interface_synchronize(data->iface, data->request);
+	return FALSE;
+}
+
+static gboolean ffm_play_failed_cb(gpointer userdata)
+{
+	struct ffm_effect_data *data = (struct ffm_effect_data *) userdata;
+
+	if (!data->stopped) {
+		ffm_play_failed(data);
+		n_sink_interface_fail(data->iface, data->request);
+	}
+	return FALSE;
+}
+
+static gboolean ffm_free_cb(gpointer userdata)
+{
+	g_free(userdata);
+	return FALSE;
+}
+
+/*
+ * Runs the device ioctls off the main loop. Commands are handled in the
+ * order they were queued, and results go back to the main loop as idle
+ * callbacks, which run in that same order.
+ */
+static gpointer ffm_worker_main(gpointer userdata)
+{
+	struct ffm_command *cmd;
+	gboolean running = TRUE;
+	(void) userdata;
+
+	while (running) {
+		cmd = g_async_queue_pop(ffm.commands);
+
+		switch (cmd->type) {
+		case FFM_CMD_PREPARE:
+			if (ffm.slots && cmd->data->origin != ffm.default_effect)
+				ffm_slot_get(cmd->data->origin);
+			g_idle_add_full(cmd->priority, ffm_prepared_cb, cmd->data,
+				NULL);
+			break;
+		case FFM_CMD_PLAY:
+			if (!ffm_play_effect(cmd->data, cmd->play) && cmd->play)
+				g_idle_add_full(cmd->priority, ffm_play_failed_cb,
+					cmd->data, NULL);
+			break;
+		case FFM_CMD_SUSPEND:
+			ffm_suspend_effect(cmd->data);
+			break;
+		case FFM_CMD_ERASE:
+			ffmemless_erase_effect(cmd->data->cached_effect.id,
+						ffm.dev_file);
+			break;
+		case FFM_CMD_PREWARM:
+			ffm_slot_get(cmd->effect);
+			break;
+		case FFM_CMD_FREE:
+			/* after any callback still queued for it */
+			g_idle_add(ffm_free_cb, cmd->data);
+			break;
+		case FFM_CMD_RELOAD:
+			/* the main loop waits for it and frees the command */
+			cmd->result = ffm_reload_effects();
+			g_async_queue_push(ffm.replies, cmd);
+			continue;
+		case FFM_CMD_QUIT:
+			running = FALSE;
+			break;
+		}
+		g_free(cmd);
+	}
+	return NULL;
+}
+
+static void ffm_worker_start(void)
+{
+	ffm.commands = g_async_queue_new();
+	ffm.replies = g_async_queue_new();
+	ffm.worker = g_thread_new("ffmemless", ffm_worker_main, NULL);
+	N_DEBUG (LOG_CAT "started haptics worker thread");
+}
+
+static void ffm_worker_stop(void)
+{
+	if (!ffm.worker)
+		return;
+
+	ffm_worker_push(FFM_CMD_QUIT, NULL, NULL, 0);
+	g_thread_join(ffm.worker);
+	g_async_queue_unref(ffm.commands);
+	g_async_queue_unref(ffm.replies);
+	ffm.worker = NULL;
+	ffm.commands = NULL;
+	ffm.replies = NULL;
+}
+
+/*
+ * Reload the effects on the worker, after the commands queued before.
+ * The main loop is blocked until then, so the worker has the effects
+ * and the slots to itself.
+ */
+static int ffm_worker_reload(void)
+{
+	struct ffm_command *cmd;
+	int ret;
+
+	ffm_worker_push(FFM_CMD_RELOAD, NULL, NULL, 0);
+	cmd = g_async_queue_pop(ffm.replies);
+	ret = cmd->result;
+	g_free(cmd);
+	return ret;
 }
 
 gboolean ffm_playback_done(gpointer userdata)
@@ -549,7 +1069,9 @@ gboolean ffm_playback_done(gpointer userdata)
 
 	N_DEBUG (LOG_CAT "Effect id %d completed", data->id);
 
-	if (ffm.cache_effects) {
+	if (ffm.cache_effects && ffm.worker) {
+		ffm_worker_push(FFM_CMD_ERASE, data, NULL, 0);
+	} else if (ffm.cache_effects) {
 		ffmemless_erase_effect(data->cached_effect.id, ffm.dev_file);
 	}
 	data->poll_id = 0;
@@ -557,15 +1079,160 @@ gboolean ffm_playback_done(gpointer userdata)
 	return FALSE;
 }
 
+static int ffm_upload_cached(struct ffm_effect_data *data)
+{
+	int16_t custom_data[CUSTOM_DATA_LEN] = {0, 0, 0};
+
+	data->cached_effect.id = -1;
+	if (data->cached_effect.type == FF_PERIODIC) {
+		custom_data[0] = data->customEffectId;
+		data->cached_effect.u.periodic.custom_data = custom_data;
+	}
+
+	return ffmemless_upload_effect(&data->cached_effect, ffm.dev_file);
+}
+
+/* Make the effect resident and return the slot holding it */
+static struct ffm_slot *ffm_slot_get(const struct ffm_effect_data *effect)
+{
+	struct ffm_effect_data copy;
+	struct ffm_slot *slot;
+
+	if ((slot = ffm_slot_find(effect)) == NULL) {
+		if ((slot = ffm_slot_claim()) == NULL)
+			return NULL;
+
+		memcpy(&copy, effect, sizeof(struct ffm_effect_data));
+		if (ffm_upload_cached(&copy)) {
+			N_DEBUG (LOG_CAT "upload of effect %d to a slot failed",
+					effect->id);
+			return NULL;
+		}
+
+		N_DEBUG (LOG_CAT "uploaded effect %d as %d", effect->id,
+				copy.cached_effect.id);
+		slot->effect = effect;
+		slot->id = copy.cached_effect.id;
+	}
+
+	slot->stamp = ++ffm.slot_clock;
+	return slot;
+}
+
+static void ffm_prewarm_clear(gboolean erase)
+{
+	if (!ffm.prewarm_effect)
+		return;
+
+	if (ffm.prewarm_expire_id) {
+		n_timers_remove(ffm.prewarm_timers, ffm.prewarm_expire_id);
+		ffm.prewarm_expire_id = 0;
+	}
+
+	if (erase)
+		ffmemless_erase_effect(ffm.prewarm_id, ffm.dev_file);
+
+	ffm.prewarm_effect = NULL;
+	ffm.prewarm_id = -1;
+}
+
+static gboolean ffm_prewarm_expire_cb(gpointer userdata)
+{
+	(void) userdata;
+
+	N_DEBUG (LOG_CAT "prewarmed effect %d was not claimed", ffm.prewarm_id);
+	ffm.prewarm_expire_id = 0;
+	ffm_prewarm_clear(TRUE);
+
+	return FALSE;
+}
+
+/* Device side of ffm_play(), runs on the worker thread if there is one */
+static int ffm_play_effect(struct ffm_effect_data *data, int play)
+{
+	int ret;
+
+	if (ffm.slots && data->origin != ffm.default_effect) {
+		if (play && !data->slot) {
+			if ((data->slot = ffm_slot_get(data->origin)) == NULL)
+				return FALSE;
+			data->slot->busy++;
+		} else if (!data->slot) {
+			/* not playing, nothing to stop */
+			return TRUE;
+		}
+
+		ret = ffmemless_play(data->slot->id, ffm.dev_file, play) ? FALSE : TRUE;
+
+		if (!play || !ret) {
+			data->slot->busy--;
+			data->slot = NULL;
+		}
+		return ret;
+	} else if (ffm.cache_effects) {
+		if (play && data->preloaded) {
+			/* uploaded already by the prewarm */
+			data->preloaded = FALSE;
+		} else if (play) {
+			if (ffm_upload_cached(data)) {
+				N_DEBUG (LOG_CAT "%d effect re-load failed", data->id);
+				return FALSE;
+			}
+		}
+
+		if (ffmemless_play(data->cached_effect.id, ffm.dev_file, play))
+			return FALSE;
+		return TRUE;
+	} else {
+		if (ffmemless_play(data->id, ffm.dev_file, play))
+			return FALSE;
+		return TRUE;
+	}
+}
+
+/*
+ * Device side of a pause. Vibra effects can not be paused, so the effect
+ * is stopped, but it stays uploaded for the resume to start it again.
+ */
+static int ffm_suspend_effect(struct ffm_effect_data *data)
+{
+	int id;
+
+	if (ffm.slots && data->origin != ffm.default_effect) {
+		if (!data->slot)
+			return TRUE;
+		/* the slot stays busy, so it is not evicted meanwhile */
+		id = data->slot->id;
+	} else if (ffm.cache_effects) {
+		id = data->cached_effect.id;
+		data->preloaded = TRUE;
+	} else {
+		id = data->id;
+	}
+
+	return ffmemless_play(id, ffm.dev_file, 0) ? FALSE : TRUE;
+}
+
+static void ffm_play_failed(struct ffm_effect_data *data)
+{
+	if (data->poll_id) {
+		n_timers_remove(ffm_timers(data), data->poll_id);
+		data->poll_id = 0;
+	}
+}
+
 static int ffm_play(struct ffm_effect_data *data, int play)
 {
 	data->poll_id = 0;
+	data->playing = play ? TRUE : FALSE;
+	data->suspended = FALSE;
 
 	/* if there is playback time set, this is single shot effect */
 	if (play) {
 		if (data->playback_time) {
 			N_DEBUG (LOG_CAT "setting up completion timer");
-			data->poll_id = g_timeout_add(data->playback_time + 20,
+			data->poll_id = n_timers_add(ffm_timers(data),
+						data->playback_time + 20,
 						ffm_playback_done, data);
 		}
 		N_DEBUG (LOG_CAT "Starting playback %d", data->id);
@@ -574,43 +1241,265 @@ static int ffm_play(struct ffm_effect_data *data, int play)
 		N_DEBUG (LOG_CAT "Stopping playback %d", data->id);
 	}
 
-	if (ffm.cache_effects) {
-		int16_t custom_data[CUSTOM_DATA_LEN] = {0, 0, 0};
-		if (play) {
-			data->cached_effect.id = -1;
-			if (data->cached_effect.type == FF_PERIODIC) {
-				custom_data[0] = data->customEffectId;
-				data->cached_effect.u.periodic.custom_data = custom_data;
-			}
-			if (ffmemless_upload_effect(&data->cached_effect, ffm.dev_file)) {
-				N_DEBUG (LOG_CAT "%d effect re-load failed", data->id);
-				if (data->poll_id) {
-					g_source_remove (data->poll_id);
-					data->poll_id = 0;
-				}
-				return FALSE;
-			} 
-		}
-
-		if (ffmemless_play(data->cached_effect.id, ffm.dev_file, play))
-			return FALSE;
-		return TRUE;
-	} else {
-		if (ffmemless_play(data->id, ffm.dev_file, play))
-			return FALSE;
+	/* failures are reported back from the worker */
+	if (ffm.worker) {
+		ffm_worker_push(FFM_CMD_PLAY, data, NULL, play);
 		return TRUE;
 	}
+
+	if (!ffm_play_effect(data, play)) {
+		ffm_play_failed(data);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static __u16 ffm_scale_u16(__u16 value, int percent)
+{
+	return (__u16) ((guint32) value * percent / 100);
+}
+
+static __s16 ffm_scale_s16(__s16 value, int percent)
+{
+	return (__s16) ((gint32) value * percent / 100);
+}
+
+static void ffm_scale_effect(struct ff_effect *ff, int percent)
+{
+	switch (ff->type) {
+	case FF_RUMBLE:
+		ff->u.rumble.strong_magnitude = ffm_scale_u16(
+			ff->u.rumble.strong_magnitude, percent);
+		ff->u.rumble.weak_magnitude = ffm_scale_u16(
+			ff->u.rumble.weak_magnitude, percent);
+		break;
+	case FF_CONSTANT:
+		ff->u.constant.level = ffm_scale_s16(ff->u.constant.level,
+						percent);
+		ff->u.constant.envelope.attack_level = ffm_scale_u16(
+			ff->u.constant.envelope.attack_level, percent);
+		ff->u.constant.envelope.fade_level = ffm_scale_u16(
+			ff->u.constant.envelope.fade_level, percent);
+		break;
+	case FF_PERIODIC:
+		ff->u.periodic.magnitude = ffm_scale_s16(
+			ff->u.periodic.magnitude, percent);
+		ff->u.periodic.offset = ffm_scale_s16(ff->u.periodic.offset,
+						percent);
+		ff->u.periodic.envelope.attack_level = ffm_scale_u16(
+			ff->u.periodic.envelope.attack_level, percent);
+		ff->u.periodic.envelope.fade_level = ffm_scale_u16(
+			ff->u.periodic.envelope.fade_level, percent);
+		break;
+	}
+}
+
+/* Parse the level_scale percentages, fails if scaling can't be used */
+static int ffm_setup_level_scale(const char *value)
+{
+	gchar **levels;
+	int i;
+
+	/* variants are uploaded like the cached effects, or into slots */
+	if (!ffm.slots && !ffm.cache_effects) {
+		N_WARNING (LOG_CAT "%s needs %s or %s", FFM_LEVEL_SCALE_KEY,
+				FFM_EFFECT_SLOTS_KEY, FFM_CACHE_EFFECTS_KEY);
+		return -1;
+	}
+
+	levels = g_strsplit(value, ";", 0);
+	ffm.level_count = g_strv_length(levels);
+	ffm.level_scale = g_new0(int, ffm.level_count);
+	for (i = 0; i < ffm.level_count; i++)
+		ffm.level_scale[i] = CLAMP(atoi(levels[i]), 0, 100);
+	g_strfreev(levels);
+
+	return ffm.level_count > 0 ? 0 : -1;
+}
+
+static void ffm_fill_variant(struct ffm_effect_data *variant,
+				const struct ffm_effect_data *data, int percent)
+{
+	memcpy(variant, data, sizeof(struct ffm_effect_data));
+	variant->id = -1;
+	variant->variants = NULL;
+	variant->cached_effect.id = -1;
+	ffm_scale_effect(&variant->cached_effect, percent);
+}
+
+/*
+ * Switch the touch effects to the scale of the vibra level. The scaled
+ * variants of a level are computed the first time the level is used and
+ * kept, they are uploaded when played like any other effect, so plays
+ * at any level cost the same. Level 0 disables touch effects altogether.
+ */
+static void ffm_set_vibra_level(int level)
+{
+	struct ffm_effect_data *data;
+	struct ffm_effect_data *variant;
+	GHashTableIter iter;
+	int index;
+
+	if (!ffm.level_count || level <= 0)
+		return;
+
+	index = MIN(level, ffm.level_count) - 1;
+	if (index == ffm.level_index)
+		return;
+
+	N_DEBUG (LOG_CAT "vibra level %d, touch effects at %d%%", level,
+			ffm.level_scale[index]);
+
+	g_hash_table_iter_init(&iter, ffm.effects);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer) &data)) {
+		/* the default effect is uploaded for good outside the slots */
+		if (!data->configured || data == ffm.default_effect ||
+				ffm.level_scale[index] >= 100)
+			continue;
+
+		if (!data->variants)
+			data->variants = g_new0(struct ffm_effect_data *,
+						ffm.level_count);
+		if (data->variants[index])
+			continue;
+
+		variant = g_new(struct ffm_effect_data, 1);
+		ffm_fill_variant(variant, data, ffm.level_scale[index]);
+		data->variants[index] = variant;
+	}
+
+	ffm.level_index = index;
+}
+
+/*
+ * Scale the variants again from the reloaded effects. Requests may be
+ * playing them, so they are refilled in place instead of replaced.
+ */
+static void ffm_rescale_variants(void)
+{
+	struct ffm_effect_data *data;
+	GHashTableIter iter;
+	int i;
+
+	if (!ffm.level_count)
+		return;
+
+	g_hash_table_iter_init(&iter, ffm.effects);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer) &data)) {
+		if (!data->variants)
+			continue;
+		for (i = 0; i < ffm.level_count; i++) {
+			if (data->variants[i])
+				ffm_fill_variant(data->variants[i], data,
+						ffm.level_scale[i]);
+		}
+	}
+
+	/* the effects configured by the reload get their variant too */
+	ffm.level_index = -1;
+	if (ffm.context)
+		ffm_set_vibra_level(n_value_get_int(n_context_get_value(
+			ffm.context, N_HAPTIC_VIBRA_LEVEL_KEY)));
+}
+
+static void ffm_vibra_level_changed_cb(NContext *context, const char *key,
+					const NValue *old_value,
+					const NValue *new_value,
+					void *userdata)
+{
+	(void) context;
+	(void) key;
+	(void) old_value;
+	(void) userdata;
+
+	ffm_set_vibra_level(n_value_get_int(new_value));
+}
+
+/* Touch effects play the variant of the current vibra level */
+static const struct ffm_effect_data *ffm_effect_scaled(
+				const struct ffm_effect_data *data,
+				NRequest *request)
+{
+	const NProplist *props = n_request_get_properties(request);
+
+	if (ffm.level_index < 0 || !data->variants ||
+			!data->variants[ffm.level_index])
+		return data;
+
+	if (n_haptic_class_for_type(n_proplist_get_string(props,
+				N_HAPTIC_TYPE_KEY)) != N_HAPTIC_CLASS_TOUCH)
+		return data;
+
+	return data->variants[ffm.level_index];
 }
 
 static void ffm_sink_shutdown(NSinkInterface *iface)
 {
 	(void) iface;
+	ffm_worker_stop();
+	ffm_prewarm_clear(TRUE);
+	if (ffm.context) {
+		n_context_unsubscribe_value_change(ffm.context,
+			N_HAPTIC_VIBRA_LEVEL_KEY, ffm_vibra_level_changed_cb);
+		ffm.context = NULL;
+	}
 	g_hash_table_destroy(ffm.effects);
+	ffm.effects = NULL;
+	g_free(ffm.level_scale);
+	ffm.level_scale = NULL;
+	ffm.level_count = 0;
+	ffm.level_index = -1;
+	/* closing the device erases the resident effects */
+	g_free(ffm.slots);
+	ffm.slots = NULL;
+	ffm.slot_count = 0;
 	ffm_close_device(ffm.dev_file);
 }
 
+/*
+ * Set the effects up again from the current parameters, on the worker if
+ * there is one. The effects keep their place in the table, as requests,
+ * slots and variants point into it. Idle slots are emptied, the playing
+ * ones are left stale, to be evicted first once they are stopped.
+ */
+static int ffm_reload_effects(void)
+{
+	const char *table;
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < ffm.slot_count; i++) {
+		if (!ffm.slots[i].effect)
+			continue;
+		if (ffm.slots[i].busy) {
+			ffm.slots[i].stale = TRUE;
+			ffm.slots[i].stamp = 0;
+			continue;
+		}
+		ffmemless_erase_effect(ffm.slots[i].id, ffm.dev_file);
+		ffm.slots[i].effect = NULL;
+		ffm.slots[i].id = -1;
+	}
+
+	table = n_proplist_get_string(ffm.ngfd_props, FFM_EFFECT_TABLE_KEY);
+	if (table && !ffm_table_load(table, ffm.effects))
+		return 0;
+
+	if (ffm_setup_effects(ffm.ngfd_props, ffm.effects))
+		ret = -1;
+	if (ffm_setup_effects(ffm.sys_props, ffm.effects))
+		N_DEBUG (LOG_CAT "No system level effect settings");
+
+	if (table)
+		ffm_table_save(table, ffm.effects);
+
+	return ret;
+}
+
 static int ffm_sink_initialize(NSinkInterface *iface)
 {
+	const char *value;
+	const char *table;
 	(void) iface;
 
 	if (ffm_setup_device(ffm.ngfd_props, &ffm.dev_file)) {
@@ -623,10 +1512,21 @@ static int ffm_sink_initialize(NSinkInterface *iface)
 	ffm.cache_effects = !g_strcmp0(n_proplist_get_string(ffm.ngfd_props, FFM_CACHE_EFFECTS_KEY), "true");
 	N_DEBUG (LOG_CAT "Caching effects: %d", ffm.cache_effects);
 
+	value = n_proplist_get_string(ffm.ngfd_props, FFM_EFFECT_SLOTS_KEY);
+	if (value && ffm.cache_effects)
+		N_WARNING (LOG_CAT "%s is ignored with %s", FFM_EFFECT_SLOTS_KEY,
+				FFM_CACHE_EFFECTS_KEY);
+	else if (value)
+		ffm_setup_slots(value, ffm.dev_file);
+
 	if (ffm_setup_default_effect(ffm.effects, ffm.dev_file)) {
 		N_ERROR (LOG_CAT "Could not load default fall-back effect");
 		goto ffm_init_error2;
 	}
+	table = n_proplist_get_string(ffm.ngfd_props, FFM_EFFECT_TABLE_KEY);
+	if (table && !ffm_table_load(table, ffm.effects))
+		goto ffm_init_effects_done;
+
 	/* Setup effects defined in ngfd internal ini file, this must pass. */
 	if (ffm_setup_effects(ffm.ngfd_props, ffm.effects)) {
 		N_ERROR (LOG_CAT "Could not load ngfd effects");
@@ -636,10 +1536,32 @@ static int ffm_sink_initialize(NSinkInterface *iface)
 	 * Setup effects defined in system level ini file, this is ok to fail.
 	 * If there are effects with same name, they get overwritten.
 	 */
+	ffm.sys_props = ffm_read_props(ffm.sys_file);
+	if (ffm.sys_props)
+		n_proplist_dump(ffm.sys_props);
 	if (ffm_setup_effects(ffm.sys_props, ffm.effects)) {
 		N_DEBUG (LOG_CAT "No system level effect settings");
 	}
 
+	if (table)
+		ffm_table_save(table, ffm.effects);
+
+ffm_init_effects_done:
+
+	value = n_proplist_get_string(ffm.ngfd_props, FFM_LEVEL_SCALE_KEY);
+	if (value && !ffm_setup_level_scale(value)) {
+		ffm.context = n_core_get_context(n_sink_interface_get_core(iface));
+		n_context_subscribe_value_change(ffm.context,
+			N_HAPTIC_VIBRA_LEVEL_KEY, ffm_vibra_level_changed_cb, NULL);
+		ffm_set_vibra_level(n_value_get_int(n_context_get_value(
+			ffm.context, N_HAPTIC_VIBRA_LEVEL_KEY)));
+	}
+
+	if (!g_strcmp0(n_proplist_get_string(ffm.ngfd_props, FFM_IO_THREAD_KEY), "true"))
+		ffm_worker_start();
+
+	n_haptic_add_plan_keys(iface);
+
 	return TRUE;
 
 ffm_init_error2:
@@ -654,6 +1576,63 @@ static int ffm_sink_can_handle(NSinkInterface *iface, NRequest *request)
 	return n_haptic_can_handle (iface, request);
 }
 
+static const struct ffm_effect_data *ffm_effect_for_request(NRequest *request)
+{
+	const struct ffm_effect_data *data;
+
+	data = g_hash_table_lookup(ffm.effects, n_haptic_effect_for_request (request));
+
+	/* Fall back to default effect, if the key did not match our effects */
+	if (data == NULL)
+		data = g_hash_table_lookup(ffm.effects, N_HAPTIC_EFFECT_DEFAULT);
+
+	return data;
+}
+
+static void ffm_sink_prewarm(NSinkInterface *iface, NRequest *request)
+{
+	const struct ffm_effect_data *data;
+	struct ffm_effect_data copy;
+
+	data = ffm_effect_scaled(ffm_effect_for_request(request), request);
+
+	/* with slots the effect is kept resident until it gets evicted */
+	if (ffm.slots) {
+		if (data != ffm.default_effect && ffm.worker)
+			ffm_worker_push(FFM_CMD_PREWARM, NULL, data, 0);
+		else if (data != ffm.default_effect)
+			ffm_slot_get(data);
+		return;
+	}
+
+	/*
+	 * without caching all effects are uploaded at startup, and the
+	 * upload-per-play prewarm is claimed synchronously in prepare
+	 */
+	if (!ffm.cache_effects || ffm.worker)
+		return;
+
+	if (data != ffm.prewarm_effect) {
+		ffm_prewarm_clear(TRUE);
+
+		memcpy(&copy, data, sizeof(struct ffm_effect_data));
+		if (ffm_upload_cached(&copy)) {
+			N_DEBUG (LOG_CAT "prewarm upload of effect %d failed", data->id);
+			return;
+		}
+
+		N_DEBUG (LOG_CAT "prewarmed effect %d as %d", data->id, copy.cached_effect.id);
+		ffm.prewarm_effect = data;
+		ffm.prewarm_id = copy.cached_effect.id;
+	} else if (ffm.prewarm_expire_id) {
+		n_timers_remove(ffm.prewarm_timers, ffm.prewarm_expire_id);
+	}
+
+	ffm.prewarm_timers = n_core_get_timers(n_sink_interface_get_core(iface));
+	ffm.prewarm_expire_id = n_timers_add(ffm.prewarm_timers, ffm.prewarm_timeout,
+					ffm_prewarm_expire_cb, NULL);
+}
+
 static int ffm_sink_prepare(NSinkInterface *iface, NRequest *request)
 {
 	const NProplist *props = n_request_get_properties (request);
@@ -666,18 +1645,22 @@ static int ffm_sink_prepare(NSinkInterface *iface, NRequest *request)
 	N_DEBUG (LOG_CAT "prepare");
 
 	key = n_haptic_effect_for_request (request);
-
-	data = g_hash_table_lookup(ffm.effects, key);
-
-	/* Fall back to default effect, if the key did not match our effects */
-	if (data == NULL)
-		data = g_hash_table_lookup(ffm.effects, N_HAPTIC_EFFECT_DEFAULT);
+	data = ffm_effect_scaled(ffm_effect_for_request(request), request);
 
 	/* creating copy of the data as we need to alter it for this event */
 	copy = g_new(struct ffm_effect_data, 1);
 	memcpy(copy, data, sizeof(struct ffm_effect_data));
 	copy->request = request;
 	copy->iface = iface;
+	copy->origin = data;
+	copy->slot = NULL;
+
+	if (ffm.cache_effects && data == ffm.prewarm_effect) {
+		N_DEBUG (LOG_CAT "claiming prewarmed effect %d", ffm.prewarm_id);
+		copy->cached_effect.id = ffm.prewarm_id;
+		copy->preloaded = TRUE;
+		ffm_prewarm_clear(FALSE);
+	}
 
 	repeat = n_proplist_get_bool (props, FFM_SOUND_REPEAT_KEY);
 	playback_time = n_proplist_get_uint (props, FFM_HAPTIC_DURATION_KEY);
@@ -697,14 +1680,42 @@ static int ffm_sink_prepare(NSinkInterface *iface, NRequest *request)
 			key, copy->repeat, copy->playback_time);
 
 	n_request_store_data(request, FFM_KEY, copy);
-	n_sink_interface_synchronize(iface, request);
+
+	/* with a worker, upload into a slot ahead of play */
+	if (ffm.worker)
+		ffm_worker_push(FFM_CMD_PREPARE, copy, NULL, 0);
+	else
+		n_sink_interface_synchronize(iface, request);
 
 	return TRUE;
 }
+static void ffm_cancel_start(struct ffm_effect_data *data)
+{
+	if (data->start_id) {
+		g_source_remove(data->start_id);
+		data->start_id = 0;
+	}
+}
+
+static gboolean ffm_start_cb(gpointer userdata)
+{
+	struct ffm_effect_data *data = userdata;
+
+	data->start_id = 0;
+
+	if (!ffm_play(data, data->repeat)) {
+		n_sink_interface_fail(data->iface, data->request);
+		return FALSE;
+	}
+	n_sink_interface_started(data->iface, data->request,
+						g_get_monotonic_time());
+	return FALSE;
+}
+
 static int ffm_sink_play(NSinkInterface *iface, NRequest *request)
 {
 	struct ffm_effect_data *data;
-	(void) iface;
+	gint64 start;
 
 	N_DEBUG (LOG_CAT "play");
 
@@ -714,7 +1725,18 @@ static int ffm_sink_play(NSinkInterface *iface, NRequest *request)
 			 "req 0x%x data 0x%x", data->id, data->repeat,
 			data->iface, data->request, data);
 
-	return ffm_play(data, data->repeat);
+	/* line up with the other sinks of the request */
+	start = n_request_get_start_time(request);
+	if (start > g_get_monotonic_time()) {
+		ffm_cancel_start(data);
+		data->start_id = n_timer_run_at(start, ffm_start_cb, data);
+		return TRUE;
+	}
+
+	if (!ffm_play(data, data->repeat))
+		return FALSE;
+	n_sink_interface_started(iface, request, g_get_monotonic_time());
+	return TRUE;
 }
 static int ffm_sink_pause(NSinkInterface *iface, NRequest *request)
 {
@@ -725,13 +1747,43 @@ static int ffm_sink_pause(NSinkInterface *iface, NRequest *request)
 
 	data = (struct ffm_effect_data *)n_request_get_data (request, FFM_KEY);
 
+	/* not started yet, the resume starts it */
+	if (data->start_id) {
+		ffm_cancel_start(data);
+		return TRUE;
+	}
+
+	if (!data->playing || data->suspended)
+		return TRUE;
+
+	/* the effect restarts on resume, so does its completion timer */
 	if (data->poll_id) {
-		g_source_remove (data->poll_id);
+		n_timers_remove(ffm_timers(data), data->poll_id);
 		data->poll_id = 0;
 	}
 
-	/* no pause possible for vibra effects, just stop */
-	return ffm_play(data, 0);
+	data->suspended = TRUE;
+
+	if (ffm.worker) {
+		ffm_worker_push(FFM_CMD_SUSPEND, data, NULL, 0);
+		return TRUE;
+	}
+
+	return ffm_suspend_effect(data);
+}
+static int ffm_sink_resume(NSinkInterface *iface, NRequest *request)
+{
+	struct ffm_effect_data *data;
+
+	N_DEBUG (LOG_CAT "resume");
+
+	data = (struct ffm_effect_data *)n_request_get_data (request, FFM_KEY);
+
+	if (!data->suspended)
+		return ffm_sink_play(iface, request);
+
+	/* uploaded and still holding its slot, just start it */
+	return ffm_play(data, data->repeat);
 }
 static void ffm_sink_stop(NSinkInterface *iface, NRequest *request)
 {
@@ -740,20 +1792,27 @@ static void ffm_sink_stop(NSinkInterface *iface, NRequest *request)
 	N_DEBUG (LOG_CAT "stop");
 
 	data = (struct ffm_effect_data *)n_request_get_data (request, FFM_KEY);
+	ffm_cancel_start(data);
 
 	if (data->poll_id) {
-		g_source_remove (data->poll_id);
+		n_timers_remove(ffm_timers(data), data->poll_id);
 		data->poll_id = 0;
 	}
 
 	ffm_play(data, 0);
-	g_free(data);
+
+	if (ffm.worker) {
+		data->stopped = TRUE;
+		ffm_worker_push(FFM_CMD_FREE, data, NULL, 0);
+	} else {
+		g_free(data);
+	}
 }
 
 N_PLUGIN_LOAD(plugin)
 {
 	const NProplist *props = n_plugin_get_params(plugin);
-	const gchar *system_settings_file;
+	const gchar *value;
 	int device_fd;
 
 	N_DEBUG (LOG_CAT "plugin load");
@@ -767,7 +1826,9 @@ N_PLUGIN_LOAD(plugin)
 		.prepare    = ffm_sink_prepare,
 		.play       = ffm_sink_play,
 		.pause      = ffm_sink_pause,
-		.stop       = ffm_sink_stop
+		.stop       = ffm_sink_stop,
+		.prewarm    = ffm_sink_prewarm,
+		.resume     = ffm_sink_resume
 	};
 
 	/* Checking if there is a device, no point in loading plugin if not..*/
@@ -779,23 +1840,66 @@ N_PLUGIN_LOAD(plugin)
 	ffmemless_evdev_file_close(device_fd);
 
 	ffm.ngfd_props = props;
-	system_settings_file = g_getenv(n_proplist_get_string(props,
-						FFM_SYSTEM_CONFIG_KEY));
-	ffm.sys_props = ffm_read_props(system_settings_file);
+	ffm.prewarm_id = -1;
+	ffm.level_index = -1;
+	value = n_proplist_get_string(props, FFM_PREWARM_TIMEOUT_KEY);
+	ffm.prewarm_timeout = value ? (guint) atoi(value) : FFM_DEFAULT_PREWARM_TIMEOUT;
+	/* the system settings are read only if there is no effect table */
+	ffm.sys_file = g_strdup(g_getenv(n_proplist_get_string(props,
+						FFM_SYSTEM_CONFIG_KEY)));
 
 	n_proplist_dump(ffm.ngfd_props);
-	if (ffm.sys_props)
-		n_proplist_dump(ffm.sys_props);
 
 	n_plugin_register_sink (plugin, &decl);
 	return TRUE;
 
 }
 
+/*
+ * The effects are reloaded from the new parameters and the system settings
+ * file. The device, caching, slots, worker and level scale stay as they
+ * were set up, changes to them are applied on restart.
+ */
+N_PLUGIN_RELOAD(plugin, params)
+{
+	const gchar *value;
+	int ret;
+	(void) plugin;
+
+	N_DEBUG (LOG_CAT "plugin reload");
+
+	ffm.ngfd_props = params;
+	value = n_proplist_get_string(params, FFM_PREWARM_TIMEOUT_KEY);
+	ffm.prewarm_timeout = value ? (guint) atoi(value) : FFM_DEFAULT_PREWARM_TIMEOUT;
+	g_free(ffm.sys_file);
+	ffm.sys_file = g_strdup(g_getenv(n_proplist_get_string(params,
+						FFM_SYSTEM_CONFIG_KEY)));
+
+	/* effects are set up when the sink is initialized */
+	if (!ffm.effects)
+		return TRUE;
+
+	/* the prewarmed upload has the old parameters */
+	ffm_prewarm_clear(TRUE);
+
+	n_proplist_free(ffm.sys_props);
+	ffm.sys_props = ffm_read_props(ffm.sys_file);
+
+	ret = ffm.worker ? ffm_worker_reload() : ffm_reload_effects();
+	if (ret)
+		N_WARNING (LOG_CAT "effects that failed to load are not played");
+
+	ffm_rescale_variants();
+
+	/* the new parameters are in use, even if some effects failed */
+	return TRUE;
+}
+
 N_PLUGIN_UNLOAD(plugin)
 {
 	(void) plugin;
 	N_DEBUG (LOG_CAT "plugin unload");
 
 	n_proplist_free(ffm.sys_props);
+	g_free(ffm.sys_file);
 }
@@ -20,11 +20,22 @@
  */
 
 #include <ngf/plugin.h>
+#include <ngf/timer.h>
+#include <ngf/metrics.h>
+#include <ngf/worker.h>
+#include <ngf/memory.h>
+#include <ngf/wakeup.h>
 
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
 #include <gst/controller/gstinterpolationcontrolsource.h>
 #include <gst/controller/gstdirectcontrolbinding.h>
 #include <gio/gio.h>
@@ -46,28 +57,96 @@
 #define SOUND_FADE_PAUSE      "sound.fade-pause"
 #define SOUND_FADE_RESUME     "sound.fade-resume"
 #define SOUND_FADE_STOP       "sound.fade-stop"
+#define SOUND_LATENCY_KEY     "sound.latency"
 #define SYSTEM_SOUND_PATH     "/usr/share/sounds/"
 #define NO_SOUND_DELAY_MS     (20)
 
+#define POOL_SIZE_KEY         "pipeline_pool_size"
+#define POOL_EXPIRY_KEY       "pipeline_pool_expiry"
+#define DEFAULT_POOL_SIZE     (2)
+#define DEFAULT_POOL_EXPIRY   (30)      /* seconds */
+
+#define SHARED_OUTPUT_KEY     "shared_output"
+#define SHARED_OUTPUT_RATE_KEY "shared_output_rate"
+#define DEFAULT_SHARED_OUTPUT_RATE (48000)
+#define SHARED_OUTPUT_IDLE_MS (2000)
+
+#define PREWARM_TIMEOUT_KEY   "prewarm_timeout"
+#define DEFAULT_PREWARM_TIMEOUT (5000)  /* ms */
+
+#define PCM_CACHE_SIZE_KEY         "pcm_cache_size"
+#define PCM_CACHE_MAX_FILE_KEY     "pcm_cache_max_file_size"
+#define PCM_CACHE_MAX_DURATION_KEY "pcm_cache_max_duration"
+#define DEFAULT_PCM_CACHE_SIZE     (1024)   /* KiB */
+#define DEFAULT_PCM_CACHE_MAX_FILE (128)    /* KiB */
+#define DEFAULT_PCM_CACHE_MAX_DURATION (3000) /* ms */
+
+/* setup latency hints for routing against the other audio sinks, us */
+#define COST_PREWARMED_US     (10000)   /* pre-rolled pipeline of the file */
+#define COST_PCM_CACHED_US    (20000)   /* decoded sound in the PCM cache */
+#define COST_POOLED_US        (40000)   /* idle pipeline in the pool */
+#define COST_COLD_US          (100000)  /* new pipeline */
+
+#define MEMORY_SOURCE_KEY     "memory_source"
+#define MEMORY_SOURCE_MAX_FILE (256 * 1024)
+#define MEMORY_CHUNK_SIZE     (64 * 1024)
+#define WARM_FILES_KEY        "warm_files"
+#define PROFILE_WARM_FILES_KEY "profile.warm_files"
+
+/* pulsesink buffer-time and latency-time of the latency classes, in us.
+   The normal class keeps the defaults of the sink. */
+#define LOW_LATENCY_BUFFER_TIME     (40000)
+#define LOW_LATENCY_LATENCY_TIME    (10000)
+#define POWERSAVE_BUFFER_TIME       (1000000)
+#define POWERSAVE_LATENCY_TIME      (250000)
+
+#define FADE_DONE_MESSAGE           "ngf-fade-done"
+#define DECODED_PAD_MESSAGE         "ngf-decoded-pad"
+#define FADE_DONE_MARGIN_MS         (100)
+
 typedef struct _StreamData StreamData;
+typedef struct _SharedOutput SharedOutput;
 typedef void (*stream_fade_completed_cb) (StreamData *stream);
 
+typedef enum _LatencyClass
+{
+    LATENCY_NORMAL = 0,
+    LATENCY_LOW,        /* short UI sounds, start as fast as possible */
+    LATENCY_POWERSAVE   /* long sounds, large buffers let the CPU sleep */
+} LatencyClass;
+
 typedef struct _FadeEffect
 {
-    gboolean enabled;   /* effect enabled */
-    gdouble elapsed;    /* effect update time */
     gdouble position;   /* begin position (in s) */
     gdouble length;     /* length of the fade (in s) */
     gdouble start;      /* starting volume */
     gdouble end;        /* ending volume */
 } FadeEffect;
 
+/* Owned by a pending fade completion on the pipeline clock. */
+typedef struct _FadeClockData
+{
+    GstElement *pipeline;
+    guint serial;
+} FadeClockData;
+
 struct _StreamData
 {
     NRequest *request;
     NSinkInterface *iface;
     GstElement *pipeline;
     GstState pipeline_state;
+    gboolean pipeline_failed;
+    gchar *pipeline_key;
+    GstElement *src;
+    GstBuffer *pcm_buffer;
+    GstCaps *pcm_caps;
+    gint pcm_pushed;
+    GBytes *contents;           /* encoded sound file read by an appsrc */
+    guint64 contents_offset;
+    GstElement *appsink;        /* end of the pipeline in shared output mode */
+    SharedOutput *output;
+    GstElement *output_src;     /* mixer input of the stream in the shared output */
     GstElement *volume;
     gboolean volume_limit;
     guint volume_cap;
@@ -76,11 +155,14 @@ struct _StreamData
     guint volume_max;
     guint volume_set;
     GstStructure *properties;
+    LatencyClass latency;
     const gchar *filename;
     gboolean repeat_enabled;
     GstControlSource *source;
-    gdouble last_volume;
-    gdouble time_spent;
+    GstPad *segment_pad;
+    gulong segment_probe_id;
+    GstClockTime loop_offset;   /* stream time at which the current loop starts */
+    gboolean segment_loop;      /* looping with segment seeks */
     guint state;
     guint bus_watch_id;
     gboolean sound_enabled;
@@ -100,11 +182,73 @@ struct _StreamData
     guint delay_play_source;
     guint delay_stop_source;
 
+    gint64 prepare_time;        /* monotonic time the stream was prepared */
+    gint64 state_request_time;  /* ... and the last state change was requested */
+    gint64 startup_time;        /* time spent in the startup state changes */
+    gboolean prerolled;         /* pipeline was pre-rolled before the stream */
+    gboolean startup_pending;   /* first transition to playing not seen yet */
+    gint64 start_time;          /* common start time the pipeline was scheduled at */
+
     FadeEffect *fade;
     guint fade_source;
+    GstClockID fade_clock_id;
+    guint fade_serial;
     stream_fade_completed_cb fade_completed_cb;
 };
 
+/* Idle pipeline kept in READY state for the next stream with the same
+   sink properties. */
+typedef struct _PooledPipeline
+{
+    GstElement *pipeline;
+    GstElement *src;
+    GstElement *volume;
+    GstElement *appsink;
+    gchar      *key;
+    guint       expire_id;
+} PooledPipeline;
+
+/* Long-lived output shared by the streams with the same stream
+   properties. Each stream pipeline ends in an appsink whose buffers are
+   pushed to an appsrc mixer input of the output pipeline. */
+struct _SharedOutput
+{
+    gchar      *key;
+    GstElement *pipeline;
+    GstElement *mixer;
+    guint       inputs;
+    guint       idle_id;
+    guint       bus_watch_id;
+};
+
+/* Decoded content of a short sound file. Entries with a NULL buffer are
+   either still being decoded or turned out not to be cacheable. */
+typedef struct _PcmCacheEntry
+{
+    gchar      *filename;
+    gint64      mtime;
+    goffset     size;
+    GstElement *decoder;
+    GstElement *appsink;
+    guint       bus_watch_id;
+    GstBuffer  *buffer;
+    GstCaps    *caps;
+    gsize       bytes;
+    GList       lru;
+    gboolean    checked;        /* mtime and size are known */
+    guint       stat_job_id;
+} PcmCacheEntry;
+
+/* file status of a cache entry, read in a worker thread */
+typedef struct _PcmCacheStat
+{
+    PcmCacheEntry *entry;
+    gchar         *filename;
+    gboolean       cacheable;
+    gint64         mtime;
+    goffset        size;
+} PcmCacheStat;
+
 #define STREAM_STATE_NOT_STARTED    (0)
 #define STREAM_STATE_PLAYING        (1)
 #define STREAM_STATE_PAUSED         (2)
@@ -127,11 +271,17 @@ static void set_stream_properties (GstElement *sink, const GstStructure *propert
 static int set_structure_string (GstStructure *s, const char *key, const char *value);
 static void proplist_to_structure_cb (const char *key, const NValue *value, gpointer userdata);
 static GstStructure* create_stream_properties (NProplist *props);
+static LatencyClass parse_latency_class (const char *str);
+static void set_sink_latency (GstElement *sink, LatencyClass latency);
 static void rewind_stream (StreamData *stream);
+static void start_segment_loop (StreamData *stream);
+static void loop_stream (StreamData *stream, GstFormat format, gint64 position);
+static GstPadProbeReturn loop_segment_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer userdata);
 static gboolean bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata);
 static void new_decoded_pad_cb (GstElement *element, GstPad *pad, gpointer userdata);
 static int make_pipeline (StreamData *stream);
 static void free_pipeline (StreamData *stream);
+static void schedule_pipeline_start (StreamData *stream, gint64 start);
 static int convert_number (const char *str, gint *result);
 static FadeEffect* fade_effect_new (gdouble position, gdouble length, gdouble start, gdouble end);
 static void fade_effect_free (FadeEffect *effect);
@@ -141,8 +291,22 @@ static void start_stream_fade (StreamData *stream, gdouble length,
                                gdouble volume_start, gdouble volume_end,
                                stream_fade_completed_cb fade_completed_cb);
 static void stop_stream_fade (StreamData *stream);
-static void update_fade_effect (FadeEffect *effect, gdouble elapsed, gdouble volume);
 static void cleanup (StreamData *stream);
+static void stream_pause (StreamData *stream);
+static int gst_sink_resume (NSinkInterface *iface, NRequest *request);
+static gboolean pipeline_pool_put (StreamData *stream);
+static gboolean pipeline_pool_take (StreamData *stream);
+static void pipeline_pool_clear ();
+static gboolean prewarmed_take (StreamData *stream);
+static void shared_output_attach (StreamData *stream);
+static void shared_output_detach (StreamData *stream);
+static void shared_output_clear ();
+static void prewarmed_clear ();
+static PcmCacheEntry* pcm_cache_lookup (StreamData *stream);
+static GBytes* read_sound_file (const char *filename);
+static void warm_sound_file (const char *filename);
+static void pcm_cache_clear ();
+static void pcm_cache_trim_cb (gsize target, gpointer userdata);
 
 static void stream_list_add (StreamData *stream);
 static void stream_list_remove (StreamData *stream);
@@ -153,6 +317,40 @@ static guint system_sounds_level = 0;
 
 static GList *active_streams;
 
+static GQueue  pipeline_pool = G_QUEUE_INIT;   /* PooledPipeline, newest first */
+static guint   pipeline_pool_size = DEFAULT_POOL_SIZE;
+static guint   pipeline_pool_expiry = DEFAULT_POOL_EXPIRY;
+static NTimers *pipeline_pool_timers;
+
+static gboolean   shared_output_enabled = FALSE;
+static guint      shared_output_rate = DEFAULT_SHARED_OUTPUT_RATE;
+static GHashTable *shared_outputs;              /* stream properties -> SharedOutput */
+
+static PooledPipeline *prewarmed;               /* pre-rolled for an expected stream */
+static guint   prewarm_timeout = DEFAULT_PREWARM_TIMEOUT;
+
+static GHashTable *pcm_cache;                   /* filename -> PcmCacheEntry */
+static GQueue  pcm_cache_lru = G_QUEUE_INIT;    /* decoded entries, most recent first */
+static gsize   pcm_cache_bytes;
+static gsize   pcm_cache_budget = DEFAULT_PCM_CACHE_SIZE * 1024;
+static goffset pcm_cache_max_file = DEFAULT_PCM_CACHE_MAX_FILE * 1024;
+static guint   pcm_cache_max_duration = DEFAULT_PCM_CACHE_MAX_DURATION;
+static NMemory *pcm_cache_memory;
+static NMemoryCache *pcm_cache_size;            /* reports pcm_cache_bytes */
+
+static gboolean memory_source_enabled = TRUE;
+
+static NWorkers *gst_workers;                   /* file checks and warming */
+static guint     warm_job_id;
+
+static NMetricHistogram *metric_state_ready;    /* NULL -> READY, us */
+static NMetricHistogram *metric_state_paused;   /* READY -> PAUSED, us */
+static NMetricHistogram *metric_state_playing;  /* PAUSED -> PLAYING, us */
+static NMetricHistogram *metric_first_pad;      /* prepare -> first decoded pad, us */
+static NMetricHistogram *metric_sink_latency;   /* us */
+static NMetricRanking   *metric_slowest_start;  /* filename -> startup time, us */
+static gchar  **warm_files;
+
 static gboolean
 is_custom_sound_filename (const char *filename)
 {
@@ -162,6 +360,79 @@ is_custom_sound_filename (const char *filename)
     return TRUE;
 }
 
+/* a copy can't be cut short like a mapping when the file is truncated */
+static GBytes*
+read_sound_file (const char *filename)
+{
+    GStatBuf st;
+    GError *error = NULL;
+    gchar *contents = NULL;
+    gsize length = 0;
+
+    /* nothing to read for an empty file, let filesrc report it, and
+       leave the large ones to filesrc too */
+    if (g_stat (filename, &st) < 0 || st.st_size == 0 ||
+        st.st_size > MEMORY_SOURCE_MAX_FILE)
+        return NULL;
+
+    if (!g_file_get_contents (filename, &contents, &length, &error)) {
+        N_DEBUG (LOG_CAT "unable to read '%s': %s", filename, error->message);
+        g_error_free (error);
+        return NULL;
+    }
+
+    if (length == 0) {
+        g_free (contents);
+        return NULL;
+    }
+
+    return g_bytes_new_take (contents, length);
+}
+
+/* runs in a worker thread */
+static void
+warm_sound_file (const char *filename)
+{
+    int fd;
+
+    if (!filename || *filename == '\0')
+        return;
+
+    if ((fd = open (filename, O_RDONLY | O_CLOEXEC)) < 0) {
+        N_DEBUG (LOG_CAT "unable to warm '%s'", filename);
+        return;
+    }
+
+    /* start reading the file into the page cache in the background */
+    (void) posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+    close (fd);
+
+    N_DEBUG (LOG_CAT "warming '%s'", filename);
+}
+
+static void
+warm_sound_files_cb (gpointer userdata)
+{
+    gchar **f = NULL;
+
+    for (f = userdata; *f; ++f)
+        warm_sound_file (g_strstrip (*f));
+}
+
+static void
+warm_sound_files (const char *list)
+{
+    if (!list)
+        return;
+
+    /* a new list replaces the one not warmed yet */
+    if (warm_job_id > 0)
+        n_workers_cancel (gst_workers, warm_job_id);
+
+    warm_job_id = n_workers_submit (gst_workers, warm_sound_files_cb, NULL,
+        g_strsplit (list, ";", -1), (GDestroyNotify) g_strfreev);
+}
+
 static gchar*
 strip_prefix (const gchar *str, const gchar *prefix)
 {
@@ -229,22 +500,47 @@ get_current_volume (StreamData *stream)
     return v/10.0;
 }
 
+/* The stream time the volume controller sees now, from the running time
+   of the pipeline without querying the elements. A flushing rewind
+   starts the running time over, the segment loops keep it going. */
 static gboolean
-get_current_position (StreamData *stream, gdouble *out_position)
+get_stream_time (StreamData *stream, GstClockTime *out_time)
 {
-    gint64 timestamp;
+    GstClock *clock = NULL;
+    GstClockTime now, base, running;
 
-    if (!gst_element_query_position (stream->pipeline, GST_FORMAT_TIME, &timestamp)) {
-        N_WARNING (LOG_CAT "unable to query data position");
+    if (!stream->pipeline)
         return FALSE;
+
+    if (GST_STATE (stream->pipeline) != GST_STATE_PLAYING)
+        running = gst_element_get_start_time (stream->pipeline);
+    else if ((clock = gst_element_get_clock (stream->pipeline))) {
+        now = gst_clock_get_time (clock);
+        base = gst_element_get_base_time (stream->pipeline);
+        running = now > base ? now - base : 0;
+        gst_object_unref (clock);
     }
+    else
+        return FALSE;
 
-    if (!GST_CLOCK_TIME_IS_VALID (timestamp)) {
-        N_WARNING (LOG_CAT "queried position or format is not valid");
+    if (!GST_CLOCK_TIME_IS_VALID (running)) {
+        N_WARNING (LOG_CAT "running time of the pipeline is not valid");
         return FALSE;
     }
 
-    *out_position = (gdouble) timestamp / GST_SECOND;
+    *out_time = stream->segment_loop ? running : running + stream->loop_offset;
+    return TRUE;
+}
+
+static gboolean
+get_current_position (StreamData *stream, gdouble *out_position)
+{
+    GstClockTime time = 0;
+
+    if (!get_stream_time (stream, &time))
+        return FALSE;
+
+    *out_position = (gdouble) time / GST_SECOND;
     return TRUE;
 }
 
@@ -390,26 +686,18 @@ free_volume (StreamData *stream)
 static void
 rewind_stream (StreamData *stream)
 {
-    gdouble position = 0.0;
-
-    /* query the current position and volume */
-    if (get_current_position (stream, &position)) {
-        stream->time_spent += position;
-        stream->last_volume = get_current_volume (stream);
-
-        /* update the stream effects */
-
-        N_DEBUG (LOG_CAT "fade effect (last volume=%.2f)", stream->last_volume);
-
-        update_fade_effect (stream->fade_in, stream->time_spent, stream->last_volume);
-        update_fade_effect (stream->fade_out, stream->time_spent, stream->last_volume);
-        update_fade_effect (stream->fade, stream->time_spent, stream->last_volume);
-        set_fade_effect (stream->source, stream->fade_in);
-        set_fade_effect (stream->source, stream->fade_out);
-        set_fade_effect (stream->source, stream->fade);
-    }
-
-    N_DEBUG (LOG_CAT "rewinding pipeline.");
+    GstClockTime position = 0;
+
+    /* The next loop continues the stream time from where this one ended,
+     * so the volume ramps set up in create_volume () and by a running
+     * stream fade keep applying without being recomputed per loop. The
+     * segment probe picks the offset up from the segment following the
+     * flushing seek. */
+    if (get_stream_time (stream, &position) && position > stream->loop_offset)
+        stream->loop_offset = position;
+
+    N_DEBUG (LOG_CAT "rewinding pipeline (loop offset %.2f)",
+             (gdouble) stream->loop_offset / GST_SECOND);
     if (!gst_element_seek(stream->pipeline, 1.0, GST_FORMAT_TIME,
                           GST_SEEK_FLAG_FLUSH, GST_SEEK_TYPE_SET, 0,
                           GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE)) {
@@ -417,45 +705,208 @@ rewind_stream (StreamData *stream)
     }
 }
 
+/* Repeating streams loop with segment seeks. The end of a loop posts
+ * SEGMENT_DONE instead of EOS and the next loop is queued behind it with
+ * a non-flushing seek, so the sink plays on without a gap. The first
+ * seek flushes and is done once the pipeline has pre-rolled. Streams
+ * that cannot seek that way are rewound on EOS instead. */
+static void
+start_segment_loop (StreamData *stream)
+{
+    if (!stream->repeat_enabled || stream->segment_loop)
+        return;
+
+    stream->segment_loop = gst_element_seek (stream->pipeline, 1.0, GST_FORMAT_TIME,
+                                             GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_SEGMENT,
+                                             GST_SEEK_TYPE_SET, 0,
+                                             GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+    if (!stream->segment_loop)
+        N_DEBUG (LOG_CAT "segment seek failed, rewinding on eos");
+}
+
+static void
+loop_stream (StreamData *stream, GstFormat format, gint64 position)
+{
+    GstClockTime time = 0;
+
+    /* the data of the next loop follows the loops played so far */
+    if (format == GST_FORMAT_TIME && position > 0)
+        stream->loop_offset += position;
+    else if (get_stream_time (stream, &time))
+        stream->loop_offset = time;
+
+    N_DEBUG (LOG_CAT "looping pipeline (loop offset %.2f)",
+             (gdouble) stream->loop_offset / GST_SECOND);
+    if (!gst_element_seek (stream->pipeline, 1.0, GST_FORMAT_TIME,
+                           GST_SEEK_FLAG_SEGMENT, GST_SEEK_TYPE_SET, 0,
+                           GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE)) {
+        N_DEBUG (LOG_CAT "failed to seek to the next loop");
+        stream->segment_loop = FALSE;
+        rewind_stream (stream);
+    }
+}
+
+static GstPadProbeReturn
+loop_segment_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer userdata)
+{
+    StreamData *stream = userdata;
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    GstEvent *shifted = NULL;
+    GstSegment segment;
+
+    (void) pad;
+
+    if (GST_EVENT_TYPE (event) != GST_EVENT_SEGMENT || stream->loop_offset == 0)
+        return GST_PAD_PROBE_OK;
+
+    gst_event_copy_segment (event, &segment);
+    segment.time += stream->loop_offset;
+
+    shifted = gst_event_new_segment (&segment);
+    gst_event_set_seqnum (shifted, gst_event_get_seqnum (event));
+    gst_event_unref (event);
+    GST_PAD_PROBE_INFO_DATA (info) = shifted;
+
+    return GST_PAD_PROBE_OK;
+}
+
+static NTimers*
+stream_timers (StreamData *stream)
+{
+    return n_core_get_timers (n_sink_interface_get_core (stream->iface));
+}
+
 static void
 stream_clear_delays (StreamData *stream)
 {
-    if (stream->fake_play_source)
-        g_source_remove (stream->fake_play_source), stream->fake_play_source = 0;
+    if (stream->fake_play_source) {
+        n_timers_remove (stream_timers (stream), stream->fake_play_source);
+        stream->fake_play_source = 0;
+    }
 
-    if (stream->delay_synchronize_source)
-        g_source_remove (stream->delay_synchronize_source), stream->delay_synchronize_source = 0;
+    if (stream->delay_synchronize_source) {
+        n_timers_remove (stream_timers (stream), stream->delay_synchronize_source);
+        stream->delay_synchronize_source = 0;
+    }
 
-    if (stream->delay_play_source)
-        g_source_remove (stream->delay_play_source), stream->delay_play_source = 0;
+    if (stream->delay_play_source) {
+        n_timers_remove (stream_timers (stream), stream->delay_play_source);
+        stream->delay_play_source = 0;
+    }
 
-    if (stream->delay_stop_source)
-        g_source_remove (stream->delay_stop_source), stream->delay_stop_source = 0;
+    if (stream->delay_stop_source) {
+        n_timers_remove (stream_timers (stream), stream->delay_stop_source);
+        stream->delay_stop_source = 0;
+    }
 }
 
 static void
 stop_stream_fade (StreamData *stream)
 {
-    if (stream->fade_source)
-        g_source_remove (stream->fade_source), stream->fade_source = 0;
+    if (stream->fade_source) {
+        n_timers_remove (stream_timers (stream), stream->fade_source);
+        stream->fade_source = 0;
+    }
+
+    if (stream->fade_clock_id) {
+        gst_clock_id_unschedule (stream->fade_clock_id);
+        gst_clock_id_unref (stream->fade_clock_id);
+        stream->fade_clock_id = NULL;
+    }
+
+    /* a completion already posted to the bus is stale now */
+    stream->fade_serial++;
 
     if (stream->fade)
         fade_effect_free (stream->fade), stream->fade = NULL;
 }
 
+static void
+stream_fade_done (StreamData *stream)
+{
+    stop_stream_fade (stream);
+    if (stream->fade_completed_cb)
+        stream->fade_completed_cb (stream);
+}
+
 static gboolean
 stream_fade_event_cb (gpointer userdata)
 {
     StreamData *stream = userdata;
 
+    n_wakeup_note ("gst.fade");
     stream->fade_source = 0;
-    stop_stream_fade (stream);
-    if (stream->fade_completed_cb)
-        stream->fade_completed_cb (stream);
+    stream_fade_done (stream);
 
     return G_SOURCE_REMOVE;
 }
 
+static void
+fade_clock_data_free (gpointer userdata)
+{
+    FadeClockData *data = userdata;
+
+    gst_object_unref (data->pipeline);
+    g_slice_free (FadeClockData, data);
+}
+
+static gboolean
+fade_clock_cb (GstClock *clock, GstClockTime time, GstClockID id, gpointer userdata)
+{
+    FadeClockData *data = userdata;
+    GstStructure *s = NULL;
+
+    (void) clock;
+    (void) id;
+
+    /* called from the clock thread, hand the completion over to bus_cb () */
+    if (!GST_CLOCK_TIME_IS_VALID (time))
+        return TRUE;
+
+    s = gst_structure_new (FADE_DONE_MESSAGE, "serial", G_TYPE_UINT, data->serial, NULL);
+    gst_element_post_message (data->pipeline,
+                              gst_message_new_application (GST_OBJECT (data->pipeline), s));
+
+    return TRUE;
+}
+
+static void
+schedule_stream_fade_done (StreamData *stream, gdouble length)
+{
+    GstClock *clock = NULL;
+    FadeClockData *data = NULL;
+    GstClockTime target;
+
+    /* Complete the fade on the pipeline clock, which is what the volume
+     * ramp is rendered against. Before the pipeline runs (e.g. right after
+     * resuming) there is no clock yet, use the main loop timer then. */
+    if (stream->pipeline_state != GST_STATE_PLAYING ||
+        !(clock = gst_element_get_clock (stream->pipeline))) {
+        stream->fade_source = n_timers_add (stream_timers (stream),
+                                            length * 1000.0 + FADE_DONE_MARGIN_MS,
+                                            stream_fade_event_cb, stream);
+        return;
+    }
+
+    target = gst_clock_get_time (clock) + (GstClockTime) (length * GST_SECOND) +
+             FADE_DONE_MARGIN_MS * GST_MSECOND;
+    stream->fade_clock_id = gst_clock_new_single_shot_id (clock, target);
+    gst_object_unref (clock);
+
+    data = g_slice_new (FadeClockData);
+    data->pipeline = gst_object_ref (stream->pipeline);
+    data->serial = stream->fade_serial;
+
+    if (gst_clock_id_wait_async (stream->fade_clock_id, fade_clock_cb,
+                                 data, fade_clock_data_free) != GST_CLOCK_OK) {
+        gst_clock_id_unref (stream->fade_clock_id);
+        stream->fade_clock_id = NULL;
+        stream->fade_source = n_timers_add (stream_timers (stream),
+                                            length * 1000.0 + FADE_DONE_MARGIN_MS,
+                                            stream_fade_event_cb, stream);
+    }
+}
+
 static void
 start_stream_fade (StreamData *stream,
                    gdouble length,
@@ -470,7 +921,8 @@ start_stream_fade (StreamData *stream,
     if (!get_current_position (stream, &position)) {
         N_ERROR (LOG_CAT "(%p) failed to start stream fade for '%s'", stream, n_request_get_name (stream->request));
         stream->fade_completed_cb = fade_completed_cb;
-        stream->fade_source = g_timeout_add (0, stream_fade_event_cb, stream);
+        stream->fade_source = n_timers_add (stream_timers (stream), 0,
+                                            stream_fade_event_cb, stream);
         return;
     }
 
@@ -502,12 +954,90 @@ start_stream_fade (StreamData *stream,
                                         (position + stream->fade->length) * GST_SECOND, stream->fade->end);
 
     stream->fade_completed_cb = fade_completed_cb;
-    stream->fade_source = g_timeout_add ((length + 0.1) * 1000.0, stream_fade_event_cb, stream);
+    schedule_stream_fade_done (stream, length);
 
     N_DEBUG (LOG_CAT "start fade at %.4f for %.4f seconds, volume start %.4f end %.4f",
                      position, length, volume_start, volume_end);
 }
 
+static GstClockTime
+query_sink_latency (StreamData *stream)
+{
+    GstQuery *query = NULL;
+    GstClockTime min_latency = GST_CLOCK_TIME_NONE;
+    gboolean live;
+
+    query = gst_query_new_latency ();
+    if (gst_element_query (stream->pipeline, query))
+        gst_query_parse_latency (query, &live, &min_latency, NULL);
+    gst_query_unref (query);
+
+    return min_latency;
+}
+
+static void
+record_state_change (StreamData *stream, GstState old_state, GstState new_state)
+{
+    NMetricHistogram *metric = NULL;
+    const char *stage = NULL;
+    GstClockTime latency;
+    gint64 now, elapsed;
+
+    if (old_state == GST_STATE_NULL && new_state == GST_STATE_READY)
+        metric = metric_state_ready, stage = "ready";
+    else if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED)
+        metric = metric_state_paused, stage = "paused";
+    else if (old_state == GST_STATE_PAUSED && new_state == GST_STATE_PLAYING &&
+             stream->startup_pending)
+        metric = metric_state_playing, stage = "playing";
+    else
+        return;
+
+    now = g_get_monotonic_time ();
+    elapsed = now - stream->state_request_time;
+    stream->state_request_time = now;
+
+    n_sink_interface_mark (stream->iface, stream->request, stage, now);
+
+    if (new_state == GST_STATE_PLAYING) {
+        /* the sinks hold the first sample until the base time */
+        n_sink_interface_started (stream->iface, stream->request,
+                                  MAX (now, stream->start_time));
+        /* let pause and resume track the running time again */
+        if (stream->start_time)
+            gst_element_set_start_time (stream->pipeline, 0);
+    }
+
+    /* the state changes of a pre-rolled pipeline happened before the
+       stream was prepared */
+    if (!stream->prerolled || new_state == GST_STATE_PLAYING) {
+        n_metric_histogram_add (metric, elapsed);
+        stream->startup_time += elapsed;
+    }
+
+    if (new_state != GST_STATE_PLAYING)
+        return;
+
+    stream->startup_pending = FALSE;
+    n_metric_ranking_record (metric_slowest_start, stream->filename, stream->startup_time);
+
+    if (!stream->appsink && GST_CLOCK_TIME_IS_VALID (latency = query_sink_latency (stream)))
+        n_metric_histogram_add (metric_sink_latency, latency / GST_USECOND);
+}
+
+static void
+record_first_pad (StreamData *stream, GstMessage *msg)
+{
+    gint64 time = 0;
+
+    if (!gst_structure_get_int64 (gst_message_get_structure (msg), "time", &time) ||
+        time < stream->prepare_time)
+        return;
+
+    n_metric_histogram_add (metric_first_pad, time - stream->prepare_time);
+    n_sink_interface_mark (stream->iface, stream->request, "first_pad", time);
+}
+
 static gboolean
 bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata)
 {
@@ -521,6 +1051,7 @@ bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata)
             gst_message_parse_error (msg, &error, NULL);
             N_WARNING (LOG_CAT "error: %s", error->message);
             g_error_free (error);
+            stream->pipeline_failed = TRUE;
             n_sink_interface_fail (stream->iface, stream->request);
             stream->bus_watch_id = 0;
             return G_SOURCE_REMOVE;
@@ -537,6 +1068,11 @@ bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata)
 
             N_DEBUG (LOG_CAT "state changed: old %d new %d pending %d", old_state, new_state, pending_state);
 
+            record_state_change (stream, old_state, new_state);
+
+            if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED)
+                start_segment_loop (stream);
+
             if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED &&
                 (!stream->delay_startup || stream->synchronization_pending)) {
                 N_DEBUG (LOG_CAT "synchronize");
@@ -544,73 +1080,1070 @@ bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata)
                 n_sink_interface_synchronize (stream->iface, stream->request);
             }
 
-            break;
-        }
+            break;
+        }
+
+        case GST_MESSAGE_APPLICATION: {
+            guint serial = 0;
+
+            if (gst_message_has_name (msg, DECODED_PAD_MESSAGE)) {
+                record_first_pad (stream, msg);
+                break;
+            }
+
+            if (!gst_message_has_name (msg, FADE_DONE_MESSAGE) || !stream->fade_clock_id)
+                break;
+
+            if (!gst_structure_get_uint (gst_message_get_structure (msg), "serial", &serial) ||
+                serial != stream->fade_serial)
+                break;
+
+            /* the completion callback may stop and free the stream */
+            n_wakeup_note ("gst.fade");
+            stream_fade_done (stream);
+            return G_SOURCE_CONTINUE;
+        }
+
+        case GST_MESSAGE_SEGMENT_DONE: {
+            GstFormat format = GST_FORMAT_UNDEFINED;
+            gint64 position = 0;
+
+            if (GST_ELEMENT (GST_MESSAGE_SRC (msg)) != stream->pipeline)
+                break;
+
+            gst_message_parse_segment_done (msg, &format, &position);
+            loop_stream (stream, format, position);
+            break;
+        }
+
+        case GST_MESSAGE_EOS: {
+            if (GST_ELEMENT (GST_MESSAGE_SRC (msg)) != stream->pipeline)
+                break;
+
+            if (stream->repeat_enabled) {
+                rewind_stream (stream);
+                return G_SOURCE_CONTINUE;
+            }
+
+            N_DEBUG (LOG_CAT "eos");
+            /* Free the pipeline already here */
+            stream->bus_watch_id = 0;
+            cleanup (stream);
+            n_sink_interface_complete (stream->iface, stream->request);
+            return G_SOURCE_REMOVE;
+        }
+
+        default:
+            break;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+new_decoded_pad_cb (GstElement *element, GstPad *pad, gpointer userdata)
+{
+    GstElement   *sink_element = (GstElement*) userdata;
+    GstStructure *structure    = NULL;
+    GstCaps      *caps         = NULL;
+    GstPad       *sink_pad     = NULL;
+    GstStructure *timing       = NULL;
+
+    caps = gst_pad_get_current_caps (pad);
+    if (gst_caps_is_empty (caps) || gst_caps_is_any (caps)) {
+        gst_caps_unref (caps);
+        return;
+    }
+
+    structure = gst_caps_get_structure (caps, 0);
+    if (g_str_has_prefix (gst_structure_get_name (structure), "audio")) {
+        sink_pad = gst_element_get_static_pad (sink_element, "sink");
+        if (!gst_pad_is_linked (sink_pad) && gst_pad_link (pad, sink_pad) == GST_PAD_LINK_OK) {
+            /* called from the streaming thread, the stream picks the time
+               up from the bus */
+            timing = gst_structure_new (DECODED_PAD_MESSAGE,
+                                        "time", G_TYPE_INT64, g_get_monotonic_time (), NULL);
+            gst_element_post_message (element,
+                                      gst_message_new_application (GST_OBJECT (element), timing));
+        }
+        gst_object_unref (sink_pad);
+    }
+
+    gst_caps_unref (caps);
+}
+
+static void
+pcm_cache_entry_free (PcmCacheEntry *entry)
+{
+    if (entry->stat_job_id > 0)
+        n_workers_cancel (gst_workers, entry->stat_job_id);
+
+    if (entry->bus_watch_id > 0)
+        g_source_remove (entry->bus_watch_id);
+
+    if (entry->decoder) {
+        gst_element_set_state (entry->decoder, GST_STATE_NULL);
+        gst_object_unref (entry->decoder);
+    }
+
+    if (entry->buffer) {
+        g_queue_unlink (&pcm_cache_lru, &entry->lru);
+        pcm_cache_bytes -= entry->bytes;
+        n_memory_cache_set_size (pcm_cache_size, pcm_cache_bytes);
+        gst_buffer_unref (entry->buffer);
+    }
+
+    if (entry->caps)
+        gst_caps_unref (entry->caps);
+
+    g_free (entry->filename);
+    g_slice_free (PcmCacheEntry, entry);
+}
+
+/* drops the least recently used entries until at most limit bytes are used */
+static void
+pcm_cache_evict (gsize limit)
+{
+    PcmCacheEntry *entry = NULL;
+
+    while (pcm_cache_lru.tail && pcm_cache_bytes > limit) {
+        entry = pcm_cache_lru.tail->data;
+        N_DEBUG (LOG_CAT "evicting decoded '%s' from cache", entry->filename);
+        g_hash_table_remove (pcm_cache, entry->filename);
+    }
+}
+
+static void
+pcm_cache_trim_cb (gsize target, gpointer userdata)
+{
+    (void) userdata;
+
+    pcm_cache_evict (target);
+}
+
+static void
+pcm_cache_collect (PcmCacheEntry *entry)
+{
+    GstSample   *sample   = NULL;
+    GstBuffer   *buffer   = NULL;
+    GstCaps     *caps     = NULL;
+    GstClockTime duration = 0;
+
+    while ((sample = gst_app_sink_try_pull_sample (GST_APP_SINK (entry->appsink), 0))) {
+        if (!caps)
+            caps = gst_caps_ref (gst_sample_get_caps (sample));
+
+        if (GST_BUFFER_DURATION_IS_VALID (gst_sample_get_buffer (sample)))
+            duration += GST_BUFFER_DURATION (gst_sample_get_buffer (sample));
+
+        if (buffer)
+            buffer = gst_buffer_append (buffer, gst_buffer_ref (gst_sample_get_buffer (sample)));
+        else
+            buffer = gst_buffer_ref (gst_sample_get_buffer (sample));
+
+        gst_sample_unref (sample);
+    }
+
+    if (!buffer || !caps)
+        goto not_cacheable;
+
+    if (gst_buffer_get_size (buffer) > pcm_cache_budget ||
+        duration > (GstClockTime) pcm_cache_max_duration * GST_MSECOND) {
+        N_DEBUG (LOG_CAT "'%s' is too long to cache", entry->filename);
+        goto not_cacheable;
+    }
+
+    buffer = gst_buffer_make_writable (buffer);
+    GST_BUFFER_PTS (buffer) = 0;
+    GST_BUFFER_DURATION (buffer) = duration > 0 ? duration : GST_CLOCK_TIME_NONE;
+
+    pcm_cache_evict (pcm_cache_budget - gst_buffer_get_size (buffer));
+
+    entry->buffer = buffer;
+    entry->caps = caps;
+    entry->bytes = gst_buffer_get_size (buffer);
+    entry->lru.data = entry;
+    g_queue_push_head_link (&pcm_cache_lru, &entry->lru);
+    pcm_cache_bytes += entry->bytes;
+    n_memory_cache_set_size (pcm_cache_size, pcm_cache_bytes);
+
+    N_DEBUG (LOG_CAT "cached decoded '%s' (%" G_GSIZE_FORMAT " bytes, %"
+        G_GSIZE_FORMAT " bytes used)", entry->filename, entry->bytes, pcm_cache_bytes);
+
+    return;
+
+not_cacheable:
+    if (buffer)
+        gst_buffer_unref (buffer);
+    if (caps)
+        gst_caps_unref (caps);
+}
+
+static gboolean
+pcm_cache_bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata)
+{
+    PcmCacheEntry *entry = userdata;
+
+    (void) bus;
+
+    switch (GST_MESSAGE_TYPE (msg)) {
+        case GST_MESSAGE_EOS:
+            pcm_cache_collect (entry);
+            break;
+
+        case GST_MESSAGE_ERROR:
+            N_DEBUG (LOG_CAT "failed to decode '%s' for the cache", entry->filename);
+            break;
+
+        default:
+            return G_SOURCE_CONTINUE;
+    }
+
+    entry->bus_watch_id = 0;
+    gst_element_set_state (entry->decoder, GST_STATE_NULL);
+    gst_object_unref (entry->decoder);
+    entry->decoder = NULL;
+    entry->appsink = NULL;
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+pcm_cache_decode (PcmCacheEntry *entry)
+{
+    GstElement *pipeline = NULL, *source = NULL, *decoder = NULL,
+        *audioconv = NULL, *sink = NULL;
+    GstCaps *caps = NULL;
+    GstBus *bus = NULL;
+
+    pipeline = gst_pipeline_new (NULL);
+    source = gst_element_factory_make ("filesrc", NULL);
+    decoder = gst_element_factory_make ("decodebin", NULL);
+    audioconv = gst_element_factory_make ("audioconvert", NULL);
+    sink = gst_element_factory_make ("appsink", NULL);
+
+    if (!pipeline || !source || !decoder || !audioconv || !sink) {
+        N_WARNING (LOG_CAT "failed to create elements for the sound cache");
+        if (sink)
+            gst_object_unref (sink);
+        if (audioconv)
+            gst_object_unref (audioconv);
+        if (decoder)
+            gst_object_unref (decoder);
+        if (source)
+            gst_object_unref (source);
+        if (pipeline)
+            gst_object_unref (pipeline);
+        return;
+    }
+
+    gst_bin_add_many (GST_BIN (pipeline), source, decoder, audioconv, sink, NULL);
+
+    caps = gst_caps_new_simple ("audio/x-raw", "layout", G_TYPE_STRING, "interleaved", NULL);
+    g_object_set (G_OBJECT (sink), "caps", caps, "sync", FALSE, NULL);
+    gst_caps_unref (caps);
+
+    if (!gst_element_link (source, decoder) || !gst_element_link (audioconv, sink)) {
+        N_WARNING (LOG_CAT "failed to link the sound cache pipeline");
+        gst_object_unref (pipeline);
+        return;
+    }
+
+    g_signal_connect (G_OBJECT (decoder), "pad-added",
+        G_CALLBACK (new_decoded_pad_cb), audioconv);
+    g_object_set (G_OBJECT (source), "location", entry->filename, NULL);
+
+    entry->decoder = pipeline;
+    entry->appsink = sink;
+
+    bus = gst_element_get_bus (pipeline);
+    entry->bus_watch_id = gst_bus_add_watch (bus, pcm_cache_bus_cb, entry);
+    gst_object_unref (bus);
+
+    N_DEBUG (LOG_CAT "decoding '%s' for the cache", entry->filename);
+    gst_element_set_state (pipeline, GST_STATE_PLAYING);
+}
+
+static void
+pcm_cache_stat_free (PcmCacheStat *check)
+{
+    g_free (check->filename);
+    g_slice_free (PcmCacheStat, check);
+}
+
+static void
+pcm_cache_stat_cb (gpointer userdata)
+{
+    PcmCacheStat *check = userdata;
+    GStatBuf      st;
+
+    if (g_stat (check->filename, &st) < 0 || !S_ISREG (st.st_mode))
+        return;
+
+    check->cacheable = TRUE;
+    check->mtime = st.st_mtime;
+    check->size = st.st_size;
+}
+
+static void
+pcm_cache_stat_done_cb (gpointer userdata)
+{
+    PcmCacheStat  *check = userdata;
+    PcmCacheEntry *entry = check->entry;
+
+    entry->stat_job_id = 0;
+
+    if (!check->cacheable || check->size > pcm_cache_max_file) {
+        g_hash_table_remove (pcm_cache, entry->filename);
+        return;
+    }
+
+    if (entry->checked && (entry->mtime != check->mtime || entry->size != check->size)) {
+        N_DEBUG (LOG_CAT "'%s' changed on disk, dropping cached copy", entry->filename);
+        g_hash_table_remove (pcm_cache, entry->filename);
+        return;
+    }
+
+    if (!entry->checked) {
+        entry->checked = TRUE;
+        entry->mtime = check->mtime;
+        entry->size = check->size;
+        pcm_cache_decode (entry);
+    }
+}
+
+static PcmCacheEntry*
+pcm_cache_lookup (StreamData *stream)
+{
+    PcmCacheEntry *entry = NULL;
+    PcmCacheStat  *check = NULL;
+
+    if (pcm_cache_budget == 0 || !stream->filename || stream->repeat_enabled)
+        return NULL;
+
+    if (!pcm_cache)
+        pcm_cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+            (GDestroyNotify) pcm_cache_entry_free);
+
+    if (!(entry = g_hash_table_lookup (pcm_cache, stream->filename))) {
+        /* play this one from the file and have it ready for next time */
+        entry = g_slice_new0 (PcmCacheEntry);
+        entry->filename = g_strdup (stream->filename);
+        g_hash_table_insert (pcm_cache, entry->filename, entry);
+    }
+
+    /* the file is checked off the main loop, before it is decoded and
+       on later plays to drop a copy that changed on disk. A changed
+       file may thus be played from the cache once more. */
+    if (entry->stat_job_id == 0) {
+        check = g_slice_new0 (PcmCacheStat);
+        check->entry = entry;
+        check->filename = g_strdup (entry->filename);
+        entry->stat_job_id = n_workers_submit (gst_workers, pcm_cache_stat_cb,
+            pcm_cache_stat_done_cb, check, (GDestroyNotify) pcm_cache_stat_free);
+    }
+
+    if (!entry->buffer)
+        return NULL;
+
+    g_queue_unlink (&pcm_cache_lru, &entry->lru);
+    g_queue_push_head_link (&pcm_cache_lru, &entry->lru);
+
+    return entry;
+}
+
+static void
+pcm_cache_clear ()
+{
+    if (pcm_cache) {
+        g_hash_table_destroy (pcm_cache);
+        pcm_cache = NULL;
+    }
+}
+
+static void
+pcm_need_data_cb (GstAppSrc *src, guint length, gpointer userdata)
+{
+    StreamData *stream = userdata;
+
+    (void) length;
+
+    /* called from the streaming thread */
+    if (g_atomic_int_compare_and_exchange (&stream->pcm_pushed, FALSE, TRUE)) {
+        gst_app_src_push_buffer (src, gst_buffer_ref (stream->pcm_buffer));
+        gst_app_src_end_of_stream (src);
+    }
+}
+
+static void
+contents_need_data_cb (GstAppSrc *src, guint length, gpointer userdata)
+{
+    StreamData *stream = userdata;
+    GstBuffer *buffer = NULL;
+    gconstpointer data;
+    gsize size;
+
+    /* called from the streaming thread, wraps the contents without copying */
+    data = g_bytes_get_data (stream->contents, &size);
+    if (stream->contents_offset >= size) {
+        gst_app_src_end_of_stream (src);
+        return;
+    }
+
+    if (length == 0 || length > MEMORY_CHUNK_SIZE)
+        length = MEMORY_CHUNK_SIZE;
+    if (length > size - stream->contents_offset)
+        length = size - stream->contents_offset;
+
+    buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+                                          (gpointer) data, size,
+                                          stream->contents_offset, length,
+                                          g_bytes_ref (stream->contents),
+                                          (GDestroyNotify) g_bytes_unref);
+    GST_BUFFER_OFFSET (buffer) = stream->contents_offset;
+    stream->contents_offset += length;
+
+    gst_app_src_push_buffer (src, buffer);
+}
+
+static gboolean
+contents_seek_data_cb (GstAppSrc *src, guint64 offset, gpointer userdata)
+{
+    StreamData *stream = userdata;
+
+    (void) src;
+
+    if (offset > g_bytes_get_size (stream->contents))
+        return FALSE;
+
+    stream->contents_offset = offset;
+    return TRUE;
+}
+
+static gchar*
+pipeline_key (StreamData *stream)
+{
+    gchar *properties = NULL;
+    gchar *key        = NULL;
+
+    if (stream->properties)
+        properties = gst_structure_to_string (stream->properties);
+
+    key = g_strdup_printf ("%s %d %s", stream->pcm_buffer ? "appsrc" : stream->contents ? "memsrc" : "filesrc",
+                           stream->latency, properties ? properties : "");
+    g_free (properties);
+
+    return key;
+}
+
+static void
+pooled_pipeline_free (PooledPipeline *pooled)
+{
+    if (pooled->expire_id > 0)
+        n_timers_remove (pipeline_pool_timers, pooled->expire_id);
+
+    gst_element_set_state (pooled->pipeline, GST_STATE_NULL);
+    gst_object_unref (pooled->pipeline);
+    g_free (pooled->key);
+    g_slice_free (PooledPipeline, pooled);
+}
+
+static gboolean
+pooled_pipeline_expire_cb (gpointer userdata)
+{
+    PooledPipeline *pooled = userdata;
+
+    N_DEBUG (LOG_CAT "idle pipeline expired");
+    pooled->expire_id = 0;
+    g_queue_remove (&pipeline_pool, pooled);
+    pooled_pipeline_free (pooled);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+pipeline_pool_put (StreamData *stream)
+{
+    PooledPipeline    *pooled  = NULL;
+    GstControlBinding *binding = NULL;
+    GstBus            *bus     = NULL;
+
+    if (pipeline_pool_size == 0 || stream->pipeline_failed || !stream->pipeline_key)
+        return FALSE;
+
+    if (gst_element_set_state (stream->pipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE)
+        return FALSE;
+
+    /* drop the messages left over from the stream */
+    bus = gst_element_get_bus (stream->pipeline);
+    gst_bus_set_flushing (bus, TRUE);
+    gst_bus_set_flushing (bus, FALSE);
+    gst_object_unref (bus);
+
+    if ((binding = gst_object_get_control_binding (GST_OBJECT (stream->volume), "volume"))) {
+        gst_object_remove_control_binding (GST_OBJECT (stream->volume), binding);
+        gst_object_unref (binding);
+    }
+    g_object_set (G_OBJECT (stream->volume), "volume", 1.0, NULL);
+
+    /* undo the clock setup of a scheduled start */
+    if (stream->start_time) {
+        gst_pipeline_auto_clock (GST_PIPELINE (stream->pipeline));
+        gst_element_set_start_time (stream->pipeline, 0);
+    }
+
+    pooled = g_slice_new0 (PooledPipeline);
+    pooled->pipeline = stream->pipeline;
+    pooled->src = stream->src;
+    pooled->volume = stream->volume;
+    pooled->appsink = stream->appsink;
+    pooled->key = stream->pipeline_key;
+    stream->pipeline_key = NULL;
+
+    if (pipeline_pool_expiry > 0 && pipeline_pool_timers)
+        pooled->expire_id = n_timers_add (pipeline_pool_timers, pipeline_pool_expiry * 1000,
+                                          pooled_pipeline_expire_cb, pooled);
+
+    g_queue_push_head (&pipeline_pool, pooled);
+    while (g_queue_get_length (&pipeline_pool) > pipeline_pool_size)
+        pooled_pipeline_free (g_queue_pop_tail (&pipeline_pool));
+
+    N_DEBUG (LOG_CAT "pipeline returned to pool (%u idle)",
+        g_queue_get_length (&pipeline_pool));
+
+    return TRUE;
+}
+
+static gboolean
+pipeline_pool_take (StreamData *stream)
+{
+    PooledPipeline *pooled = NULL;
+    GList          *iter   = NULL;
+
+    for (iter = pipeline_pool.head; iter; iter = g_list_next (iter)) {
+        pooled = iter->data;
+        if (g_str_equal (pooled->key, stream->pipeline_key))
+            break;
+    }
+
+    if (!iter)
+        return FALSE;
+
+    g_queue_delete_link (&pipeline_pool, iter);
+    if (pooled->expire_id > 0)
+        n_timers_remove (pipeline_pool_timers, pooled->expire_id);
+
+    stream->pipeline = pooled->pipeline;
+    stream->pipeline_state = GST_STATE_READY;
+    stream->src = pooled->src;
+    stream->volume = pooled->volume;
+    stream->appsink = pooled->appsink;
+
+    g_free (pooled->key);
+    g_slice_free (PooledPipeline, pooled);
+
+    return TRUE;
+}
+
+static void
+pipeline_pool_clear ()
+{
+    PooledPipeline *pooled = NULL;
+
+    while ((pooled = g_queue_pop_head (&pipeline_pool)))
+        pooled_pipeline_free (pooled);
+}
+
+static GstCaps*
+shared_output_caps ()
+{
+    return gst_caps_new_simple ("audio/x-raw",
+                                "format", G_TYPE_STRING, "S16LE",
+                                "layout", G_TYPE_STRING, "interleaved",
+                                "rate", G_TYPE_INT, shared_output_rate,
+                                "channels", G_TYPE_INT, 2,
+                                NULL);
+}
+
+static gchar*
+shared_output_key (StreamData *stream)
+{
+    gchar *properties = NULL;
+    gchar *key        = NULL;
+
+    if (stream->properties)
+        properties = gst_structure_to_string (stream->properties);
+
+    key = g_strdup_printf ("%d %s", stream->latency, properties ? properties : "");
+    g_free (properties);
+
+    return key;
+}
+
+static void
+shared_output_free (SharedOutput *output)
+{
+    if (output->idle_id > 0)
+        n_timers_remove (pipeline_pool_timers, output->idle_id);
+
+    if (output->bus_watch_id > 0)
+        g_source_remove (output->bus_watch_id);
+
+    gst_element_set_state (output->pipeline, GST_STATE_NULL);
+    gst_object_unref (output->pipeline);
+    g_free (output->key);
+    g_slice_free (SharedOutput, output);
+}
+
+static gboolean
+shared_output_bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata)
+{
+    SharedOutput *output = userdata;
+    GError       *error  = NULL;
+
+    (void) bus;
+
+    if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+        gst_message_parse_error (msg, &error, NULL);
+        N_WARNING (LOG_CAT "shared output error: %s", error->message);
+        g_error_free (error);
+
+        /* start over from NULL when the next stream attaches */
+        gst_element_set_state (output->pipeline, GST_STATE_NULL);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static LatencyClass
+parse_latency_class (const char *str)
+{
+    if (!str || g_str_equal (str, "normal"))
+        return LATENCY_NORMAL;
+    else if (g_str_equal (str, "low"))
+        return LATENCY_LOW;
+    else if (g_str_equal (str, "powersave"))
+        return LATENCY_POWERSAVE;
+
+    N_WARNING (LOG_CAT "unknown latency class '%s'", str);
+    return LATENCY_NORMAL;
+}
+
+/* pulsesink requests a latency of latency-time from the server and
+   keeps buffer-time of data queued in the pulse stream. */
+static void
+set_sink_latency (GstElement *sink, LatencyClass latency)
+{
+    if (!sink || latency == LATENCY_NORMAL)
+        return;
+
+    if (!g_object_class_find_property (G_OBJECT_GET_CLASS (sink), "buffer-time"))
+        return;
+
+    if (latency == LATENCY_LOW)
+        g_object_set (G_OBJECT (sink),
+                      "buffer-time", (gint64) LOW_LATENCY_BUFFER_TIME,
+                      "latency-time", (gint64) LOW_LATENCY_LATENCY_TIME, NULL);
+    else
+        g_object_set (G_OBJECT (sink),
+                      "buffer-time", (gint64) POWERSAVE_BUFFER_TIME,
+                      "latency-time", (gint64) POWERSAVE_LATENCY_TIME, NULL);
+}
+
+static SharedOutput*
+shared_output_get (StreamData *stream)
+{
+    SharedOutput *output = NULL;
+    GstElement *pipeline = NULL, *mixer = NULL, *audioconv = NULL, *sink = NULL;
+    GstCaps *caps = NULL;
+    GstBus *bus = NULL;
+    gchar *key = NULL;
+
+    key = shared_output_key (stream);
+
+    if (!shared_outputs)
+        shared_outputs = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+            (GDestroyNotify) shared_output_free);
+
+    if ((output = g_hash_table_lookup (shared_outputs, key))) {
+        g_free (key);
+        return output;
+    }
+
+    pipeline = gst_pipeline_new (NULL);
+    mixer = gst_element_factory_make ("audiomixer", NULL);
+    audioconv = gst_element_factory_make ("audioconvert", NULL);
+    sink = gst_element_factory_make ("pulsesink", NULL);
+
+    if (!pipeline || !mixer || !audioconv || !sink) {
+        N_ERROR (LOG_CAT "failed to create shared output elements.");
+        if (sink)
+            gst_object_unref (sink);
+        if (audioconv)
+            gst_object_unref (audioconv);
+        if (mixer)
+            gst_object_unref (mixer);
+        if (pipeline)
+            gst_object_unref (pipeline);
+        g_free (key);
+        return NULL;
+    }
+
+    gst_bin_add_many (GST_BIN (pipeline), mixer, audioconv, sink, NULL);
+
+    caps = shared_output_caps ();
+    if (!gst_element_link_filtered (mixer, audioconv, caps) ||
+        !gst_element_link (audioconv, sink)) {
+        N_ERROR (LOG_CAT "failed to link shared output");
+        gst_caps_unref (caps);
+        gst_object_unref (pipeline);
+        g_free (key);
+        return NULL;
+    }
+    gst_caps_unref (caps);
+
+    set_stream_properties (sink, stream->properties);
+    set_sink_latency (sink, stream->latency);
+
+    output = g_slice_new0 (SharedOutput);
+    output->key = key;
+    output->pipeline = pipeline;
+    output->mixer = mixer;
+
+    bus = gst_element_get_bus (pipeline);
+    output->bus_watch_id = gst_bus_add_watch (bus, shared_output_bus_cb, output);
+    gst_object_unref (bus);
+
+    g_hash_table_insert (shared_outputs, output->key, output);
+    N_DEBUG (LOG_CAT "created shared output for '%s'", key);
+
+    return output;
+}
+
+static gboolean
+shared_output_idle_cb (gpointer userdata)
+{
+    SharedOutput *output = userdata;
+
+    /* corks the pulse stream until the next stream attaches */
+    N_DEBUG (LOG_CAT "shared output idle");
+    output->idle_id = 0;
+    gst_element_set_state (output->pipeline, GST_STATE_PAUSED);
+
+    return G_SOURCE_REMOVE;
+}
+
+static GstFlowReturn
+shared_output_new_sample_cb (GstAppSink *sink, gpointer userdata)
+{
+    GstAppSrc *src    = userdata;
+    GstSample *sample = NULL;
+
+    /* called from the streaming thread of the stream pipeline */
+    if (!(sample = gst_app_sink_pull_sample (sink)))
+        return GST_FLOW_OK;
+
+    (void) gst_app_src_push_buffer (src, gst_buffer_ref (gst_sample_get_buffer (sample)));
+    gst_sample_unref (sample);
+
+    return GST_FLOW_OK;
+}
+
+static GstElement*
+create_output_sink (StreamData *stream)
+{
+    GstElement *bin = NULL, *resample = NULL, *sink = NULL;
+    GstPad *pad = NULL;
+    GstCaps *caps = NULL;
+
+    if (!shared_output_enabled) {
+        if ((sink = gst_element_factory_make ("pulsesink", NULL))) {
+            set_stream_properties (sink, stream->properties);
+            set_sink_latency (sink, stream->latency);
+        }
+        return sink;
+    }
+
+    /* the stream runs in real time against the appsink, the shared
+       output only mixes */
+    bin = gst_bin_new (NULL);
+    resample = gst_element_factory_make ("audioresample", NULL);
+    sink = gst_element_factory_make ("appsink", NULL);
+
+    if (!resample || !sink) {
+        if (sink)
+            gst_object_unref (sink);
+        if (resample)
+            gst_object_unref (resample);
+        gst_object_unref (bin);
+        return NULL;
+    }
+
+    caps = shared_output_caps ();
+    g_object_set (G_OBJECT (sink), "caps", caps, "sync", TRUE, NULL);
+    gst_caps_unref (caps);
+
+    gst_bin_add_many (GST_BIN (bin), resample, sink, NULL);
+    gst_element_link (resample, sink);
+
+    pad = gst_element_get_static_pad (resample, "sink");
+    gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+    gst_object_unref (pad);
+
+    stream->appsink = sink;
+
+    return bin;
+}
+
+static void
+shared_output_attach (StreamData *stream)
+{
+    GstAppSinkCallbacks callbacks = { .new_sample = shared_output_new_sample_cb };
+    SharedOutput *output = NULL;
+    GstElement *src = NULL;
+    GstCaps *caps = NULL;
+
+    if (!(output = shared_output_get (stream)))
+        return;
+
+    if (!(src = gst_element_factory_make ("appsrc", NULL)))
+        return;
+
+    caps = shared_output_caps ();
+    g_object_set (G_OBJECT (src), "caps", caps, "format", GST_FORMAT_TIME,
+                  "is-live", TRUE, "do-timestamp", TRUE, NULL);
+    gst_caps_unref (caps);
+
+    gst_bin_add (GST_BIN (output->pipeline), src);
+    if (!gst_element_link (src, output->mixer)) {
+        N_WARNING (LOG_CAT "failed to attach stream to shared output");
+        gst_bin_remove (GST_BIN (output->pipeline), src);
+        return;
+    }
+    gst_element_sync_state_with_parent (src);
+
+    stream->output = output;
+    stream->output_src = gst_object_ref (src);
+    gst_app_sink_set_callbacks (GST_APP_SINK (stream->appsink), &callbacks,
+                                gst_object_ref (src), gst_object_unref);
+
+    output->inputs++;
+    if (output->idle_id > 0) {
+        n_timers_remove (pipeline_pool_timers, output->idle_id);
+        output->idle_id = 0;
+    }
+    gst_element_set_state (output->pipeline, GST_STATE_PLAYING);
+}
+
+static void
+shared_output_detach (StreamData *stream)
+{
+    SharedOutput *output = stream->output;
+    GstPad *src_pad = NULL, *mixer_pad = NULL;
+
+    if (!output)
+        return;
+
+    src_pad = gst_element_get_static_pad (stream->output_src, "src");
+    mixer_pad = gst_pad_get_peer (src_pad);
+    gst_object_unref (src_pad);
+
+    gst_element_set_state (stream->output_src, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (output->pipeline), stream->output_src);
+    if (mixer_pad) {
+        gst_element_release_request_pad (output->mixer, mixer_pad);
+        gst_object_unref (mixer_pad);
+    }
+
+    gst_object_unref (stream->output_src);
+    stream->output_src = NULL;
+    stream->output = NULL;
+
+    if (--output->inputs == 0 && output->idle_id == 0)
+        output->idle_id = n_timers_add (pipeline_pool_timers, SHARED_OUTPUT_IDLE_MS,
+                                        shared_output_idle_cb, output);
+}
+
+static void
+shared_output_clear ()
+{
+    if (shared_outputs) {
+        g_hash_table_destroy (shared_outputs);
+        shared_outputs = NULL;
+    }
+}
+
+static gchar*
+prewarmed_key (StreamData *stream)
+{
+    /* a pre-rolled pipeline already has its file opened */
+    return g_strconcat (stream->pipeline_key, "\n", stream->filename, NULL);
+}
+
+static gboolean
+prewarmed_expire_cb (gpointer userdata)
+{
+    (void) userdata;
+
+    N_DEBUG (LOG_CAT "prewarmed pipeline was not claimed");
+    prewarmed->expire_id = 0;
+    prewarmed_clear ();
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+prewarmed_take (StreamData *stream)
+{
+    gchar *key = NULL;
+
+    if (!prewarmed || stream->pcm_buffer || !stream->filename)
+        return FALSE;
+
+    key = prewarmed_key (stream);
+    if (!g_str_equal (key, prewarmed->key)) {
+        g_free (key);
+        return FALSE;
+    }
+    g_free (key);
+
+    if (prewarmed->expire_id > 0)
+        n_timers_remove (pipeline_pool_timers, prewarmed->expire_id);
+
+    /* the state changes of the pre-roll are still queued on the bus and
+       synchronize the stream once the bus watch is added. */
+    stream->pipeline = prewarmed->pipeline;
+    stream->pipeline_state = GST_STATE_READY;
+    stream->src = prewarmed->src;
+    stream->volume = prewarmed->volume;
+    stream->appsink = prewarmed->appsink;
+
+    g_free (prewarmed->key);
+    g_slice_free (PooledPipeline, prewarmed);
+    prewarmed = NULL;
+
+    return TRUE;
+}
+
+static void
+prewarmed_clear ()
+{
+    if (prewarmed) {
+        pooled_pipeline_free (prewarmed);
+        prewarmed = NULL;
+    }
+}
 
-        case GST_MESSAGE_EOS: {
-            if (GST_ELEMENT (GST_MESSAGE_SRC (msg)) != stream->pipeline)
-                break;
+static void
+setup_pipeline (StreamData *stream, gboolean prerolled)
+{
+    static GstAppSrcCallbacks callbacks = { .need_data = pcm_need_data_cb };
+    static GstAppSrcCallbacks contents_callbacks = { .need_data = contents_need_data_cb,
+                                                     .seek_data = contents_seek_data_cb };
+    GstBus *bus = NULL;
 
-            if (stream->repeat_enabled) {
-                rewind_stream (stream);
-                return G_SOURCE_CONTINUE;
-            }
+    if (stream->pcm_buffer) {
+        stream->pcm_pushed = FALSE;
+        gst_app_src_set_caps (GST_APP_SRC (stream->src), stream->pcm_caps);
+        gst_app_src_set_callbacks (GST_APP_SRC (stream->src), &callbacks, stream, NULL);
+    }
+    else if (stream->contents) {
+        stream->contents_offset = 0;
+        gst_app_src_set_size (GST_APP_SRC (stream->src), g_bytes_get_size (stream->contents));
+        gst_app_src_set_callbacks (GST_APP_SRC (stream->src), &contents_callbacks, stream, NULL);
+    }
+    else if (!prerolled)
+        g_object_set (G_OBJECT (stream->src), "location", stream->filename, NULL);
 
-            N_DEBUG (LOG_CAT "eos");
-            /* Free the pipeline already here */
-            stream->bus_watch_id = 0;
-            cleanup (stream);
-            n_sink_interface_complete (stream->iface, stream->request);
-            return G_SOURCE_REMOVE;
-        }
+    if (stream->appsink)
+        shared_output_attach (stream);
 
-        default:
-            break;
+    bus = gst_element_get_bus (stream->pipeline);
+    stream->bus_watch_id = gst_bus_add_watch_full (bus,
+        n_request_get_source_priority (stream->request, G_PRIORITY_DEFAULT),
+        bus_cb, stream, NULL);
+    gst_object_unref (bus);
+
+    stream->prerolled = prerolled;
+    stream->loop_offset = 0;
+    stream->segment_loop = FALSE;
+    if (stream->repeat_enabled) {
+        stream->segment_pad = gst_element_get_static_pad (stream->volume, "sink");
+        stream->segment_probe_id = gst_pad_add_probe (stream->segment_pad,
+                                                      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                                                      loop_segment_probe_cb, stream, NULL);
     }
 
-    return G_SOURCE_CONTINUE;
+    /* a pre-rolled pipeline has already left READY, its first loop is
+       set up here rather than on the state change */
+    if (prerolled)
+        start_segment_loop (stream);
+
+    (void) create_volume (stream);
 }
 
-static void
-new_decoded_pad_cb (GstElement *element, GstPad *pad, gpointer userdata)
+static int
+build_pcm_pipeline (StreamData *stream)
 {
-    GstElement   *sink_element = (GstElement*) userdata;
-    GstStructure *structure    = NULL;
-    GstCaps      *caps         = NULL;
-    GstPad       *sink_pad     = NULL;
+    GstElement *pipeline = NULL, *source = NULL, *audioconv = NULL,
+        *volume = NULL, *sink = NULL;
 
-    (void) element;
+    pipeline = gst_pipeline_new (NULL);
+    source = gst_element_factory_make ("appsrc", NULL);
+    audioconv = gst_element_factory_make ("audioconvert", NULL);
+    volume = gst_element_factory_make ("volume", NULL);
+    sink = create_output_sink (stream);
 
-    caps = gst_pad_get_current_caps (pad);
-    if (gst_caps_is_empty (caps) || gst_caps_is_any (caps)) {
-        gst_caps_unref (caps);
-        return;
+    if (!pipeline || !source || !audioconv || !volume || !sink) {
+        N_ERROR (LOG_CAT "failed to create required elements.");
+        goto failed;
     }
 
-    structure = gst_caps_get_structure (caps, 0);
-    if (g_str_has_prefix (gst_structure_get_name (structure), "audio")) {
-        sink_pad = gst_element_get_static_pad (sink_element, "sink");
-        if (!gst_pad_is_linked (sink_pad))
-            gst_pad_link (pad, sink_pad);
-        gst_object_unref (sink_pad);
+    gst_bin_add_many (GST_BIN (pipeline), source, audioconv, volume, sink, NULL);
+
+    if (!gst_element_link_many (source, audioconv, volume, sink, NULL)) {
+        N_ERROR (LOG_CAT "failed to link source, converter, volume or sink");
+        goto failed_pipeline;
     }
 
-    gst_caps_unref (caps);
+    g_object_set (G_OBJECT (source), "format", GST_FORMAT_TIME, NULL);
+
+    stream->pipeline = pipeline;
+    stream->pipeline_state = GST_STATE_NULL;
+    stream->src = source;
+    stream->volume = volume;
+
+    return TRUE;
+
+failed:
+    if (sink)
+        gst_object_unref (sink);
+    if (volume)
+        gst_object_unref (volume);
+    if (audioconv)
+        gst_object_unref (audioconv);
+    if (source)
+        gst_object_unref (source);
+
+failed_pipeline:
+    if (pipeline)
+        gst_object_unref (pipeline);
+
+    return FALSE;
 }
 
 static int
-make_pipeline (StreamData *stream)
+build_pipeline (StreamData *stream)
 {
     GstElement *pipeline = NULL, *source = NULL, *decoder = NULL,
         *audioconv = NULL, *volume = NULL, *sink = NULL;
-    GstBus *bus = NULL;
 
     pipeline = gst_pipeline_new (NULL);
-    source = gst_element_factory_make ("filesrc", NULL);
+    source = gst_element_factory_make (stream->contents ? "appsrc" : "filesrc", NULL);
     decoder = gst_element_factory_make ("decodebin", NULL);
     audioconv = gst_element_factory_make ("audioconvert", NULL);
     volume = gst_element_factory_make ("volume", NULL);
-    sink = gst_element_factory_make ("pulsesink", NULL);
+    sink = create_output_sink (stream);
 
     if (!pipeline || !source || !decoder || !audioconv || !volume || !sink) {
         N_ERROR (LOG_CAT "failed to create required elements.");
@@ -632,20 +2165,15 @@ make_pipeline (StreamData *stream)
     g_signal_connect (G_OBJECT (decoder), "pad-added",
         G_CALLBACK (new_decoded_pad_cb), audioconv);
 
-    g_object_set (G_OBJECT (source), "location", stream->filename, NULL);
-
-    bus = gst_element_get_bus (pipeline);
-    stream->bus_watch_id = gst_bus_add_watch (bus, bus_cb, stream);
-    gst_object_unref (bus);
-
-    set_stream_properties (sink, stream->properties);
+    /* let typefinding and demuxers seek in the contents */
+    if (stream->contents)
+        g_object_set (G_OBJECT (source), "stream-type", GST_APP_STREAM_TYPE_RANDOM_ACCESS, NULL);
 
     stream->pipeline = pipeline;
     stream->pipeline_state = GST_STATE_NULL;
+    stream->src = source;
     stream->volume = volume;
 
-    (void) create_volume (stream);
-
     return TRUE;
 
 failed:
@@ -669,19 +2197,89 @@ failed_pipeline:
     return FALSE;
 }
 
+static int
+make_pipeline (StreamData *stream)
+{
+    PcmCacheEntry *cached = NULL;
+
+    if ((cached = pcm_cache_lookup (stream))) {
+        N_DEBUG (LOG_CAT "playing '%s' from the sound cache", stream->filename);
+        stream->pcm_buffer = gst_buffer_ref (cached->buffer);
+        stream->pcm_caps = gst_caps_ref (cached->caps);
+    }
+
+    stream->pipeline_key = pipeline_key (stream);
+
+    if (prewarmed_take (stream)) {
+        N_DEBUG (LOG_CAT "claiming prewarmed pipeline");
+        setup_pipeline (stream, TRUE);
+        return TRUE;
+    }
+
+    if (memory_source_enabled && !stream->pcm_buffer && stream->filename &&
+        (stream->contents = read_sound_file (stream->filename))) {
+        g_free (stream->pipeline_key);
+        stream->pipeline_key = pipeline_key (stream);
+    }
+
+    if (pipeline_pool_take (stream))
+        N_DEBUG (LOG_CAT "reusing idle pipeline");
+    else if (!(stream->pcm_buffer ? build_pcm_pipeline (stream) : build_pipeline (stream))) {
+        g_free (stream->pipeline_key);
+        stream->pipeline_key = NULL;
+        stream->appsink = NULL;
+        if (stream->contents)
+            g_bytes_unref (stream->contents), stream->contents = NULL;
+        return FALSE;
+    }
+
+    setup_pipeline (stream, FALSE);
+
+    return TRUE;
+}
+
 static void
 free_pipeline (StreamData *stream)
 {
-    if (stream->pipeline) {
+    if (stream->bus_watch_id > 0) {
+        g_source_remove (stream->bus_watch_id);
+        stream->bus_watch_id = 0;
+    }
+
+    if (stream->segment_pad) {
+        gst_pad_remove_probe (stream->segment_pad, stream->segment_probe_id);
+        gst_object_unref (stream->segment_pad);
+        stream->segment_pad = NULL;
+        stream->segment_probe_id = 0;
+    }
+
+    if (stream->pipeline && !pipeline_pool_put (stream)) {
         N_DEBUG (LOG_CAT "freeing pipeline");
         gst_element_set_state (stream->pipeline, GST_STATE_NULL);
         gst_object_unref (stream->pipeline);
-        stream->pipeline = NULL;
     }
 
-    if (stream->bus_watch_id > 0) {
-        g_source_remove (stream->bus_watch_id);
-        stream->bus_watch_id = 0;
+    /* the stream pipeline is stopped, nothing pushes to the mixer input */
+    shared_output_detach (stream);
+
+    stream->pipeline = NULL;
+    stream->src = NULL;
+    stream->volume = NULL;
+    stream->appsink = NULL;
+    g_free (stream->pipeline_key);
+    stream->pipeline_key = NULL;
+
+    if (stream->pcm_buffer) {
+        gst_buffer_unref (stream->pcm_buffer);
+        stream->pcm_buffer = NULL;
+    }
+    if (stream->pcm_caps) {
+        gst_caps_unref (stream->pcm_caps);
+        stream->pcm_caps = NULL;
+    }
+    if (stream->contents) {
+        g_bytes_unref (stream->contents);
+        stream->contents = NULL;
     }
 
     free_volume (stream);
@@ -737,6 +2335,22 @@ call_state_changed (NContext *context,
     }
 }
 
+static void
+warm_files_changed (NContext *context,
+                    const char *key,
+                    const NValue *old_value,
+                    const NValue *new_value,
+                    void *userdata)
+{
+    (void) context;
+    (void) key;
+    (void) old_value;
+    (void) userdata;
+
+    if (new_value)
+        warm_sound_files (n_value_get_string ((NValue*) new_value));
+}
+
 static void
 init_done_cb (NHook *hook, void *data, void *userdata)
 {
@@ -745,6 +2359,7 @@ init_done_cb (NHook *hook, void *data, void *userdata)
 
     NContext *context = (NContext*) userdata;
     NValue *v = NULL;
+    gchar **file = NULL;
 
     /* query the initial system sound level value */
     v = (NValue*) n_context_get_value (context, "profile.current.system.sound.level");
@@ -760,16 +2375,26 @@ init_done_cb (NHook *hook, void *data, void *userdata)
     }
 
     n_context_subscribe_value_change (context, "call_state.mode", call_state_changed, NULL);
+
+    /* get the frequently played sounds into the page cache */
+    if (warm_files)
+        for (file = warm_files; *file; ++file)
+            warm_sound_file (*file);
+
+    v = (NValue*) n_context_get_value (context, PROFILE_WARM_FILES_KEY);
+    if (v)
+        warm_sound_files (n_value_get_string (v));
+
+    n_context_subscribe_value_change (context, PROFILE_WARM_FILES_KEY, warm_files_changed, NULL);
 }
 
 static int
 gst_sink_initialize (NSinkInterface *iface)
 {
-    (void) iface;
-
     N_DEBUG (LOG_CAT "initializing GStreamer");
 
     gst_init_check (NULL, NULL, NULL);
+    n_sink_interface_add_plan_key (iface, SOUND_FILENAME_KEY, FALSE);
 
     return TRUE;
 }
@@ -780,6 +2405,15 @@ gst_sink_shutdown (NSinkInterface *iface)
     (void) iface;
 
     stream_list_stop_all ();
+    prewarmed_clear ();
+    pipeline_pool_clear ();
+    pcm_cache_clear ();
+    shared_output_clear ();
+
+    if (warm_job_id > 0) {
+        n_workers_cancel (gst_workers, warm_job_id);
+        warm_job_id = 0;
+    }
 }
 
 static int
@@ -798,6 +2432,46 @@ gst_sink_can_handle (NSinkInterface *iface, NRequest *request)
     return FALSE;
 }
 
+static int
+gst_sink_cost (NSinkInterface *iface, NRequest *request, NSinkCost *cost)
+{
+    NProplist     *props    = NULL;
+    PcmCacheEntry *entry    = NULL;
+    const char    *filename = NULL;
+    gchar         *suffix   = NULL;
+
+    (void) iface;
+
+    props = (NProplist*) n_request_get_properties (request);
+    if (!(filename = n_proplist_get_string (props, SOUND_FILENAME_KEY)))
+        return FALSE;
+
+    cost->can_fade = TRUE;
+    cost->can_loop = TRUE;
+
+    /* a rough guess from what is ready for the file, the exact pipeline
+       is only known once the stream is prepared. */
+    if (pcm_cache && !n_proplist_get_bool (props, SOUND_REPEAT_KEY))
+        entry = g_hash_table_lookup (pcm_cache, filename);
+
+    suffix = g_strconcat ("\n", filename, NULL);
+
+    if (prewarmed && g_str_has_suffix (prewarmed->key, suffix))
+        cost->setup_us = COST_PREWARMED_US;
+    else if (entry && entry->buffer) {
+        cost->setup_us = COST_PCM_CACHED_US;
+        cost->cached = TRUE;
+    }
+    else if (!g_queue_is_empty (&pipeline_pool))
+        cost->setup_us = COST_POOLED_US;
+    else
+        cost->setup_us = COST_COLD_US;
+
+    g_free (suffix);
+
+    return TRUE;
+}
+
 static int
 convert_number (const char *str, gint *result)
 {
@@ -829,8 +2503,6 @@ fade_effect_new (gdouble position, gdouble length, gdouble start, gdouble end)
     FadeEffect *effect;
 
     effect = g_slice_new (FadeEffect);
-    effect->enabled  = TRUE;
-    effect->elapsed  = 0;
     effect->position = position;
     effect->length   = length;
     effect->start    = start;
@@ -878,9 +2550,8 @@ parse_volume_fade (const char *str)
     g_strfreev (split);
 
     if (effect) {
-        N_DEBUG (LOG_CAT "fade effect parsed (enabled=%d elapsed=%.2f position=%.2f "
-                         "length=%.2f start=%.2f stop=%.2f)", effect->enabled ? 1 : 0,
-            effect->elapsed, effect->position, effect->length, effect->start, effect->end);
+        N_DEBUG (LOG_CAT "fade effect parsed (position=%.2f length=%.2f start=%.2f stop=%.2f)",
+            effect->position, effect->length, effect->start, effect->end);
     }
     else {
         N_DEBUG (LOG_CAT "invalid fade effect, unable to parse: '%s'", str);
@@ -894,60 +2565,19 @@ parse_volume_fade (const char *str)
 static void
 set_fade_effect (GstControlSource *source, FadeEffect *effect)
 {
-    gdouble start_time, new_length;
-
-    if (source == NULL || effect == NULL || !effect->enabled)
-        return;
-
-    /* effect not started yet */
-
-    if (effect->elapsed < effect->position) {
-        start_time = effect->position - effect->elapsed;
-        new_length = effect->length;
-    }
-
-    /* effect in progress */
-
-    else if (effect->elapsed >= effect->position
-             && effect->elapsed < (effect->position + effect->length)) {
-        start_time = 0;
-        new_length = effect->length - (effect->elapsed - effect->position);
-    }
-
-    /* done and finished */
-
-    else {
-        N_DEBUG (LOG_CAT "fade effect disabled (elapsed=%.2f position=%.2f "
-                         "length=%.2f start=%.2f stop=%.2f)", effect->elapsed,
-            effect->position, effect->length, effect->start, effect->end);
-        effect->enabled = FALSE;
+    if (source == NULL || effect == NULL)
         return;
-    }
 
+    /* The points are in stream time, which keeps running across the loops
+     * of a repeating stream, so the ramp is set up only once. */
     gst_timed_value_control_source_set (GST_TIMED_VALUE_CONTROL_SOURCE (source),
-	start_time * GST_SECOND, effect->start);
+        effect->position * GST_SECOND, effect->start);
 
     gst_timed_value_control_source_set (GST_TIMED_VALUE_CONTROL_SOURCE (source),
-        (start_time + new_length) * GST_SECOND, effect->end);
+        (effect->position + effect->length) * GST_SECOND, effect->end);
 
     N_DEBUG (LOG_CAT "fade effect (%.2f -> %.2f) to start from %.2f and end at %.2f seconds",
-        effect->start, effect->end, start_time, start_time + new_length);
-}
-
-static void
-update_fade_effect (FadeEffect *effect, gdouble elapsed, gdouble volume)
-{
-    if (effect == NULL || !effect->enabled)
-        return;
-
-    effect->elapsed = elapsed;
-    effect->start = volume;
-
-    N_DEBUG (LOG_CAT "fade effect updated (enabled=%d elapsed=%.2f position=%.2f "
-                     "length=%.2f start=%.2f stop=%.2f)", effect->enabled ? 1 : 0,
-        effect->elapsed, effect->position, effect->length, effect->start, effect->end);
-
-    return;
+        effect->start, effect->end, effect->position, effect->position + effect->length);
 }
 
 static gboolean
@@ -978,12 +2608,15 @@ gst_sink_fake_play_complete_cb (gpointer userdata) {
 static void
 fake_play_setup (StreamData *stream)
 {
-    if (stream->fake_play_source)
-        g_source_remove (stream->fake_play_source), stream->fake_play_source = 0;
+    if (stream->fake_play_source) {
+        n_timers_remove (stream_timers (stream), stream->fake_play_source);
+        stream->fake_play_source = 0;
+    }
 
-    stream->fake_play_source = g_timeout_add (NO_SOUND_DELAY_MS,
-                                              gst_sink_fake_play_complete_cb,
-                                              stream);
+    stream->fake_play_source = n_timers_add (stream_timers (stream),
+                                             NO_SOUND_DELAY_MS,
+                                             gst_sink_fake_play_complete_cb,
+                                             stream);
 }
 
 static void
@@ -998,6 +2631,86 @@ stream_list_remove (StreamData *stream)
     active_streams = g_list_remove (active_streams, stream);
 }
 
+static gboolean
+is_sound_enabled (const NProplist *props)
+{
+    const NValue *enabled = NULL;
+
+    if (!(enabled = n_proplist_get (props, SOUND_ENABLED_KEY)))
+        return TRUE;
+
+    if (n_value_type (enabled) == N_VALUE_TYPE_STRING)
+        return g_str_equal (n_value_get_string (enabled), SOUND_OFF) ? FALSE : TRUE;
+    else if (n_value_type (enabled) == N_VALUE_TYPE_BOOL)
+        return n_value_get_bool (enabled);
+
+    return TRUE;
+}
+
+static void
+gst_sink_prewarm (NSinkInterface *iface, NRequest *request)
+{
+    StreamData *stream = NULL;
+    NProplist *props = NULL;
+    gchar *key = NULL;
+
+    (void) iface;
+
+    props = (NProplist*) n_request_get_properties (request);
+
+    if (!n_proplist_get_string (props, SOUND_FILENAME_KEY) || !is_sound_enabled (props))
+        return;
+
+    stream = g_slice_new0 (StreamData);
+    stream->filename = n_proplist_get_string (props, SOUND_FILENAME_KEY);
+    stream->repeat_enabled = n_proplist_get_bool (props, SOUND_REPEAT_KEY);
+    stream->properties = create_stream_properties (props);
+    stream->latency = parse_latency_class (n_proplist_get_string (props, SOUND_LATENCY_KEY));
+
+    /* a cached sound needs no pre-roll */
+    if (pcm_cache_lookup (stream))
+        goto done;
+
+    stream->pipeline_key = pipeline_key (stream);
+    key = prewarmed_key (stream);
+
+    if (prewarmed && g_str_equal (prewarmed->key, key)) {
+        n_timers_remove (pipeline_pool_timers, prewarmed->expire_id);
+        prewarmed->expire_id = n_timers_add (pipeline_pool_timers, prewarm_timeout,
+                                             prewarmed_expire_cb, NULL);
+        goto done;
+    }
+
+    prewarmed_clear ();
+
+    /* have the pulse stream of the shared output ready as well */
+    if (shared_output_enabled)
+        (void) shared_output_get (stream);
+
+    if (!pipeline_pool_take (stream) && !build_pipeline (stream))
+        goto done;
+
+    N_DEBUG (LOG_CAT "pre-rolling '%s'", stream->filename);
+    g_object_set (G_OBJECT (stream->src), "location", stream->filename, NULL);
+    gst_element_set_state (stream->pipeline, GST_STATE_PAUSED);
+
+    prewarmed = g_slice_new0 (PooledPipeline);
+    prewarmed->pipeline = stream->pipeline;
+    prewarmed->src = stream->src;
+    prewarmed->volume = stream->volume;
+    prewarmed->appsink = stream->appsink;
+    prewarmed->key = key;
+    prewarmed->expire_id = n_timers_add (pipeline_pool_timers, prewarm_timeout,
+                                         prewarmed_expire_cb, NULL);
+    key = NULL;
+
+done:
+    g_free (key);
+    g_free (stream->pipeline_key);
+    free_stream_properties (stream->properties);
+    g_slice_free (StreamData, stream);
+}
+
 static int
 gst_sink_prepare (NSinkInterface *iface, NRequest *request)
 {
@@ -1005,7 +2718,6 @@ gst_sink_prepare (NSinkInterface *iface, NRequest *request)
     NProplist *props = NULL;
     gint timeout_ms;
     gboolean custom_sound, fade_only_custom;
-    NValue *enabled = NULL;
 
     props = (NProplist*) n_request_get_properties (request);
 
@@ -1015,16 +2727,10 @@ gst_sink_prepare (NSinkInterface *iface, NRequest *request)
     stream->filename = n_proplist_get_string (props, SOUND_FILENAME_KEY);
     stream->repeat_enabled = n_proplist_get_bool (props, SOUND_REPEAT_KEY);
     stream->properties = create_stream_properties (props);
+    stream->latency = parse_latency_class (n_proplist_get_string (props, SOUND_LATENCY_KEY));
     stream->state = STREAM_STATE_NOT_STARTED;
 
-    stream->sound_enabled = TRUE;
-    enabled = n_proplist_get (props, SOUND_ENABLED_KEY);
-    if (enabled) {
-        if (n_value_type (enabled) == N_VALUE_TYPE_STRING)
-            stream->sound_enabled = g_str_equal (n_value_get_string (enabled), SOUND_OFF) ? FALSE : TRUE;
-        else if (n_value_type (enabled) == N_VALUE_TYPE_BOOL)
-            stream->sound_enabled = n_value_get_bool (enabled);
-    }
+    stream->sound_enabled = is_sound_enabled (props);
 
     stream->volume_limit = parse_volume_limit (n_proplist_get_string (props, SOUND_VOLUME_KEY),
         &stream->volume_min, &stream->volume_max);
@@ -1064,13 +2770,18 @@ gst_sink_prepare (NSinkInterface *iface, NRequest *request)
 
     /* sound not enabled. pipeline not needed */
     if (!stream->sound_enabled) {
-        stream->delay_synchronize_source = g_timeout_add (NO_SOUND_DELAY_MS,
-                                                          gst_sink_synchronize_cb,
-                                                          stream);
+        stream->delay_synchronize_source = n_timers_add (stream_timers (stream),
+                                                         NO_SOUND_DELAY_MS,
+                                                         gst_sink_synchronize_cb,
+                                                         stream);
         N_DEBUG (LOG_CAT "sound disabled");
         return TRUE;
     }
 
+    stream->prepare_time = g_get_monotonic_time ();
+    stream->state_request_time = stream->prepare_time;
+    stream->startup_pending = TRUE;
+
     if (!make_pipeline (stream))
         return FALSE;
 
@@ -1080,9 +2791,10 @@ gst_sink_prepare (NSinkInterface *iface, NRequest *request)
     if (stream->delay_startup) {
         /* synchronize after startup delay so that vibra etc effects
          * start at the same time with delayed gst events as well. */
-        stream->delay_synchronize_source = g_timeout_add (stream->delay_startup,
-                                                          gst_sink_synchronize_cb,
-                                                          stream);
+        stream->delay_synchronize_source = n_timers_add (stream_timers (stream),
+                                                         stream->delay_startup,
+                                                         gst_sink_synchronize_cb,
+                                                         stream);
     }
 
     return TRUE;
@@ -1094,6 +2806,7 @@ gst_sink_play (NSinkInterface *iface, NRequest *request)
     (void) iface;
 
     StreamData *stream = NULL;
+    gint64      start  = 0;
 
     stream = (StreamData*) n_request_get_data (request, GST_KEY);
     g_assert (stream != NULL);
@@ -1111,13 +2824,14 @@ gst_sink_play (NSinkInterface *iface, NRequest *request)
 
         if (stream->state == STREAM_STATE_NOT_STARTED) {
             N_DEBUG (LOG_CAT "first time setting pipeline to playing");
+            stream->state_request_time = g_get_monotonic_time ();
+            /* shared output streams are timed by the output pipeline */
+            start = n_request_get_start_time (request);
+            if (!stream->appsink && start > stream->state_request_time)
+                schedule_pipeline_start (stream, start);
             gst_element_set_state (stream->pipeline, GST_STATE_PLAYING);
         } else if (stream->state == STREAM_STATE_PAUSED) {
-            N_DEBUG (LOG_CAT "resuming by setting pipeline to playing");
-            gst_element_set_state (stream->pipeline, GST_STATE_PLAYING);
-            if (stream->fade_resume)
-                start_stream_fade (stream, (gdouble) stream->fade_resume / 1000.0,
-                                   GST_VOLUME_SILENT, GST_VOLUME_0DB, NULL);
+            return gst_sink_resume (iface, request);
         }
 
         stream->state = STREAM_STATE_PLAYING;
@@ -1126,6 +2840,66 @@ gst_sink_play (NSinkInterface *iface, NRequest *request)
     return TRUE;
 }
 
+static int
+gst_sink_resume (NSinkInterface *iface, NRequest *request)
+{
+    StreamData *stream = NULL;
+    gdouble     volume = GST_VOLUME_SILENT;
+    guint       fade   = 0;
+
+    stream = (StreamData*) n_request_get_data (request, GST_KEY);
+    g_assert (stream != NULL);
+
+    /* only a started stream keeps its pipeline paused */
+    if (!stream->sound_enabled || !stream->pipeline || stream->state != STREAM_STATE_PAUSED)
+        return gst_sink_play (iface, request);
+
+    N_DEBUG (LOG_CAT "resuming by setting pipeline to playing");
+
+    fade = stream->fade_resume;
+
+    /* still fading out for the pause, turn back from where it got to
+       instead of pausing afterwards. */
+    if (stream->fade && stream->fade_completed_cb == stream_pause) {
+        volume = get_current_volume (stream);
+        stop_stream_fade (stream);
+        if (!fade)
+            fade = stream->fade_pause;
+    }
+
+    stream_clear_delays (stream);
+    gst_element_set_state (stream->pipeline, GST_STATE_PLAYING);
+    if (fade)
+        start_stream_fade (stream, (gdouble) fade / 1000.0,
+                           volume, GST_VOLUME_0DB, NULL);
+
+    stream->state = STREAM_STATE_PLAYING;
+
+    return TRUE;
+}
+
+/* Schedule the first sample of the pipeline at the common start time of
+   the request. The pipeline runs on the monotonic system clock, so the
+   base time is the start time in clock time. */
+static void
+schedule_pipeline_start (StreamData *stream, gint64 start)
+{
+    GstClock     *clock = NULL;
+    GstClockTime  base;
+
+    clock = gst_system_clock_obtain ();
+    gst_pipeline_use_clock (GST_PIPELINE (stream->pipeline), clock);
+    base = gst_clock_get_time (clock) + (start - g_get_monotonic_time ()) * GST_USECOND;
+    gst_object_unref (clock);
+
+    gst_element_set_start_time (stream->pipeline, GST_CLOCK_TIME_NONE);
+    gst_element_set_base_time (stream->pipeline, base);
+    stream->start_time = start;
+
+    N_DEBUG (LOG_CAT "pipeline start scheduled in %" G_GINT64_FORMAT " us",
+        start - g_get_monotonic_time ());
+}
+
 static void
 stream_pause (StreamData *stream)
 {
@@ -1236,9 +3010,10 @@ gst_sink_stop (NSinkInterface *iface, NRequest *request)
 
         if (stream->delay_stop) {
             N_DEBUG (LOG_CAT "setup delayed stop");
-            stream->delay_stop_source = g_timeout_add (stream->delay_stop,
-                                                       gst_sink_delayed_stop_cb,
-                                                       stream);
+            stream->delay_stop_source = n_timers_add (stream_timers (stream),
+                                                      stream->delay_stop,
+                                                      gst_sink_delayed_stop_cb,
+                                                      stream);
             gst_element_set_state (stream->pipeline, GST_STATE_PAUSED);
         } else {
             N_DEBUG (LOG_CAT "setup faded stop");
@@ -1265,8 +3040,11 @@ stream_list_stop_all ()
 
 N_PLUGIN_LOAD (plugin)
 {
-    NCore    *core    = NULL;
-    NContext *context = NULL;
+    NCore           *core    = NULL;
+    NContext        *context = NULL;
+    NMetrics        *metrics = NULL;
+    const NProplist *params  = NULL;
+    const char      *value   = NULL;
 
     static const NSinkInterfaceDecl decl = {
         .name       = "gst",
@@ -1277,7 +3055,10 @@ N_PLUGIN_LOAD (plugin)
         .prepare    = gst_sink_prepare,
         .play       = gst_sink_play,
         .pause      = gst_sink_pause,
-        .stop       = gst_sink_stop
+        .stop       = gst_sink_stop,
+        .prewarm    = gst_sink_prewarm,
+        .cost       = gst_sink_cost,
+        .resume     = gst_sink_resume
     };
 
     n_plugin_register_sink (plugin, &decl);
@@ -1285,6 +3066,41 @@ N_PLUGIN_LOAD (plugin)
     core = n_plugin_get_core (plugin);
     context = n_core_get_context (core);
 
+    params = n_plugin_get_params (plugin);
+    if ((value = n_proplist_get_string (params, POOL_SIZE_KEY)))
+        pipeline_pool_size = atoi (value);
+    if ((value = n_proplist_get_string (params, POOL_EXPIRY_KEY)))
+        pipeline_pool_expiry = atoi (value);
+    if ((value = n_proplist_get_string (params, SHARED_OUTPUT_KEY)))
+        shared_output_enabled = g_ascii_strcasecmp (value, "true") == 0;
+    if ((value = n_proplist_get_string (params, SHARED_OUTPUT_RATE_KEY)))
+        shared_output_rate = atoi (value);
+    if ((value = n_proplist_get_string (params, PREWARM_TIMEOUT_KEY)))
+        prewarm_timeout = atoi (value);
+    if ((value = n_proplist_get_string (params, PCM_CACHE_SIZE_KEY)))
+        pcm_cache_budget = (gsize) atoi (value) * 1024;
+    if ((value = n_proplist_get_string (params, PCM_CACHE_MAX_FILE_KEY)))
+        pcm_cache_max_file = (goffset) atoi (value) * 1024;
+    if ((value = n_proplist_get_string (params, PCM_CACHE_MAX_DURATION_KEY)))
+        pcm_cache_max_duration = atoi (value);
+    if ((value = n_proplist_get_string (params, MEMORY_SOURCE_KEY)))
+        memory_source_enabled = g_ascii_strcasecmp (value, "true") == 0;
+    if ((value = n_proplist_get_string (params, WARM_FILES_KEY)))
+        warm_files = g_strsplit (value, ";", -1);
+    pipeline_pool_timers = n_core_get_timers (core);
+    gst_workers = n_core_get_workers (core);
+    pcm_cache_memory = n_core_get_memory (core);
+    pcm_cache_size = n_memory_add_cache (pcm_cache_memory, "gst.pcm_cache",
+        N_MEMORY_PRIORITY_DEFAULT, pcm_cache_trim_cb, NULL);
+
+    metrics = n_core_get_metrics (core);
+    metric_state_ready = n_metrics_add_histogram (metrics, "gst.state.ready_us");
+    metric_state_paused = n_metrics_add_histogram (metrics, "gst.state.paused_us");
+    metric_state_playing = n_metrics_add_histogram (metrics, "gst.state.playing_us");
+    metric_first_pad = n_metrics_add_histogram (metrics, "gst.first_pad_us");
+    metric_sink_latency = n_metrics_add_histogram (metrics, "gst.sink_latency_us");
+    metric_slowest_start = n_metrics_add_ranking (metrics, "gst.slowest_start_us");
+
     if (!n_core_connect (core, N_CORE_HOOK_INIT_DONE, 0,
                          init_done_cb, context))
     {
@@ -1305,7 +3121,15 @@ N_PLUGIN_UNLOAD (plugin)
     n_context_unsubscribe_value_change (context,
         "profile.current.system.sound.level",
         system_sound_level_changed);
+    n_context_unsubscribe_value_change (context, PROFILE_WARM_FILES_KEY,
+        warm_files_changed);
+
+    g_strfreev (warm_files);
+    warm_files = NULL;
 
     n_core_disconnect (core, N_CORE_HOOK_INIT_DONE,
         init_done_cb, context);
+
+    n_memory_remove_cache (pcm_cache_memory, pcm_cache_size);
+    pcm_cache_size = NULL;
 }
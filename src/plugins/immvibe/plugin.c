@@ -20,9 +20,14 @@
  */
 
 #include <ngf/plugin.h>
+#include <ngf/timer.h>
+#include <ngf/memory.h>
+#include <ngf/wakeup.h>
+#include <glib/gstdio.h>
 #include <ImmVibe.h>
 #include <ImmVibeCore.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #define IMMVIBE_KEY                 "plugin.immvibe.data"
 #define SOUND_REPEAT_KEY            "sound.repeat"
@@ -34,30 +39,79 @@
 #define ALLOW_CUSTOM_KEY            "transform.allow_custom"
 #define SYSTEM_SOUND_PATH           "/usr/share/sounds/"
 #define LOG_CAT                     "immvibe: "
-#define POLL_TIMEOUT                500
+#define PATTERN_CACHE_SIZE_KEY      "pattern_cache_size"
+#define PATTERN_WARM_KEYS_KEY       "pattern_warm_keys"
+#define PROFILE_WARM_FILES_KEY      "profile.warm_files"
+#define DEFAULT_PATTERN_CACHE_SIZE  (256)
+#define DEFAULT_PATTERN_WARM_KEYS   PROFILE_WARM_FILES_KEY ";" \
+                                    "profile.current.ringing.alert.pattern;" \
+                                    "profile.current.sms.alert.pattern"
+/* first effect state check of the patterns without a known end, e.g.
+   ones repeated by the library */
+#define CHECK_TIMEOUT               5000
+/* the end of a pattern is checked this long after its duration */
+#define END_MARGIN                  20
+/* a pattern still playing is checked again after this, the interval
+   doubling at every check up to CHECK_TIMEOUT_MAX */
+#define CHECK_RETRY                 100
+#define CHECK_TIMEOUT_MAX           60000
 
 typedef struct _ImmvibeData
 {
     NRequest       *request;
     NSinkInterface *iface;
     guint           id;
-    gpointer        pattern;
+    GBytes         *pattern;            /* shared with the pattern cache */
+    gchar          *factory_file;       /* pattern of a factory sound, loaded in prepare_work */
+    const char     *pattern_name;       /* immvibe.filename, loaded if no factory pattern */
     gboolean        paused;
     guint           poll_id;
+    gint64          check_time;         /* monotonic time of the next check */
+    guint           check_interval;     /* to the check after the next, ms */
+    guint           remaining;          /* until the next check when paused, ms */
     gboolean        repeat_pattern;
+    gboolean        native_repeat;      /* library repeats the pattern */
     guint           idle_complete_id;
+    guint           start_id;           /* start deferred to the request start time */
 } ImmvibeData;
 
+/* Loaded IVT file, valid as long as the file is not modified */
+typedef struct _PatternEntry
+{
+    gchar          *path;
+    GBytes         *pattern;
+    gint64          mtime;
+    goffset         size;
+    guint64         stamp;              /* last use, for evicting the oldest */
+} PatternEntry;
+
 static VibeInt32    device      = VIBE_INVALID_DEVICE_HANDLE_VALUE;
 static const gchar *search_path = NULL;
 NContext* context = NULL;
 
+/* the cache is used from the worker threads preparing the requests */
+G_LOCK_DEFINE_STATIC (pattern_cache);
+static GHashTable  *pattern_cache      = NULL;     /* path -> PatternEntry */
+static gsize        pattern_cache_used = 0;
+static gsize        pattern_cache_size = DEFAULT_PATTERN_CACHE_SIZE * 1024;
+static guint64      pattern_clock      = 0;
+static gchar      **pattern_warm_keys  = NULL;
+static NMemory     *pattern_memory     = NULL;
+static NMemoryCache *pattern_memory_cache = NULL;  /* size reported from the main loop */
+
 guint vibrator_start (gpointer pattern_data, gpointer userdata);
 
 N_PLUGIN_NAME        ("immvibe")
 N_PLUGIN_VERSION     ("0.1")
 N_PLUGIN_DESCRIPTION ("Immersion vibra plugin")
 
+static gboolean pattern_check_cb (gpointer userdata);
+static void     pattern_warm_setup (void);
+static void     pattern_warm_clear (void);
+static void     pattern_cache_report (void);
+static void     pattern_cache_trim_cb (gsize target, gpointer userdata);
+static int      immvibe_sink_resume (NSinkInterface *iface, NRequest *request);
+
 static gboolean
 pattern_is_completed (gint id)
 {
@@ -73,35 +127,65 @@ pattern_is_completed (gint id)
     return TRUE;
 }
 
+static guint
+pattern_duration (VibeUInt8 *effects)
+{
+    VibeInt32 duration = 0;
+
+    if (VIBE_FAILED (ImmVibeGetIVTEffectDuration (effects, 0, &duration)) ||
+        duration <= 0 || duration == VIBE_TIME_INFINITE)
+        return 0;
+
+    return (guint) duration;
+}
+
+static void
+pattern_schedule_check (ImmvibeData *data, guint timeout)
+{
+    NTimers *timers = n_core_get_timers (n_sink_interface_get_core (data->iface));
+
+    if (data->poll_id > 0)
+        n_timers_remove (timers, data->poll_id);
+
+    data->check_time = g_get_monotonic_time () + (gint64) timeout * 1000;
+    data->poll_id = n_timers_add (timers, timeout, pattern_check_cb, data->request);
+}
+
 static gboolean
-pattern_poll_cb (gpointer userdata)
+pattern_check_cb (gpointer userdata)
 {
     ImmvibeData *data = (ImmvibeData*) n_request_get_data ((NRequest *)userdata, IMMVIBE_KEY);
 
-    if (!data->paused && pattern_is_completed (data->id)) {
-        N_DEBUG (LOG_CAT "vibration has been completed.");
+    n_wakeup_note ("immvibe.poll");
+    data->poll_id = 0;
 
-        data->poll_id = 0;
-        if (data->repeat_pattern) {
-            N_DEBUG (LOG_CAT "pattern needs to be repeated");
+    if (!pattern_is_completed (data->id)) {
+        /* still playing, e.g. repeated by the library or slowed down by
+           the device. check again, less often the longer it plays. */
+        pattern_schedule_check (data, data->check_interval);
+        data->check_interval = MIN (data->check_interval * 2, CHECK_TIMEOUT_MAX);
+        return FALSE;
+    }
 
-            if (data->id > 0)
-                ImmVibeStopPlayingEffect (device, data->id);
+    N_DEBUG (LOG_CAT "vibration has been completed.");
 
-            if (data->pattern)
-                data->id = vibrator_start (data->pattern, data->request);
+    if (data->repeat_pattern) {
+        N_DEBUG (LOG_CAT "pattern needs to be repeated");
 
-            if (!data->pattern || data->id == 0)
-                n_sink_interface_complete (data->iface, data->request);
-        }
-        else {
-            n_sink_interface_complete (data->iface, data->request);
-        }
+        if (data->id > 0)
+            ImmVibeStopPlayingEffect (device, data->id);
 
-        return FALSE;
+        if (data->pattern)
+            data->id = vibrator_start ((gpointer) g_bytes_get_data (data->pattern, NULL), data->request);
+
+        if (!data->pattern || data->id == 0)
+            n_sink_interface_complete (data->iface, data->request);
+    }
+    else {
+        n_sink_interface_complete (data->iface, data->request);
     }
 
-    return TRUE;
+    return FALSE;
 }
 
 static gboolean
@@ -124,7 +208,7 @@ vibrator_reconnect ()
 }
 
 static gpointer
-vibrator_load (const char *filename)
+vibrator_load (const char *filename, gsize *size)
 {
     FILE *fp = NULL;
     unsigned long pattern_size = 0;
@@ -147,6 +231,7 @@ vibrator_load (const char *filename)
             goto failed;
 
         fclose (fp);
+        *size = pattern_size;
 
         return (gpointer)data;
     }
@@ -165,6 +250,132 @@ failed:
     return NULL;
 }
 
+static void
+pattern_entry_free (gpointer userdata)
+{
+    PatternEntry *entry = (PatternEntry*) userdata;
+
+    pattern_cache_used -= entry->size;
+    g_bytes_unref (entry->pattern);
+    g_free (entry->path);
+    g_slice_free (PatternEntry, entry);
+}
+
+/* called with the cache locked */
+static void
+pattern_cache_evict (gsize limit)
+{
+    GHashTableIter  iter;
+    PatternEntry   *entry  = NULL;
+    PatternEntry   *oldest = NULL;
+
+    while (pattern_cache_used > limit) {
+        oldest = NULL;
+        g_hash_table_iter_init (&iter, pattern_cache);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &entry)) {
+            if (!oldest || entry->stamp < oldest->stamp)
+                oldest = entry;
+        }
+
+        if (!oldest)
+            break;
+
+        N_DEBUG (LOG_CAT "pattern %s evicted from the cache", oldest->path);
+        g_hash_table_remove (pattern_cache, oldest->path);
+    }
+}
+
+/* Returns the content of an IVT file, read from the file only if it is
+   not cached or it has been modified since. The file is read without
+   the cache locked, so other threads find their patterns meanwhile. */
+static GBytes*
+pattern_cache_get (const char *filename)
+{
+    PatternEntry *entry   = NULL;
+    GBytes       *pattern = NULL;
+    gpointer      content = NULL;
+    gsize         size    = 0;
+    GStatBuf      st;
+
+    if (filename == NULL || g_stat (filename, &st) < 0)
+        return NULL;
+
+    G_LOCK (pattern_cache);
+    entry = g_hash_table_lookup (pattern_cache, filename);
+    if (entry && entry->mtime == (gint64) st.st_mtime && entry->size == st.st_size) {
+        entry->stamp = ++pattern_clock;
+        pattern = g_bytes_ref (entry->pattern);
+    }
+    G_UNLOCK (pattern_cache);
+
+    if (pattern)
+        return pattern;
+
+    if ((content = vibrator_load (filename, &size)) == NULL)
+        return NULL;
+
+    G_LOCK (pattern_cache);
+
+    /* another thread may have loaded the same file in the meantime */
+    entry = g_hash_table_lookup (pattern_cache, filename);
+    if (entry && entry->mtime == (gint64) st.st_mtime && entry->size == st.st_size) {
+        entry->stamp = ++pattern_clock;
+        pattern = g_bytes_ref (entry->pattern);
+        g_free (content);
+        goto done;
+    }
+
+    if (entry)
+        g_hash_table_remove (pattern_cache, filename);
+
+    entry = g_slice_new0 (PatternEntry);
+    entry->path    = g_strdup (filename);
+    entry->pattern = g_bytes_new_take (content, size);
+    entry->mtime   = (gint64) st.st_mtime;
+    entry->size    = size;
+    entry->stamp   = ++pattern_clock;
+
+    /* a pattern larger than the whole cache is evicted right away, the
+       request keeps its own reference */
+    pattern_cache_used += size;
+    g_hash_table_replace (pattern_cache, entry->path, entry);
+    N_DEBUG (LOG_CAT "pattern %s cached, %" G_GSIZE_FORMAT " bytes", filename, size);
+
+    pattern = g_bytes_ref (entry->pattern);
+    pattern_cache_evict (pattern_cache_size);
+
+done:
+    G_UNLOCK (pattern_cache);
+
+    return pattern;
+}
+
+/* the cache changes in the worker threads too, the memory controller
+   is told about its size on the main loop */
+static void
+pattern_cache_report (void)
+{
+    gsize used = 0;
+
+    G_LOCK (pattern_cache);
+    used = pattern_cache_used;
+    G_UNLOCK (pattern_cache);
+
+    n_memory_cache_set_size (pattern_memory_cache, used);
+}
+
+static void
+pattern_cache_trim_cb (gsize target, gpointer userdata)
+{
+    (void) userdata;
+
+    G_LOCK (pattern_cache);
+    pattern_cache_evict (target);
+    G_UNLOCK (pattern_cache);
+
+    pattern_cache_report ();
+}
+
 static gchar*
 build_vibration_filename (const char *path, const char *source)
 {
@@ -215,15 +426,29 @@ vibrator_start (gpointer pattern_data, gpointer userdata)
     gint         id      = 0;
     VibeInt32    ret     = 0;
     gboolean     retry   = FALSE;
+    guint        duration;
 
     do {
-        ret = ImmVibePlayIVTEffect (device, effects, 0, &id);
+#ifdef VIBE_REPEAT_COUNT_INFINITE
+        /* let the library repeat the pattern without gaps */
+        data->native_repeat = data->repeat_pattern;
+        if (data->native_repeat)
+            ret = ImmVibePlayIVTEffectRepeat (device, effects, 0,
+                                              VIBE_REPEAT_COUNT_INFINITE, &id);
+        else
+#endif
+            ret = ImmVibePlayIVTEffect (device, effects, 0, &id);
 
         if (VIBE_SUCCEEDED (ret)) {
             n_sink_interface_set_resync_on_master (data->iface, data->request);
 
             N_DEBUG ("%s >> started pattern with id %d", __FUNCTION__, id);
-            data->poll_id = g_timeout_add (POLL_TIMEOUT, pattern_poll_cb, userdata);
+
+            /* check the state once the pattern should have ended, or
+               rarely if the end is not known. */
+            duration = data->native_repeat ? 0 : pattern_duration (effects);
+            data->check_interval = duration ? CHECK_RETRY : CHECK_TIMEOUT * 2;
+            pattern_schedule_check (data, duration ? duration + END_MARGIN : CHECK_TIMEOUT);
             return id;
         }
         else if (ret == VIBE_E_NOT_INITIALIZED) {
@@ -249,13 +474,23 @@ vibrator_start (gpointer pattern_data, gpointer userdata)
 static int
 immvibe_sink_initialize (NSinkInterface *iface)
 {
-    (void) iface;
     N_DEBUG (LOG_CAT "sink initialize");
     if (!vibrator_reconnect ())
         N_WARNING ("%s >> failed to connect to vibrator daemon.", __FUNCTION__);
 
     context = n_core_get_context (n_sink_interface_get_core (iface));
 
+    n_sink_interface_add_plan_key (iface, "context@profile.current.vibrating.alert.enabled", TRUE);
+    n_sink_interface_add_plan_key (iface, "immvibe.filename", FALSE);
+    n_sink_interface_add_plan_key (iface, "immvibe.filename_original", FALSE);
+
+    pattern_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+        NULL, pattern_entry_free);
+    pattern_memory = n_core_get_memory (n_sink_interface_get_core (iface));
+    pattern_memory_cache = n_memory_add_cache (pattern_memory, "immvibe.patterns",
+        N_MEMORY_PRIORITY_DEFAULT, pattern_cache_trim_cb, NULL);
+    pattern_warm_setup ();
+
     return TRUE;
 }
 
@@ -270,6 +505,12 @@ immvibe_sink_shutdown (NSinkInterface *iface)
     ImmVibeCloseDevice (device);
     device = VIBE_INVALID_DEVICE_HANDLE_VALUE;
     ImmVibeTerminate ();
+
+    pattern_warm_clear ();
+    g_hash_table_destroy (pattern_cache);
+    pattern_cache = NULL;
+    n_memory_remove_cache (pattern_memory, pattern_memory_cache);
+    pattern_memory_cache = NULL;
 }
 
 static int
@@ -309,6 +550,96 @@ factory_sound_filename (const char *filename)
     return FALSE;
 }
 
+/* pattern given either as a path or a file in the vibration path */
+static GBytes*
+pattern_load (const char *name)
+{
+    GBytes *pattern  = NULL;
+    gchar  *filename = NULL;
+
+    if ((pattern = pattern_cache_get (name)) != NULL)
+        return pattern;
+
+    filename = build_vibration_filename (search_path, name);
+    pattern = pattern_cache_get (filename);
+    g_free (filename);
+
+    return pattern;
+}
+
+static void
+pattern_warm (const char *key, const NValue *value)
+{
+    const char  *name  = n_value_get_string (value);
+    gchar      **files = NULL;
+    gchar      **file  = NULL;
+    gchar       *filename = NULL;
+    GBytes      *pattern  = NULL;
+
+    if (!name || !*name)
+        return;
+
+    if (g_str_equal (key, PROFILE_WARM_FILES_KEY)) {
+        /* the patterns looked up for the factory tones of the profile */
+        files = g_strsplit (name, ";", -1);
+        for (file = files; *file; ++file) {
+            if (!factory_sound_filename (*file))
+                continue;
+            filename = build_vibration_filename (search_path, *file);
+            if ((pattern = pattern_cache_get (filename)) != NULL)
+                g_bytes_unref (pattern);
+            g_free (filename);
+        }
+        g_strfreev (files);
+        pattern_cache_report ();
+        return;
+    }
+
+    N_DEBUG (LOG_CAT "warming pattern %s for %s", name, key);
+    if ((pattern = pattern_load (name)) != NULL)
+        g_bytes_unref (pattern);
+
+    pattern_cache_report ();
+}
+
+static void
+pattern_warm_changed_cb (NContext *context, const char *key,
+                         const NValue *old_value, const NValue *new_value,
+                         void *userdata)
+{
+    (void) context;
+    (void) old_value;
+    (void) userdata;
+
+    if (new_value)
+        pattern_warm (key, new_value);
+}
+
+static void
+pattern_warm_setup (void)
+{
+    const NValue  *value = NULL;
+    gchar        **key   = NULL;
+
+    for (key = pattern_warm_keys; key && *key; ++key) {
+        if ((value = n_context_get_value (context, *key)) != NULL)
+            pattern_warm (*key, value);
+
+        n_context_subscribe_value_change (context, *key,
+            pattern_warm_changed_cb, NULL);
+    }
+}
+
+static void
+pattern_warm_clear (void)
+{
+    gchar **key = NULL;
+
+    for (key = pattern_warm_keys; key && *key; ++key)
+        n_context_unsubscribe_value_change (context, *key,
+            pattern_warm_changed_cb);
+}
+
 static const char*
 lookup_sound_from_context (NContext *context, const char *key)
 {
@@ -325,9 +656,8 @@ static int
 immvibe_sink_prepare (NSinkInterface *iface, NRequest *request)
 {
     const NProplist *props = n_request_get_properties (request);
-    ImmvibeData *data = g_slice_new0 (ImmvibeData);
+    ImmvibeData *data = n_request_alloc (request, sizeof (ImmvibeData));
 
-    char *filename;
     const char *sound_filename, *immvibe_filename, *lookup_key,
         *custom_file, *factory_sound = NULL;
     gboolean lookup, allow_custom, sound_repeat;
@@ -346,10 +676,7 @@ immvibe_sink_prepare (NSinkInterface *iface, NRequest *request)
 
     if (custom_file && !allow_custom &&
         !g_file_test (custom_file, G_FILE_TEST_EXISTS) && !n_request_is_fallback (request))
-    {
-        g_slice_free (ImmvibeData, data);
         return FALSE;
-    }
 
     if (n_request_is_fallback (request))
         custom_file = NULL;
@@ -375,31 +702,43 @@ immvibe_sink_prepare (NSinkInterface *iface, NRequest *request)
        vibration patterns. */
 
     if (factory_sound_filename (factory_sound)) {
-        filename = build_vibration_filename (search_path, factory_sound);
-        N_DEBUG (LOG_CAT "sound is factory sound, loading pattern from: %s", filename);
-        data->pattern = vibrator_load (filename);
-        g_free (filename);
+        data->factory_file = build_vibration_filename (search_path, factory_sound);
+        N_DEBUG (LOG_CAT "sound is factory sound, loading pattern from: %s", data->factory_file);
     }
 
-    /* default case: if no pattern yet, then use immvibe.filename to load either
+    /* default case: if no factory pattern, then use immvibe.filename to load either
        absolute path or a filename that is to be searched from the vibration path. */
 
-    if (!data->pattern && immvibe_filename) {
+    data->pattern_name = immvibe_filename;
+    data->repeat_pattern = sound_repeat;
 
-        /* if repeat is set, then we need to repeat the pattern too */
-        data->repeat_pattern = sound_repeat;
+    /* the patterns are loaded in immvibe_sink_prepare_work. */
 
-        if (!(data->pattern = vibrator_load (immvibe_filename))) {
-            filename = build_vibration_filename (search_path, immvibe_filename);
-            data->pattern = vibrator_load (filename);
-            g_free (filename);
-        }
-    }
+    n_request_store_data (request, IMMVIBE_KEY, data);
 
-    /* succeed even if no data. */
+    return TRUE;
+}
 
-    n_request_store_data (request, IMMVIBE_KEY, data);
-    n_sink_interface_synchronize (iface, request);
+static int
+immvibe_sink_prepare_work (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+
+    ImmvibeData *data = (ImmvibeData*) n_request_get_data (request, IMMVIBE_KEY);
+
+    g_assert (data != NULL);
+
+    if (data->factory_file)
+        data->pattern = pattern_cache_get (data->factory_file);
+
+    /* if repeat is set, then we need to repeat the pattern given by
+       immvibe.filename too */
+    if (data->pattern)
+        data->repeat_pattern = FALSE;
+    else if (data->pattern_name)
+        data->pattern = pattern_load (data->pattern_name);
+
+    /* succeed even if no data. */
 
     return TRUE;
 }
@@ -418,33 +757,83 @@ immvibe_idle_complete_cb (gpointer userdata)
     return FALSE;
 }
 
+static void
+immvibe_start (ImmvibeData *data)
+{
+    if (data->pattern) {
+        data->id = vibrator_start ((gpointer) g_bytes_get_data (data->pattern, NULL), data->request);
+    }
+
+    if (!data->pattern || data->id == 0) {
+        data->idle_complete_id = g_idle_add_full (
+            n_request_get_source_priority (data->request, G_PRIORITY_DEFAULT_IDLE),
+            immvibe_idle_complete_cb, data, NULL);
+        return;
+    }
+
+    n_sink_interface_started (data->iface, data->request, g_get_monotonic_time ());
+}
+
+static gboolean
+immvibe_start_cb (gpointer userdata)
+{
+    ImmvibeData *data = (ImmvibeData*) userdata;
+
+    data->start_id = 0;
+    immvibe_start (data);
+
+    return FALSE;
+}
+
 static int
 immvibe_sink_play (NSinkInterface *iface, NRequest *request)
 {
     N_DEBUG (LOG_CAT "sink play");
 
-    (void) iface;
-
     ImmvibeData *data = (ImmvibeData*) n_request_get_data (request, IMMVIBE_KEY);
+    gint64       start;
+
     g_assert (data != NULL);
 
-    if (data->paused) {
-        if (data->id > 0) {
-            (void) ImmVibeResumePausedEffect (device, data->id);
-        }
+    /* the pattern was loaded in the prepare work */
+    pattern_cache_report ();
+
+    if (data->paused)
+        return immvibe_sink_resume (iface, request);
 
-        data->paused = FALSE;
+    /* start together with the other sinks of the request */
+    start = n_request_get_start_time (request);
+    if (data->pattern && start > g_get_monotonic_time ()) {
+        if (data->start_id == 0)
+            data->start_id = n_timer_run_at (start, immvibe_start_cb, data);
         return TRUE;
     }
 
-    if (data->pattern) {
-        data->id = vibrator_start (data->pattern, request);
-    }
+    immvibe_start (data);
 
-    if (!data->pattern || data->id == 0) {
-        data->idle_complete_id = g_idle_add (immvibe_idle_complete_cb, data);
+    return TRUE;
+}
+
+static int
+immvibe_sink_resume (NSinkInterface *iface, NRequest *request)
+{
+    N_DEBUG (LOG_CAT "sink resume");
+
+    ImmvibeData *data = (ImmvibeData*) n_request_get_data (request, IMMVIBE_KEY);
+    g_assert (data != NULL);
+
+    /* not started before the pause */
+    if (!data->paused)
+        return immvibe_sink_play (iface, request);
+
+    /* the effect stayed on the device, it continues where it was */
+    if (data->id > 0) {
+        (void) ImmVibeResumePausedEffect (device, data->id);
+        pattern_schedule_check (data, data->remaining);
     }
 
+    data->paused = FALSE;
+
     return TRUE;
 }
 
@@ -462,10 +851,24 @@ immvibe_sink_pause (NSinkInterface *iface, NRequest *request)
         return TRUE;
     }
 
+    /* not started yet, the next play starts it */
+    if (data->start_id > 0) {
+        g_source_remove (data->start_id);
+        data->start_id = 0;
+        return TRUE;
+    }
+
     if (data->id > 0) {
         (void) ImmVibePausePlayingEffect (device, data->id);
     }
 
+    /* the pattern does not progress while paused */
+    if (data->poll_id > 0) {
+        data->remaining = (guint) (MAX (data->check_time - g_get_monotonic_time (), 0) / 1000);
+        n_timers_remove (n_core_get_timers (n_sink_interface_get_core (iface)), data->poll_id);
+        data->poll_id = 0;
+    }
+
     data->paused = TRUE;
 
     return TRUE;
@@ -476,8 +879,6 @@ immvibe_sink_stop (NSinkInterface *iface, NRequest *request)
 {
     N_DEBUG (LOG_CAT "sink stop");
 
-    (void) iface;
-
     ImmvibeData *data = (ImmvibeData*) n_request_get_data (request, IMMVIBE_KEY);
     g_assert (data != NULL);
 
@@ -486,7 +887,7 @@ immvibe_sink_stop (NSinkInterface *iface, NRequest *request)
     }
 
     if (data->poll_id > 0) {
-        g_source_remove (data->poll_id);
+        n_timers_remove (n_core_get_timers (n_sink_interface_get_core (iface)), data->poll_id);
         data->poll_id = 0;
     }
 
@@ -495,8 +896,15 @@ immvibe_sink_stop (NSinkInterface *iface, NRequest *request)
         data->idle_complete_id = 0;
     }
 
-    g_free       (data->pattern);
-    g_slice_free (ImmvibeData, data);
+    if (data->start_id > 0) {
+        g_source_remove (data->start_id);
+        data->start_id = 0;
+    }
+
+    if (data->pattern)
+        g_bytes_unref (data->pattern);
+
+    g_free (data->factory_file);
 
     n_request_store_data (request, IMMVIBE_KEY, NULL);
 }
@@ -514,12 +922,23 @@ N_PLUGIN_LOAD (plugin)
         .prepare    = immvibe_sink_prepare,
         .play       = immvibe_sink_play,
         .pause      = immvibe_sink_pause,
-        .stop       = immvibe_sink_stop
+        .stop       = immvibe_sink_stop,
+        .prepare_work = immvibe_sink_prepare_work,
+        .resume     = immvibe_sink_resume
     };
 
+    const NProplist *params = n_plugin_get_params (plugin);
+    const char      *value  = NULL;
+
     n_plugin_register_sink (plugin, &decl);
 
-    search_path = n_proplist_get_string (n_plugin_get_params (plugin), "vibration_search_path");
+    search_path = n_proplist_get_string (params, "vibration_search_path");
+
+    if ((value = n_proplist_get_string (params, PATTERN_CACHE_SIZE_KEY)) != NULL)
+        pattern_cache_size = (gsize) atoi (value) * 1024;
+
+    value = n_proplist_get_string (params, PATTERN_WARM_KEYS_KEY);
+    pattern_warm_keys = g_strsplit (value ? value : DEFAULT_PATTERN_WARM_KEYS, ";", -1);
 
     if (search_path == NULL) {
         N_WARNING (LOG_CAT "Vibration pattern search path is missing from the configuration file");
@@ -535,4 +954,7 @@ N_PLUGIN_UNLOAD (plugin)
     (void) plugin;
 
     N_DEBUG (LOG_CAT "plugin unload");
+
+    g_strfreev (pattern_warm_keys);
+    pattern_warm_keys = NULL;
 }
@@ -29,6 +29,8 @@
 
 #define MCE_LED_PATTERN_KEY "mce.led_pattern"
 
+#define MCE_FLUSH_RETRY_MS (1000)
+
 N_PLUGIN_NAME        ("mce")
 N_PLUGIN_VERSION     ("0.1")
 N_PLUGIN_DESCRIPTION ("MCE plugin for handling backlight and led actions")
@@ -40,7 +42,20 @@ typedef struct _MceData
     gchar          *pattern;
 } MceData;
 
-static GList *active_events;
+/* LED pattern state shared by the requests using the pattern. MCE is
+   only told about a pattern when the first request activates it and the
+   last one deactivates it, changes are sent once per main loop
+   iteration. */
+typedef struct _McePattern
+{
+    gint     refs;      /* requests using the pattern */
+    gboolean active;    /* pattern state in MCE */
+} McePattern;
+
+static GList      *active_events;
+static GHashTable *patterns;
+static guint       flush_id;
+static NCore      *mce_core;
 
 static gboolean
 toggle_pattern (NCore *core, const char *pattern, gboolean activate)
@@ -71,6 +86,84 @@ toggle_pattern (NCore *core, const char *pattern, gboolean activate)
     return ret;
 }
 
+static gboolean
+flush_patterns_cb (gpointer userdata)
+{
+    GHashTableIter  iter;
+    const char     *pattern;
+    McePattern     *state;
+    gboolean        activate;
+    gboolean        failed = FALSE;
+
+    (void) userdata;
+
+    flush_id = 0;
+
+    g_hash_table_iter_init (&iter, patterns);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &pattern, (gpointer*) &state)) {
+        activate = state->refs > 0;
+
+        if (activate != state->active) {
+            /* a failed call leaves the state as it was */
+            if (toggle_pattern (mce_core, pattern, activate))
+                state->active = activate;
+            else
+                failed = TRUE;
+        }
+
+        /* kept until MCE has been told to deactivate it */
+        if (state->refs == 0 && !state->active)
+            g_hash_table_iter_remove (&iter);
+    }
+
+    /* retried later, MCE may not be on the bus yet */
+    if (failed)
+        flush_id = g_timeout_add (MCE_FLUSH_RETRY_MS, flush_patterns_cb, NULL);
+
+    return FALSE;
+}
+
+static void
+schedule_flush ()
+{
+    if (flush_id == 0)
+        flush_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE, flush_patterns_cb, NULL, NULL);
+}
+
+static void
+pattern_ref (const char *pattern)
+{
+    McePattern *state;
+
+    if (!(state = g_hash_table_lookup (patterns, pattern))) {
+        state = g_slice_new0 (McePattern);
+        g_hash_table_insert (patterns, g_strdup (pattern), state);
+    }
+
+    /* also activates again a pattern MCE has finished playing */
+    state->refs++;
+    if (!state->active)
+        schedule_flush ();
+}
+
+static void
+pattern_unref (const char *pattern)
+{
+    McePattern *state;
+
+    if (!(state = g_hash_table_lookup (patterns, pattern)) || state->refs == 0)
+        return;
+
+    if (--state->refs == 0)
+        schedule_flush ();
+}
+
+static void
+pattern_free (gpointer data)
+{
+    g_slice_free (McePattern, data);
+}
+
 static DBusHandlerResult
 mce_signal_filter (NCore *core, DBusConnection *connection, DBusMessage *msg, void *user_data)
 {
@@ -88,17 +181,30 @@ mce_signal_filter (NCore *core, DBusConnection *connection, DBusMessage *msg, vo
             N_WARNING (LOG_CAT "%s >> failed to read MCE signal arguments, cause: %s", __FUNCTION__, error.message);
             dbus_error_free(&error);
         } else {
-            GList *event;
+            GList      *event;
+            GList      *finished = NULL;
+            McePattern *state;
+
             N_DEBUG (LOG_CAT "%s >> mce finished playing %s", __FUNCTION__, pattern);
+
+            /* the pattern is off for all the requests using it */
+            if ((state = g_hash_table_lookup (patterns, pattern)))
+                state->active = FALSE;
+
             for (event = active_events; event != NULL; event = g_list_next(event)) {
                 MceData *data = (MceData *) event->data;
-                if (g_strcmp0(pattern, data->pattern) == 0) {
-                    n_sink_interface_complete(data->iface, data->request);
-                    N_DEBUG (LOG_CAT "%s >> led pattern %s complete", __FUNCTION__, data->pattern);
-                    active_events = g_list_remove_all(active_events, data);
-                    break;
-                }
+                if (g_strcmp0(pattern, data->pattern) == 0)
+                    finished = g_list_append (finished, data);
             }
+
+            for (event = finished; event != NULL; event = g_list_next(event)) {
+                MceData *data = (MceData *) event->data;
+                active_events = g_list_remove_all(active_events, data);
+                N_DEBUG (LOG_CAT "%s >> led pattern %s complete", __FUNCTION__, data->pattern);
+                n_sink_interface_complete(data->iface, data->request);
+            }
+
+            g_list_free (finished);
         }
     }
 
@@ -110,6 +216,28 @@ mce_sink_shutdown (NSinkInterface *iface)
 {
     (void) iface;
     g_list_free(active_events);
+    active_events = NULL;
+
+    if (flush_id > 0) {
+        g_source_remove (flush_id);
+        flush_id = 0;
+    }
+
+    if (patterns) {
+        g_hash_table_destroy (patterns);
+        patterns = NULL;
+    }
+}
+
+static int
+mce_sink_initialize (NSinkInterface *iface)
+{
+    n_sink_interface_add_plan_key (iface, MCE_LED_PATTERN_KEY, FALSE);
+
+    mce_core = n_sink_interface_get_core (iface);
+    patterns = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, pattern_free);
+
+    return TRUE;
 }
 
 static int
@@ -130,7 +258,7 @@ mce_sink_prepare (NSinkInterface *iface, NRequest *request)
     (void) iface;
     (void) request;
     
-    MceData *data = g_slice_new0 (MceData);
+    MceData *data = n_request_alloc (request, sizeof (MceData));
 
     data->request    = request;
     data->iface      = iface;
@@ -146,22 +274,17 @@ mce_sink_play (NSinkInterface *iface, NRequest *request)
 {
     const NProplist *props = n_request_get_properties (request);
     const gchar *pattern = NULL;
-    NCore *core;
+
+    (void) iface;
 
     MceData *data = (MceData*) n_request_get_data (request, MCE_KEY);
     g_assert (data != NULL);
 
-    core = n_sink_interface_get_core (iface);
-
     pattern = n_proplist_get_string (props, MCE_LED_PATTERN_KEY);
-    if (pattern != NULL) {
+    if (pattern != NULL && data->pattern == NULL) {
         data->pattern = g_strdup (pattern);
-        if (toggle_pattern (core, pattern, TRUE)) {
-            active_events = g_list_append(active_events, data);
-        } else {
-            g_free (data->pattern);
-            data->pattern = NULL;
-        }
+        pattern_ref (pattern);
+        active_events = g_list_append(active_events, data);
     }
 
     return TRUE;
@@ -179,21 +302,18 @@ mce_sink_pause (NSinkInterface *iface, NRequest *request)
 static void
 mce_sink_stop (NSinkInterface *iface, NRequest *request)
 {
-    NCore *core;
+    (void) iface;
 
     MceData *data = (MceData*) n_request_get_data (request, MCE_KEY);
     g_assert (data != NULL);
 
-    core = n_sink_interface_get_core (iface);
-
     if (data->pattern) {
-        toggle_pattern (core, data->pattern, FALSE);
+        pattern_unref (data->pattern);
         g_free (data->pattern);
         data->pattern = NULL;
     }
 
     active_events = g_list_remove_all(active_events, data);
-    g_slice_free (MceData, data);
 }
 
 N_PLUGIN_LOAD (plugin)
@@ -203,7 +323,7 @@ N_PLUGIN_LOAD (plugin)
     static const NSinkInterfaceDecl decl = {
         .name       = "mce",
         .type       = N_SINK_INTERFACE_TYPE_LEDS,
-        .initialize = NULL,
+        .initialize = mce_sink_initialize,
         .shutdown   = mce_sink_shutdown,
         .can_handle = mce_sink_can_handle,
         .prepare    = mce_sink_prepare,
@@ -36,6 +36,13 @@ typedef struct NullSinkData
     guint           source_id;
 } NullSinkData;
 
+static int
+null_sink_initialize (NSinkInterface *iface)
+{
+    n_sink_interface_add_plan_key (iface, NULL_KEY, FALSE);
+    return TRUE;
+}
+
 static int
 null_sink_can_handle (NSinkInterface *iface, NRequest *request)
 {
@@ -58,7 +65,7 @@ null_sink_prepare (NSinkInterface *iface, NRequest *request)
 {
     NullSinkData *data;
 
-    data          = g_slice_new0 (NullSinkData);
+    data          = n_request_alloc (request, sizeof (NullSinkData));
     data->request = request;
     data->iface   = iface;
 
@@ -92,7 +99,8 @@ null_sink_play (NSinkInterface *iface, NRequest *request)
     data = n_request_get_data (request, NULL_DATA_KEY);
     g_assert (data);
 
-    data->source_id = g_idle_add (play_cb, data);
+    data->source_id = g_idle_add_full (n_request_get_source_priority (request, G_PRIORITY_DEFAULT_IDLE),
+                                       play_cb, data, NULL);
 
     return TRUE;
 }
@@ -111,8 +119,6 @@ null_sink_stop (NSinkInterface *iface, NRequest *request)
 
     if (data->source_id > 0)
         g_source_remove (data->source_id);
-
-    g_slice_free (NullSinkData, data);
 }
 
 N_PLUGIN_LOAD (plugin)
@@ -120,7 +126,7 @@ N_PLUGIN_LOAD (plugin)
     static const NSinkInterfaceDecl decl = {
         .name       = "null",
         .type       = "null",
-        .initialize = NULL,
+        .initialize = null_sink_initialize,
         .shutdown   = NULL,
         .can_handle = null_sink_can_handle,
         .prepare    = null_sink_prepare,
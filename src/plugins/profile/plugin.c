@@ -21,9 +21,12 @@
 
 #include <profiled/libprofile.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sys/types.h>
+#include <sys/inotify.h>
 #include <dirent.h>
+#include <unistd.h>
 
 #include <dbus/dbus.h>
 
@@ -31,6 +34,8 @@
 #include <ngf/plugin.h>
 #include <ngf/event.h>
 #include <ngf/context.h>
+#include <ngf/worker.h>
+#include <ngf/filecheck.h>
 
 #define LOG_CAT                 "profile: "
 #define PROFILE_KEY_PATTERN     ".profile"
@@ -42,7 +47,19 @@
 #define VOLUME_SUFFIX           ".volume"
 #define SYSTEM_SUFFIX           ".sound.level"
 #define PATTERN_SUFFIX          ".pattern"
+#define WARM_FILES_KEY          "profile.warm_files"
 #define MAX_DEPTH               3
+#define FALLBACK_PROFILE        "fallback"
+
+#define PROFILED_DBUS_SERVICE   "com.nokia.profiled"
+#define PROFILED_DBUS_PATH      "/com/nokia/profiled"
+#define PROFILED_DBUS_INTERFACE "com.nokia.profiled"
+#define PROFILED_GET_PROFILE    "get_profile"
+#define PROFILED_GET_PROFILES   "get_profiles"
+#define PROFILED_GET_VALUES     "get_values"
+#define INDEX_REBUILD_DELAY     (500)
+#define INDEX_WATCH_MASK        (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                                 IN_DELETE_SELF | IN_MOVE_SELF)
 
 #define CLAMP_VALUE(in_v,in_min,in_max) \
     ((in_v) <= (in_min) ? (in_min) : ((in_v) >= (in_max) ? (in_max) : (in_v)))
@@ -56,8 +73,63 @@ typedef struct _ProfileEntry
     gchar  *key;
     gchar  *profile;
     gchar  *target;
+    NAtom   target_atom;
+    NAtom   context_atom;   /* atom of the context key of the value */
 } ProfileEntry;
 
+/* step of a transform plan, one for each of the request keys */
+typedef struct _ProfilePlanStep
+{
+    NAtom               key;
+    const NValue       *event_value;    /* value of the key in the event, NULL if unset */
+    const ProfileEntry *entry;          /* entry of the event value, NULL if none */
+} ProfilePlanStep;
+
+/* profile transform of an event. Which entries apply only depends on
+   the event properties, so requests only look up the context values.
+   Requests changing the key of a step fall back to the entry lookup. */
+typedef struct _ProfilePlan
+{
+    guint           num_steps;
+    ProfilePlanStep steps[];
+} ProfilePlan;
+
+typedef struct _ProfileFetch ProfileFetch;
+
+typedef struct _ProfileValues
+{
+    ProfileFetch *fetch;
+    gchar        *profile;
+    DBusMessage  *reply;    /* get_values reply, a(sss) */
+} ProfileValues;
+
+/* profile values being fetched. The calls are all sent at once and the
+   values applied together when the last reply has arrived. */
+struct _ProfileFetch
+{
+    NCore       *core;
+    GSList      *calls;             /* pending DBusPendingCalls */
+    gchar       *current;           /* current profile */
+    GList       *values;            /* ProfileValues, in request order */
+    GHashTable  *changed;           /* context keys changed while fetching */
+    gboolean     profile_changed;   /* current profile changed while fetching */
+};
+
+typedef struct _IndexEntry
+{
+    gchar  *path;
+    int     depth;  /* depth of the directory the name is relative to */
+} IndexEntry;
+
+/* index being built, rebuilds walk the directories in a worker thread
+   and the result replaces the index on the main loop. */
+typedef struct _IndexBuild
+{
+    gchar      *path;
+    GHashTable *index;
+    int         fd;     /* inotify instance watching the indexed directories */
+} IndexBuild;
+
 typedef struct _SoundLevelEntry
 {
     gchar  *key;
@@ -69,7 +141,22 @@ static DBusConnection *session_bus = NULL;
 static GList      *sound_levels            = NULL; /* contains SoundLevelEntry entries */
 static GList      *request_keys            = NULL;
 static GHashTable *profile_entries         = NULL;
+static GHashTable *transform_plans         = NULL; /* NEvent -> ProfilePlan */
+static guint       transform_generation    = 0;    /* event list generation of the plans */
 static gchar      *file_search_path        = NULL;
+static GHashTable *current_tones           = NULL; /* key -> tone path of the current profile */
+static gchar      *warm_files              = NULL;
+static ProfileFetch *current_fetch         = NULL;
+
+/* files under file_search_path, name relative to any directory up to
+   MAX_DEPTH -> IndexEntry. inotify watches the indexed directories and
+   the index is rebuilt after changes. */
+static GHashTable *file_index              = NULL;
+static int         index_fd                = -1;
+static guint       index_io_id             = 0;
+static guint       index_rebuild_id        = 0;
+static guint       index_job_id            = 0;
+static NWorkers   *index_workers           = NULL;
 
 static void          transform_properties_cb      (NHook *hook,
                                                    void *data,
@@ -82,6 +169,9 @@ static void          find_entries_within_event_cb (const char *key,
                                                    const NValue *value,
                                                    gpointer userdata);
 static void          find_profile_entries         (NCore *core);
+static ProfilePlan*  build_transform_plan         (const NEvent *event);
+static ProfilePlan*  get_transform_plan           (NCore *core,
+                                                   const NEvent *event);
 static void          value_changed_cb             (const char *profile,
                                                    const char *key,
                                                    const char *value,
@@ -89,14 +179,49 @@ static void          value_changed_cb             (const char *profile,
                                                    void *userdata);
 static void          profile_changed_cb           (const char *profile,
                                                    void *userdata);
-static void          query_current_profile        (NCore *core);
 static void          query_current_values         (NCore *core);
-static gchar*        find_file_from_path          (const char *start_path,
-                                                   const char *filename,
+static gboolean      fetch_call                   (ProfileFetch *fetch,
+                                                   const char *method,
+                                                   const char *profile,
+                                                   DBusPendingCallNotifyFunction notify,
+                                                   void *data);
+static void          fetch_done                   (ProfileFetch *fetch,
+                                                   DBusPendingCall *pending);
+static void          fetch_profile_reply_cb       (DBusPendingCall *pending,
+                                                   void *data);
+static void          fetch_profiles_reply_cb      (DBusPendingCall *pending,
+                                                   void *data);
+static void          fetch_values_reply_cb        (DBusPendingCall *pending,
+                                                   void *data);
+static void          fetch_apply_values           (ProfileFetch *fetch,
+                                                   NContext *context,
+                                                   ProfileValues *values);
+static void          fetch_apply                  (ProfileFetch *fetch);
+static void          fetch_free                   (ProfileFetch *fetch);
+static void          index_entry_free             (IndexEntry *entry);
+static void          index_add                    (GHashTable *index,
+                                                   const char *name,
+                                                   const char *path,
+                                                   int depth);
+static void          index_directory              (IndexBuild *build,
+                                                   const char *dir_path,
+                                                   const char *rel_path,
                                                    int current_depth);
+static IndexBuild*   index_build_new              ();
+static void          index_build_free             (IndexBuild *build);
+static void          index_build_run_cb           (gpointer userdata);
+static void          index_build_done_cb          (gpointer userdata);
+static void          index_install                (IndexBuild *build);
+static void          index_build                  ();
+static void          index_clear                  ();
+static gboolean      index_io_cb                  (GIOChannel *source,
+                                                   GIOCondition condition,
+                                                   gpointer userdata);
+static gboolean      index_rebuild_cb             (gpointer userdata);
 static gchar*        get_absolute_tone_path       (const char *value);
 static gchar*        construct_context_key        (const char *profile,
                                                    const char *key);
+static void          publish_warm_files           (NCore *core);
 static void          update_context_value         (NContext *context,
                                                    const char *profile,
                                                    const char *key,
@@ -104,6 +229,54 @@ static void          update_context_value         (NContext *context,
 
 
 
+static ProfilePlan*
+build_transform_plan (const NEvent *event)
+{
+    const NProplist *props = n_event_get_properties ((NEvent*) event);
+    ProfilePlan     *plan  = NULL;
+    ProfilePlanStep *step  = NULL;
+    GList           *iter  = NULL;
+
+    plan = g_malloc0 (sizeof (ProfilePlan) +
+        g_list_length (request_keys) * sizeof (ProfilePlanStep));
+
+    for (iter = g_list_first (request_keys); iter; iter = g_list_next (iter)) {
+        step = &plan->steps[plan->num_steps++];
+        step->key = n_atom_intern ((const char*) iter->data);
+        step->event_value = n_proplist_get_by_atom (props, step->key);
+
+        if (step->event_value && n_value_type ((NValue*) step->event_value) == N_VALUE_TYPE_STRING)
+            step->entry = g_hash_table_lookup (profile_entries,
+                n_value_get_string ((NValue*) step->event_value));
+    }
+
+    return plan;
+}
+
+static ProfilePlan*
+get_transform_plan (NCore *core, const NEvent *event)
+{
+    ProfilePlan *plan = NULL;
+
+    /* the plans and entries are derived from the events, pick up the
+       entries of new events when the event list has changed. */
+
+    if (transform_generation != n_core_get_events_generation (core)) {
+        transform_generation = n_core_get_events_generation (core);
+        g_hash_table_remove_all (transform_plans);
+        find_profile_entries (core);
+    }
+
+    if (!(plan = g_hash_table_lookup (transform_plans, event))) {
+        N_DEBUG (LOG_CAT "new transform plan for event '%s'",
+            n_event_get_name ((NEvent*) event));
+        plan = build_transform_plan (event);
+        g_hash_table_insert (transform_plans, (gpointer) event, plan);
+    }
+
+    return plan;
+}
+
 static void
 transform_properties_cb (NHook *hook, void *data, void *userdata)
 {
@@ -111,54 +284,70 @@ transform_properties_cb (NHook *hook, void *data, void *userdata)
     (void) data;
     (void) userdata;
 
-    NCore        *core        = (NCore*) userdata;
-    NContext     *context     = n_core_get_context (core);
-    NProplist    *new_props   = NULL;
-    NProplist    *props       = NULL;
-    GList        *iter        = NULL;
-    const char   *match_str   = NULL;
-    ProfileEntry *entry       = NULL;
-    NValue       *value       = NULL;
-    gchar        *context_key = NULL;
+    NCore              *core     = (NCore*) userdata;
+    NContext           *context  = n_core_get_context (core);
+    NProplist          *props    = NULL;
+    const NEvent       *event    = NULL;
+    ProfilePlan        *plan     = NULL;
+    ProfilePlanStep    *step     = NULL;
+    const ProfileEntry *entry    = NULL;
+    const ProfileEntry **matched = NULL;
+    const NValue      **values   = NULL;
+    NValue             *value    = NULL;
+    gboolean            fallback = FALSE;
+    guint               i;
 
     NCoreHookTransformPropertiesData *transform = (NCoreHookTransformPropertiesData*) data;
 
+    if (!request_keys || !(event = n_request_get_event (transform->request)))
+        return;
+
     N_DEBUG (LOG_CAT "transforming profile values for request '%s'",
         n_request_get_name (transform->request));
 
-    new_props = n_proplist_new ();
-    props = (NProplist*) n_request_get_properties (transform->request);
-    for (iter = g_list_first (request_keys); iter; iter = g_list_next (iter)) {
-        match_str = n_proplist_get_string (props, (gchar*) iter->data);
-        if (!match_str)
-            continue;
+    plan     = get_transform_plan (core, event);
+    props    = (NProplist*) n_request_get_properties (transform->request);
+    fallback = n_request_is_fallback (transform->request);
+    matched  = g_newa (const ProfileEntry*, plan->num_steps);
+    values   = g_newa (const NValue*, plan->num_steps);
+
+    /* the targets are checked against the properties of the request as
+       they were before the transform, the values are set afterwards. */
+
+    for (i = 0; i < plan->num_steps; i++) {
+        step = &plan->steps[i];
+        matched[i] = NULL;
+        values[i]  = NULL;
+
+        if ((value = n_proplist_get_by_atom (props, step->key)) == step->event_value)
+            entry = step->entry;
+        else if (value && n_value_type (value) == N_VALUE_TYPE_STRING)
+            entry = g_hash_table_lookup (profile_entries, n_value_get_string (value));
+        else
+            entry = NULL;
 
-        entry = g_hash_table_lookup (profile_entries, match_str);
         if (!entry)
             continue;
 
         /* if this a fallback request, we don't care if there is existing
            target. otherwise check if the target exists. */
 
-        if (!n_request_is_fallback (transform->request) &&
-             n_proplist_has_key (props, entry->target))
+        if (!fallback && n_proplist_get_by_atom (props, entry->target_atom))
             continue;
 
-        context_key = construct_context_key (entry->profile, entry->key);
-        value = (NValue*) n_context_get_value (context, context_key);
+        matched[i] = entry;
+        values[i]  = n_context_get_value_by_atom (context, entry->context_atom);
+    }
 
-        if (value) {
-            N_DEBUG (LOG_CAT "+ transforming profile key '%s' to target '%s'",
-                entry->key, entry->target);
-            n_proplist_set (new_props, entry->target, n_value_copy (value));
-        }
+    for (i = 0; i < plan->num_steps; i++) {
+        if (!values[i])
+            continue;
 
-        g_free (context_key);
+        N_DEBUG (LOG_CAT "+ transforming profile key '%s' to target '%s'",
+            matched[i]->key, matched[i]->target);
+        n_proplist_set_by_atom (props, matched[i]->target_atom, n_value_copy ((NValue*) values[i]));
     }
 
-    n_proplist_merge (props, new_props);
-    n_proplist_free (new_props);
-
     N_DEBUG (LOG_CAT "new properties:");
     n_proplist_dump (props);
 }
@@ -171,6 +360,7 @@ parse_profile_entry (const char *value)
     ProfileEntry  *entry         = NULL;
     gchar        **tokens        = NULL;
     gchar        **source_tokens = NULL;
+    gchar         *context_key   = NULL;
 
     /* split the profile key and target key */
 
@@ -199,6 +389,11 @@ parse_profile_entry (const char *value)
     entry->profile = g_strdup (source_tokens[1]);
     entry->target  = g_strdup (tokens[1]);
 
+    entry->target_atom = n_atom_intern (entry->target);
+    context_key = construct_context_key (entry->profile, entry->key);
+    entry->context_atom = n_atom_intern (context_key);
+    g_free (context_key);
+
     g_strfreev (source_tokens);
     g_strfreev (tokens);
 
@@ -289,57 +484,250 @@ find_profile_entries (NCore *core)
     }
 }
 
-static gchar*
-find_file_from_path (const char *start_path, const char *filename,
-                     int current_depth)
+static void
+index_entry_free (IndexEntry *entry)
 {
-    gchar *result_path = NULL;
-    gchar *tmp         = NULL;
+    g_free (entry->path);
+    g_slice_free (IndexEntry, entry);
+}
 
-    DIR *parent_dir;
-    struct dirent *walk;
+/* the name found from the shallowest directory wins, as it would when
+   searching the directories from the top. */
+static void
+index_add (GHashTable *index, const char *name, const char *path, int depth)
+{
+    IndexEntry *entry = NULL;
+
+    if ((entry = g_hash_table_lookup (index, name)) && entry->depth <= depth)
+        return;
+
+    entry = g_slice_new0 (IndexEntry);
+    entry->path  = g_strdup (path);
+    entry->depth = depth;
+    g_hash_table_replace (index, g_strdup (name), entry);
+}
+
+/* runs in a worker thread for the rebuilds, touches only the build. */
+static void
+index_directory (IndexBuild *build, const char *dir_path, const char *rel_path,
+                 int current_depth)
+{
+    DIR           *dir      = NULL;
+    struct dirent *walk     = NULL;
+    gchar         *path     = NULL;
+    gchar         *rel      = NULL;
+    gchar        **parts    = NULL;
+    gchar         *name     = NULL;
+    int            i;
 
     if (current_depth > MAX_DEPTH)
-        return NULL;
+        return;
 
-    if (!start_path || !filename)
-        return NULL;
+    if ((dir = opendir (dir_path)) == NULL) {
+        N_DEBUG (LOG_CAT "unable to open sound directory '%s'", dir_path);
+        return;
+    }
 
-    tmp = g_build_filename (start_path, filename, NULL);
-    if (g_file_test (tmp, G_FILE_TEST_EXISTS))
-        return tmp;
-    g_free (tmp);
+    if (build->fd >= 0 && inotify_add_watch (build->fd, dir_path, INDEX_WATCH_MASK) < 0)
+        N_WARNING (LOG_CAT "unable to watch sound directory '%s'", dir_path);
 
-    parent_dir = opendir (start_path);
-    while ((walk = readdir (parent_dir)) != NULL) {
-        if (walk->d_type & DT_DIR) {
-            if (g_str_equal (walk->d_name, ".") || g_str_equal (walk->d_name, ".."))
-                continue;
+    while ((walk = readdir (dir)) != NULL) {
+        if (g_str_equal (walk->d_name, ".") || g_str_equal (walk->d_name, ".."))
+            continue;
 
-            tmp = g_build_filename (start_path, walk->d_name, NULL);
-            result_path = find_file_from_path (tmp, filename, current_depth + 1);
-            g_free (tmp);
+        path = g_build_filename (dir_path, walk->d_name, NULL);
+        rel = rel_path ? g_build_filename (rel_path, walk->d_name, NULL)
+                       : g_strdup (walk->d_name);
 
-            if (result_path)
-                break;
+        /* the path is reachable relative to each directory above it */
+        parts = g_strsplit (rel, G_DIR_SEPARATOR_S, -1);
+        for (i = 0; parts[i]; i++) {
+            name = g_strjoinv (G_DIR_SEPARATOR_S, parts + i);
+            index_add (build->index, name, path, i);
+            g_free (name);
         }
+        g_strfreev (parts);
+
+        if (walk->d_type & DT_DIR)
+            index_directory (build, path, rel, current_depth + 1);
+
+        g_free (rel);
+        g_free (path);
+    }
+
+    closedir (dir);
+}
+
+static void
+index_clear ()
+{
+    if (index_rebuild_id > 0) {
+        g_source_remove (index_rebuild_id);
+        index_rebuild_id = 0;
     }
 
-    closedir (parent_dir);
+    if (index_io_id > 0) {
+        g_source_remove (index_io_id);
+        index_io_id = 0;
+    }
+
+    if (index_fd >= 0) {
+        close (index_fd);
+        index_fd = -1;
+    }
+
+    if (file_index) {
+        g_hash_table_destroy (file_index);
+        file_index = NULL;
+    }
+}
+
+static IndexBuild*
+index_build_new ()
+{
+    IndexBuild *build = NULL;
+
+    build = g_slice_new0 (IndexBuild);
+    build->path  = g_strdup (file_search_path);
+    build->index = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) index_entry_free);
+
+    /* a new inotify instance for each build drops the old watches. */
+
+    if ((build->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) < 0)
+        N_WARNING (LOG_CAT "unable to watch sound directories, index is not updated");
+
+    return build;
+}
+
+static void
+index_build_free (IndexBuild *build)
+{
+    if (build->fd >= 0)
+        close (build->fd);
+    if (build->index)
+        g_hash_table_destroy (build->index);
+    g_free (build->path);
+    g_slice_free (IndexBuild, build);
+}
+
+static void
+index_build_run_cb (gpointer userdata)
+{
+    IndexBuild *build = userdata;
+
+    index_directory (build, build->path, NULL, 0);
+}
+
+static void
+index_build_done_cb (gpointer userdata)
+{
+    index_job_id = 0;
+    index_install ((IndexBuild*) userdata);
+}
+
+/* the build takes the place of the current index */
+static void
+index_install (IndexBuild *build)
+{
+    GIOChannel *channel = NULL;
+
+    index_clear ();
+
+    file_index   = build->index;
+    index_fd     = build->fd;
+    build->index = NULL;
+    build->fd    = -1;
+
+    if (index_fd >= 0) {
+        channel = g_io_channel_unix_new (index_fd);
+        index_io_id = g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+            index_io_cb, NULL);
+        g_io_channel_unref (channel);
+    }
+
+    N_DEBUG (LOG_CAT "indexed %u sound files from '%s'",
+        g_hash_table_size (file_index), file_search_path);
+}
+
+/* the first index is built at load, before any request is played */
+static void
+index_build ()
+{
+    IndexBuild *build = NULL;
+
+    if (!file_search_path)
+        return;
+
+    build = index_build_new ();
+    index_build_run_cb (build);
+    index_install (build);
+    index_build_free (build);
+}
+
+static gboolean
+index_io_cb (GIOChannel *source, GIOCondition condition, gpointer userdata)
+{
+    (void) source;
+    (void) userdata;
+
+    char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+
+    if (condition & (G_IO_HUP | G_IO_ERR)) {
+        N_WARNING (LOG_CAT "sound directory watch failed, index is not updated");
+        index_io_id = 0;
+        return FALSE;
+    }
+
+    /* the events only tell that something changed, drain them and
+       rebuild once the changes have settled. */
+
+    while (read (index_fd, buf, sizeof (buf)) > 0)
+        ;
+
+    if (index_rebuild_id > 0)
+        g_source_remove (index_rebuild_id);
+    index_rebuild_id = g_timeout_add (INDEX_REBUILD_DELAY, index_rebuild_cb, NULL);
 
-    return result_path;
+    return TRUE;
+}
+
+static gboolean
+index_rebuild_cb (gpointer userdata)
+{
+    (void) userdata;
+
+    index_rebuild_id = 0;
+    N_DEBUG (LOG_CAT "sound directories changed, rebuilding index");
+
+    /* the index in use stays until the new one is ready, changes during
+       the build are seen by both and schedule another build. */
+    if (index_job_id > 0)
+        n_workers_cancel (index_workers, index_job_id);
+
+    index_job_id = n_workers_submit (index_workers, index_build_run_cb,
+        index_build_done_cb, index_build_new (), (GDestroyNotify) index_build_free);
+
+    return FALSE;
 }
 
 static gchar*
 get_absolute_tone_path (const char *value)
 {
+    IndexEntry *entry = NULL;
+
     if (!file_search_path || !value)
         return g_strdup (value);
 
-    if (g_file_test (value, G_FILE_TEST_EXISTS))
+    /* absolute paths are used as they are, a missing file is not
+       resolved anyway and checking it would block on the storage. */
+    if (g_path_is_absolute (value))
         return g_strdup (value);
 
-    return find_file_from_path (file_search_path, value, 0);
+    if (file_index && (entry = g_hash_table_lookup (file_index, value)))
+        return g_strdup (entry->path);
+
+    return NULL;
 }
 
 static gchar*
@@ -369,6 +757,8 @@ update_context_value (NContext *context, const char *profile, const char *key,
         new_val = get_absolute_tone_path (value);
         new_val = new_val != NULL ? new_val : g_strdup (value);
         n_value_set_string (context_val, new_val);
+        if (!profile && g_str_has_suffix (key, TONE_SUFFIX) && new_val)
+            g_hash_table_replace (current_tones, g_strdup (key), g_strdup (new_val));
         g_free (new_val);
     }
     else if (g_str_has_suffix (key, VOLUME_SUFFIX)) {
@@ -396,6 +786,55 @@ update_context_value (NContext *context, const char *profile, const char *key,
     g_free (context_key);
 }
 
+static gint
+compare_strings (gconstpointer a, gconstpointer b)
+{
+    return strcmp ((const char*) a, (const char*) b);
+}
+
+static void
+publish_warm_files (NCore *core)
+{
+    NContext *context = n_core_get_context (core);
+    GString  *list    = NULL;
+    GList    *tones   = NULL;
+    GList    *iter    = NULL;
+    NValue   *value   = NULL;
+
+    /* the sound sinks warm the tones of the current profile into the
+       page cache, publish them as one sorted list without duplicates. */
+
+    tones = g_list_sort (g_hash_table_get_values (current_tones), compare_strings);
+    list = g_string_new (NULL);
+
+    for (iter = g_list_first (tones); iter; iter = g_list_next (iter)) {
+        if (*((const char*) iter->data) == '\0')
+            continue;
+        if (iter->prev && g_str_equal (iter->data, iter->prev->data))
+            continue;
+        if (list->len > 0)
+            g_string_append_c (list, ';');
+        g_string_append (list, iter->data);
+
+        /* have the new tone checked before it is first played. */
+        (void) n_core_check_file (core, (const char*) iter->data);
+    }
+
+    g_list_free (tones);
+
+    if (warm_files && g_str_equal (warm_files, list->str)) {
+        g_string_free (list, TRUE);
+        return;
+    }
+
+    g_free (warm_files);
+    warm_files = g_string_free (list, FALSE);
+
+    value = n_value_new ();
+    n_value_set_string (value, warm_files);
+    n_context_set_value (context, WARM_FILES_KEY, value);
+}
+
 static void
 value_changed_cb (const char *profile,
                   const char *key,
@@ -409,6 +848,13 @@ value_changed_cb (const char *profile,
     NContext   *context   = n_core_get_context (core);
     const char *current   = NULL;
 
+    /* the fetched value of the key is older than this one. */
+    if (current_fetch)
+        g_hash_table_add (current_fetch->changed, construct_context_key (profile, key));
+
+    /* profile and current profile values change together. */
+    n_context_begin (context);
+
     update_context_value (context, profile, key, value);
 
     /* update current profile value if necessary */
@@ -417,6 +863,10 @@ value_changed_cb (const char *profile,
         CURRENT_PROFILE_KEY));
     if (current && g_str_equal (current, profile))
         update_context_value (context, NULL, key, value);
+
+    n_context_commit (context);
+
+    publish_warm_files (core);
 }
 
 static void
@@ -430,6 +880,9 @@ profile_changed_cb (const char *profile,
     NContext *context = n_core_get_context (core);
     NValue   *value   = NULL;
 
+    if (current_fetch)
+        current_fetch->profile_changed = TRUE;
+
     /* store the current profile to the context */
 
     value = n_value_new ();
@@ -438,62 +891,259 @@ profile_changed_cb (const char *profile,
     N_DEBUG (LOG_CAT "current profile changed to '%s'", profile);
 }
 
+static gboolean
+fetch_call (ProfileFetch *fetch, const char *method, const char *profile,
+            DBusPendingCallNotifyFunction notify, void *data)
+{
+    DBusMessage     *msg     = NULL;
+    DBusPendingCall *pending = NULL;
+    gboolean         success = FALSE;
+
+    msg = dbus_message_new_method_call (PROFILED_DBUS_SERVICE, PROFILED_DBUS_PATH,
+        PROFILED_DBUS_INTERFACE, method);
+    if (!msg)
+        goto done;
+
+    if (profile && !dbus_message_append_args (msg, DBUS_TYPE_STRING, &profile,
+                                              DBUS_TYPE_INVALID))
+        goto done;
+
+    if (!dbus_connection_send_with_reply (session_bus, msg, &pending,
+                                          DBUS_TIMEOUT_USE_DEFAULT) || !pending)
+        goto done;
+
+    if (!dbus_pending_call_set_notify (pending, notify, data, NULL)) {
+        dbus_pending_call_cancel (pending);
+        dbus_pending_call_unref (pending);
+        goto done;
+    }
+
+    fetch->calls = g_slist_prepend (fetch->calls, pending);
+    success = TRUE;
+
+done:
+    if (!success)
+        N_WARNING (LOG_CAT "failed to call profiled %s", method);
+
+    if (msg)
+        dbus_message_unref (msg);
+
+    return success;
+}
+
+/* called when a reply has been handled, the values are applied once all
+   the replies are in. */
 static void
-query_current_profile (NCore *core)
+fetch_done (ProfileFetch *fetch, DBusPendingCall *pending)
 {
-    NContext   *context = n_core_get_context (core);
-    NValue     *value   = NULL;
-    char       *profile = NULL;
+    if (pending) {
+        fetch->calls = g_slist_remove (fetch->calls, pending);
+        dbus_pending_call_unref (pending);
+    }
 
-    profile = profile_get_profile ();
+    if (fetch->calls)
+        return;
 
-    /* store the current profile to the context */
+    fetch_apply (fetch);
 
-    value = n_value_new ();
-    n_value_set_string (value, profile);
-    n_context_set_value (context, "profile.current_profile", value);
-    N_DEBUG (LOG_CAT "current profile set to '%s'", profile);
+    if (current_fetch == fetch)
+        current_fetch = NULL;
+    fetch_free (fetch);
+}
 
-    free (profile);
+static void
+fetch_profile_reply_cb (DBusPendingCall *pending, void *data)
+{
+    ProfileFetch *fetch   = (ProfileFetch*) data;
+    DBusMessage  *reply   = NULL;
+    const char   *profile = NULL;
+
+    if ((reply = dbus_pending_call_steal_reply (pending))) {
+        if (dbus_message_get_args (reply, NULL, DBUS_TYPE_STRING, &profile,
+                                   DBUS_TYPE_INVALID))
+            fetch->current = g_strdup (profile);
+        else
+            N_WARNING (LOG_CAT "failed to get the current profile");
+        dbus_message_unref (reply);
+    }
+
+    fetch_done (fetch, pending);
 }
 
 static void
-query_current_values (NCore *core)
+fetch_profiles_reply_cb (DBusPendingCall *pending, void *data)
 {
-    NContext      *context     = n_core_get_context (core);
-    char         **profiles    = NULL;
-    char         **p           = NULL;
-    const char    *current     = NULL;
-    profileval_t  *values      = NULL;
-    profileval_t  *v           = NULL;
-    gboolean       is_current  = FALSE;
-
-    profiles = profile_get_profiles ();
-    current  = n_value_get_string ((NValue*) n_context_get_value (context,
-        "profile.current_profile"));
-
-    for (p = profiles; *p; ++p) {
-        is_current = current && g_str_equal (current, *p);
-        values = profile_get_values (*p);
-        for (v = values; v->pv_key; ++v) {
-            update_context_value (context, *p, v->pv_key, v->pv_val);
+    ProfileFetch  *fetch    = (ProfileFetch*) data;
+    DBusMessage   *reply    = NULL;
+    char         **profiles = NULL;
+    int            count    = 0;
+    int            i;
+    ProfileValues *values   = NULL;
+
+    if ((reply = dbus_pending_call_steal_reply (pending))) {
+        if (!dbus_message_get_args (reply, NULL, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING,
+                                    &profiles, &count, DBUS_TYPE_INVALID))
+            N_WARNING (LOG_CAT "failed to get the profiles");
+        dbus_message_unref (reply);
+    }
+
+    /* This is in a way a bug, since profiled doesn't expose fallback settings ever,
+     * but, when requesting non-existing profile, get_values returns
+     * fallback profile contents. */
+
+    for (i = 0; i <= count; i++) {
+        values = g_slice_new0 (ProfileValues);
+        values->fetch   = fetch;
+        values->profile = g_strdup (i < count ? profiles[i] : FALLBACK_PROFILE);
+        fetch->values = g_list_append (fetch->values, values);
+
+        (void) fetch_call (fetch, PROFILED_GET_VALUES, values->profile,
+                           fetch_values_reply_cb, values);
+    }
+
+    if (profiles)
+        dbus_free_string_array (profiles);
+
+    fetch_done (fetch, pending);
+}
+
+static void
+fetch_values_reply_cb (DBusPendingCall *pending, void *data)
+{
+    ProfileValues *values = (ProfileValues*) data;
+
+    values->reply = dbus_pending_call_steal_reply (pending);
+    fetch_done (values->fetch, pending);
+}
+
+static void
+fetch_apply_values (ProfileFetch *fetch, NContext *context, ProfileValues *values)
+{
+    DBusMessageIter  iter;
+    DBusMessageIter  array;
+    DBusMessageIter  entry;
+    const char      *current    = NULL;
+    const char      *key        = NULL;
+    const char      *value      = NULL;
+    gchar           *context_key = NULL;
+    gboolean         is_current = FALSE;
+
+    if (!values->reply || dbus_message_get_type (values->reply) != DBUS_MESSAGE_TYPE_METHOD_RETURN) {
+        N_WARNING (LOG_CAT "failed to get values of profile '%s'", values->profile);
+        return;
+    }
+
+    if (!dbus_message_iter_init (values->reply, &iter) ||
+        dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_ARRAY)
+        return;
+
+    /* the current profile set in this transaction is not committed yet,
+       the committed one is only valid if it changed while fetching. */
+    if (fetch->profile_changed)
+        current = n_value_get_string ((NValue*) n_context_get_value (context,
+            CURRENT_PROFILE_KEY));
+    else
+        current = fetch->current;
+    is_current = current && g_str_equal (current, values->profile);
+
+    dbus_message_iter_recurse (&iter, &array);
+    while (dbus_message_iter_get_arg_type (&array) == DBUS_TYPE_STRUCT) {
+        dbus_message_iter_recurse (&array, &entry);
+        dbus_message_iter_get_basic (&entry, &key);
+        dbus_message_iter_next (&entry);
+        dbus_message_iter_get_basic (&entry, &value);
+        dbus_message_iter_next (&array);
+
+        context_key = construct_context_key (values->profile, key);
+        if (!g_hash_table_contains (fetch->changed, context_key)) {
+            update_context_value (context, values->profile, key, value);
             if (is_current)
-                update_context_value (context, NULL, v->pv_key, v->pv_val);
+                update_context_value (context, NULL, key, value);
         }
-        profile_free_values (values);
+        g_free (context_key);
     }
+}
 
-    /* fallbacks */
+static void
+fetch_apply (ProfileFetch *fetch)
+{
+    NContext *context = n_core_get_context (fetch->core);
+    NValue   *value   = NULL;
+    GList    *iter    = NULL;
 
-    /* This is in a way a bug, since profiled doesn't expose fallback settings ever,
-     * but, when requesting non-existing profile, profile_get_values() returns
-     * fallback profile contents. */
-    values = profile_get_values ("fallback");
-    for (v = values; v->pv_key; ++v)
-        update_context_value (context, "fallback", v->pv_key, v->pv_val);
-    profile_free_values (values);
+    /* apply all the profile values at once. */
+    n_context_begin (context);
+
+    /* store the current profile to the context, unless it has changed
+       meanwhile */
+
+    if (fetch->current && !fetch->profile_changed) {
+        value = n_value_new ();
+        n_value_set_string (value, fetch->current);
+        n_context_set_value (context, CURRENT_PROFILE_KEY, value);
+        N_DEBUG (LOG_CAT "current profile set to '%s'", fetch->current);
+    }
 
-    profile_free_profiles (profiles);
+    for (iter = g_list_first (fetch->values); iter; iter = g_list_next (iter))
+        fetch_apply_values (fetch, context, (ProfileValues*) iter->data);
+
+    n_context_commit (context);
+
+    publish_warm_files (fetch->core);
+}
+
+static void
+profile_values_free (ProfileValues *values)
+{
+    if (values->reply)
+        dbus_message_unref (values->reply);
+    g_free (values->profile);
+    g_slice_free (ProfileValues, values);
+}
+
+static void
+fetch_free (ProfileFetch *fetch)
+{
+    GSList *iter = NULL;
+
+    for (iter = fetch->calls; iter; iter = g_slist_next (iter)) {
+        dbus_pending_call_cancel ((DBusPendingCall*) iter->data);
+        dbus_pending_call_unref ((DBusPendingCall*) iter->data);
+    }
+    g_slist_free (fetch->calls);
+
+    g_list_free_full (fetch->values, (GDestroyNotify) profile_values_free);
+    g_hash_table_destroy (fetch->changed);
+    g_free (fetch->current);
+    g_free (fetch);
+}
+
+/* fetches the current profile and the values of all the profiles
+   without blocking. The profiles are needed for the values, the rest
+   of the calls are pipelined. */
+static void
+query_current_values (NCore *core)
+{
+    ProfileFetch *fetch = NULL;
+
+    if (current_fetch) {
+        fetch_free (current_fetch);
+        current_fetch = NULL;
+    }
+
+    fetch = g_new0 (ProfileFetch, 1);
+    fetch->core    = core;
+    fetch->changed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    (void) fetch_call (fetch, PROFILED_GET_PROFILE, NULL, fetch_profile_reply_cb, fetch);
+    (void) fetch_call (fetch, PROFILED_GET_PROFILES, NULL, fetch_profiles_reply_cb, fetch);
+
+    if (!fetch->calls) {
+        fetch_free (fetch);
+        return;
+    }
+
+    current_fetch = fetch;
 }
 
 static void
@@ -571,7 +1221,6 @@ setup_session_bus_connection (NCore *core)
     N_DEBUG (LOG_CAT "Connected to DBus session bus.");
     profile_connection_set (session_bus);
 
-    query_current_profile (core);
     query_current_values (core);
 
     return TRUE;
@@ -584,11 +1233,16 @@ N_PLUGIN_LOAD (plugin)
 
     profile_entries = g_hash_table_new_full (g_str_hash, g_str_equal,
         g_free, (GDestroyNotify) free_entry);
+    transform_plans = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, g_free);
+    current_tones = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, g_free);
 
     /* find all profile key entries within events. */
 
     core = n_plugin_get_core (plugin);
     find_profile_entries (core);
+    transform_generation = n_core_get_events_generation (core);
 
     /* connect to the transform properties hook. */
 
@@ -603,6 +1257,8 @@ N_PLUGIN_LOAD (plugin)
     setup_sound_levels (params);
 
     file_search_path = g_strdup (n_proplist_get_string (params, "search-path"));
+    index_workers = n_core_get_workers (core);
+    index_build ();
 
     /* setup the profile client */
 
@@ -637,10 +1293,24 @@ N_PLUGIN_UNLOAD (plugin)
 
     profile_tracker_quit ();
 
+    if (current_fetch) {
+        fetch_free (current_fetch);
+        current_fetch = NULL;
+    }
+
+    if (index_job_id > 0) {
+        n_workers_cancel (index_workers, index_job_id);
+        index_job_id = 0;
+    }
+
+    index_clear          ();
     g_free               (file_search_path);
     g_list_free_full     (sound_levels, sound_levels_free_cb);
+    g_hash_table_destroy (transform_plans);
     g_hash_table_destroy (profile_entries);
+    g_hash_table_destroy (current_tones);
     g_list_free_full     (request_keys, g_free);
+    g_free               (warm_files);
 
     (void) plugin;
 }
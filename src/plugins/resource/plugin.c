@@ -53,16 +53,24 @@ N_PLUGIN_VERSION     ("0.3")
 N_PLUGIN_DESCRIPTION ("Resource rules")
 
 #define RESOURCE_KEY_PREFIX "media."
+#define MAX_SINKS           (64)
 
 struct resource_def {
     char       *key;
     char       *type;
     gboolean    enabled_default;
-    gboolean    enabled;
+    NAtom       atom;
+    guint64     sink_mask;  /* bits of the sinks of the type */
 };
 
 static GSList *def_list;
 
+/* sink masks are by index in the core sink array, they are resolved again
+   if the sinks change. */
+static NSinkInterface **mask_sinks;
+static guint            mask_sink_count;
+static guint64          default_disabled_mask;
+
 static void
 lookup_types_from_keys (const char *key, const NValue *value, gpointer userdata)
 {
@@ -80,6 +88,7 @@ lookup_types_from_keys (const char *key, const NValue *value, gpointer userdata)
 
     resdef          = g_new0 (struct resource_def, 1);
     resdef->key     = g_strdup (key);
+    resdef->atom    = n_atom_intern (key);
     resdef->type    = g_strdup (key + strlen (RESOURCE_KEY_PREFIX));
 
     value_str = n_value_get_string (value);
@@ -104,14 +113,50 @@ resource_def_free_cb (gpointer data)
     g_free (resdef);
 }
 
+static void
+resolve_sink_masks (NSinkInterface **sinks)
+{
+    NSinkInterface      **sink;
+    GSList               *i;
+    struct resource_def  *resdef;
+    guint                 index;
+
+    default_disabled_mask = 0;
+
+    for (i = def_list; i; i = g_slist_next (i)) {
+        resdef = i->data;
+        resdef->sink_mask = 0;
+
+        for (sink = sinks, index = 0; *sink; ++sink, ++index) {
+            if (!g_str_equal (n_sink_interface_get_type (*sink), resdef->type))
+                continue;
+
+            if (index >= MAX_SINKS) {
+                N_WARNING (LOG_CAT "too many sinks, sink '%s' is not filtered",
+                                   n_sink_interface_get_name (*sink));
+                continue;
+            }
+
+            resdef->sink_mask |= G_GUINT64_CONSTANT (1) << index;
+        }
+
+        if (!resdef->enabled_default)
+            default_disabled_mask |= resdef->sink_mask;
+    }
+}
+
 static void
 filter_sinks_cb (NHook *hook, void *data, void *userdata)
 {
     const NProplist          *props;
+    NSinkInterface          **sinks;
     NSinkInterface          **sink;
     GSList                   *i;
     struct resource_def      *resdef;
-    gboolean                  apply_filter = FALSE;
+    const NValue             *value;
+    guint64                   disabled     = 0;
+    guint                     count        = 0;
+    guint                     index;
     NCore                    *core         = userdata;
     NCoreHookFilterSinksData *filter       = data;
 
@@ -120,42 +165,49 @@ filter_sinks_cb (NHook *hook, void *data, void *userdata)
     if (!def_list)
         return;
 
-    N_DEBUG (LOG_CAT "filter sinks for request '%s'",
-                     n_request_get_name (filter->request));
+    sinks = n_core_get_sinks (core);
+    for (sink = sinks; sink && *sink; ++sink)
+        count++;
+
+    if (sinks != mask_sinks || count != mask_sink_count) {
+        resolve_sink_masks (sinks);
+        mask_sinks      = sinks;
+        mask_sink_count = count;
+    }
 
     props = n_request_get_properties (filter->request);
 
+    /* the sinks of the resource types disabled by the request, or by
+       default unless the request enables them. */
+
+    disabled = default_disabled_mask;
     for (i = def_list; i; i = g_slist_next (i)) {
         resdef = i->data;
-        resdef->enabled = resdef->enabled_default;
 
-        if (n_proplist_has_key (props, resdef->key))
-            resdef->enabled = n_proplist_get_bool (props, resdef->key);
+        if (!(value = n_proplist_get_by_atom (props, resdef->atom)))
+            continue;
 
-        if (!resdef->enabled)
-            apply_filter = TRUE;
-
-        N_DEBUG (LOG_CAT "resource type '%s' %s",
-                         resdef->type,
-                         resdef->enabled ? "enabled" : "disabled");
+        if (n_value_type ((NValue*) value) == N_VALUE_TYPE_BOOL &&
+            n_value_get_bool ((NValue*) value))
+            disabled &= ~resdef->sink_mask;
+        else
+            disabled |= resdef->sink_mask;
     }
 
-    if (apply_filter) {
-        for (i = def_list; i; i = g_slist_next (i)) {
-            resdef = i->data;
+    if (!disabled)
+        return;
+
+    N_DEBUG (LOG_CAT "filter sinks for request '%s'",
+                     n_request_get_name (filter->request));
 
-            if (resdef->enabled)
-                continue;
+    for (sink = sinks, index = 0; *sink && index < MAX_SINKS; ++sink, ++index) {
+        if (!(disabled & (G_GUINT64_CONSTANT (1) << index)))
+            continue;
 
-            for (sink = n_core_get_sinks (core); *sink; ++sink) {
-                if (g_str_equal (n_sink_interface_get_type (*sink), resdef->type)) {
-                    N_DEBUG (LOG_CAT "filter sink '%s' (%s = false)",
-                                     n_sink_interface_get_name (*sink),
-                                     resdef->key);
-                    filter->sinks = g_list_remove (filter->sinks, *sink);
-                }
-            }
-        }
+        N_DEBUG (LOG_CAT "filter sink '%s' (%s disabled)",
+                         n_sink_interface_get_name (*sink),
+                         n_sink_interface_get_type (*sink));
+        filter->sinks = g_list_remove (filter->sinks, *sink);
     }
 }
 
@@ -163,6 +215,7 @@ N_PLUGIN_LOAD (plugin)
 {
     NCore           *core;
     const NProplist *params;
+    GSList          *i;
     def_list = NULL;
 
     core    = n_plugin_get_core (plugin);
@@ -176,6 +229,12 @@ N_PLUGIN_LOAD (plugin)
         return FALSE;
     }
 
+    /* the filter only depends on the resource flags of the request. */
+
+    for (i = def_list; i; i = g_slist_next (i))
+        n_core_add_sink_plan_key (core, filter_sinks_cb, core,
+            ((struct resource_def*) i->data)->key, TRUE);
+
     /* connect to filter sinks hook. */
 
     (void) n_core_connect (core, N_CORE_HOOK_FILTER_SINKS, 0,
@@ -192,4 +251,7 @@ N_PLUGIN_UNLOAD (plugin)
 
     if (def_list)
         g_slist_free_full (def_list, resource_def_free_cb);
+    def_list        = NULL;
+    mask_sinks      = NULL;
+    mask_sink_count = 0;
 }
@@ -34,15 +34,14 @@ N_PLUGIN_DESCRIPTION ("Audio route tracking plugin")
 static void
 update_context (NContext *context, guint output_type)
 {
-    NValue *v;
-
-    v = n_value_new ();
-    n_value_set_uint (v, output_type);
-    n_context_set_value (context, CONTEXT_ROUTE_OUTPUT_TYPE_KEY, v);
-
-    v = n_value_new ();
-    n_value_set_string (v, output_type & OHM_EXT_ROUTE_TYPE_BUILTIN ? "builtin" : "external");
-    n_context_set_value (context, CONTEXT_ROUTE_OUTPUT_CLASS_KEY, v);
+    /* both keys describe the same route, subscribers see one change. */
+    n_context_begin (context);
+    (void) n_context_set_uint_if_changed (context, CONTEXT_ROUTE_OUTPUT_TYPE_KEY,
+                                          output_type);
+    (void) n_context_set_string_if_changed (context, CONTEXT_ROUTE_OUTPUT_CLASS_KEY,
+                                            output_type & OHM_EXT_ROUTE_TYPE_BUILTIN ?
+                                            "builtin" : "external");
+    n_context_commit (context);
 }
 
 static void
@@ -105,6 +104,10 @@ N_PLUGIN_LOAD (plugin)
     context = n_core_get_context (core);
     g_assert (context);
 
+    /* last known route until the active routes query is answered. */
+    (void) n_context_restore_value (context, CONTEXT_ROUTE_OUTPUT_TYPE_KEY);
+    (void) n_context_restore_value (context, CONTEXT_ROUTE_OUTPUT_CLASS_KEY);
+
     if (n_dbus_add_match (core, filter_cb, context,
                           DBUS_BUS_SYSTEM,
                           OHM_EXT_ROUTE_MANAGER_INTERFACE,
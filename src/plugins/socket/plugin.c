@@ -0,0 +1,791 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Input interface over a SOCK_SEQPACKET Unix socket, for system
+ * components that want to skip the D-Bus daemon hop. Peers are
+ * authenticated with SO_PEERCRED. The wire format is described in
+ * protocol.h. */
+
+#define _GNU_SOURCE
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include <ngf/log.h>
+#include <ngf/value.h>
+#include <ngf/proplist.h>
+#include <ngf/plugin.h>
+#include <ngf/request.h>
+#include <ngf/event.h>
+#include <ngf/inputinterface.h>
+
+#include "protocol.h"
+
+N_PLUGIN_NAME        ("socket")
+N_PLUGIN_VERSION     ("0.1")
+N_PLUGIN_DESCRIPTION ("Unix socket interface")
+
+#define LOG_CAT "socket: "
+
+#define SOCKET_PATH             "path"
+#define SOCKET_ALLOW_UID        "allow_uid"
+#define SOCKET_ALLOW_GID        "allow_gid"
+#define SOCKET_REQUEST_LIMIT    "request_limit"
+#define SOCKET_CLIENT_LIMIT     "client_limit"
+#define DEFAULT_SOCKET_NAME     "ngfd-socket"
+#define DEFAULT_REQUEST_LIMIT   (16)
+#define DEFAULT_CLIENT_LIMIT    (16)
+
+/* from ngf/core-player.h */
+#define N_SOCKET_EVENT_FAILED       (0)
+#define N_SOCKET_EVENT_COMPLETED    (1)
+
+typedef struct _SocketData
+{
+    NInputInterface *iface;
+    int              fd;            /* listening socket */
+    guint            watch;
+    GList           *clients;       /* connected SocketClients */
+    guint            client_count;
+    GHashTable      *requests;      /* request id -> owning SocketClient */
+} SocketData;
+
+typedef struct _SocketClient
+{
+    guint        ref;
+    SocketData  *data;
+    int          fd;                /* -1 once disconnected */
+    guint        watch;
+    uid_t        uid;
+    pid_t        pid;
+    guint        active_requests;
+    GList       *requests;          /* ids of the active requests */
+} SocketClient;
+
+typedef struct _SocketReader
+{
+    const guint8 *pos;
+    const guint8 *end;
+} SocketReader;
+
+static gchar    *socket_path;
+static GArray   *socket_allow_uids;     /* guint32 */
+static GArray   *socket_allow_gids;     /* guint32 */
+static guint     socket_max_requests;
+static guint     socket_max_clients;
+
+static int       socket_initialize   (NInputInterface *iface);
+static void      socket_shutdown     (NInputInterface *iface);
+static void      socket_send_error   (NInputInterface *iface, NRequest *request,
+                                      const char *err_msg);
+static void      socket_send_reply   (NInputInterface *iface, NRequest *request,
+                                      int code);
+static gboolean  socket_client_cb    (gint fd, GIOCondition condition,
+                                      gpointer userdata);
+static void      client_disconnect   (SocketClient *client);
+
+static gboolean
+reader_u8 (SocketReader *reader, guint8 *value)
+{
+    if (reader->end - reader->pos < 1)
+        return FALSE;
+
+    *value = *reader->pos++;
+    return TRUE;
+}
+
+static gboolean
+reader_u32 (SocketReader *reader, guint32 *value)
+{
+    if (reader->end - reader->pos < (gssize) sizeof (*value))
+        return FALSE;
+
+    memcpy (value, reader->pos, sizeof (*value));
+    reader->pos += sizeof (*value);
+    return TRUE;
+}
+
+static const char*
+reader_string (SocketReader *reader)
+{
+    const guint8 *nul = NULL;
+    const char   *str = NULL;
+
+    if (!(nul = memchr (reader->pos, '\0', reader->end - reader->pos)))
+        return NULL;
+
+    str = (const char*) reader->pos;
+    reader->pos = nul + 1;
+    return str;
+}
+
+/* reads an atom, or the inline name following a 0 atom. unknown atoms
+   fail the read. */
+static gboolean
+reader_name (SocketReader *reader, NAtom *atom, const char **name)
+{
+    guint32 value = 0;
+
+    if (!reader_u32 (reader, &value))
+        return FALSE;
+
+    if (value == 0) {
+        *atom = 0;
+        *name = reader_string (reader);
+    } else {
+        *atom = (NAtom) value;
+        *name = n_atom_to_string (*atom);
+    }
+
+    return *name != NULL;
+}
+
+static gboolean
+reader_value (SocketReader *reader, guint8 type, NValue **value)
+{
+    const char *str_value = NULL;
+    guint32     num_value = 0;
+    guint8      bool_value = 0;
+
+    *value = NULL;
+
+    switch (type) {
+        case N_SOCKET_TYPE_STRING:
+            if (!(str_value = reader_string (reader)))
+                return FALSE;
+            *value = n_value_new ();
+            n_value_set_string (*value, str_value);
+            break;
+
+        case N_SOCKET_TYPE_INT:
+            if (!reader_u32 (reader, &num_value))
+                return FALSE;
+            *value = n_value_new ();
+            n_value_set_int (*value, (gint32) num_value);
+            break;
+
+        case N_SOCKET_TYPE_UINT:
+            if (!reader_u32 (reader, &num_value))
+                return FALSE;
+            *value = n_value_new ();
+            n_value_set_uint (*value, num_value);
+            break;
+
+        case N_SOCKET_TYPE_BOOL:
+            if (!reader_u8 (reader, &bool_value))
+                return FALSE;
+            *value = n_value_new ();
+            n_value_set_bool (*value, bool_value ? TRUE : FALSE);
+            break;
+
+        default:
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static SocketClient*
+client_new (SocketData *data, int fd, const struct ucred *cred)
+{
+    SocketClient *client = NULL;
+
+    client = g_new0 (SocketClient, 1);
+    client->ref  = 1;
+    client->data = data;
+    client->fd   = fd;
+    client->uid  = cred->uid;
+    client->pid  = cred->pid;
+    client->watch = g_unix_fd_add (fd, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                   socket_client_cb, client);
+
+    data->clients = g_list_prepend (data->clients, client);
+    data->client_count++;
+
+    N_DEBUG (LOG_CAT ">> new client pid %d uid %d", (int) client->pid,
+        (int) client->uid);
+
+    return client;
+}
+
+static SocketClient*
+client_ref (SocketClient *client)
+{
+    client->ref++;
+    return client;
+}
+
+static void
+client_unref (SocketClient *client)
+{
+    g_assert (client->ref > 0);
+
+    if (--client->ref > 0)
+        return;
+
+    g_list_free (client->requests);
+    g_free (client);
+}
+
+static void
+client_send (SocketClient *client, guint8 type, guint32 id,
+             const void *payload, gsize size)
+{
+    guint8         buffer[N_SOCKET_MAX_PACKET];
+    NSocketHeader  header;
+
+    if (client->fd < 0)
+        return;
+
+    if (size > sizeof (buffer) - sizeof (header))
+        size = sizeof (buffer) - sizeof (header);
+
+    memset (&header, 0, sizeof (header));
+    header.type = type;
+    header.id   = id;
+    memcpy (buffer, &header, sizeof (header));
+    if (size > 0)
+        memcpy (buffer + sizeof (header), payload, size);
+
+    /* a client that does not read its replies loses them rather than
+       blocking the daemon. */
+    if (send (client->fd, buffer, sizeof (header) + size,
+              MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+        N_WARNING (LOG_CAT "failed to send to client pid %d: %s",
+            (int) client->pid, strerror (errno));
+}
+
+static void
+client_ack (SocketClient *client, guint32 seq, guint32 value)
+{
+    client_send (client, N_SOCKET_ACK, seq, &value, sizeof (value));
+}
+
+static void
+client_error (SocketClient *client, guint32 seq, const char *error)
+{
+    N_DEBUG (LOG_CAT "reply error to client pid %d: %s", (int) client->pid, error);
+    client_send (client, N_SOCKET_ERROR, seq, error, strlen (error) + 1);
+}
+
+static NRequest*
+client_lookup_request (SocketClient *client, guint32 event_id)
+{
+    if (event_id == 0)
+        return NULL;
+
+    /* clients may only control their own requests. */
+    if (g_hash_table_lookup (client->data->requests,
+                             GUINT_TO_POINTER (event_id)) != client)
+        return NULL;
+
+    return n_core_lookup_request (n_input_interface_get_core (client->data->iface),
+                                  event_id);
+}
+
+static void
+socket_handle_play (SocketClient *client, const NSocketHeader *header,
+                    SocketReader *reader)
+{
+    NCore      *core       = n_input_interface_get_core (client->data->iface);
+    NProplist  *properties = NULL;
+    NRequest   *request    = NULL;
+    NValue     *value      = NULL;
+    const char *event      = NULL;
+    const char *key        = NULL;
+    NAtom       atom       = 0;
+    guint8      type       = 0;
+    guint       i;
+    gint64      received   = g_get_monotonic_time ();
+
+    if (!reader_name (reader, &atom, &event))
+        goto fail;
+
+    if (client->active_requests >= socket_max_requests) {
+        client_error (client, header->id, "Too many simultaneous requests.");
+        return;
+    }
+
+    properties = n_proplist_new ();
+    for (i = 0; i < header->count; i++) {
+        if (!reader_u8 (reader, &type) || !reader_name (reader, &atom, &key) ||
+            !reader_value (reader, type, &value))
+            goto fail;
+
+        /* inline keys go through the request key filter, atoms were
+           filtered when interned. */
+        if (!atom)
+            atom = n_core_intern_request_key (core, key);
+
+        if (atom)
+            n_proplist_set_by_atom (properties, atom, value);
+        else
+            n_value_free (value);
+    }
+
+    request = n_request_new_with_event (event);
+    n_request_take_properties (request, properties);
+    n_request_set_timestamp (request, N_REQUEST_STAGE_RECEIVED, received);
+
+    /* the owner is kept here rather than in the properties, which the
+       transform plugin filters before the request is played. */
+    g_hash_table_insert (client->data->requests,
+        GUINT_TO_POINTER (n_request_get_id (request)), client_ref (client));
+    client->active_requests++;
+    client->requests = g_list_prepend (client->requests,
+        GUINT_TO_POINTER (n_request_get_id (request)));
+
+    N_INFO (LOG_CAT ">> play received for event '%s' with id '%u' (client pid %d : %u active request(s))",
+                    event, n_request_get_id (request), (int) client->pid,
+                    client->active_requests);
+
+    client_ack (client, header->id, n_request_get_id (request));
+    n_input_interface_play_request (client->data->iface, request);
+
+    return;
+
+fail:
+    if (properties)
+        n_proplist_free (properties);
+    client_error (client, header->id, "Malformed request.");
+}
+
+static void
+socket_handle_stop (SocketClient *client, const NSocketHeader *header,
+                    SocketReader *reader, gboolean pause)
+{
+    NRequest *request  = NULL;
+    guint32   event_id = 0;
+    guint8    paused   = 0;
+
+    if (!reader_u32 (reader, &event_id) || (pause && !reader_u8 (reader, &paused))) {
+        client_error (client, header->id, "Malformed request.");
+        return;
+    }
+
+    if (!(request = client_lookup_request (client, event_id))) {
+        client_error (client, header->id, "No event with given id found.");
+        return;
+    }
+
+    if (!pause) {
+        N_INFO (LOG_CAT ">> stop received for id '%u'", event_id);
+        n_input_interface_stop_request (client->data->iface, request, 0);
+    }
+    else if (paused) {
+        N_INFO (LOG_CAT ">> pause received for id '%u'", event_id);
+        (void) n_input_interface_pause_request (client->data->iface, request);
+    }
+    else {
+        N_INFO (LOG_CAT ">> resume received for id '%u'", event_id);
+        (void) n_input_interface_play_request (client->data->iface, request);
+    }
+
+    client_ack (client, header->id, event_id);
+}
+
+/* event names are only interned once an event of that name exists, a
+   client may not grow the atom table with made up names. */
+static NAtom
+socket_lookup_event (NCore *core, const char *name)
+{
+    GList *iter = NULL;
+
+    for (iter = g_list_first (n_core_get_events (core)); iter; iter = g_list_next (iter)) {
+        if (g_str_equal (n_event_get_name ((NEvent*) iter->data), name))
+            return n_atom_intern (name);
+    }
+
+    return 0;
+}
+
+static void
+socket_handle_intern (SocketClient *client, const NSocketHeader *header,
+                      SocketReader *reader)
+{
+    NCore      *core = n_input_interface_get_core (client->data->iface);
+    const char *name = NULL;
+    guint8      kind = 0;
+    NAtom       atom = 0;
+
+    if (!reader_u8 (reader, &kind) || !(name = reader_string (reader)) || !*name) {
+        client_error (client, header->id, "Malformed request.");
+        return;
+    }
+
+    if (kind == N_SOCKET_ATOM_EVENT)
+        atom = socket_lookup_event (core, name);
+    else if (kind == N_SOCKET_ATOM_KEY)
+        atom = n_core_intern_request_key (core, name);
+
+    /* 0 tells the client the name is not used, unknown events are then
+       sent inline and fail as usual. */
+    client_ack (client, header->id, atom);
+}
+
+static gboolean
+socket_client_cb (gint fd, GIOCondition condition, gpointer userdata)
+{
+    SocketClient  *client = (SocketClient*) userdata;
+    guint8         buffer[N_SOCKET_MAX_PACKET];
+    NSocketHeader  header;
+    SocketReader   reader;
+    ssize_t        size   = 0;
+
+    if (condition & (G_IO_HUP | G_IO_ERR))
+        goto disconnect;
+
+    size = recv (fd, buffer, sizeof (buffer), MSG_DONTWAIT | MSG_TRUNC);
+    if (size < 0 && (errno == EAGAIN || errno == EINTR))
+        return TRUE;
+
+    if (size <= 0)
+        goto disconnect;
+
+    if (size > (ssize_t) sizeof (buffer) || size < (ssize_t) sizeof (header)) {
+        N_WARNING (LOG_CAT "invalid packet of %zd bytes from client pid %d",
+            size, (int) client->pid);
+        return TRUE;
+    }
+
+    memcpy (&header, buffer, sizeof (header));
+    reader.pos = buffer + sizeof (header);
+    reader.end = buffer + size;
+
+    switch (header.type) {
+        case N_SOCKET_PLAY:
+            socket_handle_play (client, &header, &reader);
+            break;
+
+        case N_SOCKET_STOP:
+            socket_handle_stop (client, &header, &reader, FALSE);
+            break;
+
+        case N_SOCKET_PAUSE:
+            socket_handle_stop (client, &header, &reader, TRUE);
+            break;
+
+        case N_SOCKET_INTERN:
+            socket_handle_intern (client, &header, &reader);
+            break;
+
+        default:
+            client_error (client, header.id, "Unknown request.");
+            break;
+    }
+
+    return TRUE;
+
+disconnect:
+    /* the watch is removed by returning FALSE */
+    client->watch = 0;
+    client_disconnect (client);
+    return FALSE;
+}
+
+static void
+client_disconnect (SocketClient *client)
+{
+    SocketData *data    = client->data;
+    NRequest   *request = NULL;
+    GList      *iter    = NULL;
+
+    N_INFO (LOG_CAT ">> client disconnect (pid %d)", (int) client->pid);
+
+    for (iter = g_list_first (client->requests); iter; iter = g_list_next (iter)) {
+        request = n_core_lookup_request (n_input_interface_get_core (data->iface),
+                                         GPOINTER_TO_UINT (iter->data));
+        if (request)
+            n_input_interface_stop_request (data->iface, request, 0);
+    }
+
+    if (client->watch > 0)
+        g_source_remove (client->watch);
+    client->watch = 0;
+
+    close (client->fd);
+    client->fd = -1;
+
+    data->clients = g_list_remove (data->clients, client);
+    data->client_count--;
+    client_unref (client);
+}
+
+static gboolean
+socket_peer_allowed (const struct ucred *cred)
+{
+    guint i;
+
+    if (cred->uid == 0 || cred->uid == getuid ())
+        return TRUE;
+
+    for (i = 0; socket_allow_uids && i < socket_allow_uids->len; i++) {
+        if (g_array_index (socket_allow_uids, guint32, i) == (guint32) cred->uid)
+            return TRUE;
+    }
+
+    for (i = 0; socket_allow_gids && i < socket_allow_gids->len; i++) {
+        if (g_array_index (socket_allow_gids, guint32, i) == (guint32) cred->gid)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gboolean
+socket_accept_cb (gint fd, GIOCondition condition, gpointer userdata)
+{
+    SocketData   *data = (SocketData*) userdata;
+    struct ucred  cred;
+    socklen_t     len  = sizeof (cred);
+    int           client_fd;
+
+    (void) condition;
+
+    if ((client_fd = accept4 (fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) < 0) {
+        if (errno != EAGAIN && errno != EINTR)
+            N_WARNING (LOG_CAT "accept failed: %s", strerror (errno));
+        return TRUE;
+    }
+
+    if (getsockopt (client_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+        N_WARNING (LOG_CAT "unable to get peer credentials: %s", strerror (errno));
+        goto reject;
+    }
+
+    if (!socket_peer_allowed (&cred)) {
+        N_WARNING (LOG_CAT "rejected client pid %d uid %d", (int) cred.pid,
+            (int) cred.uid);
+        goto reject;
+    }
+
+    if (data->client_count >= socket_max_clients) {
+        N_WARNING (LOG_CAT "too many clients, rejected pid %d", (int) cred.pid);
+        goto reject;
+    }
+
+    (void) client_new (data, client_fd, &cred);
+
+    return TRUE;
+
+reject:
+    close (client_fd);
+    return TRUE;
+}
+
+static int
+socket_initialize (NInputInterface *iface)
+{
+    SocketData         *data = NULL;
+    struct sockaddr_un  addr;
+
+    data = g_new0 (SocketData, 1);
+    data->iface = iface;
+    data->fd    = -1;
+    data->requests = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, (GDestroyNotify) client_unref);
+    n_input_interface_set_userdata (iface, data);
+
+    if (strlen (socket_path) >= sizeof (addr.sun_path)) {
+        N_ERROR (LOG_CAT "socket path '%s' is too long", socket_path);
+        goto error;
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, socket_path);
+
+    if ((data->fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0) {
+        N_ERROR (LOG_CAT "failed to create socket: %s", strerror (errno));
+        goto error;
+    }
+
+    (void) unlink (socket_path);
+    if (bind (data->fd, (struct sockaddr*) &addr, sizeof (addr)) < 0 ||
+        listen (data->fd, SOMAXCONN) < 0) {
+        N_ERROR (LOG_CAT "failed to listen on '%s': %s", socket_path, strerror (errno));
+        goto error;
+    }
+
+    /* access is checked from the peer credentials. */
+    (void) chmod (socket_path, 0666);
+
+    data->watch = g_unix_fd_add (data->fd, G_IO_IN, socket_accept_cb, data);
+    N_INFO (LOG_CAT "listening on '%s'", socket_path);
+
+    return TRUE;
+
+error:
+    if (data->fd >= 0)
+        close (data->fd);
+    data->fd = -1;
+    return FALSE;
+}
+
+static void
+socket_shutdown (NInputInterface *iface)
+{
+    SocketData *data = n_input_interface_get_userdata (iface);
+
+    if (!data)
+        return;
+
+    while (data->clients)
+        client_disconnect ((SocketClient*) data->clients->data);
+
+    if (data->watch > 0)
+        g_source_remove (data->watch);
+
+    if (data->fd >= 0) {
+        close (data->fd);
+        (void) unlink (socket_path);
+    }
+
+    g_hash_table_destroy (data->requests);
+    g_free (data);
+    n_input_interface_set_userdata (iface, NULL);
+}
+
+static void
+socket_send_error (NInputInterface *iface, NRequest *request,
+                   const char *err_msg)
+{
+    N_DEBUG (LOG_CAT "error occurred for request '%s': %s",
+        n_request_get_name (request), err_msg);
+
+    socket_send_reply (iface, request, N_SOCKET_EVENT_FAILED);
+}
+
+static void
+socket_send_reply (NInputInterface *iface, NRequest *request, int code)
+{
+    SocketData   *data     = n_input_interface_get_userdata (iface);
+    SocketClient *client   = NULL;
+    guint32       status   = code;
+    guint         event_id = 0;
+
+    if (!data)
+        return;
+
+    event_id = n_request_get_id (request);
+    client = g_hash_table_lookup (data->requests, GUINT_TO_POINTER (event_id));
+    if (event_id == 0 || !client)
+        return;
+
+    N_DEBUG (LOG_CAT "<< reply for event id '%u' with code '%d'", event_id, code);
+    client_send (client, N_SOCKET_STATUS, event_id, &status, sizeof (status));
+
+    if (code == N_SOCKET_EVENT_FAILED || code == N_SOCKET_EVENT_COMPLETED) {
+        if (client->active_requests > 0)
+            client->active_requests--;
+        client->requests = g_list_remove (client->requests,
+            GUINT_TO_POINTER (event_id));
+        /* drops the reference taken when the request was played */
+        g_hash_table_remove (data->requests, GUINT_TO_POINTER (event_id));
+    }
+}
+
+static GArray*
+socket_parse_ids (const NProplist *props, const char *key)
+{
+    const char  *value = NULL;
+    gchar      **ids   = NULL;
+    gchar      **id    = NULL;
+    GArray      *array = NULL;
+    guint32      num;
+
+    if (!(value = n_proplist_get_string (props, key)))
+        return NULL;
+
+    array = g_array_new (FALSE, FALSE, sizeof (guint32));
+    ids = g_strsplit (value, ";", -1);
+    for (id = ids; *id; ++id) {
+        g_strstrip (*id);
+        if (**id == '\0')
+            continue;
+        num = (guint32) strtoul (*id, NULL, 10);
+        g_array_append_vals (array, &num, 1);
+    }
+    g_strfreev (ids);
+
+    return array;
+}
+
+int
+n_plugin__load (NPlugin *plugin)
+{
+    static const NInputInterfaceDecl iface = {
+        .name       = "socket",
+        .initialize = socket_initialize,
+        .shutdown   = socket_shutdown,
+        .send_error = socket_send_error,
+        .send_reply = socket_send_reply
+    };
+
+    const NProplist *props;
+    const char *value;
+
+    props = n_plugin_get_params (plugin);
+
+    socket_max_requests = DEFAULT_REQUEST_LIMIT;
+    socket_max_clients  = DEFAULT_CLIENT_LIMIT;
+
+    if ((value = n_proplist_get_string (props, SOCKET_PATH)))
+        socket_path = g_strdup (value);
+    else
+        socket_path = g_build_filename (g_get_user_runtime_dir (), DEFAULT_SOCKET_NAME, NULL);
+
+    if ((value = n_proplist_get_string (props, SOCKET_REQUEST_LIMIT)))
+        socket_max_requests = atoi (value);
+
+    if ((value = n_proplist_get_string (props, SOCKET_CLIENT_LIMIT)))
+        socket_max_clients = atoi (value);
+
+    socket_allow_uids = socket_parse_ids (props, SOCKET_ALLOW_UID);
+    socket_allow_gids = socket_parse_ids (props, SOCKET_ALLOW_GID);
+
+    n_plugin_register_input (plugin, &iface);
+
+    return 1;
+}
+
+void
+n_plugin__unload (NPlugin *plugin)
+{
+    (void) plugin;
+
+    if (socket_allow_uids)
+        g_array_free (socket_allow_uids, TRUE);
+    if (socket_allow_gids)
+        g_array_free (socket_allow_gids, TRUE);
+    socket_allow_uids = NULL;
+    socket_allow_gids = NULL;
+
+    g_free (socket_path);
+    socket_path = NULL;
+}
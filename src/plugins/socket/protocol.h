@@ -0,0 +1,81 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_SOCKET_PROTOCOL_H
+#define N_SOCKET_PROTOCOL_H
+
+/* Wire format of the socket input interface. Every SOCK_SEQPACKET
+ * packet starts with a NSocketHeader and is at most
+ * N_SOCKET_MAX_PACKET bytes. Integers are in host byte order, since
+ * both ends are on the same machine.
+ *
+ * Names (event names and property keys) are encoded as an uint32
+ * atom. An atom of 0 is followed by the name as a NUL terminated
+ * string. Atoms are obtained with N_SOCKET_INTERN and are valid until
+ * the daemon exits.
+ *
+ * A property is an uint8 value type and a name, followed by the
+ * value: a NUL terminated string, an int32, an uint32 or an uint8
+ * boolean.
+ *
+ * Client to daemon, id is a sequence number echoed in the reply:
+ *   N_SOCKET_PLAY    event name, count properties
+ *   N_SOCKET_STOP    uint32 request id
+ *   N_SOCKET_PAUSE   uint32 request id, uint8 pause (0 resumes)
+ *   N_SOCKET_INTERN  uint8 kind (N_SOCKET_ATOM_*), NUL terminated name
+ *
+ * Daemon to client:
+ *   N_SOCKET_ACK     id is the sequence number, uint32 request id
+ *                    (0 if the request was not played) or the atom
+ *   N_SOCKET_ERROR   id is the sequence number, NUL terminated message
+ *   N_SOCKET_STATUS  id is the request id, uint32 status as in the
+ *                    D-Bus Status signal
+ */
+
+#include <stdint.h>
+
+#define N_SOCKET_MAX_PACKET     (1024)
+
+#define N_SOCKET_PLAY           (0x01)
+#define N_SOCKET_STOP           (0x02)
+#define N_SOCKET_PAUSE          (0x03)
+#define N_SOCKET_INTERN         (0x04)
+
+#define N_SOCKET_ACK            (0x81)
+#define N_SOCKET_ERROR          (0x82)
+#define N_SOCKET_STATUS         (0x83)
+
+#define N_SOCKET_ATOM_EVENT     (0x01)
+#define N_SOCKET_ATOM_KEY       (0x02)
+
+#define N_SOCKET_TYPE_STRING    (0x01)
+#define N_SOCKET_TYPE_INT       (0x02)
+#define N_SOCKET_TYPE_UINT      (0x03)
+#define N_SOCKET_TYPE_BOOL      (0x04)
+
+typedef struct _NSocketHeader
+{
+    uint8_t     type;
+    uint8_t     count;          /* number of properties in N_SOCKET_PLAY */
+    uint16_t    reserved;
+    uint32_t    id;
+} NSocketHeader;
+
+#endif /* N_SOCKET_PROTOCOL_H */
@@ -31,6 +31,7 @@
 #define SET_KEY_PREFIX  "set."
 #define TRANSFORM_KEY_PREFIX  "transform."
 #define TRANSFORM_TO_CONTEXT_KEY_PREFIX  "transform-to-context."
+#define STATE_FILE_KEY  "state-file"
 
 #define CLAMP_VALUE(in_v,in_min,in_max) \
     ((in_v) <= (in_min) ? (in_min) : ((in_v) >= (in_max) ? (in_max) : (in_v)))
@@ -40,6 +41,7 @@
 #define TYPE_DEFAULT    (0)
 #define TYPE_BUILTIN    (1)
 #define TYPE_EXTERNAL   (2)
+#define TYPE_COUNT      (3)
 
 #define USE_VAL1        (0)
 #define USE_VAL_MIN     (1)
@@ -59,21 +61,30 @@ typedef struct transform_entry {
     int max;
 } transform_entry;
 
+typedef struct role_entry role_entry;
+
 typedef struct context_entry {
     char *key;
+    role_entry *role;           /* role the rule belongs to */
     guint type;
     guint use_val;
     int val;
 } context_entry;
 
-typedef struct role_entry {
+/* The effective volume of a role is kept for every output route type,
+   so that only the rules of the changed key are looked at when a value
+   changes and a route change only picks the volume of the new type. */
+struct role_entry {
     guint ref;
     char *role;
     GSList *contexts;
-    int volume;
-} role_entry;
+    int volumes[TYPE_COUNT];    /* effective volume per output route type */
+    int volume;                 /* volume last sent to the volume controller */
+    gboolean has_value;         /* a context value of the role is known */
+};
 
-static GHashTable *stream_restore_role_map = NULL; /* contains GSLists of role_entry structs */
+static GHashTable *stream_restore_role_map = NULL; /* contains GSLists of context_entry structs */
+static GPtrArray  *role_entries            = NULL; /* all role entries, not owned */
 static GList      *transform_entries       = NULL; /* contains transform_entry entries */
 static guint       output_route_type_val   = 0;
 static NContext   *context                 = NULL;
@@ -123,6 +134,7 @@ context_entry_free (gpointer data)
 static void
 role_entry_free (role_entry *e)
 {
+    g_ptr_array_remove_fast (role_entries, e);
     g_slist_free_full (e->contexts, context_entry_free);
     g_free (e->role);
     g_free (e);
@@ -140,10 +152,11 @@ role_entry_unref (role_entry *e)
 }
 
 static context_entry*
-context_entry_new (const char *key, guint type, guint use_val)
+context_entry_new (role_entry *e, const char *key, guint type, guint use_val)
 {
     context_entry *c = g_new0 (context_entry, 1);
     c->key = g_strdup (key);
+    c->role = e;
     c->type = type;
     c->use_val = use_val;
     return c;
@@ -154,7 +167,7 @@ role_entry_add_context (role_entry *e, const char *key, guint type, guint use_va
 {
     context_entry *c;
 
-    c = context_entry_new (key, type, use_val);
+    c = context_entry_new (e, key, type, use_val);
     e->contexts = g_slist_append (e->contexts, c);
     role_entry_ref (e);
 }
@@ -221,96 +234,95 @@ role_entry_parse_rules (role_entry *e, const char *str)
         role_entry_add_context (e, str, TYPE_DEFAULT, USE_VAL1);
 }
 
-static role_entry*
-role_entry_new (const char *role, const char *str)
+static int
+role_entry_compute_volume (role_entry *entry, guint type)
 {
-    role_entry *e;
+    GSList *i;
+    context_entry *c;
+    int volume = VOLUME_MAX;
 
-    e = g_new0 (role_entry, 1);
-    e->ref = 0; /* role entry's reference count == context list size */
-    e->role = g_strdup (role);
-    role_entry_parse_rules (e, str);
+    for (i = entry->contexts; i; i = i->next) {
+        c = i->data;
 
-    N_DEBUG (LOG_CAT "new role entry '%s'", e->role);
+        if (c->type == TYPE_DEFAULT)
+            return c->val;
 
-    return e;
+        if (c->type == type) {
+            if (c->use_val == USE_VAL1)
+                return c->val;
+            volume = volume < c->val ? volume : c->val;
+        }
+    }
+
+    return volume;
 }
 
-static gboolean
-role_entry_get_volume (role_entry *entry, int *volume)
+static void
+role_entry_update_volumes (role_entry *entry, guint type)
 {
-    GSList *i;
-    context_entry *c;
+    guint t;
 
-    g_assert (entry);
-    g_assert (volume);
+    /* a rule without a route type applies to all of them */
+    for (t = 0; t < TYPE_COUNT; t++) {
+        if (type == TYPE_DEFAULT || t == type)
+            entry->volumes[t] = role_entry_compute_volume (entry, t);
+    }
+}
 
-    *volume = VOLUME_MAX;
+static void
+role_entry_push_volume (role_entry *entry)
+{
+    int volume = entry->volumes[output_route_type ()];
 
-    for (i = entry->contexts; i; i = i->next) {
-        c = i->data;
+    if (entry->has_value && entry->volume != volume) {
+        entry->volume = volume;
+        volume_controller_update (entry->role, volume);
+    }
+}
 
-        if (c->type == TYPE_DEFAULT) {
-            *volume = c->val;
-            break;
-        }
+static role_entry*
+role_entry_new (const char *role, const char *str)
+{
+    role_entry *e;
 
-        if (output_route_type() == c->type) {
-            if (c->use_val == USE_VAL1) {
-                *volume = c->val;
-                break;
-            } else
-                *volume = *volume < c->val ? *volume : c->val;
-        }
-    }
+    e = g_new0 (role_entry, 1);
+    e->ref = 0; /* role entry's reference count == context list size */
+    e->role = g_strdup (role);
+    role_entry_parse_rules (e, str);
+    role_entry_update_volumes (e, TYPE_DEFAULT);
+    g_ptr_array_add (role_entries, e);
 
-    if (entry->volume != *volume) {
-        entry->volume = *volume;
-        return TRUE;
-    }
+    N_DEBUG (LOG_CAT "new role entry '%s'", e->role);
 
-    return FALSE;
+    return e;
 }
 
-static gboolean
-role_entry_update_volume (role_entry *entry, const char *key, int volume)
+static void
+update_context_volume (GSList *contexts, int volume)
 {
-    gboolean volume_changed = FALSE;
     GSList *i;
     context_entry *c;
 
-    g_assert (entry);
-    g_assert (key);
-
-    for (i = entry->contexts; i; i = i->next) {
+    for (i = contexts; i; i = i->next) {
         c = i->data;
 
-        if (c->type == TYPE_DEFAULT) {
-            if (c->val != volume) {
-                c->val = volume;
-                volume_changed = TRUE;
-            }
-            break;
-        }
+        if (c->val == volume && c->role->has_value)
+            continue;
 
-        if (!g_strcmp0 (key, c->key)) {
-            if (c->val != volume) {
-                c->val = volume;
-                volume_changed = TRUE;
-            }
-        }
+        c->val = volume;
+        c->role->has_value = TRUE;
+        role_entry_update_volumes (c->role, c->type);
+        role_entry_push_volume (c->role);
     }
-
-    return volume_changed;
 }
 
-static gboolean
-role_entry_update_and_get_volume (role_entry *entry, const char *key, int volume, int *new_volume)
+static void
+update_route_volumes ()
 {
-    if (role_entry_update_volume (entry, key, volume))
-        return role_entry_get_volume (entry, new_volume);
+    guint i;
 
-    return FALSE;
+    for (i = 0; i < role_entries->len; i++)
+        role_entry_push_volume (g_ptr_array_index (role_entries, i));
 }
 
 static void
@@ -324,10 +336,7 @@ init_done_cb (NHook *hook, void *data, void *userdata)
     NContext       *context = n_core_get_context (core);
     const char     *key     = NULL;
     GSList         *entries = NULL;
-    GSList         *i       = NULL;
-    role_entry     *entry   = NULL;
     const NValue   *value   = NULL;
-    int             volume  = 0;
     GHashTableIter  iter;
 
     /* query initial route */
@@ -344,22 +353,17 @@ init_done_cb (NHook *hook, void *data, void *userdata)
         value = n_context_get_value (context, key);
         if (!value) {
             N_DEBUG (LOG_CAT "no value found for role '%s', key '%s' from context",
-                             entry->role, key);
+                             ((context_entry*) entries->data)->role->role, key);
             continue;
         }
 
         if (n_value_type (value) != N_VALUE_TYPE_INT) {
             N_WARNING (LOG_CAT "invalid value type for role '%s', key '%s'",
-                               entry->role, key);
+                               ((context_entry*) entries->data)->role->role, key);
             continue;
         }
 
-        for (i = entries; i; i = i->next) {
-            entry = i->data;
-            volume = n_value_get_int (value);
-            if (role_entry_update_and_get_volume (entry, key, volume, &volume))
-                volume_controller_update (entry->role, volume);
-        }
+        update_context_volume (entries, n_value_get_int (value));
     }
 }
 
@@ -449,13 +453,14 @@ static void
 hash_table_add_cb (gpointer data, gpointer user_data)
 {
     context_entry  *c       = data;
-    role_entry     *e       = user_data;
     GSList         *entries = NULL;
 
+    (void) user_data;
+
     if ((entries = g_hash_table_lookup (stream_restore_role_map, c->key))) {
-        entries = g_slist_append (entries, e);
+        entries = g_slist_append (entries, c);
     } else {
-        entries = g_slist_append (entries, e);
+        entries = g_slist_append (entries, c);
         g_hash_table_insert (stream_restore_role_map,
                              g_strdup (c->key),
                              entries);
@@ -515,13 +520,14 @@ context_value_changed_cb (NContext *context, const char *key,
     (void) userdata;
 
     GSList     *entries;
-    GSList     *i;
-    role_entry *entry;
-    int         volume = 0;
+    guint       type;
 
     if (!g_strcmp0 (key, CONTEXT_ROUTE_OUTPUT_TYPE_KEY)) {
+        type = output_route_type ();
         output_route_type_val = n_value_get_uint (new_value);
         N_DEBUG (LOG_CAT "route changes to %s", output_route_type_to_string());
+        if (output_route_type () != type)
+            update_route_volumes ();
         return;
     }
 
@@ -534,12 +540,7 @@ context_value_changed_cb (NContext *context, const char *key,
         return;
     }
 
-    for (i = entries; i; i = i->next) {
-        entry = i->data;
-        volume = n_value_get_int (new_value);
-        if (role_entry_update_and_get_volume (entry, key, volume, &volume))
-            volume_controller_update (entry->role, volume);
-    }
+    update_context_volume (entries, n_value_get_int (new_value));
 }
 
 static void
@@ -554,12 +555,21 @@ media_state_changed_cb (const char *media_state, void *userdata)
     n_context_set_value (context, "media.state", v);
 }
 
+static void
+context_entry_unref_role (gpointer data)
+{
+    context_entry *c = data;
+
+    /* the last reference frees the rules of the role, this one too */
+    role_entry_unref (c->role);
+}
+
 static void
 entry_list_free (gpointer data)
 {
     GSList *entries = data;
 
-    g_slist_free_full (entries, (GDestroyNotify) role_entry_unref);
+    g_slist_free_full (entries, context_entry_unref_role);
 }
 
 static void
@@ -573,18 +583,32 @@ N_PLUGIN_LOAD (plugin)
 {
     NCore           *core    = NULL;
     const NProplist *params  = NULL;
+    const char      *state   = NULL;
+    gchar           *path    = NULL;
 
     core = n_plugin_get_core (plugin);
     context = n_core_get_context (core);
 
     stream_restore_role_map = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                      role_map_key_free, entry_list_free);
+    role_entries = g_ptr_array_new ();
+
+    params = n_plugin_get_params (plugin);
+
+    /* relative state file paths are in the user cache directory. */
 
-    volume_controller_initialize ();
+    if ((state = n_proplist_get_string (params, STATE_FILE_KEY)) && *state) {
+        if (g_path_is_absolute (state))
+            path = g_strdup (state);
+        else
+            path = g_build_filename (g_get_user_cache_dir (), state, NULL);
+    }
+
+    volume_controller_initialize (path);
+    g_free (path);
 
     /* load the stream restore roles we are interested in. */
 
-    params = n_plugin_get_params (plugin);
     n_proplist_foreach (params, volume_add_role_key_cb, NULL);
 
     /* connect to the init done hook to query the initial values for
@@ -623,6 +647,10 @@ N_PLUGIN_UNLOAD (plugin)
         g_hash_table_destroy (stream_restore_role_map);
         stream_restore_role_map = NULL;
     }
+    if (role_entries) {
+        g_ptr_array_free (role_entries, TRUE);
+        role_entries = NULL;
+    }
     if (transform_entries) {
         volume_controller_set_subscribe_cb (NULL, NULL);
         g_list_free_full (transform_entries, transform_entry_unsubscribe_free);
@@ -23,6 +23,7 @@
 #include <stdint.h>
 #include <dbus/dbus.h>
 #include <dbus-gmain/dbus-gmain.h>
+#include <glib/gstdio.h>
 #include "volume-controller.h"
 
 #include <ngf/log.h>
@@ -59,12 +60,16 @@
 #define STOP_LISTEN_FOR_METHOD  "StopListeningForSignal"
 #define DISCONNECTED_SIG        "Disconnected"
 #define RETRY_TIMEOUT           2
+#define LOOKUP_TIMEOUT          (5000)
+#define WRITE_WINDOW            (20)
 #define VOLUME_SCALE_VALUE      65536
+#define STATE_SAVE_DELAY        (5)
+#define STATE_VOLUME_GROUP      "volume"
+#define STATE_OBJECT_PATH_GROUP "object-path"
 
 #define TO_PA_VOL(volume)       ((gdouble) (volume > 100 ? 100 : volume) / 100.0) * VOLUME_SCALE_VALUE
 #define FROM_PA_VOL(volume)     ((gdouble) volume / (gdouble) VOLUME_SCALE_VALUE * 100.0)
 
-#define QUEUE_ITEM_TYPE_SET (0)
 #define QUEUE_ITEM_TYPE_GET (1)
 
 typedef struct _QueueItem
@@ -79,9 +84,25 @@ typedef struct _SubscribeItem
     char *stream_name;
     char *object_path;
     void *data;
+    DBusPendingCall *lookup;    /* object path lookup in progress */
+    gboolean cached_path;       /* object path from the state file, not verified yet */
 } SubscribeItem;
 
+// Volume and entry name queries waiting for their replies, so that the
+// main loop does not block on PulseAudio.
+typedef struct _VolumeCall
+{
+    gchar           *name;      /* role or object path queried, for the logs */
+    gchar           *obj_path;
+    DBusPendingCall *pending;
+} VolumeCall;
+
 static GQueue         *volume_queue    = NULL;
+static GSList         *volume_calls    = NULL;
+// Volume writes waiting for the write window to pass, role -> volume. Only
+// the latest volume of each role is written.
+static GHashTable     *volume_writes   = NULL;
+static guint           volume_write_id = 0;
 static DBusConnection *volume_bus      = NULL;
 static guint           volume_retry_id = 0;
 // Session bus is used to get PulseAudio dbus socket address when PULSE_DBUS_SERVER environment
@@ -103,6 +124,18 @@ static void           *subscribe_userdata                = NULL;
 static volume_controller_subscribe_cb subscribe_callback = NULL;
 static gboolean        queue_subscribe                   = FALSE;
 
+// Number of object path lookups in progress. Signal listening is updated
+// once all of them have returned.
+static guint           pending_lookups                   = 0;
+static gboolean        lookups_found                     = FALSE;
+
+// Last known volumes (0..100) and object paths of the streams, saved to
+// state_file so that the values are known right away on the next start,
+// before PulseAudio is reachable.
+static GKeyFile       *state                             = NULL;
+static gchar          *state_file                        = NULL;
+static guint           state_save_id                     = 0;
+
 static media_state_subscribe_cb media_state_callback     = NULL;
 static void           *media_state_userdata              = NULL;
 
@@ -110,6 +143,9 @@ static gboolean          retry_timeout_cb           (gpointer userdata);
 static DBusHandlerResult filter_cb                  (DBusConnection *connection, DBusMessage *msg, void *data);
 static void              append_volume              (DBusMessageIter *iter, guint volume);
 static gboolean          add_entry                  (const char *role, guint volume);
+static void              add_entry_reply_cb         (DBusPendingCall *pending, void *data);
+static gboolean          write_timeout_cb           (gpointer userdata);
+static void              flush_volume_writes        ();
 static void              get_entry_volume           (const char *role);
 static void              process_queued_ops         ();
 static void              connect_to_pulseaudio      ();
@@ -117,12 +153,29 @@ static void              disconnect_from_pulseaudio ();
 static void              retry_connect              ();
 static void              get_address_reply_cb       (DBusPendingCall *pending, void *data);
 
-static gchar*            get_object_name            (const char *obj_path);
-static gchar*            get_object_path            (const char *obj_path);
+static void              cancel_volume_calls        ();
+static void              entry_path_reply_cb        (DBusPendingCall *pending, void *data);
+static void              entry_volume_reply_cb      (DBusPendingCall *pending, void *data);
+static void              lookup_object_name         (const char *obj_path);
+static void              object_name_reply_cb       (DBusPendingCall *pending, void *data);
+static void              lookup_object_path         (SubscribeItem *item);
+static void              lookup_object_path_reply_cb (DBusPendingCall *pending, void *data);
+static void              cancel_lookup              (SubscribeItem *item);
+static void              cancel_lookups             ();
 static void              listen_for_signal          (const char *signal, const char **objects);
 static void              stop_listen_for_signal     (const char *signal);
 static void              update_object_map_listen   ();
+static void              listen_object_map          ();
 static gboolean          get_volume                 (DBusMessage *msg, int *volume);
+static void              notify_volume              (SubscribeItem *item, int volume);
+static void              set_object_path            (SubscribeItem *item, const char *obj_path);
+
+static void              state_load                 ();
+static void              state_save                 ();
+static gboolean          state_save_cb              (gpointer userdata);
+static void              state_changed              ();
+static void              state_set_volume           (const char *name, int volume);
+static void              state_set_object_path      (const char *name, const char *obj_path);
 
 static void
 retry_connect()
@@ -131,6 +184,149 @@ retry_connect()
                                             retry_timeout_cb, NULL);
 }
 
+static void
+state_load ()
+{
+    GError *error = NULL;
+
+    state = g_key_file_new ();
+
+    if (!state_file)
+        return;
+
+    if (!g_key_file_load_from_file (state, state_file, G_KEY_FILE_NONE, &error)) {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            N_WARNING (LOG_CAT "failed to load state file %s: %s", state_file, error->message);
+        g_error_free (error);
+        return;
+    }
+
+    N_DEBUG (LOG_CAT "loaded state file %s", state_file);
+}
+
+static void
+state_save ()
+{
+    GError *error   = NULL;
+    gchar  *dirname = NULL;
+    gchar  *data    = NULL;
+    gsize   length  = 0;
+
+    if (state_save_id > 0) {
+        g_source_remove (state_save_id);
+        state_save_id = 0;
+    }
+
+    if (!state || !state_file)
+        return;
+
+    dirname = g_path_get_dirname (state_file);
+    if (g_mkdir_with_parents (dirname, 0755) < 0) {
+        N_WARNING (LOG_CAT "failed to create directory %s", dirname);
+        goto done;
+    }
+
+    data = g_key_file_to_data (state, &length, NULL);
+    if (!g_file_set_contents (state_file, data, length, &error)) {
+        N_WARNING (LOG_CAT "failed to save state file %s: %s", state_file, error->message);
+        g_error_free (error);
+        goto done;
+    }
+
+    N_DEBUG (LOG_CAT "saved state file %s", state_file);
+
+done:
+    g_free (data);
+    g_free (dirname);
+}
+
+static gboolean
+state_save_cb (gpointer userdata)
+{
+    (void) userdata;
+
+    state_save_id = 0;
+    state_save ();
+
+    return FALSE;
+}
+
+// The state is written a while after the last change, volume changes tend
+// to come in bursts.
+static void
+state_changed ()
+{
+    if (state_file && state_save_id == 0)
+        state_save_id = g_timeout_add_seconds (STATE_SAVE_DELAY, state_save_cb, NULL);
+}
+
+static void
+state_set_volume (const char *name, int volume)
+{
+    if (!state)
+        return;
+
+    if (g_key_file_has_key (state, STATE_VOLUME_GROUP, name, NULL) &&
+        g_key_file_get_integer (state, STATE_VOLUME_GROUP, name, NULL) == volume)
+        return;
+
+    g_key_file_set_integer (state, STATE_VOLUME_GROUP, name, volume);
+    state_changed ();
+}
+
+static void
+state_set_object_path (const char *name, const char *obj_path)
+{
+    gchar *old = NULL;
+
+    if (!state)
+        return;
+
+    old = g_key_file_get_string (state, STATE_OBJECT_PATH_GROUP, name, NULL);
+
+    if (obj_path && g_strcmp0 (old, obj_path) != 0) {
+        g_key_file_set_string (state, STATE_OBJECT_PATH_GROUP, name, obj_path);
+        state_changed ();
+    } else if (!obj_path && old) {
+        g_key_file_remove_key (state, STATE_OBJECT_PATH_GROUP, name, NULL);
+        state_changed ();
+    }
+
+    g_free (old);
+}
+
+static void
+notify_volume (SubscribeItem *item, int volume)
+{
+    state_set_volume (item->stream_name, volume);
+
+    if (subscribe_callback)
+        subscribe_callback (item->stream_name, volume, item->data, subscribe_userdata);
+}
+
+// Replaces the object path of the item, keeping object_map and the state
+// in sync. NULL obj_path clears the path.
+static void
+set_object_path (SubscribeItem *item, const char *obj_path)
+{
+    if (item->object_path) {
+        if (object_map)
+            g_hash_table_remove (object_map, item->object_path);
+        g_free (item->object_path);
+        item->object_path = NULL;
+    }
+
+    item->cached_path = FALSE;
+
+    if (obj_path) {
+        item->object_path = g_strdup (obj_path);
+        if (object_map)
+            g_hash_table_insert (object_map, item->object_path, item);
+    }
+
+    state_set_object_path (item->stream_name, obj_path);
+}
+
 static void
 get_address_reply_cb(DBusPendingCall *pending, void *data)
 {
@@ -248,7 +444,6 @@ filter_cb (DBusConnection *connection, DBusMessage *msg, void *data)
     (void) data;
 
     const char *obj_path;
-    char *stream_name;
     GList *list, *i;
     SubscribeItem *item;
     int volume = 0;
@@ -272,6 +467,7 @@ filter_cb (DBusConnection *connection, DBusMessage *msg, void *data)
                     g_free (item->object_path);
                     item->object_path = NULL;
                 }
+                item->cached_path = FALSE;
             }
             g_list_free (list);
             queue_subscribe = TRUE;
@@ -298,15 +494,7 @@ filter_cb (DBusConnection *connection, DBusMessage *msg, void *data)
         // and add to object_map
         if (!object_map_complete && !g_hash_table_lookup (object_map, obj_path)) {
 
-            if ((stream_name = get_object_name (obj_path))) {
-
-                if ((item = g_hash_table_lookup (subscribe_map, stream_name))) {
-                    item->object_path = g_strdup (obj_path);
-                    N_DEBUG (LOG_CAT "stream restore entry for %s appeared (%s)", item->stream_name, item->object_path);
-                    update_object_map_listen ();
-                }
-                g_free (stream_name);
-            }
+            lookup_object_name (obj_path);
         }
     }
     else if (subscribe_callback &&
@@ -320,9 +508,7 @@ filter_cb (DBusConnection *connection, DBusMessage *msg, void *data)
         }
 
         if ((item = g_hash_table_lookup (object_map, obj_path))) {
-            g_hash_table_remove (object_map, item->object_path);
-            g_free (item->object_path);
-            item->object_path = NULL;
+            set_object_path (item, NULL);
             update_object_map_listen ();
             N_DEBUG (LOG_CAT "removed entry %s from object map (%s)", item->stream_name, obj_path);
         }
@@ -337,7 +523,7 @@ filter_cb (DBusConnection *connection, DBusMessage *msg, void *data)
         if ((item = g_hash_table_lookup (object_map, obj_path))) {
             N_DEBUG (LOG_CAT "volume updated for stream %s (%s)", item->stream_name, item->object_path);
             if (get_volume (msg, &volume)) {
-                subscribe_callback (item->stream_name, FROM_PA_VOL(volume), item->data, subscribe_userdata);
+                notify_volume (item, FROM_PA_VOL(volume));
             }
         }
     }
@@ -375,18 +561,38 @@ append_volume (DBusMessageIter *iter, guint volume)
     dbus_message_iter_close_container (iter, &array);
 }
 
+static void
+add_entry_reply_cb (DBusPendingCall *pending, void *data)
+{
+    const char  *role  = (const char*) data;
+    DBusMessage *reply = NULL;
+    DBusError    error;
+
+    dbus_error_init (&error);
+
+    if ((reply = dbus_pending_call_steal_reply (pending))) {
+        if (dbus_set_error_from_message (&error, reply))
+            N_WARNING (LOG_CAT "failed to update volume role '%s': %s",
+                role, error.message);
+        dbus_message_unref (reply);
+    }
+
+    dbus_error_free (&error);
+}
+
+// Sends the volume of a role without waiting for the reply, failures are
+// logged when the reply arrives.
 static gboolean
 add_entry (const char *role, guint volume)
 {
     DBusMessage     *msg     = NULL;
-    DBusMessage     *reply   = NULL;
+    DBusPendingCall *pending = NULL;
     const char      *empty   = "";
     gboolean         success = FALSE;
     dbus_bool_t      muted   = FALSE;
     dbus_bool_t      apply   = TRUE;
     dbus_uint32_t    vol     = 0;
     DBusMessageIter  iter;
-    DBusError        error;
 
     if (!volume_bus || !role)
         return FALSE;
@@ -394,7 +600,6 @@ add_entry (const char *role, guint volume)
     /* convert the volume from 0-100 to PA_VOLUME_NORM range */
     vol = TO_PA_VOL(volume);
 
-    dbus_error_init (&error);
     msg = dbus_message_new_method_call (0, STREAM_RESTORE_PATH,
         STREAM_RESTORE_IF, ADD_ENTRY_METHOD);
 
@@ -408,82 +613,243 @@ add_entry (const char *role, guint volume)
     dbus_message_iter_append_basic (&iter, DBUS_TYPE_BOOLEAN, &muted);
     dbus_message_iter_append_basic (&iter, DBUS_TYPE_BOOLEAN, &apply);
 
-    reply = dbus_connection_send_with_reply_and_block (volume_bus,
-        msg, -1, &error);
-
-    if (!reply) {
-        if (dbus_error_is_set (&error)) {
-            N_WARNING (LOG_CAT "failed to update volume role '%s': %s",
-                role, error.message);
-        }
-
+    if (!dbus_connection_send_with_reply (volume_bus, msg, &pending, LOOKUP_TIMEOUT) ||
+        !pending) {
+        N_WARNING (LOG_CAT "failed to update volume role '%s'", role);
         goto done;
     }
 
+    if (!dbus_pending_call_set_notify (pending, add_entry_reply_cb,
+                                       g_strdup (role), g_free))
+        dbus_pending_call_cancel (pending);
+
     N_DEBUG (LOG_CAT "volume for role '%s' set to %d", role, vol);
+    state_set_volume (role, volume);
     success = TRUE;
 
 done:
-    dbus_error_free (&error);
-
-    if (reply) dbus_message_unref (reply);
-    if (msg)   dbus_message_unref (msg);
+    if (pending) dbus_pending_call_unref (pending);
+    if (msg)     dbus_message_unref (msg);
 
     return success;
 }
 
+static void
+flush_volume_writes ()
+{
+    GHashTableIter  iter;
+    gpointer        role;
+    gpointer        volume;
+
+    if (volume_write_id > 0) {
+        g_source_remove (volume_write_id);
+        volume_write_id = 0;
+    }
+
+    if (!volume_bus || !volume_writes)
+        return;
+
+    // the writes are sent back to back, the replies are handled as they come
+    g_hash_table_iter_init (&iter, volume_writes);
+    while (g_hash_table_iter_next (&iter, &role, &volume))
+        add_entry ((const char*) role, GPOINTER_TO_INT (volume));
+
+    g_hash_table_remove_all (volume_writes);
+}
+
+static gboolean
+write_timeout_cb (gpointer userdata)
+{
+    (void) userdata;
+
+    volume_write_id = 0;
+    flush_volume_writes ();
+
+    return FALSE;
+}
+
+static DBusMessage*
+new_property_get (const char *obj_path, const char *property)
+{
+    DBusMessage *msg   = NULL;
+    const gchar *iface = STREAM_ENTRY_IF;
+
+    msg = dbus_message_new_method_call (STREAM_ENTRY_IF,
+                                        obj_path,
+                                        DBUS_PROPERTIES_IF,
+                                        "Get");
+
+    if (msg && !dbus_message_append_args (msg,
+                                          DBUS_TYPE_STRING, &iface,
+                                          DBUS_TYPE_STRING, &property,
+                                          DBUS_TYPE_INVALID)) {
+        dbus_message_unref (msg);
+        msg = NULL;
+    }
+
+    return msg;
+}
+
+static gboolean
+volume_call_send (VolumeCall *call, DBusMessage *msg, DBusPendingCallNotifyFunction notify)
+{
+    g_assert (call->pending == NULL);
+
+    if (!msg)
+        return FALSE;
+
+    if (!dbus_connection_send_with_reply (volume_bus, msg, &call->pending, LOOKUP_TIMEOUT) ||
+        !call->pending) {
+        dbus_message_unref (msg);
+        return FALSE;
+    }
+
+    dbus_message_unref (msg);
+
+    if (!dbus_pending_call_set_notify (call->pending, notify, call, NULL)) {
+        dbus_pending_call_cancel (call->pending);
+        dbus_pending_call_unref (call->pending);
+        call->pending = NULL;
+        return FALSE;
+    }
+
+    if (!g_slist_find (volume_calls, call))
+        volume_calls = g_slist_prepend (volume_calls, call);
+
+    return TRUE;
+}
+
+// Returns the reply of the call or NULL with the error logged.
+static DBusMessage*
+volume_call_finish (VolumeCall *call, DBusPendingCall *pending, const char *what)
+{
+    DBusMessage *reply = NULL;
+    DBusError    error;
+
+    g_assert (call->pending == pending);
+    call->pending = NULL;
+
+    reply = dbus_pending_call_steal_reply (pending);
+    dbus_pending_call_unref (pending);
+
+    if (!reply)
+        return NULL;
+
+    dbus_error_init (&error);
+    if (dbus_set_error_from_message (&error, reply)) {
+        N_DEBUG (LOG_CAT "couldn't get %s for %s: %s", what, call->name, error.message);
+        dbus_error_free (&error);
+        dbus_message_unref (reply);
+        return NULL;
+    }
+
+    return reply;
+}
+
+static void
+volume_call_free (VolumeCall *call)
+{
+    volume_calls = g_slist_remove (volume_calls, call);
+
+    if (call->pending) {
+        dbus_pending_call_cancel (call->pending);
+        dbus_pending_call_unref (call->pending);
+    }
+
+    g_free (call->name);
+    g_free (call->obj_path);
+    g_slice_free (VolumeCall, call);
+}
+
+static void
+cancel_volume_calls ()
+{
+    while (volume_calls)
+        volume_call_free (volume_calls->data);
+}
+
 static void
 get_entry_volume (const char *role)
 {
     SubscribeItem   *item           = NULL;
-    gchar           *obj_path       = NULL;
+    VolumeCall      *call           = NULL;
     DBusMessage     *msg            = NULL;
-    DBusMessage     *reply          = NULL;
-    const gchar     *iface          = STREAM_ENTRY_IF;
-    const gchar     *addr           = "Volume";
-    int              current_type;
-    int              channel_count  = 0;
-    uint32_t         volume_max     = 0;
-    DBusMessageIter  iter;
-    DBusMessageIter  iter_variant;
-    DBusMessageIter  iter_array;
-    DBusMessageIter  iter_struct;
-    DBusError        error;
 
     if (!volume_bus || !role)
         return;
 
-    dbus_error_init (&error);
+    call = g_slice_new0 (VolumeCall);
+    call->name = g_strdup (role);
 
-    if (!(obj_path = get_object_path (role)))
-        goto done;
+    // use the object path found for the subscription, if there is one
+    if (subscribe_map && (item = g_hash_table_lookup (subscribe_map, role)) &&
+        item->object_path) {
+        call->obj_path = g_strdup (item->object_path);
+        msg = new_property_get (call->obj_path, "Volume");
+        if (!volume_call_send (call, msg, entry_volume_reply_cb))
+            volume_call_free (call);
+        return;
+    }
 
-    msg = dbus_message_new_method_call(STREAM_ENTRY_IF,
-                                       obj_path,
-                                       DBUS_PROPERTIES_IF,
-                                       "Get");
+    msg = dbus_message_new_method_call (NULL,
+                                        STREAM_RESTORE_PATH,
+                                        STREAM_RESTORE_IF,
+                                        "GetEntryByName");
 
-    if (msg == NULL)
-        goto done;
+    if (msg)
+        dbus_message_append_args (msg, DBUS_TYPE_STRING, &role, DBUS_TYPE_INVALID);
 
-    if (!dbus_message_append_args(msg,
-                                  DBUS_TYPE_STRING, &iface,
-                                  DBUS_TYPE_STRING, &addr,
-                                  DBUS_TYPE_INVALID))
-        goto done;
+    if (!volume_call_send (call, msg, entry_path_reply_cb))
+        volume_call_free (call);
+}
 
-    reply = dbus_connection_send_with_reply_and_block (volume_bus,
-                                                       msg, -1, &error);
+static void
+entry_path_reply_cb (DBusPendingCall *pending, void *data)
+{
+    VolumeCall  *call     = (VolumeCall*) data;
+    DBusMessage *reply    = NULL;
+    const gchar *obj_path = NULL;
 
-    if (!reply) {
-        if (dbus_error_is_set (&error)) {
-            N_WARNING (LOG_CAT "couldn't get volume for %s: %s",
-                               obj_path, error.message);
-        }
+    if (!(reply = volume_call_finish (call, pending, "object path")))
+        goto fail;
 
-        goto done;
+    if (!dbus_message_get_args (reply, NULL, DBUS_TYPE_OBJECT_PATH, &obj_path, DBUS_TYPE_INVALID)) {
+        N_WARNING (LOG_CAT "failed to get object path");
+        goto fail;
     }
 
+    call->obj_path = g_strdup (obj_path);
+    dbus_message_unref (reply);
+
+    if (!volume_call_send (call, new_property_get (call->obj_path, "Volume"),
+                           entry_volume_reply_cb))
+        volume_call_free (call);
+
+    return;
+
+fail:
+    if (reply)
+        dbus_message_unref (reply);
+    volume_call_free (call);
+}
+
+static void
+entry_volume_reply_cb (DBusPendingCall *pending, void *data)
+{
+    VolumeCall      *call           = (VolumeCall*) data;
+    SubscribeItem   *item           = NULL;
+    DBusMessage     *reply          = NULL;
+    int              current_type;
+    int              channel_count  = 0;
+    uint32_t         volume_max     = 0;
+    DBusMessageIter  iter;
+    DBusMessageIter  iter_variant;
+    DBusMessageIter  iter_array;
+    DBusMessageIter  iter_struct;
+
+    if (!(reply = volume_call_finish (call, pending, "volume")))
+        goto done;
+
     dbus_message_iter_init(reply, &iter);
 
     /* Volumes are in variant containing an array of structs of
@@ -519,19 +885,17 @@ get_entry_volume (const char *role)
     if (channel_count > 0) {
         if (volume_max > VOLUME_SCALE_VALUE)
             volume_max = VOLUME_SCALE_VALUE;
-        if ((item = g_hash_table_lookup (object_map, obj_path))) {
+        if ((item = g_hash_table_lookup (object_map, call->obj_path))) {
             N_DEBUG (LOG_CAT "post volume get for stream %s (%s) : %u",
                              item->stream_name, item->object_path, volume_max);
-            subscribe_callback (item->stream_name, FROM_PA_VOL(volume_max), item->data, subscribe_userdata);
+            notify_volume (item, FROM_PA_VOL(volume_max));
         }
     }
 
 done:
-    dbus_error_free (&error);
-
-    g_free (obj_path);
-    if (reply) dbus_message_unref (reply);
-    if (msg)   dbus_message_unref (msg);
+    if (reply)
+        dbus_message_unref (reply);
+    volume_call_free (call);
 }
 
 static void
@@ -602,50 +966,37 @@ done:
         dbus_message_unref (msg);
 }
 
-static gchar*
-get_object_name (const char *obj_path)
+// The name of a new entry is asked for when it is one of the subscribed
+// streams not found yet. The entry is added once the name is known.
+static void
+lookup_object_name (const char *obj_path)
 {
-    DBusMessage     *msg         = NULL;
-    DBusMessage     *reply       = NULL;
-    const gchar     *stream_name = NULL;
-    gchar           *ret         = NULL;
-    const gchar     *iface       = STREAM_ENTRY_IF;
-    const gchar     *addr        = "Name";
-    DBusError        error;
-    DBusMessageIter  iter;
-    DBusMessageIter  sub;
-    int              current_type;
+    VolumeCall *call = NULL;
 
     g_assert (volume_bus);
     g_assert (obj_path);
 
-    dbus_error_init (&error);
-
-    msg = dbus_message_new_method_call(STREAM_ENTRY_IF,
-                                       obj_path,
-                                       DBUS_PROPERTIES_IF,
-                                       "Get");
-
-    if (msg == NULL)
-        goto done;
-
-    if (!dbus_message_append_args(msg,
-                                  DBUS_TYPE_STRING, &iface,
-                                  DBUS_TYPE_STRING, &addr,
-                                  DBUS_TYPE_INVALID))
-        goto done;
+    call = g_slice_new0 (VolumeCall);
+    call->name = g_strdup (obj_path);
+    call->obj_path = g_strdup (obj_path);
 
-    reply = dbus_connection_send_with_reply_and_block (volume_bus,
-                                                       msg, -1, &error);
+    if (!volume_call_send (call, new_property_get (obj_path, "Name"), object_name_reply_cb))
+        volume_call_free (call);
+}
 
-    if (!reply) {
-        if (dbus_error_is_set (&error)) {
-            N_WARNING (LOG_CAT "couldn't get object name for %s: %s",
-                       obj_path, error.message);
-        }
+static void
+object_name_reply_cb (DBusPendingCall *pending, void *data)
+{
+    VolumeCall      *call        = (VolumeCall*) data;
+    SubscribeItem   *item        = NULL;
+    DBusMessage     *reply       = NULL;
+    const gchar     *stream_name = NULL;
+    DBusMessageIter  iter;
+    DBusMessageIter  sub;
+    int              current_type;
 
+    if (!(reply = volume_call_finish (call, pending, "object name")))
         goto done;
-    }
 
     dbus_message_iter_init(reply, &iter);
 
@@ -670,49 +1021,77 @@ get_object_name (const char *obj_path)
         goto done;
     }
 
-    ret = g_strdup (stream_name);
+    // the entry may have been found some other way meanwhile
+    if (!object_map_complete && !g_hash_table_lookup (object_map, call->obj_path) &&
+        (item = g_hash_table_lookup (subscribe_map, stream_name))) {
+        set_object_path (item, call->obj_path);
+        N_DEBUG (LOG_CAT "stream restore entry for %s appeared (%s)", item->stream_name, item->object_path);
+        update_object_map_listen ();
+    }
 
 done:
-    dbus_error_free (&error);
-
-    if (reply) dbus_message_unref (reply);
-    if (msg)   dbus_message_unref (msg);
-
-    return ret;
+    if (reply)
+        dbus_message_unref (reply);
+    volume_call_free (call);
 }
 
-static gchar*
-get_object_path (const char *stream_name)
+static void
+lookup_object_path (SubscribeItem *item)
 {
-    DBusMessage     *msg     = NULL;
-    DBusMessage     *reply   = NULL;
-    const gchar     *obj_path= NULL;
-    gchar           *ret     = NULL;
-    DBusError        error;
+    DBusMessage *msg = NULL;
 
     g_assert (volume_bus);
-    g_assert (stream_name);
+    g_assert (item->lookup == NULL);
 
-    dbus_error_init (&error);
     msg = dbus_message_new_method_call (NULL,
                                         STREAM_RESTORE_PATH,
                                         STREAM_RESTORE_IF,
                                         "GetEntryByName");
 
     if (msg == NULL)
+        return;
+
+    dbus_message_append_args (msg, DBUS_TYPE_STRING, &item->stream_name, DBUS_TYPE_INVALID);
+
+    if (!dbus_connection_send_with_reply (volume_bus, msg, &item->lookup, LOOKUP_TIMEOUT) ||
+        !item->lookup)
         goto done;
 
-    dbus_message_append_args (msg, DBUS_TYPE_STRING, &stream_name, DBUS_TYPE_INVALID);
+    if (!dbus_pending_call_set_notify (item->lookup, lookup_object_path_reply_cb, item, NULL)) {
+        cancel_lookup (item);
+        goto done;
+    }
 
-    reply = dbus_connection_send_with_reply_and_block (volume_bus,
-                                                       msg, -1, &error);
+    pending_lookups++;
 
-    if (!reply) {
-        if (dbus_error_is_set (&error)) {
-            N_DEBUG (LOG_CAT "couldn't get object path for %s: %s",
-                     stream_name, error.message);
-        }
+done:
+    dbus_message_unref (msg);
+}
+
+static void
+lookup_object_path_reply_cb (DBusPendingCall *pending, void *data)
+{
+    SubscribeItem *item     = (SubscribeItem*) data;
+    DBusMessage   *reply    = NULL;
+    const gchar   *obj_path = NULL;
+    gboolean       cached   = item->cached_path;
+    DBusError      error;
 
+    dbus_error_init (&error);
+
+    g_assert (item->lookup == pending);
+    item->lookup = NULL;
+    pending_lookups--;
+
+    reply = dbus_pending_call_steal_reply (pending);
+    dbus_pending_call_unref (pending);
+
+    if (!reply)
+        goto done;
+
+    if (dbus_set_error_from_message (&error, reply)) {
+        N_DEBUG (LOG_CAT "couldn't get object path for %s: %s",
+                 item->stream_name, error.message);
         goto done;
     }
 
@@ -721,24 +1100,93 @@ get_object_path (const char *stream_name)
         goto done;
     }
 
-    ret = g_strdup (obj_path);
+    // the entry may have appeared while the lookup was in progress, a path
+    // from the state file is replaced if PulseAudio has another one now
+    if (item->cached_path && g_strcmp0 (item->object_path, obj_path) == 0) {
+        item->cached_path = FALSE;
+        cached = FALSE;
+    } else if (!item->object_path || item->cached_path) {
+        set_object_path (item, obj_path);
+        N_DEBUG (LOG_CAT "stream restore entry for %s found (%s)", item->stream_name, item->object_path);
+        lookups_found = TRUE;
+        cached = FALSE;
+    }
 
 done:
+    // the entry of a cached path is gone
+    if (cached && item->cached_path) {
+        N_DEBUG (LOG_CAT "cached stream restore entry for %s is gone", item->stream_name);
+        set_object_path (item, NULL);
+        lookups_found = TRUE;
+    }
+
     dbus_error_free (&error);
 
-    if (reply) dbus_message_unref (reply);
-    if (msg)   dbus_message_unref (msg);
+    if (reply)
+        dbus_message_unref (reply);
+
+    if (pending_lookups == 0 && lookups_found) {
+        lookups_found = FALSE;
+        listen_object_map ();
+    }
+}
+
+static void
+cancel_lookup (SubscribeItem *item)
+{
+    if (!item->lookup)
+        return;
+
+    dbus_pending_call_cancel (item->lookup);
+    dbus_pending_call_unref (item->lookup);
+    item->lookup = NULL;
+}
+
+static void
+cancel_lookups ()
+{
+    GHashTableIter iter;
+    SubscribeItem *item = NULL;
+
+    if (!subscribe_map)
+        return;
+
+    g_hash_table_iter_init (&iter, subscribe_map);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &item))
+        cancel_lookup (item);
 
-    return ret;
+    pending_lookups = 0;
 }
 
-// Tries to update all items from subscribe_map to object_map, and after this
-// listens for stream restore entry signals coming from entries with object paths
-// in object_map.
+// Starts looking up the object paths of the items in subscribe_map not in
+// object_map yet or only known from the state file, and listens for the
+// entries known already. The lookups are
+// asynchronous, the listening is updated again once they have returned.
+static void
+update_object_map_listen ()
+{
+    GHashTableIter iter;
+    SubscribeItem *item = NULL;
+
+    if (!volume_bus || !subscribe_map || !object_map)
+        return;
+
+    g_hash_table_iter_init (&iter, subscribe_map);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &item)) {
+        if ((!item->object_path || item->cached_path) && !item->lookup)
+            lookup_object_path (item);
+    }
+
+    listen_object_map ();
+}
+
+// Updates all items from subscribe_map with a known object path to object_map,
+// and after this listens for stream restore entry signals coming from entries
+// with object paths in object_map.
 // If object_map is incomplete (doesn't contain all items from subscribe_map), then
 // object_map_complete is FALSE.
 static void
-update_object_map_listen ()
+listen_object_map ()
 {
     const char **obj_paths;
     GList *subscription_items, *i;
@@ -753,8 +1201,6 @@ update_object_map_listen ()
 
     for (i = g_list_first (subscription_items); i; i = g_list_next (i)) {
         SubscribeItem *item = (SubscribeItem*) i->data;
-        if (!item->object_path)
-            item->object_path = get_object_path (item->stream_name);
         if (item->object_path) {
             g_hash_table_insert (object_map, item->object_path, item);
             obj_paths[j++] = item->object_path;
@@ -788,14 +1234,14 @@ process_queued_ops ()
         queue_subscribe = FALSE;
     }
 
+    /* apply the writes before gets, to be up to date with get values */
+    flush_volume_writes ();
+
     while ((op = g_queue_pop_head (volume_queue)) != NULL) {
         N_DEBUG (LOG_CAT "processing queued volume for role:%s type:%u volume:%d ",
                          op->role, op->type, op->volume);
 
         switch (op->type) {
-            case QUEUE_ITEM_TYPE_SET:
-                add_entry (op->role, op->volume);
-                break;
             case QUEUE_ITEM_TYPE_GET:
                 get_entry_volume (op->role);
                 break;
@@ -929,17 +1375,24 @@ disconnect_from_pulseaudio ()
     }
 
     if (volume_bus) {
+        cancel_lookups ();
+        cancel_volume_calls ();
         dbus_connection_unref (volume_bus);
         volume_bus = NULL;
     }
 }
 
 int
-volume_controller_initialize ()
+volume_controller_initialize (const char *path)
 {
     if ((volume_queue = g_queue_new ()) == NULL)
         return FALSE;
 
+    state_file = g_strdup (path);
+    state_load ();
+
+    volume_writes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
     volume_pulse_address = NULL;
 
     connect_to_pulseaudio();
@@ -950,6 +1403,11 @@ volume_controller_initialize ()
 void
 volume_controller_shutdown ()
 {
+    /* send the writes still in the window */
+    flush_volume_writes ();
+    if (volume_bus)
+        dbus_connection_flush (volume_bus);
+
     disconnect_from_pulseaudio ();
 
     if (volume_queue) {
@@ -957,6 +1415,16 @@ volume_controller_shutdown ()
         volume_queue = NULL;
     }
 
+    if (volume_write_id > 0) {
+        g_source_remove (volume_write_id);
+        volume_write_id = 0;
+    }
+
+    if (volume_writes) {
+        g_hash_table_destroy (volume_writes);
+        volume_writes = NULL;
+    }
+
     if (volume_session_bus) {
         dbus_connection_unref(volume_session_bus);
         volume_session_bus = NULL;
@@ -966,6 +1434,15 @@ volume_controller_shutdown ()
         g_free(volume_pulse_address);
         volume_pulse_address = NULL;
     }
+
+    if (state) {
+        state_save ();
+        g_key_file_free (state);
+        state = NULL;
+    }
+
+    g_free (state_file);
+    state_file = NULL;
 }
 
 static void
@@ -973,45 +1450,54 @@ queue_op (const char *role, guint type, int volume)
 {
     QueueItem *item = NULL;
 
-    N_DEBUG (LOG_CAT "queueing op type: %s role: '%s' volume: '%d'",
-                     type == QUEUE_ITEM_TYPE_SET ? "SET" : "GET", role, volume);
+    N_DEBUG (LOG_CAT "queueing op type: GET role: '%s' volume: '%d'",
+                     role, volume);
 
     item = g_slice_new0 (QueueItem);
     item->role   = g_strdup (role);
     item->type   = type;
     item->volume = volume;
-    /* apply set ops before gets, to be up to date with get values */
-    if (type == QUEUE_ITEM_TYPE_SET)
-        g_queue_push_head (volume_queue, item);
-    else
-        g_queue_push_tail (volume_queue, item);
+    g_queue_push_tail (volume_queue, item);
 }
 
 int
 volume_controller_update (const char *role, int volume)
 {
-    if (!role)
+    if (!role || !volume_writes)
         return FALSE;
 
-    if (!volume_bus) {
-        queue_op (role, QUEUE_ITEM_TYPE_SET, volume);
-        return TRUE;
-    }
+    /* updates of a role within the write window replace each other, the
+       writes are sent when the window passes or once connected. */
+    g_hash_table_replace (volume_writes, g_strdup (role), GINT_TO_POINTER (volume));
+
+    if (volume_bus && volume_write_id == 0)
+        volume_write_id = g_timeout_add (WRITE_WINDOW, write_timeout_cb, NULL);
 
-    return add_entry (role, volume);
+    return TRUE;
 }
 
 void
 volume_controller_get_volume (const char *role)
 {
+    SubscribeItem *item = NULL;
+
     if (!role)
         return;
 
     if (!volume_bus) {
+        // use the last known volume until the real one can be read
+        if (state && subscribe_map &&
+            (item = g_hash_table_lookup (subscribe_map, role)) &&
+            g_key_file_has_key (state, STATE_VOLUME_GROUP, role, NULL)) {
+            N_DEBUG (LOG_CAT "using cached volume for stream %s", role);
+            notify_volume (item, g_key_file_get_integer (state, STATE_VOLUME_GROUP, role, NULL));
+        }
+
         queue_op (role, QUEUE_ITEM_TYPE_GET, 0);
         return;
     }
 
+    flush_volume_writes ();
     get_entry_volume (role);
 }
 
@@ -1019,6 +1505,10 @@ void
 subscribe_item_free (SubscribeItem *item)
 {
     if (item) {
+        if (item->lookup) {
+            cancel_lookup (item);
+            pending_lookups--;
+        }
         if (item->stream_name)
             g_free (item->stream_name);
         if (item->object_path)
@@ -1046,6 +1536,12 @@ volume_controller_subscribe  (const char *stream_name, void *data)
     item->stream_name = g_strdup (stream_name);
     item->data = data;
 
+    // the object path from the last run is most likely still valid, it is
+    // used right away and verified once connected
+    if (state && (item->object_path = g_key_file_get_string (state, STATE_OBJECT_PATH_GROUP,
+                                                             stream_name, NULL)))
+        item->cached_path = TRUE;
+
     g_hash_table_insert (subscribe_map, item->stream_name, item);
 
     if (first && volume_bus) {
@@ -32,7 +32,10 @@ typedef void (*volume_controller_subscribe_cb) (const char *stream_name, int vol
 // Called when media state changes
 typedef void (*media_state_subscribe_cb) (const char *media_state, void *userdata);
 
-int  volume_controller_initialize ();
+// Initializes the volume controller.
+// state_file       file for keeping the last known volumes and object paths
+//                  between runs, NULL to not keep them
+int  volume_controller_initialize (const char *state_file);
 void volume_controller_shutdown   ();
 int  volume_controller_update     (const char *role, int volume);
 void volume_controller_get_volume (const char *role);
@@ -24,12 +24,17 @@ USA.
 #include <string.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <ngf/log.h>
 #include <trace/trace.h>
 
 #include "stream.h"
 #include "ausrv.h"
+#include "dtmf.h"
 
 #if PA_API_VERSION < 9
 #error Invalid PulseAudio API version
@@ -47,8 +52,17 @@ static void event_callback(pa_context *, pa_subscription_event_type_t,
 static void connect_server(struct ausrv *);
 static void restart_timer(struct ausrv *, int);
 static void cancel_timer(struct ausrv *);
+static bool start_audio_thread(struct ausrv *);
+static void command_callback(pa_mainloop_api *, pa_io_event *, int,
+                             pa_io_event_flags_t, void *);
+static void run_commands(struct ausrv *);
+static bool hold_stop(struct ausrv *, struct ausrv_command *);
+static void run_stops(struct ausrv *);
+static void set_realtime(pa_mainloop_api *, void *);
 
 static const char *pa_client_name = "ngf-tonegen-plugin";
+static bool        audio_thread   = false;
+static int         rt_priority    = 0;
 
 
 int ausrv_init(void)
@@ -60,6 +74,12 @@ void ausrv_exit(void)
 {
 }
 
+void ausrv_set_audio_thread(bool enable, int priority)
+{
+    audio_thread = enable;
+    rt_priority  = priority;
+}
+
 struct ausrv *ausrv_create(struct tonegend *tonegend, const char *server)
 {
     pa_glib_mainloop   *mainloop = NULL;
@@ -71,12 +91,25 @@ struct ausrv *ausrv_create(struct tonegend *tonegend, const char *server)
         goto failed;
     }
 
-    if ((mainloop = pa_glib_mainloop_new(NULL)) == NULL) {
-        N_ERROR(LOG_CAT "%s(): pa_glib_mainloop_new() failed", __FUNCTION__);
-        goto failed;
+    ausrv->queue.wakeup[0] = ausrv->queue.wakeup[1] = -1;
+
+    if (audio_thread) {
+        if ((ausrv->thread = pa_threaded_mainloop_new()) == NULL) {
+            N_ERROR(LOG_CAT "%s(): pa_threaded_mainloop_new() failed",
+                    __FUNCTION__);
+            goto failed;
+        }
+
+        mainloop_api = pa_threaded_mainloop_get_api(ausrv->thread);
     }
+    else {
+        if ((mainloop = pa_glib_mainloop_new(NULL)) == NULL) {
+            N_ERROR(LOG_CAT "%s(): pa_glib_mainloop_new() failed", __FUNCTION__);
+            goto failed;
+        }
 
-    mainloop_api = pa_glib_mainloop_get_api(mainloop);
+        mainloop_api = pa_glib_mainloop_get_api(mainloop);
+    }
 
     if (pa_signal_init(mainloop_api) < 0) {
         N_ERROR(LOG_CAT "%s(): pa_signal_init() failed", __FUNCTION__);
@@ -86,17 +119,29 @@ struct ausrv *ausrv_create(struct tonegend *tonegend, const char *server)
     ausrv->tonegend = tonegend;
     ausrv->server   = strdup(server ?: DEFAULT_SERVER);
     ausrv->mainloop = mainloop;
+    ausrv->api      = mainloop_api;
 
     connect_server(ausrv);
 
+    if (ausrv->thread != NULL && !start_audio_thread(ausrv))
+        goto failed;
+
     return ausrv;
 
  failed:
     if (mainloop != NULL)
         pa_glib_mainloop_free(mainloop);
 
-    if (ausrv != NULL)
+    if (ausrv != NULL) {
+        if (ausrv->thread != NULL) {
+            if (ausrv->context != NULL)
+                pa_context_unref(ausrv->context);
+            pa_threaded_mainloop_free(ausrv->thread);
+        }
+
+        free(ausrv->server);
         free(ausrv);
+    }
 
     return NULL;
 
@@ -105,7 +150,20 @@ struct ausrv *ausrv_create(struct tonegend *tonegend, const char *server)
 void ausrv_destroy(struct ausrv *ausrv)
 {
     if (ausrv != NULL) {
+        if (ausrv->thread != NULL) {
+            /* from here on everything runs in the calling thread */
+            pa_threaded_mainloop_stop(ausrv->thread);
+            run_commands(ausrv);
+
+            if (ausrv->queue.event != NULL)
+                ausrv->api->io_free(ausrv->queue.event);
+
+            close(ausrv->queue.wakeup[0]);
+            close(ausrv->queue.wakeup[1]);
+        }
+
         stream_kill_all(ausrv);
+        dtmf_cancel_muting(ausrv);
 
         if (ausrv->context != NULL)
             pa_context_unref(ausrv->context);
@@ -113,11 +171,230 @@ void ausrv_destroy(struct ausrv *ausrv)
         if (ausrv->mainloop != NULL)
             pa_glib_mainloop_free(ausrv->mainloop);
 
+        if (ausrv->thread != NULL)
+            pa_threaded_mainloop_free(ausrv->thread);
+
         free(ausrv->server);
         free(ausrv);
     }
 }
 
+/*
+ * Runs the command right away when the streams belong to the calling
+ * thread. Otherwise the command is put on a single producer, single
+ * consumer ring and the audio thread is woken up through a pipe, so the
+ * caller never waits on the audio thread nor the other way round.
+ *
+ * A full ring drops the command and returns false, except for stops,
+ * which are held back and run once the ring is drained. Until then
+ * every other command is dropped too, so none overtakes the stops.
+ */
+bool ausrv_submit(struct ausrv *ausrv, struct ausrv_command *cmd)
+{
+    gint  head;
+    gint  tail;
+    char  byte = 0;
+
+    if (ausrv->thread == NULL ||
+        pa_threaded_mainloop_in_thread(ausrv->thread))
+    {
+        cmd->func(ausrv, cmd);
+        free(cmd->properties);
+        free(cmd->sequence);
+        return true;
+    }
+
+    head = g_atomic_int_get(&ausrv->queue.head);
+    tail = g_atomic_int_get(&ausrv->queue.tail);
+
+    if ((guint)(tail - head) >= AUSRV_QUEUE_SIZE ||
+        g_atomic_int_get(&ausrv->queue.nstop) > 0)
+    {
+        if (!cmd->stop || !hold_stop(ausrv, cmd)) {
+            N_ERROR(LOG_CAT "%s(): command queue is full", __FUNCTION__);
+            free(cmd->properties);
+            free(cmd->sequence);
+            return false;
+        }
+    }
+    else {
+        ausrv->queue.cmds[tail & (AUSRV_QUEUE_SIZE - 1)] = *cmd;
+        g_atomic_int_set(&ausrv->queue.tail, tail + 1);
+    }
+
+    if (write(ausrv->queue.wakeup[1], &byte, 1) < 0 && errno != EAGAIN)
+        N_ERROR(LOG_CAT "%s(): can't wake up audio thread: %s",
+                __FUNCTION__, strerror(errno));
+
+    return true;
+}
+
+/*
+ * Keep a stop for after the ring. The stops commute, so a stop already
+ * held back is not kept twice, and the few distinct ones always fit.
+ */
+static bool hold_stop(struct ausrv *ausrv, struct ausrv_command *cmd)
+{
+    struct ausrv_command *held;
+    gint                  nstop;
+    gint                  i;
+
+    do {
+        nstop = g_atomic_int_get(&ausrv->queue.nstop);
+
+        for (i = 0;  i < nstop;  i++) {
+            held = &ausrv->queue.stops[i];
+
+            if (held->func == cmd->func && held->flag == cmd->flag) {
+                free(cmd->properties);
+                free(cmd->sequence);
+                return true;
+            }
+        }
+
+        if (nstop >= AUSRV_STOP_SLOTS)
+            return false;
+
+        ausrv->queue.stops[nstop] = *cmd;
+
+        /* fails if the audio thread ran the held stops meanwhile */
+    } while (!g_atomic_int_compare_and_exchange(&ausrv->queue.nstop,
+                                                nstop, nstop + 1));
+
+    return true;
+}
+
+bool ausrv_in_audio_thread(struct ausrv *ausrv)
+{
+    return ausrv != NULL && ausrv->thread != NULL &&
+           pa_threaded_mainloop_in_thread(ausrv->thread);
+}
+
+
+static bool start_audio_thread(struct ausrv *ausrv)
+{
+    pa_mainloop_api *api = ausrv->api;
+
+    if (pipe(ausrv->queue.wakeup) < 0) {
+        N_ERROR(LOG_CAT "%s(): pipe() failed: %s", __FUNCTION__,
+                strerror(errno));
+        return false;
+    }
+
+    fcntl(ausrv->queue.wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl(ausrv->queue.wakeup[1], F_SETFL, O_NONBLOCK);
+    fcntl(ausrv->queue.wakeup[0], F_SETFD, FD_CLOEXEC);
+    fcntl(ausrv->queue.wakeup[1], F_SETFD, FD_CLOEXEC);
+
+    ausrv->queue.event = api->io_new(api, ausrv->queue.wakeup[0],
+                                     PA_IO_EVENT_INPUT, command_callback,
+                                     (void *)ausrv);
+
+    if (rt_priority > 0)
+        pa_mainloop_api_once(api, set_realtime, (void *)ausrv);
+
+    if (ausrv->queue.event == NULL ||
+        pa_threaded_mainloop_start(ausrv->thread) < 0)
+    {
+        N_ERROR(LOG_CAT "%s(): can't start audio thread", __FUNCTION__);
+
+        if (ausrv->queue.event != NULL)
+            api->io_free(ausrv->queue.event);
+
+        close(ausrv->queue.wakeup[0]);
+        close(ausrv->queue.wakeup[1]);
+
+        return false;
+    }
+
+    N_DEBUG(LOG_CAT "audio thread started");
+
+    return true;
+}
+
+static void set_realtime(pa_mainloop_api *api, void *data)
+{
+    struct sched_param param;
+    int                err;
+
+    (void)api;
+    (void)data;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = rt_priority;
+
+    if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)))
+        N_WARNING(LOG_CAT "can't set SCHED_FIFO priority %d for audio "
+                  "thread: %s", rt_priority, strerror(err));
+    else
+        N_DEBUG(LOG_CAT "audio thread runs with SCHED_FIFO priority %d",
+                rt_priority);
+}
+
+static void command_callback(pa_mainloop_api *api, pa_io_event *event,
+                             int fd, pa_io_event_flags_t flags, void *data)
+{
+    struct ausrv *ausrv = (struct ausrv *)data;
+    char          buf[64];
+
+    (void)api;
+    (void)event;
+    (void)flags;
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+
+    run_commands(ausrv);
+}
+
+static void run_commands(struct ausrv *ausrv)
+{
+    struct ausrv_command *cmd;
+    gint                  head;
+
+    head = g_atomic_int_get(&ausrv->queue.head);
+
+    while (head != g_atomic_int_get(&ausrv->queue.tail)) {
+        cmd = &ausrv->queue.cmds[head & (AUSRV_QUEUE_SIZE - 1)];
+
+        cmd->func(ausrv, cmd);
+        free(cmd->properties);
+        free(cmd->sequence);
+
+        g_atomic_int_set(&ausrv->queue.head, ++head);
+    }
+
+    run_stops(ausrv);
+}
+
+/* runs the stops held back while the ring was full, after the ring */
+static void run_stops(struct ausrv *ausrv)
+{
+    struct ausrv_command *cmd;
+    gint                  done = 0;
+    gint                  nstop;
+
+    for (;;) {
+        nstop = g_atomic_int_get(&ausrv->queue.nstop);
+
+        if (nstop == done) {
+            /* the main thread may have held back one more meanwhile */
+            if (!nstop || g_atomic_int_compare_and_exchange(&ausrv->queue.nstop,
+                                                            nstop, 0))
+                return;
+            continue;
+        }
+
+        while (done < nstop) {
+            cmd = &ausrv->queue.stops[done++];
+
+            cmd->func(ausrv, cmd);
+            free(cmd->properties);
+            free(cmd->sequence);
+        }
+    }
+}
+
 
 static void set_connection_status(struct ausrv *ausrv, bool connected)
 {
@@ -164,6 +441,7 @@ static void context_callback(pa_context *context, void *userdata)
         TRACE("ausrv: connection established.");
         set_connection_status(ausrv, true);
         cancel_timer(ausrv);
+        stream_query_native_format(ausrv);
         N_DEBUG(LOG_CAT "PulseAudio OK");
         break;
 
@@ -247,7 +525,7 @@ static void retry_connect(pa_mainloop_api *api, pa_time_event *event,
 
 static void restart_timer(struct ausrv *ausrv, int secs)
 {
-    pa_mainloop_api *api = pa_glib_mainloop_get_api(ausrv->mainloop);
+    pa_mainloop_api *api = ausrv->api;
     struct timeval   tv;
 
     gettimeofday(&tv, NULL);
@@ -265,7 +543,7 @@ static void cancel_timer(struct ausrv *ausrv)
     pa_mainloop_api *api;
 
     if (ausrv->timer != NULL) {
-        api = pa_glib_mainloop_get_api(ausrv->mainloop);
+        api = ausrv->api;
         api->time_free(ausrv->timer);
         ausrv->timer = NULL;
     }
@@ -274,7 +552,7 @@ static void cancel_timer(struct ausrv *ausrv)
 
 static void connect_server(struct ausrv *ausrv)
 {
-    pa_mainloop_api *api    = pa_glib_mainloop_get_api(ausrv->mainloop);
+    pa_mainloop_api *api    = ausrv->api;
     char            *server = ausrv->server;
 
     cancel_timer(ausrv);
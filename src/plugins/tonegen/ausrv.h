@@ -29,26 +29,63 @@ USA.
 #include <pulse/pulseaudio.h>
 #include <pulse/glib-mainloop.h>
 
+#define AUSRV_QUEUE_SIZE  64  /* must be a power of two */
+#define AUSRV_STOP_SLOTS  4   /* distinct stop commands, kept when full */
+
 struct tonegend;
 struct stream;
+struct ausrv;
+struct ausrv_command;
+
+typedef void (*ausrv_command_func)(struct ausrv *, struct ausrv_command *);
+
+/*
+ * A control request for the streams. With an audio thread the streams
+ * belong to that thread and requests made elsewhere are queued to it.
+ */
+struct ausrv_command {
+    ausrv_command_func  func;
+    int                 type;       /* tone or indicator type */
+    uint32_t            volume;
+    int                 duration;
+    bool                flag;
+    char               *properties; /* freed after the command ran */
+    char               *sequence;   /* DTMF keys, freed likewise */
+    int                 gap;        /* between the keys of a sequence */
+    bool                stop;       /* never dropped, even if the queue is full */
+};
 
 struct ausrv {
-    struct tonegend   *tonegend;
-    char              *server;
-    bool               connected;
-    pa_glib_mainloop  *mainloop;
-    pa_context        *context;
-    pa_time_event     *timer;
-    int                nextid;
-    struct stream     *streams;
+    struct tonegend      *tonegend;
+    char                 *server;
+    bool                  connected;
+    pa_glib_mainloop     *mainloop;
+    pa_threaded_mainloop *thread;   /* audio thread, if enabled */
+    pa_mainloop_api      *api;
+    pa_context           *context;
+    pa_time_event        *timer;
+    int                   nextid;
+    struct stream        *streams;
+    struct {
+        struct ausrv_command  cmds[AUSRV_QUEUE_SIZE];
+        volatile gint         head;     /* written by the audio thread */
+        volatile gint         tail;     /* written by the main thread */
+        struct ausrv_command  stops[AUSRV_STOP_SLOTS];
+        volatile gint         nstop;    /* stops held back while full */
+        int                   wakeup[2];
+        pa_io_event          *event;
+    }                     queue;
 };
 
 
 int ausrv_init(void);
 void ausrv_exit(void);
+void ausrv_set_audio_thread(bool enable, int priority);
 
 struct ausrv *ausrv_create(struct tonegend *tonegend, const char *server);
 void ausrv_destroy(struct ausrv *ausrv);
+bool ausrv_submit(struct ausrv *ausrv, struct ausrv_command *cmd);
+bool ausrv_in_audio_thread(struct ausrv *ausrv);
 
 
 #endif /* __TONEGEND_AUSRV_H__ */
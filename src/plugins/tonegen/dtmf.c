@@ -69,9 +69,33 @@ static void   *dtmf_props  = NULL;
 static int     vol_scale   = 100;
 static bool    mute        = false;
 static guint   tmute_id;
+static GMutex  mute_lock;
+static GQueue  mute_queue = G_QUEUE_INIT;
+static guint   mute_idle_id;
 
 
+typedef enum {
+    MUTE_START,         /* mute and stop the release timer */
+    MUTE_RELEASE_LATER, /* release after a while */
+    MUTE_RELEASE,       /* release now */
+} mute_change;
+
+struct mute_request {
+    struct ausrv  *ausrv;
+    mute_change    change;
+};
+
+static struct stream *get_stream(struct ausrv *, const char *);
+static void start_dtmf(struct ausrv *, dtmf_tone, uint32_t, int, const char *);
+static void start_sequence(struct ausrv *, const char *, uint32_t, int, int, const char *);
+static void stop_dtmf(struct ausrv *, bool);
+static void play_command(struct ausrv *, struct ausrv_command *);
+static void sequence_command(struct ausrv *, struct ausrv_command *);
+static void stop_command(struct ausrv *, struct ausrv_command *);
 static void destroy_callback(void *);
+static void change_muting(struct ausrv *, mute_change);
+static gboolean run_muting_callback(gpointer);
+static void apply_muting(struct mute_request *);
 static void set_mute_timeout(struct ausrv *, guint);
 static gboolean mute_timeout_callback(gpointer);
 static void request_muting(struct ausrv *ausrv, bool new_mute);
@@ -83,7 +107,146 @@ int dtmf_init(void)
     return 0;
 }
 
-void dtmf_play(struct ausrv *ausrv, dtmf_tone tone, uint32_t volume, int duration, const char *extra_properties)
+/*
+ * build the wave tables up front so the first key press starts at once,
+ * the tables of a rate the stream no longer uses may be dropped
+ */
+void dtmf_prepare(uint32_t rate)
+{
+    static uint32_t prepared_rate;
+    int             i;
+
+    if (rate == prepared_rate)
+        return;
+
+    for (i = 0;  i < DTMF_MAX;  i++) {
+        if (prepared_rate) {
+            tone_release_table(dtmf_defs[i].low_freq, prepared_rate);
+            tone_release_table(dtmf_defs[i].high_freq, prepared_rate);
+        }
+
+        tone_prepare_table(dtmf_defs[i].low_freq, rate);
+        tone_prepare_table(dtmf_defs[i].high_freq, rate);
+    }
+
+    prepared_rate = rate;
+}
+
+bool dtmf_play(struct ausrv *ausrv, dtmf_tone tone, uint32_t volume, int duration, const char *extra_properties)
+{
+    struct ausrv_command cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.func       = play_command;
+    cmd.type       = tone;
+    cmd.volume     = volume;
+    cmd.duration   = duration;
+    cmd.properties = extra_properties ? strdup(extra_properties) : NULL;
+
+    return ausrv_submit(ausrv, &cmd);
+}
+
+/*
+ * Play the keys of a digit string one after another in the DTMF stream.
+ * The keys are chained so every key starts a gap after the end of the
+ * previous one on the sample clock of the stream, no matter when the
+ * main loop gets to run.
+ */
+bool dtmf_play_sequence(struct ausrv *ausrv, const char *sequence, uint32_t volume,
+                        int duration, int gap, const char *extra_properties)
+{
+    struct ausrv_command cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.func       = sequence_command;
+    cmd.volume     = volume;
+    cmd.duration   = duration;
+    cmd.gap        = gap;
+    cmd.sequence   = strdup(sequence);
+    cmd.properties = extra_properties ? strdup(extra_properties) : NULL;
+
+    return ausrv_submit(ausrv, &cmd);
+}
+
+void dtmf_stop(struct ausrv *ausrv)
+{
+    struct ausrv_command cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.func = stop_command;
+    cmd.stop = true;
+
+    ausrv_submit(ausrv, &cmd);
+}
+
+/* stops the keys of the sequences, the other DTMF tones are kept */
+void dtmf_stop_sequence(struct ausrv *ausrv)
+{
+    struct ausrv_command cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.func = stop_command;
+    cmd.flag = true;
+    cmd.stop = true;
+
+    ausrv_submit(ausrv, &cmd);
+}
+
+dtmf_tone dtmf_tone_from_symbol(char symbol)
+{
+    int i;
+
+    if (symbol >= 'a' && symbol <= 'd')
+        symbol -= 'a' - 'A';
+
+    for (i = 0;  i < DTMF_MAX;  i++) {
+        if (dtmf_defs[i].symbol == symbol)
+            return (dtmf_tone)i;
+    }
+
+    return DTMF_MAX;
+}
+
+static void play_command(struct ausrv *ausrv, struct ausrv_command *cmd)
+{
+    start_dtmf(ausrv, cmd->type, cmd->volume, cmd->duration, cmd->properties);
+}
+
+static void sequence_command(struct ausrv *ausrv, struct ausrv_command *cmd)
+{
+    start_sequence(ausrv, cmd->sequence, cmd->volume, cmd->duration, cmd->gap,
+                   cmd->properties);
+}
+
+static void stop_command(struct ausrv *ausrv, struct ausrv_command *cmd)
+{
+    stop_dtmf(ausrv, cmd->flag);
+}
+
+static struct stream *get_stream(struct ausrv *ausrv, const char *extra_properties)
+{
+    struct stream *stream;
+    void          *properties = dtmf_props;
+
+    if (extra_properties)
+        properties = stream_merge_properties(dtmf_props, extra_properties);
+
+    stream = stream_create(ausrv, dtmf_stream, NULL, 0,
+                           tone_write_callback,
+                           destroy_callback,
+                           properties,
+                           NULL);
+
+    if (extra_properties)
+        stream_free_properties(properties);
+
+    if (stream == NULL)
+        N_ERROR(LOG_CAT "%s(): Can't create stream", __FUNCTION__);
+
+    return stream;
+}
+
+static void start_dtmf(struct ausrv *ausrv, dtmf_tone tone, uint32_t volume, int duration, const char *extra_properties)
 {
     struct stream *stream = stream_find(ausrv, dtmf_stream);
     struct dtmf   *dtmf   = dtmf_defs + tone;
@@ -92,7 +255,6 @@ void dtmf_play(struct ausrv *ausrv, dtmf_tone tone, uint32_t volume, int duratio
     int            type_l = TONE_DTMF_L;
     int            type_h = TONE_DTMF_H;
     uint32_t       timeout;
-    void          *properties = dtmf_props;
 
     if (tone >= DTMF_MAX || (duration != 0 && duration < 10000))
         return;
@@ -109,29 +271,15 @@ void dtmf_play(struct ausrv *ausrv, dtmf_tone tone, uint32_t volume, int duratio
     }
 
     if (stream != NULL) {
+        stream_resume(stream);
+
         if (!duration) {
             indicator_stop(ausrv, true);
-            dtmf_stop(ausrv);
-        }
-    }
-    else {
-        if (extra_properties)
-            properties = stream_merge_properties(dtmf_props, extra_properties);
-
-        stream = stream_create(ausrv, dtmf_stream, NULL, 0,
-                               tone_write_callback,
-                               destroy_callback,
-                               properties,
-                               NULL);
-
-        if (extra_properties)
-            stream_free_properties(properties);
-
-        if (stream == NULL) {
-            N_ERROR(LOG_CAT "%s(): Can't create stream", __FUNCTION__);
-            return;
+            stop_dtmf(ausrv, false);
         }
     }
+    else if ((stream = get_stream(ausrv, extra_properties)) == NULL)
+        return;
 
     volume = (vol_scale * volume) / 100;
 
@@ -142,11 +290,57 @@ void dtmf_play(struct ausrv *ausrv, dtmf_tone tone, uint32_t volume, int duratio
 
     stream_set_timeout(stream, timeout);
 
-    request_muting(ausrv, true);
-    set_mute_timeout(ausrv, 0);
+    change_muting(ausrv, MUTE_START);
 }
 
-void dtmf_stop(struct ausrv *ausrv)
+static void start_sequence(struct ausrv *ausrv, const char *sequence, uint32_t volume,
+                           int duration, int gap, const char *extra_properties)
+{
+    struct stream *stream = stream_find(ausrv, dtmf_stream);
+    struct dtmf   *dtmf;
+    dtmf_tone      tone;
+    uint32_t       start;
+    uint64_t       total = 0;
+    const char    *key;
+
+    if (!sequence || !sequence[0] || duration < 10000 || gap < 0)
+        return;
+
+    if (stream != NULL) {
+        stream_resume(stream);
+
+        /* a key held down ends where the sequence starts */
+        stop_dtmf(ausrv, false);
+    }
+    else if ((stream = get_stream(ausrv, extra_properties)) == NULL)
+        return;
+
+    volume = (vol_scale * volume) / 100;
+
+    for (key = sequence;  *key;  key++) {
+        if ((tone = dtmf_tone_from_symbol(*key)) >= DTMF_MAX)
+            continue;
+
+        dtmf  = dtmf_defs + tone;
+        start = total ? gap : 0;
+
+        tone_create(stream, TONE_DTMF_SEQ_L, dtmf->low_freq , volume/2,
+                    duration, duration, start, duration);
+        tone_create(stream, TONE_DTMF_SEQ_H, dtmf->high_freq, volume/2,
+                    duration, duration, start, duration);
+
+        total += start + duration;
+    }
+
+    TRACE("%s(): '%s' takes %llu usec", __FUNCTION__, sequence,
+          (unsigned long long)total);
+
+    stream_set_timeout(stream, (uint32_t)(total + (30 * 1000000)));
+
+    change_muting(ausrv, MUTE_START);
+}
+
+static void stop_dtmf(struct ausrv *ausrv, bool sequence)
 {
     struct stream *stream = stream_find(ausrv, dtmf_stream);
     struct tone   *tone;
@@ -159,6 +353,14 @@ void dtmf_stop(struct ausrv *ausrv)
 
             next = tone->next;
 
+            /* a sequence stops only its own keys, the ones not played
+               yet go with the one playing */
+            if (sequence) {
+                if (tone->type == TONE_DTMF_SEQ_L || tone->type == TONE_DTMF_SEQ_H)
+                    tone_destroy(tone, true);
+                continue;
+            }
+
             switch (tone->type) {
 
             case TONE_DTMF_IND_L:
@@ -177,8 +379,10 @@ void dtmf_stop(struct ausrv *ausrv)
         if (stream->data == NULL)
             stream_clean_buffer(stream);
 
-        stream_set_timeout(stream, 10 * 1000000);
-        set_mute_timeout(ausrv, 2 * 1000000);
+        if (!stream_linger(stream))
+            stream_set_timeout(stream, 10 * 1000000);
+
+        change_muting(ausrv, MUTE_RELEASE_LATER);
     }
 }
 
@@ -197,21 +401,110 @@ void dtmf_set_volume(uint32_t volume)
 static void destroy_callback(void *data)
 {
     struct tone   *tone = (struct tone *)data;
-    struct stream *stream;
-    struct ausrv  *ausrv;
 
-    set_mute_timeout(NULL, 0);
+    change_muting(tone ? tone->stream->ausrv : NULL, MUTE_RELEASE);
 
-    if (mute && tone != NULL) {
-        stream = tone->stream;
-        ausrv  = stream->ausrv;
+    tone_destroy_callback(data);
+}
 
-        request_muting(ausrv, false);
+/*
+ * Muting talks D-Bus and runs GLib timers, so with an audio thread the
+ * change is queued for the main loop, which runs the queued changes in
+ * order from a single idle source.
+ */
+static void change_muting(struct ausrv *ausrv, mute_change change)
+{
+    struct mute_request *req;
 
-        mute = false;
+    if ((req = malloc(sizeof(*req))) == NULL) {
+        N_ERROR(LOG_CAT "%s(): Can't allocate memory", __FUNCTION__);
+        return;
     }
 
-    tone_destroy_callback(data);
+    req->ausrv  = ausrv;
+    req->change = change;
+
+    if (ausrv_in_audio_thread(ausrv)) {
+        g_mutex_lock(&mute_lock);
+        g_queue_push_tail(&mute_queue, req);
+        if (mute_idle_id == 0)
+            mute_idle_id = g_idle_add(run_muting_callback, NULL);
+        g_mutex_unlock(&mute_lock);
+    }
+    else
+        apply_muting(req);
+}
+
+static gboolean run_muting_callback(gpointer data)
+{
+    GQueue               pending;
+    struct mute_request *req;
+
+    (void) data;
+
+    g_mutex_lock(&mute_lock);
+    pending = mute_queue;
+    g_queue_init(&mute_queue);
+    mute_idle_id = 0;
+    g_mutex_unlock(&mute_lock);
+
+    while ((req = g_queue_pop_head(&pending)) != NULL)
+        apply_muting(req);
+
+    return FALSE;
+}
+
+static void apply_muting(struct mute_request *req)
+{
+    struct ausrv *ausrv = req->ausrv;
+
+    switch (req->change) {
+
+    case MUTE_START:
+        request_muting(ausrv, true);
+        set_mute_timeout(ausrv, 0);
+        break;
+
+    case MUTE_RELEASE_LATER:
+        set_mute_timeout(ausrv, 2 * 1000000);
+        break;
+
+    case MUTE_RELEASE:
+        set_mute_timeout(NULL, 0);
+
+        if (mute && ausrv != NULL) {
+            request_muting(ausrv, false);
+            mute = false;
+        }
+        break;
+    }
+
+    free(req);
+}
+
+/*
+ * called from the ausrv teardown once the audio thread is stopped, the
+ * queued changes and the release timer would point to a freed ausrv
+ */
+void dtmf_cancel_muting(struct ausrv *ausrv)
+{
+    struct mute_request *req;
+
+    g_mutex_lock(&mute_lock);
+    if (mute_idle_id != 0) {
+        g_source_remove(mute_idle_id);
+        mute_idle_id = 0;
+    }
+    while ((req = g_queue_pop_head(&mute_queue)) != NULL)
+        free(req);
+    g_mutex_unlock(&mute_lock);
+
+    set_mute_timeout(NULL, 0);
+
+    if (mute) {
+        request_muting(ausrv, false);
+        mute = false;
+    }
 }
 
 static void set_mute_timeout(struct ausrv *ausrv, guint interval)
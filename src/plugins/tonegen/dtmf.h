@@ -24,6 +24,7 @@ USA.
 #define __TONEGEND_DTMF_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef enum _dtmf_tone {
     DTMF_0        = 0,
@@ -46,11 +47,18 @@ typedef enum _dtmf_tone {
 } dtmf_tone;
 
 int  dtmf_init(void);
-void dtmf_play(struct ausrv *ausrv, dtmf_tone tone,
+void dtmf_prepare(uint32_t rate);
+bool dtmf_play(struct ausrv *ausrv, dtmf_tone tone,
                uint32_t volume, int duration, const char *extra_properties);
+bool dtmf_play_sequence(struct ausrv *ausrv, const char *sequence,
+                        uint32_t volume, int duration, int gap,
+                        const char *extra_properties);
 void dtmf_stop(struct ausrv *ausrv);
+void dtmf_stop_sequence(struct ausrv *ausrv);
+dtmf_tone dtmf_tone_from_symbol(char symbol);
 void dtmf_set_properties(char *propstring);
 void dtmf_set_volume(uint32_t volume);
 void dtmf_enable_mute_signal(gboolean enable);
+void dtmf_cancel_muting(struct ausrv *ausrv);
 
 #endif /* __TONEGEND_DTMF_H__ */
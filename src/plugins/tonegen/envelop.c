@@ -33,6 +33,22 @@ USA.
 
 #define LOG_CAT "tonegen-envelop: "
 
+#define TABLE_MAX_COUNT  16
+
+/*
+ * The gains of the k1 usec steps of a ramp of k2 steps, as ramp_apply()
+ * takes them. Tables are shared by every ramp of the same length and
+ * live until envelop_exit().
+ */
+struct envelop_table {
+    struct envelop_table *next;
+    int32_t               k2;
+    float                 gain[];   /* k2 + 1 steps */
+};
+
+static struct envelop_table *tables;
+static int                   table_count;
+
 static inline union envelop *ramp_create(int type, uint32_t length,
                                          uint32_t start, uint32_t end)
 {
@@ -80,6 +96,7 @@ static inline void ramp_update(union envelop *envelop, uint32_t length,
     down->k2    = length / down->k1;
     down->start = end - length;
     down->end   = end;
+    down->table = NULL;
 }
 
 
@@ -108,11 +125,130 @@ static inline int32_t ramp_apply(union envelop *envelop, int32_t in,uint32_t t)
 }
 
 
+static const struct envelop_table *ramp_table_get(int32_t k2)
+{
+    struct envelop_table *table;
+    int32_t               k;
+
+    for (table = tables;  table;  table = table->next) {
+        if (table->k2 == k2)
+            return table;
+    }
+
+    if (table_count >= TABLE_MAX_COUNT || k2 <= 0)
+        return NULL;
+
+    table = malloc(sizeof(*table) + (k2 + 1) * sizeof(table->gain[0]));
+
+    if (table == NULL) {
+        N_ERROR(LOG_CAT "%s(): Can't allocate memory", __FUNCTION__);
+        return NULL;
+    }
+
+    table->next = tables;
+    table->k2   = k2;
+
+    for (k = 0;  k <= k2;  k++)
+        table->gain[k] = (float)k / (float)k2;
+
+    tables = table;
+    table_count++;
+
+    return table;
+}
+
+static inline float ramp_gain(struct envelop_ramp_def *def, int32_t k3)
+{
+    if (def->table == NULL || def->table->k2 != def->k2)
+        def->table = ramp_table_get(def->k2);
+
+    if (def->table != NULL && k3 >= 0 && k3 <= def->k2)
+        return def->table->gain[k3];
+
+    return def->k2 > 0 ? (float)k3 / (float)def->k2 : 1.0f;
+}
+
+static inline bool ramp_contains(struct envelop_ramp_def *def, uint32_t t)
+{
+    return t > def->start && t < def->end;
+}
+
+/*
+ * Add the samples of the block with their gain to acc. The block is
+ * split into runs on the flat part and on the steps of the ramps, the
+ * gain of a step is read from the table of its ramp, so neither the step
+ * nor the gain needs a division per sample. The steps are found from the
+ * time of every sample like ramp_apply() does, the result only differs
+ * by the rounding of the float gains.
+ */
+static void ramp_apply_block(union envelop *envelop, float *acc,
+                             const float *in, int len, const uint32_t *t)
+{
+    struct envelop_ramp_def *up   = &envelop->ramp.up;
+    struct envelop_ramp_def *down = &envelop->ramp.down;
+    uint32_t                 limit;
+    int32_t                  k3;
+    float                    gain;
+    int                      i, j;
+
+    for (i = 0;  i < len;  i = j) {
+        if (ramp_contains(up, t[i])) {
+            k3    = (int32_t)(t[i] - up->start) / up->k1;
+            limit = up->start + (uint32_t)(k3 + 1) * up->k1;
+            gain  = ramp_gain(up, k3);
+
+            for (j = i;  j < len && t[j] < limit && ramp_contains(up, t[j]);  j++)
+                acc[j] += in[j] * gain;
+        }
+        else if (ramp_contains(down, t[i])) {
+            k3    = (int32_t)(down->end - t[i]) / down->k1;
+            limit = down->end - (uint32_t)k3 * down->k1;
+            gain  = ramp_gain(down, k3);
+
+            for (j = i;  j < len && t[j] <= limit && ramp_contains(down, t[j]);  j++)
+                acc[j] += in[j] * gain;
+        }
+        else {
+            for (j = i;  j < len && !ramp_contains(up, t[j]) &&
+                         !ramp_contains(down, t[j]);  j++)
+                acc[j] += in[j];
+        }
+    }
+}
+
+static inline bool ramp_is_flat(union envelop *envelop, uint32_t from,
+                                uint32_t to)
+{
+    struct envelop_ramp_def *up   = &envelop->ramp.up;
+    struct envelop_ramp_def *down = &envelop->ramp.down;
+
+    if (to > up->start && from < up->end)
+        return false;
+
+    if (to > down->start && from < down->end)
+        return false;
+
+    return true;
+}
+
+
 int envelop_init(void)
 {
     return 0;
 }
 
+void envelop_exit(void)
+{
+    struct envelop_table *table;
+
+    while ((table = tables) != NULL) {
+        tables = table->next;
+        free(table);
+    }
+
+    table_count = 0;
+}
+
 union envelop *envelop_create(int type, uint32_t length,
                               uint32_t start, uint32_t end)
 {
@@ -173,3 +309,35 @@ int32_t envelop_apply(union envelop *envelop, int32_t in, uint32_t t)
 
     return out;
 }
+
+/*
+ * Add a block of len samples to acc with the gain of the envelop, t has
+ * the envelop time of every sample, increasing.
+ */
+void envelop_apply_block(union envelop *envelop, float *acc, const float *in,
+                         int len, const uint32_t *t)
+{
+    int i;
+
+    if (envelop != NULL && envelop->type == ENVELOP_RAMP_LINEAR)
+        ramp_apply_block(envelop, acc, in, len, t);
+    else {
+        for (i = 0;  i < len;  i++)
+            acc[i] += in[i];
+    }
+}
+
+/* true if envelop_apply() passes every t in [from, to] through unchanged */
+bool envelop_is_flat(union envelop *envelop, uint32_t from, uint32_t to)
+{
+    bool flat = true;
+
+    if (envelop != NULL) {
+        switch (envelop->type) {
+        case ENVELOP_RAMP_LINEAR:   flat = ramp_is_flat(envelop, from, to); break;
+        default:                    flat = true;                            break;
+        }
+    }
+
+    return flat;
+}
@@ -24,15 +24,19 @@ USA.
 #define __TONEGEND_ENVELOP_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define ENVELOP_UNKNOWN      0
 #define ENVELOP_RAMP_LINEAR  1
 
+struct envelop_table;
+
 struct envelop_ramp_def {
     int32_t       k1;
     int32_t       k2;
     uint32_t      start;
     uint32_t      end;
+    const struct envelop_table *table; /* gains for the block renderer */
 };
 
 struct envelop_ramp {
@@ -48,9 +52,13 @@ union envelop {
 
 
 int envelop_init(void);
+void envelop_exit(void);
 union envelop *envelop_create(int type, uint32_t length, uint32_t start, uint32_t end);
 void envelop_update(union envelop *envelop, uint32_t length, uint32_t end);
 void envelop_destroy(union envelop *envelop);
 int32_t envelop_apply(union envelop *envelop, int32_t in, uint32_t t);
+void envelop_apply_block(union envelop *envelop, float *acc, const float *in,
+                         int len, const uint32_t *t);
+bool envelop_is_flat(union envelop *envelop, uint32_t from, uint32_t to);
 
 #endif /* __TONEGEND_ENVELOP_H__ */
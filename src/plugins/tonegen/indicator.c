@@ -46,20 +46,61 @@ static indicator_standard   standard   = STD_CEPT;
 static void                *ind_props  = NULL;
 static uint32_t             vol_scale  = 100;
 
+static void start_indicator(struct ausrv *, int, uint32_t, int);
+static void stop_indicator(struct ausrv *, bool);
+static void play_command(struct ausrv *, struct ausrv_command *);
+static void stop_command(struct ausrv *, struct ausrv_command *);
+
 int indicator_init(void)
 {
     return 0;
 }
 
 
-void indicator_play(struct ausrv *ausrv, int type, uint32_t volume, int duration)
+bool indicator_play(struct ausrv *ausrv, int type, uint32_t volume, int duration)
+{
+    struct ausrv_command cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.func     = play_command;
+    cmd.type     = type;
+    cmd.volume   = volume;
+    cmd.duration = duration;
+
+    return ausrv_submit(ausrv, &cmd);
+}
+
+void indicator_stop(struct ausrv *ausrv, bool kill_stream)
+{
+    struct ausrv_command cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.func = stop_command;
+    cmd.flag = kill_stream;
+    cmd.stop = true;
+
+    ausrv_submit(ausrv, &cmd);
+}
+
+static void play_command(struct ausrv *ausrv, struct ausrv_command *cmd)
+{
+    start_indicator(ausrv, cmd->type, cmd->volume, cmd->duration);
+}
+
+static void stop_command(struct ausrv *ausrv, struct ausrv_command *cmd)
+{
+    stop_indicator(ausrv, cmd->flag);
+}
+
+static void start_indicator(struct ausrv *ausrv, int type, uint32_t volume, int duration)
 {
     struct stream *stream  = stream_find(ausrv, ind_stream);
     uint32_t       timeout = duration ?: MAX_TONE_LENGTH;
 
     if (stream != NULL) {
+        stream_resume(stream);
         dtmf_stop(ausrv);
-        indicator_stop(ausrv, false);
+        stop_indicator(ausrv, false);
     }
     else {
         stream = stream_create(ausrv, ind_stream, NULL, 0,
@@ -224,7 +265,7 @@ void indicator_play(struct ausrv *ausrv, int type, uint32_t volume, int duration
     stream_set_timeout(stream, timeout);
 }
 
-void indicator_stop(struct ausrv *ausrv, bool kill_stream)
+static void stop_indicator(struct ausrv *ausrv, bool kill_stream)
 {
     struct stream *stream = stream_find(ausrv, ind_stream);
     struct tone   *tone;
@@ -234,8 +275,15 @@ void indicator_stop(struct ausrv *ausrv, bool kill_stream)
           kill_stream ? "true":"false", stream ? stream->name:"<no-stream>");
 
     if (stream != NULL) {
-        if (kill_stream)
-            stream_destroy(stream);
+        if (kill_stream) {
+            if (!stream_linger(stream))
+                stream_destroy(stream);
+            else {
+                /* keep the stream, but silence it right away */
+                tone_destroy_callback(stream->data);
+                stream_clean_buffer(stream);
+            }
+        }
         else {
             /* destroy all but DTMF tones */
             for (hd = (struct tone *)&stream->data;  hd;  hd = hd->next) {
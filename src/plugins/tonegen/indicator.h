@@ -35,7 +35,7 @@ typedef enum _indicator_standard {
 
 
 int  indicator_init(void);
-void indicator_play(struct ausrv *ausrv, int type, uint32_t volume, int duration);
+bool indicator_play(struct ausrv *ausrv, int type, uint32_t volume, int duration);
 void indicator_stop(struct ausrv *ausrv, bool kill_stream);
 void indicator_set_standard(indicator_standard std);
 void indicator_set_properties(char *propstring);
@@ -46,9 +46,16 @@ N_PLUGIN_NAME        ("tonegen")
 N_PLUGIN_VERSION     ("0.2")
 N_PLUGIN_DESCRIPTION ("Tone generator plugin")
 
+typedef enum {
+    SAMPLE_FORMAT_S16 = 0,
+    SAMPLE_FORMAT_FLOAT32,
+    SAMPLE_FORMAT_NATIVE,       /* whatever the default sink runs at */
+} sample_format;
+
 struct properties {
     indicator_standard  standard;
     int                 sample_rate;
+    sample_format       sample_format;
     bool                statistics;
     int                 buflen;
     int                 minreq;
@@ -56,6 +63,10 @@ struct properties {
     char               *ind_tags;
     int                 dtmf_volume;
     int                 ind_volume;
+    bool                block_synthesis;
+    bool                audio_thread;
+    int                 audio_thread_priority;
+    int                 linger;
 };
 
 struct userdata {
@@ -78,13 +89,17 @@ static struct userdata u;
 
 static bool prop_8khz_parser(const NValue *val, struct options_parse *opt);
 static bool prop_standard_parser(const NValue *val, struct options_parse *opt);
+static bool prop_format_parser(const NValue *val, struct options_parse *opt);
 static bool prop_string_parser(const NValue *val, struct options_parse *opt);
 static bool prop_int_parser(const NValue *val, struct options_parse *opt);
 static bool prop_bool_parser(const NValue *val, struct options_parse *opt);
+static void set_default_properties(struct properties *properties);
+static void apply_tuning(void);
 
 static struct options_parse options[] = {
     { "8kHz"            , prop_8khz_parser      , &u.properties.sample_rate, NULL },
     { "standard"        , prop_standard_parser  , &u.properties.standard, NULL    },
+    { "sample-format"   , prop_format_parser    , &u.properties.sample_format, NULL },
     { "buflen"          , prop_int_parser       , &u.properties.buflen, NULL      },
     { "minreq"          , prop_int_parser       , &u.properties.minreq, NULL      },
     { "statistics"      , prop_bool_parser      , &u.properties.statistics, NULL  },
@@ -92,6 +107,10 @@ static struct options_parse options[] = {
     { "tag-indicator"   , prop_string_parser    , NULL, &u.properties.ind_tags    },
     { "volume-dtmf"     , prop_int_parser       , &u.properties.dtmf_volume, NULL },
     { "volume-indicator", prop_int_parser       , &u.properties.ind_volume, NULL  },
+    { "block-synthesis" , prop_bool_parser      , &u.properties.block_synthesis, NULL },
+    { "audio-thread"    , prop_bool_parser      , &u.properties.audio_thread, NULL },
+    { "audio-thread-priority", prop_int_parser  , &u.properties.audio_thread_priority, NULL },
+    { "linger"          , prop_int_parser       , &u.properties.linger, NULL      },
     { NULL              , NULL                  , NULL, NULL                      }
 };
 
@@ -155,6 +174,26 @@ prop_standard_parser (const NValue *val, struct options_parse *opt)
     return true;
 }
 
+static bool
+prop_format_parser (const NValue *val, struct options_parse *opt)
+{
+    const gchar *fmt;
+
+    fmt = n_value_get_string(val);
+    if (g_ascii_strcasecmp (fmt ?: "", "s16") == 0)
+        *(sample_format *) opt->arg_value = SAMPLE_FORMAT_S16;
+    else if (g_ascii_strcasecmp (fmt ?: "", "float32") == 0)
+        *(sample_format *) opt->arg_value = SAMPLE_FORMAT_FLOAT32;
+    else if (g_ascii_strcasecmp (fmt ?: "", "native") == 0)
+        *(sample_format *) opt->arg_value = SAMPLE_FORMAT_NATIVE;
+    else {
+        N_ERROR (LOG_CAT "Invalid sample format '%s'", fmt);
+        return false;
+    }
+
+    return true;
+}
+
 static bool
 prop_string_parser (const NValue *val, struct options_parse *opt)
 {
@@ -204,21 +243,87 @@ parse_options (NProplist *params)
     n_proplist_foreach (params, parse_opt, NULL);
 }
 
+static void
+set_default_properties (struct properties *properties)
+{
+    properties->standard = STD_CEPT;
+    properties->sample_rate = 48000;
+    properties->statistics = false;
+    properties->buflen = 0;
+    properties->minreq = 0;
+    properties->dtmf_tags = NULL;
+    properties->ind_tags = NULL;
+    properties->dtmf_volume = 100;
+    properties->ind_volume = 100;
+    properties->block_synthesis = true;
+    properties->audio_thread = false;
+    properties->audio_thread_priority = 0;
+    properties->linger = 10000;
+    properties->sample_format = SAMPLE_FORMAT_NATIVE;
+}
+
+/* Buffering, statistics, volumes and linger apply to the next streams on
+   a reload, the other options need a restart and keep their running
+   values. */
+static void
+keep_restart_options (struct properties *parsed, const struct properties *running)
+{
+    const char *changed[8];
+    gchar      *names;
+    int         n = 0;
+
+    if (parsed->standard != running->standard)
+        changed[n++] = "standard";
+    if (parsed->sample_rate != running->sample_rate)
+        changed[n++] = "8kHz";
+    if (parsed->sample_format != running->sample_format)
+        changed[n++] = "sample-format";
+    if (g_strcmp0 (parsed->dtmf_tags, running->dtmf_tags) != 0)
+        changed[n++] = "tag-dtmf";
+    if (g_strcmp0 (parsed->ind_tags, running->ind_tags) != 0)
+        changed[n++] = "tag-indicator";
+    if (parsed->block_synthesis != running->block_synthesis)
+        changed[n++] = "block-synthesis";
+    if (parsed->audio_thread != running->audio_thread)
+        changed[n++] = "audio-thread";
+    if (parsed->audio_thread_priority != running->audio_thread_priority)
+        changed[n++] = "audio-thread-priority";
+    changed[n] = NULL;
+
+    if (n > 0) {
+        names = g_strjoinv (", ", (gchar **) changed);
+        N_INFO (LOG_CAT "restart needed to apply %s", names);
+        g_free (names);
+    }
+
+    g_free (parsed->dtmf_tags);
+    g_free (parsed->ind_tags);
+
+    parsed->standard = running->standard;
+    parsed->sample_rate = running->sample_rate;
+    parsed->sample_format = running->sample_format;
+    parsed->dtmf_tags = running->dtmf_tags;
+    parsed->ind_tags = running->ind_tags;
+    parsed->block_synthesis = running->block_synthesis;
+    parsed->audio_thread = running->audio_thread;
+    parsed->audio_thread_priority = running->audio_thread_priority;
+}
+
+static void
+apply_tuning (void)
+{
+    stream_print_statistics (u.properties.statistics);
+    stream_buffering_parameters (u.properties.buflen, u.properties.minreq);
+    stream_set_linger (u.properties.linger > 0 ? u.properties.linger : 0);
+
+    dtmf_set_volume (u.properties.dtmf_volume);
+    indicator_set_volume (u.properties.ind_volume);
+}
+
 static int
 tonegen_sink_initialize (NSinkInterface *iface)
 {
-    (void) iface;
-
-    /* Set default properties */
-    u.properties.standard = STD_CEPT;
-    u.properties.sample_rate = 48000;
-    u.properties.statistics = false;
-    u.properties.buflen = 0;
-    u.properties.minreq = 0;
-    u.properties.dtmf_tags = NULL;
-    u.properties.ind_tags = NULL;
-    u.properties.dtmf_volume = 100;
-    u.properties.ind_volume = 100;
+    set_default_properties (&u.properties);
 
     NProplist *params = (NProplist*) n_plugin_get_params (u.plugin);
     N_DEBUG (LOG_CAT "starting sink");
@@ -233,15 +338,24 @@ tonegen_sink_initialize (NSinkInterface *iface)
     rfc4733_init ();
 
     stream_set_default_samplerate (u.properties.sample_rate);
-    stream_print_statistics (u.properties.statistics);
-    stream_buffering_parameters (u.properties.buflen, u.properties.minreq);
+    stream_set_default_format (u.properties.sample_format == SAMPLE_FORMAT_FLOAT32 ?
+                               PA_SAMPLE_FLOAT32NE : PA_SAMPLE_S16NE);
+    stream_set_native_format (u.properties.sample_format == SAMPLE_FORMAT_NATIVE);
+    /* with the native format the rate is known once the sink is queried */
+    if (u.properties.sample_format != SAMPLE_FORMAT_NATIVE)
+        dtmf_prepare (u.properties.sample_rate);
+    stream_register_metrics (n_core_get_metrics (n_plugin_get_core (u.plugin)));
+    apply_tuning ();
 
     dtmf_set_properties (u.properties.dtmf_tags);
     indicator_set_properties (u.properties.ind_tags);
 
-    dtmf_set_volume (u.properties.dtmf_volume);
-    indicator_set_volume (u.properties.ind_volume);
+    tone_set_block_synthesis (u.properties.block_synthesis);
 
+    ausrv_set_audio_thread (u.properties.audio_thread,
+                            u.properties.audio_thread_priority);
+
+    u.tonegend.sink = iface;
     u.tonegend.ngfd_ctx = ngfif_create (&u.tonegend);
 
     if ((u.tonegend.dbus_ctx = dbusif_create (&u.tonegend)) == NULL) {
@@ -261,6 +375,8 @@ tonegen_sink_initialize (NSinkInterface *iface)
 
     indicator_set_standard (u.properties.standard);
 
+    n_sink_interface_add_plan_key (iface, "tonegen.type", TRUE);
+
     return TRUE;
 }
 
@@ -322,11 +438,34 @@ N_PLUGIN_LOAD (plugin)
     return TRUE;
 }
 
+N_PLUGIN_RELOAD (plugin, params)
+{
+    struct properties running = u.properties;
+
+    (void) plugin;
+
+    /* options left out of the new parameters fall back to the defaults */
+    set_default_properties (&u.properties);
+    parse_options ((NProplist*) params);
+    keep_restart_options (&u.properties, &running);
+    apply_tuning ();
+
+    N_INFO (LOG_CAT "buflen %d minreq %d, volumes %d/%d, linger %d ms",
+            u.properties.buflen, u.properties.minreq,
+            u.properties.dtmf_volume, u.properties.ind_volume,
+            u.properties.linger);
+
+    return TRUE;
+}
+
 N_PLUGIN_UNLOAD (plugin)
 {
     (void) plugin;
 
     ausrv_destroy (u.tonegend.ausrv_ctx);
+    stream_exit ();
+    tone_exit ();
+    envelop_exit ();
     ngfif_destroy (u.tonegend.ngfd_ctx);
     dbusif_destroy (u.tonegend.dbus_ctx);
     rfc4733_destroy ();
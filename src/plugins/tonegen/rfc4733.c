@@ -42,6 +42,18 @@ USA.
 
 #define LOG_CAT "tonegen-rfc4733: "
 
+#define SEQUENCE_MAX_KEYS       64      /* keys in one sequence */
+#define SEQUENCE_DURATION       100     /* msec of a key by default */
+#define SEQUENCE_GAP            100     /* msec between keys by default */
+#define SEQUENCE_DATA_KEY       "tonegen.sequence"
+
+/* completes a sequence request once its keys have been played */
+struct sequence_timer {
+    NRequest        *request;
+    struct tonegend *tonegend;
+    guint            id;
+};
+
 struct method_ngfd {
     char  *name;                                        /* tone type */
     int  (*func_start)(NRequest *, struct tonegend *);  /* implementing function */
@@ -49,13 +61,17 @@ struct method_ngfd {
 };
 
 static int start_dtmf_tone(NRequest *request, struct tonegend *);
+static int start_dtmf_sequence(NRequest *request, struct tonegend *);
 static int start_indicator_tone(NRequest *request, struct tonegend *);
 static int stop_dtmf_tone(NRequest *request, struct tonegend *);
+static int stop_dtmf_sequence(NRequest *request, struct tonegend *);
 static int stop_indicator_tone(NRequest *request, struct tonegend *);
+static gboolean sequence_timeout_cb(gpointer);
 static uint32_t linear_volume(int);
 
 static struct method_ngfd  method_ngfd_defs[] = {
     {"dtmf",        start_dtmf_tone,        stop_dtmf_tone      },
+    {"dtmf_sequence", start_dtmf_sequence,  stop_dtmf_sequence  },
     {"indicator",   start_indicator_tone,   stop_indicator_tone },
     {NULL,          NULL,                   NULL                }
 };
@@ -64,6 +80,16 @@ static GHashTable *indicator_hash = NULL;
 
 int rfc4733_init(void)
 {
+    static const char *keys[] = {
+        "tonegen.pattern", "tonegen.value", "tonegen.digits", "tonegen.dbm0",
+        "tonegen.duration", "tonegen.gap", "tonegen.properties", NULL
+    };
+    const char **key;
+
+    /* declare the keys read from the requests */
+    for (key = keys; *key; key++)
+        (void) n_atom_intern(*key);
+
     return 0;
 }
 
@@ -164,9 +190,8 @@ static int start_indicator_tone(NRequest *request, struct tonegend *tonegend)
     N_DEBUG(LOG_CAT "%s(): event %u  volume %d dbm0 (%u) duration %u msec",
           __FUNCTION__, event, dbm0, volume, duration);
 
-    indicator_play(ausrv, event, volume, duration * 1000);
-
-    return TRUE;
+    /* dropped if the audio thread is that far behind */
+    return indicator_play(ausrv, event, volume, duration * 1000) ? TRUE : FALSE;
 }
 
 static int start_dtmf_tone(NRequest *request, struct tonegend *tonegend)
@@ -204,11 +229,91 @@ static int start_dtmf_tone(NRequest *request, struct tonegend *tonegend)
     N_DEBUG(LOG_CAT "%s(): event %u volume %d dbm0 (%u) extra properties (%s)",
           __FUNCTION__, event, dbm0, volume, extra_props ? extra_props : "none");
 
-    dtmf_play(ausrv, event, volume, 0, extra_props);
+    return dtmf_play(ausrv, event, volume, 0, extra_props) ? TRUE : FALSE;
+}
+
+/*
+ * A whole digit string in one request, e.g. a number to dial. The keys
+ * are timed by tonegen in one stream instead of one request per key.
+ */
+static int start_dtmf_sequence(NRequest *request, struct tonegend *tonegend)
+{
+    struct ausrv *ausrv = tonegend->ausrv_ctx;
+    struct sequence_timer *timer;
+    const char   *digits;
+    const char   *key;
+    int32_t       dbm0 = 0;
+    uint32_t      duration = SEQUENCE_DURATION;
+    uint32_t      gap = SEQUENCE_GAP;
+    uint32_t      volume;
+    const char   *extra_props = NULL;
+    const NProplist *proplist;
+
+    proplist = n_request_get_properties(request);
+    N_DEBUG(LOG_CAT "request sequence");
+
+    if (!(digits = n_proplist_get_string(proplist, "tonegen.digits")) || !digits[0]) {
+        N_WARNING(LOG_CAT "request doesn't have digits.");
+        return FALSE;
+    }
+
+    if (strlen(digits) > SEQUENCE_MAX_KEYS) {
+        N_WARNING(LOG_CAT "DTMF sequence longer than %d keys.", SEQUENCE_MAX_KEYS);
+        return FALSE;
+    }
+
+    for (key = digits;  *key;  key++) {
+        if (dtmf_tone_from_symbol(*key) >= DTMF_MAX) {
+            N_WARNING(LOG_CAT "Invalid DTMF key '%c' in sequence.", *key);
+            return FALSE;
+        }
+    }
+
+    if (n_proplist_has_key(proplist, "tonegen.dbm0"))
+        dbm0 = n_proplist_get_int(proplist, "tonegen.dbm0");
+    if (n_proplist_has_key(proplist, "tonegen.duration"))
+        duration = n_proplist_get_uint(proplist, "tonegen.duration");
+    if (n_proplist_has_key(proplist, "tonegen.gap"))
+        gap = n_proplist_get_uint(proplist, "tonegen.gap");
+
+    if (duration < 10 || duration > 10000 || gap > 10000) {
+        N_WARNING(LOG_CAT "Invalid DTMF sequence timing %u/%u msec.", duration, gap);
+        return FALSE;
+    }
+
+    if (n_proplist_has_key(proplist, "tonegen.properties"))
+        extra_props = n_proplist_get_string(proplist, "tonegen.properties");
+
+    volume = linear_volume(dbm0);
+
+    N_DEBUG(LOG_CAT "%s(): digits '%s' volume %d dbm0 (%u) key %u msec gap %u msec",
+          __FUNCTION__, digits, dbm0, volume, duration, gap);
+
+    if (!dtmf_play_sequence(ausrv, digits, volume, duration * 1000, gap * 1000, extra_props))
+        return FALSE;
+
+    timer = g_slice_new0(struct sequence_timer);
+    timer->request  = request;
+    timer->tonegend = tonegend;
+    timer->id       = g_timeout_add(strlen(digits) * (duration + gap) - gap,
+                                    sequence_timeout_cb, timer);
+    n_request_store_data(request, SEQUENCE_DATA_KEY, timer);
 
     return TRUE;
 }
 
+static gboolean sequence_timeout_cb(gpointer userdata)
+{
+    struct sequence_timer *timer = (struct sequence_timer *)userdata;
+
+    N_DEBUG(LOG_CAT "%s(): dtmf sequence played", __FUNCTION__);
+
+    timer->id = 0;
+    n_sink_interface_complete(timer->tonegend->sink, timer->request);
+
+    return FALSE;
+}
+
 static int stop_dtmf_tone(NRequest *request, struct tonegend *tonegend)
 {
     struct ausrv *ausrv = tonegend->ausrv_ctx;
@@ -221,6 +326,30 @@ static int stop_dtmf_tone(NRequest *request, struct tonegend *tonegend)
     return TRUE;
 }
 
+static int stop_dtmf_sequence(NRequest *request, struct tonegend *tonegend)
+{
+    struct ausrv *ausrv = tonegend->ausrv_ctx;
+    struct sequence_timer *timer;
+
+    N_DEBUG(LOG_CAT "%s(): stop dtmf sequence", __FUNCTION__);
+
+    if (!(timer = n_request_get_data(request, SEQUENCE_DATA_KEY)))
+        return TRUE;
+
+    n_request_store_data(request, SEQUENCE_DATA_KEY, NULL);
+
+    /* the keys of a completed sequence play until their end, only a
+       sequence stopped before it has been played is cut short */
+    if (timer->id > 0) {
+        g_source_remove(timer->id);
+        dtmf_stop_sequence(ausrv);
+    }
+
+    g_slice_free(struct sequence_timer, timer);
+
+    return TRUE;
+}
+
 static int stop_indicator_tone(NRequest *request, struct tonegend *tonegend)
 {
     struct ausrv *ausrv = tonegend->ausrv_ctx;
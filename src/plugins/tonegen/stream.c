@@ -30,37 +30,191 @@ USA.
 #include <pulse/pulseaudio.h>
 
 #include <ngf/log.h>
+#include <ngf/wakeup.h>
 #include <trace/trace.h>
 
 #include "ausrv.h"
 #include "stream.h"
+#include "dtmf.h"
 
 #define LOG_CAT "tonegen-stream: "
 
+struct pending_samples;
+
 static void state_callback(pa_stream *, void *);
 static void underflow_callback(pa_stream *, void *);
 static void suspended_callback(pa_stream *, void *);
 static void write_callback(pa_stream *, size_t, void *);
 static void flush_callback(pa_stream *, int, void *);
 static void drain_callback(pa_stream *, int, void *);
-static void write_samples(struct stream *, int16_t *,size_t, uint32_t *);
+static void write_samples(struct stream *, void *,size_t, uint32_t *);
+static size_t output_samples(struct stream *, size_t, uint32_t *);
+static void update_metrics(struct stream *, size_t, int64_t);
+static void pending_sample(struct pending_samples *, int64_t);
+static void metrics_recorded(struct stream *);
+static void publish_metrics(struct stream_metrics *);
+static gboolean publish_callback(gpointer);
+static void cork_stream(struct stream *);
+static void cancel_linger(struct stream *);
+static void linger_callback(pa_mainloop_api *, pa_time_event *,
+                            const struct timeval *, void *);
+static void free_buffers(struct stream *);
+static void server_info_callback(pa_context *, const pa_server_info *, void *);
+static void sink_info_callback(pa_context *, const pa_sink_info *, int, void *);
 
 static uint32_t default_rate     = 48000;
+static pa_sample_format_t default_format = PA_SAMPLE_S16NE;
+static bool     native_format    = false;
 static bool     print_statistics = false;
 static int      target_buflen    = 1000; /* 1000msec ie. 1sec */
 static int      min_bufreq       = 200;  /* 200msec */
+static uint32_t linger_time      = 10000; /* 10sec */
+
+#define SCRATCH_SIZE  8192  /* bytes */
+#define RENDER_WINDOW 256   /* callbacks in a render time generation */
+#define PENDING_SAMPLES  64 /* histogram samples kept between publishes */
+#define PUBLISH_INTERVAL 1000 /* msec, of the metrics of the audio thread */
+
+struct pending_samples {
+    gint                 head;      /* next sample to publish */
+    gint                 tail;      /* next sample to record */
+    int64_t              values[PENDING_SAMPLES];
+};
+
+/*
+ * The metrics belong to the main loop. The stream callbacks only record
+ * to these, with atomic operations and single producer rings, and the
+ * main loop publishes them to the metrics: right away when the streams
+ * run in the main loop, otherwise at most every PUBLISH_INTERVAL.
+ */
+struct pending_metrics {
+    guint                writes;
+    guint                bytes;
+    guint                underflows;
+    guint                late;
+    guint                buffer;    /* last buffer size + 1, 0 if none */
+    guint                buffer_max;/* largest buffer size + 1 */
+    struct pending_samples gap;
+    struct pending_samples render;
+};
+
+struct stream_metrics {
+    const char       *name;
+    NMetricCounter   *writes;
+    NMetricCounter   *bytes;
+    NMetricCounter   *underflows;
+    NMetricCounter   *late;
+    NMetricGauge     *buffer;
+    NMetricHistogram *gap;
+    NMetricHistogram *render;
+    struct pending_metrics pending;
+};
+
+static gint publish_scheduled;  /* also the user data of the publish timer */
+
+static struct stream_metrics stream_metrics[] = {
+    { .name = STREAM_INDICATOR    },
+    { .name = STREAM_DTMF         },
+    { .name = STREAM_NOTES        },
+    { .name = STREAM_NOTIFICATION },
+    { .name = "other"             },
+    { .name = NULL                }
+};
 
 int stream_init(void)
 {
     return 0;
 }
 
+void stream_exit(void)
+{
+    struct stream_metrics *m;
+
+    /* the audio thread is stopped already */
+    while (g_source_remove_by_user_data(&publish_scheduled))
+        ;
+    publish_scheduled = 0;
+
+    for (m = stream_metrics;  m->name;  m++) {
+        if (m->writes)
+            publish_metrics(m);
+    }
+}
+
+void stream_register_metrics(NMetrics *metrics)
+{
+    struct stream_metrics *m;
+    char                   name[64];
+
+#define METRIC_NAME(what) \
+    (snprintf(name, sizeof(name), "tonegen.%s." what, m->name), name)
+
+    for (m = stream_metrics;  m->name;  m++) {
+        m->writes     = n_metrics_add_counter(metrics, METRIC_NAME("writes"));
+        m->bytes      = n_metrics_add_counter(metrics, METRIC_NAME("bytes"));
+        m->underflows = n_metrics_add_counter(metrics, METRIC_NAME("underflows"));
+        m->late       = n_metrics_add_counter(metrics, METRIC_NAME("late"));
+        m->buffer     = n_metrics_add_gauge(metrics, METRIC_NAME("buffer_bytes"));
+        m->gap        = n_metrics_add_histogram(metrics, METRIC_NAME("gap_us"));
+        m->render     = n_metrics_add_rolling_histogram(metrics,
+                                                        METRIC_NAME("render_us"),
+                                                        RENDER_WINDOW);
+    }
+
+#undef METRIC_NAME
+}
+
+static struct stream_metrics *find_metrics(const char *name)
+{
+    struct stream_metrics *m;
+
+    for (m = stream_metrics;  m[1].name;  m++) {
+        if (!strcmp(name, m->name))
+            break;
+    }
+
+    return m->writes ? m : NULL;
+}
+
 
 void stream_set_default_samplerate(uint32_t rate)
 {
     default_rate = rate;
 }
 
+void stream_set_default_format(pa_sample_format_t format)
+{
+    if (format == PA_SAMPLE_S16NE || format == PA_SAMPLE_FLOAT32NE)
+        default_format = format;
+    else {
+        N_ERROR(LOG_CAT "Ignoring unsupported sample format %s",
+                pa_sample_format_to_string(format));
+    }
+}
+
+void stream_set_native_format(bool native)
+{
+    native_format = native;
+}
+
+/*
+ * Look up the sample spec of the default sink so that the streams
+ * created later on are rendered in the format and rate the sink runs
+ * at, and PulseAudio does not need to convert or resample them.
+ */
+void stream_query_native_format(struct ausrv *ausrv)
+{
+    pa_operation *oper;
+
+    if (!native_format)
+        return;
+
+    oper = pa_context_get_server_info(ausrv->context, server_info_callback,
+                                      (void *)ausrv);
+    if (oper != NULL)
+        pa_operation_unref(oper);
+}
+
 void stream_print_statistics(bool print)
 {
     print_statistics = print;
@@ -88,7 +242,7 @@ struct stream *stream_create(struct ausrv *ausrv,
                              const char   *name,
                              const char   *sink,
                              uint32_t      sample_rate,
-                             uint32_t    (*write)(struct stream *s, int16_t *samples, int length),
+                             uint32_t    (*write)(struct stream *s, void *samples, int length),
                              void        (*destroy)(void*),
                              void         *proplist,
                              void         *data)
@@ -117,7 +271,7 @@ struct stream *stream_create(struct ausrv *ausrv,
         sample_rate = default_rate;
 
     memset(&spec, 0, sizeof(spec));
-    spec.format   = PA_SAMPLE_S16LE;
+    spec.format   = default_format;
     spec.rate     = sample_rate;
     spec.channels = 1;          /* e.g. MONO */
 
@@ -145,6 +299,8 @@ struct stream *stream_create(struct ausrv *ausrv,
     stream->id      = ausrv->nextid++;
     stream->name    = strdup(name);
     stream->rate    = sample_rate;
+    stream->format  = spec.format;
+    stream->framesize = pa_sample_size(&spec);
     stream->pastr   = pa_stream_new_with_proplist(ausrv->context, name,
                                                   &spec, NULL,
                                                   (pa_proplist *)proplist);
@@ -154,6 +310,7 @@ struct stream *stream_create(struct ausrv *ausrv,
     stream->write   = write;
     stream->destroy = destroy;
     stream->data    = data;
+    stream->metrics = find_metrics(name);
 
     if (print_statistics) {
         stat = &stream->stat;
@@ -164,7 +321,15 @@ struct stream *stream_create(struct ausrv *ausrv,
     }
 
 
-    if (stream->pastr == NULL) {
+    if (stream->pastr != NULL) {
+        stream->buf.scratch    = malloc(SCRATCH_SIZE);
+        stream->buf.scratchlen = SCRATCH_SIZE;
+    }
+
+    if (stream->pastr == NULL || stream->buf.scratch == NULL) {
+        if (stream->pastr != NULL)
+            pa_stream_unref(stream->pastr);
+
         free(stream->name);
 
         free(stream);
@@ -245,6 +410,12 @@ void stream_destroy(struct stream *stream)
         return;
     }
 
+    cancel_linger(stream);
+
+    /* a corked stream would never drain */
+    if (stream->corked)
+        stream->flush = true;
+
 #ifdef ENABLE_TRACE
     gettimeofday(&tv, NULL);
     stop = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)tv.tv_usec;
@@ -276,7 +447,7 @@ void stream_destroy(struct stream *stream)
 
             stream->ausrv  = NULL;
 
-            free(stream->buf.samples);
+            free_buffers(stream);
 
             pa_stream_set_write_callback(pastr, NULL,NULL);
 
@@ -339,6 +510,61 @@ void stream_set_timeout(struct stream *stream, uint32_t timeout)
         stream->end = stream->time + timeout;
 }
 
+void stream_set_linger(uint32_t msec)
+{
+    linger_time = msec;
+}
+
+/*
+ * Keep the stream around once its tones are gone instead of letting it
+ * time out. When everything written has played the stream is corked
+ * and destroyed only if no tone comes within the linger time, so a
+ * quick series of tones reuses the same PulseAudio stream.
+ */
+bool stream_linger(struct stream *stream)
+{
+    if (!linger_time)
+        return false;
+
+    stream->lingering = true;
+    stream->end       = 0;
+
+    return true;
+}
+
+void stream_resume(struct stream *stream)
+{
+    pa_operation   *oper;
+    struct timeval  tv;
+    uint64_t        now;
+
+    cancel_linger(stream);
+
+    stream->lingering = false;
+    stream->silence   = 0;
+
+    if (stream->corked) {
+        TRACE("%s(): uncorking stream '%s'", __FUNCTION__, stream->name);
+
+        /* drop the queued silence so the next tone starts right away */
+        stream->buf.buflen = 0;
+
+        if ((oper = pa_stream_flush(stream->pastr, NULL, NULL)) != NULL)
+            pa_operation_unref(oper);
+
+        if ((oper = pa_stream_cork(stream->pastr, 0, NULL, NULL)) != NULL)
+            pa_operation_unref(oper);
+
+        stream->corked = false;
+
+        /* keep the playback position of stream_clean_buffer() in sync */
+        gettimeofday(&tv, NULL);
+        now = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)tv.tv_usec;
+        stream->start = now - ((uint64_t)(stream->bcnt / stream->framesize) *
+                               1000000ULL) / stream->rate;
+    }
+}
+
 void stream_kill_all(struct ausrv *ausrv)
 {
     struct stream *stream;
@@ -346,6 +572,8 @@ void stream_kill_all(struct ausrv *ausrv)
     while ((stream = ausrv->streams) != NULL) {
         ausrv->streams = stream->next;
 
+        cancel_linger(stream);
+
         stream->next   = NULL;
         stream->killed = true;
 
@@ -359,6 +587,8 @@ void stream_kill_all(struct ausrv *ausrv)
         pa_stream_set_suspended_callback(stream->pastr, NULL,NULL);
         pa_stream_set_write_callback(stream->pastr, NULL,NULL);
 
+        free_buffers(stream);
+
         free(stream->name);
         free(stream);
     }
@@ -370,47 +600,59 @@ void stream_clean_buffer(struct stream *stream)
     uint64_t        now;
     uint32_t        bcnt;
     uint32_t        dcnt;
+    uint32_t        fsiz = stream->framesize;
     size_t          offs;
     size_t          len;
     uint32_t        i,j;
     int32_t         sample;
+    int16_t        *s16;
+    float          *f32;
 
     gettimeofday(&tv, NULL);
     now  = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)tv.tv_usec;
     bcnt = ((now - stream->start) * (uint64_t)stream->rate) / 1000000ULL;
-    bcnt *= 2;
+    bcnt *= fsiz;
 
     dcnt = (10000ULL * (uint64_t)stream->rate) / 1000000ULL;
 
-    if (stream->buf.samples != NULL) {
+    if (stream->buf.buflen > 0) {
         offs = bcnt >= stream->bcnt ? bcnt - stream->bcnt : 0;
 
         if (offs < stream->buf.buflen) {
             len = stream->buf.buflen - offs;
 
-            if (len < dcnt * 2) {
+            if (len < dcnt * fsiz) {
                 TRACE("%s(): resetting %u bytes in write-ahead-buffer",
                       __FUNCTION__, len);
                 memset((char *)stream->buf.samples + offs, 0, len);
             }
             else {
-                for (i = 0, j = offs / 2;  i < dcnt;  i++, j++) {
-                    sample = stream->buf.samples[j];
+                s16 = (int16_t *)stream->buf.samples;
+                f32 = (float *)stream->buf.samples;
+
+                for (i = 0, j = offs / fsiz;  i < dcnt;  i++, j++) {
+                    if (stream->format == PA_SAMPLE_FLOAT32NE) {
+                        f32[j] = (f32[j] * (float)(dcnt - i - 1)) /
+                                 (float)dcnt;
+                        continue;
+                    }
+
+                    sample = s16[j];
                     sample = (sample * ((int32_t)dcnt - (int32_t)i - 1)) / (int32_t)dcnt;
 
                     if (sample > 32767)
-                        stream->buf.samples[j] = 32767;
+                        s16[j] = 32767;
                     else if (sample < -32767)
-                        stream->buf.samples[j] = -32767;
+                        s16[j] = -32767;
                     else
-                        stream->buf.samples[j] = sample;
+                        s16[j] = sample;
                 }
 
-                len  -= dcnt * 2;
-                offs += dcnt * 2;
+                len  -= dcnt * fsiz;
+                offs += dcnt * fsiz;
 
                 TRACE("%s(): ramping down %u and resetting %u bytes in "
-                      "write-ahead-buffer", __FUNCTION__, dcnt * 2, len);
+                      "write-ahead-buffer", __FUNCTION__, dcnt * fsiz, len);
 
                 if (len > 0)
                     memset((char *)stream->buf.samples + offs, 0, len);
@@ -557,6 +799,11 @@ static void underflow_callback(pa_stream *pastr, void *userdata)
 
         stream->stat.underflows++;
 
+        if (stream->metrics) {
+            g_atomic_int_inc((gint *)&stream->metrics->pending.underflows);
+            metrics_recorded(stream);
+        }
+
         stream_destroy(stream);
     }
 }
@@ -580,10 +827,8 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
     struct stream        *stream = (struct stream *)userdata;
     struct stream_stat   *stat   = &stream->stat;
     const pa_buffer_attr *battr;
-    int16_t              *samples;
+    void                 *samples;
     size_t                buflen;
-    int16_t              *extra;
-    size_t                extlen;
     struct timeval        tv;
     uint32_t              start = 0;
     uint32_t              gap = 0;
@@ -591,13 +836,17 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
     uint32_t              calc;
     uint32_t              period;
     uint32_t              cpu;
-
+    int64_t               mstart = 0;
 
     if (!stream || stream->pastr != pastr) {
         N_ERROR(LOG_CAT "%s(): Confused with data structures", __FUNCTION__);
         return;
     }
 
+    /* the audio thread does not wake up the main loop */
+    if (!ausrv_in_audio_thread(stream->ausrv))
+        n_wakeup_note("tonegen.pulse");
+
     if (stream->killed)
         return;
 
@@ -607,52 +856,19 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
         gap   = start - stat->wrtime;
     }
 
+    if (stream->metrics)
+        mstart = g_get_monotonic_time();
+
 #ifdef ENABLE_VERBOSE_TRACE
     TRACE("%s(): %d bytes", __FUNCTION__, bytes);
 #endif
 
-    if (stream->buf.samples == NULL) {
-        buflen  = (bytes + 1) & (~1U);
-        samples = (int16_t *)malloc(buflen);
-
-        if (samples != NULL)
-            write_samples(stream, samples,buflen, &cpu);
-        else {
-            N_ERROR(LOG_CAT "%s(): failed to allocate memory", __FUNCTION__);
-            return;
-        }
-    }
-    else {
-        if (bytes <= stream->buf.buflen) {
-            buflen  = stream->buf.buflen;
-            samples = stream->buf.samples;
-            cpu     = stream->buf.cpu;
-        }
-        else {
-            buflen  = (bytes + 1) & (~1U);
-            samples = (int16_t *)realloc(stream->buf.samples, buflen);
-
-            extra  = samples + (stream->buf.buflen / 2);
-            extlen = buflen - stream->buf.buflen;
+    if (bytes % stream->framesize)
+        bytes += stream->framesize - bytes % stream->framesize;
 
-            if (samples != NULL) {
-                TRACE("%s(): extending write-ahead-buffer %u butes (%u -> %u)",
-                      __FUNCTION__, extlen, stream->buf.buflen, buflen);
-                write_samples(stream, extra,extlen, &cpu);
-                cpu += stream->buf.cpu;
-            }
-            else {
-                N_ERROR(LOG_CAT "%s(): failed to allocate memory", __FUNCTION__);
-                return;
-            }
-        }
-
-        stream->buf.samples = NULL;
-        stream->buf.cpu = 0;
-    }
+    buflen = output_samples(stream, bytes, &cpu);
 
-
-    if (samples != NULL) {
+    if (buflen > 0) {
 
         if (print_statistics) {
             gettimeofday(&tv, NULL);
@@ -698,10 +914,16 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
             }
         }
 
-        pa_stream_write(stream->pastr, (void*)samples,buflen, free,
-                        0,PA_SEEK_RELATIVE);
         stream->bcnt += buflen;
 
+        if (stream->metrics)
+            update_metrics(stream, buflen, mstart);
+
+        if (stream->data == NULL)
+            stream->silence += buflen;
+        else
+            stream->silence = 0;
+
 
 #ifdef ENABLE_VERBOSE_TRACE
         TRACE("stream time %09umsec end %09umsec",
@@ -716,17 +938,40 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
                     stream->bufsize = battr->minreq;
             }
 
-            if (stream->bufsize != (uint32_t)-1) {
-                stream->buf.samples = (int16_t *)malloc(stream->bufsize);
-                stream->buf.buflen  = stream->bufsize;
+            if (stream->bufsize != (uint32_t)-1 &&
+                stream->buf.size < stream->bufsize)
+            {
+                /* only once, when the minreq of the stream is known */
+                samples = realloc(stream->buf.samples, stream->bufsize);
 
-                if (stream->buf.samples == NULL)
+                if (samples == NULL)
                     N_ERROR(LOG_CAT "%s(): failed to allocate memory", __FUNCTION__);
                 else {
-                    write_samples(stream, stream->buf.samples,stream->bufsize,
-                                  &stream->buf.cpu);
+                    stream->buf.samples = samples;
+                    stream->buf.size    = stream->bufsize;
                 }
             }
+
+            if (stream->bufsize != (uint32_t)-1 &&
+                stream->buf.size >= stream->bufsize)
+            {
+                write_samples(stream, stream->buf.samples,stream->bufsize,
+                              &stream->buf.cpu);
+                stream->buf.buflen = stream->bufsize;
+            }
+
+            if (stream->metrics) {
+                pending_sample(&stream->metrics->pending.render,
+                               g_get_monotonic_time() - mstart);
+                metrics_recorded(stream);
+            }
+
+            if (stream->lingering && !stream->corked && stream->data == NULL) {
+                battr = pa_stream_get_buffer_attr(pastr);
+
+                if (battr == NULL || stream->silence >= battr->tlength)
+                    cork_stream(stream);
+            }
         }
     }
 }
@@ -770,14 +1015,14 @@ static void drain_callback(pa_stream *pastr, int success, void *userdata)
 }
 
 
-static void write_samples(struct stream *stream, int16_t *samples,
+static void write_samples(struct stream *stream, void *samples,
                           size_t bytes, uint32_t *cpu)
 {
     int       length;
     clock_t   cpubeg;
     clock_t   cpuend;
 
-    length = bytes/2;
+    length = bytes / stream->framesize;
 
     cpubeg = print_statistics ? clock() : 0;
 
@@ -789,3 +1034,289 @@ static void write_samples(struct stream *stream, int16_t *samples,
 
     return;
 }
+
+/*
+ * Hands at least 'bytes' to PulseAudio, the write-ahead buffer first and
+ * then freshly rendered samples. Samples are rendered straight into the
+ * memory of pa_stream_begin_write() so nothing gets allocated here and
+ * PulseAudio does not need to copy them.
+ */
+static size_t output_samples(struct stream *stream, size_t bytes,
+                             uint32_t *cpu)
+{
+    size_t    ahead = stream->buf.buflen;
+    size_t    total = bytes > ahead ? bytes : ahead;
+    size_t    done;
+    size_t    len;
+    size_t    copy;
+    uint32_t  extra;
+    void     *data;
+
+    *cpu = ahead ? stream->buf.cpu : 0;
+
+    for (done = 0;  done < total;  done += len) {
+        len  = total - done;
+        data = NULL;
+
+        if (pa_stream_begin_write(stream->pastr, &data, &len) < 0 ||
+            data == NULL)
+        {
+            data = stream->buf.scratch;
+            len  = total - done;
+
+            if (len > stream->buf.scratchlen)
+                len = stream->buf.scratchlen;
+        }
+
+        if ((len -= len % stream->framesize) == 0) {
+            if (data != stream->buf.scratch)
+                pa_stream_cancel_write(stream->pastr);
+            break;
+        }
+
+        copy = done < ahead ? ahead - done : 0;
+
+        if (copy > len)
+            copy = len;
+
+        if (copy > 0)
+            memcpy(data, (char *)stream->buf.samples + done, copy);
+
+        if (copy < len) {
+            write_samples(stream, (char *)data + copy,
+                          len - copy, &extra);
+            *cpu += extra;
+        }
+
+        if (pa_stream_write(stream->pastr, data,len, NULL,
+                            0,PA_SEEK_RELATIVE) < 0)
+        {
+            N_ERROR(LOG_CAT "%s(): failed to write stream '%s'",
+                    __FUNCTION__, stream->name);
+            break;
+        }
+    }
+
+    stream->buf.buflen = 0;
+    stream->buf.cpu    = 0;
+
+    return done;
+}
+
+static void free_buffers(struct stream *stream)
+{
+    free(stream->buf.samples);
+    free(stream->buf.scratch);
+
+    stream->buf.samples = NULL;
+    stream->buf.scratch = NULL;
+    stream->buf.buflen  = 0;
+    stream->buf.size    = 0;
+}
+
+static void pending_sample(struct pending_samples *samples, int64_t value)
+{
+    gint tail = samples->tail;
+
+    /* samples beyond the ring are dropped until the next publish */
+    if ((guint)(tail - g_atomic_int_get(&samples->head)) >= PENDING_SAMPLES)
+        return;
+
+    samples->values[tail & (PENDING_SAMPLES - 1)] = value;
+    g_atomic_int_set(&samples->tail, tail + 1);
+}
+
+static void publish_samples(NMetricHistogram *histogram,
+                            struct pending_samples *samples)
+{
+    gint tail = g_atomic_int_get(&samples->tail);
+    gint head = samples->head;
+
+    for (;  head != tail;  head++)
+        n_metric_histogram_add(histogram,
+                               samples->values[head & (PENDING_SAMPLES - 1)]);
+
+    g_atomic_int_set(&samples->head, head);
+}
+
+static void publish_metrics(struct stream_metrics *m)
+{
+    struct pending_metrics *p = &m->pending;
+    guint                   value;
+
+    if ((value = g_atomic_int_and(&p->writes, 0)) > 0)
+        n_metric_counter_add(m->writes, value);
+    if ((value = g_atomic_int_and(&p->bytes, 0)) > 0)
+        n_metric_counter_add(m->bytes, value);
+    if ((value = g_atomic_int_and(&p->underflows, 0)) > 0)
+        n_metric_counter_add(m->underflows, value);
+    if ((value = g_atomic_int_and(&p->late, 0)) > 0)
+        n_metric_counter_add(m->late, value);
+
+    /* the high-water mark first, the gauge is left at the last value */
+    if ((value = g_atomic_int_and(&p->buffer_max, 0)) > 0)
+        n_metric_gauge_set(m->buffer, value - 1);
+    if ((value = g_atomic_int_and(&p->buffer, 0)) > 0)
+        n_metric_gauge_set(m->buffer, value - 1);
+
+    publish_samples(m->gap, &p->gap);
+    publish_samples(m->render, &p->render);
+}
+
+static gboolean publish_callback(gpointer userdata)
+{
+    struct stream_metrics *m;
+
+    (void)userdata;
+
+    n_wakeup_note("tonegen.metrics");
+    g_atomic_int_set(&publish_scheduled, 0);
+
+    for (m = stream_metrics;  m->name;  m++) {
+        if (m->writes)
+            publish_metrics(m);
+    }
+
+    return FALSE;
+}
+
+static void metrics_recorded(struct stream *stream)
+{
+    if (!ausrv_in_audio_thread(stream->ausrv))
+        publish_metrics(stream->metrics);
+    else if (g_atomic_int_compare_and_exchange(&publish_scheduled, 0, 1))
+        g_timeout_add(PUBLISH_INTERVAL, publish_callback, &publish_scheduled);
+}
+
+static void update_metrics(struct stream *stream, size_t bytes, int64_t now)
+{
+    struct pending_metrics *p = &stream->metrics->pending;
+    int64_t                 gap;
+
+    g_atomic_int_inc((gint *)&p->writes);
+    g_atomic_int_add((gint *)&p->bytes, (gint)bytes);
+    g_atomic_int_set((gint *)&p->buffer, (gint)bytes + 1);
+    if ((guint)bytes + 1 > (guint)g_atomic_int_get((gint *)&p->buffer_max))
+        g_atomic_int_set((gint *)&p->buffer_max, (gint)bytes + 1);
+
+    if (stream->lastwr) {
+        gap = now - stream->lastwr;
+
+        pending_sample(&p->gap, gap);
+
+        if (min_bufreq > 0 && gap > (int64_t)min_bufreq * 1000)
+            g_atomic_int_inc((gint *)&p->late);
+    }
+
+    stream->lastwr = now;
+
+    metrics_recorded(stream);
+}
+
+static void cork_stream(struct stream *stream)
+{
+    pa_mainloop_api *api = stream->ausrv->api;
+    pa_operation    *oper;
+    struct timeval   tv;
+
+    TRACE("%s(): corking stream '%s' for %u msec", __FUNCTION__,
+          stream->name, linger_time);
+
+    if ((oper = pa_stream_cork(stream->pastr, 1, NULL, NULL)) != NULL)
+        pa_operation_unref(oper);
+
+    stream->corked = true;
+
+    gettimeofday(&tv, NULL);
+    tv.tv_sec  += linger_time / 1000;
+    tv.tv_usec += (linger_time % 1000) * 1000;
+
+    if (tv.tv_usec >= 1000000) {
+        tv.tv_sec  += 1;
+        tv.tv_usec -= 1000000;
+    }
+
+    cancel_linger(stream);
+    stream->linger = api->time_new(api, &tv, linger_callback, (void *)stream);
+}
+
+static void cancel_linger(struct stream *stream)
+{
+    if (stream->linger != NULL) {
+        stream->ausrv->api->time_free(stream->linger);
+        stream->linger = NULL;
+    }
+}
+
+static void linger_callback(pa_mainloop_api *api, pa_time_event *event,
+                            const struct timeval *tv, void *data)
+{
+    struct stream *stream = (struct stream *)data;
+
+    (void)api;
+    (void)tv;
+
+    if (event != stream->linger) {
+        N_ERROR(LOG_CAT "%s(): Called with unknown timer", __FUNCTION__);
+        return;
+    }
+
+    TRACE("%s(): stream '%s' lingered long enough", __FUNCTION__,
+          stream->name);
+
+    stream_destroy(stream);
+}
+
+static void server_info_callback(pa_context *context,
+                                 const pa_server_info *info, void *data)
+{
+    pa_operation *oper;
+
+    if (info == NULL || info->default_sink_name == NULL) {
+        N_ERROR(LOG_CAT "%s(): Can't find the default sink", __FUNCTION__);
+        return;
+    }
+
+    oper = pa_context_get_sink_info_by_name(context, info->default_sink_name,
+                                            sink_info_callback, data);
+    if (oper != NULL)
+        pa_operation_unref(oper);
+}
+
+static void sink_info_callback(pa_context *context, const pa_sink_info *info,
+                               int eol, void *data)
+{
+    const pa_sample_spec *spec;
+
+    (void)context;
+    (void)data;
+
+    if (eol || info == NULL)
+        return;
+
+    spec = &info->sample_spec;
+
+    switch (spec->rate) {
+    case 8000:
+    case 16000:
+    case 44100:
+    case 48000:
+        default_rate = spec->rate;
+        break;
+    default:
+        break;
+    }
+
+    /* anything but 16 bit is converted cheaper from float */
+    if (spec->format == PA_SAMPLE_S16LE || spec->format == PA_SAMPLE_S16BE)
+        default_format = PA_SAMPLE_S16NE;
+    else
+        default_format = PA_SAMPLE_FLOAT32NE;
+
+    N_DEBUG(LOG_CAT "sink '%s' runs %s at %uHz, rendering %s at %uHz",
+            info->name, pa_sample_format_to_string(spec->format), spec->rate,
+            pa_sample_format_to_string(default_format), default_rate);
+
+    /* the DTMF stream is created at the default rate */
+    dtmf_prepare(default_rate);
+}
@@ -25,6 +25,7 @@ USA.
 
 #include <stdbool.h>
 #include <pulse/pulseaudio.h>
+#include <ngf/metrics.h>
 
 #define STREAM_INDICATOR    "indtone"
 #define STREAM_DTMF         "dtmf"
@@ -38,6 +39,7 @@ USA.
 #define INPUT_BY_ROLE       "sink-input-by-media-role"
 
 struct ausrv;
+struct stream_metrics;
 
 struct stream_stat {
     uint64_t           firstwr;      /* first writting time */
@@ -62,6 +64,8 @@ struct stream {
     int                id;       /* stream id */
     char              *name;     /* stream name */
     uint32_t           rate;     /* sample rate */
+    pa_sample_format_t format;   /* PA_SAMPLE_S16NE or PA_SAMPLE_FLOAT32NE */
+    uint32_t           framesize; /* bytes per sample */
     pa_stream         *pastr;    /* pulse audio stream */
     uint64_t           start;    /* wall clock time of stream creation */
     uint32_t           time;     /* buffer time in usecs */
@@ -70,28 +74,45 @@ struct stream {
     bool               killed;
     uint32_t           bufsize;  /* write-ahead-buffer size (ie. minreq) */
     uint32_t           bcnt;     /* byte count */
-    uint32_t         (*write)(struct stream *s, int16_t *samples, int length);
+    uint32_t         (*write)(struct stream *s, void *samples, int length);
     void             (*destroy)(void *);
     void              *data;     /* extension */
     struct stream_stat stat;     /* statistics */
+    struct stream_metrics *metrics;
+    int64_t            lastwr;   /* monotonic time of last write */
+    bool               lingering; /* cork when the tones are gone */
+    bool               corked;
+    uint32_t           silence;  /* bytes of silence written since last tone */
+    pa_time_event     *linger;   /* destroys the corked stream */
     struct {
-        int16_t  *samples;
-        size_t    buflen;
+        void     *samples;  /* write-ahead buffer */
+        size_t    buflen;   /* bytes rendered ahead, 0 if none */
+        size_t    size;     /* allocated size of samples */
         uint32_t  cpu;
+        void     *scratch;  /* used when pa_stream_begin_write() fails */
+        size_t    scratchlen;
     }                  buf;
 };
 
 int stream_init(void);
+void stream_exit(void);
 void stream_set_default_samplerate(uint32_t rate);
+void stream_set_default_format(pa_sample_format_t format);
+void stream_set_native_format(bool native);
+void stream_query_native_format(struct ausrv *ausrv);
 void stream_print_statistics(bool print);
 void stream_buffering_parameters(int tlen, int minreq);
+void stream_register_metrics(NMetrics *metrics);
 struct stream *stream_create(struct ausrv *ausrv, const char *name, const char *sink, uint32_t sample_rate,
-                             uint32_t (*write)(struct stream *s, int16_t *samples, int length),
+                             uint32_t (*write)(struct stream *s, void *samples, int length),
                              void (*destroy)(void* data),
                              void *proplist,
                              void *data);
 void stream_destroy(struct stream *stream);
 void stream_set_timeout(struct stream *stream, uint32_t timeout);
+void stream_set_linger(uint32_t msec);
+bool stream_linger(struct stream *stream);
+void stream_resume(struct stream *stream);
 void stream_kill_all(struct ausrv *ausrv);
 void stream_clean_buffer(struct stream *stream);
 struct stream *stream_find(struct ausrv *stream, char *name);
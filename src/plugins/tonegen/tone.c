@@ -27,6 +27,13 @@ USA.
 #include <errno.h>
 #include <stdbool.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TONE_NEON
+#include <arm_neon.h>
+#endif
+
 #include <ngf/log.h>
 #include <trace/trace.h>
 
@@ -40,6 +47,31 @@ USA.
 #define OFFSET    8192
 #define SCALE     1024ULL
 
+#define BLOCK_LENGTH 256  /* samples per block, must be a multiple of 8 */
+
+#define WAVETABLE_MAX_LENGTH 8192
+#define WAVETABLE_MAX_COUNT  32
+
+/*
+ * One period of a full scale sine at a given frequency and sample rate.
+ * Tables are shared by every tone with the same frequency and rate. The
+ * list is kept in the order of use; when it is full the least recently
+ * used table no tone plays is dropped. Prepared tables, such as the DTMF
+ * ones, are never dropped, and all of them go in tone_exit().
+ */
+struct wavetable {
+    struct wavetable *next;
+    uint32_t          freq;
+    uint32_t          rate;
+    uint32_t          length;
+    uint32_t          users;    /* tones playing the table */
+    bool              prepared;
+    int16_t           samples[];
+};
+
+static struct wavetable *wavetables;
+static int               wavetable_count;
+
 static inline void singen_init(struct singen *singen, uint32_t freq,
                                uint32_t rate, uint32_t volume)
 {
@@ -53,6 +85,12 @@ static inline void singen_init(struct singen *singen, uint32_t freq,
     singen->n1 = 0;
 
     singen->offs = volume ? (OFFSET * 100) / volume : LONG_MAX;
+
+    /* the step the rounded m gives, so the block renderer plays the
+       frequency of the integer recurrence */
+    singen->w     = acos((double)singen->m / (2.0 * AMPLITUDE * OFFSET));
+    singen->amp   = (double)(AMPLITUDE * OFFSET) / (double)singen->offs;
+    singen->count = 0;
 }
 
 static inline int32_t singen_write(struct singen *singen)
@@ -65,13 +103,398 @@ static inline int32_t singen_write(struct singen *singen)
     return (int32_t)(singen->n0 / singen->offs);
 }
 
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    uint32_t r;
+
+    while (b) {
+        r = a % b;
+        a = b;
+        b = r;
+    }
+
+    return a;
+}
+
+/*
+ * The table holds a whole number of cycles so looping over it is
+ * seamless. When the exact period does not fit in WAVETABLE_MAX_LENGTH
+ * the length with the smallest frequency error is used instead.
+ */
+static struct wavetable *wavetable_create(uint32_t freq, uint32_t rate)
+{
+    struct wavetable *table;
+    uint32_t          length;
+    uint32_t          cycles;
+    uint32_t          l, c;
+    double            err, best;
+    uint32_t          i;
+
+    length = rate / gcd(freq, rate);
+    cycles = freq / gcd(freq, rate);
+
+    if (length > WAVETABLE_MAX_LENGTH) {
+        best = -1.0;
+
+        for (l = WAVETABLE_MAX_LENGTH;  l > WAVETABLE_MAX_LENGTH / 2;  l--) {
+            c   = (uint32_t)((double)l * freq / rate + 0.5);
+            err = fabs((double)c * rate / l - freq);
+
+            if (best < 0.0 || err < best) {
+                best   = err;
+                length = l;
+                cycles = c;
+            }
+        }
+
+        N_DEBUG(LOG_CAT "%u Hz table at %u Hz is %u samples, "
+                "%.3f Hz off", freq, rate, length, best);
+    }
+
+    table = malloc(sizeof(*table) + length * sizeof(table->samples[0]));
+
+    if (table == NULL) {
+        N_ERROR(LOG_CAT "%s(): Can't allocate memory", __FUNCTION__);
+        return NULL;
+    }
+
+    table->next     = NULL;
+    table->freq     = freq;
+    table->rate     = rate;
+    table->length   = length;
+    table->users    = 0;
+    table->prepared = false;
+
+    for (i = 0;  i < length;  i++) {
+        table->samples[i] = lrint(AMPLITUDE * sin(2.0 * M_PI * cycles *
+                                                  ((double)i / length)));
+    }
+
+    return table;
+}
+
+/* drops the least recently used table that is neither played nor prepared */
+static bool wavetable_evict(void)
+{
+    struct wavetable **prev;
+    struct wavetable **victim = NULL;
+    struct wavetable  *table;
+
+    for (prev = &wavetables;  (table = *prev);  prev = &table->next) {
+        if (!table->users && !table->prepared)
+            victim = prev;
+    }
+
+    if (victim == NULL)
+        return false;
+
+    table   = *victim;
+    *victim = table->next;
+    wavetable_count--;
+
+    N_DEBUG(LOG_CAT "dropped %u Hz table at %u Hz", table->freq, table->rate);
+    free(table);
+
+    return true;
+}
+
+static struct wavetable *wavetable_get(uint32_t freq, uint32_t rate)
+{
+    struct wavetable **prev;
+    struct wavetable  *table;
+
+    for (prev = &wavetables;  (table = *prev);  prev = &table->next) {
+        if (table->freq == freq && table->rate == rate) {
+            *prev       = table->next;
+            table->next = wavetables;
+            wavetables  = table;
+            return table;
+        }
+    }
+
+    if (freq >= rate / 2)
+        return NULL;
+
+    if (wavetable_count >= WAVETABLE_MAX_COUNT && !wavetable_evict())
+        return NULL;
+
+    if ((table = wavetable_create(freq, rate)) != NULL) {
+        table->next = wavetables;
+        wavetables  = table;
+        wavetable_count++;
+    }
+
+    return table;
+}
+
+static inline void tablegen_init(struct tablegen *tablegen,
+                                 struct wavetable *table,
+                                 uint32_t volume)
+{
+    int64_t offs;
+
+    if (volume > 100) volume = 100;
+
+    /* same amplitude as singen_init() gives */
+    offs = (OFFSET * 100) / volume;
+
+    tablegen->table = table;
+    tablegen->pos   = 0;
+    tablegen->gain  = (AMPLITUDE * OFFSET) / offs;
+
+    table->users++;
+}
+
+static inline int32_t tablegen_write(struct tablegen *tablegen)
+{
+    const struct wavetable *table = tablegen->table;
+    int32_t                 sample;
+
+    sample = (table->samples[tablegen->pos] * tablegen->gain) / AMPLITUDE;
+
+    if (++tablegen->pos >= table->length)
+        tablegen->pos = 0;
+
+    return sample;
+}
+
+static void tablegen_write_block(struct tablegen *tablegen, float *out,
+                                 int len)
+{
+    const struct wavetable *table = tablegen->table;
+    const int16_t          *in;
+    float                   gain  = (float)tablegen->gain / AMPLITUDE;
+    uint32_t                n;
+    uint32_t                i;
+
+    while (len > 0) {
+        in = table->samples + tablegen->pos;
+        n  = table->length - tablegen->pos;
+
+        if (n > (uint32_t)len)
+            n = len;
+
+        for (i = 0;  i < n;  i++)
+            out[i] = in[i] * gain;
+
+        out += n;
+        len -= n;
+
+        if ((tablegen->pos += n) >= table->length)
+            tablegen->pos = 0;
+    }
+}
+
+/*
+ * Block renderer: instead of running the integer recurrence one sample
+ * at a time it produces a run of samples as four interleaved float
+ * recurrences, s[k+4] = 2cos(4w) * s[k] - s[k-4], seeded with sin()
+ * at the start of every run so there is no drift over long tones.
+ * out must have room for len rounded up to a multiple of four.
+ */
+static void singen_write_block(struct singen *singen, float *out, int len)
+{
+    double k = (double)singen->count;
+    float  prev[4];
+    float  curr[4];
+    float  c;
+    int    i;
+
+    c = 2.0 * cos(4.0 * singen->w);
+
+    for (i = 0;  i < 4;  i++) {
+        prev[i] = singen->amp * sin((k + i - 4.0) * singen->w);
+        curr[i] = singen->amp * sin((k + i) * singen->w);
+    }
+
+    singen->count += len;
+
+#if defined(__SSE2__)
+    {
+        __m128 vc = _mm_set1_ps(c);
+        __m128 vp = _mm_loadu_ps(prev);
+        __m128 vs = _mm_loadu_ps(curr);
+        __m128 vn;
+
+        for (i = 0;  i < len;  i += 4) {
+            _mm_storeu_ps(out + i, vs);
+            vn = _mm_sub_ps(_mm_mul_ps(vc, vs), vp);
+            vp = vs;
+            vs = vn;
+        }
+    }
+#elif defined(TONE_NEON)
+    {
+        float32x4_t vc = vdupq_n_f32(c);
+        float32x4_t vp = vld1q_f32(prev);
+        float32x4_t vs = vld1q_f32(curr);
+        float32x4_t vn;
+
+        for (i = 0;  i < len;  i += 4) {
+            vst1q_f32(out + i, vs);
+            vn = vsubq_f32(vmulq_f32(vc, vs), vp);
+            vp = vs;
+            vs = vn;
+        }
+    }
+#else
+    {
+        float next;
+        int   j;
+
+        for (i = 0;  i < len;  i += 4) {
+            for (j = 0;  j < 4;  j++) {
+                out[i + j] = curr[j];
+                next    = c * curr[j] - prev[j];
+                prev[j] = curr[j];
+                curr[j] = next;
+            }
+        }
+    }
+#endif
+}
+
+static inline void mix_block(float *acc, const float *in, int len)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    for (;  i + 4 <= len;  i += 4)
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                          _mm_loadu_ps(in + i)));
+#elif defined(TONE_NEON)
+    for (;  i + 4 <= len;  i += 4)
+        vst1q_f32(acc + i, vaddq_f32(vld1q_f32(acc + i), vld1q_f32(in + i)));
+#endif
+
+    for (;  i < len;  i++)
+        acc[i] += in[i];
+}
+
+static inline void saturate_block(int16_t *buf, const float *acc, int len)
+{
+    int32_t sample;
+    int     i = 0;
+
+    /* truncate towards zero like the integer path does */
+#if defined(__SSE2__)
+    for (;  i + 8 <= len;  i += 8) {
+        __m128i lo = _mm_cvttps_epi32(_mm_loadu_ps(acc + i));
+        __m128i hi = _mm_cvttps_epi32(_mm_loadu_ps(acc + i + 4));
+
+        _mm_storeu_si128((__m128i *)(buf + i), _mm_packs_epi32(lo, hi));
+    }
+#elif defined(TONE_NEON)
+    for (;  i + 4 <= len;  i += 4)
+        vst1_s16(buf + i, vqmovn_s32(vcvtq_s32_f32(vld1q_f32(acc + i))));
+#endif
+
+    for (;  i < len;  i++) {
+        sample = (int32_t)acc[i];
+
+        if (sample > SHRT_MAX)
+            buf[i] = SHRT_MAX;
+        else if (sample < SHRT_MIN)
+            buf[i] = SHRT_MIN;
+        else
+            buf[i] = sample;
+    }
+}
+
+/* full scale floats, the integer path saturates at the same level */
+static inline void float_block(float *buf, const float *acc, int len)
+{
+    const float scale = 1.0f / 32768.0f;
+    float       sample;
+    int         i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128 vmax   = _mm_set1_ps(SHRT_MAX * scale);
+    const __m128 vmin   = _mm_set1_ps(-1.0f);
+
+    for (;  i + 4 <= len;  i += 4) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(acc + i), vscale);
+
+        _mm_storeu_ps(buf + i, _mm_max_ps(_mm_min_ps(v, vmax), vmin));
+    }
+#elif defined(TONE_NEON)
+    const float32x4_t vmax = vdupq_n_f32(SHRT_MAX * scale);
+    const float32x4_t vmin = vdupq_n_f32(-1.0f);
+
+    for (;  i + 4 <= len;  i += 4) {
+        float32x4_t v = vmulq_n_f32(vld1q_f32(acc + i), scale);
+
+        vst1q_f32(buf + i, vmaxq_f32(vminq_f32(v, vmax), vmin));
+    }
+#endif
+
+    for (;  i < len;  i++) {
+        sample = acc[i] * scale;
+
+        if (sample > SHRT_MAX * scale)
+            buf[i] = SHRT_MAX * scale;
+        else if (sample < -1.0f)
+            buf[i] = -1.0f;
+        else
+            buf[i] = sample;
+    }
+}
+
 static void setup_envelop_for_tone(struct tone *tone, tone_type type, uint32_t play, uint32_t duration);
+static uint32_t tone_write_silence(struct stream *stream, void *buf, int len);
+static uint64_t tone_write_scalar(struct stream *stream, uint64_t t, int16_t *buf, int len);
+static uint32_t tone_write_converted(struct stream *stream, float *buf, int len);
+static uint32_t tone_write_block(struct stream *stream, void *buf, int len);
+static void schedule_tone(struct stream *stream, struct tone *tone);
+static void retire_tones(struct stream *stream, uint64_t t);
+
+static bool block_synthesis = true;
 
 int tone_init(void)
 {
     return 0;
 }
 
+void tone_exit(void)
+{
+    struct wavetable *table;
+
+    while ((table = wavetables) != NULL) {
+        wavetables = table->next;
+        free(table);
+    }
+
+    wavetable_count = 0;
+}
+
+void tone_set_block_synthesis(bool enable)
+{
+    block_synthesis = enable;
+}
+
+bool tone_prepare_table(uint32_t freq, uint32_t rate)
+{
+    struct wavetable *table;
+
+    if ((table = wavetable_get(freq, rate)) == NULL)
+        return false;
+
+    table->prepared = true;
+
+    return true;
+}
+
+void tone_release_table(uint32_t freq, uint32_t rate)
+{
+    struct wavetable *table;
+
+    for (table = wavetables;  table;  table = table->next) {
+        if (table->freq == freq && table->rate == rate)
+            table->prepared = false;
+    }
+}
+
 
 struct tone *tone_create(struct stream *stream,
                          tone_type      type,
@@ -84,8 +507,8 @@ struct tone *tone_create(struct stream *stream,
 {
     struct tone *link = NULL;
     uint32_t     time = stream->time;
-    struct tone *next = (struct tone *)stream->data;
     struct tone *tone;
+    struct wavetable *table;
 
     if (!volume || !period || !play)
         return NULL;
@@ -101,7 +524,6 @@ struct tone *tone_create(struct stream *stream,
                 while (link->chain)
                     link = link->chain;
 
-                next = NULL;
                 time = link->end / SCALE;
                 break;
             }
@@ -110,7 +532,6 @@ struct tone *tone_create(struct stream *stream,
 
     TRACE("%s(): %s", __FUNCTION__, link ? "chain" : "don't chain");
 
-    tone->next    = next;
     tone->stream  = stream;
     tone->type    = type;
     tone->period  = period;
@@ -122,6 +543,10 @@ struct tone *tone_create(struct stream *stream,
 
     if (!freq)
         tone->backend = BACKEND_UNKNOWN;
+    else if ((table = wavetable_get(freq, stream->rate)) != NULL) {
+        tone->backend = BACKEND_TABLE;
+        tablegen_init(&tone->tablegen, table, volume);
+    }
     else {
         tone->backend = BACKEND_SINGEN;
         singen_init(&tone->singen, freq, stream->rate, volume);
@@ -131,7 +556,7 @@ struct tone *tone_create(struct stream *stream,
     if (link)
         link->chain = tone;
     else
-        stream->data = (void *)tone;
+        schedule_tone(stream, tone);
 
     if (duration)
         stream->flush = false;
@@ -139,6 +564,15 @@ struct tone *tone_create(struct stream *stream,
     return tone;
 }
 
+static void tone_free(struct tone *tone)
+{
+    if (tone->backend == BACKEND_TABLE)
+        tone->tablegen.table->users--;
+
+    envelop_destroy(tone->envelop);
+    free(tone);
+}
+
 void tone_destroy(struct tone *tone, bool kill_chain)
 {
     struct stream  *stream = tone->stream;
@@ -157,8 +591,7 @@ void tone_destroy(struct tone *tone, bool kill_chain)
                 if (kill_chain) {
                     for (link = tone->chain;  link;  link = chain) {
                         chain = link->chain;
-                        envelop_destroy(link->envelop);
-                        free(link);
+                        tone_free(link);
                     }
                     prev->next = tone->next;
                 }
@@ -167,8 +600,7 @@ void tone_destroy(struct tone *tone, bool kill_chain)
                     link->next = tone->next;
                 }
             }
-            envelop_destroy(tone->envelop);
-            free(tone);
+            tone_free(tone);
             return;
         }
     }
@@ -182,6 +614,8 @@ bool tone_chainable(tone_type type)
     switch (type) {
     case TONE_DTMF_L:
     case TONE_DTMF_H:
+    case TONE_DTMF_SEQ_L:
+    case TONE_DTMF_SEQ_H:
     case TONE_NOTE_0:
         return 1;
     default:
@@ -189,18 +623,48 @@ bool tone_chainable(tone_type type)
     }
 }
 
-uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int len)
+uint32_t tone_write_callback(struct stream *stream, void *buf, int len)
+{
+    if (stream->data == NULL)
+        return tone_write_silence(stream, buf, len);
+
+    if (block_synthesis)
+        return tone_write_block(stream, buf, len);
+
+    if (stream->format == PA_SAMPLE_FLOAT32NE)
+        return tone_write_converted(stream, (float *)buf, len);
+
+    return (uint32_t)(tone_write_scalar(stream, (uint64_t)stream->time * SCALE,
+                                        (int16_t *)buf, len) / SCALE);
+}
+
+static uint32_t tone_write_silence(struct stream *stream, void *buf, int len)
+{
+    uint64_t t, dt;
+
+    t  = (uint64_t)stream->time * SCALE;
+    dt = (1000000ULL * SCALE) / (uint64_t)stream->rate;
+
+    memset(buf, 0, (size_t)len * stream->framesize);
+
+    return (uint32_t)((t + dt * (uint64_t)len) / SCALE);
+}
+
+/*
+ * Reference renderer, one sample at a time with the integer recurrence.
+ * Returns the time after the last sample in SCALE units.
+ */
+static uint64_t tone_write_scalar(struct stream *stream, uint64_t t, int16_t *buf, int len)
 {
     struct tone   *tone;
     struct tone   *next;
-    uint64_t       t, dt;
+    uint64_t       dt;
     uint32_t       abst;
     uint32_t       relt;
     int32_t        sine;
     int32_t        sample;
     int            i;
 
-    t  = (uint64_t)stream->time * SCALE;
     dt = (1000000ULL * SCALE) / (uint64_t)stream->rate;
 
     if (stream->data == NULL) {
@@ -228,6 +692,12 @@ uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int len)
                             sample += envelop_apply(tone->envelop, sine,
                                                     tone->reltime ? relt:abst);
                             break;
+
+                        case BACKEND_TABLE:
+                            sine    = tablegen_write(&tone->tablegen);
+                            sample += envelop_apply(tone->envelop, sine,
+                                                    tone->reltime ? relt:abst);
+                            break;
                         }
 
                     }
@@ -253,9 +723,215 @@ uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int len)
         }
     }
 
+    return t;
+}
+
+/* the reference renderer for float streams, converting block by block */
+static uint32_t tone_write_converted(struct stream *stream, float *buf, int len)
+{
+    int16_t  samples[BLOCK_LENGTH];
+    float    acc[BLOCK_LENGTH];
+    uint64_t t;
+    int      n, i;
+
+    t = (uint64_t)stream->time * SCALE;
+
+    for (;  len > 0;  len -= n, buf += n) {
+        n = len < BLOCK_LENGTH ? len : BLOCK_LENGTH;
+        t = tone_write_scalar(stream, t, samples, n);
+
+        for (i = 0;  i < n;  i++)
+            acc[i] = samples[i];
+
+        float_block(buf, acc, n);
+    }
+
+    return (uint32_t)(t / SCALE);
+}
+
+/* index of the first sample in the block that is at or after time x */
+static inline int block_index(uint64_t t0, uint64_t dt, uint64_t x, int len)
+{
+    uint64_t i;
+
+    if (x <= t0)
+        return 0;
+
+    i = (x - t0 + dt - 1) / dt;
+
+    return i < (uint64_t)len ? (int)i : len;
+}
+
+static inline uint32_t block_envtime(struct tone *tone, uint64_t t,
+                                     uint64_t base)
+{
+    uint64_t abst = (t - tone->start) / SCALE;
+
+    return (uint32_t)(tone->reltime ? abst - base : abst);
+}
+
+static void render_run(struct tone *tone, float *acc, uint64_t t0,
+                       uint64_t dt, int from, int to, uint64_t base)
+{
+    float    sine[BLOCK_LENGTH];
+    uint32_t envt[BLOCK_LENGTH];
+    uint32_t first;
+    uint32_t last;
+    int      i;
+
+    if (tone->backend == BACKEND_TABLE)
+        tablegen_write_block(&tone->tablegen, sine, to - from);
+    else
+        singen_write_block(&tone->singen, sine, to - from);
+
+    first = block_envtime(tone, t0 + (uint64_t)from   * dt, base);
+    last  = block_envtime(tone, t0 + (uint64_t)(to-1) * dt, base);
+
+    if (envelop_is_flat(tone->envelop, first, last))
+        mix_block(acc + from, sine, to - from);
+    else {
+        /* the times of the scalar path, so the ramps take the same steps */
+        for (i = from;  i < to;  i++)
+            envt[i - from] = block_envtime(tone, t0 + (uint64_t)i * dt, base);
+
+        envelop_apply_block(tone->envelop, acc + from, sine, to - from, envt);
+    }
+}
+
+/*
+ * Render samples [from, to) of the block, split into runs where the
+ * tone is either playing or pausing for its whole length.
+ */
+static void render_tone(struct tone *tone, float *acc, uint64_t t0,
+                        uint64_t dt, int from, int to)
+{
+    uint64_t t, abst, relt, base, limit;
+    int      i, next;
+
+    if (tone->backend == BACKEND_UNKNOWN)
+        return;
+
+    i = block_index(t0, dt, tone->start + 1, to);
+
+    for (i = i > from ? i : from;   i < to;   i = next) {
+        t    = t0 + (uint64_t)i * dt;
+        abst = (t - tone->start) / SCALE;
+        relt = abst % tone->period;
+        base = abst - relt;
+
+        limit = base + (relt < tone->play ? tone->play : tone->period);
+        next  = block_index(t0, dt, tone->start + limit * SCALE, to);
+
+        if (relt < tone->play)
+            render_run(tone, acc, t0, dt, i, next, base);
+    }
+}
+
+static uint32_t tone_write_block(struct stream *stream, void *buf, int len)
+{
+    int16_t     *s16 = (int16_t *)buf;
+    float       *f32 = (float *)buf;
+    float        acc[BLOCK_LENGTH];
+    struct tone *head;
+    struct tone *tone;
+    uint64_t     t, dt, last;
+    int          n, from, end;
+
+    t  = (uint64_t)stream->time * SCALE;
+    dt = (1000000ULL * SCALE) / (uint64_t)stream->rate;
+
+    for (;  len > 0;  len -= n, t += dt * (uint64_t)n) {
+        n    = len < BLOCK_LENGTH ? len : BLOCK_LENGTH;
+        last = t + (uint64_t)(n-1) * dt;
+
+        memset(acc, 0, n * sizeof(*acc));
+
+        /* tones are sorted by start, the rest won't sound in this block */
+        for (head = (struct tone *)stream->data;  head;  head = head->next) {
+            if (head->start >= last)
+                break;
+
+            for (tone = head, from = 0;  tone && from < n;  from = end + 1) {
+                if (!tone->end || tone->end >= last)
+                    end = n;
+                else
+                    end = block_index(t, dt, tone->end + 1, n);
+
+                render_tone(tone, acc, t, dt, from, end);
+
+                /*
+                 * the tone ends on sample 'end'; like the scalar path
+                 * its chained successor starts on the sample after
+                 */
+                tone = tone->chain;
+            }
+        }
+
+        retire_tones(stream, last);
+
+        if (stream->format == PA_SAMPLE_FLOAT32NE) {
+            float_block(f32, acc, n);
+            f32 += n;
+        }
+        else {
+            saturate_block(s16, acc, n);
+            s16 += n;
+        }
+    }
+
     return (uint32_t)(t / SCALE);
 }
 
+/*
+ * Keep stream->data sorted by start time, so that the block renderer
+ * can stop at the first tone that has not started yet.
+ */
+static void schedule_tone(struct stream *stream, struct tone *tone)
+{
+    struct tone *prev;
+
+    for (prev = (struct tone *)&stream->data;  prev->next;  prev = prev->next) {
+        if (prev->next->start > tone->start)
+            break;
+    }
+
+    tone->next = prev->next;
+    prev->next = tone;
+}
+
+/*
+ * Destroy the tones that ended before time t at the block boundary and
+ * put their chained successors in their place in the schedule.
+ */
+static void retire_tones(struct stream *stream, uint64_t t)
+{
+    struct tone *prev;
+    struct tone *tone;
+    struct tone *link;
+
+    for (prev = (struct tone *)&stream->data;  (tone = prev->next);  ) {
+        if (tone->start >= t)
+            break;
+
+        if (!tone->end || tone->end >= t) {
+            prev = tone;
+            continue;
+        }
+
+        while (tone && tone->end && tone->end < t) {
+            link = tone->chain;
+            tone_destroy(tone, false);
+            tone = link;
+        }
+
+        if (tone != NULL) {
+            /* move the successor to where it starts in the schedule */
+            prev->next = tone->next;
+            schedule_tone(stream, tone);
+        }
+    }
+}
+
 void tone_destroy_callback(void *data)
 {
     struct stream *stream;
@@ -293,6 +969,8 @@ static void setup_envelop_for_tone(struct tone *tone, tone_type type,
     case TONE_RING:
     case TONE_DTMF_L:
     case TONE_DTMF_H:
+    case TONE_DTMF_SEQ_L:
+    case TONE_DTMF_SEQ_H:
         tone->reltime = true;
         tone->envelop = envelop_create(ENVELOP_RAMP_LINEAR, 10000, 0, play);
         break;
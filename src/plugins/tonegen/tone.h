@@ -45,11 +45,14 @@ typedef enum _tone_type {
     TONE_DTMF_H       = 12,
     TONE_NOTE_0       = 13,
     TONE_SINGEN_END   = 14,
-    TONE_MAX          = 15
+    TONE_DTMF_SEQ_L   = 15,
+    TONE_DTMF_SEQ_H   = 16,
+    TONE_MAX          = 17
 } tone_type;
 
 #define BACKEND_UNKNOWN      0
 #define BACKEND_SINGEN       1
+#define BACKEND_TABLE        2
 
 
 struct stream;
@@ -60,6 +63,17 @@ struct singen {
     int64_t        n0;
     int64_t        n1;
     int64_t        offs;
+    double         w;        /* angular step for the block renderer */
+    float          amp;
+    uint64_t       count;    /* samples rendered so far */
+};
+
+struct wavetable;
+
+struct tablegen {
+    struct wavetable *table;
+    uint32_t       pos;
+    int32_t        gain;     /* AMPLITUDE means full scale */
 };
 
 
@@ -75,6 +89,7 @@ struct tone {
     int                backend;
     union {
         struct singen  singen;
+        struct tablegen tablegen;
     };
     bool               reltime; /* relative time to be passed to env. func's */
     union envelop     *envelop;
@@ -82,11 +97,15 @@ struct tone {
 
 
 int tone_init(void);
+void tone_exit(void);
+void tone_set_block_synthesis(bool enable);
+bool tone_prepare_table(uint32_t freq, uint32_t rate);
+void tone_release_table(uint32_t freq, uint32_t rate);
 struct tone *tone_create(struct stream *stream, tone_type type, uint32_t freq, uint32_t volume,
                          uint32_t period,uint32_t play, uint32_t start, uint32_t duration);
 void tone_destroy(struct tone *tone, bool kill_chain);
 bool tone_chainable(tone_type type);
-uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int length);
+uint32_t tone_write_callback(struct stream *stream, void *buf, int length);
 void tone_destroy_callback(void *data);
 
 
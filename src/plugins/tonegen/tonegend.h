@@ -25,6 +25,8 @@ USA.
 
 #include <stdint.h>
 
+#include <ngf/sinkinterface.h>
+
 struct dbusif;
 struct ausrv;
 struct ngfif;
@@ -33,6 +35,7 @@ struct tonegend {
     struct ngfif     *ngfd_ctx;
     struct dbusif    *dbus_ctx;
     struct ausrv     *ausrv_ctx;
+    NSinkInterface   *sink;
 };
 
 #endif /* __TONEGEND_TONEGEND_H__ */
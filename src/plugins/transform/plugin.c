@@ -34,10 +34,21 @@ N_PLUGIN_NAME        ("transform")
 N_PLUGIN_VERSION     ("0.1")
 N_PLUGIN_DESCRIPTION ("Transform request properties")
 
+typedef struct _TransformKey
+{
+    NAtom    key;       /* allowed request key */
+    NAtom    target;    /* key the value is stored as */
+    NAtom    original;  /* key for the target value before transform, 0 if not mapped */
+    gboolean custom;    /* allowed only with custom filenames */
+} TransformKey;
+
 static gboolean    transform_allow_all = FALSE;
 static GList      *transform_allowed_keys = NULL;
 static GHashTable *transform_key_map = NULL;
 
+/* the configuration compiled at load time, one entry per allowed key */
+static GArray     *transform_keys = NULL;
+
 static const gchar *tone_search_path = NULL;
 
 static gboolean
@@ -65,8 +76,10 @@ new_request_cb (NHook *hook, void *data, void *userdata)
     (void) userdata;
 
     NProplist *props = NULL, *new_props = NULL;
-    const char *key = NULL, *map_key = NULL, *target = NULL;
-    GList *iter = NULL;
+    const TransformKey *tk = NULL;
+    guint i;
+    int present = 0;
+    gboolean mapped = FALSE;
     NValue *value = NULL;
     NValue *original_value = NULL;
     gboolean allow_custom = FALSE;
@@ -74,7 +87,6 @@ new_request_cb (NHook *hook, void *data, void *userdata)
     const gchar *keyname = NULL;
     gboolean overwrite_audio = FALSE;
     const NValue *context_audio = NULL;
-    gchar *tmp;
 
     NCoreHookTransformPropertiesData *transform = (NCoreHookTransformPropertiesData*) data;
     props = (NProplist*) n_request_get_properties (transform->request);
@@ -96,52 +108,56 @@ new_request_cb (NHook *hook, void *data, void *userdata)
         return;
     }
 
-    new_props = n_proplist_new ();
     allow_custom = query_allow_custom_filenames (transform->request);
 
-    /* Just allow filename and enabled properties to new proplist if custom
-     * is allowed. No point in trying to be too clever. If this needs to be
-     * configurable in the future then update to something else. */
-    if (allow_custom) {
-        if ((value = n_proplist_get (props, SOUND_FILENAME))) {
-            n_proplist_set (new_props, SOUND_FILENAME, n_value_copy (value));
-            N_DEBUG (LOG_CAT "+ allowing custom value '" SOUND_FILENAME "'");
-        }
-        if ((value = n_proplist_get (props, SOUND_ENABLED))) {
-            n_proplist_set (new_props, SOUND_ENABLED, n_value_copy (value));
-            N_DEBUG (LOG_CAT "+ allowing custom value '" SOUND_ENABLED "'");
-        }
+    /* count the allowed keys of the request, with no mapped ones and
+       nothing else the result would be the same properties. */
+    for (i = 0; i < transform_keys->len; i++) {
+        tk = &g_array_index (transform_keys, TransformKey, i);
+        if ((tk->custom && !allow_custom) || !n_proplist_get_by_atom (props, tk->key))
+            continue;
+
+        present++;
+        if (tk->original)
+            mapped = TRUE;
     }
 
-    for (iter = g_list_first (transform_allowed_keys); iter; iter = g_list_next (iter)) {
-        key     = (const char*) iter->data;
-        value   = n_proplist_get (props, key);
-        map_key = g_hash_table_lookup (transform_key_map, key);
-        target  = map_key ? map_key : key;
-
-        if (value && map_key) {
-            tmp = g_strdup_printf ("%s.original", target);
-            original_value = n_proplist_get (props, target);
-            n_proplist_set (new_props, tmp, n_value_copy (original_value));
-            N_DEBUG (LOG_CAT "storing value before transform for key '%s'", tmp);
-            g_free (tmp);
-        }
+    /* all the keys are allowed as they are, the properties stay. */
+    if (!mapped && !(overwrite_audio && !allow_custom) &&
+        present == n_proplist_size (props)) {
+        N_DEBUG (LOG_CAT "nothing to transform.");
+        return;
+    }
+
+    new_props = n_proplist_new ();
 
-        if (value && map_key) {
-            N_DEBUG (LOG_CAT "+ transforming key '%s' to '%s'", key, map_key);
-            n_proplist_set (new_props, map_key, n_value_copy (value));
+    for (i = 0; i < transform_keys->len; i++) {
+        tk = &g_array_index (transform_keys, TransformKey, i);
+        if (tk->custom && !allow_custom)
+            continue;
+
+        if (!(value = n_proplist_get_by_atom (props, tk->key)))
+            continue;
+
+        if (tk->original) {
+            original_value = n_proplist_get_by_atom (props, tk->target);
+            n_proplist_set_by_atom (new_props, tk->original, n_value_copy (original_value));
+            N_DEBUG (LOG_CAT "storing value before transform for key '%s'",
+                n_atom_to_string (tk->original));
+            N_DEBUG (LOG_CAT "+ transforming key '%s' to '%s'",
+                n_atom_to_string (tk->key), n_atom_to_string (tk->target));
         }
-        else if (value) {
-            N_DEBUG (LOG_CAT "+ allowing value '%s'", target);
-            n_proplist_set (new_props, target, n_value_copy (value));
+        else {
+            N_DEBUG (LOG_CAT "+ allowing value '%s'", n_atom_to_string (tk->target));
         }
+
+        n_proplist_set_by_atom (new_props, tk->target, n_value_copy (value));
     }
 
     if (!allow_custom && overwrite_audio)
         n_proplist_set (new_props, SOUND_FILENAME, n_value_copy (context_audio));
 
-    n_request_set_properties (transform->request, new_props);
-    n_proplist_free (new_props);
+    n_request_take_properties (transform->request, new_props);
 }
 
 static int
@@ -204,6 +220,91 @@ parse_transform_map (NProplist *params)
     return TRUE;
 }
 
+static void
+add_transform_key (const char *key, const char *map_key, gboolean custom)
+{
+    TransformKey  tk;
+    TransformKey *e = NULL;
+    gchar        *tmp;
+    guint         i;
+    NAtom         atom = n_atom_intern (key);
+
+    for (i = 0; i < transform_keys->len; i++) {
+        e = &g_array_index (transform_keys, TransformKey, i);
+        if (e->key == atom)
+            break;
+    }
+
+    /* a custom key that is allowed as well is not custom anymore */
+    if (i < transform_keys->len && (custom || !e->custom))
+        return;
+
+    tk.key      = atom;
+    tk.target   = map_key ? n_atom_intern (map_key) : atom;
+    tk.original = 0;
+    tk.custom   = custom;
+
+    if (map_key) {
+        tmp = g_strdup_printf ("%s.original", map_key);
+        tk.original = n_atom_intern (tmp);
+        g_free (tmp);
+    }
+
+    if (i < transform_keys->len)
+        *e = tk;
+    else
+        g_array_append_val (transform_keys, tk);
+}
+
+/* resolve the allowed keys and their mappings to atoms once, so requests
+   are transformed without string lookups. */
+static void
+compile_transform_keys ()
+{
+    GList *iter = NULL;
+
+    transform_keys = g_array_new (FALSE, FALSE, sizeof (TransformKey));
+
+    /* Just allow filename and enabled properties to new proplist if custom
+     * is allowed. No point in trying to be too clever. If this needs to be
+     * configurable in the future then update to something else. They come
+     * first, so that the allowed keys mapped to them override the custom
+     * values. */
+    add_transform_key (SOUND_FILENAME, NULL, TRUE);
+    add_transform_key (SOUND_ENABLED, NULL, TRUE);
+
+    for (iter = g_list_first (transform_allowed_keys); iter; iter = g_list_next (iter))
+        add_transform_key ((const char*) iter->data,
+            g_hash_table_lookup (transform_key_map, iter->data), FALSE);
+}
+
+/* let the inputs drop incoming keys that would not get through the
+   transform, the original values of mapped keys are kept as well. */
+static void
+set_request_keys (NCore *core)
+{
+    GPtrArray  *keys    = NULL;
+    GList      *iter    = NULL;
+    const char *map_key = NULL;
+
+    if (transform_allow_all)
+        return;
+
+    keys = g_ptr_array_new ();
+    g_ptr_array_add (keys, (gpointer) SOUND_FILENAME);
+    g_ptr_array_add (keys, (gpointer) SOUND_ENABLED);
+
+    for (iter = g_list_first (transform_allowed_keys); iter; iter = g_list_next (iter)) {
+        g_ptr_array_add (keys, iter->data);
+        if ((map_key = g_hash_table_lookup (transform_key_map, iter->data)))
+            g_ptr_array_add (keys, (gpointer) map_key);
+    }
+
+    g_ptr_array_add (keys, NULL);
+    n_core_set_request_keys (core, (const char**) keys->pdata);
+    g_ptr_array_free (keys, TRUE);
+}
+
 N_PLUGIN_LOAD (plugin)
 {
     NCore     *core   = NULL;
@@ -238,6 +339,9 @@ N_PLUGIN_LOAD (plugin)
         return FALSE;
     }
 
+    compile_transform_keys ();
+    set_request_keys (core);
+
     return TRUE;
 }
 
@@ -246,10 +350,16 @@ N_PLUGIN_UNLOAD (plugin)
     NCore *core = n_plugin_get_core (plugin);
 
     n_core_disconnect (core, N_CORE_HOOK_NEW_REQUEST, new_request_cb, core);
+    n_core_set_request_keys (core, NULL);
 
     g_list_free_full (transform_allowed_keys, g_free);
     transform_allowed_keys = NULL;
 
     g_hash_table_destroy (transform_key_map);
     transform_key_map = NULL;
+
+    if (transform_keys) {
+        g_array_free (transform_keys, TRUE);
+        transform_keys = NULL;
+    }
 }
@@ -0,0 +1,69 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_BENCH_COMMON_H
+#define N_BENCH_COMMON_H
+
+/* Helpers shared by the micro-benchmarks. Every benchmark runs its
+ * statement the given number of times and prints the time per
+ * iteration. The iteration counts can be scaled with -s <factor>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <glib.h>
+
+#define BENCH_RUN(name, iterations, statement)                              \
+    do {                                                                    \
+        guint64 _n = bench_scale * (iterations);                            \
+        guint64 _i;                                                         \
+        gint64  _start = g_get_monotonic_time ();                           \
+        for (_i = 0; _i < _n; _i++) {                                       \
+            statement;                                                      \
+        }                                                                   \
+        bench_report ((name), _n, g_get_monotonic_time () - _start);        \
+    } while (0)
+
+static guint64 bench_scale = 1;
+
+static void
+bench_init (int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt (argc, argv, "s:")) != -1) {
+        if (opt == 's' && atoi (optarg) > 0)
+            bench_scale = (guint64) atoi (optarg);
+        else {
+            fprintf (stderr, "usage: %s [-s scale]\n", argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+}
+
+static void
+bench_report (const char *name, guint64 iterations, gint64 elapsed)
+{
+    printf ("%-40s %10" G_GUINT64_FORMAT " iterations %10.1f ns/iter\n",
+            name, iterations,
+            iterations ? elapsed * 1000.0 / iterations : 0.0);
+}
+
+#endif /* N_BENCH_COMMON_H */
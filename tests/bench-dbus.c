@@ -0,0 +1,674 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Multi-client stress test of the dbus input plugin. Starts a private
+ * message bus, boots a core with the dbus and null plugins on it and
+ * connects a few hundred clients that keep calling Play, Pause and Stop
+ * interleaved with each other. Some of the clients disconnect in the
+ * middle of a request, either before the reply to Play or while the
+ * request is paused, and reconnect under a new name. The workload is
+ * run in rounds; each round reports the call throughput, the reply
+ * latency, the growth of the resident memory and the requests and
+ * clients still known to the daemon once all clients are gone. Both
+ * of these should drop back to zero after every round. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <dbus/dbus.h>
+#include <dbus-gmain/dbus-gmain.h>
+
+#include <ngf/log.h>
+#include "src/ngf/core-internal.h"
+
+#ifndef BENCH_EVENTS_PATH
+#define BENCH_EVENTS_PATH "data/events.d"
+#endif
+
+#ifndef BENCH_PLUGIN_DIRS
+#define BENCH_PLUGIN_DIRS ""
+#endif
+
+#define BENCH_PLUGINS      "dbus;null"
+#define PLUGIN_CONF_PATH   "plugins.d"
+#define DEFAULT_CALLS      (20000)
+#define DEFAULT_CLIENTS    (200)
+#define DEFAULT_ROUNDS     (3)
+#define DEFAULT_DISCONNECT (5)          /* percent of the requests */
+#define DRAIN_TIMEOUT_MS   (5000)
+
+#define NGF_DBUS_NAME  "com.nokia.NonGraphicFeedback1.Backend"
+#define NGF_DBUS_PATH  "/com/nokia/NonGraphicFeedback1"
+#define NGF_DBUS_IFACE "com.nokia.NonGraphicFeedback1"
+
+typedef enum _BenchStep
+{
+    BENCH_STEP_PLAY = 0,
+    BENCH_STEP_PAUSE,
+    BENCH_STEP_RESUME,
+    BENCH_STEP_STOP
+} BenchStep;
+
+typedef struct _BenchClient
+{
+    DBusConnection *connection;
+    DBusPendingCall *pending;
+    dbus_uint32_t   id;             /* request being driven, 0 when none */
+    BenchStep       step;           /* call waiting for its reply */
+    gint64          sent;
+} BenchClient;
+
+typedef struct _BenchState
+{
+    NCore       *core;
+    gchar       *address;
+    GRand       *rand;
+    BenchClient *clients;
+    guint        num_clients;
+    guint        disconnect;    /* percent */
+    guint        issued;
+    guint        replied;
+    guint        total;
+    guint        errors;
+    guint        finished;      /* paused or stopped after completion */
+    guint        disconnects;
+    GArray      *latencies;     /* gint64, call to reply in us */
+} BenchState;
+
+static const char *bench_events[] = {
+    "sms", "email", "chat", "calendar", "ringtone", "clock", NULL
+};
+
+static BenchState bench;
+
+static gboolean bench_client_connect (BenchClient *client);
+static void     bench_client_close   (BenchClient *client);
+static void     bench_client_issue   (BenchClient *client);
+
+static void
+bench_append_property (DBusMessageIter *dict, const char *key, dbus_bool_t value)
+{
+    DBusMessageIter entry;
+    DBusMessageIter variant;
+
+    dbus_message_iter_open_container (dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container (&entry, DBUS_TYPE_VARIANT,
+                                      DBUS_TYPE_BOOLEAN_AS_STRING, &variant);
+    dbus_message_iter_append_basic (&variant, DBUS_TYPE_BOOLEAN, &value);
+    dbus_message_iter_close_container (&entry, &variant);
+    dbus_message_iter_close_container (dict, &entry);
+}
+
+static DBusMessage*
+bench_new_call (BenchClient *client)
+{
+    DBusMessage     *msg   = NULL;
+    DBusMessageIter  iter;
+    DBusMessageIter  dict;
+    const char      *event = NULL;
+    dbus_bool_t      pause;
+
+    if (client->step == BENCH_STEP_PLAY) {
+        msg = dbus_message_new_method_call (NGF_DBUS_NAME, NGF_DBUS_PATH,
+                                            NGF_DBUS_IFACE, "Play");
+        event = bench_events[g_rand_int_range (bench.rand, 0,
+                                               G_N_ELEMENTS (bench_events) - 1)];
+
+        dbus_message_iter_init_append (msg, &iter);
+        dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &event);
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+            DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+            DBUS_TYPE_STRING_AS_STRING
+            DBUS_TYPE_VARIANT_AS_STRING
+            DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &dict);
+        bench_append_property (&dict, "sink.null", TRUE);
+        dbus_message_iter_close_container (&iter, &dict);
+    }
+    else if (client->step == BENCH_STEP_STOP) {
+        msg = dbus_message_new_method_call (NGF_DBUS_NAME, NGF_DBUS_PATH,
+                                            NGF_DBUS_IFACE, "Stop");
+        dbus_message_append_args (msg, DBUS_TYPE_UINT32, &client->id,
+                                  DBUS_TYPE_INVALID);
+    }
+    else {
+        msg = dbus_message_new_method_call (NGF_DBUS_NAME, NGF_DBUS_PATH,
+                                            NGF_DBUS_IFACE, "Pause");
+        pause = client->step == BENCH_STEP_PAUSE;
+        dbus_message_append_args (msg, DBUS_TYPE_UINT32, &client->id,
+                                  DBUS_TYPE_BOOLEAN, &pause,
+                                  DBUS_TYPE_INVALID);
+    }
+
+    return msg;
+}
+
+static gboolean
+bench_chance (void)
+{
+    return (guint) g_rand_int_range (bench.rand, 0, 100) < bench.disconnect;
+}
+
+/* drops the connection with its requests, the client continues with
+   a new connection and a new request. */
+static void
+bench_client_drop (BenchClient *client)
+{
+    bench.disconnects++;
+    bench_client_close (client);
+    client->id = 0;
+    client->step = BENCH_STEP_PLAY;
+
+    if (bench.issued < bench.total && bench_client_connect (client))
+        bench_client_issue (client);
+}
+
+static void
+bench_reply_cb (DBusPendingCall *pending, void *userdata)
+{
+    BenchClient   *client  = userdata;
+    DBusMessage   *reply   = NULL;
+    dbus_uint32_t  id      = 0;
+    gint64         latency = g_get_monotonic_time () - client->sent;
+
+    reply = dbus_pending_call_steal_reply (pending);
+    dbus_pending_call_unref (client->pending);
+    client->pending = NULL;
+
+    g_array_append_val (bench.latencies, latency);
+    bench.replied++;
+
+    if (reply && client->step != BENCH_STEP_PLAY &&
+        dbus_message_is_error (reply, DBUS_ERROR_INVALID_ARGS)) {
+        /* the null sink completes quickly, the request may be gone
+           before it was paused or stopped. start over with a new one. */
+        bench.finished++;
+        client->step = BENCH_STEP_STOP;
+    }
+    else if (!reply || dbus_message_get_type (reply) == DBUS_MESSAGE_TYPE_ERROR ||
+             !dbus_message_get_args (reply, NULL, DBUS_TYPE_UINT32, &id,
+                                     DBUS_TYPE_INVALID)) {
+        bench.errors++;
+        client->step = BENCH_STEP_STOP;
+    }
+    else if (client->step == BENCH_STEP_PLAY)
+        client->id = id;
+
+    if (reply)
+        dbus_message_unref (reply);
+
+    if (client->step == BENCH_STEP_PAUSE && bench_chance ()) {
+        bench_client_drop (client);
+        return;
+    }
+
+    client->step = client->step == BENCH_STEP_STOP ? BENCH_STEP_PLAY
+                                                   : client->step + 1;
+    if (client->step == BENCH_STEP_PLAY)
+        client->id = 0;
+
+    if (bench.issued < bench.total)
+        bench_client_issue (client);
+}
+
+static void
+bench_client_issue (BenchClient *client)
+{
+    DBusMessage *msg = NULL;
+
+    if (!client->connection)
+        return;
+
+    msg = bench_new_call (client);
+    client->sent = g_get_monotonic_time ();
+
+    if (!dbus_connection_send_with_reply (client->connection, msg,
+                                          &client->pending, -1) ||
+        !client->pending) {
+        dbus_message_unref (msg);
+        bench.errors++;
+        return;
+    }
+
+    dbus_pending_call_set_notify (client->pending, bench_reply_cb, client, NULL);
+    dbus_message_unref (msg);
+    bench.issued++;
+
+    /* gone before the reply to Play */
+    if (client->step == BENCH_STEP_PLAY && bench_chance ()) {
+        bench.replied++;
+        bench_client_drop (client);
+    }
+}
+
+static gboolean
+bench_client_connect (BenchClient *client)
+{
+    DBusError error = DBUS_ERROR_INIT;
+
+    client->connection = dbus_connection_open_private (bench.address, &error);
+    if (!client->connection || !dbus_bus_register (client->connection, &error)) {
+        fprintf (stderr, "failed to connect client: %s\n", error.message);
+        dbus_error_free (&error);
+        if (client->connection) {
+            dbus_connection_close (client->connection);
+            dbus_connection_unref (client->connection);
+            client->connection = NULL;
+        }
+        return FALSE;
+    }
+
+    dbus_gmain_set_up_connection (client->connection, NULL);
+    return TRUE;
+}
+
+static void
+bench_client_close (BenchClient *client)
+{
+    if (client->pending) {
+        dbus_pending_call_cancel (client->pending);
+        dbus_pending_call_unref (client->pending);
+        client->pending = NULL;
+    }
+
+    if (client->connection) {
+        dbus_connection_close (client->connection);
+        dbus_connection_unref (client->connection);
+        client->connection = NULL;
+    }
+}
+
+static gchar*
+bench_start_bus (GPid *pid)
+{
+    gchar   *argv[] = { "dbus-daemon", "--session", "--nofork",
+                        "--print-address=1", NULL };
+    GError  *error  = NULL;
+    gchar    buf[512];
+    gint     out    = -1;
+    gssize   len    = 0;
+    gssize   n      = 0;
+
+    if (!g_spawn_async_with_pipes (NULL, argv, NULL, G_SPAWN_SEARCH_PATH,
+                                   NULL, NULL, pid, NULL, &out, NULL, &error)) {
+        fprintf (stderr, "failed to start dbus-daemon: %s\n", error->message);
+        g_error_free (error);
+        return NULL;
+    }
+
+    /* the address is printed on a line of its own once the bus is up */
+    while (len < (gssize) sizeof (buf) - 1 &&
+           (n = read (out, buf + len, sizeof (buf) - 1 - len)) > 0) {
+        len += n;
+        if (memchr (buf, '\n', len))
+            break;
+    }
+    close (out);
+
+    buf[len] = '\0';
+    g_strstrip (buf);
+    if (len <= 0 || buf[0] == '\0') {
+        kill (*pid, SIGTERM);
+        g_spawn_close_pid (*pid);
+        return NULL;
+    }
+
+    return g_strdup (buf);
+}
+
+static gchar*
+bench_setup_conf (const char *plugin_dirs)
+{
+    gchar   *conf_path   = NULL;
+    gchar   *plugin_path = NULL;
+    gchar   *events_path = NULL;
+    gchar   *filename    = NULL;
+    gchar   *contents    = NULL;
+    gchar  **dirs        = NULL;
+    gchar  **names       = NULL;
+    gchar   *source      = NULL;
+    gchar   *target      = NULL;
+    gchar  **dir         = NULL;
+    gchar  **name        = NULL;
+
+    if (!(conf_path = g_dir_make_tmp ("ngfd-bench-XXXXXX", NULL)))
+        return NULL;
+
+    plugin_path = g_build_filename (conf_path, "plugins", NULL);
+    g_mkdir (plugin_path, 0700);
+
+    dirs  = g_strsplit (plugin_dirs, ":", -1);
+    names = g_strsplit (BENCH_PLUGINS, ";", -1);
+    for (name = names; *name; ++name) {
+        target = g_strdup_printf ("libngfd_%s.so", *name);
+        for (dir = dirs; *dir; ++dir) {
+            source = g_build_filename (*dir, target, NULL);
+            if (g_file_test (source, G_FILE_TEST_EXISTS)) {
+                filename = g_build_filename (plugin_path, target, NULL);
+                if (symlink (source, filename) < 0)
+                    fprintf (stderr, "failed to link plugin %s\n", source);
+                g_free (filename);
+                g_free (source);
+                break;
+            }
+            g_free (source);
+        }
+        g_free (target);
+    }
+    g_strfreev (names);
+    g_strfreev (dirs);
+
+    events_path = g_build_filename (conf_path, "events.d", NULL);
+    if (symlink (BENCH_EVENTS_PATH, events_path) < 0)
+        fprintf (stderr, "failed to link events from %s\n", BENCH_EVENTS_PATH);
+
+    contents = g_strdup_printf ("[general]\nplugins = %s\n", BENCH_PLUGINS);
+    filename = g_build_filename (conf_path, "ngfd.ini", NULL);
+    g_file_set_contents (filename, contents, -1, NULL);
+    g_free (filename);
+    g_free (contents);
+
+    /* lift the client limit above the number of clients, the request
+       limit stays at its default. */
+    filename = g_build_filename (conf_path, PLUGIN_CONF_PATH, NULL);
+    g_mkdir (filename, 0700);
+    g_free (filename);
+
+    contents = g_strdup_printf ("[dbus]\nclient_limit = %u\npeer_server = false\n",
+                                bench.num_clients * 2);
+    filename = g_build_filename (conf_path, PLUGIN_CONF_PATH, "50-dbus.ini", NULL);
+    g_file_set_contents (filename, contents, -1, NULL);
+
+    g_setenv ("NGF_CONF_PATH", conf_path, TRUE);
+    g_setenv ("NGF_USER_CONF_PATH", conf_path, TRUE);
+    g_setenv ("NGF_PLUGIN_PATH", plugin_path, TRUE);
+
+    g_free (filename);
+    g_free (contents);
+    g_free (events_path);
+    g_free (plugin_path);
+
+    return conf_path;
+}
+
+static void
+bench_remove_dir (const char *path)
+{
+    GDir        *dir   = NULL;
+    const gchar *entry = NULL;
+    gchar       *file  = NULL;
+
+    if ((dir = g_dir_open (path, 0, NULL))) {
+        while ((entry = g_dir_read_name (dir))) {
+            file = g_build_filename (path, entry, NULL);
+            if (g_file_test (file, G_FILE_TEST_IS_DIR) &&
+                !g_file_test (file, G_FILE_TEST_IS_SYMLINK))
+                bench_remove_dir (file);
+            else
+                g_unlink (file);
+            g_free (file);
+        }
+        g_dir_close (dir);
+    }
+
+    g_rmdir (path);
+}
+
+static glong
+bench_rss_kb (void)
+{
+    gchar *contents = NULL;
+    glong  size     = 0;
+    glong  resident = 0;
+
+    if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+        return 0;
+
+    if (sscanf (contents, "%ld %ld", &size, &resident) != 2)
+        resident = 0;
+    g_free (contents);
+
+    return resident * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+static void
+bench_find_metric (const char *name, guint64 value, void *userdata)
+{
+    if (g_str_equal (name, "dbus.clients"))
+        *(guint64*) userdata = value;
+}
+
+static guint64
+bench_daemon_clients (void)
+{
+    guint64 clients = 0;
+
+    n_metrics_foreach (n_core_get_metrics (bench.core), bench_find_metric, &clients);
+    return clients;
+}
+
+static gboolean
+bench_drain_timeout_cb (gpointer userdata)
+{
+    *(gboolean*) userdata = TRUE;
+    return FALSE;
+}
+
+static gint
+bench_compare_latency (gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64*) a;
+    gint64 y = *(const gint64*) b;
+
+    return (x > y) - (x < y);
+}
+
+static gint64
+bench_percentile (GArray *values, guint percentile)
+{
+    guint index;
+
+    if (values->len == 0)
+        return 0;
+
+    index = (values->len - 1) * percentile / 100;
+    return g_array_index (values, gint64, index);
+}
+
+static gboolean
+bench_run (guint round, glong rss_base)
+{
+    gboolean timed_out = FALSE;
+    guint    source_id = 0;
+    guint    issued    = 0;
+    guint    i;
+    gint64   start, elapsed;
+    glong    rss;
+
+    bench.issued      = 0;
+    bench.replied     = 0;
+    bench.errors      = 0;
+    bench.finished    = 0;
+    bench.disconnects = 0;
+    g_array_set_size (bench.latencies, 0);
+
+    for (i = 0; i < bench.num_clients; i++) {
+        memset (&bench.clients[i], 0, sizeof (BenchClient));
+        if (!bench_client_connect (&bench.clients[i]))
+            return FALSE;
+    }
+
+    start = g_get_monotonic_time ();
+
+    for (i = 0; i < bench.num_clients && bench.issued < bench.total; i++)
+        bench_client_issue (&bench.clients[i]);
+
+    while (bench.replied < bench.issued || bench.issued < bench.total) {
+        g_main_context_iteration (NULL, TRUE);
+
+        /* a client without a call in flight only ends up here if the
+           call could not be sent, keep it going. */
+        if (bench.replied == bench.issued && bench.issued < bench.total) {
+            issued = bench.issued;
+            for (i = 0; i < bench.num_clients; i++) {
+                if (!bench.clients[i].pending && bench.issued < bench.total)
+                    bench_client_issue (&bench.clients[i]);
+            }
+            if (issued == bench.issued)
+                break;
+        }
+    }
+
+    elapsed = g_get_monotonic_time () - start;
+
+    /* everyone leaves, the daemon should forget all of them. */
+    for (i = 0; i < bench.num_clients; i++)
+        bench_client_close (&bench.clients[i]);
+
+    source_id = g_timeout_add (DRAIN_TIMEOUT_MS, bench_drain_timeout_cb, &timed_out);
+    while (!timed_out && (g_hash_table_size (bench.core->request_table) > 0 ||
+                          bench_daemon_clients () > 0))
+        g_main_context_iteration (NULL, TRUE);
+    if (!timed_out)
+        g_source_remove (source_id);
+
+    rss = bench_rss_kb ();
+    g_array_sort (bench.latencies, bench_compare_latency);
+
+    printf ("round %u %7u calls %8.0f calls/s  p50 %6" G_GINT64_FORMAT " us"
+            "  p99 %6" G_GINT64_FORMAT " us  %5u finished early %4u errors %4u disconnects"
+            "  rss %+6ld kB  leaked %u requests %" G_GUINT64_FORMAT " clients\n",
+            round, bench.issued,
+            elapsed > 0 ? bench.issued * (double) G_USEC_PER_SEC / elapsed : 0.0,
+            bench_percentile (bench.latencies, 50),
+            bench_percentile (bench.latencies, 99),
+            bench.finished, bench.errors, bench.disconnects, rss - rss_base,
+            g_hash_table_size (bench.core->request_table),
+            bench_daemon_clients ());
+
+    return !timed_out;
+}
+
+static void
+usage (const char *name)
+{
+    printf ("usage: %s [-n calls] [-c clients] [-r rounds] [-k percent] [-d plugin dirs]\n"
+            "  -n  number of calls per round (default %d)\n"
+            "  -c  number of clients (default %d)\n"
+            "  -r  number of rounds (default %d)\n"
+            "  -k  percent of requests whose client disconnects in the middle (default %d)\n"
+            "  -d  ':' separated directories to find the plugins from\n",
+            name, DEFAULT_CALLS, DEFAULT_CLIENTS, DEFAULT_ROUNDS, DEFAULT_DISCONNECT);
+}
+
+int
+main (int argc, char *argv[])
+{
+    const char *plugin_dirs = BENCH_PLUGIN_DIRS;
+    gchar      *conf_path   = NULL;
+    GPid        bus_pid     = 0;
+    guint       rounds      = DEFAULT_ROUNDS;
+    guint       round;
+    glong       rss_base;
+    int         ret         = EXIT_FAILURE;
+    int         opt;
+
+    bench.total       = DEFAULT_CALLS;
+    bench.num_clients = DEFAULT_CLIENTS;
+    bench.disconnect  = DEFAULT_DISCONNECT;
+
+    while ((opt = getopt (argc, argv, "n:c:r:k:d:h")) != -1) {
+        switch (opt) {
+            case 'n': bench.total = (guint) atoi (optarg);       break;
+            case 'c': bench.num_clients = (guint) atoi (optarg); break;
+            case 'r': rounds = (guint) atoi (optarg);            break;
+            case 'k': bench.disconnect = (guint) atoi (optarg);  break;
+            case 'd': plugin_dirs = optarg;                      break;
+            default:
+                usage (argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (bench.total == 0 || bench.num_clients == 0 || bench.disconnect > 100) {
+        usage (argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    n_log_initialize (N_LOG_LEVEL_ERROR);
+
+    if (!(bench.address = bench_start_bus (&bus_pid))) {
+        fprintf (stderr, "failed to start a private bus\n");
+        return EXIT_FAILURE;
+    }
+
+    /* the daemon talks to the system bus, point it to ours. */
+    g_setenv ("DBUS_SYSTEM_BUS_ADDRESS", bench.address, TRUE);
+    g_setenv ("DBUS_SESSION_BUS_ADDRESS", bench.address, TRUE);
+
+    if (!(conf_path = bench_setup_conf (plugin_dirs))) {
+        fprintf (stderr, "failed to create configuration directory\n");
+        goto stop_bus;
+    }
+
+    bench.rand      = g_rand_new_with_seed (0x5eed);
+    bench.clients   = g_new0 (BenchClient, bench.num_clients);
+    bench.latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+    bench.core      = n_core_new (&argc, argv);
+
+    if (!n_core_initialize (bench.core)) {
+        fprintf (stderr, "failed to initialize core\n");
+        goto done;
+    }
+
+    printf ("%u clients, %u%% disconnecting in the middle of a request\n",
+            bench.num_clients, bench.disconnect);
+
+    rss_base = bench_rss_kb ();
+    for (round = 1; round <= rounds; round++) {
+        if (!bench_run (round, rss_base)) {
+            fprintf (stderr, "requests or clients left behind after round %u\n", round);
+            goto done;
+        }
+    }
+
+    ret = EXIT_SUCCESS;
+
+done:
+    n_core_shutdown (bench.core);
+    n_core_free (bench.core);
+    g_array_free (bench.latencies, TRUE);
+    g_free (bench.clients);
+    g_rand_free (bench.rand);
+    bench_remove_dir (conf_path);
+    g_free (conf_path);
+
+stop_bus:
+    kill (bus_pid, SIGTERM);
+    g_spawn_close_pid (bus_pid);
+    g_free (bench.address);
+
+    return ret;
+}
@@ -0,0 +1,222 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Micro-benchmarks for n_event_list_match_request against the shipped
+ * event definitions, and for n_event_rule_match per operator and value
+ * type. */
+
+#include <string.h>
+#include <ngf/log.h>
+#include "src/ngf/core-internal.h"
+#include "src/ngf/eventlist-internal.h"
+#include "src/ngf/eventrule-internal.h"
+#include "bench-common.h"
+
+#ifndef BENCH_EVENTS_PATH
+#define BENCH_EVENTS_PATH "data/events.d"
+#endif
+
+#define MATCH_ITERATIONS (500000)
+#define RULE_ITERATIONS  (5000000)
+
+typedef struct _MatchCase
+{
+    const char *name;
+    const char *event;
+    const char *play_mode;      /* NULL leaves play.mode unset */
+    const char *profile;        /* context profile.current_profile */
+} MatchCase;
+
+static const MatchCase match_cases[] = {
+    { "ringtone default",         "ringtone",             NULL,    "general" },
+    { "ringtone short",           "ringtone",             "short", "general" },
+    { "ringtone meeting",         "ringtone",             "long",  "meeting" },
+    { "sms default",              "sms",                  NULL,    "general" },
+    { "information_tacticon",     "information_tacticon", NULL,    "general" },
+    { "unknown event",            "no_such_event",        NULL,    "general" },
+    { NULL, NULL, NULL, NULL }
+};
+
+static int
+load_events (NCore *core)
+{
+    GDir        *dir      = NULL;
+    const gchar *entry    = NULL;
+    gchar       *filename = NULL;
+    GKeyFile    *keyfile  = NULL;
+    int          loaded   = 0;
+
+    if (!(dir = g_dir_open (BENCH_EVENTS_PATH, 0, NULL)))
+        return 0;
+
+    while ((entry = g_dir_read_name (dir))) {
+        if (!g_str_has_suffix (entry, ".ini"))
+            continue;
+
+        filename = g_build_filename (BENCH_EVENTS_PATH, entry, NULL);
+        keyfile  = g_key_file_new ();
+        if (g_key_file_load_from_file (keyfile, filename, G_KEY_FILE_NONE, NULL) &&
+            n_event_list_parse_keyfile (core->eventlist, keyfile))
+            loaded++;
+        g_key_file_free (keyfile);
+        g_free (filename);
+    }
+
+    g_dir_close (dir);
+
+    return loaded;
+}
+
+static void
+bench_match (NCore *core, gboolean linear)
+{
+    const MatchCase *c       = NULL;
+    NRequest        *request = NULL;
+    NValue          *profile = NULL;
+    NProplist       *props   = NULL;
+    gchar           *name    = NULL;
+
+    core->eventlist->linear_match = linear;
+
+    for (c = match_cases; c->name; ++c) {
+        profile = n_value_new ();
+        n_value_set_string (profile, c->profile);
+        n_context_set_value (core->context, "profile.current_profile", profile);
+
+        props = n_proplist_new ();
+        if (c->play_mode)
+            n_proplist_set_string (props, "play.mode", c->play_mode);
+        request = n_request_new_with_event_and_properties (c->event, props);
+        n_proplist_free (props);
+
+        name = g_strdup_printf ("match %s (%s)", c->name, linear ? "linear" : "index");
+        BENCH_RUN (name, MATCH_ITERATIONS, {
+            (void) n_event_list_match_request (core->eventlist, request);
+        });
+        g_free (name);
+
+        n_request_free (request);
+    }
+}
+
+static void
+bench_rule (const char *type, NEventRuleOp op, NValue *rule_value,
+            const NValue *match_value)
+{
+    NEventRule *rule = NULL;
+    gchar      *name = NULL;
+
+    rule = n_event_rule_new (N_EVENT_RULE_REQUEST, "bench.key", op, rule_value);
+    name = g_strdup_printf ("rule %s %s", type,
+                            op == N_EVENT_RULE_ALWAYS ? "*" : n_event_rule_op_string (rule));
+
+    BENCH_RUN (name, RULE_ITERATIONS, {
+        (void) n_event_rule_match (rule, match_value);
+    });
+
+    g_free (name);
+    n_event_rule_unref (rule);
+}
+
+static void
+bench_rules ()
+{
+    static const NEventRuleOp numeric_ops[] = {
+        N_EVENT_RULE_EQUALS, N_EVENT_RULE_NEQUALS, N_EVENT_RULE_GREATER,
+        N_EVENT_RULE_LESS, N_EVENT_RULE_GREATER_OR_EQUAL, N_EVENT_RULE_LESS_OR_EQUAL
+    };
+
+    static const NEventRuleOp equality_ops[] = {
+        N_EVENT_RULE_EQUALS, N_EVENT_RULE_NEQUALS
+    };
+
+    NValue *match = NULL;
+    NValue *value = NULL;
+    guint   i;
+
+    match = n_value_new ();
+    n_value_set_int (match, 5);
+    for (i = 0; i < G_N_ELEMENTS (numeric_ops); i++) {
+        value = n_value_new ();
+        n_value_set_int (value, 3);
+        bench_rule ("int", numeric_ops[i], value, match);
+    }
+    n_value_free (match);
+
+    match = n_value_new ();
+    n_value_set_uint (match, 5);
+    for (i = 0; i < G_N_ELEMENTS (numeric_ops); i++) {
+        value = n_value_new ();
+        n_value_set_uint (value, 3);
+        bench_rule ("uint", numeric_ops[i], value, match);
+    }
+    n_value_free (match);
+
+    match = n_value_new ();
+    n_value_set_string (match, "meeting");
+    for (i = 0; i < G_N_ELEMENTS (equality_ops); i++) {
+        value = n_value_new ();
+        n_value_set_string (value, "general");
+        bench_rule ("string", equality_ops[i], value, match);
+    }
+    value = n_value_new ();
+    n_value_set_string (value, "*");
+    bench_rule ("string", N_EVENT_RULE_ALWAYS, value, match);
+    n_value_free (match);
+
+    match = n_value_new ();
+    n_value_set_bool (match, TRUE);
+    for (i = 0; i < G_N_ELEMENTS (equality_ops); i++) {
+        value = n_value_new ();
+        n_value_set_bool (value, TRUE);
+        bench_rule ("bool", equality_ops[i], value, match);
+    }
+    n_value_free (match);
+}
+
+int
+main (int argc, char *argv[])
+{
+    NCore *core = NULL;
+    int    ret  = EXIT_FAILURE;
+
+    bench_init (argc, argv);
+    n_log_initialize (N_LOG_LEVEL_ERROR);
+
+    core = n_core_new (NULL, NULL);
+
+    if (!load_events (core)) {
+        fprintf (stderr, "no events found from %s\n", BENCH_EVENTS_PATH);
+        goto done;
+    }
+
+    printf ("%u events loaded\n", n_event_list_size (core->eventlist));
+
+    bench_match (core, FALSE);
+    bench_match (core, TRUE);
+    bench_rules ();
+
+    ret = EXIT_SUCCESS;
+
+done:
+    n_core_free (core);
+
+    return ret;
+}
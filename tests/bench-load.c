@@ -0,0 +1,499 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Synthetic load generator. Boots a core with the shipped event
+ * definitions and the null (and optionally fake) sink plugins, drives
+ * request mixes through the player and reports throughput, resolve to
+ * play latency and heap allocations per request. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <ngf/log.h>
+#include "src/ngf/core-internal.h"
+#include "src/ngf/core-player.h"
+#include "src/ngf/allocstats.h"
+
+#ifndef BENCH_EVENTS_PATH
+#define BENCH_EVENTS_PATH "data/events.d"
+#endif
+
+#ifndef BENCH_PLUGIN_DIRS
+#define BENCH_PLUGIN_DIRS ""
+#endif
+
+#define DEFAULT_REQUESTS (20000)
+#define DEFAULT_PLUGINS  "null"
+
+typedef struct _BenchScenario
+{
+    const char  *name;
+    const char  *description;
+    const char **events;
+    guint        concurrency;   /* maximum number of active requests */
+    gint         hold;          /* loop iterations before stop, -1 waits for completion */
+} BenchScenario;
+
+typedef struct _BenchState
+{
+    NCore      *core;
+    guint       active;
+    guint       finished;
+    guint       failed;
+    GArray     *latencies;      /* gint64, resolved to playing in us */
+} BenchState;
+
+typedef struct _BenchHeld
+{
+    guint  id;
+    gint64 iteration;
+} BenchHeld;
+
+static const char *tacticon_events[] = {
+    "information_tacticon", "warning_tacticon", NULL
+};
+
+static const char *ringtone_events[] = {
+    "ringtone", "voip_ringtone", "clock", NULL
+};
+
+static const char *playstop_events[] = {
+    "sms", "email", "chat", "calendar", NULL
+};
+
+static const BenchScenario scenarios[] = {
+    { "tacticon", "tacticon storm, requests played to completion",
+      tacticon_events, 32, -1 },
+    { "ringtone", "overlapping ringtones, stopped while others start",
+      ringtone_events, 4, 8 },
+    { "playstop", "rapid play and stop",
+      playstop_events, 1, 0 },
+    { NULL, NULL, NULL, 0, 0 }
+};
+
+static BenchState bench;
+
+#ifdef __GLIBC__
+/* count heap allocations by interposing the allocator, glib and the
+   core both end up here. */
+
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static guint64 bench_allocations;
+
+void*
+malloc (size_t size)
+{
+    bench_allocations++;
+    return __libc_malloc (size);
+}
+
+void*
+calloc (size_t nmemb, size_t size)
+{
+    bench_allocations++;
+    return __libc_calloc (nmemb, size);
+}
+
+void*
+realloc (void *ptr, size_t size)
+{
+    bench_allocations++;
+    return __libc_realloc (ptr, size);
+}
+
+#define BENCH_HAVE_ALLOCATIONS (1)
+#else
+static guint64 bench_allocations;
+#define BENCH_HAVE_ALLOCATIONS (0)
+#endif
+
+static void
+bench_request_done (NRequest *request)
+{
+    gint64 resolved = n_request_get_timestamp (request, N_REQUEST_STAGE_RESOLVED);
+    gint64 playing  = n_request_get_timestamp (request, N_REQUEST_STAGE_PLAYING);
+    gint64 latency;
+
+    if (resolved > 0 && playing >= resolved) {
+        latency = playing - resolved;
+        g_array_append_val (bench.latencies, latency);
+    }
+
+    bench.active--;
+    bench.finished++;
+}
+
+static void
+bench_send_error (NInputInterface *iface, NRequest *request, const char *err_msg)
+{
+    (void) iface;
+    (void) err_msg;
+
+    bench.failed++;
+    bench_request_done (request);
+}
+
+static void
+bench_send_reply (NInputInterface *iface, NRequest *request, int code)
+{
+    (void) iface;
+
+    if (code == N_CORE_EVENT_COMPLETED)
+        bench_request_done (request);
+}
+
+static gchar*
+bench_setup_conf (const char *plugins, const char *plugin_dirs)
+{
+    gchar   *conf_path   = NULL;
+    gchar   *plugin_path = NULL;
+    gchar   *events_path = NULL;
+    gchar   *filename    = NULL;
+    gchar   *contents    = NULL;
+    gchar  **dirs        = NULL;
+    gchar  **names       = NULL;
+    gchar   *source      = NULL;
+    gchar   *target      = NULL;
+    gchar  **dir         = NULL;
+    gchar  **name        = NULL;
+
+    if (!(conf_path = g_dir_make_tmp ("ngfd-bench-XXXXXX", NULL)))
+        return NULL;
+
+    plugin_path = g_build_filename (conf_path, "plugins", NULL);
+    g_mkdir (plugin_path, 0700);
+
+    /* link the plugins from the build tree into one plugin directory */
+    dirs  = g_strsplit (plugin_dirs, ":", -1);
+    names = g_strsplit (plugins, ";", -1);
+    for (name = names; *name; ++name) {
+        target = g_strdup_printf ("libngfd_%s.so", *name);
+        for (dir = dirs; *dir; ++dir) {
+            source = g_build_filename (*dir, target, NULL);
+            if (g_file_test (source, G_FILE_TEST_EXISTS)) {
+                filename = g_build_filename (plugin_path, target, NULL);
+                if (symlink (source, filename) < 0)
+                    fprintf (stderr, "failed to link plugin %s\n", source);
+                g_free (filename);
+                g_free (source);
+                break;
+            }
+            g_free (source);
+        }
+        g_free (target);
+    }
+    g_strfreev (names);
+    g_strfreev (dirs);
+
+    events_path = g_build_filename (conf_path, "events.d", NULL);
+    if (symlink (BENCH_EVENTS_PATH, events_path) < 0)
+        fprintf (stderr, "failed to link events from %s\n", BENCH_EVENTS_PATH);
+
+    contents = g_strdup_printf ("[general]\nplugins = %s\n", plugins);
+    filename = g_build_filename (conf_path, "ngfd.ini", NULL);
+    g_file_set_contents (filename, contents, -1, NULL);
+
+    g_setenv ("NGF_CONF_PATH", conf_path, TRUE);
+    g_setenv ("NGF_USER_CONF_PATH", conf_path, TRUE);
+    g_setenv ("NGF_PLUGIN_PATH", plugin_path, TRUE);
+
+    g_free (filename);
+    g_free (contents);
+    g_free (events_path);
+    g_free (plugin_path);
+
+    return conf_path;
+}
+
+static void
+bench_remove_dir (const char *path)
+{
+    GDir        *dir   = NULL;
+    const gchar *entry = NULL;
+    gchar       *file  = NULL;
+
+    if ((dir = g_dir_open (path, 0, NULL))) {
+        while ((entry = g_dir_read_name (dir))) {
+            file = g_build_filename (path, entry, NULL);
+            if (g_file_test (file, G_FILE_TEST_IS_DIR) &&
+                !g_file_test (file, G_FILE_TEST_IS_SYMLINK))
+                bench_remove_dir (file);
+            else
+                g_unlink (file);
+            g_free (file);
+        }
+        g_dir_close (dir);
+    }
+
+    g_rmdir (path);
+}
+
+static gint
+bench_compare_latency (gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64*) a;
+    gint64 y = *(const gint64*) b;
+
+    return (x > y) - (x < y);
+}
+
+static gint64
+bench_percentile (GArray *values, guint percentile)
+{
+    guint index;
+
+    if (values->len == 0)
+        return 0;
+
+    index = (values->len - 1) * percentile / 100;
+    return g_array_index (values, gint64, index);
+}
+
+#ifdef ENABLE_ALLOC_STATS
+static void
+bench_alloc_snapshot (NAllocStats *stats)
+{
+    guint i;
+
+    for (i = 0; i < N_ALLOC_TYPES; i++)
+        n_alloc_stats_get ((NAllocType) i, &stats[i]);
+}
+
+/* allocations of the core types per request, and the objects left
+   alive once the requests are gone. */
+static void
+bench_alloc_report (const NAllocStats *before, guint total)
+{
+    NAllocStats now;
+    guint       i;
+
+    printf ("%-10s", "");
+    for (i = 0; i < N_ALLOC_TYPES; i++) {
+        n_alloc_stats_get ((NAllocType) i, &now);
+        printf (" %s %.1f (%.0f B)", n_alloc_stats_type_name ((NAllocType) i),
+                (double) (now.count - before[i].count) / total,
+                (double) (now.bytes - before[i].bytes) / total);
+        if (i != N_ALLOC_LIST && now.live != before[i].live)
+            printf (" %+ld live", (long) (now.live - before[i].live));
+    }
+    printf ("\n");
+}
+#endif
+
+static void
+bench_stop_held (GQueue *held, gint64 iteration, gint hold, gboolean all)
+{
+    BenchHeld *item    = NULL;
+    NRequest  *request = NULL;
+
+    while ((item = g_queue_peek_head (held))) {
+        if (!all && item->iteration + hold > iteration)
+            break;
+
+        g_queue_pop_head (held);
+        if ((request = n_core_lookup_request (bench.core, item->id)))
+            n_core_stop_request (bench.core, request, 0);
+        g_free (item);
+    }
+}
+
+static void
+bench_run (const BenchScenario *scenario, NInputInterface *input, guint total)
+{
+    NProplist  *props       = NULL;
+    NRequest   *request     = NULL;
+    BenchHeld  *item        = NULL;
+    GQueue     *held        = NULL;
+    guint       issued      = 0;
+    guint       num_events  = 0;
+    gint64      iteration   = 0;
+    gint64      start, elapsed;
+    guint64     allocations;
+#ifdef ENABLE_ALLOC_STATS
+    NAllocStats alloc_before[N_ALLOC_TYPES];
+#endif
+
+    while (scenario->events[num_events])
+        num_events++;
+
+    held = g_queue_new ();
+    bench.active   = 0;
+    bench.finished = 0;
+    bench.failed   = 0;
+    g_array_set_size (bench.latencies, 0);
+
+#ifdef ENABLE_ALLOC_STATS
+    bench_alloc_snapshot (alloc_before);
+#endif
+    allocations = bench_allocations;
+    start = g_get_monotonic_time ();
+
+    while (bench.finished < total) {
+        while (issued < total && bench.active < scenario->concurrency) {
+            props = n_proplist_new ();
+            n_proplist_set_bool (props, "sink.null", TRUE);
+            request = n_request_new_with_event_and_properties (
+                scenario->events[issued % num_events], props);
+            n_proplist_free (props);
+
+            request->input_iface = input;
+            bench.active++;
+            issued++;
+
+            n_core_play_request (bench.core, request);
+
+            if (scenario->hold == 0)
+                n_core_stop_request (bench.core, request, 0);
+            else if (scenario->hold > 0) {
+                item = g_new0 (BenchHeld, 1);
+                item->id = n_request_get_id (request);
+                item->iteration = iteration;
+                g_queue_push_tail (held, item);
+            }
+        }
+
+        /* block only when no new request can be issued and nothing is
+           waiting for us to stop it. */
+        g_main_context_iteration (NULL, g_queue_is_empty (held) &&
+            (issued == total || bench.active >= scenario->concurrency));
+        iteration++;
+
+        bench_stop_held (held, iteration, scenario->hold, FALSE);
+    }
+
+    elapsed = g_get_monotonic_time () - start;
+    allocations = bench_allocations - allocations;
+
+    g_array_sort (bench.latencies, bench_compare_latency);
+
+    printf ("%-10s %8u requests %10.0f req/s", scenario->name, total,
+            elapsed > 0 ? total * (double) G_USEC_PER_SEC / elapsed : 0.0);
+    if (bench.latencies->len > 0)
+        printf ("  p50 %6" G_GINT64_FORMAT " us  p99 %6" G_GINT64_FORMAT " us  ",
+                bench_percentile (bench.latencies, 50),
+                bench_percentile (bench.latencies, 99));
+    else
+        printf ("  p50      - us  p99      - us  ");
+    if (BENCH_HAVE_ALLOCATIONS)
+        printf ("%6.1f allocs/req", (double) allocations / total);
+    else
+        printf ("   n/a allocs/req");
+    printf ("  (%u failed)\n", bench.failed);
+
+    bench_stop_held (held, iteration, scenario->hold, TRUE);
+    g_queue_free (held);
+
+#ifdef ENABLE_ALLOC_STATS
+    bench_alloc_report (alloc_before, total);
+#endif
+}
+
+static void
+usage (const char *name)
+{
+    const BenchScenario *s = NULL;
+
+    printf ("usage: %s [-n requests] [-s scenario] [-p plugins] [-d plugin dirs]\n"
+            "  -n  number of requests per scenario (default %d)\n"
+            "  -s  scenario to run, all scenarios by default\n"
+            "  -p  ';' separated sink plugins (default \"%s\")\n"
+            "  -d  ':' separated directories to find the plugins from\n"
+            "scenarios:\n", name, DEFAULT_REQUESTS, DEFAULT_PLUGINS);
+
+    for (s = scenarios; s->name; ++s)
+        printf ("  %-10s %s\n", s->name, s->description);
+}
+
+int
+main (int argc, char *argv[])
+{
+    static const NInputInterfaceDecl input_decl = {
+        .name       = "bench",
+        .send_error = bench_send_error,
+        .send_reply = bench_send_reply
+    };
+
+    const BenchScenario  *s           = NULL;
+    const char           *only        = NULL;
+    const char           *plugins     = DEFAULT_PLUGINS;
+    const char           *plugin_dirs = BENCH_PLUGIN_DIRS;
+    gchar                *conf_path   = NULL;
+    guint                 total       = DEFAULT_REQUESTS;
+    int                   ret         = EXIT_FAILURE;
+    int                   opt;
+
+    while ((opt = getopt (argc, argv, "n:s:p:d:h")) != -1) {
+        switch (opt) {
+            case 'n': total = (guint) atoi (optarg); break;
+            case 's': only = optarg;                 break;
+            case 'p': plugins = optarg;              break;
+            case 'd': plugin_dirs = optarg;          break;
+            default:
+                usage (argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (total == 0) {
+        usage (argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    n_log_initialize (N_LOG_LEVEL_ERROR);
+
+    if (!(conf_path = bench_setup_conf (plugins, plugin_dirs))) {
+        fprintf (stderr, "failed to create configuration directory\n");
+        return EXIT_FAILURE;
+    }
+
+    bench.latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+    bench.core = n_core_new (&argc, argv);
+    n_core_register_input (bench.core, &input_decl);
+
+    if (!n_core_initialize (bench.core)) {
+        fprintf (stderr, "failed to initialize core\n");
+        goto done;
+    }
+
+    for (s = scenarios; s->name; ++s) {
+        if (only && g_strcmp0 (only, s->name) != 0)
+            continue;
+        bench_run (s, bench.core->inputs[0], total);
+    }
+
+    ret = EXIT_SUCCESS;
+
+done:
+    n_core_shutdown (bench.core);
+    n_core_free (bench.core);
+    g_array_free (bench.latencies, TRUE);
+    bench_remove_dir (conf_path);
+    g_free (conf_path);
+
+    return ret;
+}
@@ -0,0 +1,119 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Micro-benchmarks for the proplist copy, merge and foreach paths. The
+ * property lists mimic a request and the event it resolves to. */
+
+#include <ngf/proplist.h>
+#include "bench-common.h"
+
+#define ITERATIONS (200000)
+
+static guint foreach_count;
+
+static void
+count_cb (const char *key, const NValue *value, gpointer userdata)
+{
+    (void) key;
+    (void) value;
+    (void) userdata;
+
+    foreach_count++;
+}
+
+static NProplist*
+new_request_props ()
+{
+    NProplist *props = n_proplist_new ();
+
+    n_proplist_set_string (props, "play.mode", "long");
+    n_proplist_set_uint   (props, "play.timeout", 30000);
+    n_proplist_set_bool   (props, "media.audio", TRUE);
+    n_proplist_set_bool   (props, "media.vibra", TRUE);
+    n_proplist_set_pointer (props, "dbus.event.client", props);
+
+    return props;
+}
+
+static NProplist*
+new_event_props ()
+{
+    NProplist *props = n_proplist_new ();
+
+    n_proplist_set_string (props, "sound.filename", "/usr/share/sounds/ring-tones/Beep.aac");
+    n_proplist_set_bool   (props, "sound.repeat", TRUE);
+    n_proplist_set_string (props, "sound.stream.event.id", "phone-incoming-call");
+    n_proplist_set_string (props, "sound.stream.module-stream-restore.id", "x-meego-ringing-volume");
+    n_proplist_set_string (props, "ffmemless.effect", "NGF_RINGTONE");
+    n_proplist_set_string (props, "immvibe.filename", "/usr/share/sounds/vibra/tct_small_alert.ivt");
+    n_proplist_set_string (props, "haptic.type", "alarm");
+    n_proplist_set_int    (props, "sound.volume", 80);
+
+    return props;
+}
+
+int
+main (int argc, char *argv[])
+{
+    NProplist *request = NULL;
+    NProplist *event   = NULL;
+    NProplist *copy    = NULL;
+
+    bench_init (argc, argv);
+
+    request = new_request_props ();
+    event   = new_event_props ();
+
+    BENCH_RUN ("n_proplist_copy request", ITERATIONS, {
+        copy = n_proplist_copy (request);
+        n_proplist_free (copy);
+    });
+
+    BENCH_RUN ("n_proplist_copy event", ITERATIONS, {
+        copy = n_proplist_copy (event);
+        n_proplist_free (copy);
+    });
+
+    /* the player merges the event properties over a copy of the
+       request properties for every request. */
+    BENCH_RUN ("n_proplist_merge event into request", ITERATIONS, {
+        copy = n_proplist_copy (request);
+        n_proplist_merge (copy, event);
+        n_proplist_free (copy);
+    });
+
+    BENCH_RUN ("n_proplist_new_layered", ITERATIONS, {
+        copy = n_proplist_new_layered (event, request);
+        n_proplist_free (copy);
+    });
+
+    BENCH_RUN ("n_proplist_foreach event", ITERATIONS * 10, {
+        n_proplist_foreach (event, count_cb, NULL);
+    });
+
+    BENCH_RUN ("n_proplist_get_string", ITERATIONS * 10, {
+        (void) n_proplist_get_string (event, "haptic.type");
+    });
+
+    n_proplist_free (request);
+    n_proplist_free (event);
+
+    return foreach_count > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,340 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Render benchmark of the tonegen synthesis. The indicator and DTMF
+ * tones are set up like the plugin does for the CEPT standard and
+ * rendered with tone_write_callback into a plain buffer, without an
+ * audio server, at each sample rate and format, with the block and the
+ * scalar renderer. For every run the time per sample, the share of
+ * real time left for the rest of the system and a checksum of the
+ * rendered samples are printed. The checksums stay the same as long as
+ * a renderer is bit-exact. The block renderer is compared with the
+ * scalar one first, the benchmark fails if any sample is further off
+ * than the rounding of the float synthesis explains. */
+
+#include <string.h>
+#include <math.h>
+#include <ngf/log.h>
+#include "stream.h"
+#include "tone.h"
+#include "envelop.h"
+#include "bench-common.h"
+
+#define SECONDS         (10)
+#define CHUNK_US        (20000)     /* typical write request */
+#define VOLUME          (80)
+#define DTMF_KEY_US     (100000)    /* key press of a dialing sequence */
+#define MAX_CASE_TONES  (3)
+#define ITERATIONS      (10000000)
+#define BLOCK_ITERATIONS (100000)
+#define BLOCK           (256)
+#define COMPARE_SECONDS (2)
+#define MAX_ERROR       (4)         /* LSBs of a 16-bit sample */
+
+typedef struct _BenchTone
+{
+    tone_type   type;
+    uint32_t    freq;
+    uint32_t    volume;
+    uint32_t    period;
+    uint32_t    play;
+    uint32_t    start;
+    uint32_t    duration;
+} BenchTone;
+
+typedef struct _BenchCase
+{
+    const char *name;
+    gboolean    dtmf_keys;          /* chained key presses instead of tones */
+    BenchTone   tones[MAX_CASE_TONES];
+} BenchCase;
+
+static const BenchCase cases[] = {
+    { "dial", FALSE, {
+        { TONE_DIAL, 425, VOLUME, 1000000, 1000000, 0, 0 } } },
+    { "busy", FALSE, {
+        { TONE_BUSY, 425, VOLUME, 1000000, 500000, 0, 0 } } },
+    { "congest", FALSE, {
+        { TONE_CONGEST, 425, VOLUME, 400000, 200000, 0, 0 } } },
+    { "error", FALSE, {
+        { TONE_ERROR,  900, VOLUME, 2000000, 333333, 0, 0 },
+        { TONE_ERROR, 1400, VOLUME, 2000000, 332857, 333333, 0 },
+        { TONE_ERROR, 1800, VOLUME, 2000000, 300000, 666190, 0 } } },
+    { "wait", FALSE, {
+        { TONE_WAIT, 425, VOLUME, 800000, 200000, 0, 1000000 },
+        { TONE_WAIT, 425, VOLUME, 800000, 200000, 4000000, 1000000 } } },
+    { "ring", FALSE, {
+        { TONE_RING, 425, VOLUME, 5000000, 1000000, 0, 0 } } },
+    { "dtmf", FALSE, {
+        { TONE_DTMF_IND_L,  770, VOLUME / 2, 1000000, 1000000, 0, 0 },
+        { TONE_DTMF_IND_H, 1336, VOLUME / 2, 1000000, 1000000, 0, 0 } } },
+    { "dtmf keys", TRUE, { { 0 } } }
+};
+
+/* low and high frequency of the keys 0-9 */
+static const uint32_t dtmf_freqs[10][2] = {
+    { 941, 1336 }, { 697, 1209 }, { 697, 1336 }, { 697, 1477 },
+    { 770, 1209 }, { 770, 1336 }, { 770, 1477 }, { 852, 1209 },
+    { 852, 1336 }, { 852, 1477 }
+};
+
+static const uint32_t rates[] = { 8000, 16000, 44100, 48000 };
+
+static void
+bench_setup_tones (struct stream *stream, const BenchCase *c)
+{
+    const BenchTone *t = NULL;
+    guint64          keys;
+    guint64          i;
+    guint            j;
+
+    if (!c->dtmf_keys) {
+        for (j = 0; j < MAX_CASE_TONES; j++) {
+            t = &c->tones[j];
+            if (t->type != TONE_UNDEFINED)
+                tone_create (stream, t->type, t->freq, t->volume, t->period,
+                             t->play, t->start, t->duration);
+        }
+        return;
+    }
+
+    /* the keys are chained one after another like dtmf_play does. */
+    keys = bench_scale * SECONDS * 1000000 / DTMF_KEY_US;
+    for (i = 0; i < keys; i++) {
+        j = (guint) (i % 10);
+        tone_create (stream, TONE_DTMF_L, dtmf_freqs[j][0], VOLUME / 2,
+                     DTMF_KEY_US, DTMF_KEY_US, 0, DTMF_KEY_US);
+        tone_create (stream, TONE_DTMF_H, dtmf_freqs[j][1], VOLUME / 2,
+                     DTMF_KEY_US, DTMF_KEY_US, 0, DTMF_KEY_US);
+    }
+}
+
+/* FNV-1a over the rendered bytes */
+static guint64
+bench_checksum (guint64 hash, const guint8 *data, gsize size)
+{
+    gsize i;
+
+    for (i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= G_GUINT64_CONSTANT (1099511628211);
+    }
+
+    return hash;
+}
+
+static void
+bench_stream_init (struct stream *stream, const BenchCase *c, uint32_t rate,
+                   pa_sample_format_t format, bool block)
+{
+    memset (stream, 0, sizeof (*stream));
+    stream->name      = (char*) c->name;
+    stream->rate      = rate;
+    stream->format    = format;
+    stream->framesize = format == PA_SAMPLE_FLOAT32NE ? sizeof (float) : sizeof (int16_t);
+
+    tone_set_block_synthesis (block);
+    bench_setup_tones (stream, c);
+}
+
+/* renders frames samples in chunks like the benchmark */
+static guint8*
+bench_render_buffer (const BenchCase *c, uint32_t rate, pa_sample_format_t format,
+                     bool block, int frames)
+{
+    struct stream stream;
+    guint8       *buf   = NULL;
+    int           chunk = 0;
+    int           done  = 0;
+
+    bench_stream_init (&stream, c, rate, format, block);
+
+    chunk = (int) ((guint64) rate * CHUNK_US / 1000000);
+    buf   = g_malloc ((gsize) frames * stream.framesize);
+
+    for (done = 0; done < frames; done += chunk) {
+        chunk = MIN (chunk, frames - done);
+        stream.time = tone_write_callback (&stream, buf + (gsize) done * stream.framesize, chunk);
+    }
+
+    if (stream.data)
+        tone_destroy_callback (stream.data);
+
+    return buf;
+}
+
+static double
+bench_sample (const guint8 *buf, pa_sample_format_t format, int i)
+{
+    if (format == PA_SAMPLE_FLOAT32NE)
+        return ((const float*) buf)[i] * 32768.0;
+
+    return ((const int16_t*) buf)[i];
+}
+
+static gboolean
+bench_compare (const BenchCase *c, uint32_t rate, pa_sample_format_t format)
+{
+    guint8  *block  = NULL;
+    guint8  *scalar = NULL;
+    double   error  = 0.0;
+    double   max    = 0.0;
+    int      frames = (int) rate * COMPARE_SECONDS;
+    int      worst  = 0;
+    int      i;
+
+    block  = bench_render_buffer (c, rate, format, true, frames);
+    scalar = bench_render_buffer (c, rate, format, false, frames);
+
+    for (i = 0; i < frames; i++) {
+        error = fabs (bench_sample (block, format, i) - bench_sample (scalar, format, i));
+        if (error > max) {
+            max   = error;
+            worst = i;
+        }
+    }
+
+    g_free (block);
+    g_free (scalar);
+
+    if (max > MAX_ERROR) {
+        printf ("%-10s %5u Hz %-5s block differs from scalar by %.1f at sample %d\n",
+                c->name, rate, format == PA_SAMPLE_FLOAT32NE ? "f32" : "s16", max, worst);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+bench_render (const BenchCase *c, uint32_t rate, pa_sample_format_t format,
+              bool block)
+{
+    struct stream stream;
+    guint8       *buf      = NULL;
+    guint64       hash     = G_GUINT64_CONSTANT (14695981039346656037);
+    guint64       samples  = 0;
+    guint64       total    = 0;
+    gint64        elapsed  = 0;
+    gint64        start    = 0;
+    int           chunk    = 0;
+    gdouble       audio_us = 0.0;
+
+    bench_stream_init (&stream, c, rate, format, block);
+
+    chunk = (int) ((guint64) rate * CHUNK_US / 1000000);
+    total = bench_scale * SECONDS * rate;
+    buf   = g_malloc ((gsize) chunk * stream.framesize);
+
+    for (samples = 0; samples < total; samples += chunk) {
+        start = g_get_monotonic_time ();
+        stream.time = tone_write_callback (&stream, buf, chunk);
+        elapsed += g_get_monotonic_time () - start;
+
+        hash = bench_checksum (hash, buf, (gsize) chunk * stream.framesize);
+    }
+
+    if (stream.data)
+        tone_destroy_callback (stream.data);
+    g_free (buf);
+
+    audio_us = (gdouble) samples * 1000000.0 / rate;
+
+    printf ("%-10s %5u Hz %-5s %-6s %8.2f ns/sample %7.3f%% headroom  %016" G_GINT64_MODIFIER "x\n",
+            c->name, rate, format == PA_SAMPLE_FLOAT32NE ? "f32" : "s16",
+            block ? "block" : "scalar",
+            samples ? elapsed * 1000.0 / samples : 0.0,
+            audio_us > 0.0 ? 100.0 * (1.0 - elapsed / audio_us) : 0.0,
+            hash);
+}
+
+int
+main (int argc, char *argv[])
+{
+    union envelop *envelop = NULL;
+    volatile int32_t out   = 0;
+    uint32_t         t     = 0;
+    float            in[BLOCK];
+    float            acc[BLOCK];
+    uint32_t         envt[BLOCK];
+    gboolean         same  = TRUE;
+    guint            i;
+    guint            r;
+
+    bench_init (argc, argv);
+    n_log_set_level (N_LOG_LEVEL_NONE);
+
+    tone_init ();
+    envelop_init ();
+
+    for (r = 0; r < G_N_ELEMENTS (rates); r++) {
+        for (i = 0; i < G_N_ELEMENTS (cases); i++) {
+            same &= bench_compare (&cases[i], rates[r], PA_SAMPLE_S16NE);
+            same &= bench_compare (&cases[i], rates[r], PA_SAMPLE_FLOAT32NE);
+        }
+    }
+
+    if (!same)
+        return EXIT_FAILURE;
+
+    for (r = 0; r < G_N_ELEMENTS (rates); r++) {
+        for (i = 0; i < G_N_ELEMENTS (cases); i++) {
+            bench_render (&cases[i], rates[r], PA_SAMPLE_S16NE, true);
+            bench_render (&cases[i], rates[r], PA_SAMPLE_FLOAT32NE, true);
+            bench_render (&cases[i], rates[r], PA_SAMPLE_S16NE, false);
+            bench_render (&cases[i], rates[r], PA_SAMPLE_FLOAT32NE, false);
+        }
+    }
+
+    /* the ramp of a tone of one second, applied within and after the
+       ramps */
+    envelop = envelop_create (ENVELOP_RAMP_LINEAR, 10000, 0, 1000000);
+
+    BENCH_RUN ("envelop_apply ramp", ITERATIONS, {
+        out = envelop_apply (envelop, 20000, t % 20000);
+        t += 21;
+    });
+
+    BENCH_RUN ("envelop_apply flat", ITERATIONS, {
+        out = envelop_apply (envelop, 20000, 500000 + t % 20000);
+        t += 21;
+    });
+
+    /* a block at 48 kHz covers 5333 usec, so the runs walk over the
+       ramp-up, the flat part and the ramp-down */
+    for (i = 0; i < BLOCK; i++)
+        in[i] = (float) (i * 97 % 20000) - 10000.0f;
+    memset (acc, 0, sizeof (acc));
+    t = 0;
+
+    BENCH_RUN ("envelop_apply_block", BLOCK_ITERATIONS, {
+        for (i = 0; i < BLOCK; i++)
+            envt[i] = t % 1000000 + (uint64_t) i * 1000000 / 48000;
+        envelop_apply_block (envelop, acc, in, BLOCK, envt);
+        t += 5333;
+    });
+
+    (void) out;
+    envelop_destroy (envelop);
+    tone_exit ();
+    envelop_exit ();
+
+    return EXIT_SUCCESS;
+}
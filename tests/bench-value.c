@@ -0,0 +1,77 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Micro-benchmarks for n_value_copy and n_value_equals. */
+
+#include <ngf/value.h>
+#include "bench-common.h"
+
+#define ITERATIONS (2000000)
+
+int
+main (int argc, char *argv[])
+{
+    NValue   *values[4];
+    NValue   *others[4];
+    NValue   *copy   = NULL;
+    guint     i;
+
+    static const char *names[] = { "string", "int", "uint", "bool" };
+
+    bench_init (argc, argv);
+
+    for (i = 0; i < G_N_ELEMENTS (values); i++) {
+        values[i] = n_value_new ();
+        others[i] = n_value_new ();
+    }
+
+    n_value_set_string (values[0], "/usr/share/sounds/ring-tones/Beep.aac");
+    n_value_set_string (others[0], "/usr/share/sounds/ring-tones/Beep.mp3");
+    n_value_set_int    (values[1], -5);
+    n_value_set_int    (others[1], -5);
+    n_value_set_uint   (values[2], 3000);
+    n_value_set_uint   (others[2], 4000);
+    n_value_set_bool   (values[3], TRUE);
+    n_value_set_bool   (others[3], TRUE);
+
+    for (i = 0; i < G_N_ELEMENTS (values); i++) {
+        gchar *name = g_strdup_printf ("n_value_copy %s", names[i]);
+        BENCH_RUN (name, ITERATIONS, {
+            copy = n_value_copy (values[i]);
+            n_value_free (copy);
+        });
+        g_free (name);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS (values); i++) {
+        gchar *name = g_strdup_printf ("n_value_equals %s", names[i]);
+        BENCH_RUN (name, ITERATIONS, {
+            (void) n_value_equals (values[i], others[i]);
+        });
+        g_free (name);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS (values); i++) {
+        n_value_free (values[i]);
+        n_value_free (others[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
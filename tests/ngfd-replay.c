@@ -0,0 +1,877 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+/* Replays a request stream recorded by the dbus plugin (record_file).
+ * The calls are sent to a running daemon over D-Bus, one connection
+ * per recorded client, or with -i played on a core in this process
+ * with the null and fake sinks. The records are replayed at their
+ * recorded times, scaled by -s, or with -s 0 as fast as possible. At
+ * the end the replay prints how late the calls were sent compared to
+ * the recording, the play latency and the CPU time it used. For the
+ * in-process core that is the CPU time of the core, against a daemon
+ * the daemon has to be measured separately. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <dbus/dbus.h>
+#include <dbus-gmain/dbus-gmain.h>
+
+#include <ngf/log.h>
+#include "src/ngf/core-internal.h"
+#include "src/ngf/core-player.h"
+
+#ifndef BENCH_EVENTS_PATH
+#define BENCH_EVENTS_PATH "data/events.d"
+#endif
+
+#ifndef BENCH_PLUGIN_DIRS
+#define BENCH_PLUGIN_DIRS ""
+#endif
+
+#define DEFAULT_PLUGINS    "null;fake"
+#define DRAIN_TIMEOUT_MS   (5000)
+
+#define NGF_DBUS_NAME  "com.nokia.NonGraphicFeedback1.Backend"
+#define NGF_DBUS_PATH  "/com/nokia/NonGraphicFeedback1"
+#define NGF_DBUS_IFACE "com.nokia.NonGraphicFeedback1"
+
+typedef enum _ReplayOp
+{
+    REPLAY_OP_PLAY = 0,
+    REPLAY_OP_STOP,
+    REPLAY_OP_PAUSE,
+    REPLAY_OP_RESUME,
+    REPLAY_OP_GONE
+} ReplayOp;
+
+typedef struct _ReplayRecord
+{
+    gint64       time;          /* us since the start of the recording */
+    ReplayOp     op;
+    const char  *client;
+    guint32      id;            /* as recorded, 0 for rejected plays */
+    gchar       *event;
+    NProplist   *props;
+} ReplayRecord;
+
+typedef struct _ReplayClient
+{
+    gchar          *name;       /* recorded name */
+    DBusConnection *connection; /* daemon replay only */
+    GHashTable     *ids;        /* recorded id -> replayed id */
+    GHashTable     *plays;      /* ReplayPlay* waiting for the reply */
+} ReplayClient;
+
+typedef struct _ReplayPlay
+{
+    ReplayClient    *client;
+    DBusPendingCall *pending;
+    guint32          recorded;
+    gint64           sent;
+} ReplayPlay;
+
+typedef struct _ReplayState
+{
+    NCore           *core;          /* in-process replay only */
+    NInputInterface *input;
+    gchar           *address;       /* NULL for the system bus */
+    GHashTable      *clients;       /* name -> ReplayClient* */
+    gdouble          speed;         /* 0 for as fast as possible */
+    guint            counts[REPLAY_OP_GONE + 1];
+    guint            skipped;       /* malformed lines */
+    guint            failed;
+    guint            outstanding;   /* plays waiting for the reply */
+    gint64           recorded;      /* length of the recording */
+    GArray          *lateness;      /* gint64, us behind the recorded time */
+    GArray          *latencies;     /* gint64, play to reply or playing in us */
+} ReplayState;
+
+static ReplayState replay;
+
+static void
+replay_send_reply (NInputInterface *iface, NRequest *request, int code)
+{
+    gint64 received = n_request_get_timestamp (request, N_REQUEST_STAGE_RECEIVED);
+    gint64 playing  = n_request_get_timestamp (request, N_REQUEST_STAGE_PLAYING);
+    gint64 latency;
+
+    (void) iface;
+
+    if (code != N_CORE_EVENT_COMPLETED && code != N_CORE_EVENT_FAILED)
+        return;
+
+    if (code == N_CORE_EVENT_FAILED)
+        replay.failed++;
+
+    if (received > 0 && playing >= received) {
+        latency = playing - received;
+        g_array_append_val (replay.latencies, latency);
+    }
+}
+
+static void
+replay_send_error (NInputInterface *iface, NRequest *request, const char *err_msg)
+{
+    (void) err_msg;
+
+    replay_send_reply (iface, request, N_CORE_EVENT_FAILED);
+}
+
+static void
+replay_client_free (ReplayClient *client)
+{
+    GHashTableIter  iter;
+    ReplayPlay     *play = NULL;
+
+    g_hash_table_iter_init (&iter, client->plays);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &play, NULL)) {
+        dbus_pending_call_cancel (play->pending);
+        dbus_pending_call_unref (play->pending);
+        g_free (play);
+        replay.outstanding--;
+    }
+
+    if (client->connection) {
+        dbus_connection_close (client->connection);
+        dbus_connection_unref (client->connection);
+    }
+
+    g_hash_table_destroy (client->plays);
+    g_hash_table_destroy (client->ids);
+    g_free (client->name);
+    g_free (client);
+}
+
+static ReplayClient*
+replay_client_get (const char *name)
+{
+    ReplayClient *client = NULL;
+    DBusError     error  = DBUS_ERROR_INIT;
+
+    if ((client = g_hash_table_lookup (replay.clients, name)))
+        return client;
+
+    client = g_new0 (ReplayClient, 1);
+    client->name    = g_strdup (name);
+    client->ids     = g_hash_table_new (g_direct_hash, g_direct_equal);
+    client->plays   = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    if (!replay.core) {
+        if (replay.address) {
+            client->connection = dbus_connection_open_private (replay.address, &error);
+            if (client->connection && !dbus_bus_register (client->connection, &error)) {
+                dbus_connection_close (client->connection);
+                dbus_connection_unref (client->connection);
+                client->connection = NULL;
+            }
+        }
+        else
+            client->connection = dbus_bus_get_private (DBUS_BUS_SYSTEM, &error);
+
+        if (!client->connection) {
+            fprintf (stderr, "failed to connect client %s: %s\n", name, error.message);
+            dbus_error_free (&error);
+        }
+        else {
+            dbus_connection_set_exit_on_disconnect (client->connection, FALSE);
+            dbus_gmain_set_up_connection (client->connection, NULL);
+        }
+    }
+
+    g_hash_table_insert (replay.clients, client->name, client);
+    return client;
+}
+
+static void
+replay_append_property (const char *key, const NValue *value, gpointer userdata)
+{
+    DBusMessageIter *dict = userdata;
+    DBusMessageIter  entry;
+    DBusMessageIter  variant;
+    const char      *str_value;
+    dbus_int32_t     int_value;
+    dbus_uint32_t    uint_value;
+    dbus_bool_t      bool_value;
+
+    dbus_message_iter_open_container (dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &key);
+
+    switch (n_value_type (value)) {
+        case N_VALUE_TYPE_STRING:
+            str_value = n_value_get_string (value);
+            dbus_message_iter_open_container (&entry, DBUS_TYPE_VARIANT,
+                                              DBUS_TYPE_STRING_AS_STRING, &variant);
+            dbus_message_iter_append_basic (&variant, DBUS_TYPE_STRING, &str_value);
+            break;
+        case N_VALUE_TYPE_INT:
+            int_value = n_value_get_int (value);
+            dbus_message_iter_open_container (&entry, DBUS_TYPE_VARIANT,
+                                              DBUS_TYPE_INT32_AS_STRING, &variant);
+            dbus_message_iter_append_basic (&variant, DBUS_TYPE_INT32, &int_value);
+            break;
+        case N_VALUE_TYPE_UINT:
+            uint_value = n_value_get_uint (value);
+            dbus_message_iter_open_container (&entry, DBUS_TYPE_VARIANT,
+                                              DBUS_TYPE_UINT32_AS_STRING, &variant);
+            dbus_message_iter_append_basic (&variant, DBUS_TYPE_UINT32, &uint_value);
+            break;
+        default:
+            bool_value = n_value_get_bool (value);
+            dbus_message_iter_open_container (&entry, DBUS_TYPE_VARIANT,
+                                              DBUS_TYPE_BOOLEAN_AS_STRING, &variant);
+            dbus_message_iter_append_basic (&variant, DBUS_TYPE_BOOLEAN, &bool_value);
+            break;
+    }
+
+    dbus_message_iter_close_container (&entry, &variant);
+    dbus_message_iter_close_container (dict, &entry);
+}
+
+static void
+replay_play_reply_cb (DBusPendingCall *pending, void *userdata)
+{
+    ReplayPlay    *play    = userdata;
+    DBusMessage   *reply   = NULL;
+    dbus_uint32_t  id      = 0;
+    gint64         latency = g_get_monotonic_time () - play->sent;
+
+    reply = dbus_pending_call_steal_reply (pending);
+
+    if (!reply || dbus_message_get_type (reply) == DBUS_MESSAGE_TYPE_ERROR ||
+        !dbus_message_get_args (reply, NULL, DBUS_TYPE_UINT32, &id,
+                                DBUS_TYPE_INVALID))
+        replay.failed++;
+    else {
+        g_array_append_val (replay.latencies, latency);
+        if (play->recorded != 0 && id != 0)
+            g_hash_table_insert (play->client->ids, GUINT_TO_POINTER (play->recorded),
+                                 GUINT_TO_POINTER (id));
+    }
+
+    if (reply)
+        dbus_message_unref (reply);
+
+    g_hash_table_remove (play->client->plays, play);
+    dbus_pending_call_unref (play->pending);
+    g_free (play);
+    replay.outstanding--;
+}
+
+static ReplayPlay*
+replay_find_play (ReplayClient *client, guint32 recorded)
+{
+    GHashTableIter  iter;
+    ReplayPlay     *play = NULL;
+
+    g_hash_table_iter_init (&iter, client->plays);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &play, NULL)) {
+        if (play->recorded == recorded)
+            return play;
+    }
+
+    return NULL;
+}
+
+/* the replayed id of a recorded one, a play still waiting for its
+   reply is waited for first. */
+static guint32
+replay_lookup_id (ReplayClient *client, guint32 recorded)
+{
+    ReplayPlay *play = NULL;
+
+    /* the reply frees the play */
+    while (recorded != 0 && (play = replay_find_play (client, recorded)))
+        dbus_pending_call_block (play->pending);
+
+    return GPOINTER_TO_UINT (g_hash_table_lookup (client->ids, GUINT_TO_POINTER (recorded)));
+}
+
+static void
+replay_daemon_call (const ReplayRecord *record, ReplayClient *client)
+{
+    DBusMessage     *msg     = NULL;
+    DBusPendingCall *pending = NULL;
+    DBusMessageIter  iter;
+    DBusMessageIter  dict;
+    ReplayPlay      *play    = NULL;
+    dbus_uint32_t    id      = 0;
+    dbus_bool_t      pause;
+
+    if (!client->connection)
+        return;
+
+    if (record->op == REPLAY_OP_PLAY) {
+        msg = dbus_message_new_method_call (NGF_DBUS_NAME, NGF_DBUS_PATH,
+                                            NGF_DBUS_IFACE, "Play");
+        dbus_message_iter_init_append (msg, &iter);
+        dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &record->event);
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+            DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+            DBUS_TYPE_STRING_AS_STRING
+            DBUS_TYPE_VARIANT_AS_STRING
+            DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &dict);
+        n_proplist_foreach (record->props, replay_append_property, &dict);
+        dbus_message_iter_close_container (&iter, &dict);
+
+        play = g_new0 (ReplayPlay, 1);
+        play->client   = client;
+        play->recorded = record->id;
+        play->sent     = g_get_monotonic_time ();
+
+        if (!dbus_connection_send_with_reply (client->connection, msg, &pending, -1) ||
+            !pending) {
+            replay.failed++;
+            g_free (play);
+            dbus_message_unref (msg);
+            return;
+        }
+
+        play->pending = pending;
+        g_hash_table_add (client->plays, play);
+        replay.outstanding++;
+        dbus_pending_call_set_notify (pending, replay_play_reply_cb, play, NULL);
+        dbus_message_unref (msg);
+        return;
+    }
+
+    /* stops and pauses of unknown requests are sent as well, the
+       daemon replies to them with an error like it did when recorded. */
+    id = replay_lookup_id (client, record->id);
+
+    if (record->op == REPLAY_OP_STOP) {
+        msg = dbus_message_new_method_call (NGF_DBUS_NAME, NGF_DBUS_PATH,
+                                            NGF_DBUS_IFACE, "Stop");
+        dbus_message_append_args (msg, DBUS_TYPE_UINT32, &id, DBUS_TYPE_INVALID);
+    }
+    else {
+        msg = dbus_message_new_method_call (NGF_DBUS_NAME, NGF_DBUS_PATH,
+                                            NGF_DBUS_IFACE, "Pause");
+        pause = record->op == REPLAY_OP_PAUSE;
+        dbus_message_append_args (msg, DBUS_TYPE_UINT32, &id,
+                                  DBUS_TYPE_BOOLEAN, &pause, DBUS_TYPE_INVALID);
+    }
+
+    dbus_message_set_no_reply (msg, TRUE);
+    dbus_connection_send (client->connection, msg, NULL);
+    dbus_message_unref (msg);
+}
+
+static void
+replay_core_call (const ReplayRecord *record, ReplayClient *client)
+{
+    NRequest       *request = NULL;
+    GHashTableIter  iter;
+    gpointer        id;
+
+    switch (record->op) {
+        case REPLAY_OP_PLAY:
+            n_proplist_set_bool (record->props, "sink.null", TRUE);
+            request = n_request_new_with_event_and_properties (record->event,
+                                                                record->props);
+            n_request_set_timestamp (request, N_REQUEST_STAGE_RECEIVED,
+                                     g_get_monotonic_time ());
+            if (record->id != 0)
+                g_hash_table_insert (client->ids, GUINT_TO_POINTER (record->id),
+                                     GUINT_TO_POINTER (n_request_get_id (request)));
+            n_input_interface_play_request (replay.input, request);
+            return;
+
+        case REPLAY_OP_GONE:
+            /* the dbus plugin stops the requests of a client that is gone */
+            g_hash_table_iter_init (&iter, client->ids);
+            while (g_hash_table_iter_next (&iter, NULL, &id)) {
+                if ((request = n_core_lookup_request (replay.core, GPOINTER_TO_UINT (id))))
+                    n_input_interface_stop_request (replay.input, request, 0);
+            }
+            return;
+
+        default:
+            break;
+    }
+
+    id = g_hash_table_lookup (client->ids, GUINT_TO_POINTER (record->id));
+    if (!(request = n_core_lookup_request (replay.core, GPOINTER_TO_UINT (id))))
+        return;
+
+    /* like the dbus plugin does */
+    if (record->op == REPLAY_OP_STOP)
+        n_input_interface_stop_request (replay.input, request, 0);
+    else if (record->op == REPLAY_OP_PAUSE)
+        (void) n_input_interface_pause_request (replay.input, request);
+    else
+        (void) n_input_interface_play_request (replay.input, request);
+}
+
+static gboolean
+replay_parse_property (NProplist *props, gchar *field)
+{
+    gchar   *value = NULL;
+    gchar   *key   = NULL;
+    gchar   *data  = NULL;
+
+    if (!(value = strchr (field, '=')) || value[1] == '\0' || value[2] != ':')
+        return FALSE;
+
+    *value = '\0';
+    key  = g_strcompress (field);
+    data = value + 3;
+
+    switch (value[1]) {
+        case 's':
+            data = g_strcompress (data);
+            n_proplist_set_string (props, key, data);
+            g_free (data);
+            break;
+        case 'i':
+            n_proplist_set_int (props, key, (gint) g_ascii_strtoll (data, NULL, 10));
+            break;
+        case 'u':
+            n_proplist_set_uint (props, key, (guint) g_ascii_strtoull (data, NULL, 10));
+            break;
+        case 'b':
+            n_proplist_set_bool (props, key, data[0] == '1');
+            break;
+        default:
+            g_free (key);
+            return FALSE;
+    }
+
+    g_free (key);
+    return TRUE;
+}
+
+/* fills in the record from the fields of a line, the client points to
+   the fields. */
+static gboolean
+replay_parse (gchar **fields, ReplayRecord *record)
+{
+    static const char *ops[] = { "play", "stop", "pause", "resume", "gone" };
+    guint               n    = g_strv_length (fields);
+    guint               i;
+
+    memset (record, 0, sizeof (*record));
+
+    if (n < 4)
+        return FALSE;
+
+    for (i = 0; i < G_N_ELEMENTS (ops); i++) {
+        if (strcmp (fields[1], ops[i]) == 0)
+            break;
+    }
+    if (i == G_N_ELEMENTS (ops))
+        return FALSE;
+
+    record->time   = g_ascii_strtoll (fields[0], NULL, 10);
+    record->op     = (ReplayOp) i;
+    record->client = fields[2];
+    record->id     = (guint32) g_ascii_strtoull (fields[3], NULL, 10);
+
+    if (record->op != REPLAY_OP_PLAY)
+        return TRUE;
+
+    if (n < 5)
+        return FALSE;
+
+    record->event = g_strcompress (fields[4]);
+    record->props = n_proplist_new ();
+    for (i = 5; i < n; i++) {
+        if (!replay_parse_property (record->props, fields[i])) {
+            g_free (record->event);
+            n_proplist_free (record->props);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean
+replay_wakeup_cb (gpointer userdata)
+{
+    *(gboolean*) userdata = TRUE;
+    return FALSE;
+}
+
+/* runs the main loop until the time has come, the replies and the
+   sinks are served meanwhile. */
+static void
+replay_wait_until (gint64 due)
+{
+    gboolean woken = FALSE;
+    gint64   now;
+
+    while ((now = g_get_monotonic_time ()) < due) {
+        woken = FALSE;
+        g_timeout_add ((guint) ((due - now + 999) / 1000), replay_wakeup_cb, &woken);
+        while (!woken)
+            g_main_context_iteration (NULL, TRUE);
+    }
+
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+}
+
+static gboolean
+replay_file (FILE *file)
+{
+    ReplayRecord   record;
+    ReplayClient  *client = NULL;
+    gchar        **fields = NULL;
+    char          *line   = NULL;
+    size_t         size   = 0;
+    ssize_t        len    = 0;
+    guint          number = 0;
+    gint64         start  = 0;
+    gint64         due    = 0;
+    gint64         late   = 0;
+
+    start = g_get_monotonic_time ();
+
+    while ((len = getline (&line, &size, file)) >= 0) {
+        number++;
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        fields = g_strsplit (line, "\t", -1);
+        if (!replay_parse (fields, &record)) {
+            fprintf (stderr, "line %u: malformed record\n", number);
+            replay.skipped++;
+            g_strfreev (fields);
+            continue;
+        }
+
+        if (replay.speed > 0.0) {
+            due = start + (gint64) (record.time / replay.speed);
+            replay_wait_until (due);
+            late = g_get_monotonic_time () - due;
+            g_array_append_val (replay.lateness, late);
+        }
+        else {
+            while (g_main_context_iteration (NULL, FALSE))
+                ;
+        }
+
+        if (record.op == REPLAY_OP_GONE)
+            client = g_hash_table_lookup (replay.clients, record.client); /* may be unseen */
+        else
+            client = replay_client_get (record.client);
+
+        if (client && replay.core)
+            replay_core_call (&record, client);
+        else if (client)
+            replay_daemon_call (&record, client);
+
+        if (client && record.op == REPLAY_OP_GONE)
+            g_hash_table_remove (replay.clients, client->name);
+
+        replay.counts[record.op]++;
+        replay.recorded = record.time;
+
+        if (record.props)
+            n_proplist_free (record.props);
+        g_free (record.event);
+        g_strfreev (fields);
+    }
+
+    free (line);
+    return !ferror (file);
+}
+
+/* stops what is left and waits for the replies */
+static void
+replay_drain (void)
+{
+    GList    *requests = NULL;
+    GList    *iter     = NULL;
+    gboolean  timed_out = FALSE;
+    guint     timeout_id;
+
+    if (replay.core) {
+        requests = g_list_copy (n_core_get_requests (replay.core));
+        for (iter = requests; iter; iter = g_list_next (iter))
+            n_input_interface_stop_request (replay.input, (NRequest*) iter->data, 0);
+        g_list_free (requests);
+    }
+
+    timeout_id = g_timeout_add (DRAIN_TIMEOUT_MS, replay_wakeup_cb, &timed_out);
+    while (!timed_out) {
+        if (replay.core ? n_core_get_requests (replay.core) == NULL
+                        : replay.outstanding == 0)
+            break;
+        g_main_context_iteration (NULL, TRUE);
+    }
+
+    if (!timed_out)
+        g_source_remove (timeout_id);
+}
+
+static gint
+replay_compare (gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64*) a;
+    gint64 y = *(const gint64*) b;
+
+    return (x > y) - (x < y);
+}
+
+static gint64
+replay_percentile (GArray *values, guint percentile)
+{
+    guint index;
+
+    if (values->len == 0)
+        return 0;
+
+    index = (values->len - 1) * percentile / 100;
+    return g_array_index (values, gint64, index);
+}
+
+static void
+replay_report (gint64 elapsed)
+{
+    struct rusage usage;
+
+    printf ("%u plays, %u stops, %u pauses, %u resumes, %u disconnects (%u malformed)\n",
+            replay.counts[REPLAY_OP_PLAY], replay.counts[REPLAY_OP_STOP],
+            replay.counts[REPLAY_OP_PAUSE], replay.counts[REPLAY_OP_RESUME],
+            replay.counts[REPLAY_OP_GONE], replay.skipped);
+
+    printf ("replayed in %.3f s, recorded %.3f s\n",
+            elapsed / (double) G_USEC_PER_SEC, replay.recorded / (double) G_USEC_PER_SEC);
+
+    if (replay.lateness->len > 0) {
+        g_array_sort (replay.lateness, replay_compare);
+        printf ("late      p50 %6" G_GINT64_FORMAT " us  p99 %6" G_GINT64_FORMAT
+                " us  max %6" G_GINT64_FORMAT " us\n",
+                replay_percentile (replay.lateness, 50),
+                replay_percentile (replay.lateness, 99),
+                replay_percentile (replay.lateness, 100));
+    }
+
+    g_array_sort (replay.latencies, replay_compare);
+    printf ("%-9s p50 %6" G_GINT64_FORMAT " us  p99 %6" G_GINT64_FORMAT
+            " us  (%u failed)\n", replay.core ? "playing" : "reply",
+            replay_percentile (replay.latencies, 50),
+            replay_percentile (replay.latencies, 99), replay.failed);
+
+    if (getrusage (RUSAGE_SELF, &usage) == 0)
+        printf ("cpu       user %.3f s  system %.3f s\n",
+                usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+                usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+}
+
+static gchar*
+replay_setup_conf (const char *plugins, const char *plugin_dirs)
+{
+    gchar   *conf_path   = NULL;
+    gchar   *plugin_path = NULL;
+    gchar   *events_path = NULL;
+    gchar   *filename    = NULL;
+    gchar   *contents    = NULL;
+    gchar  **dirs        = NULL;
+    gchar  **names       = NULL;
+    gchar   *source      = NULL;
+    gchar   *target      = NULL;
+    gchar  **dir         = NULL;
+    gchar  **name        = NULL;
+
+    if (!(conf_path = g_dir_make_tmp ("ngfd-replay-XXXXXX", NULL)))
+        return NULL;
+
+    plugin_path = g_build_filename (conf_path, "plugins", NULL);
+    g_mkdir (plugin_path, 0700);
+
+    dirs  = g_strsplit (plugin_dirs, ":", -1);
+    names = g_strsplit (plugins, ";", -1);
+    for (name = names; *name; ++name) {
+        target = g_strdup_printf ("libngfd_%s.so", *name);
+        for (dir = dirs; *dir; ++dir) {
+            source = g_build_filename (*dir, target, NULL);
+            if (g_file_test (source, G_FILE_TEST_EXISTS)) {
+                filename = g_build_filename (plugin_path, target, NULL);
+                if (symlink (source, filename) < 0)
+                    fprintf (stderr, "failed to link plugin %s\n", source);
+                g_free (filename);
+                g_free (source);
+                break;
+            }
+            g_free (source);
+        }
+        g_free (target);
+    }
+    g_strfreev (names);
+    g_strfreev (dirs);
+
+    events_path = g_build_filename (conf_path, "events.d", NULL);
+    if (symlink (BENCH_EVENTS_PATH, events_path) < 0)
+        fprintf (stderr, "failed to link events from %s\n", BENCH_EVENTS_PATH);
+
+    contents = g_strdup_printf ("[general]\nplugins = %s\n", plugins);
+    filename = g_build_filename (conf_path, "ngfd.ini", NULL);
+    g_file_set_contents (filename, contents, -1, NULL);
+
+    g_setenv ("NGF_CONF_PATH", conf_path, TRUE);
+    g_setenv ("NGF_USER_CONF_PATH", conf_path, TRUE);
+    g_setenv ("NGF_PLUGIN_PATH", plugin_path, TRUE);
+
+    g_free (filename);
+    g_free (contents);
+    g_free (events_path);
+    g_free (plugin_path);
+
+    return conf_path;
+}
+
+static void
+replay_remove_dir (const char *path)
+{
+    GDir        *dir   = NULL;
+    const gchar *entry = NULL;
+    gchar       *file  = NULL;
+
+    if ((dir = g_dir_open (path, 0, NULL))) {
+        while ((entry = g_dir_read_name (dir))) {
+            file = g_build_filename (path, entry, NULL);
+            if (g_file_test (file, G_FILE_TEST_IS_DIR) &&
+                !g_file_test (file, G_FILE_TEST_IS_SYMLINK))
+                replay_remove_dir (file);
+            else
+                g_unlink (file);
+            g_free (file);
+        }
+        g_dir_close (dir);
+    }
+
+    g_rmdir (path);
+}
+
+static void
+usage (const char *name)
+{
+    printf ("usage: %s [-a address | -i [-p plugins] [-d plugin dirs]] [-s speed] file\n"
+            "  -a  bus address of the daemon (default the system bus)\n"
+            "  -i  replay on a core in this process instead of a daemon\n"
+            "  -p  ';' separated sink plugins of the core (default \"%s\")\n"
+            "  -d  ':' separated directories to find the plugins from\n"
+            "  -s  speed relative to the recording, 0 for as fast as possible (default 1)\n",
+            name, DEFAULT_PLUGINS);
+}
+
+int
+main (int argc, char *argv[])
+{
+    static const NInputInterfaceDecl input_decl = {
+        .name       = "replay",
+        .send_error = replay_send_error,
+        .send_reply = replay_send_reply
+    };
+
+    const char *plugins     = DEFAULT_PLUGINS;
+    const char *plugin_dirs = BENCH_PLUGIN_DIRS;
+    gchar      *conf_path   = NULL;
+    gboolean    in_process  = FALSE;
+    FILE       *file        = NULL;
+    gint64      start;
+    int         ret         = EXIT_FAILURE;
+    int         opt;
+
+    replay.speed = 1.0;
+
+    while ((opt = getopt (argc, argv, "a:ip:d:s:h")) != -1) {
+        switch (opt) {
+            case 'a': replay.address = optarg;                     break;
+            case 'i': in_process = TRUE;                           break;
+            case 'p': plugins = optarg;                            break;
+            case 'd': plugin_dirs = optarg;                        break;
+            case 's': replay.speed = g_ascii_strtod (optarg, NULL); break;
+            default:
+                usage (argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1 || replay.speed < 0.0) {
+        usage (argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!(file = fopen (argv[optind], "r"))) {
+        fprintf (stderr, "failed to open %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    n_log_initialize (N_LOG_LEVEL_ERROR);
+
+    replay.clients   = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                              (GDestroyNotify) replay_client_free);
+    replay.lateness  = g_array_new (FALSE, FALSE, sizeof (gint64));
+    replay.latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+    if (in_process) {
+        if (!(conf_path = replay_setup_conf (plugins, plugin_dirs))) {
+            fprintf (stderr, "failed to create configuration directory\n");
+            goto done;
+        }
+
+        replay.core = n_core_new (&argc, argv);
+        n_core_register_input (replay.core, &input_decl);
+
+        if (!n_core_initialize (replay.core)) {
+            fprintf (stderr, "failed to initialize core\n");
+            goto done;
+        }
+        replay.input = replay.core->inputs[0];
+    }
+
+    start = g_get_monotonic_time ();
+    if (!replay_file (file)) {
+        fprintf (stderr, "failed to read %s\n", argv[optind]);
+        goto done;
+    }
+    replay_drain ();
+    replay_report (g_get_monotonic_time () - start);
+
+    ret = EXIT_SUCCESS;
+
+done:
+    g_hash_table_destroy (replay.clients);
+    if (replay.core) {
+        n_core_shutdown (replay.core);
+        n_core_free (replay.core);
+    }
+    if (conf_path) {
+        replay_remove_dir (conf_path);
+        g_free (conf_path);
+    }
+    g_array_free (replay.latencies, TRUE);
+    g_array_free (replay.lateness, TRUE);
+    fclose (file);
+
+    return ret;
+}
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <check.h>
+#include <glib/gstdio.h>
 
 #include "src/ngf/context.c"
 #include "ngf/value.h"
@@ -101,6 +102,413 @@ START_TEST (test_subscribe_unsubscribe_value_change)
 }
 END_TEST
 
+static GString *prefix_calls = NULL;
+
+static void
+prefix_cb (NContext *context, const char *key, const NValue *old_value,
+           const NValue *new_value, void *userdata)
+{
+    (void) context;
+    (void) old_value;
+    (void) new_value;
+
+    g_string_append_printf (prefix_calls, "%s:%s;", (const char*) userdata, key);
+}
+
+static guint self_id = 0;
+
+static void
+prefix_self_cb (NContext *context, const char *key, const NValue *old_value,
+                const NValue *new_value, void *userdata)
+{
+    prefix_cb (context, key, old_value, new_value, userdata);
+    n_context_unsubscribe (context, self_id);
+}
+
+static void
+set_int (NContext *context, const char *key, int value)
+{
+    NValue *v = n_value_new ();
+    n_value_set_int (v, value);
+    n_context_set_value (context, key, v);
+}
+
+START_TEST (test_subscribe_prefix)
+{
+    NContext *context = n_context_new ();
+    fail_unless (context != NULL);
+    prefix_calls = g_string_new (NULL);
+
+    guint all = n_context_subscribe (context, "*", prefix_cb, "all");
+    guint profile = n_context_subscribe (context, "profile.*", prefix_cb, "profile");
+    guint ringing = n_context_subscribe (context, "profile.ringing.*", prefix_cb, "ringing");
+    guint exact = n_context_subscribe (context, "profile.ringing.volume", prefix_cb, "exact");
+    fail_unless (all && profile && ringing && exact);
+    fail_unless (n_context_subscribe (context, "x.*", NULL, NULL) == 0);
+
+    /* single key subscribers first, then prefixes from the shortest */
+    set_int (context, "profile.ringing.volume", 1);
+    fail_unless (g_str_equal (prefix_calls->str,
+        "exact:profile.ringing.volume;profile:profile.ringing.volume;"
+        "ringing:profile.ringing.volume;all:profile.ringing.volume;"));
+
+    /* a prefix doesn't match the key itself, or keys sharing some
+       characters of the last segment */
+    g_string_truncate (prefix_calls, 0);
+    set_int (context, "profile", 1);
+    set_int (context, "profile.ringingx", 1);
+    set_int (context, "profiles.a", 1);
+    fail_unless (g_str_equal (prefix_calls->str,
+        "all:profile;profile:profile.ringingx;all:profile.ringingx;all:profiles.a;"));
+
+    /* unsubscribe by id and by callback */
+    n_context_unsubscribe (context, ringing);
+    n_context_unsubscribe (context, ringing);
+    n_context_unsubscribe (context, exact);
+    fail_unless (g_hash_table_size (context->keys) == 0);
+    n_context_unsubscribe_value_change (context, "profile.*", prefix_cb);
+    n_context_unsubscribe_value_change (context, NULL, prefix_cb);
+    fail_unless (context->all_keys == NULL);
+    fail_unless (g_hash_table_size (context->subscriptions) == 0);
+
+    g_string_truncate (prefix_calls, 0);
+    set_int (context, "profile.ringing.volume", 2);
+    fail_unless (prefix_calls->len == 0);
+
+    /* the callback may remove its own subscription */
+    self_id = n_context_subscribe (context, "profile.*", prefix_self_cb, "self");
+    fail_unless (n_context_subscribe (context, "profile.*", prefix_cb, "other") != 0);
+    set_int (context, "profile.a", 1);
+    set_int (context, "profile.b", 1);
+    fail_unless (g_str_equal (prefix_calls->str,
+        "self:profile.a;other:profile.a;other:profile.b;"));
+
+    g_string_free (prefix_calls, TRUE);
+    prefix_calls = NULL;
+    n_context_free (context);
+}
+END_TEST
+
+typedef struct _SnapshotReader
+{
+    NContext *context;
+    gint      stop;
+    guint     inconsistent;
+    guint     reads;
+} SnapshotReader;
+
+static gpointer
+snapshot_reader_thread (gpointer userdata)
+{
+    SnapshotReader   *reader   = userdata;
+    NContextSnapshot *snapshot = NULL;
+
+    while (!g_atomic_int_get (&reader->stop)) {
+        snapshot = n_context_get_snapshot (reader->context);
+        /* a and b are always changed in the same transaction */
+        if (n_value_get_int (n_context_snapshot_get_value (snapshot, "snapshot.a")) !=
+            n_value_get_int (n_context_snapshot_get_value (snapshot, "snapshot.b")))
+            reader->inconsistent++;
+        reader->reads++;
+        n_context_snapshot_unref (snapshot);
+    }
+
+    return NULL;
+}
+
+START_TEST (test_snapshot)
+{
+    NContext         *context  = n_context_new ();
+    NContextSnapshot *snapshot = NULL;
+    NContextSnapshot *previous = NULL;
+    SnapshotReader    reader;
+    GThread          *thread   = NULL;
+    NValue           *value    = NULL;
+    int               i;
+
+    fail_unless (context != NULL);
+
+    /* nothing is published without readers */
+    fail_unless (n_context_get_snapshot (context) == NULL);
+    n_context_add_snapshot_reader (context);
+
+    snapshot = n_context_get_snapshot (context);
+    fail_unless (snapshot != NULL);
+    fail_unless (n_context_snapshot_get_value (snapshot, "snapshot.a") == NULL);
+    previous = snapshot;
+
+    value = n_value_new ();
+    n_value_set_string (value, "first");
+    n_context_set_value (context, "snapshot.a", value);
+
+    /* the earlier snapshot doesn't change */
+    snapshot = n_context_get_snapshot (context);
+    fail_unless (snapshot != previous);
+    fail_unless (n_context_snapshot_get_value (previous, "snapshot.a") == NULL);
+    fail_unless (g_strcmp0 (n_value_get_string (n_context_snapshot_get_value (snapshot, "snapshot.a")),
+                            "first") == 0);
+    fail_unless (n_context_snapshot_get_generation (snapshot) == n_context_get_generation (context));
+    fail_unless (n_context_snapshot_get_generation (previous) < n_context_snapshot_get_generation (snapshot));
+    n_context_snapshot_unref (previous);
+
+    /* held snapshots outlive the context */
+    value = n_value_new ();
+    n_value_set_string (value, "a value too long to be stored inline");
+    n_context_set_value (context, "snapshot.long", value);
+    n_context_snapshot_unref (snapshot);
+    snapshot = n_context_get_snapshot (context);
+
+    /* only whole transactions are published */
+    memset (&reader, 0, sizeof (reader));
+    reader.context = context;
+    thread = g_thread_new ("snapshot-reader", snapshot_reader_thread, &reader);
+
+    for (i = 0; i < 20000; i++) {
+        n_context_begin (context);
+        value = n_value_new ();
+        n_value_set_int (value, i);
+        n_context_set_value (context, "snapshot.a", value);
+        value = n_value_new ();
+        n_value_set_int (value, i);
+        n_context_set_value (context, "snapshot.b", value);
+        n_context_commit (context);
+    }
+
+    g_atomic_int_set (&reader.stop, 1);
+    g_thread_join (thread);
+    fail_unless (reader.reads > 0);
+    fail_unless (reader.inconsistent == 0);
+
+    /* the last reader releases the published snapshot */
+    n_context_remove_snapshot_reader (context);
+    fail_unless (n_context_get_snapshot (context) == NULL);
+
+    n_context_free (context);
+    fail_unless (g_strcmp0 (n_value_get_string (n_context_snapshot_get_value (snapshot, "snapshot.long")),
+                            "a value too long to be stored inline") == 0);
+    n_context_snapshot_unref (snapshot);
+}
+END_TEST
+
+START_TEST (test_generation)
+{
+    NContext *context = NULL;
+    context = n_context_new ();
+    fail_unless (context != NULL);
+
+    NAtom atom = n_atom_intern ("generation.key");
+    NAtom other = n_atom_intern ("generation.other");
+    fail_unless (n_context_get_generation (context) == 0);
+    fail_unless (n_context_get_key_generation (context, atom) == 0);
+
+    NValue *value = n_value_new ();
+    n_value_set_int (value, 1);
+    n_context_set_value (context, "generation.key", value);
+    fail_unless (n_context_get_generation (context) == 1);
+    fail_unless (n_context_get_key_generation (context, atom) == 1);
+    fail_unless (n_context_get_key_generation (context, other) == 0);
+
+    value = n_value_new ();
+    n_value_set_int (value, 2);
+    n_context_set_value (context, "generation.other", value);
+    fail_unless (n_context_get_generation (context) == 2);
+    fail_unless (n_context_get_key_generation (context, atom) == 1);
+    fail_unless (n_context_get_key_generation (context, other) == 2);
+    fail_unless (n_value_get_int (n_context_get_value_by_atom (context, other)) == 2);
+
+    n_context_free (context);
+}
+END_TEST
+
+static guint num_key_changes = 0;
+static guint num_batches = 0;
+static guint num_batch_changes = 0;
+
+static void
+transaction_key_cb (NContext *context, const char *key,
+                    const NValue *old_value, const NValue *new_value,
+                    void *userdata)
+{
+    (void) key;
+    (void) userdata;
+
+    /* all the values are applied before notifying */
+    fail_unless (n_value_get_int (n_context_get_value (context, "transaction.b")) == 3);
+    fail_unless (old_value == NULL);
+    fail_unless (new_value != NULL);
+    num_key_changes++;
+}
+
+static void
+transaction_changes_cb (NContext *context, const NContextChange *changes,
+                        unsigned int num_changes, void *userdata)
+{
+    (void) context;
+    (void) userdata;
+
+    num_batches++;
+    num_batch_changes += num_changes;
+
+    if (num_changes == 2) {
+        fail_unless (g_strcmp0 (changes[0].key, "transaction.a") == 0);
+        fail_unless (g_strcmp0 (changes[1].key, "transaction.b") == 0);
+        fail_unless (changes[1].old_value == NULL);
+        fail_unless (n_value_get_int (changes[1].new_value) == 3);
+    }
+}
+
+START_TEST (test_transaction)
+{
+    NContext *context = NULL;
+    context = n_context_new ();
+    fail_unless (context != NULL);
+
+    fail_unless (n_context_subscribe_value_change (context, "transaction.b",
+                                                   transaction_key_cb, NULL));
+    fail_unless (n_context_subscribe_changes (context, transaction_changes_cb, NULL));
+
+    n_context_begin (context);
+    NValue *value = n_value_new ();
+    n_value_set_int (value, 1);
+    n_context_set_value (context, "transaction.a", value);
+
+    n_context_begin (context);
+    value = n_value_new ();
+    n_value_set_int (value, 2);
+    n_context_set_value (context, "transaction.b", value);
+    value = n_value_new ();
+    n_value_set_int (value, 3);
+    n_context_set_value (context, "transaction.b", value);
+    n_context_commit (context);
+
+    /* nothing applied until the outermost commit */
+    fail_unless (n_context_get_value (context, "transaction.a") == NULL);
+    fail_unless (num_batches == 0);
+    fail_unless (n_context_get_generation (context) == 0);
+
+    n_context_commit (context);
+    fail_unless (n_value_get_int (n_context_get_value (context, "transaction.a")) == 1);
+    fail_unless (num_key_changes == 1);
+    fail_unless (num_batches == 1);
+    fail_unless (num_batch_changes == 2);
+    fail_unless (n_context_get_generation (context) == 1);
+    fail_unless (n_context_get_key_generation (context, n_atom_intern ("transaction.a")) == 1);
+
+    /* single value outside transaction */
+    value = n_value_new ();
+    n_value_set_int (value, 4);
+    n_context_set_value (context, "transaction.c", value);
+    fail_unless (num_batches == 2);
+    fail_unless (num_batch_changes == 3);
+
+    n_context_unsubscribe_changes (context, transaction_changes_cb);
+    n_context_begin (context);
+    value = n_value_new ();
+    n_value_set_int (value, 5);
+    n_context_set_value (context, "transaction.c", value);
+    n_context_commit (context);
+    fail_unless (num_batches == 2);
+
+    n_context_unsubscribe_value_change (context, "transaction.b", transaction_key_cb);
+    n_context_free (context);
+}
+END_TEST
+
+START_TEST (test_set_if_changed)
+{
+    NContext *context = NULL;
+    context = n_context_new ();
+    fail_unless (context != NULL);
+
+    num_batches = 0;
+    fail_unless (n_context_subscribe_changes (context, transaction_changes_cb, NULL));
+
+    fail_unless (n_context_set_string_if_changed (context, "changed.state", "ringing"));
+    fail_unless (!n_context_set_string_if_changed (context, "changed.state", "ringing"));
+    fail_unless (num_batches == 1);
+    fail_unless (n_context_get_generation (context) == 1);
+    fail_unless (g_strcmp0 (n_value_get_string (n_context_get_value (context, "changed.state")),
+                            "ringing") == 0);
+
+    fail_unless (n_context_set_string_if_changed (context, "changed.state", "active"));
+    fail_unless (num_batches == 2);
+
+    /* a value of another type is always replaced */
+    NValue *value = n_value_new ();
+    n_value_set_int (value, 1);
+    n_context_set_value (context, "changed.type", value);
+    fail_unless (n_context_set_uint_if_changed (context, "changed.type", 1));
+    fail_unless (!n_context_set_uint_if_changed (context, "changed.type", 1));
+    fail_unless (num_batches == 4);
+
+    /* compared against the pending value inside a transaction */
+    n_context_begin (context);
+    fail_unless (n_context_set_uint_if_changed (context, "changed.type", 2));
+    fail_unless (!n_context_set_uint_if_changed (context, "changed.type", 2));
+    fail_unless (!n_context_set_string_if_changed (context, "changed.state", "active"));
+    n_context_commit (context);
+    fail_unless (num_batches == 5);
+    fail_unless (n_context_get_generation (context) == 5);
+    fail_unless (n_value_get_uint (n_context_get_value (context, "changed.type")) == 2);
+
+    n_context_unsubscribe_changes (context, transaction_changes_cb);
+    n_context_free (context);
+}
+END_TEST
+
+START_TEST (test_restore_value)
+{
+    NContext *context = NULL;
+    gchar *dir = g_dir_make_tmp ("test-context-XXXXXX", NULL);
+    gchar *filename = g_build_filename (dir, "cache", "context.cache", NULL);
+    fail_unless (dir != NULL);
+
+    /* nothing cached yet */
+    context = n_context_new ();
+    n_context_set_cache_file (context, filename);
+    fail_unless (!n_context_restore_value (context, "restore.state"));
+    fail_unless (!n_context_restore_value (context, "restore.route"));
+    fail_unless (n_context_set_string_if_changed (context, "restore.state", "active"));
+    fail_unless (n_context_set_uint_if_changed (context, "restore.route", 3));
+    fail_unless (n_context_set_uint_if_changed (context, "restore.other", 4));
+    n_context_free (context);
+
+    context = n_context_new ();
+    n_context_set_cache_file (context, filename);
+    fail_unless (n_context_restore_value (context, "restore.state"));
+    fail_unless (n_context_restore_value (context, "restore.route"));
+    fail_unless (!n_context_restore_value (context, "restore.other"));
+    fail_unless (g_strcmp0 (n_value_get_string (n_context_get_value (context, "restore.state")),
+                            "active") == 0);
+    fail_unless (n_value_get_uint (n_context_get_value (context, "restore.route")) == 3);
+
+    /* the real state reconciles the restored one */
+    fail_unless (!n_context_set_uint_if_changed (context, "restore.route", 3));
+    fail_unless (n_context_set_string_if_changed (context, "restore.state", "none"));
+
+    /* without a cache nothing is restored */
+    NContext *plain = n_context_new ();
+    fail_unless (!n_context_restore_value (plain, "restore.state"));
+    n_context_free (plain);
+    n_context_free (context);
+
+    context = n_context_new ();
+    n_context_set_cache_file (context, filename);
+    fail_unless (n_context_restore_value (context, "restore.state"));
+    fail_unless (g_strcmp0 (n_value_get_string (n_context_get_value (context, "restore.state")),
+                            "none") == 0);
+    n_context_free (context);
+
+    g_unlink (filename);
+    g_free (filename);
+    filename = g_build_filename (dir, "cache", NULL);
+    g_rmdir (filename);
+    g_rmdir (dir);
+    g_free (filename);
+    g_free (dir);
+}
+END_TEST
+
 int
 main (int argc, char *argv[])
 {
@@ -118,10 +526,34 @@ main (int argc, char *argv[])
     tcase_add_test (tc, test_set_get_value);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("generation");
+    tcase_add_test (tc, test_generation);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("transaction");
+    tcase_add_test (tc, test_transaction);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("set if changed");
+    tcase_add_test (tc, test_set_if_changed);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("restore value");
+    tcase_add_test (tc, test_restore_value);
+    suite_add_tcase (s, tc);
+
     tc = tcase_create ("test subscribe & unsubscribe value change");
     tcase_add_test (tc, test_subscribe_unsubscribe_value_change);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("subscribe prefix");
+    tcase_add_test (tc, test_subscribe_prefix);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("snapshot");
+    tcase_add_test (tc, test_snapshot);
+    suite_add_tcase (s, tc);
+
     sr = srunner_create (s);
     srunner_run_all (sr, CK_NORMAL);
     num_failed = srunner_ntests_failed (sr);
@@ -1,9 +1,16 @@
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
 
 #include "ngf/core.h"
 #include "src/ngf/core-internal.h"
+#include "src/ngf/core-lazy.h"
+#include "src/ngf/eventdb-internal.h"
+#include "src/ngf/eventrule-internal.h"
 #include "ngf/event.h"
+#include "ngf/haptic.h"
 
 START_TEST (test_create)
 {
@@ -60,6 +67,1706 @@ START_TEST (test_get_requests)
 }
 END_TEST
 
+static int
+lookup_sink_play (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+    (void) request;
+    return TRUE;
+}
+
+static void
+lookup_sink_stop (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+    (void) request;
+}
+
+START_TEST (test_lookup_request)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name = "lookup",
+        .play = lookup_sink_play,
+        .stop = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *first = n_request_new_with_event ("sms");
+    NRequest *second = n_request_new_with_event ("sms");
+    first->input_iface = input;
+    second->input_iface = input;
+
+    fail_unless (n_core_lookup_request (NULL, first->id) == NULL);
+    fail_unless (n_core_lookup_request (core, 0) == NULL);
+    fail_unless (n_core_lookup_request (core, first->id) == NULL);
+
+    n_core_play_request (core, first);
+    n_core_play_request (core, second);
+    fail_unless (g_list_length (n_core_get_requests (core)) == 2);
+    fail_unless (n_core_lookup_request (core, first->id) == first);
+    fail_unless (n_core_lookup_request (core, second->id) == second);
+
+    guint id = first->id;
+    n_core_stop_request (core, first, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (n_core_lookup_request (core, id) == NULL);
+    fail_unless (n_core_lookup_request (core, second->id) == second);
+    fail_unless (g_list_length (n_core_get_requests (core)) == 1);
+
+    id = second->id;
+    n_core_stop_request (core, second, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (n_core_lookup_request (core, id) == NULL);
+    fail_unless (n_core_get_requests (core) == NULL);
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+START_TEST (test_request_timeline)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name = "timeline",
+        .play = lookup_sink_play,
+        .stop = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+
+    gint64 received = n_request_get_timestamp (request, N_REQUEST_STAGE_RECEIVED);
+    fail_unless (received > 0);
+    fail_unless (n_request_get_timestamp (request, N_REQUEST_STAGE_PLAYING) == 0);
+    fail_unless (n_request_get_timestamp (NULL, N_REQUEST_STAGE_RECEIVED) == 0);
+    fail_unless (n_request_get_timestamp (request, N_REQUEST_STAGE_LAST) == 0);
+
+    n_core_play_request (core, request);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    gint64 resolved = n_request_get_timestamp (request, N_REQUEST_STAGE_RESOLVED);
+    gint64 hooks = n_request_get_timestamp (request, N_REQUEST_STAGE_HOOKS_DONE);
+    gint64 synchronized = n_request_get_timestamp (request, N_REQUEST_STAGE_SYNCHRONIZED);
+    gint64 playing = n_request_get_timestamp (request, N_REQUEST_STAGE_PLAYING);
+    fail_unless (resolved >= received);
+    fail_unless (hooks >= resolved);
+    fail_unless (synchronized >= hooks);
+    fail_unless (playing >= synchronized);
+    fail_unless (n_request_get_timestamp (request, N_REQUEST_STAGE_MASTER_PLAY) > 0);
+    fail_unless (n_request_get_timestamp (request, N_REQUEST_STAGE_STOP) == 0);
+
+    n_sink_interface_mark (core->sinks[0], request, "preroll", received + 5);
+    n_sink_interface_mark (NULL, request, "ignored", received);
+
+    gchar *timeline = n_request_timeline_to_string (request);
+    fail_unless (strstr (timeline, "status=active") != NULL);
+    fail_unless (strstr (timeline, "received=+0") != NULL);
+    fail_unless (strstr (timeline, "stop=-") != NULL);
+    fail_unless (strstr (timeline, "sink.timeline=") != NULL);
+    fail_unless (strstr (timeline, ",preroll:+5") != NULL);
+    fail_unless (strstr (timeline, "ignored") == NULL);
+    g_free (timeline);
+
+    core->timeline_history = 4;
+    n_core_stop_request (core, request, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    fail_unless (g_queue_get_length (core->timelines) == 1);
+    timeline = g_queue_peek_head (core->timelines);
+    fail_unless (strstr (timeline, "status=stopped") != NULL);
+    fail_unless (strstr (timeline, "done=+") != NULL);
+    fail_unless (strstr (timeline, "play:+") != NULL);
+
+    /* without the history the finished timelines are not kept */
+    core->timeline_history = 0;
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    n_core_play_request (core, request);
+    n_core_stop_request (core, request, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (g_queue_get_length (core->timelines) == 0);
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+static int
+sync_start_sink_play (NSinkInterface *iface, NRequest *request)
+{
+    gint64 start = n_request_get_start_time (request);
+
+    fail_unless (start > g_get_monotonic_time ());
+    n_sink_interface_started (iface, request, start + 3);
+    n_sink_interface_started (iface, request, start + 100);
+    return TRUE;
+}
+
+START_TEST (test_sync_start)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name = "syncstart",
+        .play = sync_start_sink_play,
+        .stop = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+    g_hash_table_replace (core->key_types, g_strdup ("core.sync_start"),
+                          GINT_TO_POINTER (N_VALUE_TYPE_INT));
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "ring", "core.sync_start", "50");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *request = n_request_new_with_event ("ring");
+    request->input_iface = input;
+
+    fail_unless (n_request_get_start_time (request) == 0);
+    fail_unless (n_request_get_start_time (NULL) == 0);
+
+    n_core_play_request (core, request);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    gint64 start = n_request_get_start_time (request);
+    fail_unless (start >= n_request_get_timestamp (request, N_REQUEST_STAGE_SYNCHRONIZED) + 50000);
+    fail_unless (n_request_get_start_skew (request) == 3);
+
+    gchar *timeline = n_request_timeline_to_string (request);
+    fail_unless (strstr (timeline, " start=+") != NULL);
+    fail_unless (strstr (timeline, " skew=3") != NULL);
+    fail_unless (strstr (timeline, ",started:+") != NULL);
+    g_free (timeline);
+
+    core->timeline_history = 1;
+    n_core_stop_request (core, request, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    fail_unless (g_queue_get_length (core->timelines) == 1);
+    fail_unless (strstr (g_queue_peek_head (core->timelines), " skew=3") != NULL);
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+static int plan_can_handle_calls = 0;
+
+static int
+plan_sink_can_handle (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+    plan_can_handle_calls++;
+    return n_proplist_has_key (n_request_get_properties (request), "plan.sound");
+}
+
+static void
+plan_filter_cb (NHook *hook, void *data, void *userdata)
+{
+    (void) hook;
+    (void) data;
+    (void) userdata;
+}
+
+static void
+plan_play_and_stop (NCore *core, NRequest *request, gboolean playing)
+{
+    guint id = request->id;
+
+    n_core_play_request (core, request);
+    fail_unless ((n_core_lookup_request (core, id) != NULL) == playing);
+    if (playing)
+        n_core_stop_request (core, request, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (n_core_lookup_request (core, id) == NULL);
+}
+
+START_TEST (test_sink_plan)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name       = "plan",
+        .can_handle = plan_sink_can_handle,
+        .play       = lookup_sink_play,
+        .stop       = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "plan.sound", "beep");
+    g_key_file_set_value (keyfile, "silent", "variant", "default");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *request = NULL;
+    guint hits = 0, misses = 0;
+
+    /* without declared keys can_handle is called for every request */
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    fail_unless (plan_can_handle_calls == 2);
+    n_core_get_sink_plan_stats (core, &hits, &misses);
+    fail_unless (hits == 0 && misses == 0);
+
+    n_sink_interface_add_plan_key (core->sinks[0], "plan.sound", FALSE);
+    n_sink_interface_add_plan_key (core->sinks[0], "context@plan.mode", TRUE);
+
+    /* first request resolves the plan, second one uses it */
+    plan_can_handle_calls = 0;
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    fail_unless (plan_can_handle_calls == 1);
+    n_core_get_sink_plan_stats (core, &hits, &misses);
+    fail_unless (hits == 1 && misses == 1);
+
+    /* plans are per event, also when no sink can handle it */
+    request = n_request_new_with_event ("silent");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, FALSE);
+    request = n_request_new_with_event ("silent");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, FALSE);
+    fail_unless (plan_can_handle_calls == 2);
+
+    /* changing a declared context value resolves the sinks again */
+    NValue *value = n_value_new ();
+    n_value_set_string (value, "loud");
+    n_context_set_value (core->context, "plan.mode", value);
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    fail_unless (plan_can_handle_calls == 3);
+    n_core_get_sink_plan_stats (core, &hits, &misses);
+    fail_unless (hits == 3 && misses == 3);
+
+    /* filter hook without declared keys disables the cache */
+    n_core_connect (core, N_CORE_HOOK_FILTER_SINKS, 0, plan_filter_cb, NULL);
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    fail_unless (plan_can_handle_calls == 4);
+    n_core_add_sink_plan_key (core, plan_filter_cb, NULL, NULL, FALSE);
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    fail_unless (plan_can_handle_calls == 5);
+
+    /* the keys are declared per callback, another one without them
+       disables the cache again */
+    n_core_connect (core, N_CORE_HOOK_FILTER_SINKS, 0, plan_filter_cb, core);
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    fail_unless (plan_can_handle_calls == 7);
+    n_core_add_sink_plan_key (core, plan_filter_cb, core, "plan.sound", FALSE);
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+    fail_unless (plan_can_handle_calls == 8);
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+static void
+haptic_set_context (NCore *core, int vibra_level, gboolean alert_enabled,
+                    const char *call_state)
+{
+    NValue *value = NULL;
+
+    value = n_value_new ();
+    n_value_set_int (value, vibra_level);
+    n_context_set_value (core->context, "profile.current.touchscreen.vibration.level", value);
+
+    value = n_value_new ();
+    n_value_set_bool (value, alert_enabled);
+    n_context_set_value (core->context, "profile.current.vibrating.alert.enabled", value);
+
+    value = n_value_new ();
+    n_value_set_string (value, call_state);
+    n_context_set_value (core->context, "call_state.mode", value);
+}
+
+static gboolean
+haptic_plays (NCore *core, NInputInterface *input, const char *event,
+              const char *haptic_type)
+{
+    NProplist *props   = n_proplist_new ();
+    NRequest  *request = NULL;
+    guint      id;
+    gboolean   playing;
+
+    if (haptic_type)
+        n_proplist_set_string (props, N_HAPTIC_TYPE_KEY, haptic_type);
+    request = n_request_new_with_event_and_properties (event, props);
+    n_proplist_free (props);
+    request->input_iface = input;
+    id = request->id;
+
+    n_core_play_request (core, request);
+    playing = n_core_lookup_request (core, id) != NULL;
+    if (playing)
+        n_core_stop_request (core, request, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    return playing;
+}
+
+START_TEST (test_haptic_policy)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name       = "haptic",
+        .can_handle = n_haptic_can_handle,
+        .play       = lookup_sink_play,
+        .stop       = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "touch", N_HAPTIC_TYPE_KEY, N_HAPTIC_TYPE_TOUCH);
+    g_key_file_set_value (keyfile, "alert", N_HAPTIC_TYPE_KEY, N_HAPTIC_TYPE_EVENT);
+    g_key_file_set_value (keyfile, "unknown", N_HAPTIC_TYPE_KEY, "buzz");
+    g_key_file_set_value (keyfile, "plain", "plan.sound", "beep");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+
+    haptic_set_context (core, 0, TRUE, "none");
+    fail_unless (!haptic_plays (core, input, "touch", NULL));
+    fail_unless (haptic_plays (core, input, "alert", NULL));
+    fail_unless (!haptic_plays (core, input, "unknown", NULL));
+    fail_unless (!haptic_plays (core, input, "plain", NULL));
+
+    /* the policy follows the context values */
+    haptic_set_context (core, 3, TRUE, "none");
+    fail_unless (haptic_plays (core, input, "touch", NULL));
+    haptic_set_context (core, 3, TRUE, "active");
+    fail_unless (!haptic_plays (core, input, "touch", NULL));
+    fail_unless (!haptic_plays (core, input, "alert", NULL));
+    haptic_set_context (core, 3, FALSE, "none");
+    fail_unless (haptic_plays (core, input, "touch", NULL));
+    fail_unless (!haptic_plays (core, input, "alert", NULL));
+
+    /* a haptic type of the request overrides the one of the event */
+    fail_unless (haptic_plays (core, input, "plain", N_HAPTIC_TYPE_TOUCH));
+    fail_unless (!haptic_plays (core, input, "touch", N_HAPTIC_TYPE_EVENT));
+
+    /* the class follows a type merged in from another file */
+    haptic_set_context (core, 0, TRUE, "none");
+    keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "plain", N_HAPTIC_TYPE_KEY, N_HAPTIC_TYPE_EVENT);
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+    fail_unless (haptic_plays (core, input, "plain", NULL));
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+static NSinkInterface *async_sink = NULL;
+static int async_init_done = 0;
+
+static int
+async_sink_initialize (NSinkInterface *iface)
+{
+    async_sink = iface;
+    return N_SINK_INTERFACE_INIT_PENDING;
+}
+
+static gboolean
+async_sink_ready_cb (gpointer userdata)
+{
+    n_sink_interface_initialized ((NSinkInterface*) userdata, TRUE);
+    return FALSE;
+}
+
+static void
+async_init_done_cb (NHook *hook, void *data, void *userdata)
+{
+    (void) hook;
+    (void) data;
+    (void) userdata;
+    async_init_done++;
+}
+
+START_TEST (test_async_sink_init)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name       = "async",
+        .initialize = async_sink_initialize,
+        .play       = lookup_sink_play,
+        .stop       = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+    n_core_connect (core, N_CORE_HOOK_INIT_DONE, 0, async_init_done_cb, NULL);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *request = NULL;
+
+    /* by default the core waits for the pending sink */
+    g_idle_add (async_sink_ready_cb, core->sinks[0]);
+    fail_unless (n_core_initialize_sinks (core) == TRUE);
+    fail_unless (async_sink == core->sinks[0]);
+    fail_unless (core->sinks[0]->init_state == N_SINK_INIT_READY);
+    fail_unless (core->pending_init == 0);
+    n_core_finish_initialize (core);
+    fail_unless (async_init_done == 1);
+
+    /* in async mode init done waits for the sink, which is not used
+       before it is ready */
+    core->async_init = TRUE;
+    async_init_done = 0;
+    fail_unless (n_core_initialize_sinks (core) == TRUE);
+    fail_unless (core->sinks[0]->init_state == N_SINK_INIT_PENDING);
+    fail_unless (core->pending_init == 1);
+    n_core_finish_initialize (core);
+    fail_unless (async_init_done == 0);
+
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, FALSE);
+
+    g_idle_add (async_sink_ready_cb, core->sinks[0]);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (core->sinks[0]->init_state == N_SINK_INIT_READY);
+    fail_unless (core->pending_init == 0);
+    fail_unless (async_init_done == 1);
+
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, TRUE);
+
+    /* a second report is ignored */
+    n_sink_interface_initialized (core->sinks[0], FALSE);
+    fail_unless (core->sinks[0]->init_state == N_SINK_INIT_READY);
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+static guint early_plays[2];
+
+static int
+early_sink_play (NSinkInterface *iface, NRequest *request)
+{
+    (void) request;
+    early_plays[iface->index]++;
+    return TRUE;
+}
+
+START_TEST (test_early_start)
+{
+    static const NSinkInterfaceDecl decl_a = {
+        .name       = "early-a",
+        .initialize = async_sink_initialize,
+        .play       = early_sink_play,
+        .stop       = lookup_sink_stop
+    };
+    static const NSinkInterfaceDecl decl_b = {
+        .name       = "early-b",
+        .play       = early_sink_play,
+        .stop       = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl_a);
+    n_core_register_sink (core, &decl_b);
+    core->sinks[0]->startup_keys = g_strsplit ("early.sound", ";", -1);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    g_key_file_set_value (keyfile, "ringtone", "early.sound", "beep");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *sms = NULL;
+    NRequest *ringtone = NULL;
+
+    core->early_start = TRUE;
+    core->async_init  = TRUE;
+    fail_unless (n_core_initialize_sinks (core) == TRUE);
+    fail_unless (core->sinks[0]->init_state == N_SINK_INIT_PENDING);
+    fail_unless (core->sinks[1]->init_state == N_SINK_INIT_READY);
+
+    /* a request without the startup keys of the pending sink plays on
+       the ready sink at once */
+    sms = n_request_new_with_event ("sms");
+    sms->input_iface = input;
+    n_core_play_request (core, sms);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (!sms->startup_queued);
+    fail_unless (early_plays[0] == 0);
+    fail_unless (early_plays[1] == 1);
+
+    /* a request with the keys waits for the pending sink */
+    ringtone = n_request_new_with_event ("ringtone");
+    ringtone->input_iface = input;
+    n_core_play_request (core, ringtone);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (ringtone->startup_queued);
+    fail_unless (core->startup_queue != NULL);
+    fail_unless (early_plays[1] == 1);
+
+    /* paused while waiting, it stays queued when the sink is ready */
+    n_core_pause_request (core, ringtone);
+    n_sink_interface_initialized (core->sinks[0], TRUE);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (ringtone->startup_queued);
+    fail_unless (early_plays[0] == 0);
+    fail_unless (early_plays[1] == 1);
+
+    /* and starts once resumed */
+    n_core_resume_request (core, ringtone);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (!ringtone->is_paused);
+    fail_unless (!ringtone->startup_queued);
+    fail_unless (core->startup_queue == NULL);
+    fail_unless (early_plays[0] == 1);
+    fail_unless (early_plays[1] == 2);
+
+    n_core_stop_request (core, sms, 0);
+    n_core_stop_request (core, ringtone, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+START_TEST (test_lazy_plugin)
+{
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+
+    NProplist *params = n_proplist_new ();
+    n_proplist_set_string (params, "lazy.keys", "lazy.sound");
+    fail_unless (n_core_lazy_add_plugin (core, "nosuchplugin", params) == FALSE);
+    fail_unless (core->num_sinks == 0);
+
+    n_proplist_set_string (params, "lazy", "true");
+    n_proplist_set_string (params, "lazy.sink", "lazysink");
+    fail_unless (n_core_lazy_add_plugin (core, "nosuchplugin", params) == TRUE);
+    fail_unless (core->num_sinks == 1);
+    fail_unless (g_str_equal (core->sinks[0]->name, "lazysink"));
+    fail_unless (core->sinks[0]->plan_declared);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    g_key_file_set_value (keyfile, "ringtone", "lazy.sound", "beep");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *request = NULL;
+
+    /* the plugin is not needed without the declared keys */
+    request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, FALSE);
+    fail_unless (core->sinks[0]->funcs.play != NULL);
+
+    /* loading fails, the sink stays disabled */
+    request = n_request_new_with_event ("ringtone");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, FALSE);
+    request = n_request_new_with_event ("ringtone");
+    request->input_iface = input;
+    plan_play_and_stop (core, request, FALSE);
+
+    n_core_shutdown (core);
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+START_TEST (test_request_keys)
+{
+    static const char *keys[] = { "test.kept", "test.also_kept", NULL };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+
+    /* all keys are kept by default */
+    fail_unless (n_core_intern_request_key (core, NULL) == 0);
+    fail_unless (n_core_intern_request_key (core, "test.new_key") ==
+                 n_atom_lookup ("test.new_key"));
+
+    n_core_set_request_keys (core, keys);
+    fail_unless (n_core_intern_request_key (core, "test.kept") == n_atom_intern ("test.kept"));
+    fail_unless (n_core_intern_request_key (core, "test.also_kept") != 0);
+    fail_unless (n_core_intern_request_key (core, "test.new_key") == 0);
+    fail_unless (n_core_intern_request_key (core, "test.never_seen") == 0);
+    fail_unless (n_atom_lookup ("test.never_seen") == 0);
+
+    n_core_set_request_keys (core, NULL);
+    fail_unless (n_core_intern_request_key (core, "test.never_seen") != 0);
+    fail_unless (n_core_intern_request_key (core, "test.also_kept") != 0);
+
+    n_core_free (core);
+}
+END_TEST
+
+static gchar *stream_sink_value = NULL;
+
+static int
+stream_sink_play (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+
+    g_free (stream_sink_value);
+    stream_sink_value = g_strdup (n_proplist_get_string (
+        n_request_get_properties (request), "sound.stream.test.x"));
+    return TRUE;
+}
+
+START_TEST (test_request_key_limit)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name = "stream",
+        .play = stream_sink_play,
+        .stop = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    /* an undeclared stream property reaches the sink */
+    NAtom atom = n_core_intern_request_key (core, "sound.stream.test.x");
+    fail_unless (atom != 0);
+    NProplist *props = n_proplist_new ();
+    NValue *value = n_value_new ();
+    n_value_set_string (value, "forwarded");
+    n_proplist_set_by_atom (props, atom, value);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *request = n_request_new_with_event_and_properties ("sms", props);
+    request->input_iface = input;
+    n_proplist_free (props);
+    n_core_play_request (core, request);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (g_strcmp0 (stream_sink_value, "forwarded") == 0);
+    n_core_stop_request (core, request, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    /* only so many undeclared keys are interned */
+    gchar key[64];
+    guint i;
+    for (i = 0; i < 256; i++) {
+        g_snprintf (key, sizeof (key), "test.flood.%u", i);
+        fail_unless (n_core_intern_request_key (core, key) != 0);
+    }
+    fail_unless (n_core_intern_request_key (core, "test.flood.last") == 0);
+    fail_unless (n_atom_lookup ("test.flood.last") == 0);
+
+    /* without using up the budget of the stream properties */
+    fail_unless (n_core_intern_request_key (core, "sound.stream.test.y") != 0);
+    fail_unless (n_core_intern_request_key (core, "test.flood.0") != 0);
+
+    g_free (stream_sink_value);
+    stream_sink_value = NULL;
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+static void
+coalesced_metric_cb (const char *name, guint64 value, void *userdata)
+{
+    if (g_str_equal (name, "requests.coalesced"))
+        *(guint64*) userdata = value;
+}
+
+static guint64
+coalesced_count (NCore *core)
+{
+    guint64 value = 0;
+
+    n_metrics_foreach (n_core_get_metrics (core), coalesced_metric_cb, &value);
+    return value;
+}
+
+START_TEST (test_coalesce_request)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name = "coalesce",
+        .play = lookup_sink_play,
+        .stop = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+    g_hash_table_replace (core->key_types, g_strdup ("core.coalesce_window"),
+                          GINT_TO_POINTER (N_VALUE_TYPE_INT));
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "tacticon", "core.coalesce_window", "10000");
+    g_key_file_set_value (keyfile, "restart", "core.coalesce_window", "10000");
+    g_key_file_set_value (keyfile, "restart", "core.coalesce", "restart");
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NInputInterface *other_input = g_new0 (NInputInterface, 1);
+    NRequest *first = n_request_new_with_event ("tacticon");
+    NRequest *second = n_request_new_with_event ("tacticon");
+    NRequest *other = n_request_new_with_event ("tacticon");
+    NRequest *sms = n_request_new_with_event ("sms");
+    NRequest *sms_again = n_request_new_with_event ("sms");
+    first->input_iface = input;
+    second->input_iface = input;
+    other->input_iface = other_input;
+    sms->input_iface = input;
+    sms_again->input_iface = input;
+
+    /* the second request is merged, other input and event play */
+    n_core_play_request (core, first);
+    n_core_play_request (core, second);
+    n_core_play_request (core, other);
+    n_core_play_request (core, sms);
+    n_core_play_request (core, sms_again);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (g_list_length (n_core_get_requests (core)) == 4);
+    fail_unless (n_core_lookup_request (core, first->id) == first);
+    fail_unless (coalesced_count (core) == 1);
+
+    /* different properties are not coalesced */
+    NProplist *props = n_proplist_new ();
+    n_proplist_set_bool (props, "test.loud", TRUE);
+    NRequest *louder = n_request_new_with_event_and_properties ("tacticon", props);
+    n_proplist_free (props);
+    louder->input_iface = input;
+    n_core_play_request (core, louder);
+    fail_unless (g_list_length (n_core_get_requests (core)) == 5);
+    fail_unless (coalesced_count (core) == 1);
+
+    /* restart stops the request playing */
+    NRequest *restart = n_request_new_with_event ("restart");
+    guint restart_id = restart->id;
+    restart->input_iface = input;
+    n_core_play_request (core, restart);
+    NRequest *replace = n_request_new_with_event ("restart");
+    replace->input_iface = input;
+    n_core_play_request (core, replace);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (n_core_lookup_request (core, restart_id) == NULL);
+    fail_unless (n_core_lookup_request (core, replace->id) == replace);
+    fail_unless (coalesced_count (core) == 2);
+
+    GList *iter = NULL;
+    for (iter = n_core_get_requests (core); iter; iter = g_list_next (iter))
+        n_core_stop_request (core, (NRequest*) iter->data, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (n_core_get_requests (core) == NULL);
+
+    n_core_free (core);
+    g_free (input);
+    g_free (other_input);
+}
+END_TEST
+
+static gboolean
+request_active (NCore *core, NRequest *request)
+{
+    return g_list_find (n_core_get_requests (core), request) != NULL;
+}
+
+START_TEST (test_priority_schedule)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name = "schedule",
+        .play = lookup_sink_play,
+        .stop = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+    g_hash_table_replace (core->key_types, g_strdup ("core.priority"),
+                          GINT_TO_POINTER (N_VALUE_TYPE_INT));
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "ringtone", "core.priority", "100");
+    g_key_file_set_value (keyfile, "ringtone", "core.slots", "audio,vibra");
+    g_key_file_set_value (keyfile, "sms", "core.priority", "10");
+    g_key_file_set_value (keyfile, "sms", "core.slots", "audio");
+    g_key_file_set_value (keyfile, "sms", "core.preempt", "pause");
+    g_key_file_set_value (keyfile, "email", "core.priority", "10");
+    g_key_file_set_value (keyfile, "email", "core.slots", "audio");
+    g_key_file_set_value (keyfile, "email", "core.preempt", "stop");
+    g_key_file_set_value (keyfile, "led", "core.priority", "0");
+    g_key_file_set_value (keyfile, "led", "core.slots", "leds");
+    g_key_file_set_value (keyfile, "led", "core.preempt", "stop");
+    g_key_file_set_value (keyfile, "clock", "variant", "default");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *sms = n_request_new_with_event ("sms");
+    NRequest *ringtone = n_request_new_with_event ("ringtone");
+    NRequest *email = n_request_new_with_event ("email");
+    NRequest *sms_again = n_request_new_with_event ("sms");
+    NRequest *led = n_request_new_with_event ("led");
+    NRequest *clock = n_request_new_with_event ("clock");
+    guint email_id = email->id;
+    sms->input_iface = input;
+    ringtone->input_iface = input;
+    email->input_iface = input;
+    sms_again->input_iface = input;
+    led->input_iface = input;
+    clock->input_iface = input;
+
+    /* the ringtone pauses the sms using the audio */
+    n_core_play_request (core, sms);
+    n_core_play_request (core, ringtone);
+    fail_unless (request_active (core, sms) && sms->is_paused);
+    fail_unless (request_active (core, ringtone));
+
+    /* lower priorities give way, other slots and unprioritized events play */
+    n_core_play_request (core, email);
+    n_core_play_request (core, sms_again);
+    n_core_play_request (core, led);
+    n_core_play_request (core, clock);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (n_core_lookup_request (core, email_id) == NULL);
+    fail_unless (!request_active (core, sms_again));
+    fail_unless (request_active (core, led));
+    fail_unless (request_active (core, clock));
+
+    /* the sms resumes when the ringtone is done, the queued one waits
+       for the sms of the same priority */
+    n_core_stop_request (core, ringtone, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (request_active (core, sms) && !sms->is_paused);
+    fail_unless (!request_active (core, sms_again));
+
+    n_core_stop_request (core, sms, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (request_active (core, sms_again));
+
+    GList *iter = NULL;
+    for (iter = n_core_get_requests (core); iter; iter = g_list_next (iter))
+        n_core_stop_request (core, (NRequest*) iter->data, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (n_core_get_requests (core) == NULL);
+    fail_unless (core->scheduled == NULL);
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+START_TEST (test_critical_dispatch)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name = "critical",
+        .play = lookup_sink_play,
+        .stop = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+    g_hash_table_replace (core->key_types, g_strdup ("core.critical"),
+                          GINT_TO_POINTER (N_VALUE_TYPE_BOOL));
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "alarm", "core.critical", "true");
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *sms = n_request_new_with_event ("sms");
+    NRequest *alarm = n_request_new_with_event ("alarm");
+    sms->input_iface = input;
+    alarm->input_iface = input;
+
+    n_core_play_request (core, sms);
+    n_core_play_request (core, alarm);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (n_request_get_source_priority (alarm, G_PRIORITY_DEFAULT_IDLE) == G_PRIORITY_HIGH);
+    fail_unless (n_request_get_source_priority (sms, G_PRIORITY_DEFAULT_IDLE) == G_PRIORITY_DEFAULT_IDLE);
+
+    /* the critical request is done first even though it was stopped last */
+    n_core_stop_request (core, sms, 0);
+    n_core_stop_request (core, alarm, 0);
+    g_main_context_iteration (NULL, FALSE);
+    fail_unless (!request_active (core, alarm));
+    fail_unless (request_active (core, sms));
+
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (n_core_get_requests (core) == NULL);
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+static GMutex   prepare_lock;
+static GCond    prepare_cond;
+static guint    prepare_started  = 0;
+static gboolean prepare_parallel = FALSE;
+static guint    prepare_played   = 0;
+
+static int
+prepare_sink_prepare (NSinkInterface *iface, NRequest *request)
+{
+    n_request_store_data (request, n_sink_interface_get_name (iface), request);
+    return TRUE;
+}
+
+static int
+prepare_sink_prepare_work (NSinkInterface *iface, NRequest *request)
+{
+    gint64 deadline = g_get_monotonic_time () + G_TIME_SPAN_SECOND;
+
+    fail_unless (n_request_get_data (request, n_sink_interface_get_name (iface)) == request);
+
+    /* both sinks are preparing at the same time or this times out */
+    g_mutex_lock (&prepare_lock);
+    prepare_started++;
+    g_cond_broadcast (&prepare_cond);
+    while (prepare_started < 2 && g_cond_wait_until (&prepare_cond, &prepare_lock, deadline))
+        ;
+    prepare_parallel = prepare_started >= 2;
+    g_mutex_unlock (&prepare_lock);
+
+    return !n_proplist_has_key (n_request_get_properties (request), "prepare.fail");
+}
+
+static int
+prepare_sink_play (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+    (void) request;
+    prepare_played++;
+    return TRUE;
+}
+
+START_TEST (test_threaded_prepare)
+{
+    static const NSinkInterfaceDecl decl_a = {
+        .name         = "prepare-a",
+        .prepare      = prepare_sink_prepare,
+        .play         = prepare_sink_play,
+        .stop         = lookup_sink_stop,
+        .prepare_work = prepare_sink_prepare_work
+    };
+    static const NSinkInterfaceDecl decl_b = {
+        .name         = "prepare-b",
+        .prepare      = prepare_sink_prepare,
+        .play         = prepare_sink_play,
+        .stop         = lookup_sink_stop,
+        .prepare_work = prepare_sink_prepare_work
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl_a);
+    n_core_register_sink (core, &decl_b);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+
+    n_core_play_request (core, request);
+    fail_unless (request->sinks_preparing != 0);
+    while (prepare_played < 2)
+        g_main_context_iteration (NULL, TRUE);
+    fail_unless (prepare_parallel);
+    fail_unless (request->prepare_jobs == NULL);
+    fail_unless (n_request_get_timestamp (request, N_REQUEST_STAGE_SYNCHRONIZED) > 0);
+
+    n_core_stop_request (core, request, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    /* failed work fails the request */
+    NProplist *props = n_proplist_new ();
+    n_proplist_set_bool (props, "prepare.fail", TRUE);
+    request = n_request_new_with_event_and_properties ("sms", props);
+    request->input_iface = input;
+    guint id = request->id;
+    n_proplist_free (props);
+
+    prepare_started = 0;
+    n_core_play_request (core, request);
+    while (n_core_lookup_request (core, id) != NULL)
+        g_main_context_iteration (NULL, TRUE);
+    fail_unless (prepare_played == 2);
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+static guint resume_plays   = 0;
+static guint resume_resumes = 0;
+
+static int
+resume_sink_play (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+    (void) request;
+    resume_plays++;
+    return TRUE;
+}
+
+static int
+resume_sink_resume (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+    (void) request;
+    resume_resumes++;
+    return TRUE;
+}
+
+START_TEST (test_resume_request)
+{
+    static const NSinkInterfaceDecl decl_a = {
+        .name   = "resume-a",
+        .play   = resume_sink_play,
+        .stop   = lookup_sink_stop,
+        .resume = resume_sink_resume
+    };
+    static const NSinkInterfaceDecl decl_b = {
+        .name   = "resume-b",
+        .play   = resume_sink_play,
+        .stop   = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl_a);
+    n_core_register_sink (core, &decl_b);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "alarm", "variant", "default");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *request = n_request_new_with_event ("alarm");
+    request->input_iface = input;
+
+    n_core_play_request (core, request);
+    while (resume_plays < 2)
+        g_main_context_iteration (NULL, TRUE);
+
+    /* sinks with resume continue, the others are played again */
+    n_core_pause_request (core, request);
+    fail_unless (n_request_is_paused (request));
+    n_core_resume_request (core, request);
+    fail_unless (!n_request_is_paused (request));
+    fail_unless (resume_resumes == 1);
+    fail_unless (resume_plays == 3);
+
+    /* resuming a request that is not paused does nothing */
+    n_core_resume_request (core, request);
+    fail_unless (resume_resumes == 1);
+
+    gchar *timeline = n_request_timeline_to_string (request);
+    fail_unless (strstr (timeline, " resumes=1 ") != NULL);
+    g_free (timeline);
+
+    n_core_stop_request (core, request, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+static gchar *fallback_sound   = NULL;
+static gchar *fallback_pattern = NULL;
+
+static int
+fallback_sink_play (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+
+    const NProplist *props = n_request_get_properties (request);
+
+    if (!n_request_is_fallback (request))
+        return FALSE;
+
+    fallback_sound   = g_strdup (n_proplist_get_string (props, "sound.filename"));
+    fallback_pattern = g_strdup (n_proplist_get_string (props, "haptic.pattern"));
+    return TRUE;
+}
+
+START_TEST (test_fallback_request)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name    = "fallback",
+        .play    = fallback_sink_play,
+        .stop    = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "ringtone", "sound.filename", "custom.ogg");
+    g_key_file_set_value (keyfile, "ringtone", "sound.filename.fallback", "default.ogg");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NEvent *event = n_event_list_get_events (core->eventlist)->data;
+    fail_unless (event->num_fallbacks == 1);
+
+    /* fallback keys of both the event and the request are translated */
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NProplist *props = n_proplist_new ();
+    n_proplist_set_string (props, "haptic.pattern", "custom");
+    n_proplist_set_string (props, "haptic.pattern.fallback", "buzz");
+    NRequest *request = n_request_new_with_event_and_properties ("ringtone", props);
+    request->input_iface = input;
+    n_proplist_free (props);
+
+    n_core_play_request (core, request);
+    while (fallback_sound == NULL)
+        g_main_context_iteration (NULL, TRUE);
+    fail_unless (g_strcmp0 (fallback_sound, "default.ogg") == 0);
+    fail_unless (g_strcmp0 (fallback_pattern, "buzz") == 0);
+
+    /* the event itself is left as it was */
+    fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "sound.filename"),
+                            "custom.ogg") == 0);
+
+    n_core_free (core);
+    g_free (input);
+    g_free (fallback_sound);
+    g_free (fallback_pattern);
+    fallback_sound   = NULL;
+    fallback_pattern = NULL;
+}
+END_TEST
+
+static guint watchdog_stops = 0;
+
+static int
+watchdog_sink_prepare (NSinkInterface *iface, NRequest *request)
+{
+    /* synchronizes only when asked to stall later */
+    if (n_proplist_has_key (n_request_get_properties (request), "stall.play"))
+        n_sink_interface_synchronize (iface, request);
+    return TRUE;
+}
+
+static void
+watchdog_sink_stop (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+    (void) request;
+    watchdog_stops++;
+}
+
+static void
+watchdog_metric_cb (const char *name, guint64 value, void *userdata)
+{
+    GHashTable *values = userdata;
+
+    g_hash_table_replace (values, g_strdup (name), GUINT_TO_POINTER ((guint) value));
+}
+
+static guint
+watchdog_metric (NCore *core, const char *name)
+{
+    GHashTable *values = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    guint       value  = 0;
+
+    n_metrics_foreach (core->metrics, watchdog_metric_cb, values);
+    value = GPOINTER_TO_UINT (g_hash_table_lookup (values, name));
+    g_hash_table_destroy (values);
+
+    return value;
+}
+
+START_TEST (test_request_watchdog)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name    = "stall",
+        .prepare = watchdog_sink_prepare,
+        .play    = lookup_sink_play,
+        .stop    = watchdog_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+    core->watchdog_synchronize = 20;
+
+    g_hash_table_replace (core->key_types, g_strdup ("core.watchdog_play"),
+                          GINT_TO_POINTER (N_VALUE_TYPE_INT));
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    g_key_file_set_value (keyfile, "tacticon", "core.watchdog_play", "20");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    /* a sink that never synchronizes is failed and stopped */
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    guint id = request->id;
+
+    n_core_play_request (core, request);
+    while (n_core_lookup_request (core, id) != NULL)
+        g_main_context_iteration (NULL, TRUE);
+    fail_unless (watchdog_stops == 1);
+    fail_unless (watchdog_metric (core, "watchdog.stalled.stall.synchronize") == 1);
+
+    /* without a play deadline a playing sink is left alone */
+    NProplist *props = n_proplist_new ();
+    n_proplist_set_bool (props, "stall.play", TRUE);
+    request = n_request_new_with_event_and_properties ("sms", props);
+    request->input_iface = input;
+    id = request->id;
+
+    n_core_play_request (core, request);
+    while (request->sinks_playing == 0 || request->watchdog_id > 0)
+        g_main_context_iteration (NULL, TRUE);
+    fail_unless (n_core_lookup_request (core, id) == request);
+    fail_unless (watchdog_stops == 1);
+    n_core_stop_request (core, request, 0);
+    while (n_core_lookup_request (core, id) != NULL)
+        g_main_context_iteration (NULL, TRUE);
+    fail_unless (watchdog_stops == 2);
+
+    /* the event sets a play deadline */
+    request = n_request_new_with_event_and_properties ("tacticon", props);
+    request->input_iface = input;
+    id = request->id;
+
+    n_core_play_request (core, request);
+    while (n_core_lookup_request (core, id) != NULL)
+        g_main_context_iteration (NULL, TRUE);
+    fail_unless (watchdog_stops == 3);
+    fail_unless (watchdog_metric (core, "watchdog.stalled.stall.play") == 1);
+    fail_unless (watchdog_metric (core, "watchdog.stalled.stall.synchronize") == 1);
+
+    /* the time paused does not count, the deadline starts over on resume */
+    request = n_request_new_with_event_and_properties ("tacticon", props);
+    request->input_iface = input;
+    id = request->id;
+    n_proplist_free (props);
+
+    n_core_play_request (core, request);
+    while (request->sinks_playing == 0)
+        g_main_context_iteration (NULL, TRUE);
+    n_core_pause_request (core, request);
+    fail_unless (request->watchdog_id == 0);
+    gint64 paused = g_get_monotonic_time ();
+    while (g_get_monotonic_time () - paused < 50000)
+        g_main_context_iteration (NULL, FALSE);
+    fail_unless (n_core_lookup_request (core, id) == request);
+
+    n_core_resume_request (core, request);
+    fail_unless (request->watchdog_id > 0);
+    while (n_core_lookup_request (core, id) != NULL)
+        g_main_context_iteration (NULL, TRUE);
+    fail_unless (watchdog_stops == 4);
+    fail_unless (watchdog_metric (core, "watchdog.stalled.stall.play") == 2);
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
+static guint invalid_file_plays = 0;
+
+static int
+invalid_file_sink_play (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+
+    const NProplist *props = n_request_get_properties (request);
+
+    if (!n_request_is_fallback (request)) {
+        invalid_file_plays++;
+        return FALSE;
+    }
+
+    fallback_sound = g_strdup (n_proplist_get_string (props, "sound.filename"));
+    return TRUE;
+}
+
+static void
+invalid_file_metric_cb (const char *name, guint64 value, void *userdata)
+{
+    if (g_str_equal (name, "requests.invalid_file"))
+        *((guint64*) userdata) = value;
+}
+
+START_TEST (test_invalid_file_fallback)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name    = "invalid",
+        .play    = invalid_file_sink_play,
+        .stop    = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+
+    /* unchecked until keys are configured */
+    fail_unless (n_core_check_file (core, "/nonexistent.ogg") == N_FILE_STATE_UNKNOWN);
+
+    core->file_check_keys     = g_new0 (NAtom, 1);
+    core->file_check_keys[0]  = n_atom_intern ("sound.filename");
+    core->num_file_check_keys = 1;
+    core->filecheck = n_file_check_new (core->workers, core->metrics);
+
+    gchar *dir = g_build_filename (g_get_tmp_dir (), "test-core-XXXXXX", NULL);
+    fail_unless (g_mkdtemp (dir) != NULL);
+    gchar *empty = g_build_filename (dir, "empty.ogg", NULL);
+    gchar *tone = g_build_filename (dir, "tone.ogg", NULL);
+    fail_unless (g_file_set_contents (empty, "", 0, NULL));
+    fail_unless (g_file_set_contents (tone, "RIFF", -1, NULL));
+
+    /* relative paths are not checked */
+    fail_unless (n_core_check_file (core, "tone.ogg") == N_FILE_STATE_UNKNOWN);
+
+    while (n_core_check_file (core, empty) == N_FILE_STATE_UNKNOWN)
+        g_main_context_iteration (NULL, TRUE);
+    fail_unless (n_core_check_file (core, empty) == N_FILE_STATE_INVALID);
+    while (n_core_check_file (core, tone) == N_FILE_STATE_UNKNOWN)
+        g_main_context_iteration (NULL, TRUE);
+    fail_unless (n_core_check_file (core, tone) == N_FILE_STATE_VALID);
+
+    /* a fifo is not opened, which would block the worker */
+    gchar *fifo = g_build_filename (dir, "fifo.ogg", NULL);
+    fail_unless (mkfifo (fifo, 0600) == 0);
+    while (n_core_check_file (core, fifo) == N_FILE_STATE_UNKNOWN)
+        g_main_context_iteration (NULL, TRUE);
+    fail_unless (n_core_check_file (core, fifo) == N_FILE_STATE_INVALID);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "ringtone", "sound.filename", empty);
+    g_key_file_set_value (keyfile, "ringtone", "sound.filename.fallback", "default.ogg");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    /* the sink is never asked to play the invalid file */
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+    NRequest *request = n_request_new_with_event ("ringtone");
+    request->input_iface = input;
+
+    n_core_play_request (core, request);
+    while (fallback_sound == NULL)
+        g_main_context_iteration (NULL, TRUE);
+    fail_unless (g_strcmp0 (fallback_sound, "default.ogg") == 0);
+    fail_unless (invalid_file_plays == 0);
+
+    guint64 invalid = 0;
+    n_metrics_foreach (core->metrics, invalid_file_metric_cb, &invalid);
+    fail_unless (invalid == 1);
+
+    n_core_free (core);
+    g_free (input);
+    g_free (fallback_sound);
+    fallback_sound = NULL;
+    g_unlink (empty);
+    g_unlink (tone);
+    g_unlink (fifo);
+    g_rmdir (dir);
+    g_free (empty);
+    g_free (tone);
+    g_free (fifo);
+    g_free (dir);
+}
+END_TEST
+
+static gchar *prewarmed_value = NULL;
+static guint  prewarm_calls    = 0;
+
+static void
+prewarm_sink_prewarm (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+
+    prewarm_calls++;
+    g_free (prewarmed_value);
+    prewarmed_value = g_strdup (n_proplist_get_string (
+        n_request_get_properties (request), "sound.filename"));
+}
+
+START_TEST (test_prewarm_event)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name    = "prewarm",
+        .play    = lookup_sink_play,
+        .stop    = lookup_sink_stop,
+        .prewarm = prewarm_sink_prewarm
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "ringtone", "sound.filename", "ring.ogg");
+    g_key_file_set_value (keyfile, "ringtone => play.mode=short", "sound.filename", "short.ogg");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    /* sinks see the resolved event properties, nothing is played */
+    n_core_prewarm_event (core, "ringtone", NULL);
+    fail_unless (prewarm_calls == 1);
+    fail_unless (g_strcmp0 (prewarmed_value, "ring.ogg") == 0);
+    fail_unless (n_core_get_requests (core) == NULL);
+
+    NProplist *props = n_proplist_new ();
+    n_proplist_set_string (props, "play.mode", "short");
+    n_core_prewarm_event (core, "ringtone", props);
+    n_proplist_free (props);
+    fail_unless (prewarm_calls == 2);
+    fail_unless (g_strcmp0 (prewarmed_value, "short.ogg") == 0);
+
+    /* unknown events do not reach the sinks */
+    n_core_prewarm_event (core, "no_such_event", NULL);
+    fail_unless (prewarm_calls == 2);
+
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (n_core_get_requests (core) == NULL);
+
+    n_core_free (core);
+    g_free (prewarmed_value);
+    prewarmed_value = NULL;
+}
+END_TEST
+
+static int
+route_sink_cost (NSinkInterface *iface, NRequest *request, NSinkCost *cost)
+{
+    (void) request;
+
+    /* the fast sink plays short sounds only */
+    if (g_str_equal (n_sink_interface_get_name (iface), "route-fast")) {
+        cost->setup_us = 5000;
+        return TRUE;
+    }
+
+    cost->setup_us = 50000;
+    cost->can_fade = TRUE;
+    cost->can_loop = TRUE;
+    return TRUE;
+}
+
+static guint64 route_count = 0;
+
+static void
+route_metric_cb (const char *name, guint64 value, void *userdata)
+{
+    if (g_str_equal (name, (const char*) userdata))
+        route_count = value;
+}
+
+static gboolean
+route_played_by (NRequest *request, const char *name)
+{
+    NSinkInterface **sink = NULL;
+
+    for (sink = request->all_sinks; sink && *sink; ++sink) {
+        if (g_str_equal ((*sink)->name, name))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+START_TEST (test_route_sinks)
+{
+    static const NSinkInterfaceDecl decl_slow = {
+        .name = "route-slow",
+        .type = N_SINK_INTERFACE_TYPE_AUDIO,
+        .play = lookup_sink_play,
+        .stop = lookup_sink_stop,
+        .cost = route_sink_cost
+    };
+    static const NSinkInterfaceDecl decl_fast = {
+        .name = "route-fast",
+        .type = N_SINK_INTERFACE_TYPE_AUDIO,
+        .play = lookup_sink_play,
+        .stop = lookup_sink_stop,
+        .cost = route_sink_cost
+    };
+    static const NSinkInterfaceDecl decl_plain = {
+        .name = "route-plain",
+        .type = N_SINK_INTERFACE_TYPE_AUDIO,
+        .play = lookup_sink_play,
+        .stop = lookup_sink_stop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+    n_core_register_sink (core, &decl_slow);
+    n_core_register_sink (core, &decl_fast);
+    n_core_register_sink (core, &decl_plain);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NInputInterface *input = g_new0 (NInputInterface, 1);
+
+    /* the cheapest sink plays short sounds, sinks without a cost hint
+       are not routed */
+    NRequest *request = n_request_new_with_event ("sms");
+    request->input_iface = input;
+    n_core_play_request (core, request);
+    fail_unless (route_played_by (request, "route-fast"));
+    fail_unless (route_played_by (request, "route-plain"));
+    fail_unless (!route_played_by (request, "route-slow"));
+    n_core_stop_request (core, request, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    /* a repeated sound needs a sink that can loop it */
+    NProplist *props = n_proplist_new ();
+    n_proplist_set_bool (props, "sound.repeat", TRUE);
+    request = n_request_new_with_event_and_properties ("sms", props);
+    request->input_iface = input;
+    n_proplist_free (props);
+    n_core_play_request (core, request);
+    fail_unless (route_played_by (request, "route-slow"));
+    fail_unless (!route_played_by (request, "route-fast"));
+    n_core_stop_request (core, request, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    /* routing can be turned off for an event */
+    props = n_proplist_new ();
+    n_proplist_set_bool (props, "core.route", FALSE);
+    request = n_request_new_with_event_and_properties ("sms", props);
+    request->input_iface = input;
+    n_proplist_free (props);
+    n_core_play_request (core, request);
+    fail_unless (route_played_by (request, "route-slow"));
+    fail_unless (route_played_by (request, "route-fast"));
+    n_core_stop_request (core, request, 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    n_metrics_foreach (n_core_get_metrics (core), route_metric_cb,
+        "requests.route.route-fast");
+    fail_unless (route_count == 1);
+    n_metrics_foreach (n_core_get_metrics (core), route_metric_cb,
+        "requests.route.route-slow");
+    fail_unless (route_count == 1);
+
+    n_core_free (core);
+    g_free (input);
+}
+END_TEST
+
 START_TEST (test_add_get_events)
 {
     NCore *core = NULL;
@@ -90,6 +1797,477 @@ START_TEST (test_add_get_events)
 }
 END_TEST
 
+START_TEST (test_event_rule_match)
+{
+    static const struct {
+        const char *rule;
+        const char *value;      /* parsed as a rule value */
+        gboolean    match;
+    } cases[] = {
+        { "key == foo",        "foo",              TRUE  },
+        { "key == foo",        "fob",              FALSE },
+        { "key == foo",        "oo",               FALSE },
+        { "key == foo",        "*",                TRUE  },
+        { "key == foo",        "(int)1",           FALSE },
+        { "key != foo",        "bar",              TRUE  },
+        { "key != foo",        "foo",              FALSE },
+        { "key != foo",        "*",                TRUE  },
+        { "key == *",          "(int)1",           TRUE  },
+        { "key == (int)5",     "(int)5",           TRUE  },
+        { "key == (int)5",     "(uint)5",          FALSE },
+        { "key == (int)5",     "*",                TRUE  },
+        { "key > (int)-2",     "(int)-1",          TRUE  },
+        { "key > (int)-2",     "(int)-2",          FALSE },
+        { "key >= (int)-2",    "(int)-2",          TRUE  },
+        { "key < (int)0",      "(int)-1",          TRUE  },
+        { "key <= (int)0",     "(int)1",           FALSE },
+        { "key != (int)3",     "(int)4",           TRUE  },
+        { "key > (uint)1",     "(uint)4000000000", TRUE  },
+        { "key < (uint)1",     "(uint)0",          TRUE  },
+        { "key >= (uint)1",    "(uint)0",          FALSE },
+        { "key <= (uint)1",    "(uint)1",          TRUE  },
+        { "key == (bool)true", "(bool)true",       TRUE  },
+        { "key == (bool)true", "(bool)false",      FALSE },
+        { "key != (bool)true", "(bool)false",      TRUE  },
+        { "key == (bool)false", "foo",             FALSE },
+        { "key > foo",         "foo",              FALSE },
+        { "key > foo",         "*",                TRUE  }
+    };
+
+    NEventRule *rule  = NULL;
+    NEventRule *value = NULL;
+    gchar      *str   = NULL;
+    guint       i;
+
+    for (i = 0; i < G_N_ELEMENTS (cases); i++) {
+        rule = n_event_rule_parse (cases[i].rule);
+        fail_unless (rule != NULL);
+        fail_unless (rule->match != NULL);
+
+        /* use the rule parser for the typed value prefixes */
+        str   = g_strdup_printf ("v == %s", cases[i].value);
+        value = n_event_rule_parse (str);
+        g_free (str);
+        fail_unless (value != NULL);
+
+        fail_unless (n_event_rule_match (rule, value->value) == cases[i].match,
+                     "'%s' against '%s'", cases[i].rule, cases[i].value);
+        fail_unless (!n_event_rule_match (rule, NULL));
+
+        n_event_rule_unref (value);
+        n_event_rule_unref (rule);
+    }
+}
+END_TEST
+
+START_TEST (test_match_request)
+{
+    NCore *core = NULL;
+    core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+
+    GKeyFile *keyfile = NULL;
+    keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    g_key_file_set_value (keyfile, "sms => type=chat", "variant", "chat");
+    g_key_file_set_value (keyfile, "sms => type=chat, context@call.state=active", "variant", "chat-call");
+    g_key_file_set_value (keyfile, "sms => context@call.state=active", "variant", "call");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NProplist *props = n_proplist_new ();
+    n_proplist_set_string (props, "type", "chat");
+    NRequest *request = n_request_new_with_event_and_properties ("sms", props);
+    NRequest *other = n_request_new_with_event ("sms");
+    other->properties = n_proplist_new ();
+    n_proplist_free (props);
+
+    int pass;
+    for (pass = 0; pass < 2; pass++) {
+        core->eventlist->linear_match = pass;
+
+        NEvent *event = n_event_list_match_request (core->eventlist, request);
+        fail_unless (event != NULL);
+        fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "chat") == 0);
+        event = n_event_list_match_request (core->eventlist, other);
+        fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "default") == 0);
+    }
+
+    NValue *value = n_value_new ();
+    n_value_set_string (value, "active");
+    n_context_set_value (core->context, "call.state", value);
+
+    for (pass = 0; pass < 2; pass++) {
+        core->eventlist->linear_match = pass;
+
+        NEvent *event = n_event_list_match_request (core->eventlist, request);
+        fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "chat-call") == 0);
+        event = n_event_list_match_request (core->eventlist, other);
+        fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "call") == 0);
+    }
+
+    n_request_free (request);
+    n_request_free (other);
+    n_core_free (core);
+    core = NULL;
+}
+END_TEST
+
+START_TEST (test_evaluate_request_cache)
+{
+    NCore *core = NULL;
+    guint hits = 0, misses = 0, size = 0;
+    core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+
+    GKeyFile *keyfile = NULL;
+    keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    g_key_file_set_value (keyfile, "sms => type=chat", "variant", "chat");
+    g_key_file_set_value (keyfile, "sms => type=chat, context@call.state=active", "variant", "chat-call");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NRequest *request = n_request_new_with_event ("sms");
+    request->properties = n_proplist_new ();
+    n_proplist_set_string (request->properties, "type", "chat");
+    n_proplist_set_string (request->properties, "unrelated", "first");
+
+    NEvent *event = n_core_evaluate_request (core, request);
+    fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "chat") == 0);
+    n_core_get_event_cache_stats (core, &hits, &misses, &size);
+    fail_unless (hits == 0 && misses == 1 && size == 1);
+
+    /* keys not referenced by any rule don't affect the cache */
+    n_proplist_set_string (request->properties, "unrelated", "second");
+    fail_unless (n_core_evaluate_request (core, request) == event);
+    n_core_get_event_cache_stats (core, &hits, &misses, &size);
+    fail_unless (hits == 1 && misses == 1 && size == 1);
+
+    /* referenced key changes */
+    n_proplist_set_string (request->properties, "type", "other");
+    event = n_core_evaluate_request (core, request);
+    fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "default") == 0);
+    n_core_get_event_cache_stats (core, &hits, &misses, &size);
+    fail_unless (hits == 1 && misses == 2 && size == 2);
+
+    /* context change flushes the cache */
+    NValue *value = n_value_new ();
+    n_value_set_string (value, "active");
+    n_context_set_value (core->context, "call.state", value);
+    n_proplist_set_string (request->properties, "type", "chat");
+    event = n_core_evaluate_request (core, request);
+    fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "chat-call") == 0);
+    n_core_get_event_cache_stats (core, &hits, &misses, &size);
+    fail_unless (hits == 1 && misses == 3 && size == 1);
+
+    /* unknown events are not cached */
+    NRequest *unknown = n_request_new_with_event ("unknown");
+    fail_unless (n_core_evaluate_request (core, unknown) == NULL);
+    n_core_get_event_cache_stats (core, NULL, NULL, &size);
+    fail_unless (size == 1);
+
+    n_request_free (unknown);
+    n_request_free (request);
+    n_core_free (core);
+    core = NULL;
+}
+END_TEST
+
+START_TEST (test_match_request_context_only)
+{
+    NCore *core = NULL;
+    core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+
+    GKeyFile *keyfile = NULL;
+    keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "ringtone", "variant", "default");
+    g_key_file_set_value (keyfile, "ringtone => context@profile.current=silent", "variant", "silent");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    NRequest *request = n_request_new_with_event ("ringtone");
+    request->properties = n_proplist_new ();
+
+    /* matched result is reused until a relevant context key changes */
+    NEvent *event = n_event_list_match_request (core->eventlist, request);
+    fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "default") == 0);
+
+    NValue *value = n_value_new ();
+    n_value_set_string (value, "active");
+    n_context_set_value (core->context, "call.state", value);
+    event = n_event_list_match_request (core->eventlist, request);
+    fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "default") == 0);
+
+    value = n_value_new ();
+    n_value_set_string (value, "silent");
+    n_context_set_value (core->context, "profile.current", value);
+    event = n_event_list_match_request (core->eventlist, request);
+    fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "silent") == 0);
+
+    value = n_value_new ();
+    n_value_set_string (value, "general");
+    n_context_set_value (core->context, "profile.current", value);
+    event = n_event_list_match_request (core->eventlist, request);
+    fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "default") == 0);
+
+    n_request_free (request);
+    n_core_free (core);
+    core = NULL;
+}
+END_TEST
+
+START_TEST (test_event_db)
+{
+    NCore *core = NULL;
+    core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+
+    gchar *dir = g_build_filename (g_get_tmp_dir (), "test-core-XXXXXX", NULL);
+    fail_unless (g_mkdtemp (dir) != NULL);
+    gchar *db = g_build_filename (dir, "events.db", NULL);
+    gchar *source = g_build_filename (dir, "events.ini", NULL);
+    fail_unless (g_file_set_contents (source, "[sms]\n", -1, NULL));
+    GSList *sources = g_slist_append (NULL, source);
+
+    GKeyFile *keyfile = NULL;
+    keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms", "variant", "default");
+    g_key_file_set_value (keyfile, "sms => type=chat", "variant", "chat");
+    g_key_file_set_value (keyfile, "sms => type=chat, context@call.state=active", "variant", "chat-call");
+    g_key_file_set_value (keyfile, "sms => context@call.state=active", "variant", "call");
+    g_key_file_set_value (keyfile, "ringtone@priority 10 => level<=int:3", "variant", "low");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    fail_unless (n_event_db_save (core->eventlist, db, sources));
+
+    /* loading only works into an empty list */
+    fail_if (n_event_db_load (core->eventlist, db, sources));
+
+    NEventList *loaded = n_event_list_new (core);
+    fail_unless (n_event_db_load (loaded, db, sources));
+    fail_unless (n_event_list_size (loaded) == n_event_list_size (core->eventlist));
+
+    GList *a = n_event_list_get_events (core->eventlist);
+    GList *b = n_event_list_get_events (loaded);
+    for (; a && b; a = g_list_next (a), b = g_list_next (b)) {
+        NEvent *ea = a->data, *eb = b->data;
+        fail_unless (g_strcmp0 (ea->name, eb->name) == 0);
+        fail_unless (ea->priority == eb->priority);
+        fail_unless (n_event_rules_equal (ea, eb));
+        fail_unless (g_strcmp0 (n_proplist_get_string (ea->properties, "variant"),
+                                n_proplist_get_string (eb->properties, "variant")) == 0);
+    }
+    fail_unless (a == NULL && b == NULL);
+
+    NEvent *event = NULL;
+
+    NProplist *props = n_proplist_new ();
+    n_proplist_set_string (props, "type", "chat");
+    NRequest *request = n_request_new_with_event_and_properties ("sms", props);
+    n_proplist_free (props);
+
+    event = n_event_list_match_request (loaded, request);
+    fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "chat") == 0);
+
+    NValue *value = n_value_new ();
+    n_value_set_string (value, "active");
+    n_context_set_value (core->context, "call.state", value);
+    event = n_event_list_match_request (loaded, request);
+    fail_unless (g_strcmp0 (n_proplist_get_string (event->properties, "variant"), "chat-call") == 0);
+
+    n_event_list_free (loaded);
+
+    /* changed source invalidates the database */
+    fail_unless (g_file_set_contents (source, "[sms]\n[ringtone]\n", -1, NULL));
+    loaded = n_event_list_new (core);
+    fail_if (n_event_db_load (loaded, db, sources));
+    fail_unless (n_event_list_size (loaded) == 0);
+    n_event_list_free (loaded);
+
+    /* corrupted database is rejected */
+    fail_unless (n_event_db_save (core->eventlist, db, sources));
+    gchar *contents = NULL;
+    gsize length = 0;
+    fail_unless (g_file_get_contents (db, &contents, &length, NULL));
+    fail_unless (g_file_set_contents (db, contents, length / 2, NULL));
+    g_free (contents);
+    loaded = n_event_list_new (core);
+    fail_if (n_event_db_load (loaded, db, sources));
+    n_event_list_free (loaded);
+
+    g_unlink (db);
+    g_unlink (source);
+    g_rmdir (dir);
+    g_slist_free (sources);
+    g_free (source);
+    g_free (db);
+    g_free (dir);
+    n_request_free (request);
+    n_core_free (core);
+    core = NULL;
+}
+END_TEST
+
+static NEvent*
+find_event (NCore *core, const char *name, const char *variant)
+{
+    GList *iter;
+    NEvent *event;
+
+    for (iter = n_event_list_get_events (core->eventlist); iter; iter = g_list_next (iter)) {
+        event = iter->data;
+        if (g_strcmp0 (event->name, name) == 0 &&
+            g_strcmp0 (n_proplist_get_string (event->properties, "variant"), variant) == 0)
+            return event;
+    }
+
+    return NULL;
+}
+
+START_TEST (test_reload_events)
+{
+    NCore *core = NULL;
+    core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+
+    gchar *dir = g_build_filename (g_get_tmp_dir (), "test-core-XXXXXX", NULL);
+    fail_unless (g_mkdtemp (dir) != NULL);
+    gchar *events_dir = g_build_filename (dir, "events.d", NULL);
+    fail_unless (g_mkdir (events_dir, 0700) == 0);
+    gchar *a = g_build_filename (events_dir, "a.ini", NULL);
+    gchar *b = g_build_filename (events_dir, "b.ini", NULL);
+    fail_unless (g_file_set_contents (a, "[ringtone]\nvariant = a\n", -1, NULL));
+    fail_unless (g_file_set_contents (b, "[sms]\nvariant = b\n[sms => type=chat]\nvariant = b-chat\n", -1, NULL));
+
+    g_free (core->conf_path);
+    g_free (core->user_conf_path);
+    core->conf_path = g_strdup (dir);
+    core->user_conf_path = g_build_filename (dir, "none", NULL);
+
+    fail_unless (n_core_reload_events (core));
+    fail_unless (n_event_list_size (core->eventlist) == 3);
+    NEvent *ringtone = find_event (core, "ringtone", "a");
+    NEvent *sms = find_event (core, "sms", "b");
+    fail_unless (ringtone != NULL && sms != NULL);
+
+    /* nothing changed */
+    guint generation = core->eventlist->generation;
+    fail_unless (n_core_reload_events (core));
+    fail_unless (core->eventlist->generation == generation);
+    fail_unless (n_core_get_events_generation (core) == generation);
+
+    /* in-flight request keeps its event */
+    NRequest *request = n_request_new_with_event ("sms");
+    request->event = sms;
+    core->requests = g_list_append (core->requests, request);
+
+    /* only events named in the changed file are replaced, and
+       events with the same name from other files are merged again. */
+    fail_unless (g_file_set_contents (b, "[sms]\nvariant = b2\n[ringtone]\nextra = 1\n", -1, NULL));
+    fail_unless (n_core_reload_events (core));
+    fail_unless (n_event_list_size (core->eventlist) == 2);
+    fail_unless (n_core_get_events_generation (core) != generation);
+    fail_unless (find_event (core, "sms", "b2") != NULL);
+    NEvent *merged = find_event (core, "ringtone", "a");
+    fail_unless (merged != NULL);
+    fail_unless (g_strcmp0 (n_proplist_get_string (merged->properties, "extra"), "1") == 0);
+    fail_unless (g_list_find (core->retired_events, sms) != NULL);
+    fail_unless (g_strcmp0 (sms->name, "sms") == 0);
+
+    core->requests = g_list_remove (core->requests, request);
+    n_core_free_retired_events (core);
+    fail_unless (core->retired_events == NULL);
+    n_request_free (request);
+
+    /* untouched file keeps its events */
+    ringtone = merged;
+    fail_unless (g_file_set_contents (b, "[sms]\nvariant = b3\n", -1, NULL));
+    fail_unless (n_core_reload_events (core));
+    fail_unless (find_event (core, "sms", "b3") != NULL);
+    fail_unless (find_event (core, "ringtone", "a") != ringtone);
+    fail_unless (find_event (core, "ringtone", "a") != NULL);
+    fail_unless (n_proplist_get_string (find_event (core, "ringtone", "a")->properties, "extra") == NULL);
+    ringtone = find_event (core, "ringtone", "a");
+    fail_unless (g_file_set_contents (b, "[sms]\nvariant = b4\n", -1, NULL));
+    fail_unless (n_core_reload_events (core));
+    fail_unless (find_event (core, "ringtone", "a") == ringtone);
+
+    /* removed file */
+    g_unlink (b);
+    fail_unless (n_core_reload_events (core));
+    fail_unless (n_event_list_size (core->eventlist) == 1);
+
+    g_unlink (a);
+    g_rmdir (events_dir);
+    g_rmdir (dir);
+    g_free (a);
+    g_free (b);
+    g_free (events_dir);
+    g_free (dir);
+    n_core_free (core);
+    core = NULL;
+}
+END_TEST
+
+START_TEST (test_reload_events_order)
+{
+    NCore *core = NULL;
+    core = n_core_new (NULL, NULL);
+    fail_unless (core != NULL);
+
+    gchar *dir = g_build_filename (g_get_tmp_dir (), "test-core-XXXXXX", NULL);
+    fail_unless (g_mkdtemp (dir) != NULL);
+    gchar *events_dir = g_build_filename (dir, "events.d", NULL);
+    fail_unless (g_mkdir (events_dir, 0700) == 0);
+
+    /* the files are parsed in parallel, yet merged in file order so the
+       last file overrides the others. */
+    gchar *files[16];
+    guint i;
+    for (i = 0; i < G_N_ELEMENTS (files); i++) {
+        gchar *name = g_strdup_printf ("%02u.ini", i);
+        gchar *content = g_strdup_printf ("[ringtone]\nvariant = %02u\nfile%02u = 1\n", i, i);
+        files[i] = g_build_filename (events_dir, name, NULL);
+        fail_unless (g_file_set_contents (files[i], content, -1, NULL));
+        g_free (content);
+        g_free (name);
+    }
+
+    g_free (core->conf_path);
+    g_free (core->user_conf_path);
+    core->conf_path = g_strdup (dir);
+    core->user_conf_path = g_build_filename (dir, "none", NULL);
+
+    fail_unless (n_core_reload_events (core));
+    fail_unless (n_event_list_size (core->eventlist) == 1);
+    NEvent *ringtone = find_event (core, "ringtone", "15");
+    fail_unless (ringtone != NULL);
+    fail_unless (g_strcmp0 (n_proplist_get_string (ringtone->properties, "file00"), "1") == 0);
+
+    /* an unchanged file is read again when another file changes the event */
+    fail_unless (g_file_set_contents (files[3], "[ringtone]\nvariant = changed\n", -1, NULL));
+    fail_unless (n_core_reload_events (core));
+    ringtone = find_event (core, "ringtone", "15");
+    fail_unless (ringtone != NULL);
+    fail_unless (n_proplist_get_string (ringtone->properties, "file03") == NULL);
+    fail_unless (g_strcmp0 (n_proplist_get_string (ringtone->properties, "file14"), "1") == 0);
+
+    for (i = 0; i < G_N_ELEMENTS (files); i++) {
+        g_unlink (files[i]);
+        g_free (files[i]);
+    }
+    g_rmdir (events_dir);
+    g_rmdir (dir);
+    g_free (events_dir);
+    g_free (dir);
+    n_core_free (core);
+    core = NULL;
+}
+END_TEST
+
 static void callback (NHook *hook, void *data, void *userdata)
 {
     (void) hook;
@@ -106,11 +2284,8 @@ START_TEST (test_connect)
     int priority = 10;
     NCoreHook hook = N_CORE_HOOK_INIT_DONE;
     void *userdata = NULL;
-    GList *list = NULL;
     
-    list = core->hooks[hook].slots;
-    fail_unless (g_list_length (list) == 0);
-    list = NULL;
+    fail_unless (core->hooks[hook].num_slots == 0);
 
     /* connect tests */
     
@@ -131,25 +2306,20 @@ START_TEST (test_connect)
     hook = N_CORE_HOOK_INIT_DONE;
     result = n_core_connect (core, hook, priority, callback, userdata);
     fail_unless (result == TRUE);
-    list = core->hooks[hook].slots;
-    fail_unless (list != NULL);
-    fail_unless (g_list_length (list) == 1);
+    fail_unless (core->hooks[hook].slots != NULL);
+    fail_unless (core->hooks[hook].num_slots == 1);
 
     /* disconnect tests */
 
     /* core is NULL */
     n_core_disconnect (NULL, hook, callback, userdata);
-    list = core->hooks[hook].slots;
-    fail_unless (list != NULL);
-    fail_unless (g_list_length (list) == 1);
-    list = NULL;
+    fail_unless (core->hooks[hook].slots != NULL);
+    fail_unless (core->hooks[hook].num_slots == 1);
 
     /* callback is NULL */
     n_core_disconnect (core, hook, NULL, userdata);
-    list = core->hooks[hook].slots;
-    fail_unless (list != NULL);
-    fail_unless (g_list_length (list) == 1);
-    list = NULL;
+    fail_unless (core->hooks[hook].slots != NULL);
+    fail_unless (core->hooks[hook].num_slots == 1);
 
     /* hook >= N_CORE_HOOK_LAST */
     hook = N_CORE_HOOK_LAST;
@@ -158,15 +2328,66 @@ START_TEST (test_connect)
     /* disconnect callback */
     hook = N_CORE_HOOK_INIT_DONE;
     n_core_disconnect (core, hook, callback, userdata);
-    list = core->hooks[hook].slots;
-    fail_unless (list == NULL);
-    fail_unless (g_list_length (list) == 0);
+    fail_unless (core->hooks[hook].slots == NULL);
+    fail_unless (core->hooks[hook].num_slots == 0);
 
     n_core_free (core);
     core = NULL;
 }
 END_TEST
 
+static GString *fire_order = NULL;
+
+static void
+order_cb (NHook *hook, void *data, void *userdata)
+{
+    (void) data;
+    g_string_append (fire_order, (const char*) userdata);
+
+    /* disconnecting while firing, the removed slot is not called */
+    if (g_str_equal ((const char*) userdata, "b"))
+        n_hook_disconnect (hook, order_cb, "c");
+}
+
+START_TEST (test_hook_fire)
+{
+    NHook hook;
+    guint i;
+
+    n_hook_init (&hook);
+    fire_order = g_string_new (NULL);
+
+    fail_unless (n_hook_connect (&hook, N_HOOK_PRIORITY_LOW, order_cb, "d"));
+    fail_unless (n_hook_connect (&hook, N_HOOK_PRIORITY_HIGH, order_cb, "a"));
+    fail_unless (n_hook_connect (&hook, N_HOOK_PRIORITY_DEFAULT, order_cb, "b"));
+    fail_unless (n_hook_connect (&hook, N_HOOK_PRIORITY_DEFAULT, order_cb, "c"));
+    fail_unless (hook.num_slots == 4);
+
+    n_hook_set_timing (&hook, TRUE);
+    fail_unless (n_hook_fire (&hook, NULL));
+    fail_unless (g_strcmp0 (fire_order->str, "abd") == 0);
+    fail_unless (hook.num_slots == 3);
+
+    g_string_truncate (fire_order, 0);
+    fail_unless (n_hook_fire (&hook, NULL));
+    fail_unless (g_strcmp0 (fire_order->str, "abd") == 0);
+
+    for (i = 0; i < hook.num_slots; i++) {
+        fail_unless (hook.slots[i]->calls == 2);
+        fail_unless (hook.slots[i]->max_us <= hook.slots[i]->total_us);
+    }
+
+    /* timing disabled, statistics are not updated */
+    n_hook_set_timing (&hook, FALSE);
+    fail_unless (n_hook_fire (&hook, NULL));
+    fail_unless (hook.slots[0]->calls == 2);
+
+    n_hook_clear (&hook);
+    fail_unless (hook.num_slots == 0);
+    g_string_free (fire_order, TRUE);
+}
+END_TEST
+
 int
 main (int argc, char *argv[])
 {
@@ -190,14 +2411,51 @@ main (int argc, char *argv[])
 
     tc = tcase_create ("get requests");
     tcase_add_test (tc, test_get_requests);
+    tcase_add_test (tc, test_lookup_request);
+    tcase_add_test (tc, test_sink_plan);
+    tcase_add_test (tc, test_request_timeline);
+    tcase_add_test (tc, test_sync_start);
+    tcase_add_test (tc, test_haptic_policy);
+    tcase_add_test (tc, test_async_sink_init);
+    tcase_add_test (tc, test_early_start);
+    tcase_add_test (tc, test_lazy_plugin);
+    tcase_add_test (tc, test_request_keys);
+    tcase_add_test (tc, test_request_key_limit);
+    tcase_add_test (tc, test_coalesce_request);
+    tcase_add_test (tc, test_priority_schedule);
+    tcase_add_test (tc, test_critical_dispatch);
+    tcase_add_test (tc, test_threaded_prepare);
+    tcase_add_test (tc, test_fallback_request);
+    tcase_add_test (tc, test_invalid_file_fallback);
+    tcase_add_test (tc, test_request_watchdog);
+    tcase_add_test (tc, test_resume_request);
+    tcase_add_test (tc, test_prewarm_event);
+    tcase_add_test (tc, test_route_sinks);
     suite_add_tcase (s, tc);
 
     tc = tcase_create ("add & get events");
     tcase_add_test (tc, test_add_get_events);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("match request");
+    tcase_add_test (tc, test_event_rule_match);
+    tcase_add_test (tc, test_match_request);
+    tcase_add_test (tc, test_match_request_context_only);
+    tcase_add_test (tc, test_evaluate_request_cache);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("event database");
+    tcase_add_test (tc, test_event_db);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("reload events");
+    tcase_add_test (tc, test_reload_events);
+    tcase_add_test (tc, test_reload_events_order);
+    suite_add_tcase (s, tc);
+
     tc = tcase_create ("connect/disconnect callback to/from hook");
     tcase_add_test (tc, test_connect);
+    tcase_add_test (tc, test_hook_fire);
     suite_add_tcase (s, tc);
     
     sr = srunner_create (s);
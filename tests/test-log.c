@@ -0,0 +1,178 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <check.h>
+
+#include "src/ngf/log.c"
+
+/* format the last buffered message */
+static void
+format_last (char *buf, size_t size)
+{
+    guint head = (guint) g_atomic_int_get (&_log_buffer_head);
+    const NLogRecord *record = &_log_buffer[(head - 1) % LOG_BUFFER_RECORDS];
+
+    fail_unless ((guint) record->seq == head);
+    n_log_format_record (record, buf, size);
+}
+
+static void
+check_format (const char *expected, const char *fmt, ...)
+{
+    char buf[LOG_MESSAGE_SIZE];
+    char reference[LOG_MESSAGE_SIZE];
+    va_list args;
+
+    va_start (args, fmt);
+    n_log_buffer_message (N_LOG_LEVEL_DEBUG, fmt, args);
+    va_end (args);
+
+    format_last (buf, sizeof (buf));
+
+    if (!expected) {
+        va_start (args, fmt);
+        vsnprintf (reference, sizeof (reference), fmt, args);
+        va_end (args);
+        expected = reference;
+    }
+
+    fail_unless (g_strcmp0 (buf, expected) == 0, "'%s' != '%s'", buf, expected);
+}
+
+START_TEST (test_buffer_format)
+{
+    gchar *transient = NULL;
+    char buf[LOG_MESSAGE_SIZE];
+    char long_string[LOG_BUFFER_ARGS_SIZE * 2];
+
+    n_log_set_target (N_LOG_TARGET_BUFFER);
+    fail_unless (n_log_get_target () == N_LOG_TARGET_BUFFER);
+
+    check_format (NULL, "plain text");
+    check_format (NULL, "100%% done");
+    check_format (NULL, "%d %i %u %x %05X %c", -1, 42, 7u, 255u, 171u, 'z');
+    check_format (NULL, "%ld %lu %lld %llu %zu %zd", -5L, 6UL, -7LL, 8ULL, (size_t) 9, (ssize_t) -10);
+    check_format (NULL, "%hd %hhu", (short) -3, (unsigned char) 200);
+    check_format (NULL, "%.2f %e %g %Lf", 1.25, 2.5, 0.125, (long double) 3.5);
+    check_format (NULL, "%*d|%-*.*s|", 5, 3, 6, 2, "abcdef");
+    check_format (NULL, "%s %s", "key", (const char*) NULL);
+    check_format (NULL, "%.*s|%.3s|%-6.2s|", 4, "abcdefgh", "abcdefgh", "abcdefgh");
+    check_format (NULL, "%.*s|%5.*s|", -1, "abc", 0, "abc");
+
+    /* only the printed part of a string with a precision is read */
+    memset (long_string, 'b', sizeof (long_string));
+    check_format ("bbb", "%.*s", 3, long_string);
+    check_format (NULL, "%p", (void*) &buf);
+
+    /* strings are copied, not referenced */
+    transient = g_strdup ("transient");
+    n_log_message (N_LOG_LEVEL_ERROR, __FUNCTION__, __LINE__, "value %s (%d)", transient, 1);
+    g_free (transient);
+    format_last (buf, sizeof (buf));
+    fail_unless (g_strcmp0 (buf, "value transient (1)") == 0);
+
+    /* so is the format */
+    transient = g_strdup ("format %s");
+    n_log_message (N_LOG_LEVEL_ERROR, __FUNCTION__, __LINE__, transient, "copied");
+    memset (transient, '%', strlen (transient));
+    g_free (transient);
+    format_last (buf, sizeof (buf));
+    fail_unless (g_strcmp0 (buf, "format copied") == 0);
+
+    /* arguments not fitting are cut off */
+    memset (long_string, 'a', sizeof (long_string) - 1);
+    long_string[sizeof (long_string) - 1] = '\0';
+    n_log_message (N_LOG_LEVEL_ERROR, __FUNCTION__, __LINE__, "%d %s %d", 1, long_string, 2);
+    format_last (buf, sizeof (buf));
+    fail_unless (g_str_has_prefix (buf, "1 aaaa"));
+    fail_unless (g_str_has_suffix (buf, " [truncated]"));
+    fail_unless (strlen (buf) < LOG_MESSAGE_SIZE);
+
+    /* unsupported conversions end the message */
+    check_format ("wide  [truncated]", "wide %ls", L"x");
+
+    (void) n_log_dump (0);
+    fail_unless (n_log_get_buffered () == 0);
+}
+END_TEST
+
+START_TEST (test_buffer_dump)
+{
+    guint i;
+
+    n_log_set_level (N_LOG_LEVEL_DEBUG);
+    n_log_set_target (N_LOG_TARGET_BUFFER);
+    (void) n_log_dump (0);
+
+    N_ENTER ("below the level");
+    fail_unless (n_log_get_buffered () == 0);
+
+    for (i = 0; i < 10; i++)
+        N_DEBUG ("message %u", i);
+
+    fail_unless (n_log_get_buffered () == 10);
+    fail_unless (n_log_dump (4) == 4);
+    fail_unless (n_log_get_buffered () == 6);
+    fail_unless (n_log_dump (0) == 6);
+    fail_unless (n_log_get_buffered () == 0);
+
+    /* the oldest messages are overwritten */
+    for (i = 0; i < LOG_BUFFER_RECORDS + 10; i++)
+        N_DEBUG ("message %u", i);
+
+    fail_unless (n_log_get_buffered () == LOG_BUFFER_RECORDS);
+    fail_unless (n_log_dump (0) == LOG_BUFFER_RECORDS);
+
+    /* leaving the buffer target dumps the rest */
+    N_DEBUG ("last message");
+    n_log_set_target (N_LOG_TARGET_STDOUT);
+    fail_unless (n_log_get_buffered () == 0);
+}
+END_TEST
+
+int
+main (int argc, char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    int num_failed = 0;
+    Suite *s = NULL;
+    TCase *tc = NULL;
+    SRunner *sr = NULL;
+
+    s = suite_create ("\tLog tests");
+
+    tc = tcase_create ("buffer format");
+    tcase_add_test (tc, test_buffer_format);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("buffer dump");
+    tcase_add_test (tc, test_buffer_dump);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
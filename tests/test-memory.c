@@ -0,0 +1,233 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include "src/ngf/memory-internal.h"
+#include "src/ngf/metrics-internal.h"
+#include "src/ngf/timer-internal.h"
+
+typedef struct _TestCache
+{
+    NMemoryCache *cache;
+    gsize         size;
+    guint         trims;
+    GString      *order;            /* names of the caches trimmed */
+    const char   *name;
+} TestCache;
+
+static void
+test_trim_cb (gsize target, gpointer userdata)
+{
+    TestCache *test = userdata;
+
+    test->trims++;
+    test->size = target;
+    if (test->order)
+        g_string_append (test->order, test->name);
+    n_memory_cache_set_size (test->cache, test->size);
+}
+
+static void
+test_cache_set (TestCache *test, gsize size)
+{
+    test->size = size;
+    n_memory_cache_set_size (test->cache, size);
+}
+
+typedef struct _MetricValue
+{
+    const char *name;
+    guint64     value;
+    gboolean    found;
+} MetricValue;
+
+static void
+metric_value_cb (const char *name, guint64 value, void *userdata)
+{
+    MetricValue *metric = userdata;
+
+    if (g_str_equal (name, metric->name)) {
+        metric->value = value;
+        metric->found = TRUE;
+    }
+}
+
+static guint64
+metric_value (NMetrics *metrics, const char *name)
+{
+    MetricValue metric = { name, 0, FALSE };
+
+    n_metrics_foreach (metrics, metric_value_cb, &metric);
+    fail_unless (metric.found);
+
+    return metric.value;
+}
+
+START_TEST (test_budget)
+{
+    NMetrics  *metrics = n_metrics_new ();
+    NTimers   *timers  = n_timers_new ();
+    NMemory   *memory  = n_memory_new (metrics, timers);
+    GString   *order   = g_string_new (NULL);
+    TestCache  low     = { NULL, 0, 0, order, "l" };
+    TestCache  high    = { NULL, 0, 0, order, "h" };
+
+    high.cache = n_memory_add_cache (memory, "high", N_MEMORY_PRIORITY_HIGH, test_trim_cb, &high);
+    low.cache = n_memory_add_cache (memory, "low", N_MEMORY_PRIORITY_LOW, test_trim_cb, &low);
+    n_memory_set_budget (memory, 1000);
+
+    test_cache_set (&low, 400);
+    test_cache_set (&high, 500);
+    fail_unless (n_memory_get_total (memory) == 900);
+    fail_unless (metric_value (metrics, "memory.total") == 900);
+
+    /* going over the budget trims later from the main loop */
+    test_cache_set (&high, 800);
+    fail_unless (low.trims == 0 && high.trims == 0);
+    while (low.trims == 0 && high.trims == 0)
+        g_main_context_iteration (NULL, TRUE);
+
+    /* the low priority cache gives way first */
+    fail_unless (g_strcmp0 (order->str, "l") == 0);
+    fail_unless (low.size == 200);
+    fail_unless (high.size == 800);
+    fail_unless (n_memory_get_total (memory) == 1000);
+
+    /* under pressure both are trimmed, the peaks are kept */
+    g_string_truncate (order, 0);
+    n_memory_trim (memory, 300);
+    fail_unless (g_strcmp0 (order->str, "lh") == 0);
+    fail_unless (low.size == 0);
+    fail_unless (high.size == 300);
+    fail_unless (metric_value (metrics, "memory.high") == 300);
+    fail_unless (metric_value (metrics, "memory.high.max") == 800);
+    fail_unless (metric_value (metrics, "memory.trims") == 2);
+
+    n_memory_remove_cache (memory, low.cache);
+    n_memory_remove_cache (memory, high.cache);
+    fail_unless (n_memory_get_total (memory) == 0);
+
+    n_memory_free (memory);
+    n_timers_free (timers);
+    n_metrics_free (metrics);
+    g_string_free (order, TRUE);
+}
+END_TEST
+
+START_TEST (test_idle)
+{
+    NMetrics  *metrics = n_metrics_new ();
+    NTimers   *timers  = n_timers_new ();
+    NMemory   *memory  = n_memory_new (metrics, timers);
+    TestCache  test    = { NULL, 0, 0, NULL, "t" };
+    TestCache  high    = { NULL, 0, 0, NULL, "h" };
+    gint64     timeout = 0;
+
+    test.cache = n_memory_add_cache (memory, "test", N_MEMORY_PRIORITY_DEFAULT, test_trim_cb, &test);
+    high.cache = n_memory_add_cache (memory, "high", N_MEMORY_PRIORITY_HIGH, test_trim_cb, &high);
+    n_memory_set_idle_timeout (memory, 20);
+
+    /* the caches are evicted without a budget as well */
+    test_cache_set (&test, 5000);
+    test_cache_set (&high, 3000);
+    n_memory_set_busy (memory, FALSE);
+
+    /* a request before the timeout postpones the trim */
+    n_memory_set_busy (memory, TRUE);
+    n_memory_set_busy (memory, FALSE);
+
+    timeout = g_get_monotonic_time () + G_TIME_SPAN_SECOND;
+    while (test.trims == 0 && g_get_monotonic_time () < timeout)
+        g_main_context_iteration (NULL, TRUE);
+
+    /* only the high priority cache is kept */
+    fail_unless (test.trims == 1);
+    fail_unless (test.size == 0);
+    fail_unless (high.trims == 0);
+    fail_unless (high.size == 3000);
+
+    /* it stays within the budget */
+    n_memory_set_budget (memory, 1000);
+    n_memory_set_busy (memory, FALSE);
+
+    timeout = g_get_monotonic_time () + G_TIME_SPAN_SECOND;
+    while (high.trims == 0 && g_get_monotonic_time () < timeout)
+        g_main_context_iteration (NULL, TRUE);
+
+    fail_unless (high.trims == 1);
+    fail_unless (high.size == 1000);
+
+    n_memory_remove_cache (memory, test.cache);
+    n_memory_remove_cache (memory, high.cache);
+    n_memory_free (memory);
+    n_timers_free (timers);
+    n_metrics_free (metrics);
+}
+END_TEST
+
+START_TEST (test_pressure)
+{
+    NMetrics *metrics = n_metrics_new ();
+    NTimers  *timers  = n_timers_new ();
+    NMemory  *memory  = n_memory_new (metrics, timers);
+
+    fail_unless (!n_memory_watch_pressure (memory, "/nonexistent/memory.pressure", NULL));
+
+    n_memory_free (memory);
+    n_timers_free (timers);
+    n_metrics_free (metrics);
+}
+END_TEST
+
+int
+main (int argc, char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    int num_failed = 0;
+    Suite *s = NULL;
+    TCase *tc = NULL;
+    SRunner *sr = NULL;
+
+    s = suite_create ("\tMemory tests");
+
+    tc = tcase_create ("budget");
+    tcase_add_test (tc, test_budget);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("idle");
+    tcase_add_test (tc, test_idle);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("pressure");
+    tcase_add_test (tc, test_pressure);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
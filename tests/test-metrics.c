@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include "src/ngf/metrics-internal.h"
+
+typedef struct _LookupData
+{
+    const char *name;
+    guint64     value;
+    gboolean    found;
+} LookupData;
+
+static void
+lookup_cb (const char *name, guint64 value, void *userdata)
+{
+    LookupData *data = userdata;
+
+    if (g_strcmp0 (name, data->name) == 0) {
+        data->value = value;
+        data->found = TRUE;
+    }
+}
+
+static guint64
+lookup_value (NMetrics *metrics, const char *name, gboolean *found)
+{
+    LookupData data;
+
+    memset (&data, 0, sizeof (data));
+    data.name = name;
+    n_metrics_foreach (metrics, lookup_cb, &data);
+    if (found)
+        *found = data.found;
+
+    return data.value;
+}
+
+START_TEST (test_counter_and_gauge)
+{
+    NMetrics *metrics = n_metrics_new ();
+    fail_unless (metrics != NULL);
+
+    NMetricCounter *counter = n_metrics_add_counter (metrics, "counter");
+    fail_unless (counter != NULL);
+    fail_unless (n_metrics_add_counter (metrics, "counter") == counter);
+    fail_unless (n_metrics_add_gauge (metrics, "counter") == NULL);
+    fail_unless (n_metrics_add_counter (NULL, "counter") == NULL);
+
+    n_metric_counter_inc (counter);
+    n_metric_counter_add (counter, 10);
+    n_metric_counter_inc (NULL);
+    fail_unless (lookup_value (metrics, "counter", NULL) == 11);
+
+    NMetricGauge *gauge = n_metrics_add_gauge (metrics, "gauge");
+    n_metric_gauge_set (gauge, 5);
+    n_metric_gauge_set (gauge, 2);
+    fail_unless (lookup_value (metrics, "gauge", NULL) == 2);
+    fail_unless (lookup_value (metrics, "gauge.max", NULL) == 5);
+
+    n_metrics_dump (metrics);
+    n_metrics_free (metrics);
+}
+END_TEST
+
+START_TEST (test_histogram)
+{
+    gboolean found = FALSE;
+
+    NMetrics *metrics = n_metrics_new ();
+    NMetricHistogram *histogram = n_metrics_add_histogram (metrics, "latency");
+    fail_unless (histogram != NULL);
+
+    n_metric_histogram_add (histogram, -3);
+    n_metric_histogram_add (histogram, 0);
+    n_metric_histogram_add (histogram, 1);
+    n_metric_histogram_add (histogram, 5);
+    n_metric_histogram_add (histogram, 7);
+    n_metric_histogram_add (histogram, G_MAXINT64);
+
+    fail_unless (lookup_value (metrics, "latency.count", NULL) == 6);
+    fail_unless (lookup_value (metrics, "latency.max", NULL) == (guint64) G_MAXINT64);
+    fail_unless (lookup_value (metrics, "latency.le_0", NULL) == 2);
+    fail_unless (lookup_value (metrics, "latency.lt_2", NULL) == 1);
+    fail_unless (lookup_value (metrics, "latency.lt_8", NULL) == 2);
+    fail_unless (lookup_value (metrics, "latency.inf", NULL) == 1);
+
+    /* empty buckets are not reported */
+    lookup_value (metrics, "latency.lt_4", &found);
+    fail_unless (found == FALSE);
+
+    n_metrics_free (metrics);
+}
+END_TEST
+
+START_TEST (test_rolling_histogram)
+{
+    NMetrics *metrics = n_metrics_new ();
+    NMetricHistogram *histogram = n_metrics_add_rolling_histogram (metrics, "render", 4);
+    int i;
+
+    fail_unless (histogram != NULL);
+    fail_unless (n_metrics_add_rolling_histogram (metrics, "render", 4) == histogram);
+
+    for (i = 0; i < 4; i++)
+        n_metric_histogram_add (histogram, 100);
+    fail_unless (lookup_value (metrics, "render.count", NULL) == 4);
+    fail_unless (lookup_value (metrics, "render.max", NULL) == 100);
+
+    /* second generation, the first one is still reported */
+    for (i = 0; i < 4; i++)
+        n_metric_histogram_add (histogram, 3);
+    fail_unless (lookup_value (metrics, "render.count", NULL) == 8);
+    fail_unless (lookup_value (metrics, "render.sum", NULL) == 412);
+    fail_unless (lookup_value (metrics, "render.lt_128", NULL) == 4);
+    fail_unless (lookup_value (metrics, "render.lt_4", NULL) == 4);
+
+    /* third generation drops the first */
+    n_metric_histogram_add (histogram, 3);
+    fail_unless (lookup_value (metrics, "render.count", NULL) == 5);
+    fail_unless (lookup_value (metrics, "render.max", NULL) == 3);
+    fail_unless (lookup_value (metrics, "render.lt_128", NULL) == 0);
+
+    n_metrics_free (metrics);
+}
+END_TEST
+
+START_TEST (test_family)
+{
+    gchar label[16];
+    int   i;
+
+    NMetrics *metrics = n_metrics_new ();
+    NMetricFamily *family = n_metrics_add_family (metrics, "requests");
+    fail_unless (family != NULL);
+
+    n_metric_family_inc (family, "sms");
+    n_metric_family_inc (family, "sms");
+    n_metric_family_inc (family, "ringtone");
+    fail_unless (lookup_value (metrics, "requests.sms", NULL) == 2);
+    fail_unless (lookup_value (metrics, "requests.ringtone", NULL) == 1);
+
+    /* labels beyond the limit are counted as other */
+    for (i = 0; i < N_METRIC_FAMILY_MAX_LABELS; i++) {
+        g_snprintf (label, sizeof (label), "event%d", i);
+        n_metric_family_inc (family, label);
+    }
+    fail_unless (lookup_value (metrics, "requests." N_METRIC_FAMILY_OTHER, NULL) == 2);
+    n_metric_family_inc (family, "sms");
+    fail_unless (lookup_value (metrics, "requests.sms", NULL) == 3);
+
+    n_metrics_free (metrics);
+}
+END_TEST
+
+static void
+first_cb (const char *name, guint64 value, void *userdata)
+{
+    gchar **first = userdata;
+
+    (void) value;
+
+    if (!*first)
+        *first = g_strdup (name);
+}
+
+START_TEST (test_ranking)
+{
+    gchar     label[16];
+    gchar     long_label[N_METRIC_RANKING_LABEL_MAX + 10];
+    gchar    *first = NULL;
+    gboolean  found;
+    int       i;
+
+    NMetrics *metrics = n_metrics_new ();
+    NMetricRanking *ranking = n_metrics_add_ranking (metrics, "slowest");
+    fail_unless (ranking != NULL);
+    fail_unless (n_metrics_add_family (metrics, "slowest") == NULL);
+
+    n_metric_ranking_record (ranking, "a.wav", 5);
+    n_metric_ranking_record (ranking, "b.wav", 10);
+    n_metric_ranking_record (ranking, "a.wav", 3);
+    fail_unless (lookup_value (metrics, "slowest.a.wav", NULL) == 5);
+
+    /* the largest value is reported first */
+    n_metric_ranking_record (ranking, "a.wav", 20);
+    n_metrics_foreach (metrics, first_cb, &first);
+    fail_unless (g_strcmp0 (first, "slowest.a.wav") == 0);
+    g_free (first);
+
+    /* a full ranking drops the smallest value for a larger one */
+    for (i = 0; i < N_METRIC_RANKING_SIZE; i++) {
+        g_snprintf (label, sizeof (label), "file%d", i);
+        n_metric_ranking_record (ranking, label, 100 + i);
+    }
+    (void) lookup_value (metrics, "slowest.b.wav", &found);
+    fail_unless (found == FALSE);
+    (void) lookup_value (metrics, "slowest.a.wav", &found);
+    fail_unless (found == FALSE);
+    n_metric_ranking_record (ranking, "c.wav", 1);
+    (void) lookup_value (metrics, "slowest.c.wav", &found);
+    fail_unless (found == FALSE);
+
+    /* long labels keep their end */
+    memset (long_label, 'x', sizeof (long_label) - 1);
+    long_label[sizeof (long_label) - 1] = '\0';
+    long_label[sizeof (long_label) - 2] = 'z';
+    n_metric_ranking_record (ranking, long_label, 1000);
+    first = NULL;
+    n_metrics_foreach (metrics, first_cb, &first);
+    fail_unless (strlen (first) == strlen ("slowest.") + N_METRIC_RANKING_LABEL_MAX - 1);
+    fail_unless (g_str_has_suffix (first, "xz"));
+    g_free (first);
+
+    n_metrics_free (metrics);
+}
+END_TEST
+
+int
+main (int argc, char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    int num_failed = 0;
+    Suite *s = NULL;
+    TCase *tc = NULL;
+    SRunner *sr = NULL;
+
+    s = suite_create ("\tMetrics tests");
+
+    tc = tcase_create ("counters and gauges");
+    tcase_add_test (tc, test_counter_and_gauge);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("histograms");
+    tcase_add_test (tc, test_histogram);
+    tcase_add_test (tc, test_rolling_histogram);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("counter families");
+    tcase_add_test (tc, test_family);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("rankings");
+    tcase_add_test (tc, test_ranking);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -206,6 +206,49 @@ START_TEST (test_load_plugin)
 }
 END_TEST
 
+/* a built-in plugin without a reload function */
+static gboolean builtin_loaded = FALSE;
+
+const char* n_plugin_unit__get_name ()    { return "unit"; }
+const char* n_plugin_unit__get_desc ()    { return "Built-in plugin for unit tests"; }
+const char* n_plugin_unit__get_version () { return "0.1"; }
+int  n_plugin_unit__load (NPlugin *plugin)   { (void) plugin; builtin_loaded = TRUE; return TRUE; }
+void n_plugin_unit__unload (NPlugin *plugin) { (void) plugin; builtin_loaded = FALSE; }
+
+N_PLUGIN_BUILTIN_DECLARE (unit)
+
+START_TEST (test_builtin_plugin)
+{
+    NCore   *core   = n_core_new (NULL, NULL);
+    NPlugin *plugin = NULL;
+
+    fail_unless (core != NULL);
+    fail_unless (n_plugin_open_builtin ("unit") == NULL);
+
+    n_plugin_register_builtin (&n_plugin_builtin_unit);
+
+    /* opened without a module from the plugin path. */
+    plugin = n_core_open_plugin (core, "unit", n_proplist_new ());
+    fail_unless (plugin != NULL);
+    fail_unless (plugin->module == NULL);
+    fail_unless (plugin->core == core);
+    fail_unless (plugin->params != NULL);
+    fail_unless (plugin->reload == NULL);
+    fail_unless (g_strcmp0 (plugin->get_name (), "unit") == 0);
+
+    fail_unless (n_plugin_init (plugin) == TRUE);
+    fail_unless (builtin_loaded == TRUE);
+    plugin->unload (plugin);
+    fail_unless (builtin_loaded == FALSE);
+    n_plugin_unload (plugin);
+
+    /* the rest are still looked up in the plugin path. */
+    fail_unless (n_plugin_open_builtin ("not-built-in") == NULL);
+
+    n_core_free (core);
+}
+END_TEST
+
 int
 main (int argc, char *argv[])
 {
@@ -240,6 +283,10 @@ main (int argc, char *argv[])
     tcase_add_test (tc, test_load_plugin);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("built-in plug-in");
+    tcase_add_test (tc, test_builtin_plugin);
+    suite_add_tcase (s, tc);
+
     sr = srunner_create (s);
     srunner_run_all (sr, CK_NORMAL);
     num_failed = srunner_ntests_failed (sr);
@@ -3,6 +3,7 @@
 #include <check.h>
 
 #include "src/include/ngf/proplist.h"
+#include "src/ngf/allocstats.h"
 #define ARRAY_SIZE(array) (sizeof((array)) / sizeof((array)[0]))
 
 START_TEST (test_match_exact)
@@ -537,6 +538,207 @@ START_TEST (test_proplist_values)
 }
 END_TEST
 
+START_TEST (test_atoms)
+{
+    NProplist *proplist = NULL;
+    NValue *value = NULL;
+    NAtom atom = 0;
+    const char *key = "atom.key";
+
+    fail_unless (n_atom_intern (NULL) == 0);
+    fail_unless (n_atom_to_string (0) == NULL);
+
+    atom = n_atom_intern (key);
+    fail_unless (atom != 0);
+    fail_unless (n_atom_intern ("atom.key") == atom);
+    fail_unless (n_atom_intern ("atom.other") != atom);
+    fail_unless (g_strcmp0 (n_atom_to_string (atom), key) == 0);
+
+    proplist = n_proplist_new ();
+    fail_unless (n_proplist_get_by_atom (proplist, atom) == NULL);
+    fail_unless (n_proplist_get_by_atom (proplist, 0) == NULL);
+
+    /* value set by atom is visible through string key and vice versa */
+    value = n_value_new ();
+    n_value_set_int (value, 42);
+    n_proplist_set_by_atom (proplist, atom, value);
+    fail_unless (n_proplist_get_int (proplist, key) == 42);
+    fail_unless (n_proplist_has_key (proplist, key) == TRUE);
+
+    n_proplist_set_string (proplist, "atom.string", "value");
+    value = n_proplist_get_by_atom (proplist, n_atom_intern ("atom.string"));
+    fail_unless (value != NULL);
+    fail_unless (g_strcmp0 (n_value_get_string (value), "value") == 0);
+
+    /* lookup with a never seen key must not fail */
+    fail_unless (n_proplist_get (proplist, "atom.never-seen-key") == NULL);
+
+    n_proplist_unset (proplist, key);
+    fail_unless (n_proplist_get_by_atom (proplist, atom) == NULL);
+    fail_unless (n_proplist_size (proplist) == 1);
+
+    n_proplist_free (proplist);
+}
+END_TEST
+
+START_TEST (test_large)
+{
+    NProplist *proplist = NULL;
+    NProplist *copy = NULL;
+    gchar *key = NULL;
+    int i;
+
+    /* grow well past the flat storage limit and make sure nothing is
+       lost when the proplist switches representation. */
+    proplist = n_proplist_new ();
+    for (i = 0; i < 100; i++) {
+        key = g_strdup_printf ("large.%d", i);
+        n_proplist_set_int (proplist, key, i);
+        g_free (key);
+    }
+    fail_unless (n_proplist_size (proplist) == 100);
+
+    /* replacing existing keys must not change the size */
+    n_proplist_set_int (proplist, "large.0", 1000);
+    n_proplist_set_int (proplist, "large.99", 1099);
+    fail_unless (n_proplist_size (proplist) == 100);
+    fail_unless (n_proplist_get_int (proplist, "large.0") == 1000);
+    fail_unless (n_proplist_get_int (proplist, "large.50") == 50);
+    fail_unless (n_proplist_get_int (proplist, "large.99") == 1099);
+
+    copy = n_proplist_copy (proplist);
+    fail_unless (n_proplist_match_exact (proplist, copy) == TRUE);
+
+    for (i = 0; i < 100; i += 2) {
+        key = g_strdup_printf ("large.%d", i);
+        n_proplist_unset (copy, key);
+        g_free (key);
+    }
+    fail_unless (n_proplist_size (copy) == 50);
+    fail_unless (n_proplist_has_key (copy, "large.50") == FALSE);
+    fail_unless (n_proplist_get_int (copy, "large.51") == 51);
+
+    n_proplist_free (copy);
+    n_proplist_free (proplist);
+
+    /* unset from the middle of a small proplist keeps the rest */
+    proplist = n_proplist_new ();
+    n_proplist_set_int (proplist, "small.a", 1);
+    n_proplist_set_int (proplist, "small.b", 2);
+    n_proplist_set_int (proplist, "small.c", 3);
+    n_proplist_unset (proplist, "small.b");
+    fail_unless (n_proplist_size (proplist) == 2);
+    fail_unless (n_proplist_get_int (proplist, "small.a") == 1);
+    fail_unless (n_proplist_get_int (proplist, "small.c") == 3);
+    n_proplist_free (proplist);
+}
+END_TEST
+
+START_TEST (test_layered)
+{
+    NProplist *base = NULL;
+    NProplist *overlay = NULL;
+    NProplist *layered = NULL;
+    NProplist *copy = NULL;
+    NProplist *expected = NULL;
+
+    base = n_proplist_new ();
+    n_proplist_set_string (base, "layer.a", "base-a");
+    n_proplist_set_string (base, "layer.b", "base-b");
+    n_proplist_set_int (base, "layer.c", 3);
+
+    overlay = n_proplist_new ();
+    n_proplist_set_string (overlay, "layer.b", "overlay-b");
+    n_proplist_set_int (overlay, "layer.d", 4);
+
+    expected = n_proplist_copy (base);
+    n_proplist_merge (expected, overlay);
+
+    layered = n_proplist_new_layered (base, overlay);
+    fail_unless (layered != NULL);
+    fail_unless (n_proplist_size (layered) == 4);
+    fail_unless (n_proplist_match_exact (layered, expected) == TRUE);
+    fail_unless (g_strcmp0 (n_proplist_get_string (layered, "layer.a"), "base-a") == 0);
+    fail_unless (g_strcmp0 (n_proplist_get_string (layered, "layer.b"), "overlay-b") == 0);
+
+    /* modifying layered proplist doesn't touch the layers, and
+       modifying the layers afterwards doesn't touch the layered one */
+    copy = n_proplist_copy (layered);
+    n_proplist_set_int (layered, "layer.c", 30);
+    n_proplist_unset (layered, "layer.a");
+    fail_unless (n_proplist_size (layered) == 3);
+    fail_unless (n_proplist_get_int (layered, "layer.c") == 30);
+    fail_unless (n_proplist_has_key (layered, "layer.a") == FALSE);
+    fail_unless (n_proplist_get_int (base, "layer.c") == 3);
+    fail_unless (n_proplist_has_key (base, "layer.a") == TRUE);
+    fail_unless (n_proplist_match_exact (copy, expected) == TRUE);
+
+    n_proplist_set_int (base, "layer.e", 5);
+    n_proplist_unset (overlay, "layer.d");
+    fail_unless (n_proplist_match_exact (copy, expected) == TRUE);
+    fail_unless (n_proplist_has_key (layered, "layer.e") == FALSE);
+    fail_unless (n_proplist_get_int (layered, "layer.d") == 4);
+
+    n_proplist_free (base);
+    n_proplist_free (overlay);
+    fail_unless (n_proplist_match_exact (copy, expected) == TRUE);
+    fail_unless (n_proplist_get_int (layered, "layer.d") == 4);
+
+    n_proplist_free (copy);
+    n_proplist_free (layered);
+    n_proplist_free (expected);
+
+    /* NULL layers */
+    base = n_proplist_new ();
+    n_proplist_set_int (base, "layer.a", 1);
+    layered = n_proplist_new_layered (base, NULL);
+    fail_unless (n_proplist_match_exact (layered, base) == TRUE);
+    n_proplist_free (layered);
+    layered = n_proplist_new_layered (NULL, base);
+    fail_unless (n_proplist_match_exact (layered, base) == TRUE);
+    n_proplist_free (layered);
+    n_proplist_free (base);
+    fail_unless (n_proplist_new_layered (NULL, NULL) == NULL);
+}
+END_TEST
+
+#ifdef ENABLE_ALLOC_STATS
+START_TEST (test_alloc_stats)
+{
+    NProplist  *proplist = NULL;
+    NProplist  *copy = NULL;
+    NAllocStats before, after;
+    gchar       key[32];
+    int         i;
+
+    n_alloc_stats_get (N_ALLOC_PROPLIST, &before);
+
+    /* a proplist is one object however its data is shared */
+    proplist = n_proplist_new ();
+    copy = n_proplist_copy (proplist);
+    n_alloc_stats_get (N_ALLOC_PROPLIST, &after);
+    fail_unless (after.count - before.count == 2);
+    fail_unless (after.live - before.live == 2);
+
+    /* the entries and the hash table add to the bytes only */
+    n_alloc_stats_get (N_ALLOC_PROPLIST, &before);
+    for (i = 0; i < 40; i++) {
+        g_snprintf (key, sizeof (key), "alloc.key.%d", i);
+        n_proplist_set_int (proplist, key, i);
+    }
+    n_alloc_stats_get (N_ALLOC_PROPLIST, &after);
+    fail_unless (after.count == before.count);
+    fail_unless (after.bytes - before.bytes >= 40 * 2 * sizeof (gpointer));
+
+    n_alloc_stats_get (N_ALLOC_PROPLIST, &before);
+    n_proplist_free (copy);
+    n_proplist_free (proplist);
+    n_alloc_stats_get (N_ALLOC_PROPLIST, &after);
+    fail_unless (before.live - after.live == 2);
+}
+END_TEST
+#endif
+
 int
 main (int argc, char *argv[])
 {
@@ -594,6 +796,24 @@ main (int argc, char *argv[])
     tcase_add_test (tc, test_proplist_values);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("large proplist");
+    tcase_add_test (tc, test_large);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("layered");
+    tcase_add_test (tc, test_layered);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("atoms");
+    tcase_add_test (tc, test_atoms);
+    suite_add_tcase (s, tc);
+
+#ifdef ENABLE_ALLOC_STATS
+    tc = tcase_create ("alloc stats");
+    tcase_add_test (tc, test_alloc_stats);
+    suite_add_tcase (s, tc);
+#endif
+
     sr = srunner_create (s);
     srunner_run_all (sr, CK_NORMAL);
     num_failed = srunner_ntests_failed (sr);
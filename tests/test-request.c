@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 
 #include "src/include/ngf/request.h"
@@ -82,6 +83,14 @@ START_TEST (test_properties)
     set = n_request_get_properties (request);
     fail_unless (n_proplist_match_exact (set, proplist) == TRUE);
     
+    /* the request takes ownership of taken properties */
+    NProplist *taken = n_proplist_new ();
+    n_proplist_set_string (taken, "taken", "value");
+    n_request_take_properties (NULL, taken);
+    n_request_take_properties (request, NULL);
+    n_request_take_properties (request, taken);
+    fail_unless (n_request_get_properties (request) == taken);
+
     n_proplist_free (proplist);
     proplist = NULL;
     n_request_free (request);
@@ -123,6 +132,40 @@ START_TEST (test_data)
 }
 END_TEST
 
+START_TEST (test_alloc)
+{
+    NRequest *request = NULL;
+    request = n_request_new ();
+    fail_unless (request != NULL);
+
+    fail_unless (n_request_alloc (NULL, 16) == NULL);
+    fail_unless (n_request_alloc (request, 0) == NULL);
+
+    /* small allocations, enough to need more than one chunk */
+    guint8 *prev = NULL;
+    int i, j;
+    for (i = 0; i < 100; i++) {
+        guint8 *ptr = n_request_alloc (request, 24);
+        fail_unless (ptr != NULL);
+        fail_unless (((gsize) ptr) % sizeof (gpointer) == 0);
+        for (j = 0; j < 24; j++)
+            fail_unless (ptr[j] == 0);
+        memset (ptr, 0xff, 24);
+        fail_unless (ptr != prev);
+        prev = ptr;
+    }
+
+    /* large allocation */
+    guint8 *large = n_request_alloc (request, 4096);
+    fail_unless (large != NULL);
+    fail_unless (large[0] == 0 && large[4095] == 0);
+    memset (large, 0xff, 4096);
+
+    n_request_free (request);
+    request = NULL;
+}
+END_TEST
+
 int
 main (int argc, char *argv[])
 {
@@ -148,6 +191,10 @@ main (int argc, char *argv[])
     tcase_add_test (tc, test_data);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("request lifetime allocations");
+    tcase_add_test (tc, test_alloc);
+    suite_add_tcase (s, tc);
+
     sr = srunner_create (s);
     srunner_run_all (sr, CK_NORMAL);
     num_failed = srunner_ntests_failed (sr);
@@ -53,7 +53,7 @@ START_TEST (test_resync_on_master)
     fail_unless (request != NULL);
     const char *req_name = "TEST_RESYNC_ON_MASTER_REQUST_name";
     request->name = g_strdup (req_name);
-    request->sinks_resync = NULL;
+    request->sinks_resync = 0;
     NCore *core = NULL;
     core = n_core_new (NULL, NULL);
     fail_unless (core != NULL);
@@ -68,38 +68,35 @@ START_TEST (test_resync_on_master)
 
     /* test for invalid parameter */
     n_sink_interface_set_resync_on_master (NULL, request);
-    fail_unless (request->sinks_resync == NULL);
+    fail_unless (request->sinks_resync == 0);
     /* test for invalid parameter */
     n_sink_interface_set_resync_on_master (iface, NULL);
-    fail_unless (request->sinks_resync == NULL);
+    fail_unless (request->sinks_resync == 0);
 
     /* master_sink = sink */
     request->master_sink = iface;
     n_sink_interface_set_resync_on_master (iface, request);
-    fail_unless (request->sinks_resync == NULL);
+    fail_unless (request->sinks_resync == 0);
 
     
     request->master_sink = NULL;
     NSinkInterface *master_sink = g_new0 (NSinkInterface, 1);
     const char *master_name = "TEST_RESYNC_ON_MASTER_sink_name";
     master_sink->name = master_name;
+    master_sink->index = 1;
     request->master_sink = master_sink;
     
     /* add proper sink do resync sinks */
     n_sink_interface_set_resync_on_master (iface, request);
-    fail_unless (request->sinks_resync != NULL);
-    fail_unless (g_list_length (request->sinks_resync) == 1);
-    fail_unless (g_list_find (request->sinks_resync, iface) != NULL);
+    fail_unless (request->sinks_resync == N_SINK_SET_BIT (iface));
 
     /* readd sink that is already synced */
     n_sink_interface_set_resync_on_master (iface, request);
-    fail_unless (request->sinks_resync != NULL);
-    fail_unless (g_list_length (request->sinks_resync) == 1);
+    fail_unless (request->sinks_resync == N_SINK_SET_BIT (iface));
 
     g_free (master_sink);
     master_sink = NULL;
-    g_list_free (request->sinks_resync);
-    request->sinks_resync = NULL;
+    request->sinks_resync = 0;
     n_core_free (core);
     core = NULL;
     n_request_free (request);
@@ -143,7 +140,7 @@ START_TEST (test_resynchronize)
     fail_unless (request != NULL);
     const char *req_name = "TEST_RESYNC_REQUST_name";
     request->name = g_strdup (req_name);
-    request->sinks_preparing = NULL;
+    request->sinks_preparing = 0;
     NCore *core = NULL;
     core = n_core_new (NULL, NULL);
     fail_unless (core != NULL);
@@ -158,27 +155,29 @@ START_TEST (test_resynchronize)
 
     /* test for invelid parameter */
     n_sink_interface_resynchronize (NULL, request);
-    fail_unless (request->sinks_prepared == NULL);
+    fail_unless (request->sinks_prepared == 0);
     /* test for invalid parameter */
     n_sink_interface_resynchronize (iface, NULL);
-    fail_unless (request->sinks_prepared == NULL);
+    fail_unless (request->sinks_prepared == 0);
     /* sink (iface) is not master sink */
     n_sink_interface_resynchronize (iface, request);
-    fail_unless (request->sinks_prepared == NULL);
+    fail_unless (request->sinks_prepared == 0);
 
     request->play_source_id = 100;
     request->master_sink = iface;
+    NSinkInterface *all_sinks[3] = { iface, NULL, NULL };
+    request->all_sinks = all_sinks;
     /* play_source_id > 0 */
     n_sink_interface_resynchronize (iface, request);
-    fail_unless (request->sinks_prepared == NULL);
+    fail_unless (request->sinks_prepared == 0);
     /* needs verification */
 
-    request->sinks_playing = g_list_append (request->sinks_playing, iface);
+    request->sinks_playing = N_SINK_SET_BIT (iface);
     request->play_source_id = 0;
-    /* sink_resync is NULL */
+    /* sink_resync is empty */
     n_sink_interface_resynchronize (iface, request);
-    fail_unless (request->sinks_playing == NULL);
-    fail_unless (request->sinks_prepared != NULL);
+    fail_unless (request->sinks_playing == 0);
+    fail_unless (request->sinks_prepared == N_SINK_SET_BIT (iface));
     fail_unless (request->play_source_id == 1);
 
     request->play_source_id = 0;
@@ -186,6 +185,7 @@ START_TEST (test_resynchronize)
     fail_unless (sink_in_resync != NULL);
     const char *sink_name = "TEST_RESYNC_sink_name";
     sink_in_resync->name = sink_name;
+    sink_in_resync->index = 1;
     static const NSinkInterfaceDecl decl = {
         .name       = "TEST_RESYNC_unit_test_DECL",
         .initialize = NULL,
@@ -197,7 +197,8 @@ START_TEST (test_resynchronize)
         .stop       = iface_stop
     };
     sink_in_resync->funcs = decl;
-    request->sinks_resync = g_list_append (request->sinks_resync, sink_in_resync);
+    all_sinks[1] = sink_in_resync;
+    request->sinks_resync = N_SINK_SET_BIT (sink_in_resync);
 
     /*sink_resync != NULL */
     n_sink_interface_resynchronize (iface, request);
@@ -209,15 +210,15 @@ START_TEST (test_resynchronize)
     int *data = (int*) n_request_get_data (request, DATA_KEY);
     fail_unless (data != NULL);
     fail_unless (*data == 1);
-    fail_unless (request->sinks_resync == NULL);
-    fail_unless (g_list_find (request->sinks_preparing, sink_in_resync) != NULL);
+    fail_unless (request->sinks_resync == 0);
+    fail_unless (request->sinks_preparing == N_SINK_SET_BIT (sink_in_resync));
+    fail_unless (request->sinks_stop == N_SINK_SET_BIT (sink_in_resync));
 
     g_slice_free (int, data);
     data = NULL;
     g_free (sink_in_resync);
     sink_in_resync = NULL;
-    g_list_free (request->sinks_prepared);
-    request->sinks_prepared = NULL;
+    request->all_sinks = NULL;
     n_core_free (core);
     core = NULL;
     n_request_free (request);
@@ -239,7 +240,7 @@ START_TEST (test_synchronize)
     fail_unless (request != NULL);
     const char *req_name = "TEST_SYNCHRONIZE_REQUST_name";
     request->name = g_strdup (req_name);
-    request->sinks_preparing = NULL;
+    request->sinks_preparing = 0;
     NCore *core = NULL;
     core = n_core_new (NULL, NULL);
     fail_unless (core != NULL);
@@ -254,37 +255,32 @@ START_TEST (test_synchronize)
 
     /* test for invalid parameter */
     n_sink_interface_synchronize (NULL, request);
-    fail_unless (request->sinks_prepared == NULL);
+    fail_unless (request->sinks_prepared == 0);
     /* test for invalid parameter */
     n_sink_interface_synchronize (iface, NULL);
-    fail_unless (request->sinks_prepared == NULL);
+    fail_unless (request->sinks_prepared == 0);
 
-    /* request->sinks_preparing is NULL */
+    /* request->sinks_preparing is empty */
     n_sink_interface_synchronize (iface, request);
-    fail_unless (request->sinks_prepared == NULL);
+    fail_unless (request->sinks_prepared == 0);
 
     NSinkInterface *iface_second = g_new0 (NSinkInterface, 1);
-    /* add different sink (iface_second) to preparing list */
-    request->sinks_preparing = g_list_append (request->sinks_preparing, iface_second);
+    iface_second->index = 1;
+    /* add different sink (iface_second) to preparing set */
+    request->sinks_preparing |= N_SINK_SET_BIT (iface_second);
     /* sink (iface_second) is already in preparing phase, but we call sync for iface */
     n_sink_interface_synchronize (iface, request);
-    fail_unless (g_list_length (request->sinks_preparing) == 1);
-    fail_unless (request->sinks_prepared == NULL);
+    fail_unless (request->sinks_preparing == N_SINK_SET_BIT (iface_second));
+    fail_unless (request->sinks_prepared == 0);
 
-    /* add proper sink to preparing list, at that point two items are in the preparing list */
-    request->sinks_preparing = g_list_append (request->sinks_preparing, iface);
+    /* add proper sink to preparing set, at that point two items are in the preparing set */
+    request->sinks_preparing |= N_SINK_SET_BIT (iface);
     n_sink_interface_synchronize (iface, request);
-    fail_unless (g_list_length (request->sinks_preparing) == 1);
-    fail_unless (request->sinks_prepared != NULL);
-    fail_unless (g_list_length (request->sinks_prepared) == 1);
-    fail_unless (g_list_find (request->sinks_prepared, iface) != NULL);
+    fail_unless (request->sinks_preparing == N_SINK_SET_BIT (iface_second));
+    fail_unless (request->sinks_prepared == N_SINK_SET_BIT (iface));
 
     g_free (iface_second);
     iface_second = NULL;
-    g_list_free (request->sinks_prepared);
-    request->sinks_prepared = NULL;
-    g_list_free (request->sinks_preparing);
-    request->sinks_preparing = NULL;
     n_core_free (core);
     core = NULL;
     n_request_free (request);
@@ -306,7 +302,7 @@ START_TEST (test_complete)
     fail_unless (request != NULL);
     const char *req_name = "TEST_COMPLETE_REQUST_name";
     request->name = g_strdup (req_name);
-    request->sinks_playing = NULL;
+    request->sinks_playing = 0;
     NCore *core = NULL;
     core = n_core_new (NULL, NULL);
     fail_unless (core != NULL);
@@ -319,22 +315,20 @@ START_TEST (test_complete)
     n_proplist_free (proplist);
     proplist = NULL;
 
-    /* sinks_playing = NULL */
+    /* sinks_playing is empty */
     n_sink_interface_complete (iface, request);
     /* ?? verification ?? */
 
-    request->sinks_playing = g_list_append (request->sinks_playing, iface);
+    request->sinks_playing = N_SINK_SET_BIT (iface);
     /* test for invalid parameters */
     n_sink_interface_complete (NULL, request);
-    fail_unless (request->sinks_playing != NULL);
-    fail_unless (g_list_length (request->sinks_playing) == 1);
+    fail_unless (request->sinks_playing == N_SINK_SET_BIT (iface));
     /* test for invalid parameters */
     n_sink_interface_complete (iface, NULL);
-    fail_unless (request->sinks_playing != NULL);
-    fail_unless (g_list_length (request->sinks_playing) == 1);
+    fail_unless (request->sinks_playing == N_SINK_SET_BIT (iface));
     
     n_sink_interface_complete (iface, request);
-    fail_unless (request->sinks_playing == NULL);
+    fail_unless (request->sinks_playing == 0);
     fail_unless (request->stop_source_id = 1);
 
     n_core_free (core);
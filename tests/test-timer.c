@@ -0,0 +1,256 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include "src/ngf/timer-internal.h"
+
+typedef struct _FireData
+{
+    NTimers  *timers;
+    gint64    started;
+    guint     interval;
+    guint     fired;
+    guint     repeat;           /* times to fire */
+    guint     remove_id;        /* timer to remove when fired */
+    gboolean  early;            /* fired before the interval passed */
+    guint    *order;
+    guint    *position;
+} FireData;
+
+static gboolean
+fire_cb (gpointer userdata)
+{
+    FireData *data = userdata;
+
+    data->fired++;
+    if (g_get_monotonic_time () - data->started < (gint64) data->interval * data->fired * 1000)
+        data->early = TRUE;
+
+    if (data->order)
+        data->order[(*data->position)++] = data->interval;
+
+    if (data->remove_id) {
+        fail_unless (n_timers_remove (data->timers, data->remove_id) == TRUE);
+        data->remove_id = 0;
+    }
+
+    return data->fired < data->repeat;
+}
+
+static void
+fire_data_init (FireData *data, NTimers *timers, guint interval)
+{
+    memset (data, 0, sizeof (*data));
+    data->timers = timers;
+    data->started = g_get_monotonic_time ();
+    data->interval = interval;
+    data->repeat = 1;
+}
+
+static void
+run_until_empty (NTimers *timers)
+{
+    while (n_timers_size (timers) > 0)
+        g_main_context_iteration (NULL, TRUE);
+}
+
+START_TEST (test_order)
+{
+    FireData data[3];
+    guint    order[3];
+    guint    position = 0;
+    guint    i;
+
+    NTimers *timers = n_timers_new ();
+    fail_unless (timers != NULL);
+
+    fire_data_init (&data[0], timers, 30);
+    fire_data_init (&data[1], timers, 10);
+    fire_data_init (&data[2], timers, 300);     /* beyond the first level */
+
+    for (i = 0; i < G_N_ELEMENTS (data); i++) {
+        data[i].order = order;
+        data[i].position = &position;
+        fail_unless (n_timers_add (timers, data[i].interval, fire_cb, &data[i]) > 0);
+    }
+
+    fail_unless (n_timers_size (timers) == 3);
+    run_until_empty (timers);
+
+    fail_unless (position == 3);
+    fail_unless (order[0] == 10);
+    fail_unless (order[1] == 30);
+    fail_unless (order[2] == 300);
+
+    for (i = 0; i < G_N_ELEMENTS (data); i++) {
+        fail_unless (data[i].fired == 1);
+        fail_unless (data[i].early == FALSE);
+    }
+
+    n_timers_free (timers);
+}
+END_TEST
+
+START_TEST (test_repeat_and_remove)
+{
+    FireData repeat;
+    FireData removing;
+    FireData removed;
+    FireData self;
+    guint    id;
+
+    NTimers *timers = n_timers_new ();
+
+    fire_data_init (&repeat, timers, 5);
+    repeat.repeat = 3;
+    n_timers_add (timers, repeat.interval, fire_cb, &repeat);
+
+    /* removes a timer due in the same tick */
+    fire_data_init (&removing, timers, 20);
+    fire_data_init (&removed, timers, 20);
+    n_timers_add (timers, removing.interval, fire_cb, &removing);
+    removing.remove_id = n_timers_add (timers, removed.interval, fire_cb, &removed);
+
+    /* removes itself while it would repeat */
+    fire_data_init (&self, timers, 10);
+    self.repeat = 10;
+    id = n_timers_add (timers, self.interval, fire_cb, &self);
+    self.remove_id = id;
+
+    fail_unless (n_timers_size (timers) == 4);
+    run_until_empty (timers);
+
+    fail_unless (repeat.fired == 3);
+    fail_unless (repeat.early == FALSE);
+    fail_unless (removing.fired == 1);
+    fail_unless (removed.fired == 0);
+    fail_unless (self.fired == 1);
+    fail_unless (n_timers_remove (timers, id) == FALSE);
+
+    /* removed before firing */
+    fire_data_init (&removed, timers, 10);
+    id = n_timers_add (timers, removed.interval, fire_cb, &removed);
+    fail_unless (n_timers_remove (timers, id) == TRUE);
+    fail_unless (n_timers_size (timers) == 0);
+
+    n_timers_free (timers);
+}
+END_TEST
+
+START_TEST (test_coalesce)
+{
+    FireData first;
+    FireData second;
+
+    NTimers *timers = n_timers_new ();
+
+    /* deadlines within the same resolution period fire in one wakeup */
+    fire_data_init (&first, timers, 4 * N_TIMER_RESOLUTION_MS - 1);
+    fire_data_init (&second, timers, 4 * N_TIMER_RESOLUTION_MS);
+    n_timers_add (timers, second.interval, fire_cb, &second);
+    n_timers_add (timers, first.interval, fire_cb, &first);
+
+    while (first.fired == 0 && second.fired == 0)
+        g_main_context_iteration (NULL, TRUE);
+
+    fail_unless (first.fired == 1);
+    fail_unless (second.fired == 1);
+    fail_unless (n_timers_size (timers) == 0);
+
+    /* pending timers are released with the wheel */
+    fire_data_init (&first, timers, 1000);
+    n_timers_add (timers, first.interval, fire_cb, &first);
+    n_timers_free (timers);
+    fail_unless (first.fired == 0);
+}
+END_TEST
+
+static gboolean
+run_at_cb (gpointer userdata)
+{
+    gint64 *fired = userdata;
+
+    *fired = g_get_monotonic_time ();
+    return TRUE;
+}
+
+START_TEST (test_run_at)
+{
+    gint64 fired = 0;
+    gint64 time = g_get_monotonic_time () + 3 * 1000 + 250;
+
+    /* the deadline is not rounded to the timer resolution */
+    n_timer_run_at (time, run_at_cb, &fired);
+
+    while (fired == 0)
+        g_main_context_iteration (NULL, TRUE);
+
+    fail_unless (fired >= time);
+    fail_unless (fired - time < N_TIMER_RESOLUTION_MS * 1000);
+
+    /* the source is removed after it ran */
+    fired = 0;
+    guint id = n_timer_run_at (0, run_at_cb, &fired);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (fired > 0);
+    fail_unless (g_main_context_find_source_by_id (NULL, id) == NULL);
+}
+END_TEST
+
+int
+main (int argc, char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    int num_failed = 0;
+    Suite *s = NULL;
+    TCase *tc = NULL;
+    SRunner *sr = NULL;
+
+    s = suite_create ("\tTimer tests");
+
+    tc = tcase_create ("ordering");
+    tcase_add_test (tc, test_order);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("repeat and remove");
+    tcase_add_test (tc, test_repeat_and_remove);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("coalescing");
+    tcase_add_test (tc, test_coalesce);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("precise timers");
+    tcase_add_test (tc, test_run_at);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
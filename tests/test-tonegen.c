@@ -0,0 +1,397 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <check.h>
+#include <glib.h>
+
+#include "src/plugins/tonegen/stream.h"
+#include "src/plugins/tonegen/tone.h"
+#include "src/plugins/tonegen/envelop.h"
+
+#define BLOCK      (256)
+#define SCALE      (1024ULL)
+#define MAX_ERROR  (1.0)
+#define CHUNK_US   (20000)
+#define VOLUME     (80)
+#define MAX_TONES  (3)
+#define DTMF_KEY   (100000)
+
+typedef struct _TestTone
+{
+    tone_type   type;
+    uint32_t    freq;
+    uint32_t    period;
+    uint32_t    play;
+    uint32_t    start;
+    uint32_t    duration;
+} TestTone;
+
+typedef struct _TestCase
+{
+    const char *name;
+    TestTone    tones[MAX_TONES];
+} TestCase;
+
+static const uint32_t rates[] = { 8000, 44100, 48000 };
+
+static const TestCase cases[] = {
+    { "dial", {
+        { TONE_DIAL, 425, 1000000, 1000000, 0, 0 } } },
+    { "busy", {
+        { TONE_BUSY, 425, 100000, 50000, 0, 0 } } },
+    { "error", {
+        { TONE_ERROR,  900, 300000, 100000,      0, 0 },
+        { TONE_ERROR, 1400, 300000, 100000, 100000, 0 },
+        { TONE_ERROR, 1800, 300000, 100000, 200000, 0 } } },
+    { "ended", {
+        { TONE_DIAL, 425, 1000000, 1000000, 10000, 333333 } } },
+    { "dtmf keys", {
+        { TONE_DTMF_L,  697, DTMF_KEY, DTMF_KEY, 0, DTMF_KEY },
+        { TONE_DTMF_H, 1209, DTMF_KEY, DTMF_KEY, 0, DTMF_KEY } } }
+};
+
+/*
+ * Compares the block gain with envelop_apply() for the samples of a
+ * tone starting at 0 that fall in [from, to) usec, the times taken the
+ * same way the tone renderer does.
+ */
+static void
+compare_envelop (union envelop *envelop, uint32_t rate, uint32_t from,
+                 uint32_t to)
+{
+    float     in[BLOCK];
+    float     acc[BLOCK];
+    uint32_t  t[BLOCK];
+    uint64_t  dt = (1000000ULL * SCALE) / rate;
+    uint64_t  i  = ((uint64_t) from * SCALE + dt - 1) / dt;
+    int32_t   expected;
+    int       n, j;
+
+    while ((uint32_t) ((i * dt) / SCALE) < to) {
+        for (n = 0; n < BLOCK && (uint32_t) (((i + n) * dt) / SCALE) < to; n++) {
+            t[n]   = (uint32_t) (((i + n) * dt) / SCALE);
+            in[n]  = (float) ((int) ((i + n) * 7919 % 40000) - 20000);
+            acc[n] = 0.0f;
+        }
+
+        envelop_apply_block (envelop, acc, in, n, t);
+
+        for (j = 0; j < n; j++) {
+            expected = envelop_apply (envelop, (int32_t) in[j], t[j]);
+            fail_unless (fabs (acc[j] - expected) <= MAX_ERROR,
+                "%u Hz at %u usec: block gives %.1f, scalar %d",
+                rate, t[j], acc[j], expected);
+        }
+
+        i += n;
+    }
+}
+
+static void
+stream_setup (struct stream *stream, uint32_t rate, pa_sample_format_t format)
+{
+    memset (stream, 0, sizeof (*stream));
+    stream->name      = (char*) "test";
+    stream->rate      = rate;
+    stream->format    = format;
+    stream->framesize = format == PA_SAMPLE_FLOAT32NE ? sizeof (float) : sizeof (int16_t);
+}
+
+static void
+stream_teardown (struct stream *stream)
+{
+    if (stream->data)
+        tone_destroy_callback (stream->data);
+    stream->data = NULL;
+}
+
+/* the keys are chained one after another like dtmf_play does */
+static void
+setup_tones (struct stream *stream, const TestCase *c)
+{
+    const TestTone *t = NULL;
+    guint           i, k;
+
+    for (k = 0; k < (strcmp (c->name, "dtmf keys") ? 1 : 5); k++) {
+        for (i = 0; i < MAX_TONES; i++) {
+            t = &c->tones[i];
+            if (t->type != TONE_UNDEFINED)
+                fail_unless (tone_create (stream, t->type, t->freq, VOLUME,
+                                          t->period, t->play, t->start,
+                                          t->duration) != NULL);
+        }
+    }
+}
+
+/* renders the tones of the case in stream writes of CHUNK_US */
+static guint8*
+render_case (const TestCase *c, uint32_t freq, uint32_t rate,
+             pa_sample_format_t format, bool block, int frames)
+{
+    struct stream stream;
+    TestCase      single;
+    guint8       *buf   = NULL;
+    int           chunk = (int) ((uint64_t) rate * CHUNK_US / 1000000);
+    int           done  = 0;
+
+    stream_setup (&stream, rate, format);
+    tone_set_block_synthesis (block);
+
+    if (c == NULL) {
+        memset (&single, 0, sizeof (single));
+        single.name     = "single";
+        single.tones[0] = (TestTone) { TONE_DIAL, freq, 1000000, 1000000, 0, 0 };
+        c = &single;
+    }
+
+    setup_tones (&stream, c);
+    buf = g_malloc ((gsize) frames * stream.framesize);
+
+    for (done = 0; done < frames; done += chunk) {
+        chunk = MIN (chunk, frames - done);
+        stream.time = tone_write_callback (&stream, buf + (gsize) done * stream.framesize, chunk);
+    }
+
+    stream_teardown (&stream);
+
+    return buf;
+}
+
+static double
+sample_at (const guint8 *buf, pa_sample_format_t format, int i)
+{
+    if (format == PA_SAMPLE_FLOAT32NE)
+        return ((const float*) buf)[i] * 32768.0;
+
+    return ((const int16_t*) buf)[i];
+}
+
+/*
+ * Compares the block renderer with the scalar one for a case, or a
+ * single tone of freq when no case is given, over frames samples.
+ */
+static void
+compare_tones (const TestCase *c, uint32_t freq, uint32_t rate,
+               pa_sample_format_t format, int frames, double max_error)
+{
+    guint8 *block  = NULL;
+    guint8 *scalar = NULL;
+    double  error  = 0.0;
+    int     i;
+
+    block  = render_case (c, freq, rate, format, true, frames);
+    scalar = render_case (c, freq, rate, format, false, frames);
+
+    for (i = 0; i < frames; i++) {
+        error = fabs (sample_at (block, format, i) - sample_at (scalar, format, i));
+        fail_unless (error <= max_error,
+            "%s at %u Hz, %s: block differs from scalar by %.1f at sample %d",
+            c ? c->name : "single", rate,
+            format == PA_SAMPLE_FLOAT32NE ? "f32" : "s16", error, i);
+    }
+
+    g_free (block);
+    g_free (scalar);
+}
+
+START_TEST (test_envelop_ramp)
+{
+    union envelop *envelop = NULL;
+    guint          r;
+
+    fail_unless (envelop_init () == 0);
+
+    /* ramps of 10 ms on a tone of one second */
+    envelop = envelop_create (ENVELOP_RAMP_LINEAR, 10000, 0, 1000000);
+    fail_unless (envelop != NULL);
+
+    for (r = 0; r < G_N_ELEMENTS (rates); r++) {
+        compare_envelop (envelop, rates[r], 0, 20000);
+        compare_envelop (envelop, rates[r], 495000, 505000);
+        compare_envelop (envelop, rates[r], 980000, 1010000);
+    }
+
+    envelop_destroy (envelop);
+    envelop_exit ();
+}
+END_TEST
+
+START_TEST (test_envelop_update)
+{
+    union envelop *envelop = NULL;
+    guint          r;
+
+    fail_unless (envelop_init () == 0);
+
+    /* a tone stopped early ramps down within 10 ms of the new end */
+    envelop = envelop_create (ENVELOP_RAMP_LINEAR, 10000, 0, 1000000);
+    fail_unless (envelop != NULL);
+    envelop_update (envelop, 10000, 500000);
+
+    for (r = 0; r < G_N_ELEMENTS (rates); r++) {
+        compare_envelop (envelop, rates[r], 0, 20000);
+        compare_envelop (envelop, rates[r], 480000, 520000);
+        compare_envelop (envelop, rates[r], 980000, 1010000);
+    }
+
+    /* a ramp shorter than a step of the ramp-up */
+    envelop_update (envelop, 150, 300000);
+
+    for (r = 0; r < G_N_ELEMENTS (rates); r++)
+        compare_envelop (envelop, rates[r], 299000, 301000);
+
+    envelop_destroy (envelop);
+    envelop_exit ();
+}
+END_TEST
+
+START_TEST (test_tone_table)
+{
+    guint r, i;
+
+    fail_unless (tone_init () == 0);
+    fail_unless (envelop_init () == 0);
+
+    /* the table backend plays the same samples in both renderers, only
+       the float envelop and the rounding differ */
+    for (r = 0; r < G_N_ELEMENTS (rates); r++) {
+        for (i = 0; i < G_N_ELEMENTS (cases); i++) {
+            compare_tones (&cases[i], 0, rates[r], PA_SAMPLE_S16NE, rates[r], 4.0);
+            compare_tones (&cases[i], 0, rates[r], PA_SAMPLE_FLOAT32NE, rates[r], 4.0);
+        }
+    }
+
+    tone_exit ();
+    envelop_exit ();
+}
+END_TEST
+
+START_TEST (test_tone_singen)
+{
+    struct stream filler;
+    guint         r;
+    uint32_t      freq;
+
+    fail_unless (tone_init () == 0);
+    fail_unless (envelop_init () == 0);
+
+    /* tones playing all the tables there are leave the sine generator
+       for the rest */
+    for (r = 0; r < G_N_ELEMENTS (rates); r++) {
+        stream_setup (&filler, rates[r], PA_SAMPLE_S16NE);
+
+        for (freq = 100; freq < 100 + 40 * 10; freq += 10)
+            fail_unless (tone_create (&filler, TONE_DIAL, freq, VOLUME, 1000000,
+                                      1000000, 0, 0) != NULL);
+
+        /* the integer recurrence of the scalar path rounds down at
+           every sample, so allow for some drift over 100 ms */
+        compare_tones (NULL, 425, rates[r], PA_SAMPLE_S16NE, rates[r] / 10, 4.0);
+        compare_tones (NULL, 425, rates[r], PA_SAMPLE_FLOAT32NE, rates[r] / 10, 4.0);
+
+        stream_teardown (&filler);
+    }
+
+    tone_exit ();
+    envelop_exit ();
+}
+END_TEST
+
+START_TEST (test_tone_wavetables)
+{
+    struct stream  stream;
+    struct tone   *tone = NULL;
+    uint32_t       freq;
+
+    fail_unless (tone_init () == 0);
+    fail_unless (envelop_init () == 0);
+    stream_setup (&stream, 8000, PA_SAMPLE_S16NE);
+
+    /* prepared tables take their room for good */
+    fail_unless (tone_prepare_table (697, 8000));
+    fail_unless (tone_prepare_table (1209, 8000));
+
+    /* tables nobody plays make way for new frequencies */
+    for (freq = 100; freq < 100 + 40 * 10; freq += 10) {
+        tone = tone_create (&stream, TONE_DIAL, freq, VOLUME, 1000000, 1000000, 0, 0);
+        fail_unless (tone != NULL);
+        fail_unless (tone->backend == BACKEND_TABLE);
+        tone_destroy (tone, true);
+    }
+
+    /* a table a tone plays stays, the rest go to the sine generator */
+    for (freq = 100; freq < 100 + 40 * 10; freq += 10) {
+        tone = tone_create (&stream, TONE_DIAL, freq, VOLUME, 1000000, 1000000, 0, 0);
+        fail_unless (tone != NULL);
+        fail_unless (tone->backend == (freq < 100 + 30 * 10 ? BACKEND_TABLE : BACKEND_SINGEN));
+    }
+
+    tone = tone_create (&stream, TONE_DTMF_L, 697, VOLUME, DTMF_KEY, DTMF_KEY, 0, DTMF_KEY);
+    fail_unless (tone != NULL);
+    fail_unless (tone->backend == BACKEND_TABLE);
+
+    stream_teardown (&stream);
+
+    /* and once the tones are gone there is room again */
+    stream_setup (&stream, 11025, PA_SAMPLE_S16NE);
+    tone = tone_create (&stream, TONE_DIAL, 5000, VOLUME, 1000000, 1000000, 0, 0);
+    fail_unless (tone != NULL);
+    fail_unless (tone->backend == BACKEND_TABLE);
+    stream_teardown (&stream);
+
+    tone_exit ();
+    envelop_exit ();
+}
+END_TEST
+
+int
+main (int argc, char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    int num_failed = 0;
+    Suite *s = NULL;
+    TCase *tc = NULL;
+    SRunner *sr = NULL;
+
+    s = suite_create ("\tTonegen tests");
+
+    tc = tcase_create ("envelop");
+    tcase_add_test (tc, test_envelop_ramp);
+    tcase_add_test (tc, test_envelop_update);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("tone");
+    tcase_add_test (tc, test_tone_table);
+    tcase_add_test (tc, test_tone_singen);
+    tcase_add_test (tc, test_tone_wavetables);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,6 +2,7 @@
 #include <check.h>
 
 #include "src/include/ngf/value.h"
+#include "src/ngf/value-internal.h"
 
 START_TEST (test_value_create)
 {
@@ -165,6 +166,86 @@ START_TEST (test_string)
 }
 END_TEST
 
+START_TEST (test_string_storage)
+{
+    NValue *value = n_value_new ();
+    NValue *copy = NULL;
+    const char *long_str = "/usr/share/sounds/jolla-ringtones/stereo/jolla-ringtone.ogg";
+
+    /* short strings are stored inline */
+    n_value_set_string (value, "ringtone");
+    copy = n_value_copy (value);
+    fail_unless (n_value_get_string (copy) != n_value_get_string (value));
+    fail_unless (strcmp (n_value_get_string (copy), "ringtone") == 0);
+    fail_unless (n_value_equals (value, copy));
+    n_value_free (copy);
+
+    /* setting from own contents */
+    n_value_set_string (value, n_value_get_string (value) + 4);
+    fail_unless (strcmp (n_value_get_string (value), "tone") == 0);
+
+    /* long strings are shared between copies */
+    n_value_set_string (value, long_str);
+    copy = n_value_copy (value);
+    fail_unless (n_value_get_string (copy) == n_value_get_string (value));
+    fail_unless (n_value_equals (value, copy));
+    n_value_free (value);
+    fail_unless (strcmp (n_value_get_string (copy), long_str) == 0);
+
+    n_value_set_string (copy, n_value_get_string (copy) + 1);
+    fail_unless (strcmp (n_value_get_string (copy), long_str + 1) == 0);
+
+    /* changing type releases the string */
+    n_value_set_int (copy, 1);
+    fail_unless (n_value_get_string (copy) == NULL);
+    fail_unless (n_value_get_int (copy) == 1);
+    n_value_free (copy);
+}
+END_TEST
+
+START_TEST (test_value_pool)
+{
+    NValuePool *pool = n_value_pool_new ();
+    NValue *a = n_value_new ();
+    NValue *b = n_value_new ();
+    NValue *c = n_value_new ();
+    const char *long_str = "/usr/share/sounds/jolla-ringtones/stereo/jolla-ringtone.ogg";
+    gsize buffer_size = 0;
+
+    n_value_set_string (a, long_str);
+    n_value_set_string (b, long_str);
+    n_value_set_string (c, "ringtone");
+    fail_unless (n_value_get_string (a) != n_value_get_string (b));
+
+    /* equal strings end up sharing one buffer */
+    fail_unless (n_value_pool_intern (pool, a) == 0);
+    n_value_heap_size (b, &buffer_size, NULL);
+    fail_unless (buffer_size > strlen (long_str));
+    fail_unless (n_value_pool_intern (pool, b) == buffer_size);
+    fail_unless (n_value_get_string (a) == n_value_get_string (b));
+    fail_unless (n_value_pool_intern (pool, b) == 0);
+
+    /* inline strings are not pooled */
+    fail_unless (n_value_pool_intern (pool, c) == 0);
+    n_value_heap_size (c, &buffer_size, NULL);
+    fail_unless (buffer_size == 0);
+    fail_unless (n_value_pool_size (pool) == 1);
+
+    /* strings stay pooled while used */
+    n_value_free (a);
+    n_value_pool_prune (pool);
+    fail_unless (n_value_pool_size (pool) == 1);
+    fail_unless (strcmp (n_value_get_string (b), long_str) == 0);
+
+    n_value_free (b);
+    n_value_pool_prune (pool);
+    fail_unless (n_value_pool_size (pool) == 0);
+
+    n_value_free (c);
+    n_value_pool_free (pool);
+}
+END_TEST
+
 START_TEST (test_int)
 {
     NValue *value = NULL;
@@ -332,6 +413,14 @@ main (int agrc, char* argv[])
     tcase_add_test (tc, test_pointer);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("String storage");
+    tcase_add_test (tc, test_string_storage);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Value pool");
+    tcase_add_test (tc, test_value_pool);
+    suite_add_tcase (s, tc);
+
     tc = tcase_create ("To string");
     tcase_add_test (tc, test_to_string);
     suite_add_tcase (s, tc);
@@ -0,0 +1,174 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include "src/ngf/wakeup-internal.h"
+#include "src/ngf/metrics-internal.h"
+
+typedef struct _Lookup
+{
+    const char *name;
+    guint64     value;
+    gboolean    found;
+} Lookup;
+
+static void
+lookup_cb (const char *name, guint64 value, void *userdata)
+{
+    Lookup *lookup = userdata;
+
+    if (g_str_equal (name, lookup->name)) {
+        lookup->value = value;
+        lookup->found = TRUE;
+    }
+}
+
+static guint64
+metric_value (NMetrics *metrics, const char *name)
+{
+    Lookup lookup = { name, 0, FALSE };
+
+    n_metrics_foreach (metrics, lookup_cb, &lookup);
+    return lookup.value;
+}
+
+typedef struct _Source
+{
+    const char *origin;         /* noted by the callback */
+    const char *fallback;       /* noted as the default origin */
+    gboolean    fired;
+} Source;
+
+static gboolean
+source_cb (gpointer userdata)
+{
+    Source *source = userdata;
+
+    if (source->fallback)
+        n_wakeups_note_default (source->fallback);
+    if (source->origin) {
+        n_wakeup_note (source->origin);
+        n_wakeup_note ("late");
+    }
+
+    source->fired = TRUE;
+    return FALSE;
+}
+
+static gboolean
+silent_cb (gpointer userdata)
+{
+    (void) userdata;
+    return FALSE;
+}
+
+static void
+run_timeout (const char *origin, const char *fallback)
+{
+    Source source = { origin, fallback, FALSE };
+
+    g_timeout_add (5, source_cb, &source);
+    while (!source.fired)
+        g_main_context_iteration (NULL, TRUE);
+
+    /* the wakeup is attributed by the next poll */
+    g_timeout_add (1, silent_cb, NULL);
+    g_main_context_iteration (NULL, TRUE);
+}
+
+START_TEST (test_origins)
+{
+    NMetrics *metrics = n_metrics_new ();
+
+    /* nothing is counted before enabling */
+    n_wakeup_note ("test");
+
+    n_wakeups_enable (metrics);
+
+    run_timeout ("test", NULL);
+    fail_unless (metric_value (metrics, "wakeups.idle.test") == 1);
+    fail_unless (metric_value (metrics, "wakeups.idle.late") == 0);
+    fail_unless (metric_value (metrics, "wakeups.active.test") == 0);
+
+    n_wakeups_set_active (TRUE);
+    run_timeout ("test", NULL);
+    fail_unless (metric_value (metrics, "wakeups.active.test") == 1);
+    fail_unless (metric_value (metrics, "wakeups.idle.test") == 1);
+    fail_unless (metric_value (metrics, "wakeups.active_rate") > 0);
+    fail_unless (metric_value (metrics, "wakeups.idle_rate") > 0);
+
+    n_wakeups_disable ();
+
+    /* the poll function is restored */
+    run_timeout ("test", NULL);
+    fail_unless (metric_value (metrics, "wakeups.active.test") == 1);
+
+    n_metrics_free (metrics);
+}
+END_TEST
+
+START_TEST (test_default_origin)
+{
+    NMetrics *metrics = n_metrics_new ();
+
+    n_wakeups_enable (metrics);
+
+    run_timeout (NULL, "default");
+    fail_unless (metric_value (metrics, "wakeups.idle.default") == 1);
+
+    /* a noted origin wins over the default */
+    run_timeout ("test", "default");
+    fail_unless (metric_value (metrics, "wakeups.idle.default") == 1);
+    fail_unless (metric_value (metrics, "wakeups.idle.test") == 1);
+
+    n_wakeups_disable ();
+    n_metrics_free (metrics);
+}
+END_TEST
+
+int
+main (int argc, char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    int num_failed = 0;
+    Suite *s = NULL;
+    TCase *tc = NULL;
+    SRunner *sr = NULL;
+
+    s = suite_create ("\tWakeup tests");
+
+    tc = tcase_create ("origins");
+    tcase_add_test (tc, test_origins);
+    tcase_add_test (tc, test_default_origin);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
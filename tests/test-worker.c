@@ -0,0 +1,211 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2018 Jolla Ltd.
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include "src/ngf/worker-internal.h"
+
+typedef struct _JobData
+{
+    GThread  *main_thread;
+    GThread  *ran_in;           /* thread the job function ran in */
+    gboolean  done_in_main;
+    guint     done;
+    guint    *freed;
+    GMutex   *gate;             /* held by the test to keep the job running */
+    gint      started;
+} JobData;
+
+static void
+job_cb (gpointer userdata)
+{
+    JobData *data = userdata;
+
+    g_atomic_int_set (&data->started, 1);
+    data->ran_in = g_thread_self ();
+
+    if (data->gate) {
+        g_mutex_lock (data->gate);
+        g_mutex_unlock (data->gate);
+    }
+}
+
+static void
+job_done_cb (gpointer userdata)
+{
+    JobData *data = userdata;
+
+    data->done++;
+    data->done_in_main = (g_thread_self () == data->main_thread);
+}
+
+static void
+job_free_cb (gpointer userdata)
+{
+    JobData *data = userdata;
+
+    (*data->freed)++;
+}
+
+static void
+run_until_done (NWorkers *workers)
+{
+    while (n_workers_size (workers) > 0)
+        g_main_context_iteration (NULL, TRUE);
+}
+
+START_TEST (test_submit)
+{
+    NWorkers *workers = n_workers_new (2);
+    JobData   data[4];
+    guint     freed = 0;
+    int       i;
+
+    memset (data, 0, sizeof (data));
+    for (i = 0; i < 4; i++) {
+        data[i].main_thread = g_thread_self ();
+        data[i].freed = &freed;
+        fail_unless (n_workers_submit (workers, job_cb, job_done_cb, &data[i], job_free_cb) > 0);
+    }
+
+    /* nothing is delivered before the main loop runs */
+    fail_unless (n_workers_size (workers) == 4);
+    fail_unless (data[0].done == 0);
+
+    run_until_done (workers);
+
+    for (i = 0; i < 4; i++) {
+        fail_unless (data[i].done == 1);
+        fail_unless (data[i].done_in_main == TRUE);
+        fail_unless (data[i].ran_in != g_thread_self ());
+    }
+    fail_unless (freed == 4);
+
+    n_workers_free (workers);
+}
+END_TEST
+
+START_TEST (test_cancel)
+{
+    NWorkers *workers = n_workers_new (1);
+    GMutex    gate;
+    JobData   running, queued, finished;
+    guint     freed = 0;
+    guint     running_id, queued_id, finished_id;
+
+    memset (&running, 0, sizeof (running));
+    memset (&queued, 0, sizeof (queued));
+    memset (&finished, 0, sizeof (finished));
+    running.freed = queued.freed = finished.freed = &freed;
+
+    /* a finished job not yet delivered is dropped */
+    finished_id = n_workers_submit (workers, job_cb, job_done_cb, &finished, job_free_cb);
+    while (!g_atomic_int_get (&finished.started))
+        g_usleep (1000);
+    g_usleep (10000);
+    fail_unless (n_workers_cancel (workers, finished_id) == TRUE);
+    fail_unless (freed == 1);
+
+    /* the single thread is held by the first job, the second waits */
+    g_mutex_init (&gate);
+    g_mutex_lock (&gate);
+    running.gate = &gate;
+    running_id = n_workers_submit (workers, job_cb, job_done_cb, &running, job_free_cb);
+    queued_id = n_workers_submit (workers, job_cb, job_done_cb, &queued, job_free_cb);
+    while (!g_atomic_int_get (&running.started))
+        g_usleep (1000);
+
+    fail_unless (n_workers_running (workers, running_id) == TRUE);
+    fail_unless (n_workers_running (workers, queued_id) == FALSE);
+
+    fail_unless (n_workers_cancel (workers, queued_id) == TRUE);
+    fail_unless (freed == 2);
+    fail_unless (n_workers_cancel (workers, queued_id) == FALSE);
+
+    g_mutex_unlock (&gate);
+    fail_unless (n_workers_cancel (workers, running_id) == TRUE);
+    fail_unless (freed == 3);
+
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    fail_unless (running.done == 0 && queued.done == 0 && finished.done == 0);
+    fail_unless (queued.started == 0);
+    fail_unless (n_workers_size (workers) == 0);
+
+    n_workers_free (workers);
+    g_mutex_clear (&gate);
+}
+END_TEST
+
+START_TEST (test_free_pending)
+{
+    NWorkers *workers = n_workers_new (1);
+    JobData   data[8];
+    guint     freed = 0;
+    int       i;
+
+    memset (data, 0, sizeof (data));
+    for (i = 0; i < 8; i++) {
+        data[i].freed = &freed;
+        n_workers_submit (workers, job_cb, job_done_cb, &data[i], job_free_cb);
+    }
+
+    /* the data of every job is freed, none is delivered */
+    n_workers_free (workers);
+    fail_unless (freed == 8);
+    for (i = 0; i < 8; i++)
+        fail_unless (data[i].done == 0);
+}
+END_TEST
+
+int
+main (int argc, char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    int num_failed = 0;
+    Suite *s = NULL;
+    TCase *tc = NULL;
+    SRunner *sr = NULL;
+
+    s = suite_create ("\tWorker tests");
+
+    tc = tcase_create ("submit");
+    tcase_add_test (tc, test_submit);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("cancel");
+    tcase_add_test (tc, test_cancel);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("free with pending jobs");
+    tcase_add_test (tc, test_free_pending);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}